@@ -0,0 +1,327 @@
+#include <benchmark/benchmark.h>
+
+#include <jinja2cpp/filesystem_handler.h>
+#include <jinja2cpp/template.h>
+#include <jinja2cpp/template_env.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Allocations of the benchmark are reported to the tracked renders (see Settings::trackAllocations). Size of the block is stored in
+// front of it, so the deallocations are reported with their sizes too
+namespace
+{
+constexpr size_t AllocationHeaderSize = alignof(std::max_align_t);
+} // namespace
+
+void* operator new(size_t size)
+{
+    auto block = static_cast<char*>(std::malloc(size + AllocationHeaderSize));
+    if (!block)
+        throw std::bad_alloc();
+    *reinterpret_cast<size_t*>(block) = size;
+    jinja2::TrackAllocation(size);
+    return block + AllocationHeaderSize;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (!ptr)
+        return;
+    auto block = static_cast<char*>(ptr) - AllocationHeaderSize;
+    jinja2::TrackDeallocation(*reinterpret_cast<size_t*>(block));
+    std::free(block);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+using namespace jinja2;
+
+namespace
+{
+Template LoadTemplate(const std::string& source)
+{
+    Template tpl;
+    auto result = tpl.Load(source);
+    if (!result)
+        throw std::runtime_error(result.error().ToString());
+    return tpl;
+}
+
+void RenderLoop(benchmark::State& state, const Template& tpl, const ValuesMap& params)
+{
+    for (auto _ : state)
+    {
+        auto result = tpl.RenderAsString(params);
+        if (!result)
+        {
+            state.SkipWithError(result.error().ToString().c_str());
+            break;
+        }
+        benchmark::DoNotOptimize(result.value());
+    }
+}
+
+ValuesList MakeItems(int64_t count)
+{
+    ValuesList items;
+    for (int64_t n = 0; n < count; ++ n)
+        items.push_back(ValuesMap{{"id", n}, {"name", "item" + std::to_string(n)}, {"price", static_cast<double>(n) / 3}});
+    return items;
+}
+
+// Template of the specified number of the typical fragments
+std::string MakeSource(int64_t fragmentsCount)
+{
+    std::string source;
+    for (int64_t n = 0; n < fragmentsCount; ++ n)
+    {
+        source += "<h2>Section " + std::to_string(n) + "</h2>\n";
+        source += "{% if items %}<ul>{% for item in items | sort(attribute='name') %}<li class=\"{{ loop.cycle('odd', 'even') }}\">"
+                  "{{ item.name | title }}: {{ item.price | round(2) }}</li>{% endfor %}</ul>{% else %}{{ empty_text | default('none') }}{% endif %}\n";
+    }
+    return source;
+}
+
+void BM_Parse(benchmark::State& state)
+{
+    auto source = MakeSource(state.range(0));
+    for (auto _ : state)
+    {
+        Template tpl;
+        auto result = tpl.Load(source);
+        if (!result)
+        {
+            state.SkipWithError(result.error().ToString().c_str());
+            break;
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * source.size()));
+}
+BENCHMARK(BM_Parse)->RangeMultiplier(4)->Range(1, 256);
+
+void BM_RenderPlainText(benchmark::State& state)
+{
+    auto tpl = LoadTemplate(std::string(static_cast<size_t>(state.range(0)), 'a'));
+    RenderLoop(state, tpl, ValuesMap());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RenderPlainText)->RangeMultiplier(16)->Range(16, 64 << 10);
+
+void BM_RenderSubstitution(benchmark::State& state)
+{
+    auto tpl = LoadTemplate("{{ message }} from {{ user.name }} to {{ user.friends[0] }}!");
+    RenderLoop(state, tpl, {{"message", "Hello World"}, {"user", ValuesMap{{"name", "John"}, {"friends", ValuesList{"Jane", "Bob"}}}}});
+}
+BENCHMARK(BM_RenderSubstitution);
+
+void BM_RenderLoop(benchmark::State& state)
+{
+    auto tpl = LoadTemplate("{% for item in items %}{{ loop.index }}. {{ item.name }} - {{ item.price }}\n{% endfor %}");
+    RenderLoop(state, tpl, {{"items", MakeItems(state.range(0))}});
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RenderLoop)->RangeMultiplier(8)->Range(1, 4096);
+
+void BM_RenderMacro(benchmark::State& state)
+{
+    auto tpl = LoadTemplate(
+        "{% macro row(item, cls='row') %}<tr class=\"{{ cls }}\"><td>{{ item.id }}</td><td>{{ item.name }}</td></tr>{% endmacro %}"
+        "{% for item in items %}{{ row(item, cls=loop.cycle('odd', 'even')) }}{% endfor %}");
+    RenderLoop(state, tpl, {{"items", MakeItems(state.range(0))}});
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RenderMacro)->RangeMultiplier(8)->Range(1, 4096);
+
+// Environment with the 'base.j2tpl' layout, the 'page.j2tpl' which extends it, and the 'item.j2tpl' part to include
+void SetupEnvironment(TemplateEnv& env, MemoryFileSystem& fs)
+{
+    fs.AddFile("base.j2tpl", "<html><head>{% block head %}<title>{{ title }}</title>{% endblock %}</head>"
+                             "<body>{% block content %}{% endblock %}</body></html>");
+    fs.AddFile("page.j2tpl", "{% extends 'base.j2tpl' %}{% block content %}{% for item in items %}{{ item.name }}{% endfor %}{% endblock %}");
+    fs.AddFile("item.j2tpl", "<li>{{ item.id }}: {{ item.name }}</li>");
+    fs.AddFile("list.j2tpl", "<ul>{% for item in items %}{% include 'item.j2tpl' %}{% endfor %}</ul>");
+    env.AddFilesystemHandler(std::string(), fs);
+}
+
+void BM_RenderExtends(benchmark::State& state)
+{
+    TemplateEnv env;
+    MemoryFileSystem fs;
+    SetupEnvironment(env, fs);
+    auto tpl = env.LoadTemplate("page.j2tpl").value();
+    RenderLoop(state, tpl, {{"title", "Page"}, {"items", MakeItems(16)}});
+}
+BENCHMARK(BM_RenderExtends);
+
+void BM_RenderInclude(benchmark::State& state)
+{
+    TemplateEnv env;
+    MemoryFileSystem fs;
+    SetupEnvironment(env, fs);
+    auto tpl = env.LoadTemplate("list.j2tpl").value();
+    RenderLoop(state, tpl, {{"items", MakeItems(state.range(0))}});
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RenderInclude)->RangeMultiplier(8)->Range(1, 512);
+
+struct FilterCase
+{
+    const char* name;
+    const char* expression;
+};
+
+const FilterCase g_filterCases[] = {
+    {"abs", "{{ -number | abs }}"},
+    {"attr", "{{ user | attr('name') }}"},
+    {"batch", "{{ numbers | batch(3) | list | length }}"},
+    {"capitalize", "{{ text | capitalize }}"},
+    {"center", "{{ word | center(40) }}"},
+    {"default", "{{ missing | default('none') }}"},
+    {"dictsort", "{{ user | dictsort | length }}"},
+    {"escape", "{{ html | escape }}"},
+    {"first", "{{ numbers | first }}"},
+    {"float", "{{ number_text | float }}"},
+    {"format", "{{ '%s has %d items' | format(word, number) }}"},
+    {"groupby", "{{ items | groupby('parity') | length }}"},
+    {"int", "{{ number_text | int }}"},
+    {"join", "{{ words | join(', ') }}"},
+    {"last", "{{ numbers | last }}"},
+    {"length", "{{ text | length }}"},
+    {"list", "{{ word | list | length }}"},
+    {"lower", "{{ text | lower }}"},
+    {"map", "{{ words | map('upper') | join }}"},
+    {"max", "{{ numbers | max }}"},
+    {"min", "{{ numbers | min }}"},
+    {"pprint", "{{ user | pprint }}"},
+    {"reject", "{{ numbers | reject('odd') | list | length }}"},
+    {"rejectattr", "{{ items | rejectattr('parity') | list | length }}"},
+    {"replace", "{{ text | replace('fox', 'cat') }}"},
+    {"reverse", "{{ numbers | reverse | first }}"},
+    {"round", "{{ fraction | round(2) }}"},
+    {"select", "{{ numbers | select('odd') | list | length }}"},
+    {"selectattr", "{{ items | selectattr('parity') | list | length }}"},
+    {"slice", "{{ numbers | slice(3) | list | length }}"},
+    {"sort", "{{ words | sort | join }}"},
+    {"striptags", "{{ html | striptags }}"},
+    {"sum", "{{ numbers | sum }}"},
+    {"title", "{{ text | title }}"},
+    {"tojson", "{{ user | tojson }}"},
+    {"trim", "{{ padded | trim }}"},
+    {"truncate", "{{ text | truncate(16) }}"},
+    {"unique", "{{ words | unique | list | length }}"},
+    {"upper", "{{ text | upper }}"},
+    {"urlencode", "{{ text | urlencode }}"},
+    {"wordcount", "{{ text | wordcount }}"},
+    {"wordwrap", "{{ text | wordwrap(10) }}"},
+    {"xmlattr", "{{ user | xmlattr }}"},
+};
+
+void BM_Filter(benchmark::State& state)
+{
+    auto& filterCase = g_filterCases[state.range(0)];
+    state.SetLabel(filterCase.name);
+
+    ValuesList numbers;
+    for (int n = 0; n < 64; ++ n)
+        numbers.push_back(n * 7 % 64);
+    ValuesList items;
+    for (int n = 0; n < 64; ++ n)
+        items.push_back(ValuesMap{{"id", n}, {"parity", n % 2 == 1}});
+
+    auto tpl = LoadTemplate(filterCase.expression);
+    RenderLoop(state, tpl, {
+        {"number", 42},
+        {"number_text", "42.5"},
+        {"fraction", 3.14159},
+        {"word", "jinja2"},
+        {"text", "the quick brown fox jumps over the lazy dog"},
+        {"padded", "   the quick brown fox   "},
+        {"html", "<p>Fish &amp; <b>Chips</b></p>"},
+        {"words", ValuesList{"delta", "alpha", "charlie", "bravo", "alpha", "echo"}},
+        {"numbers", std::move(numbers)},
+        {"items", std::move(items)},
+        {"user", ValuesMap{{"name", "John"}, {"age", 42}, {"email", "john@example.com"}}},
+    });
+}
+BENCHMARK(BM_Filter)->DenseRange(0, static_cast<int>(sizeof(g_filterCases) / sizeof(g_filterCases[0])) - 1);
+
+struct AllocationCase
+{
+    const char* name;
+    const char* source;
+};
+
+const AllocationCase g_allocationCases[] = {
+    {"plain_text", "<html><body><p>Lorem ipsum dolor sit amet, consectetur adipiscing elit</p></body></html>"},
+    {"substitution", "{{ title }}: {{ items[0].name }}"},
+    {"loop", "{% for item in items %}{{ item.id }}. {{ item.name }}\n{% endfor %}"},
+    {"filters", "{{ items | map(attribute='name') | join(', ') | upper }}"},
+    {"macro", "{% macro row(item) %}<td>{{ item.name }}</td>{% endmacro %}{% for item in items %}{{ row(item) }}{% endfor %}"},
+    {"include", "{% for item in items %}{% include 'item.j2tpl' %}{% endfor %}"},
+};
+
+// Heap usage per render call, reported as the 'allocs', 'bytes' and 'peak_bytes' counters
+void BM_RenderAllocations(benchmark::State& state)
+{
+    auto& allocationCase = g_allocationCases[state.range(0)];
+    state.SetLabel(allocationCase.name);
+
+    TemplateEnv env;
+    MemoryFileSystem fs;
+    SetupEnvironment(env, fs);
+    fs.AddFile("case.j2tpl", allocationCase.source);
+    env.GetSettings().trackAllocations = true;
+
+    RenderAllocationStats total;
+    uint64_t rendersCount = 0;
+    env.SetAllocationListener([&total, &rendersCount](const std::string&, const RenderAllocationStats& stats) {
+        total.allocations += stats.allocations;
+        total.allocatedBytes += stats.allocatedBytes;
+        total.peakBytes = std::max(total.peakBytes, stats.peakBytes);
+        ++ rendersCount;
+    });
+
+    auto tpl = env.LoadTemplate("case.j2tpl");
+    if (!tpl)
+    {
+        state.SkipWithError(tpl.error().ToString().c_str());
+        return;
+    }
+    RenderLoop(state, tpl.value(), {{"title", "Page"}, {"items", MakeItems(16)}});
+
+    if (rendersCount == 0)
+        return;
+    state.counters["allocs"] = static_cast<double>(total.allocations) / rendersCount;
+    state.counters["bytes"] = static_cast<double>(total.allocatedBytes) / rendersCount;
+    state.counters["peak_bytes"] = static_cast<double>(total.peakBytes);
+}
+BENCHMARK(BM_RenderAllocations)->DenseRange(0, static_cast<int>(sizeof(g_allocationCases) / sizeof(g_allocationCases[0])) - 1);
+
+// Environment is shared by the threads of the benchmark
+void BM_EnvCacheHit(benchmark::State& state)
+{
+    static TemplateEnv env;
+    static MemoryFileSystem fs;
+    static bool isSetUp = (SetupEnvironment(env, fs), env.LoadTemplate("page.j2tpl").has_value());
+    if (!isSetUp)
+    {
+        state.SkipWithError("Can't load 'page.j2tpl'");
+        return;
+    }
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(env.LoadTemplate("page.j2tpl"));
+}
+BENCHMARK(BM_EnvCacheHit)->ThreadRange(1, 16)->UseRealTime();
+} // namespace
+
+BENCHMARK_MAIN();
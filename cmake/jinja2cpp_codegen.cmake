@@ -0,0 +1,37 @@
+include(CMakeParseArguments)
+
+set(JINJA2CPP_CODEGEN_SOURCE_DIR ${CMAKE_CURRENT_LIST_DIR}/../src)
+
+# Generates the render code of the template with jinja2cpp_codegen tool:
+#   Jinja2CppGenerateTemplate(<target> <template file> FUNCTION <name> [NAMESPACE <namespace>] [OPTIONS <tool options>...])
+# Generated header and source ('<name>.h' and '<name>.cpp' in the 'jinja2cpp_generated' subdir of the current binary dir) are added
+# to the target. They contain the render function of the template, the template text and its compiled image. OPTIONS are passed to
+# the tool as is (e.g. --trim-blocks, --lstrip-blocks, --autoescape).
+# Generated code uses the internal headers of the library, so it's meant for the in-tree builds: the target should be linked with
+# jinja2cpp and ${JINJA2CPP_PRIVATE_LIBS} (the same way as the unit tests are)
+function (Jinja2CppGenerateTemplate Target Template)
+    cmake_parse_arguments(J2CPP_CODEGEN "" "FUNCTION;NAMESPACE" "OPTIONS" ${ARGN})
+    if (NOT J2CPP_CODEGEN_FUNCTION)
+        message(FATAL_ERROR "Jinja2CppGenerateTemplate: FUNCTION name is required for '${Template}'")
+    endif ()
+
+    get_filename_component(_templatePath ${Template} ABSOLUTE)
+    set(_outputDir ${CMAKE_CURRENT_BINARY_DIR}/jinja2cpp_generated)
+    set(_header ${_outputDir}/${J2CPP_CODEGEN_FUNCTION}.h)
+    set(_source ${_outputDir}/${J2CPP_CODEGEN_FUNCTION}.cpp)
+    set(_toolArgs --name ${J2CPP_CODEGEN_FUNCTION})
+    if (J2CPP_CODEGEN_NAMESPACE)
+        list(APPEND _toolArgs --namespace ${J2CPP_CODEGEN_NAMESPACE})
+    endif ()
+
+    add_custom_command(
+            OUTPUT ${_header} ${_source}
+            COMMAND ${CMAKE_COMMAND} -E make_directory ${_outputDir}
+            COMMAND jinja2cpp_codegen ${_toolArgs} ${J2CPP_CODEGEN_OPTIONS} ${_templatePath} ${_header} ${_source}
+            DEPENDS jinja2cpp_codegen ${_templatePath}
+            COMMENT "Generating render function '${J2CPP_CODEGEN_FUNCTION}' for ${Template}"
+    )
+
+    set_property(TARGET ${Target} APPEND PROPERTY SOURCES ${_header} ${_source})
+    target_include_directories(${Target} PRIVATE ${_outputDir} ${JINJA2CPP_CODEGEN_SOURCE_DIR})
+endfunction ()
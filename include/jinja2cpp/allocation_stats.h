@@ -0,0 +1,42 @@
+#ifndef JINJA2CPP_ALLOCATION_STATS_H
+#define JINJA2CPP_ALLOCATION_STATS_H
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace jinja2
+{
+//! Heap usage of the single render call (see \ref Settings::trackAllocations)
+struct RenderAllocationStats
+{
+    //! Number of the allocations made by the render
+    uint64_t allocations = 0;
+    //! Number of the deallocations made by the render
+    uint64_t deallocations = 0;
+    //! Total size of the allocations in bytes
+    uint64_t allocatedBytes = 0;
+    //! Maximum size of the memory held by the render at once, in bytes
+    uint64_t peakBytes = 0;
+};
+
+/*!
+ * \brief Report the heap allocation to the tracked render running on the current thread (if any)
+ *
+ * The library doesn't intercept the allocations itself. The application calls this function (and \ref TrackDeallocation)
+ * from its allocation hooks, e.g. from the replaced global `operator new` and `operator delete`. The function doesn't
+ * allocate and costs a single thread-local read if no tracked render is running on the thread.
+ *
+ * @param bytes Size of the allocated block
+ */
+JINJA2CPP_EXPORT void TrackAllocation(size_t bytes) noexcept;
+/*!
+ * \brief Report the heap deallocation to the tracked render running on the current thread (if any)
+ *
+ * @param bytes Size of the freed block. Zero if it's unknown, then the block isn't subtracted from the memory held by the render
+ */
+JINJA2CPP_EXPORT void TrackDeallocation(size_t bytes) noexcept;
+} // jinja2
+
+#endif // JINJA2CPP_ALLOCATION_STATS_H
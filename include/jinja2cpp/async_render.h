@@ -0,0 +1,205 @@
+#ifndef JINJA2CPP_ASYNC_RENDER_H
+#define JINJA2CPP_ASYNC_RENDER_H
+
+#include "config.h"
+#include "template.h"
+#include "value.h"
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+
+namespace jinja2
+{
+class ValuePromise;
+
+/*!
+ * \brief Value which is produced asynchronously (e.g. fetched from the cache, RPC or DB)
+ *
+ * Pending value is created by \ref ValuePromise, which is given to the asynchronous operation. Copies of the pending value
+ * share the same result. Default constructed pending value is ready and holds the empty value.
+ */
+class JINJA2CPP_EXPORT PendingValue
+{
+public:
+    //! Default constructor. Constructs the ready empty value
+    PendingValue() = default;
+
+    //! Check whether the value (or the error) is produced
+    bool IsReady() const;
+    /*!
+     * \brief Get the produced value. Waits until the value is ready
+     *
+     * Rethrows the exception passed to \ref ValuePromise::SetException
+     *
+     * @return Produced value
+     */
+    Value Get() const;
+    /*!
+     * \brief Register the handler which is called once the value is ready
+     *
+     * Handler is called on the thread which sets the value, or immediately if the value is ready already
+     *
+     * @param handler  Handler to call
+     */
+    void OnReady(std::function<void ()> handler) const;
+
+private:
+    friend class ValuePromise;
+    struct State;
+
+    explicit PendingValue(std::shared_ptr<State> state)
+        : m_state(std::move(state))
+    {
+    }
+
+private:
+    std::shared_ptr<State> m_state;
+};
+
+/*!
+ * \brief Producer side of the \ref PendingValue
+ *
+ * Only the first result passed to the promise is kept. Promise destroyed without the result sets the broken promise error
+ * (`std::future_error`) to its pending value, so the renders which wait for it aren't stuck forever.
+ */
+class JINJA2CPP_EXPORT ValuePromise
+{
+public:
+    //! Constructor
+    ValuePromise();
+    //! Destructor
+    ~ValuePromise();
+
+    ValuePromise(const ValuePromise&) = delete;
+    ValuePromise& operator=(const ValuePromise&) = delete;
+    ValuePromise(ValuePromise&& other) noexcept;
+    ValuePromise& operator=(ValuePromise&& other) noexcept;
+
+    //! Get the pending value bound to this promise
+    PendingValue GetPendingValue() const;
+    /*!
+     * \brief Set the produced value and call the handlers of the pending value
+     *
+     * @param val  Produced value
+     */
+    void SetValue(Value val);
+    /*!
+     * \brief Set the error of the operation and call the handlers of the pending value
+     *
+     * @param ex  Exception which is rethrown by \ref PendingValue::Get
+     */
+    void SetException(std::exception_ptr ex);
+
+private:
+    void Break();
+
+private:
+    std::shared_ptr<PendingValue::State> m_state;
+};
+
+/*!
+ * \brief Get the asynchronously produced value from the user callable or the list enumerator
+ *
+ * Should be called from the \ref UserCallable (or the \ref ListEnumerator) which needs the pending value. Within the
+ * render started by \ref AsyncRenderer the value which isn't ready yet is replaced by the empty value and the render goes on,
+ * so the independent requests of the template are started together. Output of such render is dropped and the render is
+ * suspended until all the values it requested are ready, so the thread can proceed with the other renders. Within the
+ * ordinary render calls the function waits for the value.
+ *
+ * Suspended render is resumed by rendering the template again from the beginning, with the values requested by the previous
+ * attempts. `start` is called only once for each key within the render, so the template is rendered once more for each level
+ * of the dependent requests (e.g. the request which takes the result of another request as the argument). Therefore the
+ * requests should be identified by the keys, and the callables shouldn't have side effects other than the requests.
+ * Requests made after the empty stand-in value changed the control flow may be started needlessly.
+ *
+ * ```c++
+ * jinja2::UserCallable fetchUser{[&db](const jinja2::UserCallableParams& params) {
+ *     auto id = params["id"].get<int64_t>();
+ *     return jinja2::AwaitValue("user:" + std::to_string(id), [&db, id]() { return db.FetchUserAsync(id); });
+ * }, {jinja2::ArgInfo{"id"}}};
+ * ```
+ *
+ * @param key    Key of the request within the render. Requests with the same key share the value
+ * @param start  Function which starts the asynchronous operation and returns the pending value of it
+ *
+ * @return Value produced by the operation, or the empty value if the render is suspended
+ */
+JINJA2CPP_EXPORT Value AwaitValue(const std::string& key, const std::function<PendingValue ()>& start);
+
+/*!
+ * \brief Scheduler of the renders which wait for the asynchronously produced values
+ *
+ * Multiplexes the renders over the single thread: render which waits for the values requested with \ref AwaitValue is
+ * suspended, and the thread proceeds with the other renders. Render is queued for resumption once all of the values it
+ * waits for are ready. Renders are started and resumed by \ref Poll (or \ref Run) calls on the thread which owns the scheduler.
+ *
+ * Basic usage of AsyncRenderer class:
+ * ```c++
+ * jinja2::AsyncRenderer renderer;
+ * std::vector<std::future<jinja2::Result<std::string>>> results;
+ * for (auto& params : requests)
+ *     results.push_back(renderer.RenderAsync(tpl, params));
+ *
+ * renderer.Run();
+ * ```
+ *
+ * `RenderAsync` can be called from any thread. `Poll` and `Run` shouldn't be called concurrently.
+ */
+class JINJA2CPP_EXPORT AsyncRenderer
+{
+public:
+    //! Constructor
+    AsyncRenderer();
+    //! Destructor. Renders which are still in flight are abandoned (their futures report the broken promise)
+    ~AsyncRenderer();
+
+    AsyncRenderer(const AsyncRenderer&) = delete;
+    AsyncRenderer& operator=(const AsyncRenderer&) = delete;
+
+    /*!
+     * \brief Schedule the render of the narrow char template
+     *
+     * @param tpl     Loaded template. Template object is copied, so it may be destroyed before the render is finished
+     * @param params  Set of params which should be passed to the template engine
+     *
+     * @return Future result of the render
+     */
+    std::future<Result<std::string>> RenderAsync(const Template& tpl, ValuesMap params);
+    /*!
+     * \brief Schedule the render of the wide char template
+     *
+     * @param tpl     Loaded template. Template object is copied, so it may be destroyed before the render is finished
+     * @param params  Set of params which should be passed to the template engine
+     *
+     * @return Future result of the render
+     */
+    std::future<ResultW<std::wstring>> RenderAsync(const TemplateW& tpl, ValuesMap params);
+
+    /*!
+     * \brief Start the scheduled renders and resume the ones whose awaited values are ready
+     *
+     * Doesn't block: renders which wait for the values are left suspended. Only the renders queued for the start or the
+     * resumption are processed
+     *
+     * @return Number of the renders still in flight
+     */
+    size_t Poll();
+    /*!
+     * \brief Process the renders until all of them (including the ones scheduled meanwhile) are finished
+     *
+     * Sleeps while all the renders in flight wait for the values, and wakes up once some of them are queued for the start
+     * or the resumption
+     */
+    void Run();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+} // jinja2
+
+#endif // JINJA2CPP_ASYNC_RENDER_H
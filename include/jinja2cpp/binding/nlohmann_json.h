@@ -5,62 +5,137 @@
 
 #include <jinja2cpp/reflected_value.h>
 
+#include <memory>
+
 namespace jinja2
 {
 namespace detail
 {
+// Document reflected by value. It's shared by all the accessors of the nested objects and arrays, so copying of the reflected
+// values doesn't copy the document. Null for the documents reflected by pointer (they are referenced, not owned)
+using NLohmannJsonRoot = std::shared_ptr<const nlohmann::json>;
+
+inline Value ReflectJsonNode(const nlohmann::json* val, const NLohmannJsonRoot& root);
 
-class NLohmannJsonObjectAccessor : public MapItemAccessor, public ReflectedDataHolder<nlohmann::json>
+class NLohmannJsonObjectAccessor : public MapItemAccessor
 {
 public:
-    using ReflectedDataHolder<nlohmann::json>::ReflectedDataHolder;
+    NLohmannJsonObjectAccessor(const nlohmann::json* val, NLohmannJsonRoot root)
+        : m_value(val)
+        , m_root(std::move(root))
+    {
+    }
     ~NLohmannJsonObjectAccessor() override = default;
 
     size_t GetSize() const override
     {
-        auto j = this->GetValue();
-        return j ? j->size() : 0ULL;
+        return m_value->size();
     }
 
     bool HasValue(const std::string& name) const override
     {
-        auto j = this->GetValue();
-        return j ? j->contains(name) : false;
+        return m_value->find(name) != m_value->end();
     }
 
     Value GetValueByName(const std::string& name) const override
     {
-        auto j = this->GetValue();
-        if (!j || !j->contains(name))
+        auto p = m_value->find(name);
+        if (p == m_value->end())
             return Value();
 
-        return Reflect(&(*j)[name]);
+        return ReflectJsonNode(&p.value(), m_root);
     }
 
     std::vector<std::string> GetKeys() const override
     {
-        auto j = this->GetValue();
-        if (!j)
-            return {};
-
         std::vector<std::string> result;
-        for (auto& item : j->items())
-        {
-            result.emplace_back(item.key());
-        }
+        result.reserve(m_value->size());
+        for (auto p = m_value->begin(); p != m_value->end(); ++ p)
+            result.emplace_back(p.key());
+
         return result;
     }
+
+private:
+    const nlohmann::json* m_value;
+    NLohmannJsonRoot m_root;
 };
 
+struct NLohmannJsonArrayEnumerator : public ListEnumerator
+{
+    using Iterator = nlohmann::json::const_iterator;
+
+    Iterator m_begin;
+    Iterator m_cur;
+    Iterator m_end;
+    NLohmannJsonRoot m_root;
+    bool m_justInited = true;
+
+    NLohmannJsonArrayEnumerator(Iterator begin, Iterator end, NLohmannJsonRoot root)
+        : m_begin(begin)
+        , m_cur(end)
+        , m_end(end)
+        , m_root(std::move(root))
+    {}
+
+    void Reset() override
+    {
+        m_justInited = true;
+    }
+
+    bool MoveNext() override
+    {
+        if (m_justInited)
+        {
+            m_cur = m_begin;
+            m_justInited = false;
+        }
+        else
+            ++ m_cur;
 
-struct NLohmannJsonArrayAccessor : ListItemAccessor, IndexBasedAccessor, ReflectedDataHolder<nlohmann::json>
+        return m_cur != m_end;
+    }
+
+    Value GetCurrent() const override
+    {
+        return ReflectJsonNode(&*m_cur, m_root);
+    }
+
+    ListEnumeratorPtr Clone() const override
+    {
+        auto result = std::make_unique<NLohmannJsonArrayEnumerator>(m_begin, m_end, m_root);
+        result->m_cur = m_cur;
+        result->m_justInited = m_justInited;
+        return jinja2::ListEnumeratorPtr(result.release(), Deleter);
+    }
+
+    ListEnumeratorPtr Move() override
+    {
+        auto result = std::make_unique<NLohmannJsonArrayEnumerator>(m_begin, m_end, std::move(m_root));
+        result->m_cur = std::move(m_cur);
+        result->m_justInited = m_justInited;
+        this->m_justInited = true;
+        return jinja2::ListEnumeratorPtr(result.release(), Deleter);
+    }
+
+    static void Deleter(ListEnumerator* e)
+    {
+        delete static_cast<NLohmannJsonArrayEnumerator*>(e);
+    }
+};
+
+class NLohmannJsonArrayAccessor : public ListItemAccessor, public IndexBasedAccessor
 {
-    using ReflectedDataHolder<nlohmann::json>::ReflectedDataHolder;
+public:
+    NLohmannJsonArrayAccessor(const nlohmann::json* val, NLohmannJsonRoot root)
+        : m_value(val)
+        , m_root(std::move(root))
+    {
+    }
 
     nonstd::optional<size_t> GetSize() const override
     {
-        auto j = this->GetValue();
-        return j ? j->size() : nonstd::optional<size_t>();
+        return m_value->size();
     }
     const IndexBasedAccessor* GetIndexer() const override
     {
@@ -69,89 +144,77 @@ struct NLohmannJsonArrayAccessor : ListItemAccessor, IndexBasedAccessor, Reflect
 
     ListEnumeratorPtr CreateEnumerator() const override
     {
-        using Enum = Enumerator<typename nlohmann::json::const_iterator>;
-        auto j = this->GetValue();
-        if (!j)
-            jinja2::ListEnumeratorPtr(nullptr, Enum::Deleter);
-
-        return jinja2::ListEnumeratorPtr(new Enum(j->begin(), j->end()), Enum::Deleter);
+        using Enum = NLohmannJsonArrayEnumerator;
+        return jinja2::ListEnumeratorPtr(new Enum(m_value->begin(), m_value->end(), m_root), Enum::Deleter);
     }
 
     Value GetItemByIndex(int64_t idx) const override
     {
-        auto j = this->GetValue();
-        if (!j)
-            return Value();
-
-        return Reflect((*j)[idx]);
+        return ReflectJsonNode(&(*m_value)[static_cast<size_t>(idx)], m_root);
     }
+
+private:
+    const nlohmann::json* m_value;
+    NLohmannJsonRoot m_root;
 };
 
+// Strings of the referenced documents are exposed as views. Strings of the owned documents are copied, because the values
+// could outlive the document
+inline Value ReflectJsonNode(const nlohmann::json* val, const NLohmannJsonRoot& root)
+{
+    Value result;
+    switch (val->type())
+    {
+    case nlohmann::detail::value_t::null:
+        break;
+    case nlohmann::detail::value_t::object:
+        result = GenericMap([accessor = NLohmannJsonObjectAccessor(val, root)]() { return &accessor; });
+        break;
+    case nlohmann::detail::value_t::array:
+        result = GenericList([accessor = NLohmannJsonArrayAccessor(val, root)]() { return &accessor; });
+        break;
+    case nlohmann::detail::value_t::string:
+    {
+        const auto& str = val->get_ref<const std::string&>();
+        if (root)
+            result = str;
+        else
+            result = nonstd::string_view(str);
+        break;
+    }
+    case nlohmann::detail::value_t::boolean:
+        result = val->get<bool>();
+        break;
+    case nlohmann::detail::value_t::number_integer:
+    case nlohmann::detail::value_t::number_unsigned:
+        result = val->get<int64_t>();
+        break;
+    case nlohmann::detail::value_t::number_float:
+        result = val->get<double>();
+        break;
+    case nlohmann::detail::value_t::discarded:
+        break;
+    }
+    return result;
+}
+
 template<>
 struct Reflector<nlohmann::json>
 {
     static Value Create(nlohmann::json val)
     {
-        Value result;
-        switch (val.type())
-        {
-        case nlohmann::detail::value_t::null:
-            break;
-        case nlohmann::detail::value_t::object:
-            result = GenericMap([accessor = NLohmannJsonObjectAccessor(std::move(val))]() { return &accessor; });
-            break;
-        case nlohmann::detail::value_t::array:
-            result = GenericList([accessor = NLohmannJsonArrayAccessor(std::move(val))]() { return &accessor; });
-            break;
-        case nlohmann::detail::value_t::string:
-            result = val.get<std::string>();
-            break;
-        case nlohmann::detail::value_t::boolean:
-            result = val.get<bool>();
-            break;
-        case nlohmann::detail::value_t::number_integer:
-        case nlohmann::detail::value_t::number_unsigned:
-            result = val.get<int64_t>();
-            break;
-        case nlohmann::detail::value_t::number_float:
-            result = val.get<double>();
-            break;
-        case nlohmann::detail::value_t::discarded:
-            break;
-        }
-        return result;
+        if (val.is_string())
+            return Value(std::move(val.get_ref<std::string&>()));
+        if (!val.is_object() && !val.is_array())
+            return ReflectJsonNode(&val, NLohmannJsonRoot());
+
+        auto root = std::make_shared<const nlohmann::json>(std::move(val));
+        return ReflectJsonNode(root.get(), root);
     }
 
     static Value CreateFromPtr(const nlohmann::json *val)
     {
-        Value result;
-        switch (val->type())
-        {
-        case nlohmann::detail::value_t::null:
-            break;
-        case nlohmann::detail::value_t::object:
-            result = GenericMap([accessor = NLohmannJsonObjectAccessor(val)]() { return &accessor; });
-            break;
-        case nlohmann::detail::value_t::array:
-            result = GenericList([accessor = NLohmannJsonArrayAccessor(val)]() {return &accessor;});
-            break;
-        case nlohmann::detail::value_t::string:
-            result = val->get<std::string>();
-            break;
-        case nlohmann::detail::value_t::boolean:
-            result = val->get<bool>();
-            break;
-        case nlohmann::detail::value_t::number_integer:
-        case nlohmann::detail::value_t::number_unsigned:
-            result = val->get<int64_t>();
-            break;
-        case nlohmann::detail::value_t::number_float:
-            result = val->get<double>();
-            break;
-        case nlohmann::detail::value_t::discarded:
-            break;
-        }
-        return result;
+        return ReflectJsonNode(val, NLohmannJsonRoot());
     }
 
 };
@@ -159,4 +222,4 @@ struct Reflector<nlohmann::json>
 } // namespace detail
 } // namespace jinja2
 
-#endif // JINJA2CPP_BINDING_NLOHMANN_JSON_H
\ No newline at end of file
+#endif // JINJA2CPP_BINDING_NLOHMANN_JSON_H
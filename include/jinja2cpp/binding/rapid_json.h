@@ -6,24 +6,58 @@
 #include <rapidjson/document.h>
 #include <rapidjson/rapidjson.h>
 
+#include <algorithm>
+#include <atomic>
+
 namespace jinja2
 {
 namespace detail
 {
 
+// Matches the member names of the document against the requested name without the conversion of the member names
 template<typename CharT>
-struct RapidJsonNameConverter;
+struct RapidJsonNameMatcher;
 
 template<>
-struct RapidJsonNameConverter<char>
+struct RapidJsonNameMatcher<char>
 {
-    static const std::string& GetName(const std::string& str) { return str; }
+    explicit RapidJsonNameMatcher(const std::string& name)
+        : m_name(name)
+    {
+    }
+
+    template<typename V>
+    bool operator()(const V& key) const
+    {
+        return key.GetStringLength() == m_name.size() && std::equal(m_name.begin(), m_name.end(), key.GetString());
+    }
+
+    nonstd::string_view m_name;
 };
 
 template<>
-struct RapidJsonNameConverter<wchar_t>
+struct RapidJsonNameMatcher<wchar_t>
 {
-    static std::wstring GetName(const std::string& str) { return ConvertString<std::wstring>(str); }
+    // ASCII names (the common case) are compared with the wide member names char by char. Other names are converted once per lookup
+    explicit RapidJsonNameMatcher(const std::string& name)
+        : m_name(name)
+    {
+        if (std::any_of(name.begin(), name.end(), [](char ch) { return static_cast<unsigned char>(ch) >= 0x80; }))
+            m_wideName = ConvertString<std::wstring>(name);
+    }
+
+    template<typename V>
+    bool operator()(const V& key) const
+    {
+        if (m_wideName.empty())
+            return key.GetStringLength() == m_name.size() &&
+                std::equal(m_name.begin(), m_name.end(), key.GetString(), [](char ch, wchar_t keyCh) { return static_cast<wchar_t>(ch) == keyCh; });
+
+        return key.GetStringLength() == m_wideName.size() && std::equal(m_wideName.begin(), m_wideName.end(), key.GetString());
+    }
+
+    nonstd::string_view m_name;
+    std::wstring m_wideName;
 };
 
 template<typename T>
@@ -31,7 +65,14 @@ class RapidJsonObjectAccessor : public MapItemAccessor, public ReflectedDataHold
 {
 public:
     using ReflectedDataHolder<T, false>::ReflectedDataHolder;
-    using NameCvt = RapidJsonNameConverter<typename T::Ch>;
+    using NameMatcher = RapidJsonNameMatcher<typename T::Ch>;
+    using ConstMemberIterator = typename T::ConstMemberIterator;
+
+    RapidJsonObjectAccessor(const RapidJsonObjectAccessor& other)
+        : ReflectedDataHolder<T, false>(other)
+        , m_nextMember(other.m_nextMember.load(std::memory_order_relaxed))
+    {
+    }
     ~RapidJsonObjectAccessor() override = default;
 
     size_t GetSize() const override
@@ -43,17 +84,20 @@ public:
     bool HasValue(const std::string& name) const override
     {
         auto j = this->GetValue();
-        return j ? j->HasMember(NameCvt::GetName(name).c_str()) : false;
+        return j ? FindMember(*j, name) != j->MemberEnd() : false;
     }
 
-    Value GetValueByName(const std::string& nameOrig) const override
+    Value GetValueByName(const std::string& name) const override
     {
         auto j = this->GetValue();
-        const auto& name = NameCvt::GetName(nameOrig);
-        if (!j || !j->HasMember(name.c_str()))
+        if (!j)
             return Value();
 
-        return Reflect(&(*j)[name.c_str()]);
+        auto p = FindMember(*j, name);
+        if (p == j->MemberEnd())
+            return Value();
+
+        return Reflect(&p->value);
     }
 
     std::vector<std::string> GetKeys() const override
@@ -63,12 +107,40 @@ public:
             return {};
 
         std::vector<std::string> result;
+        result.reserve(j->MemberCount());
         for (auto it = j->MemberBegin(); it != j->MemberEnd(); ++ it)
         {
-            result.emplace_back(ConvertString<std::string>(nonstd::basic_string_view<typename T::Ch>(it->name.GetString())));
+            result.emplace_back(ConvertString<std::string>(nonstd::basic_string_view<typename T::Ch>(it->name.GetString(), it->name.GetStringLength())));
         }
         return result;
     }
+
+private:
+    // Fields of the object are usually accessed in the order of the declaration, so the search starts from the member which
+    // follows the previously found one
+    ConstMemberIterator FindMember(const T& obj, const std::string& name) const
+    {
+        NameMatcher matcher(name);
+        auto count = obj.MemberCount();
+        auto start = m_nextMember.load(std::memory_order_relaxed);
+        if (start >= count)
+            start = 0;
+
+        for (rapidjson::SizeType n = 0; n < count; ++ n)
+        {
+            auto idx = start + n < count ? start + n : start + n - count;
+            auto p = obj.MemberBegin() + idx;
+            if (!matcher(p->name))
+                continue;
+
+            m_nextMember.store(idx + 1, std::memory_order_relaxed);
+            return p;
+        }
+
+        return obj.MemberEnd();
+    }
+
+    mutable std::atomic<rapidjson::SizeType> m_nextMember{0};
 };
 
 template<typename Enc>
@@ -132,7 +204,7 @@ struct Reflector<rapidjson::GenericValue<Enc>>
             result = GenericList([accessor = RapidJsonArrayAccessor<Enc>(val)]() { return &accessor; });
             break;
         case rapidjson::kStringType:
-            result = std::basic_string<typename Enc::Ch>(val->GetString(), val->GetStringLength());
+            result = nonstd::basic_string_view<typename Enc::Ch>(val->GetString(), val->GetStringLength());
             break;
         case rapidjson::kNumberType:
             if (val->IsInt64() || val->IsUint64())
@@ -0,0 +1,70 @@
+#ifndef JINJA2CPP_COMPRESSED_OUTPUT_H
+#define JINJA2CPP_COMPRESSED_OUTPUT_H
+
+#include "config.h"
+#include "template.h"
+
+#include <memory>
+
+namespace jinja2
+{
+/*!
+ * \brief Output sink which compresses the rendered output to the gzip format on the fly
+ *
+ * Rendered chunks are fed to the deflate stream as they arrive (see \ref Template::Render and \ref Settings::outputChunkSize),
+ * so the uncompressed output is never stored entirely. Compressed data is passed to the target sink by the blocks of up to 16 KiB.
+ * The sink is available if the library is built with the `JINJA2CPP_WITH_ZLIB` option (requires zlib).
+ *
+ * Basic usage:
+ * ```c++
+ *  std::string compressed;
+ *  jinja2::GzipOutputSink gzip([&compressed](const char* data, size_t size) { compressed.append(data, size); });
+ *  auto result = tpl.Render(gzip.GetSink(), params);
+ *  gzip.Finish();
+ * ```
+ *
+ * In case of the render error the target has already received the compressed part of the output.
+ */
+class JINJA2CPP_EXPORT GzipOutputSink
+{
+public:
+    /*!
+     * \brief Initializing constructor
+     *
+     * @param target Callback which receives the compressed output
+     * @param level  Compression level from 1 (fastest) to 9 (best). -1 selects the default zlib level
+     */
+    explicit GzipOutputSink(OutputSink target, int level = -1);
+    //! Destructor. Unfinished stream is discarded
+    ~GzipOutputSink();
+
+    GzipOutputSink(const GzipOutputSink&) = delete;
+    GzipOutputSink& operator=(const GzipOutputSink&) = delete;
+
+    /*!
+     * \brief Returns the sink to render the templates to
+     *
+     * @return Sink which refers to this object, so it's valid while the object exists
+     */
+    OutputSink GetSink();
+    /*!
+     * \brief Compress the next chunk of the output
+     *
+     * Chunks written after \ref Finish are ignored
+     *
+     * @param data Chunk to compress
+     * @param size Size of the chunk
+     */
+    void Write(const char* data, size_t size);
+    /*!
+     * \brief Flush the compressed data and the gzip trailer to the target
+     */
+    void Finish();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+} // jinja2
+
+#endif // JINJA2CPP_COMPRESSED_OUTPUT_H
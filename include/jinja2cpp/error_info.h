@@ -26,6 +26,8 @@ enum class ErrorCode
     InvalidValueType,             //!< Invalid type of the value in the particular context
     InvalidTemplateName,          //!< Invalid name of the template. ExtraParams[0] contains the name
     MetadataParseError,           //!< Invalid name of the template. ExtraParams[0] contains the name
+    InvalidCompiledTemplate,      //!< Compiled template image is corrupted or doesn't match the template source or settings. ExtraParams[0] contains the reason
+    RenderLimitExceeded,          //!< Render exceeded one of the limits set by \ref Settings::RenderLimits. ExtraParams[0] contains the name of the limit
     ExpectedStringLiteral = 1001, //!< String literal expected
     ExpectedIdentifier,           //!< Identifier expected
     ExpectedSquareBracket,        //!< ']' expected
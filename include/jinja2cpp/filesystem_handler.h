@@ -4,13 +4,16 @@
 #include "config.h"
 
 #include <nonstd/optional.hpp>
+#include <nonstd/string_view.hpp>
 #include <nonstd/variant.hpp>
 
 #include <chrono>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace jinja2
 {
@@ -19,6 +22,8 @@ template<typename CharT>
 using FileStreamPtr = std::unique_ptr<std::basic_istream<CharT>, void (*)(std::basic_istream<CharT>*)>;
 using CharFileStreamPtr = FileStreamPtr<char>;
 using WCharFileStreamPtr = FileStreamPtr<wchar_t>;
+//! Narrow char content of the file owned by the filesystem handler (e.g. memory-mapped file). Viewed memory is valid while any copy of the pointer is alive
+using FileBufferPtr = std::shared_ptr<const nonstd::string_view>;
 
 /*!
  * \brief Generic interface to filesystem handlers (loaders)
@@ -65,6 +70,85 @@ public:
      * @return Last modification date (if applicable) or empty optional object otherwise
      */
     virtual nonstd::optional<std::chrono::system_clock::time_point> GetLastModificationDate(const std::string& name) const = 0;
+    /*!
+     * \brief Method is called to enumerate the files provided by the handler (if applicable)
+     *
+     * Returned names should be accepted by the `OpenStream` methods. Main purpose of this method is to help the template environment to
+     * preload the templates (see \ref TemplateEnv::PreloadByPattern). Default implementation returns the empty list, so the handler
+     * which can't enumerate its files is skipped by the preload.
+     *
+     * @return List of the file names
+     */
+    virtual std::vector<std::string> ListFiles() const { return std::vector<std::string>(); }
+    /*!
+     * \brief Method is called to get the content of the file in 'narrow-char' mode without copying it (if applicable)
+     *
+     * If the handler can share the content of the file (e.g. map it into memory) this method should return the pointer to it. Template loaded from
+     * the buffer refers to the content directly and keeps the returned pointer while it's alive, so the content should stay unchanged. In other case
+     * the method should return the empty pointer, and the file is read via \ref OpenStream. Default implementation returns the empty pointer
+     *
+     * @param name Name of the file to get the content of
+     * @return Shared content of the file or empty pointer
+     */
+    virtual FileBufferPtr OpenBuffer(const std::string& name) const { return FileBufferPtr(); }
+    /*!
+     * \brief Method is called to obtain the modification dates of the several files at once (if applicable)
+     *
+     * Main purpose of this method is to help the handlers of the remote stores to check the cached templates (see
+     * \ref Settings::autoReloadInterval) with the single request instead of the request per file. Returned list should contain the
+     * date (or the empty optional object) for each of the specified names in the same order. If the method throws or returns the list
+     * of the other size, the files are checked by \ref GetLastModificationDate one by one. Default implementation calls
+     * \ref GetLastModificationDate for each name
+     *
+     * @param names Names of the files to get the last modification dates
+     * @return Last modification dates of the files
+     */
+    virtual std::vector<nonstd::optional<std::chrono::system_clock::time_point>> GetLastModificationDates(const std::vector<std::string>& names) const
+    {
+        std::vector<nonstd::optional<std::chrono::system_clock::time_point>> result;
+        result.reserve(names.size());
+        for (auto& name : names)
+            result.push_back(GetLastModificationDate(name));
+        return result;
+    }
+    /*!
+     * \brief Method is called to start opening the file with the specified name in 'narrow-char' mode without waiting for it
+     *
+     * The environment starts opening of the several files this way before it needs them (e.g. the compiled image of the template along
+     * with the source, see \ref Settings::usePrecompiledTemplates), so the handlers of the remote stores can fetch them concurrently.
+     * Default implementation calls \ref OpenStream when the result is requested
+     *
+     * @param name Name of the file to open
+     * @return Future of the opened stream object (or empty pointer in case of any error)
+     */
+    virtual std::future<CharFileStreamPtr> OpenStreamAsync(const std::string& name) const
+    {
+        return std::async(std::launch::deferred, [this, name]() { return OpenStream(name); });
+    }
+    /*!
+     * \brief Method is called to start opening the file with the specified name in 'wide-char' mode without waiting for it
+     *
+     * Same as \ref OpenStreamAsync, but for the wide char files. Default implementation calls \ref OpenWStream when the result is
+     * requested
+     *
+     * @param name Name of the file to open
+     * @return Future of the opened stream object (or empty pointer in case of any error)
+     */
+    virtual std::future<WCharFileStreamPtr> OpenWStreamAsync(const std::string& name) const
+    {
+        return std::async(std::launch::deferred, [this, name]() { return OpenWStream(name); });
+    }
+    /*!
+     * \brief Method is called with the names of the files which are likely to be opened soon
+     *
+     * The environment calls this method with the statically known dependencies of the just loaded template (the targets of its
+     * `extends`, `include` and `import` statements) if \ref Settings::prefetchDependencies is enabled, before these templates are
+     * loaded in the background. Handlers of the remote stores can start fetching the files in a batch. Method is called from the
+     * loading thread and shouldn't block. Default implementation does nothing
+     *
+     * @param names Names of the files to prefetch
+     */
+    virtual void Prefetch(const std::vector<std::string>& names) const {}
 };
 
 using FilesystemHandlerPtr = std::shared_ptr<IFilesystemHandler>;
@@ -100,6 +184,7 @@ public:
     CharFileStreamPtr OpenStream(const std::string& name) const override;
     WCharFileStreamPtr OpenWStream(const std::string& name) const override;
     nonstd::optional<std::chrono::system_clock::time_point> GetLastModificationDate(const std::string& name) const override;
+    std::vector<std::string> ListFiles() const override;
 
 private:
     struct FileContent
@@ -167,9 +252,30 @@ public:
      */
     CharFileStreamPtr OpenByteStream(const std::string& name) const;
     nonstd::optional<std::chrono::system_clock::time_point> GetLastModificationDate(const std::string& name) const override;
+    /*!
+     * \brief Enable or disable the memory mapping of the template files
+     *
+     * With the enabled mapping \ref OpenBuffer maps the narrow char files into memory, so the loaded templates refer to the mapped pages instead of
+     * the copies of the files, and the pages are shared between the processes. Mapped file shouldn't be changed in place while the templates loaded
+     * from it exist: update the files by replacing them (e.g. via rename). Disabled by default. Not supported on Windows (files are read as usual).
+     *
+     * @param enable True to enable the mapping
+     */
+    void SetMemoryMapping(bool enable)
+    {
+        m_useMemoryMapping = enable;
+    }
+    FileBufferPtr OpenBuffer(const std::string& name) const override;
+    /*!
+     * \brief Enumerate the regular files of the root folder and its subfolders
+     *
+     * @return Paths of the files relative to the root folder. '/' is used as a separator
+     */
+    std::vector<std::string> ListFiles() const override;
 
 private:
     std::string m_rootFolder;
+    bool m_useMemoryMapping = false;
 };
 } // jinja2
 
@@ -0,0 +1,93 @@
+#ifndef JINJA2CPP_FRAGMENT_CACHE_H
+#define JINJA2CPP_FRAGMENT_CACHE_H
+
+#include "config.h"
+
+#include <nonstd/optional.hpp>
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace jinja2
+{
+
+/*!
+ * \brief Generic interface to the storage of the rendered template fragments
+ *
+ * Fragments are the rendered bodies of the `{% cache key, ttl %}` statements (see \ref Settings::Extensions::Cache). Keys are
+ * built from the template name, the position of the statement in it and the evaluated key expression. Fragments of the
+ * wide-char templates are stored UTF-8 encoded. This interface should be implemented in order to keep the fragments in
+ * the external storage (ex. Redis or memcached). Methods are called from the render threads, so the implementation should be
+ * thread-safe.
+ */
+class JINJA2CPP_EXPORT IFragmentCache
+{
+public:
+    //! Destructor
+    virtual ~IFragmentCache() = default;
+
+    /*!
+     * \brief Method is called to get the stored fragment
+     *
+     * @param key Key of the fragment
+     * @return Stored fragment or empty optional object if there is no such fragment or it has expired
+     */
+    virtual nonstd::optional<std::string> Get(const std::string& key) = 0;
+    /*!
+     * \brief Method is called to store the rendered fragment
+     *
+     * @param key      Key of the fragment
+     * @param fragment Rendered fragment
+     * @param ttl      Time the fragment stays valid. Zero means the fragment doesn't expire
+     */
+    virtual void Put(const std::string& key, std::string fragment, std::chrono::seconds ttl) = 0;
+};
+
+using FragmentCachePtr = std::shared_ptr<IFragmentCache>;
+
+/*!
+ * \brief In-process fragments storage
+ *
+ * Keeps the fragments in memory. Least recently used fragments are evicted when the size limit is reached. This storage is
+ * used by the \ref TemplateEnv by default.
+ */
+class JINJA2CPP_EXPORT MemoryFragmentCache : public IFragmentCache
+{
+public:
+    /*!
+     * \brief Constructor
+     *
+     * @param maxSize Maximal number of the stored fragments
+     */
+    explicit MemoryFragmentCache(size_t maxSize = 1000)
+        : m_maxSize(maxSize)
+    {
+    }
+
+    nonstd::optional<std::string> Get(const std::string& key) override;
+    void Put(const std::string& key, std::string fragment, std::chrono::seconds ttl) override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::string key;
+        std::string fragment;
+        nonstd::optional<Clock::time_point> expiration;
+    };
+
+    size_t m_maxSize;
+    std::mutex m_guard;
+    // Most recently used entries go first
+    std::list<Entry> m_entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+};
+
+} // jinja2
+
+#endif // JINJA2CPP_FRAGMENT_CACHE_H
@@ -3,6 +3,8 @@
 
 #include <nonstd/optional.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <iterator>
 #include <memory>
 #include <functional>
@@ -36,6 +38,23 @@ inline auto MakeEmptyListEnumeratorPtr()
     return ListEnumeratorPtr(nullptr, [](ListEnumerator*) {});
 }
 
+/*!
+ * \brief View of the contiguous array of the native numbers the list items are produced from
+ *
+ * Lists of the integers or the doubles stored in the contiguous arrays (e.g. the reflected `std::vector<int64_t>` and `std::vector<double>`) provide
+ * such view via \ref ListItemAccessor::GetNumbers, so the numeric filters (`sum`, `min`, `max`, `sort`) process the array directly instead of the
+ * items converted one by one. At most one of the pointers is set.
+ */
+struct NumbersArrayView
+{
+    //! Items of the list of integers. Null if the list isn't the array of integers
+    const int64_t* integers = nullptr;
+    //! Items of the list of doubles. Null if the list isn't the array of doubles
+    const double* doubles = nullptr;
+    //! Number of the items
+    size_t size = 0;
+};
+
 /*!
  * \brief Generic list enumerator interface
  *
@@ -142,6 +161,17 @@ struct ListItemAccessor
      */
     virtual nonstd::optional<size_t> GetSize() const = 0;
 
+    /*!
+     * \brief Called to get the view of the native array of numbers the list items are produced from (if applicable)
+     *
+     * See \ref NumbersArrayView. The view should stay valid while the list is alive and unchanged, and should have the same items as the list.
+     *
+     * Method can be called several times from the different threads.
+     *
+     * @return View of the array or the empty view if the list isn't the array of numbers
+     */
+    virtual NumbersArrayView GetNumbers() const { return NumbersArrayView(); }
+
     /*!
      * \brief Helper factory method of particular enumerator implementation
      *
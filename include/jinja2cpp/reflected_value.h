@@ -5,12 +5,16 @@
 
 #include <nonstd/optional.hpp>
 
+#include <algorithm>
+#include <array>
 #include <vector>
 #include <set>
 #include <cstddef>
 #include <string>
+#include <tuple>
 #include <type_traits>
 #include <memory>
+#include <utility>
 
 namespace jinja2
 {
@@ -26,7 +30,9 @@ namespace jinja2
  *
  * Reflected value takes ownership on the object, passed to the `Reflect` method by r-value reference or value. Actually, such object is moved. For const
  * references or pointers reflected value holds the pointer to the reflected object. So, it's necessary to be sure that life time of the reflected object is
- * longer than it's usage within the template.
+ * longer than it's usage within the template. Strings passed by const reference (e.g. `jinja2::Reflect(obj.strValue)` within the field accessor) are
+ * reflected as the string views on the same terms, so the access to the string fields copies nothing. Strings of the objects owned by the reflected value
+ * (the objects and containers reflected by value) are copied, because the owned object could be copied and destroyed while the string is in use.
  *
  * In order to reflect custom (user) the \ref jinja2::TypeReflection template should be specialized in the following way:
  * ```c++
@@ -54,6 +60,24 @@ namespace jinja2
  * and define only one method: `GetAccessors`. This method returns the unordered map object which maps field name (as a string) to the corresponded field
  * accessor. And field accessor here is a lambda object which takes the reflected object reference and returns the value of the field from it.
  *
+ * Types with many fields accessed in the hot loops could be reflected with the fields table instead. Specialization of the \ref TypeReflection template
+ * derives from \ref TypeReflectedFields template and defines `GetFields` method which returns the table made by \ref MakeReflectedFields:
+ * ```c++
+ * struct jinja2::TypeReflection<TestStruct> : jinja2::TypeReflectedFields<TestStruct>
+ * {
+ *     static auto& GetFields()
+ *     {
+ *         static const auto fields = jinja2::MakeReflectedFields<TestStruct>(
+ *             jinja2::ReflectField("intValue", &TestStruct::intValue),
+ *             jinja2::ReflectField("intEvenValue", [](const TestStruct& obj) -> Value { return obj.intValue % 2 ? Value() : Value(obj.intValue); }));
+ *
+ *         return fields;
+ *     }
+ * };
+ * ```
+ * Field is either the pointer to the data member or the callable object. Field accessors are called directly (without `std::function`) and the field
+ * is looked up in the name-sorted table, so the field access doesn't allocate anything.
+ *
  * @tparam T Type of value to reflect
  * @param val Value to reflect
  *
@@ -83,6 +107,138 @@ struct TypeReflection : TypeReflectedImpl<T, false>
 {
 };
 
+struct TypeReflectedFieldsTag
+{
+};
+
+template<typename T>
+struct TypeReflectedFields : TypeReflectedImpl<T, true>, TypeReflectedFieldsTag
+{
+};
+
+namespace detail
+{
+template<typename T, typename M>
+struct MemberFieldGetter
+{
+    M T::* member;
+
+    Value operator()(const T& obj) const
+    {
+        return Reflect(obj.*member);
+    }
+};
+
+template<typename Getter>
+struct ReflectedField
+{
+    const char* name;
+    Getter getter;
+};
+} // namespace detail
+
+/*!
+ * \brief Declares the field of the reflected type for the \ref MakeReflectedFields table
+ *
+ * @param name Name of the field
+ * @param member Pointer to the data member (reflected by reference) or callable object which takes the reflected object and returns the field value
+ */
+template<typename M, typename T, typename = std::enable_if_t<!std::is_function<M>::value>>
+auto ReflectField(const char* name, M T::* member)
+{
+    return detail::ReflectedField<detail::MemberFieldGetter<T, M>>{name, {member}};
+}
+
+template<typename Fn>
+auto ReflectField(const char* name, Fn fn)
+{
+    return detail::ReflectedField<Fn>{name, std::move(fn)};
+}
+
+/*!
+ * \brief Table of the reflected type fields
+ *
+ * Keeps the field accessors as is (in the tuple) and the field names sorted for the binary search. Accessors are called through the array of the plain
+ * function pointers indexed by the field number. Made by the \ref MakeReflectedFields function.
+ */
+template<typename T, typename ... Getters>
+class ReflectedFields
+{
+public:
+    static_assert(sizeof...(Getters) != 0, "Reflected type should have at least one field");
+    static constexpr size_t FieldsCount = sizeof...(Getters);
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    explicit ReflectedFields(detail::ReflectedField<Getters> ... fields)
+        : m_names{{fields.name...}}
+        , m_getters(std::move(fields.getter)...)
+    {
+        for (size_t idx = 0; idx != FieldsCount; ++ idx)
+            m_index[idx] = FieldIndex{m_names[idx], idx};
+
+        std::sort(m_index.begin(), m_index.end(), [](const FieldIndex& left, const FieldIndex& right) { return left.name < right.name; });
+    }
+
+    size_t GetSize() const { return FieldsCount; }
+    // Names in the order of the declaration
+    const std::array<const char*, FieldsCount>& GetNames() const { return m_names; }
+
+    size_t FindField(nonstd::string_view name) const
+    {
+        auto p = std::lower_bound(m_index.begin(), m_index.end(), name, [](const FieldIndex& field, nonstd::string_view val) { return field.name < val; });
+        if (p == m_index.end() || p->name != name)
+            return npos;
+
+        return p->index;
+    }
+
+    Value GetField(const T& obj, size_t idx) const
+    {
+        return GetFieldImpl(obj, idx, std::index_sequence_for<Getters...>());
+    }
+
+private:
+    using GettersTuple = std::tuple<Getters...>;
+
+    struct FieldIndex
+    {
+        nonstd::string_view name;
+        size_t index;
+    };
+
+    template<size_t Idx>
+    static Value CallGetter(const GettersTuple& getters, const T& obj)
+    {
+        return std::get<Idx>(getters)(obj);
+    }
+
+    template<size_t ... Idxs>
+    Value GetFieldImpl(const T& obj, size_t idx, std::index_sequence<Idxs...>) const
+    {
+        using Getter = Value (*)(const GettersTuple&, const T&);
+        static constexpr Getter getters[] = {&CallGetter<Idxs>...};
+        return getters[idx](m_getters, obj);
+    }
+
+    std::array<const char*, FieldsCount> m_names;
+    std::array<FieldIndex, FieldsCount> m_index;
+    GettersTuple m_getters;
+};
+
+/*!
+ * \brief Makes the fields table for the \ref TypeReflectedFields based reflection
+ *
+ * @tparam T Reflected type
+ * @param fields Fields declared with \ref ReflectField
+ *
+ * @return Fields table which should be stored in the static variable
+ */
+template<typename T, typename ... Getters>
+auto MakeReflectedFields(detail::ReflectedField<Getters> ... fields)
+{
+    return ReflectedFields<T, Getters...>(std::move(fields)...);
+}
+
 #ifndef JINJA2CPP_NO_DOXYGEN
 template<typename Derived>
 class ReflectedMapImplBase : public MapItemAccessor
@@ -116,6 +272,20 @@ public:
     }
 };
 
+namespace detail
+{
+// Replaces the string view (which could refer to the field of the owned object) with the string copy
+inline Value DetachValue(Value&& val)
+{
+    if (auto str = val.getPtr<nonstd::string_view>())
+        return Value(std::string(str->begin(), str->end()));
+    if (auto str = val.getPtr<nonstd::wstring_view>())
+        return Value(std::wstring(str->begin(), str->end()));
+
+    return std::move(val);
+}
+} // namespace detail
+
 template<typename T, bool byValue = true>
 class ReflectedDataHolder;
 
@@ -131,6 +301,10 @@ protected:
     {
         return m_valuePtr ? m_valuePtr : (m_value ? &m_value.value() : nullptr);
     }
+    bool IsOwned() const
+    {
+        return !m_valuePtr;
+    }
 
 private:
     nonstd::optional<T> m_value;
@@ -148,16 +322,20 @@ protected:
     {
         return m_valuePtr;
     }
+    bool IsOwned() const
+    {
+        return false;
+    }
 
 private:
     const T* m_valuePtr = nullptr;
 };
 
-template<typename T>
-class ReflectedMapImpl : public ReflectedMapImplBase<ReflectedMapImpl<T>>, public ReflectedDataHolder<T>
+template<typename T, bool byValue = true>
+class ReflectedMapImpl : public ReflectedMapImplBase<ReflectedMapImpl<T, byValue>>, public ReflectedDataHolder<T, byValue>
 {
 public:
-    using ReflectedDataHolder<T>::ReflectedDataHolder;
+    using ReflectedDataHolder<T, byValue>::ReflectedDataHolder;
 
     static auto GetAccessors() {return TypeReflection<T>::GetAccessors();}
     template<typename Fn>
@@ -166,19 +344,79 @@ public:
         auto v = this->GetValue();
         if (!v)
             return Value();
+        if (this->IsOwned())
+            return detail::DetachValue(accessor(*v));
         return accessor(*v);
     }
 };
 
+template<typename T, bool byValue = true>
+class ReflectedFieldsMapImpl : public MapItemAccessor, public ReflectedDataHolder<T, byValue>
+{
+public:
+    using ReflectedDataHolder<T, byValue>::ReflectedDataHolder;
+
+    static auto& GetFields() { return TypeReflection<T>::GetFields(); }
+
+    size_t GetSize() const override
+    {
+        return GetFields().GetSize();
+    }
+    bool HasValue(const std::string& name) const override
+    {
+        const auto& fields = GetFields();
+        return fields.FindField(name) != fields.npos;
+    }
+    Value GetValueByName(const std::string& name) const override
+    {
+        const auto& fields = GetFields();
+        auto idx = fields.FindField(name);
+        if (idx == fields.npos)
+            throw std::runtime_error("Invalid field access");
+
+        auto v = this->GetValue();
+        if (!v)
+            return Value();
+        if (this->IsOwned())
+            return detail::DetachValue(fields.GetField(*v, idx));
+        return fields.GetField(*v, idx);
+    }
+    std::vector<std::string> GetKeys() const override
+    {
+        const auto& names = GetFields().GetNames();
+        return std::vector<std::string>(names.begin(), names.end());
+    }
+    // Objects of the same type share the fields table, so the field index found once is valid for all of them
+    const void* GetLayout() const override { return &GetFields(); }
+    size_t FindSlot(const std::string& name) const override { return GetFields().FindField(name); }
+    Value GetValueBySlot(size_t slot) const override
+    {
+        const auto& fields = GetFields();
+        if (slot >= fields.GetSize())
+            return Value();
+
+        auto v = this->GetValue();
+        if (!v)
+            return Value();
+        if (this->IsOwned())
+            return detail::DetachValue(fields.GetField(*v, slot));
+        return fields.GetField(*v, slot);
+    }
+};
+
 namespace detail
 {
 template<typename T, typename Tag = void>
 struct Reflector;
 
+template<typename T, bool byValue>
+using ReflectedTypeImpl = std::conditional_t<std::is_base_of<TypeReflectedFieldsTag, TypeReflection<T>>::value,
+    ReflectedFieldsMapImpl<T, byValue>, ReflectedMapImpl<T, byValue>>;
+
 template<typename T>
 using IsReflectedType = std::enable_if_t<TypeReflection<T>::value>;
 
-template<typename It>
+template<typename It, bool OwnsItems = false>
 struct Enumerator : public ListEnumerator
 {
     It m_begin;
@@ -212,12 +450,14 @@ struct Enumerator : public ListEnumerator
 
     Value GetCurrent() const override
     {
+        if (OwnsItems)
+            return DetachValue(Reflect(*m_cur));
         return Reflect(*m_cur);
     }
 
     ListEnumeratorPtr Clone() const override
     {
-        auto result = std::make_unique<Enumerator<It>>(m_begin, m_end);
+        auto result = std::make_unique<Enumerator<It, OwnsItems>>(m_begin, m_end);
         result->m_cur = m_cur;
         result->m_justInited = m_justInited;
         return jinja2::ListEnumeratorPtr(result.release(), Deleter);
@@ -225,7 +465,7 @@ struct Enumerator : public ListEnumerator
 
     ListEnumeratorPtr Move() override
     {
-        auto result = std::make_unique<Enumerator<It>>(m_begin, m_end);
+        auto result = std::make_unique<Enumerator<It, OwnsItems>>(m_begin, m_end);
         result->m_cur = std::move(m_cur);
         result->m_justInited = m_justInited;
         this->m_justInited = true;
@@ -234,7 +474,7 @@ struct Enumerator : public ListEnumerator
 
     static void Deleter(ListEnumerator* e)
     {
-        delete static_cast<Enumerator<It>*>(e);
+        delete static_cast<Enumerator<It, OwnsItems>*>(e);
     }
 };
 
@@ -262,7 +502,7 @@ struct ContainerReflector
 
         ListEnumeratorPtr CreateEnumerator() const override
         {
-            using Enum = Enumerator<typename T::const_iterator>;
+            using Enum = Enumerator<typename T::const_iterator, true>;
             return jinja2::ListEnumeratorPtr(new Enum(m_value.begin(), m_value.end()), Enum::Deleter);
         }
 
@@ -270,7 +510,12 @@ struct ContainerReflector
         {
             auto p = m_value.begin();
             std::advance(p, static_cast<size_t>(idx));
-            return Reflect(*p);
+            return DetachValue(Reflect(*p));
+        }
+
+        NumbersArrayView GetNumbers() const override
+        {
+            return GetNumbersView(m_value);
         }
     };
 
@@ -304,8 +549,36 @@ struct ContainerReflector
             std::advance(p, static_cast<size_t>(idx));
             return Reflect(*p);
         }
+
+        NumbersArrayView GetNumbers() const override
+        {
+            return GetNumbersView(*m_value);
+        }
     };
 
+    // Vectors of the integers and the doubles are viewed as the arrays of numbers (see NumbersArrayView)
+    template<typename T>
+    static NumbersArrayView GetNumbersView(const T&)
+    {
+        return NumbersArrayView();
+    }
+
+    static NumbersArrayView GetNumbersView(const std::vector<int64_t>& cont)
+    {
+        NumbersArrayView result;
+        result.integers = cont.data();
+        result.size = cont.size();
+        return result;
+    }
+
+    static NumbersArrayView GetNumbersView(const std::vector<double>& cont)
+    {
+        NumbersArrayView result;
+        result.doubles = cont.data();
+        result.size = cont.size();
+        return result;
+    }
+
     template<typename T>
     static Value CreateFromValue(T&& cont)
     {
@@ -357,17 +630,17 @@ struct Reflector<T, IsReflectedType<T>>
 {
     static auto Create(const T& val)
     {
-        return GenericMap([accessor = ReflectedMapImpl<T>(val)]() {return &accessor;});
+        return GenericMap([accessor = ReflectedTypeImpl<T, true>(val)]() {return &accessor;});
     }
 
     static auto CreateFromPtr(const T* val)
     {
-        return GenericMap([accessor = ReflectedMapImpl<T>(static_cast<const T*>(val))]() {return &accessor;});
+        return GenericMap([accessor = ReflectedTypeImpl<T, false>(static_cast<const T*>(val))]() {return &accessor;});
     }
 
     static auto CreateFromPtr(std::shared_ptr<T> val)
     {
-        return GenericMap([ptr = val, accessor = ReflectedMapImpl<T>(val.get())]() {return &accessor;});
+        return GenericMap([ptr = val, accessor = ReflectedTypeImpl<T, false>(val.get())]() {return &accessor;});
     }
 };
 
@@ -460,7 +733,7 @@ struct Reflector<std::basic_string<CharT>>
         return Value(std::move(str));
     }
     static auto CreateFromPtr(const std::basic_string<CharT>* str) {
-        return Value(*str);
+        return Value(nonstd::basic_string_view<CharT>(*str));
     }
 };
 
@@ -0,0 +1,68 @@
+#ifndef JINJA2CPP_RENDER_PROFILE_H
+#define JINJA2CPP_RENDER_PROFILE_H
+
+#include "config.h"
+#include "error_info.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace jinja2
+{
+//! Statistics of the statement or the expression collected by the profiled renders (see \ref Settings::profileRender)
+struct RenderProfileNode
+{
+    //! Source text of the statement or the expression (e.g. `{% for item in items %}`)
+    std::string description;
+    //! Location of the statement or the expression in the template source
+    SourceLocation location;
+    //! Index of the parent node in \ref RenderProfile::nodes or \ref RenderProfile::NoParent for the top-level nodes
+    size_t parent = 0;
+    //! Number of the renders of the node
+    uint64_t callsCount = 0;
+    //! Total time of the node renders including the nested nodes
+    std::chrono::nanoseconds inclusiveTime{0};
+    //! Total time of the node renders excluding the nested nodes
+    std::chrono::nanoseconds exclusiveTime{0};
+};
+
+/*!
+ * \brief Call tree of the profiled renders of the template
+ *
+ * Node of the tree is the statement or the expression reached by the particular path of the nested statements, includes
+ * and macro calls, so the same statement appears several times if it's reached by the different paths. Parent nodes
+ * precede their children in \ref nodes.
+ */
+struct JINJA2CPP_EXPORT RenderProfile
+{
+    //! Value of \ref RenderProfileNode::parent for the top-level nodes
+    static constexpr size_t NoParent = static_cast<size_t>(-1);
+
+    //! Nodes of the call tree
+    std::vector<RenderProfileNode> nodes;
+
+    /*!
+     * \brief Export the profile in the folded stacks format
+     *
+     * Each line is the path of the node from the root and the exclusive time of it in nanoseconds (e.g.
+     * `page.j2tpl:3 {% for item in items %};item.j2tpl:1 {{ item.name | title }} 1520`). The format is accepted by
+     * the flame graph tools (flamegraph.pl, speedscope, etc.)
+     *
+     * @return Profile in the folded stacks format
+     */
+    std::string ToFoldedStacks() const;
+    /*!
+     * \brief Export the profile in the Chrome trace event format
+     *
+     * The call tree is laid out as the single timeline: each node is the complete event which lasts for its inclusive
+     * time, children follow each other within their parent. The result can be opened by `chrome://tracing` or Perfetto.
+     *
+     * @return Profile as the JSON object of the Chrome trace event format
+     */
+    std::string ToChromeTrace() const;
+};
+} // jinja2
+
+#endif // JINJA2CPP_RENDER_PROFILE_H
@@ -12,6 +12,18 @@ namespace jinja2
 {
 namespace detail
 {
+    // ASCII strings are converted char by char, without the locale-dependent multibyte conversion
+    template<typename CharT>
+    bool IsAsciiString(const nonstd::basic_string_view<CharT>& str)
+    {
+        for (auto ch : str)
+        {
+            if (static_cast<std::make_unsigned_t<CharT>>(ch) >= 0x80)
+                return false;
+        }
+        return true;
+    }
+
     template<typename Src, typename Dst>
     struct StringConverter;
 
@@ -29,6 +41,9 @@ namespace detail
     {
         static std::string DoConvert(const nonstd::wstring_view& from)
         {
+            if (IsAsciiString(from))
+                return std::string(from.begin(), from.end());
+
             std::mbstate_t state = std::mbstate_t();
             auto srcPtr = from.data();
             std::size_t srcSize = from.size();
@@ -64,6 +79,9 @@ namespace detail
     {
         static std::wstring DoConvert(const nonstd::string_view& from)
         {
+            if (IsAsciiString(from))
+                return std::wstring(from.begin(), from.end());
+
             std::mbstate_t state = std::mbstate_t();
             auto srcPtr = from.data();
             std::size_t srcSize = from.size();
@@ -119,6 +137,23 @@ Dst ConvertString(Src&& from)
     return detail::StringConverter<src_t, std::decay_t<Dst>>::DoConvert(nonstd::basic_string_view<typename src_t::value_type>(from));
 }
 
+/*!
+ * \brief Append the string to the string of the other (or the same) char type
+ *
+ * Same as `dst += ConvertString<std::basic_string<DstCharT>>(src)`, but ASCII strings are appended without the temporary string
+ *
+ * @param dst Destination string
+ * @param src Source string
+ */
+template<typename DstCharT, typename SrcCharT>
+void AppendConvertedString(std::basic_string<DstCharT>& dst, const nonstd::basic_string_view<SrcCharT>& src)
+{
+    if (std::is_same<DstCharT, SrcCharT>::value || detail::IsAsciiString(src))
+        dst.append(src.begin(), src.end());
+    else
+        dst += ConvertString<std::basic_string<DstCharT>>(src);
+}
+
 /*!
  * \brief Gets std::string from std::string
  *
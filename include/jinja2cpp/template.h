@@ -3,24 +3,106 @@
 
 #include "config.h"
 #include "error_info.h"
+#include "render_profile.h"
 #include "value.h"
 
 #include <nonstd/expected.hpp>
 
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 namespace jinja2
 {
 class JINJA2CPP_EXPORT ITemplateImpl;
 class JINJA2CPP_EXPORT TemplateEnv;
+class IRenderSessionImpl;
+class RenderSession;
+class RenderSessionW;
 template<typename CharT>
 class TemplateImpl;
+template<typename CharT>
+class SlicesStreamWriter;
 template<typename U>
 using Result = nonstd::expected<U, ErrorInfo>;
 template<typename U>
 using ResultW = nonstd::expected<U, ErrorInfoW>;
+//! Callback which receives rendered narrow char output chunk by chunk
+using OutputSink = std::function<void (const char* data, size_t size)>;
+//! Callback which receives rendered wide char output chunk by chunk
+using OutputSinkW = std::function<void (const wchar_t* data, size_t size)>;
+//! Callback which receives the result of the single narrow char template render of the batch
+using BatchOutputSink = std::function<void (size_t index, const Result<nonstd::string_view>& result)>;
+//! Callback which receives the result of the single wide char template render of the batch
+using BatchOutputSinkW = std::function<void (size_t index, const ResultW<nonstd::wstring_view>& result)>;
+
+//! Slice of the rendered output (see \ref RenderedSlices)
+template<typename CharT>
+struct OutputSlice
+{
+    //! Pointer to the first char of the slice
+    const CharT* data;
+    //! Number of chars in the slice
+    size_t size;
+};
+
+/*!
+ * \brief Rendered output as the sequence of slices
+ *
+ * Static text of the templates is referenced in place, without copying. The rest of the output (the rendered values and the
+ * short text fragments) is stored in the chunks owned by this object. Slices map to the vectored I/O buffers (e.g. `iovec` of
+ * `writev` or `sendmsg`) one-to-one. The object keeps the rendered templates (including the included and imported ones) alive,
+ * so the slices stay valid while it exists, even if the templates are dropped from the environment cache.
+ */
+template<typename CharT>
+class RenderedSlices
+{
+public:
+    //! Static text fragments shorter than this number of chars are copied to the owned chunks instead of referenced
+    static constexpr size_t MinReferencedSize = 64;
+
+    RenderedSlices() = default;
+    RenderedSlices(RenderedSlices&&) = default;
+    RenderedSlices& operator=(RenderedSlices&&) = default;
+    // Copy would refer to the chunks of the original
+    RenderedSlices(const RenderedSlices&) = delete;
+    RenderedSlices& operator=(const RenderedSlices&) = delete;
+
+    //! Slices of the output in order
+    const std::vector<OutputSlice<CharT>>& GetSlices() const { return m_slices; }
+    //! Total size of the output in chars
+    size_t GetSize() const
+    {
+        size_t result = 0;
+        for (auto& s : m_slices)
+            result += s.size;
+        return result;
+    }
+    //! Copy of the output gathered into the single string
+    std::basic_string<CharT> ToString() const
+    {
+        std::basic_string<CharT> result;
+        result.reserve(GetSize());
+        for (auto& s : m_slices)
+            result.append(s.data, s.size);
+        return result;
+    }
+
+private:
+    friend class SlicesStreamWriter<CharT>;
+
+    std::vector<OutputSlice<CharT>> m_slices;
+    // Deque never moves the stored chunks, so the slices of them stay valid while the new ones are added
+    std::deque<std::basic_string<CharT>> m_chunks;
+    std::vector<std::shared_ptr<const void>> m_owners;
+};
+
+template<typename CharT>
+constexpr size_t RenderedSlices<CharT>::MinReferencedSize;
 
 template<typename CharT>
 struct MetadataInfo
@@ -30,6 +112,17 @@ struct MetadataInfo
     SourceLocation location;
 };
 
+//! Variables the template may look up from the render params (see \ref Template::GetUsedVariables)
+struct TemplateVariablesUsage
+{
+    //! Names of the variables which aren't bound by the templates themselves (by `set`, `for`, `macro`, `import` etc.)
+    std::set<std::string> variables;
+    //! Dotted paths of the constant attribute chains accessed on these variables, e.g. `user.name` for both `user.name` and `user['name']`
+    std::set<std::string> attributePaths;
+    //! Names of the referred templates which failed to load, so their variables aren't included
+    std::vector<std::string> unresolvedTemplates;
+};
+
 /*!
  * \brief Template object which is used to render narrow char templates
  *
@@ -44,6 +137,10 @@ struct MetadataInfo
  * tpl.Load(source);
  * std::string result = tpl.RenderAsString(ValuesMap{}).value();
  * ```
+ *
+ * Once loaded, the template is immutable: all the `Render*` and `GetMetadata*` methods can be called concurrently
+ * from several threads on the same instance. All the per-render state lives in the render call itself. `Load`
+ * must not be called concurrently with any other method.
  */
 class JINJA2CPP_EXPORT Template
 {
@@ -104,6 +201,19 @@ public:
      * @return Either noting or instance of \ref ErrorInfoTpl as an error
      */
     Result<void> Load(std::istream& stream, std::string tplName = std::string());
+    /*!
+     * \brief Load template from the externally owned buffer
+     *
+     * Parses the specified text as a source of Jinja2 template without copying it: the loaded template refers to
+     * the buffer (e.g. memory-mapped file) and keeps the owner of it alive. In case of error returns detailed diagnostic
+     *
+     * @param tpl          Narrow char text of the template. Should stay unchanged while the owner is alive
+     * @param sourceOwner  Object which owns the memory of the text
+     * @param tplName      Optional name of the template (for the error reporting purposes)
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    Result<void> Load(nonstd::string_view tpl, std::shared_ptr<const void> sourceOwner, std::string tplName = std::string());
     /*!
      * \brief Load template from the specified file
      *
@@ -115,11 +225,40 @@ public:
      * @return Either noting or instance of \ref ErrorInfoTpl as an error
      */
     Result<void> LoadFromFile(const std::string& fileName);
+    /*!
+     * \brief Load template from the compiled binary image
+     *
+     * Restores the template from the image previously produced by \ref SaveCompiled without parsing the source.
+     * The source itself is still required: the image refers to the text blocks of it and is checked to match it.
+     * Image is also rejected if it was compiled with the different parsing-related settings or by the incompatible
+     * version of the library. In this case \ref ErrorCode::InvalidCompiledTemplate is returned and the template
+     * can be loaded from the source with \ref Load
+     *
+     * @param image    Compiled image of the template
+     * @param tpl      Source of the template which the image was compiled from
+     * @param tplName  Optional name of the template (for the error reporting purposes)
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    Result<void> LoadCompiled(const std::string& image, const std::string& tpl, std::string tplName = std::string());
+    /*!
+     * \brief Save previously loaded template as the compiled binary image
+     *
+     * Produces the compact binary representation of the parsed template which can be loaded back with
+     * \ref LoadCompiled much faster than the source is parsed.
+     *
+     * @param image  String to store the image to
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    Result<void> SaveCompiled(std::string& image);
 
     /*!
      * \brief Render previously loaded template to the narrow char stream
      *
      * Renders previously loaded template to the specified narrow char stream and specified set of params.
+     * Output is written to the stream while rendering is in progress, so in case of error the stream can
+     * already contain part of the result.
      *
      * @param os      Stream to render template to
      * @param params  Set of params which should be passed to the template engine and can be used within the template
@@ -127,6 +266,18 @@ public:
      * @return Either noting or instance of \ref ErrorInfoTpl as an error
      */
     Result<void> Render(std::ostream& os, const ValuesMap& params);
+    /*!
+     * \brief Render previously loaded template to the user-provided sink
+     *
+     * Renders previously loaded template with specified set of params and passes the result to the sink chunk by
+     * chunk while rendering is in progress. In case of error the sink can already have received part of the result.
+     *
+     * @param sink    Callback which receives rendered output
+     * @param params  Set of params which should be passed to the template engine and can be used within the template
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    Result<void> Render(const OutputSink& sink, const ValuesMap& params);
     /*!
      * \brief Render previously loaded template to the narrow char string
      *
@@ -137,6 +288,70 @@ public:
      * @return Either rendered string or instance of \ref ErrorInfoTpl as an error
      */
     Result<std::string> RenderAsString(const ValuesMap& params);
+    /*!
+     * \brief Render previously loaded template to the user-provided narrow char string
+     *
+     * Renders previously loaded template with specified set of params to the specified buffer. The previous content
+     * of the buffer is discarded while its allocated memory is reused, so the same buffer can be passed to the
+     * subsequent render calls to avoid reallocations.
+     *
+     * @param buffer  String to render template to
+     * @param params  Set of params which should be passed to the template engine and can be used within the template
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    Result<void> RenderTo(std::string& buffer, const ValuesMap& params);
+    /*!
+     * \brief Render previously loaded template to the sequence of slices
+     *
+     * Renders previously loaded template with specified set of params. Static text of the templates is referenced by
+     * the result instead of copied, so the large mostly-static output can be sent with the vectored I/O calls without
+     * copying it. See \ref RenderedSlices for details.
+     *
+     * @param params  Set of params which should be passed to the template engine and can be used within the template
+     *
+     * @return Either rendered slices or instance of \ref ErrorInfoTpl as an error
+     */
+    Result<RenderedSlices<char>> RenderSlices(const ValuesMap& params);
+    /*!
+     * \brief Render previously loaded template with the each set of params in parallel
+     *
+     * Renders the template for each set of params from the list on the several threads and passes the results to the
+     * sink. All the renders share the parsed template and the converted global values, and each thread reuses its own
+     * output buffer, so the per-item setup cost is lower than the one of the separate \ref RenderAsString calls.
+     *
+     * @param paramsList    Sets of params to render the template with
+     * @param sink          Callback which receives the index of the item and either the rendered text or the error. Called
+     *                      from the worker threads concurrently. Rendered text is valid until the callback returns. If
+     *                      the callback throws, the rest of the items are skipped and the exception is rethrown
+     * @param threadsCount  Number of the threads (including the calling one) to render on. Zero means the number of the
+     *                      hardware threads
+     */
+    void RenderBatch(const std::vector<ValuesMap>& paramsList, const BatchOutputSink& sink, size_t threadsCount = 0);
+    /*!
+     * \brief Render previously loaded template with the each set of params in parallel
+     *
+     * Same as the sink-based version but collects the results.
+     *
+     * @param paramsList    Sets of params to render the template with
+     * @param threadsCount  Number of the threads (including the calling one) to render on. Zero means the number of the
+     *                      hardware threads
+     *
+     * @return Either rendered string or instance of \ref ErrorInfoTpl as an error for the each set of params
+     */
+    std::vector<Result<std::string>> RenderBatch(const std::vector<ValuesMap>& paramsList, size_t threadsCount = 0);
+    /*!
+     * \brief Create the session for the repeated renders of the template
+     *
+     * Session keeps the parameters, the converted values of them and the output buffer between the render calls, so
+     * the subsequent renders with the same (or slightly changed) parameters don't repeat the setup work. See
+     * \ref RenderSession for details.
+     *
+     * @param params  Initial set of params which should be passed to the template engine
+     *
+     * @return Session object bound to this template
+     */
+    RenderSession CreateRenderSession(ValuesMap params = ValuesMap());
     /*!
      * \brief Get metadata, provided in the {% meta %} tag
      *
@@ -149,6 +364,64 @@ public:
      * @return Non-parsed metadata information or instance of \ref ErrorInfoTpl as an error
      */
     Result<MetadataInfo<char>> GetMetadataRaw();
+    /*!
+     * \brief Get names of the templates this template refers to
+     *
+     * Returns names of the templates used by the `extends`, `include` and `import` statements of the template in order of
+     * their appearance. Only the names specified by the constant expressions are known before the render.
+     *
+     * @return List of the template names. Empty if the template isn't loaded
+     */
+    std::vector<std::string> GetDependencies() const;
+    /*!
+     * \brief Get variables the template may look up from the render params
+     *
+     * The variables are collected at the load time from the template itself and from the templates referred by the `extends`,
+     * `include` and `import` statements with the constant names (see \ref GetDependencies), which are loaded via the
+     * environment. Analysis is conservative: the name bound after its use, in the other template or within the scope
+     * which isn't visible at the use point is reported as the used variable. So the params missing from the result are never
+     * looked up by the render. Templates referred by the computed names aren't analysed. Names of the environment globals
+     * are reported too since the params override them, while the built-in functions (e.g. `range`) aren't.
+     *
+     * @return Used variables and their accessed attributes. Empty if the template isn't loaded
+     */
+    TemplateVariablesUsage GetUsedVariables() const;
+    /*!
+     * \brief Get the memory footprint of the loaded template
+     *
+     * Estimates the heap size of the template source and the parsed tree: the nodes, the links between them and the strings
+     * they own. Allocator overhead isn't included, so the value is approximate. Can be used to choose
+     * \ref Settings::cacheSize for the templates set.
+     *
+     * @return Size in bytes. Zero if the template isn't loaded
+     */
+    size_t GetParsedSize() const;
+    /*!
+     * \brief Get statistics of the profiled renders of the template
+     *
+     * Renders of the templates loaded with \ref Settings::profileRender enabled are accumulated (by all the copies of
+     * the template object) until \ref ResetRenderProfile call. Nodes of the included templates are the children of the
+     * `include` statement nodes.
+     *
+     * @return Call tree of the statements and expressions. Empty if the profiling isn't enabled
+     */
+    RenderProfile GetRenderProfile() const;
+    /*!
+     * \brief Discard statistics of the profiled renders of the template
+     */
+    void ResetRenderProfile();
+    /*!
+     * \brief Get the variant of the template specialized for the frozen globals of the environment
+     *
+     * Expressions of the specialized template which depend on the frozen global variables only (see
+     * \ref TemplateEnv::FreezeGlobals) are evaluated once, the `if` branches with such conditions are resolved and the
+     * static text around them is merged. Specialization is built by the first call and shared by the subsequent ones (and
+     * by all the copies of the template object) until the frozen globals are changed. Specialized template which became
+     * stale renders the generic version of the template. Template created without the environment is returned as is.
+     *
+     * @return Either specialized template or instance of \ref ErrorInfoTpl as an error
+     */
+    Result<Template> Specialize() const;
 
 private:
     std::shared_ptr<ITemplateImpl> m_impl;
@@ -169,6 +442,8 @@ private:
  * tpl.Load(source);
  * std::string result = tpl.RenderAsString(ValuesMap{}).value();
  * ```
+ *
+ * Thread-safety guarantees are the same as for \ref Template.
 */
 class JINJA2CPP_EXPORT TemplateW
 {
@@ -229,6 +504,19 @@ public:
      * @return Either noting or instance of \ref ErrorInfoTpl as an error
      */
     ResultW<void> Load(std::wistream& stream, std::string tplName = std::string());
+    /*!
+     * \brief Load template from the externally owned buffer
+     *
+     * Parses the specified text as a source of Jinja2 template without copying it: the loaded template refers to
+     * the buffer and keeps the owner of it alive. In case of error returns detailed diagnostic
+     *
+     * @param tpl          Wide char text of the template. Should stay unchanged while the owner is alive
+     * @param sourceOwner  Object which owns the memory of the text
+     * @param tplName      Optional name of the template (for the error reporting purposes)
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    ResultW<void> Load(nonstd::wstring_view tpl, std::shared_ptr<const void> sourceOwner, std::string tplName = std::string());
     /*!
      * \brief Load template from the specified file
      *
@@ -240,11 +528,40 @@ public:
      * @return Either noting or instance of \ref ErrorInfoTpl as an error
      */
     ResultW<void> LoadFromFile(const std::string& fileName);
+    /*!
+     * \brief Load template from the compiled binary image
+     *
+     * Restores the template from the image previously produced by \ref SaveCompiled without parsing the source.
+     * The source itself is still required: the image refers to the text blocks of it and is checked to match it.
+     * Image is also rejected if it was compiled with the different parsing-related settings or by the incompatible
+     * version of the library. In this case \ref ErrorCode::InvalidCompiledTemplate is returned and the template
+     * can be loaded from the source with \ref Load
+     *
+     * @param image    Compiled image of the template
+     * @param tpl      Source of the template which the image was compiled from
+     * @param tplName  Optional name of the template (for the error reporting purposes)
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    ResultW<void> LoadCompiled(const std::string& image, const std::wstring& tpl, std::string tplName = std::string());
+    /*!
+     * \brief Save previously loaded template as the compiled binary image
+     *
+     * Produces the compact binary representation of the parsed template which can be loaded back with
+     * \ref LoadCompiled much faster than the source is parsed.
+     *
+     * @param image  String to store the image to
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    ResultW<void> SaveCompiled(std::string& image);
 
     /*!
      * \brief Render previously loaded template to the wide char stream
      *
      * Renders previously loaded template to the specified wide char stream and specified set of params.
+     * Output is written to the stream while rendering is in progress, so in case of error the stream can
+     * already contain part of the result.
      *
      * @param os      Stream to render template to
      * @param params  Set of params which should be passed to the template engine and can be used within the template
@@ -252,6 +569,18 @@ public:
      * @return Either noting or instance of \ref ErrorInfoTpl as an error
      */
     ResultW<void> Render(std::wostream& os, const ValuesMap& params);
+    /*!
+     * \brief Render previously loaded template to the user-provided sink
+     *
+     * Renders previously loaded template with specified set of params and passes the result to the sink chunk by
+     * chunk while rendering is in progress. In case of error the sink can already have received part of the result.
+     *
+     * @param sink    Callback which receives rendered output
+     * @param params  Set of params which should be passed to the template engine and can be used within the template
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    ResultW<void> Render(const OutputSinkW& sink, const ValuesMap& params);
     /*!
      * \brief Render previously loaded template to the wide char string
      *
@@ -262,6 +591,69 @@ public:
      * @return Either rendered string or instance of \ref ErrorInfoTpl as an error
      */
     ResultW<std::wstring> RenderAsString(const ValuesMap& params);
+    /*!
+     * \brief Render previously loaded template to the user-provided wide char string
+     *
+     * Renders previously loaded template with specified set of params to the specified buffer. The previous content
+     * of the buffer is discarded while its allocated memory is reused, so the same buffer can be passed to the
+     * subsequent render calls to avoid reallocations.
+     *
+     * @param buffer  String to render template to
+     * @param params  Set of params which should be passed to the template engine and can be used within the template
+     *
+     * @return Either noting or instance of \ref ErrorInfoTpl as an error
+     */
+    ResultW<void> RenderTo(std::wstring& buffer, const ValuesMap& params);
+    /*!
+     * \brief Render previously loaded template to the sequence of slices
+     *
+     * Renders previously loaded template with specified set of params. Static text of the templates is referenced by
+     * the result instead of copied. See \ref RenderedSlices for details.
+     *
+     * @param params  Set of params which should be passed to the template engine and can be used within the template
+     *
+     * @return Either rendered slices or instance of \ref ErrorInfoTpl as an error
+     */
+    ResultW<RenderedSlices<wchar_t>> RenderSlices(const ValuesMap& params);
+    /*!
+     * \brief Render previously loaded template with the each set of params in parallel
+     *
+     * Renders the template for each set of params from the list on the several threads and passes the results to the
+     * sink. All the renders share the parsed template and the converted global values, and each thread reuses its own
+     * output buffer, so the per-item setup cost is lower than the one of the separate \ref RenderAsString calls.
+     *
+     * @param paramsList    Sets of params to render the template with
+     * @param sink          Callback which receives the index of the item and either the rendered text or the error. Called
+     *                      from the worker threads concurrently. Rendered text is valid until the callback returns. If
+     *                      the callback throws, the rest of the items are skipped and the exception is rethrown
+     * @param threadsCount  Number of the threads (including the calling one) to render on. Zero means the number of the
+     *                      hardware threads
+     */
+    void RenderBatch(const std::vector<ValuesMap>& paramsList, const BatchOutputSinkW& sink, size_t threadsCount = 0);
+    /*!
+     * \brief Render previously loaded template with the each set of params in parallel
+     *
+     * Same as the sink-based version but collects the results.
+     *
+     * @param paramsList    Sets of params to render the template with
+     * @param threadsCount  Number of the threads (including the calling one) to render on. Zero means the number of the
+     *                      hardware threads
+     *
+     * @return Either rendered string or instance of \ref ErrorInfoTpl as an error for the each set of params
+     */
+    std::vector<ResultW<std::wstring>> RenderBatch(const std::vector<ValuesMap>& paramsList, size_t threadsCount = 0);
+    /*!
+     * \brief Create the session for the repeated renders of the template
+     *
+     * Session keeps the parameters, the converted values of them and the output buffer between the render calls, so
+     * the subsequent renders with the same (or slightly changed) parameters don't repeat the setup work. See
+     * \ref RenderSessionW for details.
+     *
+     * @param params  Initial set of params which should be passed to the template engine
+     *
+     * @return Session object bound to this template
+     */
+    RenderSessionW CreateRenderSession(ValuesMap params = ValuesMap());
     /*!
      * \brief Get metadata, provided in the {% meta %} tag
      *
@@ -274,11 +666,218 @@ public:
      * @return Non-parsed metadata information or instance of \ref ErrorInfoTpl as an error
      */
     ResultW<MetadataInfo<wchar_t>> GetMetadataRaw();
+    /*!
+     * \brief Get names of the templates this template refers to
+     *
+     * Returns names of the templates used by the `extends`, `include` and `import` statements of the template in order of
+     * their appearance. Only the names specified by the constant expressions are known before the render.
+     *
+     * @return List of the template names. Empty if the template isn't loaded
+     */
+    std::vector<std::string> GetDependencies() const;
+    /*!
+     * \brief Get variables the template may look up from the render params
+     *
+     * The variables are collected at the load time from the template itself and from the templates referred by the `extends`,
+     * `include` and `import` statements with the constant names (see \ref GetDependencies), which are loaded via the
+     * environment. Analysis is conservative: the name bound after its use, in the other template or within the scope
+     * which isn't visible at the use point is reported as the used variable. So the params missing from the result are never
+     * looked up by the render. Templates referred by the computed names aren't analysed. Names of the environment globals
+     * are reported too since the params override them, while the built-in functions (e.g. `range`) aren't.
+     *
+     * @return Used variables and their accessed attributes. Empty if the template isn't loaded
+     */
+    TemplateVariablesUsage GetUsedVariables() const;
+    /*!
+     * \brief Get the memory footprint of the loaded template
+     *
+     * Estimates the heap size of the template source and the parsed tree: the nodes, the links between them and the strings
+     * they own. Allocator overhead isn't included, so the value is approximate. Can be used to choose
+     * \ref Settings::cacheSize for the templates set.
+     *
+     * @return Size in bytes. Zero if the template isn't loaded
+     */
+    size_t GetParsedSize() const;
+    /*!
+     * \brief Get statistics of the profiled renders of the template
+     *
+     * Renders of the templates loaded with \ref Settings::profileRender enabled are accumulated (by all the copies of
+     * the template object) until \ref ResetRenderProfile call. Nodes of the included templates are the children of the
+     * `include` statement nodes.
+     *
+     * @return Call tree of the statements and expressions. Empty if the profiling isn't enabled
+     */
+    RenderProfile GetRenderProfile() const;
+    /*!
+     * \brief Discard statistics of the profiled renders of the template
+     */
+    void ResetRenderProfile();
+    /*!
+     * \brief Get the variant of the template specialized for the frozen globals of the environment
+     *
+     * Expressions of the specialized template which depend on the frozen global variables only (see
+     * \ref TemplateEnv::FreezeGlobals) are evaluated once, the `if` branches with such conditions are resolved and the
+     * static text around them is merged. Specialization is built by the first call and shared by the subsequent ones (and
+     * by all the copies of the template object) until the frozen globals are changed. Specialized template which became
+     * stale renders the generic version of the template. Template created without the environment is returned as is.
+     *
+     * @return Either specialized template or instance of \ref ErrorInfoTpl as an error
+     */
+    ResultW<TemplateW> Specialize() const;
 
 private:
     std::shared_ptr<ITemplateImpl> m_impl;
     friend class TemplateImpl<wchar_t>;
 };
+
+/*!
+ * \brief Session for the repeated renders of the narrow char template
+ *
+ * Created by \ref Template::CreateRenderSession. Session owns the set of params and keeps the values converted to the
+ * internal representation, the renderer state and the output buffer between the render calls. Individual params can be
+ * changed between the renders: only the changed ones are converted again.
+ *
+ * Basic usage of RenderSession class:
+ * ```c++
+ * jinja2::Template tpl;
+ * tpl.Load("{{ greeting }}, {{ name }}!");
+ *
+ * auto session = tpl.CreateRenderSession({{"greeting", "Hello"}});
+ * for (auto& name : names)
+ * {
+ *     session.SetParam("name", name);
+ *     std::cout << session.RenderAsString().value() << std::endl;
+ * }
+ * ```
+ *
+ * Session keeps the template it was created for alive. Unlike the \ref Template itself, the session object can't be
+ * used from several threads concurrently: each thread should create its own session. Copies of the session share the
+ * same state.
+ */
+class JINJA2CPP_EXPORT RenderSession
+{
+public:
+    /*!
+     * \brief Set (or replace) the value of the param
+     *
+     * @param name   Name of the param
+     * @param value  New value of the param
+     */
+    void SetParam(const std::string& name, Value value);
+    /*!
+     * \brief Remove the param from the session
+     *
+     * @param name  Name of the param
+     */
+    void RemoveParam(const std::string& name);
+    /*!
+     * \brief Replace the whole set of params
+     *
+     * @param params  New set of params
+     */
+    void SetParams(ValuesMap params);
+    /*!
+     * \brief Switch the incremental render on or off
+     *
+     * In the incremental mode the session records the params read by each top level segment of the template (the
+     * text, expression or statement at the template root, including the includes and the macro calls) and keeps the
+     * output of the segments. The next render renders again only the segments which read the params changed since
+     * the previous render (see \ref SetParam and \ref RemoveParam, \ref SetParams changes all of them) and splices the
+     * kept output of the rest ones. Segments which change the rendering context (e.g. set the variables or define the
+     * macros) are rendered every time. Changes of the environment globals and the reloads of the templates drop the
+     * kept output. Rendered values are supposed to depend on the params, the globals and the templates only: results
+     * of the user callables with the side effects (e.g. current time) are kept as well.
+     *
+     * @param enable  Whether the incremental render is on. Off by default
+     */
+    void SetIncrementalRender(bool enable);
+    /*!
+     * \brief Get current set of params
+     *
+     * @return Params which are used for the rendering
+     */
+    const ValuesMap& GetParams() const;
+    /*!
+     * \brief Render the template with the current set of params
+     *
+     * Result is stored in the buffer owned by the session. The buffer is reused by the subsequent render calls, so
+     * the returned view is valid until the next call of this method.
+     *
+     * @return Either view on the rendered string or instance of \ref ErrorInfoTpl as an error
+     */
+    Result<nonstd::string_view> RenderAsString();
+
+private:
+    explicit RenderSession(std::shared_ptr<IRenderSessionImpl> impl)
+        : m_impl(std::move(impl))
+    {
+    }
+
+    std::shared_ptr<IRenderSessionImpl> m_impl;
+    friend class Template;
+};
+
+/*!
+ * \brief Session for the repeated renders of the wide char template
+ *
+ * Created by \ref TemplateW::CreateRenderSession. Behaviour and thread-safety guarantees are the same as for
+ * \ref RenderSession.
+ */
+class JINJA2CPP_EXPORT RenderSessionW
+{
+public:
+    /*!
+     * \brief Set (or replace) the value of the param
+     *
+     * @param name   Name of the param
+     * @param value  New value of the param
+     */
+    void SetParam(const std::string& name, Value value);
+    /*!
+     * \brief Remove the param from the session
+     *
+     * @param name  Name of the param
+     */
+    void RemoveParam(const std::string& name);
+    /*!
+     * \brief Replace the whole set of params
+     *
+     * @param params  New set of params
+     */
+    void SetParams(ValuesMap params);
+    /*!
+     * \brief Switch the incremental render on or off
+     *
+     * See \ref RenderSession::SetIncrementalRender for details.
+     *
+     * @param enable  Whether the incremental render is on. Off by default
+     */
+    void SetIncrementalRender(bool enable);
+    /*!
+     * \brief Get current set of params
+     *
+     * @return Params which are used for the rendering
+     */
+    const ValuesMap& GetParams() const;
+    /*!
+     * \brief Render the template with the current set of params
+     *
+     * Result is stored in the buffer owned by the session. The buffer is reused by the subsequent render calls, so
+     * the returned view is valid until the next call of this method.
+     *
+     * @return Either view on the rendered string or instance of \ref ErrorInfoTpl as an error
+     */
+    ResultW<nonstd::wstring_view> RenderAsString();
+
+private:
+    explicit RenderSessionW(std::shared_ptr<IRenderSessionImpl> impl)
+        : m_impl(std::move(impl))
+    {
+    }
+
+    std::shared_ptr<IRenderSessionImpl> m_impl;
+    friend class TemplateW;
+};
 } // jinja2
 
 #endif // JINJA2_TEMPLATE_H
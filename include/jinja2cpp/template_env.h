@@ -1,13 +1,24 @@
 #ifndef JINJA2CPP_TEMPLATE_ENV_H
 #define JINJA2CPP_TEMPLATE_ENV_H
 
+#include "allocation_stats.h"
 #include "config.h"
 #include "error_info.h"
 #include "filesystem_handler.h"
+#include "fragment_cache.h"
 #include "template.h"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <shared_mutex>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace jinja2
 {
@@ -22,6 +33,13 @@ enum class Jinja2CompatMode
     Vesrsion_2_10, //!< Compatibility with Jinja2 v.2.10 specification
 };
 
+//! Engine which renders the parsed templates
+enum class RenderEngine
+{
+    Ast,      //!< Default engine. Parsed templates are rendered by walking the tree of the statements and expressions
+    Bytecode, //!< Statements and expressions are compiled at load time to the linear instruction streams run by the interpreter loop. Output is the same as of the `Ast` engine
+};
+
 //! Global template environment settings
 struct Settings
 {
@@ -29,6 +47,16 @@ struct Settings
     struct Extensions
     {
         bool Do = false;  //!< Enable use of `do` statement
+        bool Cache = false;  //!< Enable use of `cache` statement (see \ref IFragmentCache)
+    };
+
+    /// Limits of the resources the single render call may consume. Render which exceeds the limit fails with \ref ErrorCode::RenderLimitExceeded. Zero value means no limit
+    struct RenderLimits
+    {
+        std::chrono::milliseconds timeout{0}; //!< Wall-clock time of the render. Checked periodically while the loops and the calls are processed
+        size_t maxOutputSize = 0;             //!< Number of the chars written to the render output
+        size_t maxSteps = 0;                  //!< Number of the loop iterations and the calls of the functions, macros and user callables
+        size_t maxRecursionDepth = 0;         //!< Depth of the nested macro calls, includes, imports and recursive loops
     };
 
     //! Enables use of line statements (yet not supported)
@@ -37,10 +65,40 @@ struct Settings
     bool trimBlocks = false;
     //! Enables blocks stripping (from the left) the same way as it does python Jinja2 engine
     bool lstripBlocks = false;
-    //! Templates cache size
+    //! Enables HTML escaping of the expressions output (same as python Jinja2 `autoescape`). Can be switched in the templates with the `{% autoescape %}` blocks
+    bool autoescape = false;
+    //! Templates cache size. Templates which aren't requested recently are evicted when the limit is reached (CLOCK approximation of the least recently used policy). Zero disables the cache, negative value makes it unbounded
     int cacheSize = 400;
     //! If auto_reload is set to true (default) every time a template is requested the loader checks if the source changed and if yes, it will reload the template
     bool autoReload = true;
+    //! If non-zero (and `autoReload` is enabled), the cached templates are checked for the modifications by the background thread with the specified period instead of the check on every template request. Changed templates are dropped from the cache and loaded again on the next request
+    std::chrono::milliseconds autoReloadInterval{0};
+    //! If enabled, templates are loaded from the compiled images (`<template name>.j2c` files produced by \ref Template::SaveCompiled and stored next to the sources) when the image matches the source
+    bool usePrecompiledTemplates = false;
+    //! If enabled, the cached templates with the identical sources share the single parsed template regardless of their names, so the duplicates aren't parsed and stored again. Errors of such templates refer to the name the template was loaded with first. Ignored if `usePrecompiledTemplates` is enabled
+    bool deduplicateTemplates = false;
+    //! If enabled, the statically known dependencies of the loaded template (the targets of its `extends`, `include` and `import` statements) are loaded into the cache in the background, so the render doesn't wait for them one by one. Filesystem handlers are notified of them beforehand (see \ref IFilesystemHandler::Prefetch). Ignored if the cache is disabled
+    bool prefetchDependencies = false;
+    //! If enabled, the adjacent top-level `{% include %}` statements and `{% block %}`s without `set`/`import`/`macro` statements are rendered concurrently, each into its own buffer. Such children shouldn't depend on the variables set by the preceding siblings, and the render params should be safe for the concurrent reading
+    bool parallelRender = false;
+    //! If enabled, the renders collect the number of calls and the time of each statement and expression of the templates (see \ref Template::GetRenderProfile). Applies to the templates parsed from the sources. Profiled templates are rendered sequentially regardless of `parallelRender`
+    bool profileRender = false;
+    //! Engine which renders the templates (see \ref RenderEngine). Profiled templates are rendered by the `Ast` engine
+    RenderEngine renderEngine = RenderEngine::Ast;
+    //! If enabled, the environment collects the load, render and filesystem access metrics of its templates (see \ref TemplateEnv::GetMetrics)
+    bool collectMetrics = false;
+    //! If enabled, the heap usage of each render call is reported to the allocation listener of the environment (see \ref TemplateEnv::SetAllocationListener)
+    bool trackAllocations = false;
+    //! If enabled, the runtime lists (e.g. the ones of the render params) probed by the `in` tests a few times during the render are looked up by the hash index built on the fly instead of the items scan. Applies to the lists of integers and strings. Lists of the literals are indexed at load time regardless of this option
+    bool indexMembershipTests = false;
+    //! Minimal size of the indexable lists the `map`, `select`/`reject`, `selectattr`/`rejectattr`, `sum`, `min`/`max`, `sort` and `unique` filters process in parallel, split into the chunks. Zero disables the parallel execution. Results are the same as the sequential ones. `map`, `select` and `reject` are executed in parallel only with the built-in filters and testers with the constant params, which don't have side effects. List items and their attributes should be safe for the concurrent reading
+    size_t parallelFilterThreshold = 0;
+    //! Number of the threads (including the rendering one) the filters are executed on if the list reaches `parallelFilterThreshold`. Zero means the number of the hardware threads
+    size_t parallelFilterThreads = 0;
+    //! Size of the chunks the output is passed to the sinks with (see \ref Template::Render). Larger chunks suit the streaming compressors (see \ref GzipOutputSink) better. The rendered value which crosses the chunk boundary stays in the chunk, and the text fragments longer than the chunk are passed through as is
+    size_t outputChunkSize = 4096;
+    //! Limits of the render calls (see \ref RenderLimits)
+    RenderLimits renderLimits;
     //! Extensions set enabled for templates
     Extensions extensions;
     //! Controls Jinja2 compatibility mode
@@ -49,6 +107,97 @@ struct Settings
     std::string m_defaultMetadataType = "json";
 };
 
+//! Statistics of the templates cache
+struct TemplateCacheStats
+{
+    //! Number of templates which are currently cached (both narrow and wide char ones)
+    size_t size = 0;
+    //! Number of template requests served from the cache
+    uint64_t hits = 0;
+    //! Number of template requests which caused (re)loading of the template
+    uint64_t misses = 0;
+    //! Number of templates removed from the cache due to the cache size limit
+    uint64_t evictions = 0;
+    //! Number of cached templates which are reloaded (or dropped from the cache) because of the modification of their sources
+    uint64_t reloads = 0;
+    //! Number of loaded templates which share the parsed template with the cached one with the same source (see \ref Settings::deduplicateTemplates)
+    uint64_t duplicates = 0;
+};
+
+//! Distribution of the durations over the exponential buckets
+struct DurationHistogram
+{
+    //! Number of the buckets. Upper bound of the bucket N is 2^N microseconds, the last bucket is unbounded
+    static constexpr size_t BucketsCount = 25;
+
+    //! Number of the durations which fall into each bucket (buckets aren't cumulative)
+    std::array<uint64_t, BucketsCount> buckets{};
+    //! Total number of the durations
+    uint64_t count = 0;
+    //! Sum of the durations
+    std::chrono::nanoseconds sum{0};
+
+    //! Upper bound (inclusive) of the specified bucket
+    static std::chrono::nanoseconds GetBucketBound(size_t bucket)
+    {
+        return bucket + 1 < BucketsCount ? std::chrono::nanoseconds(std::chrono::microseconds(int64_t(1) << bucket)) : std::chrono::nanoseconds::max();
+    }
+};
+
+//! Metrics of the templates environment (see \ref Settings::collectMetrics)
+struct TemplateEnvMetrics
+{
+    //! Statistics of the templates cache. Collected regardless of \ref Settings::collectMetrics
+    TemplateCacheStats cache;
+    //! Time of the template loads (the source reading and parsing) by the template name. Counters of the template are dropped when it's evicted from the cache. Number of the names is limited by the larger of \ref Settings::cacheSize and 1024, loads of the rest names aren't counted per name
+    std::unordered_map<std::string, DurationHistogram> loadTime;
+    //! Time of the render calls of the templates, both the successful and the failed ones
+    DurationHistogram renderTime;
+    //! Number of the failed render calls
+    uint64_t failedRenders = 0;
+    //! Size of the rendered output in bytes
+    uint64_t renderedBytes = 0;
+    //! Time of the filesystem handlers calls which open the templates. Count of the calls includes the requests of the missing files
+    DurationHistogram filesystemOpenTime;
+    //! Time of the filesystem handlers calls which check the modification of the templates
+    DurationHistogram filesystemCheckTime;
+};
+
+//! Kind of the event reported to the metrics listener (see \ref TemplateEnv::SetMetricsListener)
+enum class MetricsEvent
+{
+    TemplateLoaded,   //!< Template is loaded from the source
+    TemplateRendered, //!< Render call is finished successfully
+    RenderFailed,     //!< Render call is failed
+    FilesystemOpen,   //!< Filesystem handler is requested to open the template
+    FilesystemCheck   //!< Filesystem handler is requested for the modification date of the template
+};
+
+/*!
+ * \brief Callback which receives the metrics events as they happen
+ *
+ * Called on the thread which causes the event, so it should be thread-safe and fast.
+ *
+ * @param event         Kind of the event
+ * @param templateName  Name of the template
+ * @param duration      Duration of the operation
+ * @param bytes         Size of the render output (in bytes) for the render events, zero for the rest ones
+ */
+using MetricsListener = std::function<void (MetricsEvent event, const std::string& templateName, std::chrono::nanoseconds duration, uint64_t bytes)>;
+
+/*!
+ * \brief Callback which receives the heap usage of the render calls (see \ref Settings::trackAllocations)
+ *
+ * Called on the thread which renders the template after each render call, including the failed ones.
+ *
+ * @param templateName  Name of the rendered template
+ * @param stats         Heap usage of the render call
+ */
+using AllocationListener = std::function<void (const std::string& templateName, const RenderAllocationStats& stats)>;
+
+//! Dependencies of the cached templates: name of the template mapped to the names of the templates it refers to
+using TemplateDependencyGraph = std::unordered_map<std::string, std::vector<std::string>>;
+
 /*!
  * \brief Global template environment which controls behaviour of the different \ref Template instances
  *
@@ -63,7 +212,14 @@ class JINJA2CPP_EXPORT TemplateEnv
 {
 public:
     using TimePoint = std::chrono::system_clock::time_point;
-    using TimeStamp = std::chrono::steady_clock::time_point;
+
+    TemplateEnv() = default;
+    /*!
+     * \brief Destructor
+     *
+     * Stops the background templates modification checker (see \ref Settings::autoReloadInterval)
+     */
+    ~TemplateEnv();
 
     /*!
      * \brief Returns global settings for the environment
@@ -135,6 +291,23 @@ public:
     {
         m_filesystemHandlers.push_back(FsHandler{std::move(prefix), std::shared_ptr<IFilesystemHandler>(&h, [](auto*) {})});
     }
+    /*!
+     * \brief Replace the storage of the rendered fragments
+     *
+     * Storage keeps the rendered bodies of the `{% cache %}` statements (see \ref Settings::Extensions::Cache). By default
+     * the environment uses \ref MemoryFragmentCache. Empty pointer disables the caching, the bodies are rendered every time.
+     * Method is thread-unsafe. It's dangerous to replace the storage and render templates simultaneously.
+     *
+     * @param cache Shared pointer to the storage
+     */
+    void SetFragmentCache(FragmentCachePtr cache) { m_fragmentCache = std::move(cache); }
+    /*!
+     * \brief Returns the storage of the rendered fragments
+     *
+     * @return Pointer to the storage. Can be empty
+     */
+    IFragmentCache* GetFragmentCache() const { return m_fragmentCache.get(); }
+
     /*!
      * \brief Load narrow char template with the specified name via registered file handlers
      *
@@ -159,6 +332,76 @@ public:
      * @return Either loaded template or load/parse error. See \ref ErrorInfoTpl
      */
     nonstd::expected<TemplateW, ErrorInfoW> LoadTemplateW(std::string fileName);
+    /*!
+     * \brief Returns the metadata of the narrow char template with the specified name without loading the template
+     *
+     * Only the `{% meta %}` block of the template is processed: the source is scanned up to the end of the block, the template
+     * body isn't parsed. Parsed metadata is cached per template name (unless the cache is disabled by \ref Settings::cacheSize)
+     * and shared by all the requests, so the returned map is read-only. The map keeps the parsed metadata alive while it's
+     * referenced. Cache entries are dropped by \ref InvalidateTemplate and by the modification of the template sources (see
+     * \ref Settings::autoReload). If the template itself is already cached, its metadata is returned (see \ref Template::GetMetadata).
+     * Method is thread-safe. It's dangerous to add new filesystem handlers and request the metadata simultaneously.
+     *
+     * @param fileName Template name
+     *
+     * @return Either the metadata of the template (empty map if the template has no metadata) or load/metadata parse error
+     */
+    nonstd::expected<GenericMap, ErrorInfo> LoadMetadata(const std::string& fileName);
+    /*!
+     * \brief Load narrow char template with the specified name specialized for the frozen global variables
+     *
+     * Template is loaded via \ref LoadTemplate and specialized via \ref Template::Specialize, so the specialization is shared
+     * by the requests while neither the template nor the frozen globals (see \ref FreezeGlobals) are changed.
+     * Method is thread-unsafe. It's dangerous to add new filesystem handlers and load templates simultaneously.
+     *
+     * @param fileName Template name to load
+     *
+     * @return Either specialized template or load/parse error. See \ref ErrorInfoTpl
+     */
+    nonstd::expected<Template, ErrorInfo> LoadSpecializedTemplate(std::string fileName);
+    /*!
+     * \brief Load wide char template with the specified name specialized for the frozen global variables
+     *
+     * Same as \ref LoadSpecializedTemplate, but for the wide char templates.
+     * Method is thread-unsafe. It's dangerous to add new filesystem handlers and load templates simultaneously.
+     *
+     * @param fileName Template name to load
+     *
+     * @return Either specialized template or load/parse error. See \ref ErrorInfoTpl
+     */
+    nonstd::expected<TemplateW, ErrorInfoW> LoadSpecializedTemplateW(std::string fileName);
+    /*!
+     * \brief Load the specified narrow char templates and the templates they depend on in parallel
+     *
+     * Warms up the templates cache, so the first requests of the templates don't parse them. Along with the specified templates
+     * the ones referred by their `extends`, `include` and `import` statements (with the constant names) are loaded as well.
+     * Templates are loaded via \ref LoadTemplate, so the cache settings are respected. With the disabled cache method only
+     * validates the templates.
+     * Method is thread-unsafe. It's dangerous to add new filesystem handlers and preload templates simultaneously.
+     *
+     * @param fileNames     Names of the templates to load
+     * @param threadsCount  Number of the threads (including the calling one) to load on. Zero means the number of the hardware
+     *                      threads
+     *
+     * @return Errors of the specified templates which failed to load. Errors of the dependencies aren't reported, because the
+     *         missing dependencies may be optional (e.g. `include ... ignore missing`)
+     */
+    std::vector<ErrorInfo> Preload(std::vector<std::string> fileNames, size_t threadsCount = 0);
+    /*!
+     * \brief Load the narrow char templates matching the specified pattern and the templates they depend on in parallel
+     *
+     * Same as \ref Preload but the templates are enumerated via the registered filesystem handlers (see
+     * \ref IFilesystemHandler::ListFiles). In the pattern '*' matches any sequence of chars (including '/') and '?' matches any
+     * single char. E.g. `"*.j2tpl"` or `"mail/*"`.
+     * Method is thread-unsafe. It's dangerous to add new filesystem handlers and preload templates simultaneously.
+     *
+     * @param pattern       Pattern of the template names
+     * @param threadsCount  Number of the threads (including the calling one) to load on. Zero means the number of the hardware
+     *                      threads
+     *
+     * @return Errors of the matching templates which failed to load
+     */
+    std::vector<ErrorInfo> PreloadByPattern(const std::string& pattern, size_t threadsCount = 0);
 
     /*!
      * \brief Add global variable to the environment
@@ -172,7 +415,10 @@ public:
     void AddGlobal(std::string name, Value val)
     {
         std::unique_lock<std::shared_timed_mutex> l(m_guard);
+        if (m_frozenGlobals.count(name) != 0)
+            ++ m_frozenGlobalsVersion;
         m_globalValues[std::move(name)] = std::move(val);
+        ++ m_globalsVersion;
     }
     /*!
      * \brief Remove global variable from the environment
@@ -185,7 +431,30 @@ public:
     void RemoveGlobal(const std::string& name)
     {
         std::unique_lock<std::shared_timed_mutex> l(m_guard);
+        if (m_frozenGlobals.count(name) != 0)
+            ++ m_frozenGlobalsVersion;
         m_globalValues.erase(name);
+        ++ m_globalsVersion;
+    }
+    /*!
+     * \brief Freeze the global variables with the specified names
+     *
+     * Frozen globals are treated as the constants by the specialized templates (see \ref LoadSpecializedTemplate and
+     * \ref Template::Specialize): the expressions which depend on them only are evaluated once the template is specialized, the
+     * `if` branches with such conditions are resolved and the static text around them is merged. Specialized templates are
+     * rebuilt by the subsequent requests once any of the frozen globals is changed via \ref AddGlobal or \ref RemoveGlobal;
+     * the stale ones render the generic version of the template meanwhile. Globals may be frozen before they're added.
+     * Frozen globals take precedence over the render params with the same names in the specialized templates. Names bound
+     * by the template itself (with `set`, `for`, `with`, `import`, macro params and so on) aren't folded.
+     * Method is thread-safe.
+     *
+     * @param names Names of the global variables to freeze
+     */
+    void FreezeGlobals(const std::vector<std::string>& names)
+    {
+        std::unique_lock<std::shared_timed_mutex> l(m_guard);
+        m_frozenGlobals.insert(names.begin(), names.end());
+        ++ m_frozenGlobalsVersion;
     }
 
     /*!
@@ -204,9 +473,157 @@ public:
         fn(m_globalValues);
     }
 
+    /*!
+     * \brief Returns the version of the global variables set
+     *
+     * Version is changed by every \ref AddGlobal or \ref RemoveGlobal call, so the templates can cache the converted globals
+     * between the render calls. Method is thread-safe.
+     *
+     * @return Current version of the global variables set
+     */
+    uint64_t GetGlobalsVersion() const { return m_globalsVersion.load(); }
+
+    /*!
+     * \brief Call the specified function with the current set of global variables and the names of the frozen ones under the internal lock
+     *
+     * Same as \ref ApplyGlobals, but the functional object gets the names of the frozen globals (see \ref FreezeGlobals) as the
+     * second argument.
+     *
+     * @tparam Fn Type of the functional object to call
+     * @param fn Functional object to call
+     */
+    template<typename Fn>
+    void ApplyFrozenGlobals(Fn&& fn)
+    {
+        std::shared_lock<std::shared_timed_mutex> l(m_guard);
+        fn(m_globalValues, m_frozenGlobals);
+    }
+
+    /*!
+     * \brief Returns the version of the frozen global variables
+     *
+     * Version is changed by every \ref FreezeGlobals call and by the \ref AddGlobal or \ref RemoveGlobal calls for the frozen
+     * globals, so the specialized templates can detect the changes. Method is thread-safe.
+     *
+     * @return Current version of the frozen global variables
+     */
+    uint64_t GetFrozenGlobalsVersion() const { return m_frozenGlobalsVersion.load(); }
+
+    /*!
+     * \brief Returns the version of the cached templates set
+     *
+     * Version is changed every time a template is removed from the cache (because of the modification of its source or
+     * due to the cache size limit) or replaced in it, so the templates linked with the cached ones (e.g. the parents of
+     * the extending template) can detect the changes. Method is thread-safe.
+     *
+     * @return Current version of the cached templates set
+     */
+    uint64_t GetTemplatesVersion() const { return m_templatesVersion.load(); }
+
+    /*!
+     * \brief Returns current statistics of the templates cache
+     *
+     * Method is thread-safe.
+     *
+     * @return Snapshot of the cache counters
+     */
+    TemplateCacheStats GetCacheStats() const;
+
+    /*!
+     * \brief Returns the dependencies of the cached templates
+     *
+     * Dependencies are the templates referred by the `extends`, `include` and `import` statements with the constant names (see
+     * \ref Template::GetDependencies). When the cached template is reloaded (or dropped because of the modification of its
+     * source), the templates which depend on it directly or indirectly are removed from the cache as well.
+     * Method is thread-safe.
+     *
+     * @return Dependencies of the narrow and wide char templates which are currently cached
+     */
+    TemplateDependencyGraph GetDependencyGraph() const;
+    /*!
+     * \brief Returns the names of the cached templates which depend on the specified one directly or indirectly
+     *
+     * Method is thread-safe.
+     *
+     * @param fileName Name of the template
+     *
+     * @return Names of the dependent templates in the order of the distance from the specified one
+     */
+    std::vector<std::string> GetDependentTemplates(const std::string& fileName) const;
+    /*!
+     * \brief Remove the specified template and the templates which depend on it from the cache
+     *
+     * Next requests of the removed templates reload them. Method is thread-safe.
+     *
+     * @param fileName Name of the template
+     */
+    void InvalidateTemplate(const std::string& fileName);
+
+    /*!
+     * \brief Returns current metrics of the environment
+     *
+     * Load, render and filesystem metrics are collected if \ref Settings::collectMetrics is enabled. Renders are counted
+     * for the templates loaded by this environment or created with it. Method is thread-safe.
+     *
+     * @return Snapshot of the metrics
+     */
+    TemplateEnvMetrics GetMetrics() const;
+    /*!
+     * \brief Set the callback which receives the metrics events (e.g. for the push-based exporters)
+     *
+     * Events are reported if \ref Settings::collectMetrics is enabled. Method is thread-safe.
+     *
+     * @param listener Callback to set. Empty callback removes the current one
+     */
+    void SetMetricsListener(MetricsListener listener);
+    /*!
+     * \brief Set the callback which receives the heap usage of the render calls
+     *
+     * Renders are tracked if \ref Settings::trackAllocations is enabled. Allocations are counted only if the application reports
+     * them by \ref TrackAllocation and \ref TrackDeallocation. Method is thread-safe.
+     *
+     * @param listener Callback to set. Empty callback removes the current one
+     */
+    void SetAllocationListener(AllocationListener listener);
+
 private:
+    template<typename CharT>
+    friend class TemplateImpl;
+
+    // Lock-free counters of DurationHistogram
+    struct HistogramCounters
+    {
+        std::array<std::atomic<uint64_t>, DurationHistogram::BucketsCount> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<int64_t> sum{0};
+
+        void Add(std::chrono::nanoseconds duration);
+        DurationHistogram Get() const;
+    };
+
+    void RecordMetric(MetricsEvent event, const std::string& templateName, std::chrono::nanoseconds duration, uint64_t bytes = 0);
+    std::shared_ptr<const AllocationListener> GetAllocationListener() const { return std::atomic_load(&m_allocationListener); }
+    template<typename Fn>
+    auto CallFilesystem(MetricsEvent event, const std::string& fileName, Fn&& fn);
+    template<typename CharT, typename T, typename Cache, typename InFlightLoads>
+    auto LoadTemplateImpl(TemplateEnv* env, std::string fileName, const T& filesystemHandlers, Cache& cache, InFlightLoads& inFlightLoads);
     template<typename CharT, typename T, typename Cache>
-    auto LoadTemplateImpl(TemplateEnv* env, std::string fileName, const T& filesystemHandlers, Cache& cache);
+    auto ReadTemplateImpl(TemplateEnv* env, const std::string& fileName, const T& filesystemHandlers, Cache& cache);
+    template<typename Cache, typename Fn>
+    void UpdateCache(Cache& cache, Fn&& fn);
+    template<typename Cache>
+    void EvictCacheEntries(Cache& cache, const std::string& newEntryName);
+    template<typename Cache>
+    void EraseDependentEntries(Cache& cache, const std::string& fileName);
+    void StartReloadChecker();
+    void CheckModifiedTemplates();
+    void DropModifiedMetadata();
+    template<typename Cache>
+    void DropModifiedTemplates(Cache& cache);
+    template<typename Entries>
+    std::vector<bool> CheckModifiedEntries(const Entries& entries);
+    template<typename CharT, typename Cache>
+    void PrefetchDependencies(const std::vector<std::string>& fileNames, const Cache& cache);
 
 
 private:
@@ -219,26 +636,241 @@ private:
     struct BaseTemplateInfo
     {
         nonstd::optional<TimePoint> lastModification;
-        TimeStamp lastAccessTime;
+        // Reference bit of the CLOCK eviction. Set by the template requests, cleared by the eviction pass
+        std::atomic<bool> isReferenced{false};
         FilesystemHandlerPtr handler;
+        std::vector<std::string> dependencies;
+        // Hash of the source. Set if the templates are deduplicated
+        uint64_t contentHash = 0;
     };
 
     struct TemplateCacheEntry : public BaseTemplateInfo
     {
         Template tpl;
+        std::shared_ptr<const nonstd::string_view> source;
     };
 
     struct TemplateWCacheEntry : public BaseTemplateInfo
     {
         TemplateW tpl;
+        std::shared_ptr<const nonstd::wstring_view> source;
+    };
+
+    // Metadata scanned without loading the template (see LoadMetadata)
+    struct MetadataCacheEntry
+    {
+        nonstd::optional<TimePoint> lastModification;
+        FilesystemHandlerPtr handler;
+        GenericMap values;
     };
 
     std::vector<FsHandler> m_filesystemHandlers;
     Settings m_settings;
+    FragmentCachePtr m_fragmentCache = std::make_shared<MemoryFragmentCache>();
     ValuesMap m_globalValues;
-    std::shared_timed_mutex m_guard;
-    std::unordered_map<std::string, TemplateCacheEntry> m_templateCache;
-    std::unordered_map<std::string, TemplateWCacheEntry> m_templateWCache;
+    std::unordered_set<std::string> m_frozenGlobals;
+
+    // Cached templates split into the shards by the hash of the name. Template requests lock the shard of the name for reading only,
+    // so the requests of the different templates rarely meet on the same lock. Entries are modified in place, one at a time.
+    // Modifications should be serialized by the caller. Entries are evicted by the CLOCK algorithm: the ring of the entries is swept
+    // by the hand, which skips (and unmarks) the entries requested since the previous sweep and evicts the first unmarked one
+    template<typename Entry>
+    class TemplatesCache
+    {
+    public:
+        using EntryPtr = std::shared_ptr<Entry>;
+        using value_type = std::pair<std::string, EntryPtr>;
+        static constexpr size_t ShardsCount = 32;
+
+        EntryPtr Find(const std::string& name) const
+        {
+            auto& shard = GetShard(name);
+            std::shared_lock<std::shared_timed_mutex> l(shard.guard);
+            auto p = shard.entries.find(name);
+            return p == shard.entries.end() ? EntryPtr() : p->second.entry;
+        }
+        bool Contains(const std::string& name) const { return !!Find(name); }
+        // Returns the replaced entry (if any)
+        EntryPtr Insert(const std::string& name, EntryPtr entry)
+        {
+            auto& shard = GetShard(name);
+            std::unique_lock<std::shared_timed_mutex> l(shard.guard);
+            auto p = shard.entries.find(name);
+            if (p == shard.entries.end())
+            {
+                size_t slot = m_clock.size();
+                if (m_freeSlots.empty())
+                    m_clock.emplace_back();
+                else
+                {
+                    slot = m_freeSlots.back();
+                    m_freeSlots.pop_back();
+                }
+                m_clock[slot] = value_type(name, entry);
+                AddContent(entry);
+                shard.entries.emplace(name, Item{std::move(entry), slot});
+                m_size.fetch_add(1, std::memory_order_relaxed);
+                return EntryPtr();
+            }
+
+            m_clock[p->second.clockSlot].second = entry;
+            AddContent(entry);
+            std::swap(p->second.entry, entry);
+            RemoveContent(entry);
+            return entry;
+        }
+        // Returns the removed entry (if any)
+        EntryPtr Erase(const std::string& name)
+        {
+            auto& shard = GetShard(name);
+            std::unique_lock<std::shared_timed_mutex> l(shard.guard);
+            auto p = shard.entries.find(name);
+            if (p == shard.entries.end())
+                return EntryPtr();
+
+            auto result = std::move(p->second.entry);
+            RemoveContent(result);
+            m_clock[p->second.clockSlot] = value_type();
+            m_freeSlots.push_back(p->second.clockSlot);
+            shard.entries.erase(p);
+            m_size.fetch_sub(1, std::memory_order_relaxed);
+            return result;
+        }
+        // Removes the next entry selected by the CLOCK hand. Returns the name of the removed entry, or nothing if the cache is empty
+        nonstd::optional<std::string> EvictOne()
+        {
+            if (GetSize() == 0)
+                return nonstd::optional<std::string>();
+
+            for (;;)
+            {
+                auto& slot = m_clock[m_clockHand];
+                m_clockHand = (m_clockHand + 1) % m_clock.size();
+                if (!slot.second)
+                    continue;
+                if (slot.second->isReferenced.exchange(false, std::memory_order_relaxed))
+                    continue;
+
+                auto name = slot.first;
+                Erase(name);
+                return name;
+            }
+        }
+        std::vector<value_type> GetEntries() const
+        {
+            std::vector<value_type> result;
+            for (auto& shard : m_shards)
+            {
+                std::shared_lock<std::shared_timed_mutex> l(shard.guard);
+                for (auto& e : shard.entries)
+                    result.emplace_back(e.first, e.second.entry);
+            }
+            return result;
+        }
+        size_t GetSize() const { return m_size.load(std::memory_order_relaxed); }
+        // Returns the entry with the specified hash of the source (see Settings::deduplicateTemplates) which satisfies 'pred'
+        template<typename Fn>
+        EntryPtr FindByContentHash(uint64_t contentHash, Fn&& pred) const
+        {
+            std::lock_guard<std::mutex> l(m_contentsGuard);
+            auto range = m_contents.equal_range(contentHash);
+            for (auto p = range.first; p != range.second; ++ p)
+            {
+                if (pred(*p->second))
+                    return p->second;
+            }
+            return EntryPtr();
+        }
+
+    private:
+        struct Item
+        {
+            EntryPtr entry;
+            size_t clockSlot;
+        };
+
+        struct Shard
+        {
+            mutable std::shared_timed_mutex guard;
+            std::unordered_map<std::string, Item> entries;
+        };
+
+        // Entries without the source hash (loaded with the disabled deduplication) aren't indexed
+        void AddContent(const EntryPtr& entry)
+        {
+            if (!entry->contentHash)
+                return;
+
+            std::lock_guard<std::mutex> l(m_contentsGuard);
+            m_contents.emplace(entry->contentHash, entry);
+        }
+        void RemoveContent(const EntryPtr& entry)
+        {
+            if (!entry || !entry->contentHash)
+                return;
+
+            std::lock_guard<std::mutex> l(m_contentsGuard);
+            auto range = m_contents.equal_range(entry->contentHash);
+            for (auto p = range.first; p != range.second; ++ p)
+            {
+                if (p->second == entry)
+                {
+                    m_contents.erase(p);
+                    break;
+                }
+            }
+        }
+
+        const Shard& GetShard(const std::string& name) const { return m_shards[std::hash<std::string>()(name) % ShardsCount]; }
+        Shard& GetShard(const std::string& name) { return m_shards[std::hash<std::string>()(name) % ShardsCount]; }
+
+        std::array<Shard, ShardsCount> m_shards;
+        std::atomic<size_t> m_size{0};
+        // Ring of the CLOCK eviction. Free slots are empty and are reused by the next inserted entries
+        std::vector<value_type> m_clock;
+        std::vector<size_t> m_freeSlots;
+        size_t m_clockHand = 0;
+        mutable std::mutex m_contentsGuard;
+        std::unordered_multimap<uint64_t, EntryPtr> m_contents;
+    };
+
+    mutable std::shared_timed_mutex m_guard;
+    // Modifications of the caches are serialized by m_cacheUpdateGuard (see UpdateCache). Template requests don't take it
+    TemplatesCache<TemplateCacheEntry> m_templateCache;
+    TemplatesCache<TemplateWCacheEntry> m_templateWCache;
+    std::mutex m_cacheUpdateGuard;
+    std::atomic<uint64_t> m_globalsVersion{0};
+    std::atomic<uint64_t> m_frozenGlobalsVersion{0};
+    std::atomic<uint64_t> m_templatesVersion{0};
+    std::atomic<uint64_t> m_cacheHits{0};
+    std::atomic<uint64_t> m_cacheMisses{0};
+    std::atomic<uint64_t> m_cacheEvictions{0};
+    std::atomic<uint64_t> m_cacheReloads{0};
+    std::atomic<uint64_t> m_cacheDuplicates{0};
+    // Metrics (see Settings::collectMetrics). Counters of the hot paths are the relaxed atomics
+    HistogramCounters m_renderTime;
+    std::atomic<uint64_t> m_failedRenders{0};
+    std::atomic<uint64_t> m_renderedBytes{0};
+    HistogramCounters m_filesystemOpenTime;
+    HistogramCounters m_filesystemCheckTime;
+    mutable std::mutex m_loadTimeGuard;
+    std::unordered_map<std::string, HistogramCounters> m_loadTime;
+    std::shared_ptr<const MetricsListener> m_metricsListener;
+    std::shared_ptr<const AllocationListener> m_allocationListener;
+    std::mutex m_inFlightGuard;
+    std::unordered_map<std::string, std::shared_future<nonstd::expected<Template, ErrorInfo>>> m_inFlightLoads;
+    std::unordered_map<std::string, std::shared_future<nonstd::expected<TemplateW, ErrorInfoW>>> m_inFlightWLoads;
+    mutable std::mutex m_metadataCacheGuard;
+    std::unordered_map<std::string, std::shared_ptr<const MetadataCacheEntry>> m_metadataCache;
+    std::once_flag m_reloadCheckerStarted;
+    std::thread m_reloadChecker;
+    std::mutex m_reloadCheckerGuard;
+    std::condition_variable m_reloadCheckerStop;
+    bool m_isStopping = false;
+    // Background loads of the dependencies (see Settings::prefetchDependencies)
+    std::mutex m_prefetchGuard;
+    std::vector<std::future<void>> m_prefetchTasks;
+    bool m_isPrefetchStopped = false;
 };
 
 } // jinja2
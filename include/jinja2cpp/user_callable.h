@@ -6,6 +6,7 @@
 
 #include <nonstd/optional.hpp>
 
+#include <memory>
 #include <tuple>
 #include <type_traits>
 
@@ -163,9 +164,11 @@ struct UCInvoker
     }
 };
 
-inline const Value& GetParamValue(const UserCallableParams& params, const ArgInfo& info)
+inline const Value& GetParamValue(const UserCallableParams& params, const ArgInfo& info, size_t idx)
 {
-    // static Value empty;
+    if (idx < params.argValues.size() && info.paramName[0] != '*')
+        return params.argValues[idx];
+
     auto p = params.args.find(info.paramName);
     if (p != params.args.end())
         return p->second;
@@ -209,11 +212,17 @@ struct ParamUnwrapper
     }
 };
 
+template<typename Fn, size_t ... Idx, typename ... ArgDescr>
+Value InvokeUserCallableImpl(Fn&& fn, const UserCallableParams& params, std::index_sequence<Idx...>, ArgDescr&& ... ad)
+{
+    auto invoker = UCInvoker<Fn>(fn, params);
+    return nonstd::visit(ParamUnwrapper<UCInvoker<Fn>>(&invoker), GetParamValue(params, ad, Idx).data()...);
+}
+
 template<typename Fn, typename ... ArgDescr>
 Value InvokeUserCallable(Fn&& fn, const UserCallableParams& params, ArgDescr&& ... ad)
 {
-    auto invoker = UCInvoker<Fn>(fn, params);
-    return nonstd::visit(ParamUnwrapper<UCInvoker<Fn>>(&invoker), GetParamValue(params, ad).data()...);
+    return InvokeUserCallableImpl(fn, params, std::index_sequence_for<ArgDescr...>(), ad...);
 }
 
 template<typename T>
@@ -221,6 +230,8 @@ struct TypedParam
 {
     using decayed_t = std::decay_t<T>;
     nonstd::variant<EmptyValue, decayed_t, const decayed_t*> data;
+    // Owns the string converted from the other char type which the view param refers to
+    std::shared_ptr<void> holder;
 
     bool HasValue() const { return data.index() != 0; }
     T GetValue() const
@@ -236,6 +247,16 @@ struct TypedParam
     void SetValue(decayed_t&& val) { data = std::move(val); }
 };
 
+template<typename T, typename CharT>
+struct IsOtherCharView : std::false_type
+{
+};
+
+template<typename ViewCharT, typename CharT>
+struct IsOtherCharView<nonstd::basic_string_view<ViewCharT>, CharT> : std::integral_constant<bool, !std::is_same<ViewCharT, CharT>::value>
+{
+};
+
 template<typename T>
 struct TypedParamUnwrapper
 {
@@ -269,13 +290,37 @@ struct TypedParamUnwrapper
     void operator()(const EmptyValue&) const { param->SetValue(ValueType()); }
 
     template<typename U>
-    auto operator()(const U& v) -> std::enable_if_t<PromoteTester<U>::value && !std::is_same<std::decay_t<U>, ValueType>::value>
+    struct IsConvertedView : std::false_type
+    {
+    };
+
+    template<typename CharT>
+    struct IsConvertedView<std::basic_string<CharT>> : IsOtherCharView<ValueType, CharT>
+    {
+    };
+
+    template<typename CharT>
+    struct IsConvertedView<nonstd::basic_string_view<CharT>> : IsConvertedView<std::basic_string<CharT>>
+    {
+    };
+
+    template<typename U>
+    auto operator()(const U& v) -> std::enable_if_t<PromoteTester<U>::value && !std::is_same<std::decay_t<U>, ValueType>::value && !IsConvertedView<U>::value>
     {
         param->SetValue(Promote(v));
     }
 
     template<typename U>
-    auto operator()(const U&) -> std::enable_if_t<!PromoteTester<U>::value && !std::is_same<std::decay_t<U>, ValueType>::value>
+    auto operator()(const U& v) -> std::enable_if_t<IsConvertedView<U>::value>
+    {
+        using string = std::basic_string<typename ValueType::value_type>;
+        auto converted = std::make_shared<string>(ConvertString<string>(v));
+        param->holder = converted;
+        param->SetValue(ValueType(*converted));
+    }
+
+    template<typename U>
+    auto operator()(const U&) -> std::enable_if_t<!PromoteTester<U>::value && !std::is_same<std::decay_t<U>, ValueType>::value && !IsConvertedView<U>::value>
     {
     }
 };
@@ -302,7 +347,7 @@ bool TypedParamHasValue(const TypedParam<T>& param, Params&&... params)
 }
 
 template<typename Fn, typename Tuple, size_t... Idx>
-Value InvokeTypedUserCallableImpl(Fn&& fn, Tuple&& tuple, std::index_sequence<Idx...>&&)
+Value ApplyTypedParams(Fn&& fn, Tuple&& tuple, std::index_sequence<Idx...>&&)
 {
     bool has_value = TypedParamHasValue(std::get<Idx>(tuple)...);
     if (!has_value)
@@ -312,12 +357,12 @@ Value InvokeTypedUserCallableImpl(Fn&& fn, Tuple&& tuple, std::index_sequence<Id
 }
 #endif
 
-template<typename Fn, typename... ArgDescr>
-Value InvokeTypedUserCallable(Fn&& fn, const UserCallableParams& params, ArgDescr&&... ad)
+template<typename Fn, size_t... Idx, typename... ArgDescr>
+Value InvokeTypedUserCallableImpl(Fn&& fn, const UserCallableParams& params, std::index_sequence<Idx...>, ArgDescr&&... ad)
 {
-    auto typed_params = std::make_tuple(TypedUnwrapParam<typename std::decay_t<ArgDescr>::type>(GetParamValue(params, ad).data())...);
+    auto typed_params = std::make_tuple(TypedUnwrapParam<typename std::decay_t<ArgDescr>::type>(GetParamValue(params, ad, Idx).data())...);
 #if !optional_CPP17_OR_GREATER
-    return InvokeTypedUserCallableImpl(fn, typed_params, std::index_sequence_for<ArgDescr...>());
+    return ApplyTypedParams(fn, typed_params, std::index_sequence_for<ArgDescr...>());
 #else
     return std::apply(
       [&fn](auto&... args) {
@@ -331,6 +376,12 @@ Value InvokeTypedUserCallable(Fn&& fn, const UserCallableParams& params, ArgDesc
 #endif
 }
 
+template<typename Fn, typename... ArgDescr>
+Value InvokeTypedUserCallable(Fn&& fn, const UserCallableParams& params, ArgDescr&&... ad)
+{
+    return InvokeTypedUserCallableImpl(fn, params, std::index_sequence_for<ArgDescr...>(), ad...);
+}
+
 template<typename... ArgDescr>
 struct ArgDescrHasType : std::false_type
 {
@@ -381,7 +432,8 @@ auto MakeCallable(Fn&& f, ArgDescr&&... ad) -> typename std::enable_if<!detail::
         [=, fn = std::forward<Fn>(f)](const UserCallableParams& params) {
             return detail::InvokeUserCallable(fn, params, ad...);
         },
-        {ArgInfo(std::forward<ArgDescr>(ad))...}
+        {ArgInfo(std::forward<ArgDescr>(ad))...},
+        true
     };
 }
 
@@ -389,14 +441,16 @@ template<typename Fn, typename... ArgDescr>
 auto MakeCallable(Fn&& f, ArgDescr&&... ad) -> typename std::enable_if<detail::ArgDescrHasType<ArgDescr...>::value, UserCallable>::type
 {
     return UserCallable{ [=, fn = std::forward<Fn>(f)](const UserCallableParams& params) { return detail::InvokeTypedUserCallable(fn, params, ad...); },
-                         { ArgInfo(std::forward<ArgDescr>(ad))... } };
+                         { ArgInfo(std::forward<ArgDescr>(ad))... },
+                         true };
 }
 
 template<typename R, typename... Args, typename... ArgDescr>
 auto MakeCallable(R (*f)(Args...), ArgDescr&&... ad) -> UserCallable
 {
     return UserCallable{ [=, fn = f](const UserCallableParams& params) { return detail::InvokeTypedUserCallable(fn, params, ArgInfoT<Args>(ad)...); },
-                         { ArgInfoT<Args>(std::forward<ArgDescr>(ad))... } };
+                         { ArgInfoT<Args>(std::forward<ArgDescr>(ad))... },
+                         true };
 }
 
 template<typename R, typename T, typename... Args, typename... ArgDescr>
@@ -406,7 +460,8 @@ auto MakeCallable(R (T::*f)(Args...), T* obj, ArgDescr&&... ad) -> UserCallable
                             return detail::InvokeTypedUserCallable(
                               [fn, obj](Args&&... args) { return (obj->*fn)(std::forward<Args>(args)...); }, params, ArgInfoT<Args>(ad)...);
                         },
-                         { ArgInfoT<Args>(std::forward<ArgDescr>(ad))... } };
+                         { ArgInfoT<Args>(std::forward<ArgDescr>(ad))... },
+                         true };
 }
 
 template<typename R, typename T, typename... Args, typename... ArgDescr>
@@ -416,7 +471,8 @@ auto MakeCallable(R (T::*f)(Args...) const, const T* obj, ArgDescr&&... ad) -> U
                             return detail::InvokeTypedUserCallable(
                               [fn, obj](Args&&... args) { return (obj->*fn)(std::forward<Args>(args)...); }, params, ArgInfoT<Args>(ad)...);
                         },
-                         { ArgInfoT<Args>(std::forward<ArgDescr>(ad))... } };
+                         { ArgInfoT<Args>(std::forward<ArgDescr>(ad))... },
+                         true };
 }
 
 /*!
@@ -429,7 +485,7 @@ auto MakeCallable(R (T::*f)(Args...) const, const T* obj, ArgDescr&&... ad) -> U
 template<typename Fn>
 auto MakeCallable(Fn&& f)
 {
-    return UserCallable{ [=, fn = std::forward<Fn>(f)](const UserCallableParams&) { return fn(); }, {} };
+    return UserCallable{ [=, fn = std::forward<Fn>(f)](const UserCallableParams&) { return fn(); }, {}, true };
 }
 } // jinja2
 
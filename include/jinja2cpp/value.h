@@ -57,6 +57,34 @@ struct MapItemAccessor
      * @return Collection of keys if any. Ordering of keys is unspecified.
      */
     virtual std::vector<std::string> GetKeys() const = 0;
+    /*!
+     * \brief Method is called to obtain the layout of the dictionary items (if applicable)
+     *
+     * Dictionaries with the same layout (e.g. the objects of the same reflected type) keep the items with the same names in the same
+     * slots. Templates remember the slot of the item found by name (see \ref FindSlot) along with the layout and get the item by the
+     * slot (see \ref GetValueBySlot) the next time the dictionary of the same layout is accessed by the same expression. Returned
+     * pointer identifies the layout and should stay valid while the templates are rendered (e.g. the address of the static fields
+     * table). Default implementation returns nullptr, so the items are always looked up by name
+     *
+     * @return Identity of the layout or nullptr
+     */
+    virtual const void* GetLayout() const { return nullptr; }
+    /*!
+     * \brief Method is called to find the slot of the item within the layout of the dictionary (see \ref GetLayout)
+     *
+     * @param name Name of the item
+     *
+     * @return Slot of the item or `static_cast<size_t>(-1)` if the item is absent
+     */
+    virtual size_t FindSlot(const std::string& name) const { return static_cast<size_t>(-1); }
+    /*!
+     * \brief Method is called for retrieving the value from the slot found by \ref FindSlot
+     *
+     * @param slot Slot of the item
+     *
+     * @return Requested value
+     */
+    virtual Value GetValueBySlot(size_t slot) const;
 };
 
 /*!
@@ -145,6 +173,7 @@ struct ValuesMap;
 struct UserCallableArgs;
 struct ParamInfo;
 struct UserCallable;
+struct LazyValue;
 
 template<typename T>
 using RecWrapper = nonstd::value_ptr<T>;
@@ -168,6 +197,7 @@ using RecWrapper = nonstd::value_ptr<T>;
  *  - Generic list of other values (\ref GenericList)
  *  - Generic map of other values (\ref GenericMap)
  *  - User-defined callable (\ref UserCallable)
+ *  - Value computed on demand (\ref LazyValue)
  *
  *  Exact value can be accessed via nonstd::visit method applied to the result of the Value::data() call or any of
  *  asXXX method (ex. \ref Value::asString). In case of string retrieval it's better to use \ref AsString or \ref
@@ -189,7 +219,8 @@ public:
         RecWrapper<ValuesMap>,
         GenericList,
         GenericMap,
-        RecWrapper<UserCallable>
+        RecWrapper<UserCallable>,
+        RecWrapper<LazyValue>
      >;
 
     template<typename T, typename ... L>
@@ -221,7 +252,7 @@ public:
      * @param val Value which should be used to initialize \ref Value instance
      */
     template<typename T>
-    Value(T&& val, typename std::enable_if<!AnyOf<T, Value, ValuesList, ValuesMap, UserCallable>::value>::type* = nullptr)
+    Value(T&& val, typename std::enable_if<!AnyOf<T, Value, ValuesList, ValuesMap, UserCallable, LazyValue>::value>::type* = nullptr)
         : m_data(std::forward<T>(val))
     {
     }
@@ -308,6 +339,18 @@ public:
      * @param callable UserCallable which should be used to initialize \ref Value instance
      */
     Value(UserCallable&& callable);
+    /*!
+     * \brief Initializing constructor from the \ref LazyValue
+     *
+     * @param lazy LazyValue which should be used to initialize \ref Value instance
+     */
+    Value(const LazyValue& lazy);
+    /*!
+     * \brief Initializing move constructor from the \ref LazyValue
+     *
+     * @param lazy LazyValue which should be used to initialize \ref Value instance
+     */
+    Value(LazyValue&& lazy);
 
     /*!
      * \brief Get the non-mutable stored data object
@@ -505,6 +548,10 @@ struct UserCallableParams
     Value extraKwArgs;
     //! Context object which provides access to the current variables set of the template
     Value context;
+    //! Values of parameters in the order of \ref UserCallable::argsInfo. Filled instead of the \ref args field for the
+    //! callables with \ref UserCallable::positionalArgs flag set. Strings may refer to the call arguments and are valid
+    //! during the call only
+    std::vector<Value> argValues;
     bool paramsParsed = false;
 
     Value operator[](const std::string& paramName) const
@@ -598,6 +645,10 @@ struct UserCallable
     std::function<Value (const UserCallableParams&)> callable;
     //! Information about arguments of the user-defined callable
     std::vector<ArgInfo> argsInfo;
+    //! Callable takes the params from the \ref UserCallableParams::argValues field (by position) instead of the \ref
+    //! UserCallableParams::args one. Extra args and context are passed only if they are described in \ref argsInfo.
+    //! Set by \ref MakeCallable
+    bool positionalArgs = false;
 };
 
 inline Value::Value(const UserCallable& callable)
@@ -610,6 +661,38 @@ inline Value::Value(UserCallable&& callable)
 {
 }
 
+/*!
+ * \brief Value computed on demand
+ *
+ * Wraps the computation of the param which is needed by the template only in some cases (e.g. within the conditional
+ * branch). The producer is called when the template looks up the param for the first time during the render, and the
+ * produced value is reused by the rest lookups of the same render. If the param isn't looked up, the producer isn't
+ * called at all:
+ * ```c++
+ *  jinja2::ValuesMap params;
+ *  params["orders"] = jinja2::LazyValue{[&db, userId] { return LoadOrders(db, userId); }};
+ *  tpl.RenderAsString(params);
+ * ```
+ * Each render calls the producer anew, so it may be called concurrently by the renders running in parallel. Lazy values
+ * nested into the lists and maps are computed on each access of the item. Exceptions thrown by the producer aren't
+ * caught.
+ */
+struct LazyValue
+{
+    //! Functional object which produces the value. Empty producer produces the empty value
+    std::function<Value ()> producer;
+};
+
+inline Value::Value(const LazyValue& lazy)
+    : m_data(RecWrapper<LazyValue>(lazy))
+{
+}
+
+inline Value::Value(LazyValue&& lazy)
+    : m_data(RecWrapper<LazyValue>(std::move(lazy)))
+{
+}
+
 inline Value GenericMap::GetValueByName(const std::string& name) const
 {
     return m_accessor ? m_accessor()->GetValueByName(name) : Value();
@@ -619,6 +702,11 @@ inline auto GenericMap::operator[](const std::string& name) const
     return GetValueByName(name);
 }
 
+inline Value MapItemAccessor::GetValueBySlot(size_t) const
+{
+    return Value();
+}
+
 inline Value::Value() = default;
 inline Value::Value(const Value& val) = default;
 inline Value::Value(Value&& val) noexcept
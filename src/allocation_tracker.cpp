@@ -0,0 +1,20 @@
+#include "allocation_tracker.h"
+
+namespace jinja2
+{
+thread_local AllocationTracker* AllocationTracker::s_current = nullptr;
+
+void TrackAllocation(size_t bytes) noexcept
+{
+    auto tracker = AllocationTracker::GetCurrent();
+    if (tracker)
+        tracker->OnAllocate(bytes);
+}
+
+void TrackDeallocation(size_t bytes) noexcept
+{
+    auto tracker = AllocationTracker::GetCurrent();
+    if (tracker)
+        tracker->OnDeallocate(bytes);
+}
+} // jinja2
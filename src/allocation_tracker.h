@@ -0,0 +1,72 @@
+#ifndef ALLOCATION_TRACKER_H
+#define ALLOCATION_TRACKER_H
+
+#include <jinja2cpp/allocation_stats.h>
+
+#include <atomic>
+
+namespace jinja2
+{
+// Counters of the allocations of the single render call (see Settings::trackAllocations). Fed by TrackAllocation/TrackDeallocation
+// on the threads the tracker is installed on, including the ones of the parallel render
+class AllocationTracker
+{
+public:
+    // Installs the tracker on the current thread while alive. Null tracker suspends the tracking
+    class Scope
+    {
+    public:
+        explicit Scope(AllocationTracker* tracker)
+            : m_prev(s_current)
+        {
+            s_current = tracker;
+        }
+        ~Scope() { s_current = m_prev; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        AllocationTracker* m_prev;
+    };
+
+    static AllocationTracker* GetCurrent() { return s_current; }
+
+    void OnAllocate(size_t bytes)
+    {
+        m_allocations.fetch_add(1, std::memory_order_relaxed);
+        m_allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        auto held = m_heldBytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed) + static_cast<int64_t>(bytes);
+        auto peak = m_peakBytes.load(std::memory_order_relaxed);
+        while (held > peak && !m_peakBytes.compare_exchange_weak(peak, held, std::memory_order_relaxed))
+            ;
+    }
+    void OnDeallocate(size_t bytes)
+    {
+        m_deallocations.fetch_add(1, std::memory_order_relaxed);
+        m_heldBytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+    }
+
+    RenderAllocationStats GetStats() const
+    {
+        RenderAllocationStats result;
+        result.allocations = m_allocations.load(std::memory_order_relaxed);
+        result.deallocations = m_deallocations.load(std::memory_order_relaxed);
+        result.allocatedBytes = m_allocatedBytes.load(std::memory_order_relaxed);
+        result.peakBytes = static_cast<uint64_t>(m_peakBytes.load(std::memory_order_relaxed));
+        return result;
+    }
+
+private:
+    static thread_local AllocationTracker* s_current;
+
+    std::atomic<uint64_t> m_allocations{0};
+    std::atomic<uint64_t> m_deallocations{0};
+    std::atomic<uint64_t> m_allocatedBytes{0};
+    // Blocks allocated before the render may be freed by it, so the held size may go below zero
+    std::atomic<int64_t> m_heldBytes{0};
+    std::atomic<int64_t> m_peakBytes{0};
+};
+} // jinja2
+
+#endif // ALLOCATION_TRACKER_H
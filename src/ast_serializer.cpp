@@ -0,0 +1,1163 @@
+#include "ast_serializer.h"
+#include "expression_evaluator.h"
+#include "renderer.h"
+#include "statements.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace jinja2
+{
+namespace
+{
+enum class ValueTag : uint8_t
+{
+    Empty = 0,
+    Bool,
+    String,
+    WString,
+    Int,
+    Double
+};
+
+// Keeps the images stable between the runs despite of the unordered containers
+template<typename Map>
+auto SortedItems(const Map& map)
+{
+    std::vector<const typename Map::value_type*> result;
+    result.reserve(map.size());
+    for (auto& item : map)
+        result.push_back(&item);
+    std::sort(result.begin(), result.end(), [](auto left, auto right) { return left->first < right->first; });
+    return result;
+}
+
+// Node allocated by make_shared along with the control block (the virtual table pointer and two counters)
+template<typename Node>
+constexpr size_t SharedNodeSize()
+{
+    return sizeof(Node) + sizeof(void*) + 2 * sizeof(int32_t);
+}
+
+size_t GetNodeSize(AstNodeKind kind)
+{
+    switch (kind)
+    {
+    case AstNodeKind::Null:
+    case AstNodeKind::Ref:
+        return 0;
+    case AstNodeKind::ComposedRenderer: return SharedNodeSize<ComposedRenderer>();
+    case AstNodeKind::RawTextRenderer: return SharedNodeSize<RawTextRenderer>();
+    case AstNodeKind::ExpressionRenderer: return SharedNodeSize<ExpressionRenderer>();
+    case AstNodeKind::ForStatement: return SharedNodeSize<ForStatement>();
+    case AstNodeKind::IfStatement: return SharedNodeSize<IfStatement>();
+    case AstNodeKind::ElseBranchStatement: return SharedNodeSize<ElseBranchStatement>();
+    case AstNodeKind::SetLineStatement: return SharedNodeSize<SetLineStatement>();
+    case AstNodeKind::SetRawBlockStatement: return SharedNodeSize<SetRawBlockStatement>();
+    case AstNodeKind::SetFilteredBlockStatement: return SharedNodeSize<SetFilteredBlockStatement>();
+    case AstNodeKind::ParentBlockStatement: return SharedNodeSize<ParentBlockStatement>();
+    case AstNodeKind::BlockStatement: return SharedNodeSize<BlockStatement>();
+    case AstNodeKind::ExtendsStatement: return SharedNodeSize<ExtendsStatement>();
+    case AstNodeKind::IncludeStatement: return SharedNodeSize<IncludeStatement>();
+    case AstNodeKind::ImportStatement: return SharedNodeSize<ImportStatement>();
+    case AstNodeKind::MacroStatement: return SharedNodeSize<MacroStatement>();
+    case AstNodeKind::MacroCallStatement: return SharedNodeSize<MacroCallStatement>();
+    case AstNodeKind::DoStatement: return SharedNodeSize<DoStatement>();
+    case AstNodeKind::WithStatement: return SharedNodeSize<WithStatement>();
+    case AstNodeKind::FilterStatement: return SharedNodeSize<FilterStatement>();
+    case AstNodeKind::CacheStatement: return SharedNodeSize<CacheStatement>();
+    case AstNodeKind::FullExpressionEvaluator: return SharedNodeSize<FullExpressionEvaluator>();
+    case AstNodeKind::ValueRefExpression: return SharedNodeSize<ValueRefExpression>();
+    case AstNodeKind::SubscriptExpression: return SharedNodeSize<SubscriptExpression>();
+    case AstNodeKind::FilteredExpression: return SharedNodeSize<FilteredExpression>();
+    case AstNodeKind::ConstantExpression: return SharedNodeSize<ConstantExpression>();
+    case AstNodeKind::TupleCreator: return SharedNodeSize<TupleCreator>();
+    case AstNodeKind::DictCreator: return SharedNodeSize<DictCreator>();
+    case AstNodeKind::UnaryExpression: return SharedNodeSize<UnaryExpression>();
+    case AstNodeKind::IsExpression: return SharedNodeSize<IsExpression>();
+    case AstNodeKind::BinaryExpression: return SharedNodeSize<BinaryExpression>();
+    case AstNodeKind::CallExpression: return SharedNodeSize<CallExpression>();
+    }
+    return 0;
+}
+
+// Strings longer than the small string buffer own the heap block
+template<typename CharT>
+size_t GetStringHeapSize(size_t length)
+{
+    return length > std::basic_string<CharT>().capacity() ? (length + 1) * sizeof(CharT) : 0;
+}
+} // namespace
+
+size_t EstimateAstFootprint(const RendererBase* root, const void* sourceBegin, size_t sourceLength, size_t charSize)
+{
+    AstWriter writer(sourceBegin, sourceLength, charSize);
+    writer.m_isMeasuring = true;
+    writer.WriteRenderer(root);
+    return writer.m_footprint;
+}
+
+uint64_t CalcSourceHash(const void* data, size_t size)
+{
+    // FNV-1a
+    uint64_t result = 14695981039346656037ULL;
+    auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t n = 0; n < size; ++ n)
+    {
+        result ^= bytes[n];
+        result *= 1099511628211ULL;
+    }
+
+    return result;
+}
+
+void RendererBase::Serialize(AstWriter&) const
+{
+    throw AstFormatError("Statement can't be serialized");
+}
+
+void ExpressionEvaluatorBase::Serialize(AstWriter&) const
+{
+    throw AstFormatError("Expression can't be serialized");
+}
+
+void AstWriter::WriteNodeKind(AstNodeKind kind)
+{
+    m_footprint += GetNodeSize(kind);
+    WriteUInt(static_cast<uint8_t>(kind));
+}
+
+void AstWriter::WriteUInt(uint64_t val)
+{
+    do
+    {
+        uint8_t byte = val & 0x7f;
+        val >>= 7;
+        if (val)
+            byte |= 0x80;
+        m_data.push_back(static_cast<char>(byte));
+    } while (val);
+}
+
+void AstWriter::WriteInt(int64_t val)
+{
+    WriteUInt((static_cast<uint64_t>(val) << 1) ^ static_cast<uint64_t>(val >> 63));
+}
+
+void AstWriter::WriteDouble(double val)
+{
+    uint64_t bits = 0;
+    std::memcpy(&bits, &val, sizeof(bits));
+    for (int n = 0; n < 8; ++ n, bits >>= 8)
+        m_data.push_back(static_cast<char>(bits & 0xff));
+}
+
+void AstWriter::WriteString(const std::string& str)
+{
+    m_footprint += GetStringHeapSize<char>(str.size());
+    WriteUInt(str.size());
+    m_data.append(str);
+}
+
+void AstWriter::WriteStrings(const std::vector<std::string>& strs)
+{
+    m_footprint += strs.size() * sizeof(std::string);
+    WriteUInt(strs.size());
+    for (auto& str : strs)
+        WriteString(str);
+}
+
+void AstWriter::WriteSourcePtr(const void* ptr)
+{
+    auto offset = static_cast<const char*>(ptr) - m_sourceBegin;
+    if (offset < 0 || static_cast<size_t>(offset) > m_sourceLength * m_charSize)
+        throw AstFormatError("Raw text block is outside of the template source");
+    WriteUInt(static_cast<size_t>(offset) / m_charSize);
+}
+
+void AstWriter::WriteValue(const InternalValue& val)
+{
+    if (val.IsEmpty())
+    {
+        WriteUInt(static_cast<uint8_t>(ValueTag::Empty));
+    }
+    else if (auto boolVal = GetIf<bool>(&val))
+    {
+        WriteUInt(static_cast<uint8_t>(ValueTag::Bool));
+        WriteBool(*boolVal);
+    }
+    else if (auto intVal = GetIf<int64_t>(&val))
+    {
+        WriteUInt(static_cast<uint8_t>(ValueTag::Int));
+        WriteInt(*intVal);
+    }
+    else if (auto doubleVal = GetIf<double>(&val))
+    {
+        WriteUInt(static_cast<uint8_t>(ValueTag::Double));
+        WriteDouble(*doubleVal);
+    }
+    else if (auto strVal = GetIf<std::string>(&val))
+    {
+        WriteUInt(static_cast<uint8_t>(ValueTag::String));
+        WriteString(*strVal);
+    }
+    else if (auto targetStr = GetIf<TargetString>(&val))
+    {
+        if (auto narrowStr = nonstd::get_if<std::string>(targetStr))
+        {
+            WriteUInt(static_cast<uint8_t>(ValueTag::String));
+            WriteString(*narrowStr);
+        }
+        else
+        {
+            auto& wideStr = nonstd::get<std::wstring>(*targetStr);
+            m_footprint += GetStringHeapSize<wchar_t>(wideStr.size());
+            WriteUInt(static_cast<uint8_t>(ValueTag::WString));
+            WriteUInt(wideStr.size());
+            for (auto ch : wideStr)
+                WriteUInt(static_cast<uint32_t>(ch));
+        }
+    }
+    else
+    {
+        throw AstFormatError("Constant of this type can't be serialized");
+    }
+}
+
+template<typename Node>
+void AstWriter::WriteNode(const Node* node, std::unordered_map<const void*, uint64_t>& ids)
+{
+    if (!node)
+    {
+        WriteNodeKind(AstNodeKind::Null);
+        return;
+    }
+
+    m_footprint += sizeof(std::shared_ptr<Node>);
+    auto p = ids.find(node);
+    if (p != ids.end())
+    {
+        WriteNodeKind(AstNodeKind::Ref);
+        WriteUInt(p->second);
+        return;
+    }
+
+    auto id = ids.size();
+    ids[node] = id;
+    if (!m_isMeasuring)
+    {
+        node->Serialize(*this);
+        return;
+    }
+
+    try
+    {
+        node->Serialize(*this);
+    }
+    catch (const AstFormatError&)
+    {
+        // Measured data isn't stored anywhere, so the partially written node is harmless
+    }
+}
+
+void AstWriter::WriteRenderer(const RendererBase* renderer)
+{
+    WriteNode(renderer, m_rendererIds);
+}
+
+void AstWriter::WriteExpression(const ExpressionEvaluatorBase* expr)
+{
+    WriteNode(expr, m_expressionIds);
+}
+
+void AstWriter::WriteCallParams(const CallParamsInfo& params)
+{
+    // Nodes of the keyword params map keep the hash and the link to the next node
+    m_footprint += params.kwParams.size() * (sizeof(std::string) + sizeof(ExpressionEvaluatorPtr<>) + sizeof(void*) + sizeof(size_t)) +
+        params.kwParams.bucket_count() * sizeof(void*);
+    WriteUInt(params.posParams.size());
+    for (auto& param : params.posParams)
+        WriteExpression(param);
+
+    WriteUInt(params.kwParams.size());
+    for (auto param : SortedItems(params.kwParams))
+    {
+        WriteString(param->first);
+        WriteExpression(param->second);
+    }
+}
+
+void AstWriter::WriteMacroParams(const std::vector<MacroParam>& params)
+{
+    m_footprint += params.size() * sizeof(MacroParam);
+    WriteUInt(params.size());
+    for (auto& param : params)
+    {
+        WriteString(param.paramName);
+        WriteExpression(param.defaultValue);
+    }
+}
+
+void AstWriter::RegisterLoop(const void* loop)
+{
+    auto id = m_loopIds.size() + 1;
+    m_loopIds[loop] = id;
+}
+
+void AstWriter::WriteLoopRef(const void* loop)
+{
+    // Reference to the loop which isn't serialized (or to no loop at all) turns into the lookup by name
+    auto p = m_loopIds.find(loop);
+    WriteUInt(p == m_loopIds.end() ? 0 : p->second);
+}
+
+AstNodeKind AstReader::ReadNodeKind()
+{
+    auto kind = ReadUInt();
+    if (kind > static_cast<uint8_t>(AstNodeKind::CallExpression))
+        throw AstFormatError("Unknown node kind");
+    return static_cast<AstNodeKind>(kind);
+}
+
+uint64_t AstReader::ReadUInt()
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (m_cur == m_end)
+            throw AstFormatError("Unexpected end of data");
+
+        auto byte = static_cast<uint8_t>(*m_cur ++);
+        result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return result;
+    }
+
+    throw AstFormatError("Invalid integer value");
+}
+
+size_t AstReader::ReadSize()
+{
+    // Sizes are limited by the remaining data, so corrupted images can't trigger huge allocations
+    auto size = ReadUInt();
+    if (size > static_cast<uint64_t>(m_end - m_cur))
+        throw AstFormatError("Invalid size value");
+    return static_cast<size_t>(size);
+}
+
+int64_t AstReader::ReadInt()
+{
+    auto val = ReadUInt();
+    return static_cast<int64_t>(val >> 1) ^ -static_cast<int64_t>(val & 1);
+}
+
+double AstReader::ReadDouble()
+{
+    if (m_end - m_cur < 8)
+        throw AstFormatError("Unexpected end of data");
+
+    uint64_t bits = 0;
+    for (int n = 0; n < 8; ++ n)
+        bits |= static_cast<uint64_t>(static_cast<uint8_t>(*m_cur ++)) << (n * 8);
+
+    double result = 0;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+std::string AstReader::ReadString()
+{
+    auto size = ReadSize();
+    std::string result(m_cur, size);
+    m_cur += size;
+    return result;
+}
+
+std::vector<std::string> AstReader::ReadStrings()
+{
+    std::vector<std::string> result(ReadSize());
+    for (auto& str : result)
+        str = ReadString();
+    return result;
+}
+
+const void* AstReader::ReadSourcePtr(size_t length)
+{
+    auto offset = ReadUInt();
+    if (offset > m_sourceLength || length > m_sourceLength - offset)
+        throw AstFormatError("Raw text block is outside of the template source");
+    return m_sourceBegin + offset * m_charSize;
+}
+
+InternalValue AstReader::ReadValue()
+{
+    switch (static_cast<ValueTag>(ReadUInt()))
+    {
+    case ValueTag::Empty:
+        return InternalValue();
+    case ValueTag::Bool:
+        return InternalValue(ReadBool());
+    case ValueTag::Int:
+        return InternalValue(ReadInt());
+    case ValueTag::Double:
+        return InternalValue(ReadDouble());
+    case ValueTag::String:
+        return InternalValue(TargetString(ReadString()));
+    case ValueTag::WString:
+    {
+        std::wstring result(ReadSize(), L'\0');
+        for (auto& ch : result)
+            ch = static_cast<wchar_t>(ReadUInt());
+        return InternalValue(TargetString(std::move(result)));
+    }
+    }
+
+    throw AstFormatError("Unknown constant type");
+}
+
+std::shared_ptr<RendererBase> AstReader::ReadRenderer()
+{
+    auto kind = ReadNodeKind();
+    if (kind == AstNodeKind::Null)
+        return std::shared_ptr<RendererBase>();
+
+    if (kind == AstNodeKind::Ref)
+    {
+        auto id = ReadUInt();
+        if (id >= m_renderers.size() || !m_renderers[id])
+            throw AstFormatError("Invalid statement reference");
+        return m_renderers[id];
+    }
+
+    auto id = m_renderers.size();
+    m_renderers.emplace_back();
+
+    std::shared_ptr<RendererBase> result;
+    switch (kind)
+    {
+    case AstNodeKind::ComposedRenderer: result = ComposedRenderer::Deserialize(*this); break;
+    case AstNodeKind::RawTextRenderer: result = RawTextRenderer::Deserialize(*this); break;
+    case AstNodeKind::ExpressionRenderer: result = ExpressionRenderer::Deserialize(*this); break;
+    case AstNodeKind::ForStatement: result = ForStatement::Deserialize(*this); break;
+    case AstNodeKind::IfStatement: result = IfStatement::Deserialize(*this); break;
+    case AstNodeKind::ElseBranchStatement: result = ElseBranchStatement::Deserialize(*this); break;
+    case AstNodeKind::SetLineStatement: result = SetLineStatement::Deserialize(*this); break;
+    case AstNodeKind::SetRawBlockStatement: result = SetRawBlockStatement::Deserialize(*this); break;
+    case AstNodeKind::SetFilteredBlockStatement: result = SetFilteredBlockStatement::Deserialize(*this); break;
+    case AstNodeKind::ParentBlockStatement: result = ParentBlockStatement::Deserialize(*this); break;
+    case AstNodeKind::BlockStatement: result = BlockStatement::Deserialize(*this); break;
+    case AstNodeKind::ExtendsStatement: result = ExtendsStatement::Deserialize(*this); break;
+    case AstNodeKind::IncludeStatement: result = IncludeStatement::Deserialize(*this); break;
+    case AstNodeKind::ImportStatement: result = ImportStatement::Deserialize(*this); break;
+    case AstNodeKind::MacroStatement: result = MacroStatement::Deserialize(*this); break;
+    case AstNodeKind::MacroCallStatement: result = MacroCallStatement::Deserialize(*this); break;
+    case AstNodeKind::DoStatement: result = DoStatement::Deserialize(*this); break;
+    case AstNodeKind::WithStatement: result = WithStatement::Deserialize(*this); break;
+    case AstNodeKind::FilterStatement: result = FilterStatement::Deserialize(*this); break;
+    case AstNodeKind::CacheStatement: result = CacheStatement::Deserialize(*this); break;
+    default:
+        throw AstFormatError("Statement expected");
+    }
+
+    m_renderers[id] = result;
+    return result;
+}
+
+std::shared_ptr<ExpressionEvaluatorBase> AstReader::ReadExpression()
+{
+    auto kind = ReadNodeKind();
+    if (kind == AstNodeKind::Null)
+        return std::shared_ptr<ExpressionEvaluatorBase>();
+
+    if (kind == AstNodeKind::Ref)
+    {
+        auto id = ReadUInt();
+        if (id >= m_expressions.size() || !m_expressions[id])
+            throw AstFormatError("Invalid expression reference");
+        return m_expressions[id];
+    }
+
+    auto id = m_expressions.size();
+    m_expressions.emplace_back();
+
+    std::shared_ptr<ExpressionEvaluatorBase> result;
+    switch (kind)
+    {
+    case AstNodeKind::FullExpressionEvaluator: result = FullExpressionEvaluator::Deserialize(*this); break;
+    case AstNodeKind::ValueRefExpression: result = ValueRefExpression::Deserialize(*this); break;
+    case AstNodeKind::SubscriptExpression: result = SubscriptExpression::Deserialize(*this); break;
+    case AstNodeKind::FilteredExpression: result = FilteredExpression::Deserialize(*this); break;
+    case AstNodeKind::ConstantExpression: result = ConstantExpression::Deserialize(*this); break;
+    case AstNodeKind::TupleCreator: result = TupleCreator::Deserialize(*this); break;
+    case AstNodeKind::DictCreator: result = DictCreator::Deserialize(*this); break;
+    case AstNodeKind::UnaryExpression: result = UnaryExpression::Deserialize(*this); break;
+    case AstNodeKind::IsExpression: result = IsExpression::Deserialize(*this); break;
+    case AstNodeKind::BinaryExpression: result = BinaryExpression::Deserialize(*this); break;
+    case AstNodeKind::CallExpression: result = CallExpression::Deserialize(*this); break;
+    default:
+        throw AstFormatError("Expression expected");
+    }
+
+    m_expressions[id] = result;
+    return result;
+}
+
+CallParamsInfo AstReader::ReadCallParams()
+{
+    CallParamsInfo result;
+    result.posParams.resize(ReadSize());
+    for (auto& param : result.posParams)
+        param = ReadExpression();
+
+    auto kwParamsCount = ReadSize();
+    for (size_t n = 0; n < kwParamsCount; ++ n)
+    {
+        auto name = ReadString();
+        result.kwParams[name] = ReadExpression();
+    }
+
+    return result;
+}
+
+std::vector<MacroParam> AstReader::ReadMacroParams()
+{
+    std::vector<MacroParam> result(ReadSize());
+    for (auto& param : result)
+    {
+        param.paramName = ReadString();
+        param.defaultValue = ReadExpression();
+    }
+
+    return result;
+}
+
+const void* AstReader::ReadLoopRef()
+{
+    auto id = ReadUInt();
+    if (id == 0)
+        return nullptr;
+    if (id > m_loops.size())
+        throw AstFormatError("Invalid loop reference");
+    return m_loops[id - 1];
+}
+
+// Renderers
+
+void ComposedRenderer::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ComposedRenderer);
+    writer.WriteUInt(m_renderers.size());
+    for (auto& r : m_renderers)
+        writer.WriteRenderer(r);
+}
+
+RendererPtr ComposedRenderer::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<ComposedRenderer>();
+    auto count = reader.ReadSize();
+    for (size_t n = 0; n < count; ++ n)
+        result->AddRenderer(reader.ReadRenderer());
+    return result;
+}
+
+void RawTextRenderer::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::RawTextRenderer);
+    writer.WriteBool(IsOwnText());
+    if (IsOwnText())
+    {
+        writer.WriteString(std::string(static_cast<const char*>(m_ptr), m_length * writer.GetCharSize()));
+        return;
+    }
+    writer.WriteUInt(m_length);
+    writer.WriteSourcePtr(m_ptr);
+}
+
+template<typename CharT>
+static RendererPtr CreateOwnTextRenderer(const std::string& data)
+{
+    std::basic_string<CharT> text(data.size() / sizeof(CharT), CharT());
+    std::memcpy(&text[0], data.data(), text.size() * sizeof(CharT));
+    return std::make_shared<RawTextRenderer>(std::move(text));
+}
+
+RendererPtr RawTextRenderer::Deserialize(AstReader& reader)
+{
+    if (reader.ReadBool())
+    {
+        auto data = reader.ReadString();
+        auto charSize = reader.GetCharSize();
+        if (data.empty() || data.size() % charSize != 0)
+            throw AstFormatError("Invalid static text block");
+        if (charSize == sizeof(char))
+            return CreateOwnTextRenderer<char>(data);
+        if (charSize == sizeof(wchar_t))
+            return CreateOwnTextRenderer<wchar_t>(data);
+        throw AstFormatError("Unsupported char type");
+    }
+
+    auto length = static_cast<size_t>(reader.ReadUInt());
+    auto ptr = reader.ReadSourcePtr(length);
+    return std::make_shared<RawTextRenderer>(ptr, length);
+}
+
+void ExpressionRenderer::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ExpressionRenderer);
+    writer.WriteExpression(m_expression);
+    writer.WriteBool(m_autoescape);
+}
+
+RendererPtr ExpressionRenderer::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<ExpressionRenderer>(reader.ReadExpression());
+    result->SetAutoescape(reader.ReadBool());
+    return result;
+}
+
+// Statements
+
+void ForStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ForStatement);
+    writer.WriteStrings(m_vars);
+    writer.WriteExpression(m_value);
+    writer.WriteExpression(m_ifExpr);
+    writer.WriteBool(m_isRecursive);
+    writer.WriteUInt(m_loopVarUsage);
+    writer.RegisterLoop(this);
+    writer.WriteRenderer(m_mainBody);
+    writer.WriteRenderer(m_elseBody);
+}
+
+RendererPtr ForStatement::Deserialize(AstReader& reader)
+{
+    auto vars = reader.ReadStrings();
+    auto value = reader.ReadExpression();
+    auto ifExpr = reader.ReadExpression();
+    auto isRecursive = reader.ReadBool();
+    auto loopVarUsage = reader.ReadUInt();
+    auto result = std::make_shared<ForStatement>(std::move(vars), std::move(value), std::move(ifExpr), isRecursive);
+    result->SetLoopVarUsage(static_cast<uint32_t>(loopVarUsage));
+    reader.RegisterLoop(result.get());
+    result->SetMainBody(reader.ReadRenderer());
+    result->SetElseBody(reader.ReadRenderer());
+    return result;
+}
+
+void IfStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::IfStatement);
+    writer.WriteExpression(m_expr);
+    writer.WriteRenderer(m_mainBody);
+    writer.WriteUInt(m_elseBranches.size());
+    for (auto& branch : m_elseBranches)
+        writer.WriteRenderer(branch);
+}
+
+RendererPtr IfStatement::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<IfStatement>(reader.ReadExpression());
+    result->SetMainBody(reader.ReadRenderer());
+    auto count = reader.ReadSize();
+    for (size_t n = 0; n < count; ++ n)
+        result->AddElseBranch(reader.ReadRendererAs<ElseBranchStatement>());
+    return result;
+}
+
+void ElseBranchStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ElseBranchStatement);
+    writer.WriteExpression(m_expr);
+    writer.WriteRenderer(m_mainBody);
+}
+
+RendererPtr ElseBranchStatement::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<ElseBranchStatement>(reader.ReadExpression());
+    result->SetMainBody(reader.ReadRenderer());
+    return result;
+}
+
+void SetLineStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::SetLineStatement);
+    writer.WriteStrings(GetFields());
+    writer.WriteExpression(m_expr);
+}
+
+RendererPtr SetLineStatement::Deserialize(AstReader& reader)
+{
+    auto fields = reader.ReadStrings();
+    return std::make_shared<SetLineStatement>(std::move(fields), reader.ReadExpression());
+}
+
+void SetRawBlockStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::SetRawBlockStatement);
+    writer.WriteStrings(GetFields());
+    writer.WriteBool(IsAutoescape());
+    writer.WriteRenderer(GetBody());
+}
+
+RendererPtr SetRawBlockStatement::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<SetRawBlockStatement>(reader.ReadStrings());
+    result->SetAutoescape(reader.ReadBool());
+    result->SetBody(reader.ReadRenderer());
+    return result;
+}
+
+void SetFilteredBlockStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::SetFilteredBlockStatement);
+    writer.WriteStrings(GetFields());
+    writer.WriteBool(static_cast<bool>(m_expr));
+    if (m_expr)
+        m_expr->Serialize(writer);
+    writer.WriteBool(IsAutoescape());
+    writer.WriteRenderer(GetBody());
+}
+
+RendererPtr SetFilteredBlockStatement::Deserialize(AstReader& reader)
+{
+    auto fields = reader.ReadStrings();
+    auto filter = reader.ReadBool() ? ExpressionFilter::Deserialize(reader) : ExpressionEvaluatorPtr<ExpressionFilter>();
+    auto result = std::make_shared<SetFilteredBlockStatement>(std::move(fields), std::move(filter));
+    result->SetAutoescape(reader.ReadBool());
+    result->SetBody(reader.ReadRenderer());
+    return result;
+}
+
+void ParentBlockStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ParentBlockStatement);
+    writer.WriteString(m_name);
+    writer.WriteBool(m_isScoped);
+    writer.WriteRenderer(m_mainBody);
+}
+
+RendererPtr ParentBlockStatement::Deserialize(AstReader& reader)
+{
+    auto name = reader.ReadString();
+    auto isScoped = reader.ReadBool();
+    auto result = std::make_shared<ParentBlockStatement>(std::move(name), isScoped);
+    result->SetMainBody(reader.ReadRenderer());
+    return result;
+}
+
+void BlockStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::BlockStatement);
+    writer.WriteString(m_name);
+    writer.WriteRenderer(m_mainBody);
+}
+
+RendererPtr BlockStatement::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<BlockStatement>(reader.ReadString());
+    result->SetMainBody(reader.ReadRenderer());
+    return result;
+}
+
+void ExtendsStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ExtendsStatement);
+    writer.WriteString(m_templateName);
+    writer.WriteBool(m_isPath);
+    writer.WriteUInt(m_blocks.size());
+    for (auto block : SortedItems(m_blocks))
+        writer.WriteRenderer(block->second);
+}
+
+RendererPtr ExtendsStatement::Deserialize(AstReader& reader)
+{
+    auto name = reader.ReadString();
+    auto isPath = reader.ReadBool();
+    auto result = std::make_shared<ExtendsStatement>(std::move(name), isPath);
+    auto count = reader.ReadSize();
+    for (size_t n = 0; n < count; ++ n)
+    {
+        auto block = reader.ReadRendererAs<BlockStatement>();
+        if (!block)
+            throw AstFormatError("Block statement expected");
+        result->AddBlock(std::move(block));
+    }
+    return result;
+}
+
+void IncludeStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::IncludeStatement);
+    writer.WriteBool(m_ignoreMissing);
+    writer.WriteBool(m_withContext);
+    writer.WriteExpression(m_expr);
+}
+
+RendererPtr IncludeStatement::Deserialize(AstReader& reader)
+{
+    auto ignoreMissing = reader.ReadBool();
+    auto withContext = reader.ReadBool();
+    auto result = std::make_shared<IncludeStatement>(ignoreMissing, withContext);
+    result->SetIncludeNamesExpr(reader.ReadExpression());
+    return result;
+}
+
+void ImportStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ImportStatement);
+    writer.WriteBool(m_withContext);
+    writer.WriteExpression(m_nameExpr);
+    writer.WriteBool(m_namespace.has_value());
+    if (m_namespace)
+        writer.WriteString(m_namespace.value());
+    writer.WriteUInt(m_namesToImport.size());
+    for (auto name : SortedItems(m_namesToImport))
+    {
+        writer.WriteString(name->first);
+        writer.WriteString(name->second);
+    }
+}
+
+RendererPtr ImportStatement::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<ImportStatement>(reader.ReadBool());
+    result->SetImportNameExpr(reader.ReadExpression());
+    if (reader.ReadBool())
+        result->SetNamespace(reader.ReadString());
+    auto count = reader.ReadSize();
+    for (size_t n = 0; n < count; ++ n)
+    {
+        auto name = reader.ReadString();
+        result->AddNameToImport(std::move(name), reader.ReadString());
+    }
+    return result;
+}
+
+void MacroStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::MacroStatement);
+    writer.WriteString(m_name);
+    writer.WriteMacroParams(m_params);
+    writer.WriteBool(m_autoescape);
+    writer.WriteBool(m_isCached);
+    writer.WriteUInt(m_macroVarUsage);
+    writer.WriteRenderer(m_mainBody);
+}
+
+RendererPtr MacroStatement::Deserialize(AstReader& reader)
+{
+    auto name = reader.ReadString();
+    auto result = std::make_shared<MacroStatement>(std::move(name), reader.ReadMacroParams());
+    result->SetAutoescape(reader.ReadBool());
+    result->SetCached(reader.ReadBool());
+    result->SetMacroVarUsage(static_cast<uint32_t>(reader.ReadUInt()));
+    result->SetMainBody(reader.ReadRenderer());
+    return result;
+}
+
+void MacroCallStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::MacroCallStatement);
+    writer.WriteString(m_macroName);
+    writer.WriteCallParams(m_callParams);
+    writer.WriteMacroParams(m_params);
+    writer.WriteBool(m_autoescape);
+    writer.WriteUInt(m_macroVarUsage);
+    writer.WriteRenderer(m_mainBody);
+}
+
+RendererPtr MacroCallStatement::Deserialize(AstReader& reader)
+{
+    auto macroName = reader.ReadString();
+    auto callParams = reader.ReadCallParams();
+    auto result = std::make_shared<MacroCallStatement>(std::move(macroName), std::move(callParams), reader.ReadMacroParams());
+    result->SetAutoescape(reader.ReadBool());
+    result->SetMacroVarUsage(static_cast<uint32_t>(reader.ReadUInt()));
+    result->SetMainBody(reader.ReadRenderer());
+    return result;
+}
+
+void DoStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::DoStatement);
+    writer.WriteExpression(m_expr);
+}
+
+RendererPtr DoStatement::Deserialize(AstReader& reader)
+{
+    return std::make_shared<DoStatement>(reader.ReadExpression());
+}
+
+void WithStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::WithStatement);
+    writer.WriteUInt(m_scopeVars.size());
+    for (auto& var : m_scopeVars)
+    {
+        writer.WriteString(var.first);
+        writer.WriteExpression(var.second);
+    }
+    writer.WriteRenderer(m_mainBody);
+}
+
+RendererPtr WithStatement::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<WithStatement>();
+    std::vector<std::pair<std::string, ExpressionEvaluatorPtr<>>> scopeVars(reader.ReadSize());
+    for (auto& var : scopeVars)
+    {
+        var.first = reader.ReadString();
+        var.second = reader.ReadExpression();
+    }
+    result->SetScopeVars(std::move(scopeVars));
+    result->SetMainBody(reader.ReadRenderer());
+    return result;
+}
+
+void FilterStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::FilterStatement);
+    writer.WriteBool(static_cast<bool>(m_expr));
+    if (m_expr)
+        m_expr->Serialize(writer);
+    writer.WriteRenderer(m_body);
+}
+
+RendererPtr FilterStatement::Deserialize(AstReader& reader)
+{
+    auto filter = reader.ReadBool() ? ExpressionFilter::Deserialize(reader) : ExpressionEvaluatorPtr<ExpressionFilter>();
+    auto result = std::make_shared<FilterStatement>(std::move(filter));
+    result->SetBody(reader.ReadRenderer());
+    return result;
+}
+
+void CacheStatement::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::CacheStatement);
+    writer.WriteString(m_fragmentId);
+    writer.WriteExpression(m_keyExpr);
+    writer.WriteExpression(m_ttlExpr);
+    writer.WriteRenderer(m_body);
+}
+
+RendererPtr CacheStatement::Deserialize(AstReader& reader)
+{
+    auto fragmentId = reader.ReadString();
+    auto keyExpr = reader.ReadExpression();
+    auto ttlExpr = reader.ReadExpression();
+    auto result = std::make_shared<CacheStatement>(std::move(fragmentId), std::move(keyExpr), std::move(ttlExpr));
+    result->SetBody(reader.ReadRenderer());
+    return result;
+}
+
+// Expressions
+
+void FullExpressionEvaluator::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::FullExpressionEvaluator);
+    writer.WriteExpression(m_expression);
+    writer.WriteBool(static_cast<bool>(m_tester));
+    if (m_tester)
+        m_tester->Serialize(writer);
+}
+
+ExpressionEvaluatorPtr<> FullExpressionEvaluator::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<FullExpressionEvaluator>();
+    result->SetExpression(reader.ReadExpression());
+    if (reader.ReadBool())
+        result->SetTester(IfExpression::Deserialize(reader));
+    return result;
+}
+
+void ValueRefExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ValueRefExpression);
+    writer.WriteString(m_valueName.GetName());
+    writer.WriteLoopRef(m_slotOwner);
+    writer.WriteUInt(m_slotIndex);
+}
+
+ExpressionEvaluatorPtr<> ValueRefExpression::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<ValueRefExpression>(reader.ReadString());
+    auto slotOwner = reader.ReadLoopRef();
+    auto slotIndex = reader.ReadUInt();
+    if (slotOwner)
+        result->SetSlot(slotOwner, static_cast<size_t>(slotIndex));
+    return result;
+}
+
+void SubscriptExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::SubscriptExpression);
+    writer.WriteExpression(m_value);
+    writer.WriteUInt(m_subscriptExprs.size());
+    for (auto& expr : m_subscriptExprs)
+        writer.WriteExpression(expr);
+}
+
+ExpressionEvaluatorPtr<> SubscriptExpression::Deserialize(AstReader& reader)
+{
+    auto result = std::make_shared<SubscriptExpression>(reader.ReadExpression());
+    auto count = reader.ReadSize();
+    for (size_t n = 0; n < count; ++ n)
+        result->AddIndex(reader.ReadExpression());
+    return result;
+}
+
+void FilteredExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::FilteredExpression);
+    writer.WriteExpression(m_expression);
+    m_filter->Serialize(writer);
+}
+
+ExpressionEvaluatorPtr<> FilteredExpression::Deserialize(AstReader& reader)
+{
+    auto expr = reader.ReadExpression();
+    return std::make_shared<FilteredExpression>(std::move(expr), ExpressionFilter::Deserialize(reader));
+}
+
+void ConstantExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::ConstantExpression);
+    writer.WriteValue(m_constant);
+}
+
+ExpressionEvaluatorPtr<> ConstantExpression::Deserialize(AstReader& reader)
+{
+    return std::make_shared<ConstantExpression>(reader.ReadValue());
+}
+
+void TupleCreator::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::TupleCreator);
+    writer.WriteUInt(m_exprs.size());
+    for (auto& expr : m_exprs)
+        writer.WriteExpression(expr);
+}
+
+ExpressionEvaluatorPtr<> TupleCreator::Deserialize(AstReader& reader)
+{
+    std::vector<ExpressionEvaluatorPtr<>> exprs(reader.ReadSize());
+    for (auto& expr : exprs)
+        expr = reader.ReadExpression();
+    return std::make_shared<TupleCreator>(std::move(exprs));
+}
+
+void DictCreator::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::DictCreator);
+    writer.WriteUInt(m_exprs.size());
+    for (auto item : SortedItems(m_exprs))
+    {
+        writer.WriteString(item->first);
+        writer.WriteExpression(item->second);
+    }
+}
+
+ExpressionEvaluatorPtr<> DictCreator::Deserialize(AstReader& reader)
+{
+    std::unordered_map<std::string, ExpressionEvaluatorPtr<>> exprs;
+    auto count = reader.ReadSize();
+    for (size_t n = 0; n < count; ++ n)
+    {
+        auto name = reader.ReadString();
+        exprs[name] = reader.ReadExpression();
+    }
+    return std::make_shared<DictCreator>(std::move(exprs));
+}
+
+void UnaryExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::UnaryExpression);
+    writer.WriteUInt(m_oper);
+    writer.WriteExpression(m_expr);
+}
+
+ExpressionEvaluatorPtr<> UnaryExpression::Deserialize(AstReader& reader)
+{
+    auto oper = reader.ReadUInt();
+    if (oper > UnaryMinus)
+        throw AstFormatError("Invalid unary operation");
+    return std::make_shared<UnaryExpression>(static_cast<Operation>(oper), reader.ReadExpression());
+}
+
+void IsExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::IsExpression);
+    writer.WriteExpression(m_value);
+    writer.WriteString(m_testerName);
+    writer.WriteCallParams(m_params);
+}
+
+ExpressionEvaluatorPtr<> IsExpression::Deserialize(AstReader& reader)
+{
+    auto value = reader.ReadExpression();
+    auto tester = reader.ReadString();
+    return std::make_shared<IsExpression>(std::move(value), tester, reader.ReadCallParams());
+}
+
+void BinaryExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::BinaryExpression);
+    writer.WriteUInt(m_oper);
+    writer.WriteExpression(m_leftExpr);
+    writer.WriteExpression(m_rightExpr);
+}
+
+ExpressionEvaluatorPtr<> BinaryExpression::Deserialize(AstReader& reader)
+{
+    auto oper = reader.ReadUInt();
+    if (oper > StringConcat)
+        throw AstFormatError("Invalid binary operation");
+    auto leftExpr = reader.ReadExpression();
+    auto rightExpr = reader.ReadExpression();
+    return std::make_shared<BinaryExpression>(static_cast<Operation>(oper), std::move(leftExpr), std::move(rightExpr));
+}
+
+void CallExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteNodeKind(AstNodeKind::CallExpression);
+    writer.WriteExpression(m_valueRef);
+    writer.WriteCallParams(m_params);
+}
+
+ExpressionEvaluatorPtr<> CallExpression::Deserialize(AstReader& reader)
+{
+    auto valueRef = reader.ReadExpression();
+    return std::make_shared<CallExpression>(std::move(valueRef), reader.ReadCallParams());
+}
+
+void ExpressionFilter::Serialize(AstWriter& writer) const
+{
+    writer.WriteString(m_filterName);
+    writer.WriteCallParams(m_params);
+    writer.WriteBool(static_cast<bool>(m_parentFilter));
+    if (m_parentFilter)
+        m_parentFilter->Serialize(writer);
+}
+
+std::shared_ptr<ExpressionFilter> ExpressionFilter::Deserialize(AstReader& reader)
+{
+    auto name = reader.ReadString();
+    auto result = std::make_shared<ExpressionFilter>(name, reader.ReadCallParams());
+    if (reader.ReadBool())
+        result->SetParentFilter(Deserialize(reader));
+    return result;
+}
+
+void IfExpression::Serialize(AstWriter& writer) const
+{
+    writer.WriteExpression(m_testExpr);
+    writer.WriteExpression(m_altValue);
+}
+
+std::shared_ptr<IfExpression> IfExpression::Deserialize(AstReader& reader)
+{
+    auto testExpr = reader.ReadExpression();
+    return std::make_shared<IfExpression>(std::move(testExpr), reader.ReadExpression());
+}
+} // jinja2
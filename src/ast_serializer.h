@@ -0,0 +1,192 @@
+#ifndef AST_SERIALIZER_H
+#define AST_SERIALIZER_H
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace jinja2
+{
+class RendererBase;
+class ExpressionEvaluatorBase;
+class InternalValue;
+struct CallParamsInfo;
+struct MacroParam;
+
+constexpr char CompiledImageMagic[] = "J2CPP-AST";
+// Version of the compiled templates binary format. Should be increased on every change of the nodes layout
+constexpr uint32_t AstFormatVersion = 9;
+
+// Kinds of the serialized AST nodes. Values are stored in the compiled images, so existing items must never be reordered
+enum class AstNodeKind : uint8_t
+{
+    Null = 0,
+    Ref,
+    ComposedRenderer,
+    RawTextRenderer,
+    ExpressionRenderer,
+    ForStatement,
+    IfStatement,
+    ElseBranchStatement,
+    SetLineStatement,
+    SetRawBlockStatement,
+    SetFilteredBlockStatement,
+    ParentBlockStatement,
+    BlockStatement,
+    ExtendsStatement,
+    IncludeStatement,
+    ImportStatement,
+    MacroStatement,
+    MacroCallStatement,
+    DoStatement,
+    WithStatement,
+    FilterStatement,
+    FullExpressionEvaluator,
+    ValueRefExpression,
+    SubscriptExpression,
+    FilteredExpression,
+    ConstantExpression,
+    TupleCreator,
+    DictCreator,
+    UnaryExpression,
+    IsExpression,
+    BinaryExpression,
+    CallExpression,
+    CacheStatement,
+};
+
+// Hash of the template source which the compiled image is checked against
+uint64_t CalcSourceHash(const void* data, size_t size);
+
+struct AstFormatError : public std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Approximate heap size of the parsed tree: the nodes with their control blocks, the links to them and the strings they own. Nodes
+// which can't be serialized are counted as the links only
+size_t EstimateAstFootprint(const RendererBase* root, const void* sourceBegin, size_t sourceLength, size_t charSize);
+
+class AstWriter
+{
+public:
+    // Source text of the template (length in chars). Raw text nodes are stored as the offsets within it
+    AstWriter(const void* sourceBegin, size_t sourceLength, size_t charSize)
+        : m_sourceBegin(static_cast<const char*>(sourceBegin))
+        , m_sourceLength(sourceLength)
+        , m_charSize(charSize)
+    {
+    }
+
+    void WriteNodeKind(AstNodeKind kind);
+    void WriteUInt(uint64_t val);
+    void WriteInt(int64_t val);
+    void WriteBool(bool val) { WriteUInt(val ? 1 : 0); }
+    void WriteDouble(double val);
+    void WriteString(const std::string& str);
+    void WriteStrings(const std::vector<std::string>& strs);
+    void WriteSourcePtr(const void* ptr);
+    void WriteValue(const InternalValue& val);
+    void WriteRenderer(const RendererBase* renderer);
+    void WriteExpression(const ExpressionEvaluatorBase* expr);
+    void WriteCallParams(const CallParamsInfo& params);
+    void WriteMacroParams(const std::vector<MacroParam>& params);
+
+    template<typename T>
+    void WriteRenderer(const std::shared_ptr<T>& renderer) { WriteRenderer(static_cast<const RendererBase*>(renderer.get())); }
+    template<typename T>
+    void WriteExpression(const std::shared_ptr<T>& expr) { WriteExpression(static_cast<const ExpressionEvaluatorBase*>(expr.get())); }
+
+    // Loop statements register themselves before their bodies, so the references to the loop variable slots can be stored
+    void RegisterLoop(const void* loop);
+    void WriteLoopRef(const void* loop);
+
+    const std::string& GetData() const { return m_data; }
+    size_t GetCharSize() const { return m_charSize; }
+
+private:
+    friend size_t EstimateAstFootprint(const RendererBase* root, const void* sourceBegin, size_t sourceLength, size_t charSize);
+
+    template<typename Node>
+    void WriteNode(const Node* node, std::unordered_map<const void*, uint64_t>& ids);
+
+private:
+    const char* m_sourceBegin;
+    size_t m_sourceLength;
+    size_t m_charSize;
+    std::string m_data;
+    std::unordered_map<const void*, uint64_t> m_rendererIds;
+    std::unordered_map<const void*, uint64_t> m_expressionIds;
+    std::unordered_map<const void*, uint64_t> m_loopIds;
+    // Footprint of the written nodes (see EstimateAstFootprint)
+    size_t m_footprint = 0;
+    bool m_isMeasuring = false;
+};
+
+class AstReader
+{
+public:
+    AstReader(const char* data, size_t size, const void* sourceBegin, size_t sourceLength, size_t charSize)
+        : m_cur(data)
+        , m_end(data + size)
+        , m_sourceBegin(static_cast<const char*>(sourceBegin))
+        , m_sourceLength(sourceLength)
+        , m_charSize(charSize)
+    {
+    }
+
+    AstNodeKind ReadNodeKind();
+    uint64_t ReadUInt();
+    size_t ReadSize();
+    int64_t ReadInt();
+    bool ReadBool() { return ReadUInt() != 0; }
+    double ReadDouble();
+    std::string ReadString();
+    std::vector<std::string> ReadStrings();
+    const void* ReadSourcePtr(size_t length);
+    InternalValue ReadValue();
+    std::shared_ptr<RendererBase> ReadRenderer();
+    std::shared_ptr<ExpressionEvaluatorBase> ReadExpression();
+    CallParamsInfo ReadCallParams();
+    std::vector<MacroParam> ReadMacroParams();
+
+    template<typename T>
+    std::shared_ptr<T> ReadRendererAs()
+    {
+        auto renderer = ReadRenderer();
+        auto result = std::dynamic_pointer_cast<T>(renderer);
+        if (renderer && !result)
+            throw AstFormatError("Unexpected statement type");
+        return result;
+    }
+
+    void RegisterLoop(const void* loop) { m_loops.push_back(loop); }
+    const void* ReadLoopRef();
+
+    bool IsAtEnd() const { return m_cur == m_end; }
+    size_t GetCharSize() const { return m_charSize; }
+
+private:
+    const char* m_cur;
+    const char* m_end;
+    const char* m_sourceBegin;
+    size_t m_sourceLength;
+    size_t m_charSize;
+    std::vector<std::shared_ptr<RendererBase>> m_renderers;
+    std::vector<std::shared_ptr<ExpressionEvaluatorBase>> m_expressions;
+    std::vector<const void*> m_loops;
+};
+
+#define SERIALIZABLE_STATEMENT() \
+    void Serialize(AstWriter& writer) const override; \
+    static std::shared_ptr<RendererBase> Deserialize(AstReader& reader);
+
+#define SERIALIZABLE_EXPRESSION() \
+    void Serialize(AstWriter& writer) const override; \
+    static std::shared_ptr<ExpressionEvaluatorBase> Deserialize(AstReader& reader);
+} // jinja2
+
+#endif // AST_SERIALIZER_H
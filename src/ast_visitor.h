@@ -10,6 +10,7 @@ class ForStatement;
 class IfStatement;
 class ElseBranchStatement;
 class SetStatement;
+class SetBlockStatement;
 class ParentBlockStatement;
 class BlockStatement;
 class ExtendsStatement;
@@ -17,6 +18,9 @@ class IncludeStatement;
 class ImportStatement;
 class MacroStatement;
 class MacroCallStatement;
+class WithStatement;
+class FilterStatement;
+class CacheStatement;
 class ComposedRenderer;
 class RawTextRenderer;
 class ExpressionRenderer;
@@ -88,6 +92,7 @@ class StatementVisitor : public VisitorBase<
     IfStatement,
     ElseBranchStatement,
     SetStatement,
+    SetBlockStatement,
     ParentBlockStatement,
     BlockStatement,
     ExtendsStatement,
@@ -95,6 +100,9 @@ class StatementVisitor : public VisitorBase<
     ImportStatement,
     MacroStatement,
     MacroCallStatement,
+    WithStatement,
+    FilterStatement,
+    CacheStatement,
     ComposedRenderer,
     RawTextRenderer,
     ExpressionRenderer>
@@ -0,0 +1,386 @@
+#include <jinja2cpp/async_render.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace jinja2
+{
+namespace
+{
+// std::future_error isn't constructible from the error code before C++17, so the error is taken from the abandoned promise
+std::exception_ptr MakeBrokenPromiseError()
+{
+    std::future<void> result;
+    {
+        std::promise<void> promise;
+        result = promise.get_future();
+    }
+
+    try
+    {
+        result.get();
+    }
+    catch (...)
+    {
+        return std::current_exception();
+    }
+    return std::exception_ptr();
+}
+} // namespace
+
+struct PendingValue::State
+{
+    // Returns false if the result is already set
+    bool SetResult(Value val, std::exception_ptr ex)
+    {
+        std::vector<std::function<void ()>> readyHandlers;
+        {
+            std::lock_guard<std::mutex> l(guard);
+            if (isReady)
+                return false;
+            isReady = true;
+            value = std::move(val);
+            exception = std::move(ex);
+            readyHandlers.swap(handlers);
+        }
+        readyCond.notify_all();
+        for (auto& h : readyHandlers)
+            h();
+        return true;
+    }
+
+    std::mutex guard;
+    std::condition_variable readyCond;
+    bool isReady = false;
+    Value value;
+    std::exception_ptr exception;
+    std::vector<std::function<void ()>> handlers;
+};
+
+bool PendingValue::IsReady() const
+{
+    if (!m_state)
+        return true;
+
+    std::lock_guard<std::mutex> l(m_state->guard);
+    return m_state->isReady;
+}
+
+Value PendingValue::Get() const
+{
+    if (!m_state)
+        return Value();
+
+    std::unique_lock<std::mutex> l(m_state->guard);
+    m_state->readyCond.wait(l, [this]() { return m_state->isReady; });
+    if (m_state->exception)
+        std::rethrow_exception(m_state->exception);
+    return m_state->value;
+}
+
+void PendingValue::OnReady(std::function<void ()> handler) const
+{
+    if (m_state)
+    {
+        std::lock_guard<std::mutex> l(m_state->guard);
+        if (!m_state->isReady)
+        {
+            m_state->handlers.push_back(std::move(handler));
+            return;
+        }
+    }
+    handler();
+}
+
+ValuePromise::ValuePromise()
+    : m_state(std::make_shared<PendingValue::State>())
+{
+}
+
+ValuePromise::~ValuePromise()
+{
+    Break();
+}
+
+ValuePromise::ValuePromise(ValuePromise&& other) noexcept
+    : m_state(std::move(other.m_state))
+{
+}
+
+ValuePromise& ValuePromise::operator=(ValuePromise&& other) noexcept
+{
+    if (this != &other)
+    {
+        Break();
+        m_state = std::move(other.m_state);
+    }
+    return *this;
+}
+
+PendingValue ValuePromise::GetPendingValue() const
+{
+    return PendingValue(m_state);
+}
+
+void ValuePromise::SetValue(Value val)
+{
+    if (m_state)
+        m_state->SetResult(std::move(val), std::exception_ptr());
+}
+
+void ValuePromise::SetException(std::exception_ptr ex)
+{
+    if (m_state)
+        m_state->SetResult(Value(), std::move(ex));
+}
+
+void ValuePromise::Break()
+{
+    if (m_state)
+        m_state->SetResult(Value(), MakeBrokenPromiseError());
+}
+
+namespace
+{
+// Values requested by the render. Kept between the attempts of the same render
+struct AwaitState
+{
+    std::unordered_map<std::string, PendingValue> values;
+    // Values the current attempt got the empty stand-ins for
+    std::unordered_map<std::string, PendingValue> awaited;
+};
+
+thread_local AwaitState* g_awaitState = nullptr;
+
+class AwaitStateGuard
+{
+public:
+    explicit AwaitStateGuard(AwaitState& state)
+        : m_prevState(g_awaitState)
+    {
+        state.awaited.clear();
+        g_awaitState = &state;
+    }
+    ~AwaitStateGuard()
+    {
+        g_awaitState = m_prevState;
+    }
+
+private:
+    AwaitState* m_prevState;
+};
+
+struct RenderTask
+{
+    virtual ~RenderTask() = default;
+    // Renders the template from the beginning. Result is reported only if the render hasn't awaited any value
+    virtual void Render() = 0;
+    virtual void Fail(std::exception_ptr ex) = 0;
+
+    AwaitState state;
+    // Number of the awaited values which aren't ready yet. Guarded by the queue mutex
+    size_t pendingCount = 0;
+};
+
+template<typename TemplateT, typename ResultT>
+struct RenderTaskImpl : RenderTask
+{
+    RenderTaskImpl(const TemplateT& t, ValuesMap p)
+        : tpl(t)
+        , params(std::move(p))
+    {
+    }
+
+    void Render() override
+    {
+        auto result = tpl.RenderAsString(params);
+        if (state.awaited.empty())
+            promise.set_value(std::move(result));
+    }
+    void Fail(std::exception_ptr ex) override
+    {
+        promise.set_exception(std::move(ex));
+    }
+
+    TemplateT tpl;
+    ValuesMap params;
+    std::promise<ResultT> promise;
+};
+
+// Renders to start or to resume. Shared with the handlers of the awaited values, which may outlive the scheduler
+struct TasksQueue
+{
+    void OnValueReady(RenderTask* task)
+    {
+        std::lock_guard<std::mutex> l(guard);
+        if (isClosed || -- task->pendingCount != 0)
+            return;
+
+        ready.push_back(task);
+        readyCond.notify_one();
+    }
+
+    std::mutex guard;
+    std::condition_variable readyCond;
+    bool isClosed = false;
+    std::vector<std::unique_ptr<RenderTask>> scheduled;
+    std::vector<RenderTask*> ready;
+};
+} // namespace
+
+Value AwaitValue(const std::string& key, const std::function<PendingValue ()>& start)
+{
+    auto state = g_awaitState;
+    if (!state)
+        return start().Get();
+
+    auto p = state->values.find(key);
+    if (p == state->values.end())
+        p = state->values.emplace(key, start()).first;
+
+    auto& val = p->second;
+    if (!val.IsReady())
+    {
+        // Render goes on in order to start the rest of the requests which don't depend on this value
+        state->awaited.emplace(key, val);
+        return Value();
+    }
+
+    return val.Get();
+}
+
+struct AsyncRenderer::Impl
+{
+    Impl()
+        : queue(std::make_shared<TasksQueue>())
+    {
+    }
+
+    ~Impl()
+    {
+        std::vector<std::unique_ptr<RenderTask>> scheduled;
+        std::lock_guard<std::mutex> l(queue->guard);
+        queue->isClosed = true;
+        scheduled.swap(queue->scheduled);
+    }
+
+    template<typename ResultT, typename TemplateT>
+    std::future<ResultT> Schedule(const TemplateT& tpl, ValuesMap params)
+    {
+        auto task = std::make_unique<RenderTaskImpl<TemplateT, ResultT>>(tpl, std::move(params));
+        auto result = task->promise.get_future();
+
+        std::lock_guard<std::mutex> l(queue->guard);
+        queue->scheduled.push_back(std::move(task));
+        queue->readyCond.notify_one();
+        return result;
+    }
+
+    size_t Poll()
+    {
+        std::vector<std::unique_ptr<RenderTask>> scheduled;
+        std::vector<RenderTask*> ready;
+        {
+            std::lock_guard<std::mutex> l(queue->guard);
+            scheduled.swap(queue->scheduled);
+            ready.swap(queue->ready);
+        }
+
+        for (auto& t : scheduled)
+        {
+            auto task = t.get();
+            tasks.emplace(task, std::move(t));
+            Resume(*task);
+        }
+        for (auto task : ready)
+            Resume(*task);
+
+        std::lock_guard<std::mutex> l(queue->guard);
+        return tasks.size() + queue->scheduled.size();
+    }
+
+    void Resume(RenderTask& task)
+    {
+        {
+            AwaitStateGuard guard(task.state);
+            try
+            {
+                task.Render();
+            }
+            catch (...)
+            {
+                // Failure caused by the stand-in values is ignored, the render is repeated with the real ones
+                if (task.state.awaited.empty())
+                    task.Fail(std::current_exception());
+            }
+        }
+
+        if (task.state.awaited.empty())
+        {
+            tasks.erase(&task);
+            return;
+        }
+
+        Suspend(task);
+    }
+
+    // Render is queued for the resumption by the handler of the last awaited value which becomes ready
+    void Suspend(RenderTask& task)
+    {
+        {
+            std::lock_guard<std::mutex> l(queue->guard);
+            task.pendingCount = task.state.awaited.size();
+        }
+
+        std::weak_ptr<TasksQueue> weakQueue = queue;
+        auto taskPtr = &task;
+        for (auto& val : task.state.awaited)
+        {
+            val.second.OnReady([weakQueue, taskPtr]() {
+                if (auto q = weakQueue.lock())
+                    q->OnValueReady(taskPtr);
+            });
+        }
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> l(queue->guard);
+        queue->readyCond.wait(l, [this]() { return !queue->scheduled.empty() || !queue->ready.empty(); });
+    }
+
+    std::shared_ptr<TasksQueue> queue;
+    std::unordered_map<RenderTask*, std::unique_ptr<RenderTask>> tasks;
+};
+
+AsyncRenderer::AsyncRenderer()
+    : m_impl(std::make_unique<Impl>())
+{
+}
+
+AsyncRenderer::~AsyncRenderer() = default;
+
+std::future<Result<std::string>> AsyncRenderer::RenderAsync(const Template& tpl, ValuesMap params)
+{
+    return m_impl->Schedule<Result<std::string>>(tpl, std::move(params));
+}
+
+std::future<ResultW<std::wstring>> AsyncRenderer::RenderAsync(const TemplateW& tpl, ValuesMap params)
+{
+    return m_impl->Schedule<ResultW<std::wstring>>(tpl, std::move(params));
+}
+
+size_t AsyncRenderer::Poll()
+{
+    return m_impl->Poll();
+}
+
+void AsyncRenderer::Run()
+{
+    while (Poll() != 0)
+        m_impl->Wait();
+}
+
+} // jinja2
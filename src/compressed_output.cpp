@@ -0,0 +1,90 @@
+#include <jinja2cpp/compressed_output.h>
+
+#ifdef JINJA2CPP_WITH_ZLIB
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace jinja2
+{
+struct GzipOutputSink::Impl
+{
+    static constexpr size_t OutBufferSize = 16384;
+    // Window bits of the deflate stream with the gzip header and trailer
+    static constexpr int GzipWindowBits = 15 + 16;
+
+    Impl(OutputSink sink, int level)
+        : target(std::move(sink))
+    {
+        if (deflateInit2(&stream, level, Z_DEFLATED, GzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error("Failed to initialize the gzip stream");
+    }
+    ~Impl() { deflateEnd(&stream); }
+
+    // Feeds the input to the compressor and passes the produced data to the target as soon as the output buffer is filled
+    void Deflate(const char* data, size_t size, int flush)
+    {
+        do
+        {
+            auto chunkSize = std::min<size_t>(size, std::numeric_limits<uInt>::max());
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            stream.avail_in = static_cast<uInt>(chunkSize);
+            data += chunkSize;
+            size -= chunkSize;
+
+            auto chunkFlush = size == 0 ? flush : Z_NO_FLUSH;
+            do
+            {
+                stream.next_out = reinterpret_cast<Bytef*>(outBuffer);
+                stream.avail_out = static_cast<uInt>(OutBufferSize);
+                deflate(&stream, chunkFlush);
+                auto produced = OutBufferSize - stream.avail_out;
+                if (produced != 0)
+                    target(outBuffer, produced);
+            } while (stream.avail_out == 0);
+        } while (size != 0);
+    }
+
+    OutputSink target;
+    z_stream stream{};
+    bool isFinished = false;
+    char outBuffer[OutBufferSize];
+};
+
+constexpr size_t GzipOutputSink::Impl::OutBufferSize;
+constexpr int GzipOutputSink::Impl::GzipWindowBits;
+
+GzipOutputSink::GzipOutputSink(OutputSink target, int level)
+    : m_impl(new Impl(std::move(target), level))
+{
+}
+
+GzipOutputSink::~GzipOutputSink() = default;
+
+OutputSink GzipOutputSink::GetSink()
+{
+    return [this](const char* data, size_t size) { Write(data, size); };
+}
+
+void GzipOutputSink::Write(const char* data, size_t size)
+{
+    if (m_impl->isFinished || size == 0)
+        return;
+
+    m_impl->Deflate(data, size, Z_NO_FLUSH);
+}
+
+void GzipOutputSink::Finish()
+{
+    if (m_impl->isFinished)
+        return;
+
+    m_impl->Deflate(nullptr, 0, Z_FINISH);
+    m_impl->isFinished = true;
+}
+} // jinja2
+
+#endif // JINJA2CPP_WITH_ZLIB
@@ -75,6 +75,8 @@ struct ValueRenderer
 
     void operator()(const jinja2::UserCallable& /*val*/) const {}
 
+    void operator()(const jinja2::LazyValue& /*val*/) const {}
+
     template<typename T>
     void operator()(const T& val) const
     {
@@ -133,6 +135,18 @@ void RenderErrorInfo(std::basic_string<CharT>& result, const ErrorInfoTpl<CharT>
         format_to(out, UNIVERSAL_STR("Error occurred during template metadata parsing. Error: {}").GetValue<CharT>(), extraParams[0]);
         break;
     }
+    case ErrorCode::InvalidCompiledTemplate:
+    {
+        auto& extraParams = errInfo.GetExtraParams();
+        format_to(out, UNIVERSAL_STR("Invalid compiled template image. Reason: {}").GetValue<CharT>(), extraParams[0]);
+        break;
+    }
+    case ErrorCode::RenderLimitExceeded:
+    {
+        auto& extraParams = errInfo.GetExtraParams();
+        format_to(out, UNIVERSAL_STR("Render limit exceeded: {}").GetValue<CharT>(), extraParams[0]);
+        break;
+    }
     case ErrorCode::YetUnsupported:
         format_to(out, UNIVERSAL_STR("This feature has not been supported yet").GetValue<CharT>());
         break;
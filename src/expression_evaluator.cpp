@@ -1,5 +1,6 @@
 #include "expression_evaluator.h"
 #include "filters.h"
+#include "frozen_globals.h"
 #include "generic_adapters.h"
 #include "internal_value.h"
 #include "out_stream.h"
@@ -9,6 +10,7 @@
 #include <boost/algorithm/string/join.hpp>
 #include <boost/container/small_vector.hpp>
 
+#include <algorithm>
 #include <cmath>
 #include <stack>
 
@@ -43,8 +45,20 @@ void FullExpressionEvaluator::Render(OutStream& stream, RenderContext& values)
         Expression::Render(stream, values);
 }
 
+bool FullExpressionEvaluator::IsConstant() const
+{
+    return m_expression && m_expression->IsConstant() && (!m_tester || m_tester->IsConstant());
+}
+
 InternalValue ValueRefExpression::Evaluate(RenderContext& values)
 {
+    if (m_slotOwner)
+    {
+        auto value = values.FindSlotValue(m_slotOwner, m_slotIndex);
+        if (value)
+            return *value;
+    }
+
     bool found = false;
     auto p = values.FindValue(m_valueName, found);
     if (found)
@@ -53,26 +67,100 @@ InternalValue ValueRefExpression::Evaluate(RenderContext& values)
     return InternalValue();
 }
 
-InternalValue SubscriptExpression::Evaluate(RenderContext& values)
+bool ValueRefExpression::IsConstant() const
 {
-    InternalValue cur = m_value->Evaluate(values);
+    // Names bound by the template itself aren't frozen (see FrozenGlobals), so the reference to the frozen name is the global one
+    auto frozen = FrozenGlobals::GetCurrent();
+    return frozen && frozen->IsFrozen(m_valueName.GetName());
+}
 
-    for (auto idx : m_subscriptExprs)
+void SubscriptExpression::AddIndex(ExpressionEvaluatorPtr<Expression> value)
+{
+    nonstd::optional<HashedName> name;
+    bool isConverted = false;
+    // Subscripts are parsed as the full expressions, so the literals are taken through the wrapper
+    auto literal = value->GetLiteralValue();
+    if (literal)
     {
-        auto subscript = idx->Evaluate(values);
-        auto newVal = Subscript(cur, subscript, &values);
-        if (cur.ShouldExtendLifetime())
-            newVal.SetParentData(cur);
-        std::swap(newVal, cur);
+        auto str = GetIf<std::string>(literal);
+        auto targetStr = GetIf<TargetString>(literal);
+        auto wstr = targetStr ? nonstd::get_if<std::wstring>(targetStr) : nullptr;
+        if (!str && targetStr)
+            str = nonstd::get_if<std::string>(targetStr);
+        if (str)
+            name = HashedName(*str);
+        // Wide subscripts of the wide templates are converted once here instead of on each lookup
+        else if (wstr)
+            name = HashedName(ConvertString<std::string>(*wstr));
+        isConverted = wstr != nullptr;
     }
 
+    m_subscriptExprs.push_back(std::move(value));
+    m_subscriptNames.push_back(std::move(name));
+    m_convertedSubscriptNames.push_back(isConverted);
+    m_subscriptCaches.emplace_back();
+}
+
+std::vector<std::string> SubscriptExpression::GetAttributesPath() const
+{
+    std::vector<std::string> result;
+    for (auto& name : m_subscriptNames)
+    {
+        if (!name)
+            break;
+        result.push_back(name->GetName());
+    }
+
+    return result;
+}
+
+InternalValue SubscriptExpression::Evaluate(RenderContext& values)
+{
+    InternalValue cur = m_value->Evaluate(values);
+
+    for (size_t n = 0; n < m_subscriptExprs.size(); ++ n)
+        ApplyIndex(n, cur, nullptr, values);
+
     return cur;
 }
 
+void SubscriptExpression::ApplyIndex(size_t n, InternalValue& cur, const InternalValue* index, RenderContext& values)
+{
+    auto& name = m_subscriptNames[n];
+    // Converted names are only valid for the maps, the rest of the values are subscripted by the original wide strings
+    auto useName = name && (!m_convertedSubscriptNames[n] || GetIf<MapAdapter>(&cur));
+    InternalValue subscriptHolder;
+    auto newVal = useName ? Subscript(cur, *name, m_subscriptCaches[n], &values)
+                          : Subscript(cur, index ? *index : m_subscriptExprs[n]->EvaluateRef(values, subscriptHolder), &values);
+    if (cur.ShouldExtendLifetime())
+        newVal.SetParentData(cur);
+    std::swap(newVal, cur);
+}
+
+bool SubscriptExpression::IsConstant() const
+{
+    return m_value->IsConstant() &&
+        std::all_of(m_subscriptExprs.begin(), m_subscriptExprs.end(), [](auto& e) {return e->IsConstant();});
+}
+
+FilteredExpression::FilteredExpression(ExpressionEvaluatorPtr<Expression> expression, ExpressionEvaluatorPtr<ExpressionFilter> filter)
+    : m_expression(std::move(expression))
+    , m_filter(std::move(filter))
+{
+    auto literal = m_expression->GetLiteralValue();
+    if (literal)
+        m_filter->PrepareForBase(*literal);
+}
+
 InternalValue FilteredExpression::Evaluate(RenderContext& values)
 {
-    auto origResult = m_expression->Evaluate(values);
-    return m_filter->Evaluate(origResult, values);
+    InternalValue holder;
+    return m_filter->Evaluate(m_expression->EvaluateRef(values, holder), values);
+}
+
+bool FilteredExpression::IsConstant() const
+{
+    return m_expression->IsConstant() && m_filter->IsConstant();
 }
 
 InternalValue UnaryExpression::Evaluate(RenderContext& values)
@@ -80,6 +168,11 @@ InternalValue UnaryExpression::Evaluate(RenderContext& values)
     return Apply<visitors::UnaryOperation>(m_expr->Evaluate(values), m_oper);
 }
 
+bool UnaryExpression::IsConstant() const
+{
+    return m_expr->IsConstant();
+}
+
 BinaryExpression::BinaryExpression(BinaryExpression::Operation oper, ExpressionEvaluatorPtr<> leftExpr, ExpressionEvaluatorPtr<> rightExpr)
     : m_oper(oper)
     , m_leftExpr(leftExpr)
@@ -93,10 +186,134 @@ BinaryExpression::BinaryExpression(BinaryExpression::Operation oper, ExpressionE
     }
 }
 
+namespace
+{
+// Fast paths of the binary operations over the most frequent operand pairs: integers, numbers (the integer is promoted to double) and
+// strings of the same char type. Operands are checked by type before the generic BinaryMathOperation dispatch over all the value
+// types, and the results are the same as its ones. Return false for the other operations, which are left to the generic visitor
+bool EvaluateIntegers(int64_t left, int64_t right, BinaryExpression::Operation oper, InternalValue& result)
+{
+    switch (oper)
+    {
+    case BinaryExpression::Plus: result = left + right; return true;
+    case BinaryExpression::Minus: result = left - right; return true;
+    case BinaryExpression::Mul: result = left * right; return true;
+    case BinaryExpression::LogicalEq: result = left == right; return true;
+    case BinaryExpression::LogicalNe: result = left != right; return true;
+    case BinaryExpression::LogicalGt: result = left > right; return true;
+    case BinaryExpression::LogicalLt: result = left < right; return true;
+    case BinaryExpression::LogicalGe: result = left >= right; return true;
+    case BinaryExpression::LogicalLe: result = left <= right; return true;
+    default: return false;
+    }
+}
+
+// Equality of the doubles is checked with the tolerance, so such operations are left to the generic visitor
+bool EvaluateDoubles(double left, double right, BinaryExpression::Operation oper, InternalValue& result)
+{
+    switch (oper)
+    {
+    case BinaryExpression::Plus: result = left + right; return true;
+    case BinaryExpression::Minus: result = left - right; return true;
+    case BinaryExpression::Mul: result = left * right; return true;
+    case BinaryExpression::Div: result = left / right; return true;
+    case BinaryExpression::LogicalGt: result = left > right; return true;
+    case BinaryExpression::LogicalLt: result = left < right; return true;
+    default: return false;
+    }
+}
+
+inline const std::string* GetPlainString(const InternalValueData& data, char)
+{
+    return nonstd::get_if<std::string>(&data);
+}
+
+inline const std::wstring* GetPlainString(const InternalValueData&, wchar_t)
+{
+    return nullptr;
+}
+
+template<typename CharT>
+bool GetStringView(const InternalValueData& data, nonstd::basic_string_view<CharT>& result)
+{
+    const std::basic_string<CharT>* str = GetPlainString(data, CharT());
+    if (!str)
+    {
+        auto targetStr = nonstd::get_if<TargetString>(&data);
+        str = targetStr ? nonstd::get_if<std::basic_string<CharT>>(targetStr) : nullptr;
+    }
+    if (str)
+    {
+        result = nonstd::basic_string_view<CharT>(*str);
+        return true;
+    }
+
+    auto targetView = nonstd::get_if<TargetStringView>(&data);
+    auto view = targetView ? nonstd::get_if<nonstd::basic_string_view<CharT>>(targetView) : nullptr;
+    if (view)
+        result = *view;
+    return view != nullptr;
+}
+
+// Operators compare the strings case-sensitively
+template<typename CharT>
+bool EvaluateStrings(const InternalValueData& leftData, const InternalValueData& rightData, BinaryExpression::Operation oper, InternalValue& result)
+{
+    nonstd::basic_string_view<CharT> left;
+    nonstd::basic_string_view<CharT> right;
+    if (!GetStringView(leftData, left) || !GetStringView(rightData, right))
+        return false;
+
+    switch (oper)
+    {
+    case BinaryExpression::Plus:
+    {
+        std::basic_string<CharT> str;
+        str.reserve(left.size() + right.size());
+        str.append(left.begin(), left.end());
+        str.append(right.begin(), right.end());
+        result = TargetString(std::move(str));
+        return true;
+    }
+    case BinaryExpression::LogicalEq: result = left == right; return true;
+    case BinaryExpression::LogicalNe: result = left != right; return true;
+    case BinaryExpression::LogicalGt: result = left > right; return true;
+    case BinaryExpression::LogicalLt: result = left < right; return true;
+    case BinaryExpression::LogicalGe: result = left >= right; return true;
+    case BinaryExpression::LogicalLe: result = left <= right; return true;
+    default: return false;
+    }
+}
+
+bool EvaluateFastPath(const InternalValue& leftVal, const InternalValue& rightVal, BinaryExpression::Operation oper, InternalValue& result)
+{
+    auto& left = leftVal.GetData();
+    auto& right = rightVal.GetData();
+    auto leftInt = nonstd::get_if<int64_t>(&left);
+    auto rightInt = nonstd::get_if<int64_t>(&right);
+    if (leftInt && rightInt)
+        return EvaluateIntegers(*leftInt, *rightInt, oper, result);
+
+    auto leftDouble = nonstd::get_if<double>(&left);
+    auto rightDouble = nonstd::get_if<double>(&right);
+    if ((leftInt || leftDouble) && (rightInt || rightDouble))
+        return EvaluateDoubles(leftDouble ? *leftDouble : static_cast<double>(*leftInt), rightDouble ? *rightDouble : static_cast<double>(*rightInt), oper, result);
+
+    return EvaluateStrings<char>(left, right, oper, result) || EvaluateStrings<wchar_t>(left, right, oper, result);
+}
+} // namespace
+
 InternalValue BinaryExpression::Evaluate(RenderContext& context)
 {
-    InternalValue leftVal = m_leftExpr->Evaluate(context);
-    InternalValue rightVal = m_oper == In ? InternalValue() : m_rightExpr->Evaluate(context);
+    InternalValue leftHolder;
+    InternalValue rightHolder;
+    const InternalValue& leftVal = m_leftExpr->EvaluateRef(context, leftHolder);
+    const InternalValue& rightVal = m_oper == In ? rightHolder : m_rightExpr->EvaluateRef(context, rightHolder);
+    return Evaluate(leftVal, rightVal, &leftVal == &leftHolder ? &leftHolder : nullptr, context);
+}
+
+InternalValue BinaryExpression::Evaluate(const InternalValue& leftVal, const InternalValue& rightVal, InternalValue* leftTemp, RenderContext& context)
+{
     InternalValue result;
 
     switch (m_oper)
@@ -130,7 +347,8 @@ InternalValue BinaryExpression::Evaluate(RenderContext& context)
     case jinja2::BinaryExpression::DivReminder:
     case jinja2::BinaryExpression::DivInteger:
     case jinja2::BinaryExpression::Pow:
-        result = Apply2<visitors::BinaryMathOperation>(leftVal, rightVal, m_oper);
+        if (!EvaluateFastPath(leftVal, rightVal, m_oper, result))
+            result = Apply2<visitors::BinaryMathOperation>(leftVal, rightVal, m_oper);
         break;
     case jinja2::BinaryExpression::In:
     {
@@ -139,21 +357,16 @@ InternalValue BinaryExpression::Evaluate(RenderContext& context)
     }
     case jinja2::BinaryExpression::StringConcat:
     {
-        auto leftStr = context.GetRendererCallback()->GetAsTargetString(leftVal);
-        auto rightStr = context.GetRendererCallback()->GetAsTargetString(rightVal);
+        auto callback = context.GetRendererCallback();
+        // Result of the nested concatenation (e.g. in the 'a ~ b ~ c' chain) is the temporary, so it becomes the buffer the
+        // right operand is appended to
         TargetString resultStr;
-        std::string* nleftStr = GetIf<std::string>(&leftStr);
-        if (nleftStr != nullptr)
-        {
-            auto* nrightStr = GetIf<std::string>(&rightStr);
-            resultStr = *nleftStr + *nrightStr;
-        }
+        auto leftStr = leftTemp ? GetIf<TargetString>(leftTemp) : nullptr;
+        if (leftStr != nullptr)
+            resultStr = std::move(*leftStr);
         else
-        {
-            auto* wleftStr = GetIf<std::wstring>(&leftStr);
-            auto* wrightStr = GetIf<std::wstring>(&rightStr);
-            resultStr = *wleftStr + *wrightStr;
-        }
+            resultStr = callback->GetAsTargetString(leftVal);
+        callback->AppendAsTargetString(resultStr, rightVal);
         result = InternalValue(std::move(resultStr));
         break;
     }
@@ -163,8 +376,32 @@ InternalValue BinaryExpression::Evaluate(RenderContext& context)
     return result;
 }
 
+bool BinaryExpression::IsConstant() const
+{
+    return m_leftExpr->IsConstant() && m_rightExpr->IsConstant();
+}
+
+TupleCreator::TupleCreator(std::vector<ExpressionEvaluatorPtr<>> exprs)
+    : m_exprs(std::move(exprs))
+{
+    InternalValueList items;
+    items.reserve(m_exprs.size());
+    for (auto& e : m_exprs)
+    {
+        auto literal = e->GetLiteralValue();
+        if (!literal)
+            return;
+        items.push_back(*literal);
+    }
+
+    m_literal = InternalValue(ListAdapter::CreateSharedAdapter(std::move(items)));
+}
+
 InternalValue TupleCreator::Evaluate(RenderContext& context)
 {
+    if (m_literal)
+        return *m_literal;
+
     InternalValueList result;
     for (auto& e : m_exprs)
     {
@@ -174,8 +411,31 @@ InternalValue TupleCreator::Evaluate(RenderContext& context)
     return ListAdapter::CreateAdapter(std::move(result));
 }
 
+bool TupleCreator::IsConstant() const
+{
+    return std::all_of(m_exprs.begin(), m_exprs.end(), [](auto& e) {return e->IsConstant();});
+}
+
+DictCreator::DictCreator(std::unordered_map<std::string, ExpressionEvaluatorPtr<>> exprs)
+    : m_exprs(std::move(exprs))
+{
+    InternalValueMap items;
+    for (auto& e : m_exprs)
+    {
+        auto literal = e.second->GetLiteralValue();
+        if (!literal)
+            return;
+        items[e.first] = *literal;
+    }
+
+    m_literal = InternalValue(CreateSharedMapAdapter(std::move(items)));
+}
+
 InternalValue DictCreator::Evaluate(RenderContext& context)
 {
+    if (m_literal)
+        return *m_literal;
+
     InternalValueMap result;
     for (auto& e : m_exprs)
     {
@@ -185,11 +445,18 @@ InternalValue DictCreator::Evaluate(RenderContext& context)
     return CreateMapAdapter(std::move(result));;
 }
 
+bool DictCreator::IsConstant() const
+{
+    return std::all_of(m_exprs.begin(), m_exprs.end(), [](auto& e) {return e.second->IsConstant();});
+}
+
 ExpressionFilter::ExpressionFilter(const std::string& filterName, CallParamsInfo params)
+    : m_filterName(filterName)
+    , m_params(params)
 {
+    // Unknown names refer to the user-defined filters, which are looked up at render time (see UserDefinedFilter), so the filter is always
+    // created
     m_filter = CreateFilter(filterName, std::move(params));
-    if (!m_filter)
-        throw std::runtime_error("Can't find filter '" + filterName + "'");
 }
 
 InternalValue ExpressionFilter::Evaluate(const InternalValue& baseVal, RenderContext& context)
@@ -200,12 +467,26 @@ InternalValue ExpressionFilter::Evaluate(const InternalValue& baseVal, RenderCon
     return m_filter->Filter(baseVal, context);
 }
 
+void ExpressionFilter::PrepareForBase(const InternalValue& baseVal)
+{
+    if (m_parentFilter)
+        m_parentFilter->PrepareForBase(baseVal);
+    else
+        m_filter->PrepareForBase(baseVal);
+}
+
+bool ExpressionFilter::IsConstant() const
+{
+    return IsConstantFilter(m_filterName) && helpers::IsConstantCallParams(m_params) && (!m_parentFilter || m_parentFilter->IsConstant());
+}
+
 IsExpression::IsExpression(ExpressionEvaluatorPtr<> value, const std::string& tester, CallParamsInfo params)
     : m_value(value)
+    , m_testerName(tester)
+    , m_params(params)
 {
+    // Same as the filters, unknown names refer to the user-defined testers (see UserDefinedTester)
     m_tester = CreateTester(tester, std::move(params));
-    if (!m_tester)
-        throw std::runtime_error("Can't find tester '" + tester + "'");
 }
 
 InternalValue IsExpression::Evaluate(RenderContext& context)
@@ -213,6 +494,11 @@ InternalValue IsExpression::Evaluate(RenderContext& context)
     return m_tester->Test(m_value->Evaluate(context), context);
 }
 
+bool IsExpression::IsConstant() const
+{
+    return m_value->IsConstant() && IsConstantTester(m_testerName) && helpers::IsConstantCallParams(m_params);
+}
+
 bool IfExpression::Evaluate(RenderContext& context)
 {
     return ConvertToBool(m_testExpr->Evaluate(context));
@@ -223,6 +509,11 @@ InternalValue IfExpression::EvaluateAltValue(RenderContext& context)
     return m_altValue ? m_altValue->Evaluate(context) : InternalValue();
 }
 
+bool IfExpression::IsConstant() const
+{
+    return m_testExpr->IsConstant() && (!m_altValue || m_altValue->IsConstant());
+}
+
 /*
 InternalValue DictionaryCreator::Evaluate(RenderContext& context)
 {
@@ -237,10 +528,16 @@ InternalValue DictionaryCreator::Evaluate(RenderContext& context)
 
 InternalValue CallExpression::Evaluate(RenderContext& values)
 {
-    auto fn = m_valueRef->Evaluate(values);
+    values.CountStep();
+    if (values.HasError())
+        return InternalValue();
 
-    auto fnId = ConvertToInt(fn, InvalidFn);
+    return Call(m_valueRef->Evaluate(values), values);
+}
 
+InternalValue CallExpression::Call(const InternalValue& fn, RenderContext& values)
+{
+    auto fnId = ConvertToInt(fn, InvalidFn);
 
     switch (fnId)
     {
@@ -249,25 +546,36 @@ InternalValue CallExpression::Evaluate(RenderContext& values)
     case LoopCycleFn:
         return CallLoopCycle(values);
     default:
-        return CallArbitraryFn(values);
+        return CallArbitraryFn(fn, values);
     }
 }
 
 void CallExpression::Render(OutStream& stream, RenderContext& values)
 {
-    auto fnVal = m_valueRef->Evaluate(values);
+    RenderCall(m_valueRef->Evaluate(values), stream, values);
+}
+
+void CallExpression::RenderCall(InternalValue fnVal, OutStream& stream, RenderContext& values)
+{
     const Callable* callable = GetIf<Callable>(&fnVal);
     if (callable == nullptr)
     {
-        fnVal = Subscript(fnVal, std::string("operator()"), &values);
-        callable = GetIf<Callable>(&fnVal);
+        auto fnAttr = Subscript(fnVal, std::string("operator()"), &values);
+        callable = GetIf<Callable>(&fnAttr);
         if (callable == nullptr)
         {
-            Expression::Render(stream, values);
+            // Value which isn't callable is rendered as the result of the call (e.g. the global range() one)
+            values.CountStep();
+            stream.WriteValue(values.HasError() ? InternalValue() : Call(fnVal, values));
             return;
         }
+        fnVal = std::move(fnAttr);
+        callable = GetIf<Callable>(&fnVal);
     }
 
+    values.CountStep();
+    if (values.HasError())
+        return;
     auto callParams = helpers::EvaluateCallParams(m_params, values);
 
     if (callable->GetType() == Callable::Type::Expression)
@@ -276,13 +584,15 @@ void CallExpression::Render(OutStream& stream, RenderContext& values)
     }
     else
     {
+        // Statements (e.g. macro bodies) are responsible for escaping of their own output
+        bool prevAutoescape = stream.SetAutoescape(false);
         callable->GetStatementCallable()(callParams, stream, values);
+        stream.SetAutoescape(prevAutoescape);
     }
 }
 
-InternalValue CallExpression::CallArbitraryFn(RenderContext& values)
+InternalValue CallExpression::CallArbitraryFn(InternalValue fnVal, RenderContext& values)
 {
-    auto fnVal = m_valueRef->Evaluate(values);
     Callable* callable = GetIf<Callable>(&fnVal);
     if (callable == nullptr)
     {
@@ -306,7 +616,9 @@ InternalValue CallExpression::CallArbitraryFn(RenderContext& values)
     TargetString resultStr;
     auto stream = values.GetRendererCallback()->GetStreamOnString(resultStr);
     callable->GetStatementCallable()(callParams, stream, values);
-    return resultStr;
+    InternalValue result(std::move(resultStr));
+    result.SetSafe(callable->IsSafeOutput());
+    return result;
 }
 
 InternalValue CallExpression::CallGlobalRange(RenderContext& values)
@@ -340,12 +652,12 @@ InternalValue CallExpression::CallGlobalRange(RenderContext& values)
             return InternalValue();
     }
 
+    // Incomplete last step still produces the item, as in Python: range(0, 10, 3) is [0, 3, 6, 9]
     auto distance = stop - start;
-    auto items_count = distance / step;
-    items_count = items_count < 0 ? 0 : static_cast<size_t>(items_count);
+    auto items_count = (distance + step + (step > 0 ? -1 : 1)) / step;
+    items_count = items_count < 0 ? 0 : items_count;
 
-    return ListAdapter::CreateAdapter(static_cast<size_t>(items_count),
-                                      [start, step](size_t idx) { return InternalValue(static_cast<int64_t>(start + step * idx)); });
+    return ListAdapter::CreateRangeAdapter(IntegerRange{start, step, static_cast<size_t>(items_count)});
 }
 
 InternalValue CallExpression::CallLoopCycle(RenderContext& values)
@@ -596,5 +908,11 @@ CallParams EvaluateCallParams(const CallParamsInfo& info, RenderContext& context
     return result;
 }
 
+bool IsConstantCallParams(const CallParamsInfo& info)
+{
+    return std::all_of(info.posParams.begin(), info.posParams.end(), [](auto& p) {return p->IsConstant();}) &&
+        std::all_of(info.kwParams.begin(), info.kwParams.end(), [](auto& kw) {return kw.second->IsConstant();});
+}
+
 }
 }
@@ -1,9 +1,11 @@
 #ifndef EXPRESSION_EVALUATOR_H
 #define EXPRESSION_EVALUATOR_H
 
+#include "ast_serializer.h"
 #include "internal_value.h"
 #include "render_context.h"
 
+#include <deque>
 #include <memory>
 #include <limits>
 
@@ -24,6 +26,22 @@ public:
 
     virtual InternalValue Evaluate(RenderContext& values) = 0;
     virtual void Render(OutStream& stream, RenderContext& values);
+    virtual void Serialize(AstWriter& writer) const;
+    // Constant expressions don't depend on the render context, so they can be evaluated once at load time
+    virtual bool IsConstant() const { return false; }
+    // Immutable value owned by the expression (the literal or the literal collection built at parse time). Null for the rest
+    virtual const InternalValue* GetLiteralValue() const { return nullptr; }
+
+    // Borrows the literal value instead of copying it. The rest of the values are evaluated into 'holder'
+    const InternalValue& EvaluateRef(RenderContext& values, InternalValue& holder)
+    {
+        auto literal = GetLiteralValue();
+        if (literal)
+            return *literal;
+
+        holder = Evaluate(values);
+        return holder;
+    }
 };
 
 template<typename T = ExpressionEvaluatorBase>
@@ -104,6 +122,12 @@ public:
     }
     InternalValue Evaluate(RenderContext& values) override;
     void Render(OutStream &stream, RenderContext &values) override;
+    bool IsConstant() const override;
+    const InternalValue* GetLiteralValue() const override { return m_expression && !m_tester ? m_expression->GetLiteralValue() : nullptr; }
+    SERIALIZABLE_EXPRESSION()
+
+    auto& GetExpression() const {return m_expression;}
+    auto& GetTester() const {return m_tester;}
 private:
     ExpressionEvaluatorPtr<Expression> m_expression;
     ExpressionEvaluatorPtr<IfExpression> m_tester;
@@ -113,12 +137,30 @@ class ValueRefExpression : public Expression
 {
 public:
     ValueRefExpression(std::string valueName)
-        : m_valueName(valueName)
+        : m_valueName(std::move(valueName))
     {
     }
     InternalValue Evaluate(RenderContext& values) override;
+    bool IsConstant() const override;
+    SERIALIZABLE_EXPRESSION()
+
+    const std::string& GetValueName() const {return m_valueName.GetName();}
+    auto& GetHashedName() const {return m_valueName;}
+    const void* GetSlotOwner() const {return m_slotOwner;}
+    size_t GetSlotIndex() const {return m_slotIndex;}
+    void SetSlot(const void* owner, size_t index)
+    {
+        m_slotOwner = owner;
+        m_slotIndex = index;
+    }
+    void ResetSlot()
+    {
+        m_slotOwner = nullptr;
+    }
 private:
-    std::string m_valueName;
+    HashedName m_valueName;
+    const void* m_slotOwner = nullptr;
+    size_t m_slotIndex = 0;
 };
 
 class SubscriptExpression : public Expression
@@ -129,25 +171,39 @@ public:
     {
     }
     InternalValue Evaluate(RenderContext& values) override;
-    void AddIndex(ExpressionEvaluatorPtr<Expression> value)
-    {
-        m_subscriptExprs.push_back(value);
-    }
+    bool IsConstant() const override;
+    SERIALIZABLE_EXPRESSION()
+    void AddIndex(ExpressionEvaluatorPtr<Expression> value);
+    // Names of the leading constant string subscripts, up to the first computed (or non-string) one
+    std::vector<std::string> GetAttributesPath() const;
+    auto& GetValue() const {return m_value;}
+    size_t GetIndicesCount() const {return m_subscriptExprs.size();}
+    auto& GetIndex(size_t n) const {return m_subscriptExprs[n];}
+    bool IsNamedIndex(size_t n) const {return !!m_subscriptNames[n];}
+    // Replaces 'cur' with its subscript 'n'. 'index' is the value of the index expression, it's evaluated here if null
+    void ApplyIndex(size_t n, InternalValue& cur, const InternalValue* index, RenderContext& values);
 
 private:
     ExpressionEvaluatorPtr<Expression> m_value;
     std::vector<ExpressionEvaluatorPtr<Expression>> m_subscriptExprs;
+    // Hashed names of the constant string subscripts (attributes), empty for the other ones
+    std::vector<nonstd::optional<HashedName>> m_subscriptNames;
+    // Flags of the names converted from the wide string subscripts
+    std::vector<bool> m_convertedSubscriptNames;
+    // Slot caches of the attribute subscripts. Deque keeps the non-movable caches in place while the indices are added
+    std::deque<MapSlotCache> m_subscriptCaches;
 };
 
 class FilteredExpression : public Expression
 {
 public:
-    explicit FilteredExpression(ExpressionEvaluatorPtr<Expression> expression, ExpressionEvaluatorPtr<ExpressionFilter> filter)
-        : m_expression(std::move(expression))
-        , m_filter(std::move(filter))
-    {
-    }
+    explicit FilteredExpression(ExpressionEvaluatorPtr<Expression> expression, ExpressionEvaluatorPtr<ExpressionFilter> filter);
     InternalValue Evaluate(RenderContext&) override;
+    bool IsConstant() const override;
+    SERIALIZABLE_EXPRESSION()
+
+    auto& GetExpression() const {return m_expression;}
+    auto& GetFilter() const {return m_filter;}
 
 private:
     ExpressionEvaluatorPtr<Expression> m_expression;
@@ -164,6 +220,10 @@ public:
     {
         return m_constant;
     }
+    bool IsConstant() const override { return true; }
+    const InternalValue* GetLiteralValue() const override { return &m_constant; }
+    auto& GetValue() const { return m_constant; }
+    SERIALIZABLE_EXPRESSION()
 private:
     InternalValue m_constant;
 };
@@ -171,15 +231,19 @@ private:
 class TupleCreator : public Expression
 {
 public:
-    TupleCreator(std::vector<ExpressionEvaluatorPtr<>> exprs)
-        : m_exprs(std::move(exprs))
-    {
-    }
+    TupleCreator(std::vector<ExpressionEvaluatorPtr<>> exprs);
 
     InternalValue Evaluate(RenderContext&) override;
+    bool IsConstant() const override;
+    const InternalValue* GetLiteralValue() const override { return m_literal ? &m_literal.value() : nullptr; }
+    SERIALIZABLE_EXPRESSION()
+
+    auto& GetExprs() const { return m_exprs; }
 
 private:
     std::vector<ExpressionEvaluatorPtr<>> m_exprs;
+    // List of the literal items built once and shared read-only by all the evaluations. Null if any item isn't literal
+    nonstd::optional<InternalValue> m_literal;
 };
 /*
 class DictionaryCreator : public Expression
@@ -199,15 +263,17 @@ private:
 class DictCreator : public Expression
 {
 public:
-    DictCreator(std::unordered_map<std::string, ExpressionEvaluatorPtr<>> exprs)
-        : m_exprs(std::move(exprs))
-    {
-    }
+    DictCreator(std::unordered_map<std::string, ExpressionEvaluatorPtr<>> exprs);
 
     InternalValue Evaluate(RenderContext&) override;
+    bool IsConstant() const override;
+    const InternalValue* GetLiteralValue() const override { return m_literal ? &m_literal.value() : nullptr; }
+    SERIALIZABLE_EXPRESSION()
 
 private:
     std::unordered_map<std::string, ExpressionEvaluatorPtr<>> m_exprs;
+    // Dictionary of the literal items built once and shared read-only by all the evaluations. Null if any item isn't literal
+    nonstd::optional<InternalValue> m_literal;
 };
 
 class UnaryExpression : public Expression
@@ -225,6 +291,11 @@ public:
         , m_expr(expr)
     {}
     InternalValue Evaluate(RenderContext&) override;
+    bool IsConstant() const override;
+    SERIALIZABLE_EXPRESSION()
+
+    auto GetOperation() const {return m_oper;}
+    auto& GetExpression() const {return m_expr;}
 private:
     Operation m_oper;
     ExpressionEvaluatorPtr<> m_expr;
@@ -245,9 +316,16 @@ public:
 
     IsExpression(ExpressionEvaluatorPtr<> value, const std::string& tester, CallParamsInfo params);
     InternalValue Evaluate(RenderContext& context) override;
+    bool IsConstant() const override;
+    SERIALIZABLE_EXPRESSION()
+
+    auto& GetValue() const {return m_value;}
+    auto& GetTester() const {return m_tester;}
 
 private:
     ExpressionEvaluatorPtr<> m_value;
+    std::string m_testerName;
+    CallParamsInfo m_params;
     std::shared_ptr<ITester> m_tester;
 };
 
@@ -284,6 +362,16 @@ public:
 
     BinaryExpression(Operation oper, ExpressionEvaluatorPtr<> leftExpr, ExpressionEvaluatorPtr<> rightExpr);
     InternalValue Evaluate(RenderContext&) override;
+    bool IsConstant() const override;
+    SERIALIZABLE_EXPRESSION()
+
+    auto GetOperation() const {return m_oper;}
+    auto& GetLeftExpression() const {return m_leftExpr;}
+    auto& GetRightExpression() const {return m_rightExpr;}
+    auto& GetInTester() const {return m_inTester;}
+    // Applies the operation to the evaluated operands. 'leftTemp' is the left operand if it's the temporary one, so its storage can
+    // be reused for the result. The right operand of the 'in' operation is evaluated by the tester itself
+    InternalValue Evaluate(const InternalValue& leftVal, const InternalValue& rightVal, InternalValue* leftTemp, RenderContext& context);
 private:
     Operation m_oper;
     ExpressionEvaluatorPtr<> m_leftExpr;
@@ -305,12 +393,16 @@ public:
 
     InternalValue Evaluate(RenderContext &values) override;
     void Render(OutStream &stream, RenderContext &values) override;
+    SERIALIZABLE_EXPRESSION()
 
     auto& GetValueRef() const {return m_valueRef;}
     auto& GetParams() const {return m_params;}
+    // Evaluate and Render with the evaluated callable ('fn' is the value of the value reference)
+    InternalValue Call(const InternalValue& fn, RenderContext& values);
+    void RenderCall(InternalValue fnVal, OutStream& stream, RenderContext& values);
 
 private:
-    InternalValue CallArbitraryFn(RenderContext &values);
+    InternalValue CallArbitraryFn(InternalValue fnVal, RenderContext &values);
     InternalValue CallGlobalRange(RenderContext &values);
     InternalValue CallLoopCycle(RenderContext &values);
 
@@ -328,6 +420,8 @@ public:
     {
         virtual ~IExpressionFilter() {}
         virtual InternalValue Filter(const InternalValue& baseVal, RenderContext& context) = 0;
+        // Called at load time if the filtered value is the literal, so the filter can prepare for it (e.g. parse the format string)
+        virtual void PrepareForBase(const InternalValue& /*baseVal*/) {}
     };
 
     using FilterFactoryFn = std::function<std::shared_ptr<IExpressionFilter>(CallParamsInfo params)>;
@@ -335,11 +429,21 @@ public:
     ExpressionFilter(const std::string& filterName, CallParamsInfo params);
 
     InternalValue Evaluate(const InternalValue& baseVal, RenderContext& context);
+    // Passes the literal filtered value to the first filter of the chain
+    void PrepareForBase(const InternalValue& baseVal);
     void SetParentFilter(std::shared_ptr<ExpressionFilter> parentFilter)
     {
         m_parentFilter = std::move(parentFilter);
     }
+    bool IsConstant() const;
+    void Serialize(AstWriter& writer) const;
+    static std::shared_ptr<ExpressionFilter> Deserialize(AstReader& reader);
+
+    auto& GetFilter() const {return m_filter;}
+    auto& GetParentFilter() const {return m_parentFilter;}
 private:
+    std::string m_filterName;
+    CallParamsInfo m_params;
     std::shared_ptr<IExpressionFilter> m_filter;
     std::shared_ptr<ExpressionFilter> m_parentFilter;
 };
@@ -363,6 +467,12 @@ public:
     {
         m_altValue = std::move(altValue);
     }
+    bool IsConstant() const;
+    void Serialize(AstWriter& writer) const;
+    static std::shared_ptr<IfExpression> Deserialize(AstReader& reader);
+
+    auto& GetTestExpression() const {return m_testExpr;}
+    auto& GetAltValue() const {return m_altValue;}
 
 private:
     ExpressionEvaluatorPtr<> m_testExpr;
@@ -376,6 +486,7 @@ ParsedArguments ParseCallParams(const std::vector<ArgumentInfo>& args, const Cal
 ParsedArgumentsInfo ParseCallParamsInfo(const std::initializer_list<ArgumentInfo>& argsInfo, const CallParamsInfo& params, bool& isSucceeded);
 ParsedArgumentsInfo ParseCallParamsInfo(const std::vector<ArgumentInfo>& args, const CallParamsInfo& params, bool& isSucceeded);
 CallParams EvaluateCallParams(const CallParamsInfo& info, RenderContext& context);
+bool IsConstantCallParams(const CallParamsInfo& info);
 }
 } // jinja2
 
@@ -1,5 +1,8 @@
 #include "expression_parser.h"
 
+#include "statements.h"
+
+#include <algorithm>
 #include <sstream>
 #include <unordered_set>
 #include <jinja2cpp/template_env.h>
@@ -17,7 +20,222 @@ auto ReplaceErrorIfPossible(T& result, const Token& pivotTok, ErrorCode newError
     return result.get_unexpected();
 }
 
-ExpressionParser::ExpressionParser(const Settings& /* settings */, TemplateEnv* /* env */)
+// Name of the 'loop' variable attribute accessed right after the reference. 'operator()' stands for the recursive loop call
+static std::string PeekLoopAttrName(LexScanner& lexer)
+{
+    auto tok = lexer.PeekNextToken();
+    if (tok == '(')
+        return "operator()";
+    if (tok != '.')
+        return std::string();
+
+    auto state = lexer.GetState();
+    lexer.EatToken();
+    std::string result;
+    if (lexer.PeekNextToken() == Token::Identifier)
+        result = AsString(lexer.PeekNextToken().value);
+    lexer.RestoreState(state);
+    return result;
+}
+
+void LocalSlotsResolver::EnterLoop(const void* owner, const std::vector<std::string>& vars)
+{
+    Frame frame;
+    frame.owner = owner;
+    frame.names = vars;
+    // 'loop' variable takes the slot right after the loop vars
+    frame.names.push_back("loop");
+    m_boundNames.insert(frame.names.begin(), frame.names.end());
+    m_scopes.emplace_back(frame.names.begin(), frame.names.end());
+    m_frames.push_back(std::move(frame));
+}
+
+void LocalSlotsResolver::LeaveLoopBody()
+{
+    if (!m_frames.empty())
+        m_frames.back().isActive = false;
+    // Neither the loop variables nor the names bound by the loop body are visible within the 'else' branch
+    if (m_scopes.size() > 1)
+        m_scopes.back().clear();
+}
+
+uint32_t LocalSlotsResolver::ExitLoop()
+{
+    if (m_frames.empty())
+        return ForStatement::LoopVarAll;
+
+    auto& frame = m_frames.back();
+    for (auto& ref : frame.refs)
+    {
+        if (frame.reboundNames.count(ref->GetValueName()) != 0)
+            ref->ResetSlot();
+    }
+    auto usage = frame.loopVarUsage;
+    if (frame.reboundNames.count("loop") != 0)
+        usage = ForStatement::LoopVarAll;
+    m_frames.pop_back();
+    ExitScope();
+    return usage;
+}
+
+void LocalSlotsResolver::EnterOpaqueScope(const std::vector<std::string>& localNames)
+{
+    m_frames.push_back(Frame());
+    m_scopes.emplace_back(localNames.begin(), localNames.end());
+}
+
+uint32_t LocalSlotsResolver::ExitOpaqueScope()
+{
+    if (m_frames.empty())
+        return ForStatement::LoopVarAll;
+
+    auto usage = m_frames.back().loopVarUsage;
+    m_frames.pop_back();
+    ExitScope();
+    return usage;
+}
+
+void LocalSlotsResolver::ExitScope()
+{
+    if (m_scopes.size() > 1)
+        m_scopes.pop_back();
+}
+
+void LocalSlotsResolver::AddBinding(const std::string& name)
+{
+    m_boundNames.insert(name);
+    m_scopes.back().insert(name);
+    for (auto& frame : m_frames)
+    {
+        if (frame.owner)
+            frame.reboundNames.insert(name);
+    }
+}
+
+void LocalSlotsResolver::AddLoopVarUsage(uint32_t usage)
+{
+    if (!m_frames.empty())
+        m_frames.back().loopVarUsage |= usage;
+}
+
+void LocalSlotsResolver::ExposeLoopVars()
+{
+    for (auto p = m_frames.rbegin(); p != m_frames.rend(); ++ p)
+    {
+        p->loopVarUsage = ForStatement::LoopVarAll;
+        // Opaque scope is rendered wherever it's invoked from, so the outer loops are exposed by the invocation itself
+        if (!p->owner)
+            return;
+    }
+}
+
+void LocalSlotsResolver::ExposeMacroVars()
+{
+    for (auto& frame : m_frames)
+    {
+        if (!frame.owner)
+            frame.macroVarUsage = MacroStatement::MacroVarAll;
+    }
+}
+
+uint32_t LocalSlotsResolver::GetMacroVarUsage() const
+{
+    for (auto p = m_frames.rbegin(); p != m_frames.rend(); ++ p)
+    {
+        if (!p->owner)
+            return p->macroVarUsage;
+    }
+
+    return MacroStatement::MacroVarAll;
+}
+
+void LocalSlotsResolver::Resolve(const std::shared_ptr<ValueRefExpression>& valueRef, const std::string& loopAttr)
+{
+    auto& name = valueRef->GetValueName();
+    // Filter blocks are rendered within the scope of the enclosing macro, so the usage is added to all the enclosing opaque scopes
+    if (auto macroVar = MacroStatement::GetMacroVarAttr(name))
+    {
+        for (auto& frame : m_frames)
+        {
+            if (!frame.owner)
+            {
+                frame.macroVarUsage |= macroVar;
+                m_boundNames.insert(name);
+            }
+        }
+    }
+
+    bool isLoopVar = name == "loop";
+    for (auto p = m_frames.rbegin(); p != m_frames.rend(); ++ p)
+    {
+        // Macro bodies, call blocks and so on are rendered within their own scopes
+        if (!p->owner)
+        {
+            if (isLoopVar)
+                p->loopVarUsage = ForStatement::LoopVarAll;
+            return;
+        }
+
+        auto nameP = std::find(p->names.begin(), p->names.end(), name);
+        if (nameP == p->names.end())
+            continue;
+
+        auto slotIdx = static_cast<size_t>(nameP - p->names.begin());
+        bool isLoopSlot = slotIdx + 1 == p->names.size();
+        // Loop variables aren't bound inside the 'else' branch of the loop
+        if (!p->isActive)
+        {
+            if (isLoopSlot)
+                p->loopVarUsage = ForStatement::LoopVarAll;
+            return;
+        }
+
+        valueRef->SetSlot(p->owner, slotIdx);
+        p->refs.push_back(valueRef);
+        if (isLoopSlot)
+            p->loopVarUsage |= loopAttr.empty() ? ForStatement::LoopVarAll : ForStatement::GetLoopVarAttr(loopAttr);
+        return;
+    }
+}
+
+bool LocalSlotsResolver::IsFreeName(const std::string& name) const
+{
+    for (auto& scope : m_scopes)
+    {
+        if (scope.count(name) != 0)
+            return false;
+    }
+
+    // Special variables of the macro bodies and call blocks
+    if (MacroStatement::GetMacroVarAttr(name))
+    {
+        for (auto& frame : m_frames)
+        {
+            if (!frame.owner)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void LocalSlotsResolver::AddFreeUsage(const std::string& name, const std::vector<std::string>& attributes)
+{
+    m_freeNames.insert(name);
+    if (attributes.empty())
+        return;
+
+    std::string path = name;
+    for (auto& attr : attributes)
+    {
+        path.push_back('.');
+        path += attr;
+    }
+    m_attributePaths.insert(std::move(path));
+}
+
+ExpressionParser::ExpressionParser(const Settings& /* settings */, TemplateEnv* /* env */, LocalSlotsResolver* slotsResolver)
+    : m_slotsResolver(slotsResolver)
 {
 
 }
@@ -290,6 +508,8 @@ ExpressionParser::ParseResult<ExpressionEvaluatorPtr<Expression>> ExpressionPars
     static const std::unordered_set<Keyword> forbiddenKw = {Keyword::Is, Keyword::In, Keyword::If, Keyword::Else};
 
     ParseResult<ExpressionEvaluatorPtr<Expression>> valueRef;
+    bool isLoopVarRef = false;
+    std::string freeName;
 
     switch (tok.type)
     {
@@ -299,7 +519,15 @@ ExpressionParser::ParseResult<ExpressionEvaluatorPtr<Expression>> ExpressionPars
         if (forbiddenKw.count(kwType) != 0)
             return MakeParseError(ErrorCode::UnexpectedToken, tok);
             
-        valueRef = std::make_shared<ValueRefExpression>(AsString(tok.value));
+        auto ref = std::make_shared<ValueRefExpression>(AsString(tok.value));
+        isLoopVarRef = ref->GetValueName() == "loop";
+        if (m_slotsResolver)
+        {
+            m_slotsResolver->Resolve(ref, isLoopVarRef ? PeekLoopAttrName(lexer) : std::string());
+            if (m_slotsResolver->IsFreeName(ref->GetValueName()))
+                freeName = ref->GetValueName();
+        }
+        valueRef = ref;
         break;
     }
     case Token::IntegerNum:
@@ -329,8 +557,18 @@ ExpressionParser::ParseResult<ExpressionEvaluatorPtr<Expression>> ExpressionPars
         if (tok == '[' || tok == '.')
             valueRef = ParseSubscript(lexer, *valueRef);
 
+        if (!freeName.empty() && valueRef)
+        {
+            auto subscript = std::dynamic_pointer_cast<SubscriptExpression>(*valueRef);
+            m_slotsResolver->AddFreeUsage(freeName, subscript ? subscript->GetAttributesPath() : std::vector<std::string>());
+        }
+
         if (lexer.EatIfEqual('('))
+        {
+            if (m_slotsResolver && !isLoopVarRef)
+                m_slotsResolver->ExposeLoopVars();
             valueRef = ParseCall(lexer, *valueRef);
+        }
     }
     return valueRef;
 }
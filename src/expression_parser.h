@@ -9,15 +9,84 @@
 #include <nonstd/expected.hpp>
 #include <jinja2cpp/template_env.h>
 
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
 namespace jinja2
 {
+// Tracks lexical scopes of the loop variables during the template parsing and binds references to them to the loop slots.
+// Reference loses the slot if the same name can be rebound (by 'set', 'with', 'import' etc.) somewhere inside the loop body.
+// Also collects the attributes of the 'loop' variable used by every loop (see ForStatement::LoopVarAttr) and the special variables
+// used by every macro (see MacroStatement::MacroVarAttr), the names bound anywhere in the template (see GetBoundNames) and the
+// free variables referred by the template (see GetFreeNames)
+class LocalSlotsResolver
+{
+public:
+    void EnterLoop(const void* owner, const std::vector<std::string>& vars);
+    void LeaveLoopBody();
+    uint32_t ExitLoop();
+    // Local names are bound by the scope itself, e.g. the loop variables visible to the loop filter
+    void EnterOpaqueScope(const std::vector<std::string>& localNames = std::vector<std::string>());
+    uint32_t ExitOpaqueScope();
+    // Scopes which only limit the visibility of the names bound inside them (e.g. 'with' statement bodies)
+    void EnterScope() { m_scopes.emplace_back(); }
+    void ExitScope();
+    void AddBinding(const std::string& name);
+    // Parameters of the macros and call blocks. Bound within the opaque scopes, so they don't affect the loop slots
+    void AddParam(const std::string& name)
+    {
+        m_boundNames.insert(name);
+        m_scopes.back().insert(name);
+    }
+    void AddLoopVarUsage(uint32_t usage);
+    // Macros, included templates, blocks etc. are rendered within the current scope and can look up the 'loop' variable by name
+    void ExposeLoopVars();
+    // Included and imported templates are rendered within the current scope and can look up the macro variables by name
+    void ExposeMacroVars();
+    // Macro variables used by the innermost opaque scope (macro body)
+    uint32_t GetMacroVarUsage() const;
+    void Resolve(const std::shared_ptr<ValueRefExpression>& valueRef, const std::string& loopAttr = std::string());
+    // Names which may refer to the local variables rather than to the globals somewhere in the template
+    const std::unordered_set<std::string>& GetBoundNames() const { return m_boundNames; }
+    // Checks whether the name isn't bound by the template at the current parse position, so it's looked up from the render params
+    // (or the globals). Names bound later or by the other templates are treated as free, so the result errs on the side of freedom
+    bool IsFreeName(const std::string& name) const;
+    // Reference to the free variable followed by the constant attributes chain (possibly empty)
+    void AddFreeUsage(const std::string& name, const std::vector<std::string>& attributes);
+    const std::set<std::string>& GetFreeNames() const { return m_freeNames; }
+    // Dotted paths of the constant attributes chains accessed on the free variables (e.g. "user.name")
+    const std::set<std::string>& GetAttributePaths() const { return m_attributePaths; }
+
+private:
+    struct Frame
+    {
+        const void* owner = nullptr;
+        std::vector<std::string> names;
+        bool isActive = true;
+        uint32_t loopVarUsage = 0;
+        uint32_t macroVarUsage = 0;
+        std::unordered_set<std::string> reboundNames;
+        std::vector<std::shared_ptr<ValueRefExpression>> refs;
+    };
+
+    std::vector<Frame> m_frames;
+    std::unordered_set<std::string> m_boundNames;
+    // Names bound by the enclosing lexical scopes, the outermost one is the template top level
+    std::vector<std::unordered_set<std::string>> m_scopes = std::vector<std::unordered_set<std::string>>(1);
+    std::set<std::string> m_freeNames;
+    std::set<std::string> m_attributePaths;
+};
+
 class ExpressionParser
 {
 public:
     template<typename T>
     using ParseResult = nonstd::expected<T, ParseError>;
 
-    explicit ExpressionParser(const Settings& settings, TemplateEnv* env = nullptr);
+    explicit ExpressionParser(const Settings& settings, TemplateEnv* env = nullptr, LocalSlotsResolver* slotsResolver = nullptr);
     ParseResult<RendererPtr> Parse(LexScanner& lexer);
     ParseResult<ExpressionEvaluatorPtr<FullExpressionEvaluator>> ParseFullExpression(LexScanner& lexer, bool includeIfPart = true);
     ParseResult<CallParamsInfo> ParseCallParams(LexScanner& lexer);
@@ -42,6 +111,7 @@ private:
 
 private:
     ComposedRenderer* m_topLevelRenderer = nullptr;
+    LocalSlotsResolver* m_slotsResolver = nullptr;
 };
 
 } // jinja2
@@ -7,6 +7,13 @@
 #include <sstream>
 #include <fstream>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace jinja2
 {
 
@@ -90,6 +97,16 @@ nonstd::optional<std::chrono::system_clock::time_point> MemoryFileSystem::GetLas
     return nonstd::optional<std::chrono::system_clock::time_point>();
 }
 
+std::vector<std::string> MemoryFileSystem::ListFiles() const
+{
+    std::vector<std::string> result;
+    result.reserve(m_filesMap.size());
+    for (auto& f : m_filesMap)
+        result.push_back(f.first);
+
+    return result;
+}
+
 RealFileSystem::RealFileSystem(std::string rootFolder)
     : m_rootFolder(std::move(rootFolder))
 {
@@ -133,6 +150,31 @@ nonstd::optional<std::chrono::system_clock::time_point> RealFileSystem::GetLastM
 
     return std::chrono::system_clock::from_time_t(modify_time);
 }
+
+std::vector<std::string> RealFileSystem::ListFiles() const
+{
+    std::vector<std::string> result;
+    boost::system::error_code ec;
+    boost::filesystem::recursive_directory_iterator p(boost::filesystem::path(m_rootFolder), ec);
+    for (; !ec && p != boost::filesystem::recursive_directory_iterator(); p.increment(ec))
+    {
+        if (!boost::filesystem::is_regular_file(p->status()))
+            continue;
+
+        // Names are built from the path components, so they don't depend on the form of the root folder path
+        std::string name;
+        auto path = p->path();
+        auto component = path.end();
+        for (int level = p.level(); level >= 0; -- level)
+        {
+            -- component;
+            name = level == p.level() ? component->string() : component->string() + "/" + name;
+        }
+        result.push_back(std::move(name));
+    }
+
+    return result;
+}
 CharFileStreamPtr RealFileSystem::OpenByteStream(const std::string& name) const
 {
     auto filePath = GetFullFilePath(name);
@@ -144,4 +186,41 @@ CharFileStreamPtr RealFileSystem::OpenByteStream(const std::string& name) const
     return CharFileStreamPtr(nullptr, [](std::istream*){});
 }
 
+FileBufferPtr RealFileSystem::OpenBuffer(const std::string& name) const
+{
+#if defined(_WIN32)
+    (void)name;
+    return FileBufferPtr();
+#else
+    if (!m_useMemoryMapping)
+        return FileBufferPtr();
+
+    auto filePath = GetFullFilePath(name);
+    int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return FileBufferPtr();
+
+    struct stat fileInfo;
+    if (::fstat(fd, &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode))
+    {
+        ::close(fd);
+        return FileBufferPtr();
+    }
+
+    auto size = static_cast<size_t>(fileInfo.st_size);
+    // Empty files can't be mapped
+    void* data = size == 0 ? nullptr : ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (size == 0)
+        return std::make_shared<const nonstd::string_view>();
+    if (data == MAP_FAILED)
+        return FileBufferPtr();
+
+    return FileBufferPtr(new nonstd::string_view(static_cast<const char*>(data), size), [data, size](const nonstd::string_view* view) {
+        ::munmap(data, size);
+        delete view;
+    });
+#endif
+}
+
 } // jinja2
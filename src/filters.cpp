@@ -2,16 +2,19 @@
 
 #include "generic_adapters.h"
 #include "out_stream.h"
+#include "parallel_filters.h"
 #include "rapid_json_serializer.h"
 #include "testers.h"
 #include "value_helpers.h"
 #include "value_visitors.h"
 
 #include <algorithm>
+#include <locale>
 #include <numeric>
 #include <random>
 #include <sstream>
 #include <string>
+#include <unordered_set>
 
 using namespace std::string_literals;
 
@@ -63,6 +66,7 @@ std::unordered_map<std::string, ExpressionFilter::FilterFactoryFn> s_filters = {
     { "replace", FilterFactory<filters::StringConverter>::MakeCreator(filters::StringConverter::ReplaceMode) },
     { "round", FilterFactory<filters::ValueConverter>::MakeCreator(filters::ValueConverter::RoundMode) },
     { "reverse", FilterFactory<filters::SequenceAccessor>::MakeCreator(filters::SequenceAccessor::ReverseMode) },
+    { "safe", FilterFactory<filters::StringConverter>::MakeCreator(filters::StringConverter::SafeMode) },
     { "select", FilterFactory<filters::Tester>::MakeCreator(filters::Tester::SelectMode) },
     { "selectattr", FilterFactory<filters::Tester>::MakeCreator(filters::Tester::SelectAttrMode) },
     { "slice", FilterFactory<filters::Slice>::MakeCreator(filters::Slice::SliceMode) },
@@ -93,14 +97,394 @@ extern FilterPtr CreateFilter(std::string filterName, CallParamsInfo params)
     return p->second(std::move(params));
 }
 
+extern bool IsConstantFilter(const std::string& filterName)
+{
+    // These filters look up macros, filters or testers in the render context or produce random results
+    static const std::unordered_set<std::string> contextDependentFilters = {
+        "applymacro", "map", "random", "reject", "rejectattr", "select", "selectattr"
+    };
+
+    return s_filters.count(filterName) != 0 && contextDependentFilters.count(filterName) == 0;
+}
+
 namespace filters
 {
 
+// Lazy lists are enumerated after the filter returns, so the source value which refers to the data of its temporary parent is kept
+// alive together with the list
+static InternalValue GetLifetimeHolder(const InternalValue& val)
+{
+    return val.ShouldExtendLifetime() ? val : InternalValue();
+}
+
+// Index of the distinct values (in the order of addition) for the groupby and unique filters. Values are looked up by hash, the ones
+// which can't be hashed (see visitors::ValueHasher) are compared one by one
+class DistinctValuesIndex
+{
+public:
+    explicit DistinctValuesIndex(BinaryExpression::CompareType compType)
+        : m_compType(compType)
+    {
+    }
+
+    // Returns the index of the value equal to 'val'. Adds 'val' if there is no such value yet
+    size_t FindOrAdd(const InternalValue& val, bool& isAdded)
+    {
+        isAdded = false;
+        auto hash = Apply<visitors::ValueHasher>(val, m_compType);
+        size_t found = m_values.size();
+        auto checkCandidate = [this, &val, &found](size_t idx) {
+            if (idx < found && IsEqual(m_values[idx], val))
+                found = idx;
+        };
+
+        if (hash)
+        {
+            auto range = m_hashed.equal_range(hash.value());
+            for (auto p = range.first; p != range.second; ++ p)
+                checkCandidate(p->second);
+            for (auto idx : m_unhashed)
+                checkCandidate(idx);
+        }
+        else
+        {
+            for (size_t idx = 0; idx != m_values.size(); ++ idx)
+                checkCandidate(idx);
+        }
+
+        if (found != m_values.size())
+            return found;
+
+        if (hash)
+            m_hashed.emplace(hash.value(), found);
+        else
+            m_unhashed.push_back(found);
+        m_values.push_back(val);
+        isAdded = true;
+        return found;
+    }
+
+    InternalValueList& GetValues() { return m_values; }
+
+private:
+    bool IsEqual(const InternalValue& val1, const InternalValue& val2) const
+    {
+        return ConvertToBool(Apply2<visitors::BinaryMathOperation>(val1, val2, BinaryExpression::LogicalEq, m_compType));
+    }
+
+private:
+    BinaryExpression::CompareType m_compType;
+    InternalValueList m_values;
+    std::unordered_multimap<size_t, size_t> m_hashed;
+    std::vector<size_t> m_unhashed;
+};
+
+// Params of the filters and testers applied to each item are evaluated per item. Items can be processed concurrently only if the params
+// are constant, so the evaluation doesn't call the user code
+static bool HasConstantParams(const CallParamsInfo& params)
+{
+    for (auto& p : params.kwParams)
+    {
+        if (!p.second || !p.second->IsConstant())
+            return false;
+    }
+    for (auto& p : params.posParams)
+    {
+        if (!p || !p->IsConstant())
+            return false;
+    }
+
+    return true;
+}
+
+// Executor of the filter over the list (see Settings::parallelFilterThreshold). Null if the list isn't indexable or is too short
+static const ParallelFilterExecutor* GetParallelExecutor(const ListAdapter& list, const RenderContext& context)
+{
+    auto executor = context.GetParallelFilters();
+    if (!executor)
+        return nullptr;
+
+    auto size = list.GetSize();
+    if (!size || executor->GetChunksCount(size.value()) == 1)
+        return nullptr;
+
+    return executor;
+}
+
+// Calls fn(begin, end, context) for the chunks of [0, size) concurrently if the range is large enough, for the whole range otherwise
+template<typename Fn>
+static void ForEachItemsChunk(size_t size, RenderContext& context, Fn&& fn)
+{
+    auto executor = context.GetParallelFilters();
+    if (executor && executor->GetChunksCount(size) > 1)
+        executor->ForEachChunk(size, context, fn);
+    else
+        fn(0, size, context);
+}
+
+// Kernels of the numeric filters over the arrays of native numbers (see NumbersArrayView). Items are combined in the same order and by the
+// same operations as the generic filters do, so the results are the same. 'size' should be non-zero
+template<typename T>
+static T SumNumbers(const T* items, size_t size)
+{
+    T result = items[0];
+    for (size_t idx = 1; idx != size; ++ idx)
+        result += items[idx];
+    return result;
+}
+
+// Follows the std::max_element/std::min_element rules: the first of the equal items is selected
+template<typename T>
+static T FindBestNumber(const T* items, size_t size, bool isMax)
+{
+    T result = items[0];
+    if (isMax)
+    {
+        for (size_t idx = 1; idx != size; ++ idx)
+            result = result < items[idx] ? items[idx] : result;
+    }
+    else
+    {
+        for (size_t idx = 1; idx != size; ++ idx)
+            result = items[idx] < result ? items[idx] : result;
+    }
+    return result;
+}
+
+template<typename T>
+static ListAdapter SortNumbers(const T* items, size_t size, bool isReverse)
+{
+    std::vector<T> result(items, items + size);
+    if (isReverse)
+        std::stable_sort(result.begin(), result.end(), [](T l, T r) { return r < l; });
+    else
+        std::stable_sort(result.begin(), result.end());
+    return ListAdapter::CreateNumbersAdapter(std::move(result));
+}
+
+// Calls fn(items, size) for the integers or the doubles of the non-empty view
+template<typename Fn>
+static InternalValue ApplyToNumbers(const NumbersArrayView& numbers, Fn&& fn)
+{
+    if (numbers.integers)
+        return InternalValue(fn(numbers.integers, numbers.size));
+
+    return InternalValue(fn(numbers.doubles, numbers.size));
+}
+
+// Keys of the items for the sort and dictsort filters, extracted once before the sort. Numbers and strings are compared directly
+// (in the same way as the 'LogicalLt' operation of BinaryMathOperation does), other values are compared with this operation
+class SortKeys
+{
+public:
+    explicit SortKeys(BinaryExpression::CompareType compType)
+        : m_compType(compType)
+    {
+    }
+
+    // 'val' should outlive the keys
+    void Add(const InternalValue& val)
+    {
+        m_keys.push_back(Apply<KeyExtractor>(val, m_compType));
+        m_keys.back().value = &val;
+    }
+
+    void Add(const std::string& str)
+    {
+        m_keys.push_back(KeyExtractor(m_compType)(str));
+    }
+
+    // Keys are extracted by the chunks concurrently if the executor is set. 'values' should outlive the keys
+    void AddAll(const InternalValueList& values, const ParallelFilterExecutor* executor)
+    {
+        auto offset = m_keys.size();
+        m_keys.resize(offset + values.size());
+        auto extract = [this, &values, offset](size_t begin, size_t end) {
+            for (auto idx = begin; idx != end; ++ idx)
+            {
+                auto& key = m_keys[offset + idx];
+                key = Apply<KeyExtractor>(values[idx], m_compType);
+                key.value = &values[idx];
+            }
+        };
+
+        if (executor && executor->GetChunksCount(values.size()) > 1)
+            executor->ForEachChunk(values.size(), extract);
+        else
+            extract(0, values.size());
+    }
+
+    // Indices of the keys in the sorted order. Order of the equal keys is kept
+    std::vector<size_t> GetSortedIndices(bool isReverse, const ParallelFilterExecutor* executor = nullptr) const
+    {
+        std::vector<size_t> indices(m_keys.size());
+        std::iota(indices.begin(), indices.end(), 0);
+        auto less = [this, isReverse](size_t l, size_t r) { return isReverse ? IsLess(m_keys[r], m_keys[l]) : IsLess(m_keys[l], m_keys[r]); };
+        if (!executor || executor->GetChunksCount(indices.size()) == 1)
+        {
+            std::stable_sort(indices.begin(), indices.end(), less);
+            return indices;
+        }
+
+        // Chunks are sorted concurrently and merged pairwise. Merge puts the keys of the left chunk first, so the equal keys keep their order
+        auto bounds = executor->GetChunkBounds(indices.size());
+        executor->ForEachChunk(indices.size(), [&indices, &less](size_t begin, size_t end) {
+            std::stable_sort(indices.begin() + begin, indices.begin() + end, less);
+        });
+        auto chunksCount = bounds.size() - 1;
+        for (size_t width = 1; width < chunksCount; width *= 2)
+        {
+            for (size_t idx = 0; idx + width < chunksCount; idx += width * 2)
+            {
+                auto end = bounds[std::min(idx + width * 2, chunksCount)];
+                std::inplace_merge(indices.begin() + bounds[idx], indices.begin() + bounds[idx + width], indices.begin() + end, less);
+            }
+        }
+
+        return indices;
+    }
+
+private:
+    struct Key
+    {
+        enum Kind
+        {
+            NumberKey,
+            StringKey,
+            WideStringKey,
+            OtherKey
+        };
+
+        Kind kind = OtherKey;
+        bool isInt = false;
+        int64_t intVal = 0;
+        double dblVal = 0;
+        // Strings compared case-insensitively are stored in upper case
+        std::string str;
+        std::wstring wstr;
+        const InternalValue* value = nullptr;
+    };
+
+    struct KeyExtractor : visitors::BaseVisitor<Key>
+    {
+        using BaseVisitor::operator ();
+
+        explicit KeyExtractor(BinaryExpression::CompareType compType)
+            : m_compType(compType)
+        {
+        }
+
+        Key operator() (int64_t val) const
+        {
+            Key key;
+            key.kind = Key::NumberKey;
+            key.isInt = true;
+            key.intVal = val;
+            key.dblVal = static_cast<double>(val);
+            return key;
+        }
+
+        Key operator() (double val) const
+        {
+            Key key;
+            key.kind = Key::NumberKey;
+            key.dblVal = val;
+            return key;
+        }
+
+        Key operator() (const std::string& str) const
+        {
+            Key key;
+            key.kind = Key::StringKey;
+            key.str = Fold(nonstd::string_view(str));
+            return key;
+        }
+
+        Key operator() (const nonstd::string_view& str) const
+        {
+            Key key;
+            key.kind = Key::StringKey;
+            key.str = Fold(str);
+            return key;
+        }
+
+        Key operator() (const std::wstring& str) const
+        {
+            Key key;
+            key.kind = Key::WideStringKey;
+            key.wstr = Fold(nonstd::wstring_view(str));
+            return key;
+        }
+
+        Key operator() (const nonstd::wstring_view& str) const
+        {
+            Key key;
+            key.kind = Key::WideStringKey;
+            key.wstr = Fold(str);
+            return key;
+        }
+
+        // Matches boost::algorithm::is_iless which compares the chars converted to upper case
+        template<typename CharT>
+        std::basic_string<CharT> Fold(const nonstd::basic_string_view<CharT>& str) const
+        {
+            std::basic_string<CharT> result(str.begin(), str.end());
+            if (m_compType == BinaryExpression::CaseInsensitive)
+            {
+                std::locale loc;
+                for (auto& ch : result)
+                    ch = std::toupper(ch, loc);
+            }
+            return result;
+        }
+
+        BinaryExpression::CompareType m_compType;
+    };
+
+    bool IsLess(const Key& left, const Key& right) const
+    {
+        if (left.kind != right.kind || left.kind == Key::OtherKey)
+        {
+            if (!left.value || !right.value)
+                return false;
+            return ConvertToBool(Apply2<visitors::BinaryMathOperation>(*left.value, *right.value, BinaryExpression::LogicalLt, m_compType));
+        }
+
+        switch (left.kind)
+        {
+        case Key::NumberKey:
+            return left.isInt && right.isInt ? left.intVal < right.intVal : left.dblVal < right.dblVal;
+        case Key::StringKey:
+            return IsLess(left.str, right.str);
+        case Key::WideStringKey:
+            return IsLess(left.wstr, right.wstr);
+        default:
+            return false;
+        }
+    }
+
+    template<typename CharT>
+    bool IsLess(const std::basic_string<CharT>& left, const std::basic_string<CharT>& right) const
+    {
+        if (m_compType == BinaryExpression::CaseSensitive)
+            return left < right;
+
+        return std::lexicographical_compare(left.begin(), left.end(), right.begin(), right.end());
+    }
+
+private:
+    BinaryExpression::CompareType m_compType;
+    std::vector<Key> m_keys;
+};
+
 Join::Join(FilterParams params)
 {
     ParseParams({ { "d", false, std::string() }, { "attribute" } }, params);
 }
 
+// Upper bound of the space reserved for the not yet rendered items of the join (in chars)
+constexpr size_t MaxJoinItemEstimation = 1024 * 1024;
+
 InternalValue Join::Filter(const InternalValue& baseVal, RenderContext& context)
 {
     InternalValue attrName = GetArgumentValue("attribute", context);
@@ -111,17 +495,35 @@ InternalValue Join::Filter(const InternalValue& baseVal, RenderContext& context)
     if (!isConverted)
         return InternalValue();
 
+    // Items are rendered to the end of the single buffer, so the join is linear in the length of the result
+    auto callback = context.GetRendererCallback();
+    InternalValue delimiter = GetArgumentValue("d", context);
+    auto delimiterLen = nonstd::visit([](auto& str) { return str.size(); }, callback->GetAsTargetString(delimiter));
+    auto itemsCount = values.GetSize();
+
+    TargetString result = callback->GetAsTargetString(InternalValue());
     bool isFirst = true;
-    InternalValue result;
-    InternalValue delimiter = m_args["d"]->Evaluate(context);
     for (const InternalValue& val : values)
     {
         if (isFirst)
+        {
             isFirst = false;
-        else
-            result = Apply2<visitors::StringJoiner>(result, delimiter);
+            // Length of the items is unknown before the rendering, the first one is taken as the estimation. The estimation is capped, so
+            // the long first item doesn't make the buffer much larger than the result. Delimiters are known, so they are reserved as is
+            callback->AppendAsTargetString(result, val);
+            if (itemsCount && itemsCount.value() > 1)
+            {
+                auto restCount = itemsCount.value() - 1;
+                nonstd::visit([&](auto& str) {
+                    auto itemsEstimation = std::min(str.size(), MaxJoinItemEstimation / restCount) * restCount;
+                    str.reserve(str.size() + delimiterLen * restCount + itemsEstimation);
+                }, result);
+            }
+            continue;
+        }
 
-        result = Apply2<visitors::StringJoiner>(result, val);
+        callback->AppendAsTargetString(result, delimiter);
+        callback->AppendAsTargetString(result, val);
     }
 
     return result;
@@ -142,22 +544,38 @@ InternalValue Sort::Filter(const InternalValue& baseVal, RenderContext& context)
     ListAdapter origValues = ConvertToList(baseVal, isConverted);
     if (!isConverted)
         return InternalValue();
+
+    auto numbers = origValues.GetNumbers();
+    if (numbers.size != 0 && IsEmpty(attrName))
+    {
+        bool isReverse = ConvertToBool(isReverseVal);
+        return ApplyToNumbers(numbers, [isReverse](auto items, size_t size) { return SortNumbers(items, size, isReverse); });
+    }
+
     InternalValueList values = origValues.ToValueList();
 
-    BinaryExpression::Operation oper = ConvertToBool(isReverseVal) ? BinaryExpression::LogicalGt : BinaryExpression::LogicalLt;
     BinaryExpression::CompareType compType = ConvertToBool(isCsVal) ? BinaryExpression::CaseSensitive : BinaryExpression::CaseInsensitive;
 
-    std::sort(values.begin(), values.end(), [&attrName, oper, compType, &context](auto& val1, auto& val2) {
-        InternalValue cmpRes;
-        if (IsEmpty(attrName))
-            cmpRes = Apply2<visitors::BinaryMathOperation>(val1, val2, oper, compType);
-        else
-            cmpRes = Apply2<visitors::BinaryMathOperation>(Subscript(val1, attrName, &context), Subscript(val2, attrName, &context), oper, compType);
+    InternalValueList attrValues;
+    if (!IsEmpty(attrName))
+    {
+        attrValues.resize(values.size());
+        ForEachItemsChunk(values.size(), context, [&values, &attrValues, &attrName](size_t begin, size_t end, RenderContext& chunkContext) {
+            for (auto idx = begin; idx != end; ++ idx)
+                attrValues[idx] = Subscript(values[idx], attrName, &chunkContext);
+        });
+    }
 
-        return ConvertToBool(cmpRes);
-    });
+    auto executor = context.GetParallelFilters();
+    SortKeys keys(compType);
+    keys.AddAll(IsEmpty(attrName) ? values : attrValues, executor);
 
-    return ListAdapter::CreateAdapter(std::move(values));
+    InternalValueList result;
+    result.reserve(values.size());
+    for (auto idx : keys.GetSortedIndices(ConvertToBool(isReverseVal), executor))
+        result.push_back(std::move(values[idx]));
+
+    return ListAdapter::CreateAdapter(std::move(result));
 }
 
 Attribute::Attribute(FilterParams params)
@@ -208,58 +626,30 @@ InternalValue DictSort::Filter(const InternalValue& baseVal, RenderContext& cont
     InternalValue isCsVal = GetArgumentValue("case_sensitive", context);
     InternalValue byVal = GetArgumentValue("by", context);
 
-    bool (*comparator)(const KeyValuePair& left, const KeyValuePair& right);
-
-    if (AsString(byVal) == "key") // Sort by key
-    {
-        if (ConvertToBool(isCsVal))
-        {
-            comparator = [](const KeyValuePair& left, const KeyValuePair& right) { return left.key < right.key; };
-        }
-        else
-        {
-            comparator = [](const KeyValuePair& left, const KeyValuePair& right) {
-                return boost::lexicographical_compare(left.key, right.key, boost::algorithm::is_iless());
-            };
-        }
-    }
-    else if (AsString(byVal) == "value")
-    {
-        if (ConvertToBool(isCsVal))
-        {
-            comparator = [](const KeyValuePair& left, const KeyValuePair& right) {
-                return ConvertToBool(
-                  Apply2<visitors::BinaryMathOperation>(left.value, right.value, BinaryExpression::LogicalLt, BinaryExpression::CaseSensitive));
-            };
-        }
-        else
-        {
-            comparator = [](const KeyValuePair& left, const KeyValuePair& right) {
-                return ConvertToBool(
-                  Apply2<visitors::BinaryMathOperation>(left.value, right.value, BinaryExpression::LogicalLt, BinaryExpression::CaseInsensitive));
-            };
-        }
-    }
-    else
+    bool isByKey = AsString(byVal) == "key";
+    if (!isByKey && AsString(byVal) != "value")
         return InternalValue();
 
     std::vector<KeyValuePair> tempVector;
     tempVector.reserve(map->GetSize());
-    for (auto& key : map->GetKeys())
+    auto items = map->GetEnumerator();
+    while (items && items->MoveNext())
+        tempVector.push_back(KeyValuePair{ items->GetKey(), items->GetValue() });
+
+    SortKeys keys(ConvertToBool(isCsVal) ? BinaryExpression::CaseSensitive : BinaryExpression::CaseInsensitive);
+    for (auto& tmpVal : tempVector)
     {
-        auto val = map->GetValueByName(key);
-        tempVector.push_back(KeyValuePair{ key, val });
+        if (isByKey)
+            keys.Add(tmpVal.key);
+        else
+            keys.Add(tmpVal.value);
     }
 
-    if (ConvertToBool(isReverseVal))
-        std::sort(tempVector.begin(), tempVector.end(), [comparator](auto& l, auto& r) { return comparator(r, l); });
-    else
-        std::sort(tempVector.begin(), tempVector.end(), [comparator](auto& l, auto& r) { return comparator(l, r); });
-
     InternalValueList resultList;
-    for (auto& tmpVal : tempVector)
+    resultList.reserve(tempVector.size());
+    for (auto idx : keys.GetSortedIndices(ConvertToBool(isReverseVal)))
     {
-        auto resultVal = InternalValue(std::move(tmpVal));
+        auto resultVal = InternalValue(std::move(tempVector[idx]));
         if (baseVal.ShouldExtendLifetime())
             resultVal.SetParentData(baseVal);
         resultList.push_back(std::move(resultVal));
@@ -283,34 +673,24 @@ InternalValue GroupBy::Filter(const InternalValue& baseVal, RenderContext& conte
 
     InternalValue attrName = GetArgumentValue("attribute", context);
 
-    auto equalComparator = [](auto& val1, auto& val2) {
-        InternalValue cmpRes = Apply2<visitors::BinaryMathOperation>(val1, val2, BinaryExpression::LogicalEq, BinaryExpression::CaseSensitive);
-
-        return ConvertToBool(cmpRes);
-    };
-
-    struct GroupInfo
-    {
-        InternalValue grouper;
-        InternalValueList items;
-    };
-
-    std::vector<GroupInfo> groups;
+    DistinctValuesIndex groupers(BinaryExpression::CaseSensitive);
+    std::vector<InternalValueList> groups;
 
     for (auto& item : list)
     {
         auto attr = Subscript(item, attrName, &context);
-        auto p = std::find_if(groups.begin(), groups.end(), [&equalComparator, &attr](auto& i) { return equalComparator(i.grouper, attr); });
-        if (p == groups.end())
-            groups.push_back(GroupInfo{ attr, { item } });
-        else
-            p->items.push_back(item);
+        bool isAdded = false;
+        auto idx = groupers.FindOrAdd(attr, isAdded);
+        if (isAdded)
+            groups.emplace_back();
+        groups[idx].push_back(item);
     }
 
     InternalValueList result;
-    for (auto& g : groups)
+    auto& grouperValues = groupers.GetValues();
+    for (size_t idx = 0; idx != groups.size(); ++ idx)
     {
-        InternalValueMap groupItem{ { "grouper", std::move(g.grouper) }, { "list", ListAdapter::CreateAdapter(std::move(g.items)) } };
+        InternalValueMap groupItem{ { "grouper", std::move(grouperValues[idx]) }, { "list", ListAdapter::CreateAdapter(std::move(groups[idx])) } };
         result.push_back(CreateMapAdapter(std::move(groupItem)));
     }
 
@@ -358,6 +738,7 @@ InternalValue ApplyMacro::Filter(const InternalValue& baseVal, RenderContext& co
         auto stream = context.GetRendererCallback()->GetStreamOnString(resultStr);
         callable->GetStatementCallable()(callParams, stream, context);
         result = std::move(resultStr);
+        result.SetSafe(callable->IsSafeOutput());
     }
 
     return result;
@@ -409,11 +790,27 @@ InternalValue Map::Filter(const InternalValue& baseVal, RenderContext& context)
     if (!isConverted)
         return InternalValue();
 
-    InternalValueList resultList;
-    resultList.reserve(list.GetSize().value_or(0));
-    std::transform(list.begin(), list.end(), std::back_inserter(resultList), [filter, &context](auto& val) { return filter->Filter(val, context); });
+    // Built-in filters with the constant params don't have side effects, so the large lists are mapped at once by the chunks in parallel
+    if (GetParallelExecutor(list, context) && IsConstantFilter(AsString(filterName)) && HasConstantParams(m_mappingParams))
+    {
+        InternalValueList result(list.GetSize().value());
+        ForEachItemsChunk(result.size(), context, [&list, &filter, &result](size_t begin, size_t end, RenderContext& chunkContext) {
+            for (auto idx = begin; idx != end; ++ idx)
+                result[idx] = filter->Filter(list.GetValueByIndex(static_cast<int64_t>(idx)), chunkContext);
+        });
+        return ListAdapter::CreateAdapter(std::move(result));
+    }
 
-    return ListAdapter::CreateAdapter(std::move(resultList));
+    // Items are mapped on enumeration, so the chained filters are applied in one pass without the intermediate lists
+    return ListAdapter::CreateLazyAdapter([list = std::move(list), holder = GetLifetimeHolder(baseVal), filter, &context]() {
+        return [e = list.GetEnumerator(), filter, &context]() mutable {
+            using ResultType = nonstd::optional<InternalValue>;
+            if (!e->MoveNext())
+                return ResultType();
+
+            return ResultType(filter->Filter(e->GetCurrent(), context));
+        };
+    });
 }
 Random::Random(FilterParams params) {}
 
@@ -444,7 +841,7 @@ SequenceAccessor::SequenceAccessor(FilterParams params, SequenceAccessor::Mode m
             ParseParams({ { "attribute", false }, { "start", false } }, params);
             break;
         case UniqueItemsMode:
-            ParseParams({ { "attribute", false } }, params);
+            ParseParams({ { "case_sensitive", false, InternalValue(false) }, { "attribute", false } }, params);
             break;
     }
 }
@@ -464,19 +861,53 @@ InternalValue SequenceAccessor::Filter(const InternalValue& baseVal, RenderConte
 
     BinaryExpression::CompareType compType = ConvertToBool(isCsVal) ? BinaryExpression::CaseSensitive : BinaryExpression::CaseInsensitive;
 
-    auto lessComparator = [&attrName, &compType, &context](auto& val1, auto& val2) {
+    auto isLess = [&attrName, &compType](auto& val1, auto& val2, RenderContext& ctx) {
         InternalValue cmpRes;
 
         if (IsEmpty(attrName))
             cmpRes = Apply2<visitors::BinaryMathOperation>(val1, val2, BinaryExpression::LogicalLt, compType);
         else
             cmpRes = Apply2<visitors::BinaryMathOperation>(
-              Subscript(val1, attrName, &context), Subscript(val2, attrName, &context), BinaryExpression::LogicalLt, compType);
+              Subscript(val1, attrName, &ctx), Subscript(val2, attrName, &ctx), BinaryExpression::LogicalLt, compType);
 
         return ConvertToBool(cmpRes);
     };
+    auto lessComparator = [&isLess, &context](auto& val1, auto& val2) { return isLess(val1, val2, context); };
 
     const auto& listSize = list.GetSize();
+    auto executor = GetParallelExecutor(list, context);
+    // Array of numbers is processed directly, without the conversion of the items
+    auto numbers = IsEmpty(attrName) ? list.GetNumbers() : NumbersArrayView();
+    bool isNumbers = numbers.size != 0;
+
+    // Each chunk finds its own best item, then the best items of the chunks are compared in order. The comparisons follow the
+    // max_element/min_element rules, so the first of the equal items is selected as the sequential filters do
+    auto findBestItem = [&list, &isLess, &context, executor](bool isMax) {
+        auto size = list.GetSize().value();
+        auto bounds = executor->GetChunkBounds(size);
+        auto isBetter = [&isLess, isMax](const InternalValue& val, const InternalValue& best, RenderContext& ctx) {
+            return isMax ? isLess(best, val, ctx) : isLess(val, best, ctx);
+        };
+        InternalValueList chunksBest(bounds.size() - 1);
+        executor->ForEachChunk(size, context, [&list, &bounds, &chunksBest, &isBetter](size_t begin, size_t end, RenderContext& chunkContext) {
+            auto best = list.GetValueByIndex(static_cast<int64_t>(begin));
+            for (auto idx = begin + 1; idx != end; ++ idx)
+            {
+                auto val = list.GetValueByIndex(static_cast<int64_t>(idx));
+                if (isBetter(val, best, chunkContext))
+                    best = std::move(val);
+            }
+            chunksBest[std::lower_bound(bounds.begin(), bounds.end(), begin) - bounds.begin()] = std::move(best);
+        });
+
+        InternalValue result = chunksBest[0];
+        for (size_t idx = 1; idx != chunksBest.size(); ++ idx)
+        {
+            if (isBetter(chunksBest[idx], result, context))
+                result = chunksBest[idx];
+        }
+        return result;
+    };
 
     switch (m_mode)
     {
@@ -532,6 +963,16 @@ InternalValue SequenceAccessor::Filter(const InternalValue& baseVal, RenderConte
         }
         case MaxItemMode:
         {
+            if (isNumbers)
+            {
+                result = ApplyToNumbers(numbers, [](auto items, size_t size) { return FindBestNumber(items, size, true); });
+                break;
+            }
+            if (executor)
+            {
+                result = findBestItem(true);
+                break;
+            }
             auto b = list.begin();
             auto e = list.end();
             auto p = std::max_element(list.begin(), list.end(), lessComparator);
@@ -540,6 +981,16 @@ InternalValue SequenceAccessor::Filter(const InternalValue& baseVal, RenderConte
         }
         case MinItemMode:
         {
+            if (isNumbers)
+            {
+                result = ApplyToNumbers(numbers, [](auto items, size_t size) { return FindBestNumber(items, size, false); });
+                break;
+            }
+            if (executor)
+            {
+                result = findBestItem(false);
+                break;
+            }
             auto b = list.begin();
             auto e = list.end();
             auto p = std::min_element(b, e, lessComparator);
@@ -572,18 +1023,34 @@ InternalValue SequenceAccessor::Filter(const InternalValue& baseVal, RenderConte
         }
         case SumItemsMode:
         {
+            InternalValue start = GetArgumentValue("start", context);
+            if (isNumbers && IsEmpty(start))
+            {
+                result = ApplyToNumbers(numbers, [](auto items, size_t size) { return SumNumbers(items, size); });
+                break;
+            }
             ListAdapter l1;
             ListAdapter* actualList;
             if (IsEmpty(attrName))
             {
                 actualList = &list;
             }
+            else if (executor)
+            {
+                // Attributes are looked up concurrently, the items are summed up sequentially
+                InternalValueList attrValues(listSize.value());
+                ForEachItemsChunk(attrValues.size(), context, [&list, &attrValues, &attrName](size_t begin, size_t end, RenderContext& chunkContext) {
+                    for (auto idx = begin; idx != end; ++ idx)
+                        attrValues[idx] = Subscript(list.GetValueByIndex(static_cast<int64_t>(idx)), attrName, &chunkContext);
+                });
+                l1 = ListAdapter::CreateAdapter(std::move(attrValues));
+                actualList = &l1;
+            }
             else
             {
                 l1 = list.ToSubscriptedList(attrName, true);
                 actualList = &l1;
             }
-            InternalValue start = GetArgumentValue("start", context);
             InternalValue resultVal = std::accumulate(actualList->begin(), actualList->end(), start, [](const InternalValue& cur, const InternalValue& val) {
                 if (IsEmpty(cur))
                     return val;
@@ -596,36 +1063,39 @@ InternalValue SequenceAccessor::Filter(const InternalValue& baseVal, RenderConte
         }
         case UniqueItemsMode:
         {
+            // The first of the equal items is kept
             InternalValueList resultList;
-
-            struct Item
+            DistinctValuesIndex values(compType);
+            if (executor && !IsEmpty(attrName))
             {
-                InternalValue val;
-                int64_t idx;
-            };
-            std::vector<Item> items;
+                // Attributes are looked up concurrently, the distinct ones are selected sequentially
+                InternalValueList items(listSize.value());
+                InternalValueList attrValues(items.size());
+                ForEachItemsChunk(items.size(), context, [&list, &items, &attrValues, &attrName](size_t begin, size_t end, RenderContext& chunkContext) {
+                    for (auto idx = begin; idx != end; ++ idx)
+                    {
+                        items[idx] = list.GetValueByIndex(static_cast<int64_t>(idx));
+                        attrValues[idx] = Subscript(items[idx], attrName, &chunkContext);
+                    }
+                });
+                for (size_t idx = 0; idx != items.size(); ++ idx)
+                {
+                    bool isAdded = false;
+                    values.FindOrAdd(attrValues[idx], isAdded);
+                    if (isAdded)
+                        resultList.push_back(std::move(items[idx]));
+                }
 
-            int idx = 0;
+                result = ListAdapter::CreateAdapter(std::move(resultList));
+                break;
+            }
             for (auto& v : list)
-                items.push_back(Item{ IsEmpty(attrName) ? v : Subscript(v, attrName, &context), idx++ });
-
-            std::stable_sort(items.begin(), items.end(), [&compType](auto& i1, auto& i2) {
-                auto cmpRes = Apply2<visitors::BinaryMathOperation>(i1.val, i2.val, BinaryExpression::LogicalLt, compType);
-
-                return ConvertToBool(cmpRes);
-            });
-
-            auto end = std::unique(items.begin(), items.end(), [&compType](auto& i1, auto& i2) {
-                auto cmpRes = Apply2<visitors::BinaryMathOperation>(i1.val, i2.val, BinaryExpression::LogicalEq, compType);
-
-                return ConvertToBool(cmpRes);
-            });
-            items.erase(end, items.end());
-
-            std::stable_sort(items.begin(), items.end(), [](auto& i1, auto& i2) { return i1.idx < i2.idx; });
-
-            for (auto& i : items)
-                resultList.push_back(list.GetValueByIndex(i.idx));
+            {
+                bool isAdded = false;
+                values.FindOrAdd(IsEmpty(attrName) ? v : Subscript(v, attrName, &context), isAdded);
+                if (isAdded)
+                    resultList.push_back(v);
+            }
 
             result = ListAdapter::CreateAdapter(std::move(resultList));
             break;
@@ -660,31 +1130,25 @@ InternalValue Slice::Filter(const InternalValue& baseVal, RenderContext& context
     int64_t sliceLength = ConvertToInt(sliceLengthValue);
     InternalValue fillWith = GetArgumentValue("fill_with", context);
 
-    InternalValueList resultList;
-    InternalValueList sublist;
-    int sublistItemIndex = 0;
-    for (auto& item : list)
-    {
-        if (sublistItemIndex == 0)
-            sublist.clear();
-        if (sublistItemIndex == sliceLength)
-        {
-            resultList.push_back(ListAdapter::CreateAdapter(std::move(sublist)));
-            sublist.clear();
-            sublistItemIndex %= sliceLength;
-        }
-        sublist.push_back(item);
-        ++sublistItemIndex;
-    }
-    if (!IsEmpty(fillWith))
-    {
-        while (sublistItemIndex++ < sliceLength)
-            sublist.push_back(fillWith);
-    }
-    if (sublistItemIndex > 0)
-        resultList.push_back(ListAdapter::CreateAdapter(std::move(sublist)));
-
-    return InternalValue(ListAdapter::CreateAdapter(std::move(resultList)));
+    if (sliceLength <= 0)
+        return InternalValue(ListAdapter::CreateAdapter(InternalValueList()));
+
+    // Only the current slice is stored while the source list is enumerated
+    auto length = static_cast<size_t>(sliceLength);
+    return InternalValue(ListAdapter::CreateLazyAdapter([list = std::move(list), holder = GetLifetimeHolder(baseVal), length, fillWith]() {
+        return [e = list.GetEnumerator(), length, fillWith]() mutable {
+            using ResultType = nonstd::optional<InternalValue>;
+            InternalValueList sublist;
+            while (sublist.size() < length && e->MoveNext())
+                sublist.push_back(e->GetCurrent());
+            if (sublist.empty())
+                return ResultType();
+
+            if (!IsEmpty(fillWith))
+                sublist.resize(length, fillWith);
+            return ResultType(ListAdapter::CreateAdapter(std::move(sublist)));
+        };
+    }));
 }
 
 InternalValue Slice::Batch(const InternalValue& baseVal, RenderContext& context)
@@ -701,6 +1165,10 @@ InternalValue Slice::Batch(const InternalValue& baseVal, RenderContext& context)
     if (!isConverted)
         return InternalValue();
 
+    // Rows are laid out by the total items count, so the lazy lists are materialized
+    if (!list.GetSize())
+        list = ListAdapter::CreateAdapter(list.ToValueList());
+
     auto elementsCount = list.GetSize().value_or(0);
     if (!elementsCount)
         return InternalValue();
@@ -772,9 +1240,8 @@ InternalValue Tester::Filter(const InternalValue& baseVal, RenderContext& contex
     if (!isConverted)
         return InternalValue();
 
-    InternalValueList resultList;
-    resultList.reserve(list.GetSize().value_or(0));
-    std::copy_if(list.begin(), list.end(), std::back_inserter(resultList), [this, tester, attrName, &context](auto& val) {
+    bool isSelect = m_mode == SelectMode || m_mode == SelectAttrMode;
+    auto test = [isSelect, tester, attrName](const InternalValue& val, RenderContext& context) {
         InternalValue attrVal;
         bool isAttr = !IsEmpty(attrName);
         if (isAttr)
@@ -786,10 +1253,46 @@ InternalValue Tester::Filter(const InternalValue& baseVal, RenderContext& contex
         else
             result = ConvertToBool(isAttr ? attrVal : val);
 
-        return (m_mode == SelectMode || m_mode == SelectAttrMode) ? result : !result;
-    });
+        return isSelect ? result : !result;
+    };
 
-    return ListAdapter::CreateAdapter(std::move(resultList));
+    // Built-in testers with the constant params don't have side effects, so the large lists are filtered at once by the chunks in parallel
+    if (GetParallelExecutor(list, context) && (!tester || (IsConstantTester(AsString(testerName)) && HasConstantParams(m_testingParams))))
+    {
+        InternalValueList items(list.GetSize().value());
+        // Not std::vector<bool>: the flags are written concurrently
+        std::vector<uint8_t> matches(items.size());
+        ForEachItemsChunk(items.size(), context, [&list, &items, &matches, &test](size_t begin, size_t end, RenderContext& chunkContext) {
+            for (auto idx = begin; idx != end; ++ idx)
+            {
+                items[idx] = list.GetValueByIndex(static_cast<int64_t>(idx));
+                matches[idx] = test(items[idx], chunkContext);
+            }
+        });
+
+        InternalValueList result;
+        for (size_t idx = 0; idx != items.size(); ++ idx)
+        {
+            if (matches[idx])
+                result.push_back(std::move(items[idx]));
+        }
+        return ListAdapter::CreateAdapter(std::move(result));
+    }
+
+    auto predicate = [test, &context](const InternalValue& val) { return test(val, context); };
+
+    return ListAdapter::CreateLazyAdapter([list = std::move(list), holder = GetLifetimeHolder(baseVal), predicate]() {
+        return [e = list.GetEnumerator(), predicate]() mutable {
+            using ResultType = nonstd::optional<InternalValue>;
+            while (e->MoveNext())
+            {
+                auto val = e->GetCurrent();
+                if (predicate(val))
+                    return ResultType(std::move(val));
+            }
+            return ResultType();
+        };
+    });
 }
 
 ValueConverter::ValueConverter(FilterParams params, ValueConverter::Mode mode)
@@ -958,6 +1461,22 @@ struct ValueConverterImpl : visitors::BaseVisitor<>
         return result;
     }
 
+    // Conversion functions need the zero-terminated strings. Numbers are short, so the views are copied to the stack buffer
+    template<typename CharT, typename Fn>
+    static auto ConvertView(const nonstd::basic_string_view<CharT>& val, Fn&& fn)
+    {
+        CharT buff[64];
+        if (val.size() < sizeof(buff) / sizeof(CharT))
+        {
+            std::copy(val.begin(), val.end(), buff);
+            buff[val.size()] = 0;
+            return fn(buff);
+        }
+
+        std::basic_string<CharT> str(val.begin(), val.end());
+        return fn(str.c_str());
+    }
+
     template<typename CharT>
     InternalValue operator()(const nonstd::basic_string_view<CharT>& val) const
     {
@@ -967,8 +1486,7 @@ struct ValueConverterImpl : visitors::BaseVisitor<>
             case ValueConverter::ToFloatMode:
             {
                 bool converted = false;
-                std::basic_string<CharT> str(val.begin(), val.end());
-                double dblVal = ConvertToDouble(str.c_str(), converted);
+                double dblVal = ConvertView(val, [&converted](const CharT* str) { return ConvertToDouble(str, converted); });
 
                 if (!converted)
                     result = m_params.defValule;
@@ -980,8 +1498,7 @@ struct ValueConverterImpl : visitors::BaseVisitor<>
             {
                 int base = static_cast<int>(GetAs<int64_t>(m_params.base));
                 bool converted = false;
-                std::basic_string<CharT> str(val.begin(), val.end());
-                long long intVal = ConvertToInt(str.c_str(), base, converted);
+                long long intVal = ConvertView(val, [base, &converted](const CharT* str) { return ConvertToInt(str, base, converted); });
 
                 if (!converted)
                     result = m_params.defValule;
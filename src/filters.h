@@ -15,6 +15,8 @@ using FilterPtr = std::shared_ptr<ExpressionFilter::IExpressionFilter>;
 using FilterParams = CallParamsInfo;
 
 extern FilterPtr CreateFilter(std::string filterName, CallParamsInfo params);
+// Returns true if the filter result depends on its argument and parameters only
+extern bool IsConstantFilter(const std::string& filterName);
 
 namespace filters
 {
@@ -191,7 +193,8 @@ public:
         WordWrapMode,
         UnderscoreMode,
         UrlEncodeMode,
-        CenterMode
+        CenterMode,
+        SafeMode
     };
 
     StringConverter(FilterParams params, Mode mode);
@@ -207,9 +210,17 @@ class StringFormat : public  FilterBase
 public:
     StringFormat(FilterParams params);
 
+    void PrepareForBase(const InternalValue& baseVal) override;
     InternalValue Filter(const InternalValue& baseVal, RenderContext& context);
+private:
+    struct CompiledFormat;
+
+    nonstd::optional<std::string> FormatCompiled(const CompiledFormat& format, const InternalValueList& argValues, RenderContext& context) const;
+
 private:
     FilterParams m_params;
+    // Literal format string parsed at load time
+    std::shared_ptr<const CompiledFormat> m_compiledFormat;
 };
 
 class Tester : public  FilterBase
@@ -0,0 +1,57 @@
+#include <jinja2cpp/fragment_cache.h>
+
+namespace jinja2
+{
+
+nonstd::optional<std::string> MemoryFragmentCache::Get(const std::string& key)
+{
+    std::lock_guard<std::mutex> l(m_guard);
+
+    auto p = m_index.find(key);
+    if (p == m_index.end())
+        return nonstd::optional<std::string>();
+
+    auto entry = p->second;
+    if (entry->expiration && Clock::now() >= entry->expiration.value())
+    {
+        m_entries.erase(entry);
+        m_index.erase(p);
+        return nonstd::optional<std::string>();
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, entry);
+    return entry->fragment;
+}
+
+void MemoryFragmentCache::Put(const std::string& key, std::string fragment, std::chrono::seconds ttl)
+{
+    if (m_maxSize == 0)
+        return;
+
+    nonstd::optional<Clock::time_point> expiration;
+    if (ttl.count() > 0)
+        expiration = Clock::now() + ttl;
+
+    std::lock_guard<std::mutex> l(m_guard);
+
+    auto p = m_index.find(key);
+    if (p != m_index.end())
+    {
+        auto entry = p->second;
+        entry->fragment = std::move(fragment);
+        entry->expiration = expiration;
+        m_entries.splice(m_entries.begin(), m_entries, entry);
+        return;
+    }
+
+    if (m_entries.size() >= m_maxSize)
+    {
+        m_index.erase(m_entries.back().key);
+        m_entries.pop_back();
+    }
+
+    m_entries.push_front(Entry{key, std::move(fragment), expiration});
+    m_index[key] = m_entries.begin();
+}
+
+} // jinja2
@@ -0,0 +1,6 @@
+#include "frozen_globals.h"
+
+namespace jinja2
+{
+thread_local const FrozenGlobals* FrozenGlobals::s_current = nullptr;
+} // jinja2
@@ -0,0 +1,56 @@
+#ifndef FROZEN_GLOBALS_H
+#define FROZEN_GLOBALS_H
+
+#include "internal_value.h"
+
+#include <string>
+#include <unordered_set>
+
+namespace jinja2
+{
+// Values of the environment globals frozen for the specialized template (see TemplateEnv::FreezeGlobals). Installed on the current
+// thread while the specialized template is optimized, so the references to these globals are treated as the constants
+class FrozenGlobals
+{
+public:
+    // Installs the frozen globals on the current thread while alive
+    class Scope
+    {
+    public:
+        explicit Scope(const FrozenGlobals* globals)
+            : m_prev(s_current)
+        {
+            s_current = globals;
+        }
+        ~Scope() { s_current = m_prev; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const FrozenGlobals* m_prev;
+    };
+
+    // Globals shadowed by the local variables somewhere in the template aren't frozen
+    FrozenGlobals(const InternalValueMap& values, const std::unordered_set<std::string>& boundNames)
+    {
+        for (auto& v : values)
+        {
+            if (boundNames.count(v.first) == 0)
+                m_values.insert(v);
+        }
+    }
+
+    static const FrozenGlobals* GetCurrent() { return s_current; }
+
+    bool IsFrozen(const std::string& name) const { return m_values.count(name) != 0; }
+    const InternalValueMap& GetValues() const { return m_values; }
+
+private:
+    static thread_local const FrozenGlobals* s_current;
+
+    InternalValueMap m_values;
+};
+} // jinja2
+
+#endif // FROZEN_GLOBALS_H
@@ -11,10 +11,22 @@ class FunctionBase
 public:
 protected:
     bool ParseParams(const std::initializer_list<ArgumentInfo>& argsInfo, const CallParamsInfo& params);
-    InternalValue GetArgumentValue(const std::string& argName, RenderContext& context, InternalValue defVal = InternalValue());
+    InternalValue GetArgumentValue(nonstd::string_view argName, RenderContext& context, InternalValue defVal = InternalValue());
 
 protected:
     ParsedArgumentsInfo m_args;
+
+private:
+    // Argument bound at parse time to its position in the function declaration. Values of the literal arguments are extracted once
+    struct BoundArgument
+    {
+        std::string name;
+        ExpressionEvaluatorPtr<> expr;
+        InternalValue value;
+        bool isConstant = false;
+    };
+
+    std::vector<BoundArgument> m_boundArgs;
 };
 
 inline bool FunctionBase::ParseParams(const std::initializer_list<ArgumentInfo>& argsInfo, const CallParamsInfo& params)
@@ -22,13 +34,41 @@ inline bool FunctionBase::ParseParams(const std::initializer_list<ArgumentInfo>&
     bool result = true;
     m_args = helpers::ParseCallParamsInfo(argsInfo, params, result);
 
+    m_boundArgs.clear();
+    m_boundArgs.reserve(argsInfo.size());
+    for (auto& info : argsInfo)
+    {
+        BoundArgument arg;
+        arg.name = info.name;
+        arg.expr = m_args[info.name];
+        // Literal collections are shared read-only, so the copy of the bound value is cheap as well
+        auto literal = arg.expr ? arg.expr->GetLiteralValue() : nullptr;
+        if (literal)
+        {
+            arg.value = *literal;
+            arg.isConstant = true;
+        }
+        m_boundArgs.push_back(std::move(arg));
+    }
+
     return result;
 }
 
-inline InternalValue FunctionBase::GetArgumentValue(const std::string& argName, RenderContext& context, InternalValue defVal)
+inline InternalValue FunctionBase::GetArgumentValue(nonstd::string_view argName, RenderContext& context, InternalValue defVal)
 {
-    auto argExpr = m_args[argName];
-    return argExpr ? argExpr->Evaluate(context) : std::move(defVal);
+    // Functions have a few arguments, so the scan is cheaper than the hash lookup
+    for (auto& arg : m_boundArgs)
+    {
+        if (nonstd::string_view(arg.name) != argName)
+            continue;
+
+        if (arg.isConstant)
+            return arg.value;
+
+        return arg.expr ? arg.expr->Evaluate(context) : std::move(defVal);
+    }
+
+    return defVal;
 }
 
 } // jinja2
@@ -0,0 +1,168 @@
+#include "generated_template.h"
+#include "template_impl.h"
+
+namespace jinja2
+{
+
+namespace
+{
+// Root of the template rendered by the generated code. The tree stays alive as the owner of the nodes the code refers to
+class GeneratedRenderer : public RendererBase
+{
+public:
+    GeneratedRenderer(RendererPtr tree, GeneratedRenderFn render)
+        : m_tree(std::move(tree))
+        , m_nodes(m_tree)
+        , m_render(render)
+    {
+    }
+
+    void Render(OutStream& os, RenderContext& values) override
+    {
+        m_render(os, values, m_nodes);
+    }
+
+private:
+    RendererPtr m_tree;
+    GeneratedTemplateNodes m_nodes;
+    GeneratedRenderFn m_render;
+};
+} // namespace
+
+constexpr size_t GeneratedTemplateNodes::npos;
+
+GeneratedTemplateNodes::GeneratedTemplateNodes(const RendererPtr& root)
+{
+    AddRenderer(root);
+}
+
+// Nodes are collected in the pre-order, the same way as jinja2cpp_codegen walks the tree. Renderers and expressions the generated code
+// doesn't handle itself are collected as well, they are rendered (or evaluated) by the tree
+void GeneratedTemplateNodes::AddRenderer(const RendererPtr& renderer)
+{
+    auto r = renderer.get();
+    if (!r)
+        return;
+
+    Add(r);
+    if (auto composed = dynamic_cast<ComposedRenderer*>(r))
+    {
+        if (composed->IsParallel())
+            return;
+        for (auto& child : composed->GetRenderers())
+            AddRenderer(child);
+    }
+    else if (auto expr = dynamic_cast<ExpressionRenderer*>(r))
+        AddExpression(expr->GetExpression());
+    else if (auto stmt = dynamic_cast<IfStatement*>(r))
+    {
+        AddExpression(stmt->GetCondition());
+        AddRenderer(stmt->GetMainBody());
+        for (auto& b : stmt->GetElseBranches())
+        {
+            AddExpression(b->GetCondition());
+            AddRenderer(b->GetMainBody());
+        }
+    }
+    else if (auto stmt = dynamic_cast<ForStatement*>(r))
+    {
+        AddExpression(stmt->GetLoopValue());
+        AddRenderer(stmt->GetMainBody());
+        AddRenderer(stmt->GetElseBody());
+    }
+    else if (auto stmt = dynamic_cast<SetLineStatement*>(r))
+        AddExpression(stmt->GetExpression());
+}
+
+void GeneratedTemplateNodes::AddExpression(const ExpressionEvaluatorPtr<>& expr)
+{
+    auto e = expr.get();
+    if (!e)
+        return;
+
+    if (auto literal = e->GetLiteralValue())
+    {
+        Add(literal);
+        return;
+    }
+
+    Add(e);
+    if (auto full = dynamic_cast<FullExpressionEvaluator*>(e))
+    {
+        AddExpression(full->GetExpression());
+        if (auto& tester = full->GetTester())
+        {
+            AddExpression(tester->GetTestExpression());
+            AddExpression(tester->GetAltValue());
+        }
+    }
+    else if (auto subscript = dynamic_cast<SubscriptExpression*>(e))
+    {
+        AddExpression(subscript->GetValue());
+        for (size_t n = 0; n != subscript->GetIndicesCount(); ++ n)
+        {
+            if (!subscript->IsNamedIndex(n))
+                AddExpression(subscript->GetIndex(n));
+        }
+    }
+    else if (auto filtered = dynamic_cast<FilteredExpression*>(e))
+    {
+        AddExpression(filtered->GetExpression());
+        AddFilter(*filtered->GetFilter());
+    }
+    else if (auto unary = dynamic_cast<UnaryExpression*>(e))
+        AddExpression(unary->GetExpression());
+    else if (auto test = dynamic_cast<IsExpression*>(e))
+    {
+        AddExpression(test->GetValue());
+        Add(test->GetTester().get());
+    }
+    else if (auto binary = dynamic_cast<BinaryExpression*>(e))
+    {
+        AddExpression(binary->GetLeftExpression());
+        if (binary->GetOperation() == BinaryExpression::In)
+            Add(binary->GetInTester().get());
+        else
+            AddExpression(binary->GetRightExpression());
+    }
+    else if (auto tuple = dynamic_cast<TupleCreator*>(e))
+    {
+        for (auto& item : tuple->GetExprs())
+            AddExpression(item);
+    }
+    else if (auto call = dynamic_cast<CallExpression*>(e))
+        AddExpression(call->GetValueRef());
+}
+
+// Parent filters of the chain are applied first
+void GeneratedTemplateNodes::AddFilter(const ExpressionFilter& filter)
+{
+    if (auto& parent = filter.GetParentFilter())
+        AddFilter(*parent);
+
+    Add(filter.GetFilter().get());
+}
+
+void GeneratedTemplateNodes::Add(const void* node)
+{
+    if (m_indices.emplace(node, m_nodes.size()).second)
+        m_nodes.push_back(const_cast<void*>(node));
+}
+
+Result<void> LoadGeneratedTemplate(Template& tpl, const std::string& image, const std::string& source, std::string tplName, GeneratedRenderFn render)
+{
+    auto result = tpl.LoadCompiled(image, source, tplName);
+    if (!result)
+        return tpl.Load(source, std::move(tplName));
+
+    auto impl = TemplateImpl<char>::GetTemplateImpl(tpl);
+    impl->SetRenderer(std::make_shared<GeneratedRenderer>(impl->GetRenderer(), render));
+    return result;
+}
+
+RendererPtr GetTemplateRenderer(const Template& tpl)
+{
+    return TemplateImpl<char>::GetTemplateImpl(tpl)->GetRenderer();
+}
+
+} // jinja2
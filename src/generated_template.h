@@ -0,0 +1,80 @@
+#ifndef GENERATED_TEMPLATE_H
+#define GENERATED_TEMPLATE_H
+
+#include "expression_evaluator.h"
+#include "renderer.h"
+#include "statements.h"
+#include "value_visitors.h"
+
+#include <jinja2cpp/template.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace jinja2
+{
+// Nodes of the template tree the render code generated by jinja2cpp_codegen refers to: statements and expressions, their literals,
+// filters and testers. The tool and the generated code collect them from the tree loaded from the same compiled image in the same
+// order, so the generated code refers to the nodes by their indices
+class GeneratedTemplateNodes
+{
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    explicit GeneratedTemplateNodes(const RendererPtr& root);
+
+    template<typename T = RendererBase>
+    T* GetRenderer(size_t idx) const { return static_cast<T*>(static_cast<RendererBase*>(m_nodes[idx])); }
+    template<typename T = ExpressionEvaluatorBase>
+    T* GetExpression(size_t idx) const { return static_cast<T*>(static_cast<ExpressionEvaluatorBase*>(m_nodes[idx])); }
+    const InternalValue& GetLiteral(size_t idx) const { return *static_cast<const InternalValue*>(m_nodes[idx]); }
+    ExpressionFilter::IExpressionFilter* GetFilter(size_t idx) const { return static_cast<ExpressionFilter::IExpressionFilter*>(m_nodes[idx]); }
+    IsExpression::ITester* GetTester(size_t idx) const { return static_cast<IsExpression::ITester*>(m_nodes[idx]); }
+
+    // Renderers and expressions are looked up by the pointers to their base classes (RendererBase and ExpressionEvaluatorBase)
+    size_t IndexOf(const void* node) const
+    {
+        auto p = m_indices.find(node);
+        return p == m_indices.end() ? npos : p->second;
+    }
+
+private:
+    void AddRenderer(const RendererPtr& renderer);
+    void AddExpression(const ExpressionEvaluatorPtr<>& expr);
+    void AddFilter(const ExpressionFilter& filter);
+    void Add(const void* node);
+
+private:
+    std::vector<void*> m_nodes;
+    std::unordered_map<const void*, size_t> m_indices;
+};
+
+using GeneratedRenderFn = void (*)(OutStream& os, RenderContext& values, const GeneratedTemplateNodes& nodes);
+
+// Value of the variable, the same as ValueRefExpression::Evaluate looks it up. Loop variables are taken from the slots of the loop
+inline InternalValue FindGeneratedVar(RenderContext& values, const HashedName& name)
+{
+    bool found = false;
+    auto p = values.FindValue(name, found);
+    if (found)
+        return p->second;
+
+    return InternalValue();
+}
+
+inline InternalValue FindGeneratedVar(RenderContext& values, const HashedName& name, const ForStatement* loop, size_t slot)
+{
+    auto value = values.FindSlotValue(loop, slot);
+    return value ? *value : FindGeneratedVar(values, name);
+}
+
+// Loads the template from the compiled image and makes it rendered by the generated function. The source is parsed and rendered by
+// the tree if the image is rejected (e.g. it's made by the different version of the library)
+Result<void> LoadGeneratedTemplate(Template& tpl, const std::string& image, const std::string& source, std::string tplName, GeneratedRenderFn render);
+
+// Root of the template tree the render code is generated for
+RendererPtr GetTemplateRenderer(const Template& tpl);
+} // jinja2
+
+#endif // GENERATED_TEMPLATE_H
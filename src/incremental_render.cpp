@@ -0,0 +1,93 @@
+#include "incremental_render.h"
+
+#include "parallel_render.h"
+
+namespace jinja2
+{
+void IncrementalRenderState::Render(const RendererPtr& root, OutStream& os, RenderContext& context, const EnvVersion& envVersion)
+{
+    auto composed = dynamic_cast<ComposedRenderer*>(root.get());
+    if (!composed)
+    {
+        root->Render(os, context);
+        return;
+    }
+
+    if (root != m_root)
+        Reset(root, composed);
+    if (!envVersion || envVersion != m_envVersion)
+        m_isAllChanged = true;
+    m_envVersion = envVersion;
+
+    // Interrupted render (e.g. by the exception) leaves the state partially updated, so it's dropped until the render completes
+    bool isAllChanged = m_isAllChanged;
+    m_isAllChanged = true;
+
+    auto callback = context.GetRendererCallback();
+    auto& renderers = composed->GetRenderers();
+    for (size_t idx = 0; idx < renderers.size(); ++ idx)
+    {
+        auto& segment = m_segments[idx];
+        auto& renderer = renderers[idx];
+        if (segment.kind == SegmentKind::StaticText)
+        {
+            renderer->Render(os, context);
+            continue;
+        }
+
+        bool isChanged = isAllChanged || !segment.isRendered || IsChanged(segment);
+        m_reads.Take();
+        if (segment.kind == SegmentKind::Stateful)
+        {
+            renderer->Render(os, context);
+            // Context changed by the segment may differ from the previous render, so the following output is rendered again
+            if (isChanged)
+                isAllChanged = true;
+        }
+        else if (isChanged)
+        {
+            auto stream = callback->GetStreamOnString(segment.output);
+            renderer->Render(stream, context);
+        }
+
+        if (context.HasError())
+            return;
+
+        if (segment.kind == SegmentKind::Stateful || isChanged)
+            segment.dependencies = m_reads.Take();
+        segment.isRendered = true;
+        if (segment.kind == SegmentKind::Cached)
+            nonstd::visit([&os](auto& str) { os.WriteBuffer(str.data(), str.size()); }, segment.output);
+    }
+
+    m_changedParams.clear();
+    m_isAllChanged = false;
+}
+
+bool IncrementalRenderState::IsChanged(const Segment& segment) const
+{
+    for (auto& name : m_changedParams)
+    {
+        if (segment.dependencies.count(name))
+            return true;
+    }
+
+    return false;
+}
+
+void IncrementalRenderState::Reset(const RendererPtr& root, ComposedRenderer* composed)
+{
+    m_root = root;
+    m_segments.clear();
+    for (auto& r : composed->GetRenderers())
+    {
+        Segment segment;
+        if (dynamic_cast<RawTextRenderer*>(r.get()))
+            segment.kind = SegmentKind::StaticText;
+        else
+            segment.kind = ParallelUnitsDetector::IsIndependent(r) ? SegmentKind::Cached : SegmentKind::Stateful;
+        m_segments.push_back(std::move(segment));
+    }
+    m_isAllChanged = true;
+}
+} // jinja2
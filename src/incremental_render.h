@@ -0,0 +1,66 @@
+#ifndef INCREMENTAL_RENDER_H
+#define INCREMENTAL_RENDER_H
+
+#include "render_context.h"
+#include "renderer.h"
+
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace jinja2
+{
+// Output of the top level segments (children of the template root) cached between the renders of the session (see
+// RenderSession::SetIncrementalRender). The params each segment reads are recorded by the render, including the reads of the
+// included templates and of the called macros. Segment is rendered again only if any of them is changed since the previous render.
+// Segments which change the rendering context (set the variables, define the macros, import the templates, etc.) are rendered every
+// time. Once such segment depends on the changed params, the rest of the segments are rendered again as well
+class IncrementalRenderState
+{
+public:
+    // Versions of the environment globals and the templates. None if the changes of the environment can't be tracked, then the
+    // cached output is dropped by every render
+    using EnvVersion = nonstd::optional<std::pair<uint64_t, uint64_t>>;
+
+    explicit IncrementalRenderState(ExternalScope& extParams)
+    {
+        extParams.SetReadsRecorder(&m_reads);
+    }
+
+    void Render(const RendererPtr& root, OutStream& os, RenderContext& context, const EnvVersion& envVersion);
+
+    // Should be called once the param is changed (or removed)
+    void Invalidate(const std::string& name) { m_changedParams.insert(name); }
+    void InvalidateAll() { m_isAllChanged = true; }
+
+private:
+    enum class SegmentKind
+    {
+        StaticText,
+        Cached,
+        Stateful
+    };
+
+    struct Segment
+    {
+        SegmentKind kind;
+        bool isRendered = false;
+        std::unordered_set<std::string> dependencies;
+        TargetString output;
+    };
+
+    bool IsChanged(const Segment& segment) const;
+    void Reset(const RendererPtr& root, ComposedRenderer* composed);
+
+    // Kept alive, so the replaced tree (e.g. by the reload of the template) is never confused with the new one
+    RendererPtr m_root;
+    std::vector<Segment> m_segments;
+    ParamReadsRecorder m_reads;
+    std::unordered_set<std::string> m_changedParams;
+    bool m_isAllChanged = true;
+    EnvVersion m_envVersion;
+};
+} // jinja2
+
+#endif // INCREMENTAL_RENDER_H
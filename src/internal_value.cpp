@@ -5,6 +5,12 @@
 #include "helpers.h"
 #include "value_visitors.h"
 
+#include <jinja2cpp/reflected_value.h>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+
 namespace jinja2
 {
 
@@ -18,21 +24,17 @@ struct SubscriptionVisitor : public visitors::BaseVisitor<>
     template<typename CharT>
     InternalValue operator()(const MapAdapter& values, const std::basic_string<CharT>& fieldName) const
     {
-        auto field = ConvertString<std::string>(fieldName);
-        if (!values.HasValue(field))
-            return InternalValue();
-
-        return values.GetValueByName(field);
+        InternalValue result;
+        values.FindValue(HashedName(ConvertString<std::string>(fieldName)), result);
+        return result;
     }
 
     template<typename CharT>
     InternalValue operator()(const MapAdapter& values, const nonstd::basic_string_view<CharT>& fieldName) const
     {
-        auto field = ConvertString<std::string>(fieldName);
-        if (!values.HasValue(field))
-            return InternalValue();
-
-        return values.GetValueByName(field);
+        InternalValue result;
+        values.FindValue(HashedName(ConvertString<std::string>(fieldName)), result);
+        return result;
     }
 
     template<typename CharT>
@@ -43,7 +45,8 @@ struct SubscriptionVisitor : public visitors::BaseVisitor<>
 
     InternalValue operator()(const ListAdapter& values, int64_t index) const
     {
-        if (index < 0 || static_cast<size_t>(index) >= values.GetSize())
+        auto size = values.GetSize();
+        if (index < 0 || (size && static_cast<size_t>(index) >= size.value()))
             return InternalValue();
 
         return values.GetValueByIndex(index);
@@ -96,19 +99,21 @@ struct SubscriptionVisitor : public visitors::BaseVisitor<>
     }
 };
 
-InternalValue Subscript(const InternalValue& val, const InternalValue& subscript, RenderContext* values)
+namespace
+{
+// Dynamic properties (see MakeDynamicProperty) are evaluated on access
+InternalValue EvaluateDynamicProperty(InternalValue result, RenderContext* values)
 {
-    static const std::string callOperName = "value()";
-    auto result = Apply2<SubscriptionVisitor>(val, subscript);
+    static const HashedName callOperName("value()");
 
     if (!values)
         return result;
 
     auto map = GetIf<MapAdapter>(&result);
-    if (!map || !map->HasValue(callOperName))
+    InternalValue callableVal;
+    if (!map || !map->FindValue(callOperName, callableVal))
         return result;
 
-    auto callableVal = map->GetValueByName(callOperName);
     auto callable = GetIf<Callable>(&callableVal);
     if (!callable || callable->GetKind() == Callable::Macro || callable->GetType() == Callable::Type::Statement)
         return result;
@@ -116,12 +121,68 @@ InternalValue Subscript(const InternalValue& val, const InternalValue& subscript
     CallParams callParams;
     return callable->GetExpressionCallable()(callParams, *values);
 }
+} // namespace
+
+InternalValue Subscript(const InternalValue& val, const InternalValue& subscript, RenderContext* values)
+{
+    return EvaluateDynamicProperty(Apply2<SubscriptionVisitor>(val, subscript), values);
+}
 
 InternalValue Subscript(const InternalValue& val, const std::string& subscript, RenderContext* values)
 {
     return Subscript(val, InternalValue(subscript), values);
 }
 
+InternalValue Subscript(const InternalValue& val, const HashedName& subscript, RenderContext* values)
+{
+    auto map = GetIf<MapAdapter>(&val);
+    if (!map)
+        return Subscript(val, InternalValue(subscript.GetName()), values);
+
+    InternalValue result;
+    map->FindValue(subscript, result);
+    return EvaluateDynamicProperty(std::move(result), values);
+}
+
+bool MapSlotCache::FindValue(const MapAdapter& map, const HashedName& name, InternalValue& result)
+{
+    auto accessor = map.GetAccessor();
+    if (!accessor)
+        return false;
+
+    auto state = m_state.load(std::memory_order_acquire);
+    if (state == Ready)
+    {
+        if (accessor->GetLayout() == m_layout && accessor->GetItemBySlot(m_slot, result))
+            return true;
+    }
+    else if (state == Empty)
+    {
+        auto layout = accessor->GetLayout();
+        auto slot = layout ? accessor->FindSlot(name.GetName()) : static_cast<size_t>(-1);
+        int expected = Empty;
+        if (slot != static_cast<size_t>(-1) && m_state.compare_exchange_strong(expected, Busy, std::memory_order_acquire))
+        {
+            m_layout = layout;
+            m_slot = slot;
+            m_state.store(Ready, std::memory_order_release);
+        }
+    }
+
+    return accessor->FindItem(name, result);
+}
+
+InternalValue Subscript(const InternalValue& val, const HashedName& subscript, MapSlotCache& cache, RenderContext* values)
+{
+    auto map = GetIf<MapAdapter>(&val);
+    if (!map)
+        return Subscript(val, InternalValue(subscript.GetName()), values);
+
+    InternalValue result;
+    cache.FindValue(*map, subscript, result);
+    return EvaluateDynamicProperty(std::move(result), values);
+}
+
 struct StringGetter : public visitors::BaseVisitor<std::string>
 {
     using BaseVisitor::operator();
@@ -157,8 +218,10 @@ struct ListConverter : public visitors::BaseVisitor<boost::optional<ListAdapter>
             return result_t();
 
         InternalValueList list;
-        for (auto& k : map.GetKeys())
-            list.push_back(TargetString(k));
+        list.reserve(map.GetSize());
+        auto items = map.GetEnumerator();
+        while (items && items->MoveNext())
+            list.push_back(TargetString(items->GetKey()));
 
         return ListAdapter::CreateAdapter(std::move(list)); 
     }
@@ -218,6 +281,7 @@ public:
     const T& Get() const { return *m_val; }
     T& Get() { return *const_cast<T*>(m_val); }
     bool ShouldExtendLifetime() const { return false; }
+    const void* GetIdentity() const { return m_val; }
 
 private:
     const T* m_val;
@@ -236,6 +300,7 @@ public:
     const T& Get() const { return m_val; }
     T& Get() { return m_val; }
     bool ShouldExtendLifetime() const { return false; }
+    const void* GetIdentity() const { return nullptr; }
 
 private:
     T m_val;
@@ -254,11 +319,86 @@ public:
     const T& Get() const { return *m_val; }
     T& Get() { return *m_val; }
     bool ShouldExtendLifetime() const { return true; }
+    const void* GetIdentity() const { return m_val.get(); }
 
 private:
     std::shared_ptr<T> m_val;
 };
 
+// Immutable data shared by the copies of the adapter (e.g. the literal collections built at load time). The items are returned as the
+// self-contained copies, so the subscripted values needn't keep the data alive
+template<typename T>
+class BySharedConstVal : public BySharedVal<T>
+{
+public:
+    using BySharedVal<T>::BySharedVal;
+
+    bool ShouldExtendLifetime() const { return false; }
+};
+
+// Items of the enumerator-only list cached as they are enumerated, so the random access (e.g. `items[i]` or `batch`) doesn't enumerate
+// the list from the start for every item. The deque never moves the stored items, so they are copied out of the lock. Only the first
+// MaxCachedItems items are cached, the farther ones are reached by the enumeration from the start
+class EnumeratedItemsCache
+{
+public:
+    using EnumeratorFactory = std::function<ListAccessorEnumeratorPtr ()>;
+
+    static constexpr size_t MaxCachedItems = 64 * 1024;
+
+    explicit EnumeratedItemsCache(EnumeratorFactory factory)
+        : m_factory(std::move(factory))
+    {
+    }
+
+    nonstd::optional<InternalValue> GetItem(int64_t idx)
+    {
+        if (idx < 0)
+            return nonstd::optional<InternalValue>();
+
+        auto pos = static_cast<size_t>(idx);
+        const InternalValue* item = nullptr;
+        {
+            std::lock_guard<std::mutex> l(m_guard);
+            if (!m_isFinished && !m_enumerator)
+                m_enumerator = m_factory();
+            while (!m_isFinished && m_items.size() <= pos && m_items.size() < MaxCachedItems)
+            {
+                if (!m_enumerator->MoveNext())
+                {
+                    m_isFinished = true;
+                    m_enumerator = ListAccessorEnumeratorPtr();
+                    break;
+                }
+                m_items.push_back(m_enumerator->GetCurrent());
+            }
+            if (pos < m_items.size())
+                item = &m_items[pos];
+            else if (m_isFinished)
+                return nonstd::optional<InternalValue>();
+        }
+        if (item)
+            return *item;
+
+        auto e = m_factory();
+        for (size_t n = 0; e->MoveNext(); ++ n)
+        {
+            if (n == pos)
+                return e->GetCurrent();
+        }
+        return nonstd::optional<InternalValue>();
+    }
+
+private:
+    EnumeratorFactory m_factory;
+    std::mutex m_guard;
+    std::deque<InternalValue> m_items;
+    ListAccessorEnumeratorPtr m_enumerator;
+    bool m_isFinished = false;
+};
+
+constexpr size_t EnumeratedItemsCache::MaxCachedItems;
+
 template<template<typename> class Holder>
 class GenericListAdapter : public IListAccessor
 {
@@ -302,6 +442,12 @@ public:
         return visit(visitors::InputValueConvertor(true, false), std::move(val.data())).get();
     }
     bool ShouldExtendLifetime() const override { return m_values.ShouldExtendLifetime(); }
+    const void* GetIdentity() const override { return m_values.GetIdentity(); }
+    NumbersArrayView GetNumbers() const override
+    {
+        const ListItemAccessor* accessor = m_values.Get().GetAccessor();
+        return accessor ? accessor->GetNumbers() : NumbersArrayView();
+    }
     ListAccessorEnumeratorPtr CreateListAccessorEnumerator() const override
     {
         const ListItemAccessor* accessor = m_values.Get().GetAccessor();
@@ -319,6 +465,29 @@ private:
     Holder<GenericList> m_values;
 };
 
+template<template<typename> class Holder>
+class InternalValueListAdapter : public IndexedListAccessorImpl<InternalValueListAdapter<Holder>>
+{
+public:
+    template<typename U>
+    InternalValueListAdapter(U&& values)
+        : m_values(std::forward<U>(values))
+    {
+    }
+
+    size_t GetItemsCountImpl() const { return m_values.Get().size(); }
+    nonstd::optional<InternalValue> GetItem(int64_t idx) const override { return m_values.Get()[static_cast<size_t>(idx)]; }
+    bool ShouldExtendLifetime() const override { return m_values.ShouldExtendLifetime(); }
+    const void* GetIdentity() const override { return m_values.GetIdentity(); }
+    GenericList CreateGenericList() const override
+    {
+        return GenericList([adapter = *this]() -> const ListItemAccessor* { return &adapter; });
+    }
+
+private:
+    Holder<InternalValueList> m_values;
+};
+
 template<template<typename> class Holder>
 class ValuesListAdapter : public IndexedListAccessorImpl<ValuesListAdapter<Holder>>
 {
@@ -336,6 +505,7 @@ public:
         return visit(visitors::InputValueConvertor(false, true), val.data()).get();
     }
     bool ShouldExtendLifetime() const override { return m_values.ShouldExtendLifetime(); }
+    const void* GetIdentity() const override { return m_values.GetIdentity(); }
     GenericList CreateGenericList() const override
     {
         // return m_values.Get();
@@ -346,29 +516,57 @@ private:
     Holder<ValuesList> m_values;
 };
 
-ListAdapter ListAdapter::CreateAdapter(InternalValueList&& values)
+template<typename T>
+class NumbersListAdapter : public IndexedListAccessorImpl<NumbersListAdapter<T>>
 {
-    class Adapter : public IndexedListAccessorImpl<Adapter>
+public:
+    explicit NumbersListAdapter(std::vector<T>&& values)
+        : m_values(std::move(values))
     {
-    public:
-        explicit Adapter(InternalValueList&& values)
-            : m_values(std::move(values))
-        {
-        }
+    }
 
-        size_t GetItemsCountImpl() const { return m_values.size(); }
-        nonstd::optional<InternalValue> GetItem(int64_t idx) const override { return m_values[static_cast<size_t>(idx)]; }
-        bool ShouldExtendLifetime() const override { return false; }
-        GenericList CreateGenericList() const override
-        {
-            return GenericList([adapter = *this]() -> const ListItemAccessor* { return &adapter; });
-        }
+    size_t GetItemsCountImpl() const { return m_values.Get().size(); }
+    nonstd::optional<InternalValue> GetItem(int64_t idx) const override { return InternalValue(m_values.Get()[static_cast<size_t>(idx)]); }
+    bool ShouldExtendLifetime() const override { return m_values.ShouldExtendLifetime(); }
+    const void* GetIdentity() const override { return m_values.GetIdentity(); }
+    NumbersArrayView GetNumbers() const override
+    {
+        NumbersArrayView result;
+        SetItems(result, m_values.Get().data());
+        result.size = m_values.Get().size();
+        return result;
+    }
+    GenericList CreateGenericList() const override
+    {
+        return GenericList([adapter = *this]() -> const ListItemAccessor* { return &adapter; });
+    }
 
-    private:
-        InternalValueList m_values;
-    };
+private:
+    static void SetItems(NumbersArrayView& view, const int64_t* items) { view.integers = items; }
+    static void SetItems(NumbersArrayView& view, const double* items) { view.doubles = items; }
 
-    return ListAdapter([accessor = Adapter(std::move(values))]() { return &accessor; });
+private:
+    BySharedConstVal<std::vector<T>> m_values;
+};
+
+ListAdapter ListAdapter::CreateAdapter(InternalValueList&& values)
+{
+    return ListAdapter([accessor = InternalValueListAdapter<ByVal>(std::move(values))]() { return &accessor; });
+}
+
+ListAdapter ListAdapter::CreateSharedAdapter(InternalValueList&& values)
+{
+    return ListAdapter([accessor = InternalValueListAdapter<BySharedConstVal>(std::move(values))]() { return &accessor; });
+}
+
+ListAdapter ListAdapter::CreateNumbersAdapter(std::vector<int64_t>&& values)
+{
+    return ListAdapter([accessor = NumbersListAdapter<int64_t>(std::move(values))]() { return &accessor; });
+}
+
+ListAdapter ListAdapter::CreateNumbersAdapter(std::vector<double>&& values)
+{
+    return ListAdapter([accessor = NumbersListAdapter<double>(std::move(values))]() { return &accessor; });
 }
 
 ListAdapter ListAdapter::CreateAdapter(const GenericList& values)
@@ -493,6 +691,114 @@ ListAdapter ListAdapter::CreateAdapter(size_t listSize, std::function<InternalVa
     return ListAdapter([accessor = Adapter(listSize, std::move(fn))]() { return &accessor; });
 }
 
+ListAdapter ListAdapter::CreateRangeAdapter(const IntegerRange& range)
+{
+    class Adapter : public IndexedListAccessorImpl<Adapter>
+    {
+    public:
+        explicit Adapter(const IntegerRange& range)
+            : m_range(range)
+        {
+        }
+
+        size_t GetItemsCountImpl() const { return m_range.count; }
+        nonstd::optional<InternalValue> GetItem(int64_t idx) const override
+        {
+            if (idx < 0 || static_cast<size_t>(idx) >= m_range.count)
+                return nonstd::optional<InternalValue>();
+
+            return InternalValue(m_range.start + m_range.step * idx);
+        }
+        bool ShouldExtendLifetime() const override { return false; }
+        const IntegerRange* GetIntegerRange() const override { return &m_range; }
+        GenericList CreateGenericList() const override
+        {
+            return GenericList([adapter = *this]() -> const ListItemAccessor* { return &adapter; });
+        }
+
+    private:
+        IntegerRange m_range;
+    };
+
+    return ListAdapter([accessor = Adapter(range)]() { return &accessor; });
+}
+
+ListAdapter ListAdapter::CreateLazyAdapter(std::function<std::function<nonstd::optional<InternalValue>()>()> genFactory)
+{
+    using GenFn = std::function<nonstd::optional<InternalValue>()>;
+    using GenFactoryFn = std::function<GenFn()>;
+
+    class Adapter : public IListAccessor
+    {
+    public:
+        class Enumerator : public IListAccessorEnumerator
+        {
+        public:
+            explicit Enumerator(const GenFactoryFn* factory)
+                : m_factory(factory)
+                , m_fn((*factory)())
+            {
+            }
+
+            void Reset() override { m_fn = (*m_factory)(); }
+
+            bool MoveNext() override
+            {
+                if (!m_fn)
+                    return false;
+
+                auto res = m_fn();
+                if (!res)
+                {
+                    m_fn = GenFn();
+                    return false;
+                }
+
+                m_current = std::move(*res);
+                return true;
+            }
+
+            InternalValue GetCurrent() const override { return m_current; }
+
+            IListAccessorEnumerator* Clone() const override { return new Enumerator(*this); }
+            IListAccessorEnumerator* Transfer() override { return new Enumerator(std::move(*this)); }
+
+        private:
+            const GenFactoryFn* m_factory;
+            GenFn m_fn;
+            InternalValue m_current;
+        };
+
+        explicit Adapter(GenFactoryFn&& factory)
+            : m_factory(std::move(factory))
+            , m_itemsCache([this]() { return CreateListAccessorEnumerator(); })
+        {
+        }
+
+        nonstd::optional<size_t> GetSize() const override { return nonstd::optional<size_t>(); }
+        // Random access caches the generated items, so the list isn't generated again for every index
+        nonstd::optional<InternalValue> GetItem(int64_t idx) const override { return m_itemsCache.GetItem(idx); }
+        bool ShouldExtendLifetime() const override { return false; }
+        ListAccessorEnumeratorPtr CreateListAccessorEnumerator() const override { return ListAccessorEnumeratorPtr(new Enumerator(&m_factory)); }
+
+        GenericList CreateGenericList() const override
+        {
+            // Generic lists outlive the render, so the items are materialized
+            InternalValueList items;
+            for (Enumerator e(&m_factory); e.MoveNext();)
+                items.push_back(e.GetCurrent());
+            return ListAdapter::CreateAdapter(std::move(items)).CreateGenericList();
+        }
+
+    private:
+        GenFactoryFn m_factory;
+        mutable EnumeratedItemsCache m_itemsCache;
+    };
+
+    // Copies of the adapter share the generators factory with all its captured state
+    return ListAdapter([accessor = std::make_shared<Adapter>(std::move(genFactory))]() { return accessor.get(); });
+}
+
 template<typename Holder>
 auto CreateIndexedSubscribedList(Holder&& holder, const InternalValue& subscript, size_t size)
 {
@@ -541,6 +847,81 @@ InternalValueList ListAdapter::ToValueList() const
     return result;
 }
 
+namespace
+{
+class MapKeysEnumerator : public IMapAccessorEnumerator
+{
+public:
+    explicit MapKeysEnumerator(const IMapAccessor* map)
+        : m_map(map)
+        , m_keys(map->GetKeys())
+    {
+    }
+
+    bool MoveNext() override
+    {
+        if (m_nextIdx == m_keys.size())
+            return false;
+
+        m_key = &m_keys[m_nextIdx++];
+        m_value = m_map->GetItem(*m_key);
+        return true;
+    }
+    const std::string& GetKey() const override { return *m_key; }
+    const InternalValue& GetValue() const override { return m_value; }
+
+private:
+    const IMapAccessor* m_map;
+    std::vector<std::string> m_keys;
+    size_t m_nextIdx = 0;
+    const std::string* m_key = nullptr;
+    InternalValue m_value;
+};
+
+// Walks the nodes of the map container. Values of the external maps are converted when requested
+template<typename Map>
+class MapItemsEnumerator : public IMapAccessorEnumerator
+{
+public:
+    explicit MapItemsEnumerator(const Map& map)
+        : m_cur(map.begin())
+        , m_end(map.end())
+    {
+    }
+
+    bool MoveNext() override
+    {
+        if (m_isFirst)
+            m_isFirst = false;
+        else if (m_cur != m_end)
+            ++m_cur;
+
+        return m_cur != m_end;
+    }
+    const std::string& GetKey() const override { return m_cur->first; }
+    const InternalValue& GetValue() const override { return ToItemValue(m_cur->second); }
+
+private:
+    const InternalValue& ToItemValue(const InternalValue& val) const { return val; }
+    const InternalValue& ToItemValue(const Value& val) const
+    {
+        m_value = Value2IntValue(val);
+        return m_value;
+    }
+
+private:
+    typename Map::const_iterator m_cur;
+    typename Map::const_iterator m_end;
+    bool m_isFirst = true;
+    mutable InternalValue m_value;
+};
+} // namespace
+
+MapAccessorEnumeratorPtr IMapAccessor::CreateEnumerator() const
+{
+    return MapAccessorEnumeratorPtr(new MapKeysEnumerator(this));
+}
+
 template<template<typename> class Holder, bool CanModify>
 class InternalValueMapAdapter : public MapAccessorImpl<InternalValueMapAdapter<Holder, CanModify>>
 {
@@ -562,6 +943,16 @@ public:
 
         return p->second;
     }
+    bool FindItem(const HashedName& name, InternalValue& result) const override
+    {
+        auto& vals = m_values.Get();
+        auto p = FindByName(vals, name);
+        if (p == vals.end())
+            return false;
+
+        result = p->second;
+        return true;
+    }
     std::vector<std::string> GetKeys() const override
     {
         std::vector<std::string> result;
@@ -571,6 +962,10 @@ public:
 
         return result;
     }
+    MapAccessorEnumeratorPtr CreateEnumerator() const override
+    {
+        return MapAccessorEnumeratorPtr(new MapItemsEnumerator<std::decay_t<decltype(m_values.Get())>>(m_values.Get()));
+    }
 
     bool SetValue(std::string name, const InternalValue& val) override
     {
@@ -635,6 +1030,26 @@ public:
     {
         return GenericMap([accessor = *this]() -> const MapItemAccessor* { return accessor.m_values.Get().GetAccessor(); });
     }
+    const void* GetLayout() const override
+    {
+        auto accessor = m_values.Get().GetAccessor();
+        return accessor ? accessor->GetLayout() : nullptr;
+    }
+    size_t FindSlot(const std::string& name) const override
+    {
+        auto accessor = m_values.Get().GetAccessor();
+        return accessor ? accessor->FindSlot(name) : static_cast<size_t>(-1);
+    }
+    bool GetItemBySlot(size_t slot, InternalValue& result) const override
+    {
+        auto accessor = m_values.Get().GetAccessor();
+        if (!accessor)
+            return false;
+
+        auto val = accessor->GetValueBySlot(slot);
+        result = val.isEmpty() ? InternalValue() : Value2IntValue(std::move(val));
+        return true;
+    }
 
 private:
     Holder<GenericMap> m_values;
@@ -661,6 +1076,16 @@ public:
 
         return Value2IntValue(p->second);
     }
+    bool FindItem(const HashedName& name, InternalValue& result) const override
+    {
+        auto& vals = m_values.Get();
+        auto p = vals.find(name.GetName());
+        if (p == vals.end())
+            return false;
+
+        result = Value2IntValue(p->second);
+        return true;
+    }
     std::vector<std::string> GetKeys() const override
     {
         std::vector<std::string> result;
@@ -670,6 +1095,10 @@ public:
 
         return result;
     }
+    MapAccessorEnumeratorPtr CreateEnumerator() const override
+    {
+        return MapAccessorEnumeratorPtr(new MapItemsEnumerator<std::decay_t<decltype(m_values.Get())>>(m_values.Get()));
+    }
     bool ShouldExtendLifetime() const override { return m_values.ShouldExtendLifetime(); }
     GenericMap CreateGenericMap() const override
     {
@@ -685,6 +1114,11 @@ MapAdapter CreateMapAdapter(InternalValueMap&& values)
     return MapAdapter([accessor = InternalValueMapAdapter<ByVal, true>(std::move(values))]() mutable { return &accessor; });
 }
 
+MapAdapter CreateSharedMapAdapter(InternalValueMap&& values)
+{
+    return MapAdapter([accessor = InternalValueMapAdapter<BySharedConstVal, false>(std::move(values))]() mutable { return &accessor; });
+}
+
 MapAdapter CreateMapAdapter(const InternalValueMap* values)
 {
     return MapAdapter([accessor = InternalValueMapAdapter<ByRef, false>(*values)]() mutable { return &accessor; });
@@ -842,11 +1276,145 @@ UserCallableParams PrepareUserCallableParams(const CallParams& params, RenderCon
     return result;
 }
 
+// Params of the user callable with positional args (see UserCallable::positionalArgs). Layout of the params is analyzed once, on the
+// conversion of the callable
+struct PositionalCallableArgs
+{
+    explicit PositionalCallableArgs(const std::vector<ArgInfo>& info)
+    {
+        bool hasSpecialArgs = false;
+        for (auto& pi : info)
+        {
+            args.emplace_back(pi.paramName, pi.isMandatory, Value2IntValue(pi.defValue));
+            if (pi.paramName.size() > 1 && pi.paramName[0] == '*')
+                hasSpecialArgs = true;
+            if (pi.paramName == "*args")
+                hasExtraPosArgs = true;
+            else if (pi.paramName == "**kwargs")
+                hasExtraKwArgs = true;
+            else if (pi.paramName == "*context")
+                hasContext = true;
+        }
+
+        // Positional call args are bound to the params in order unless the callable has the optional params before the mandatory
+        // ones (the same rule as for the macro params)
+        bool isMandatoryFirst = args.empty() || args.front().mandatory || std::none_of(args.begin(), args.end(), [](auto& a) { return a.mandatory; });
+        bindInOrder = !hasSpecialArgs && isMandatoryFirst;
+    }
+
+    std::vector<ArgumentInfo> args;
+    bool bindInOrder = false;
+    bool hasExtraPosArgs = false;
+    bool hasExtraKwArgs = false;
+    bool hasContext = false;
+};
+
+// Call args outlive the call of the user callable, so the strings are passed as views
+Value IntValue2ArgValue(const InternalValue& val)
+{
+    if (auto str = GetIf<std::string>(&val))
+        return nonstd::string_view(*str);
+    if (auto str = GetIf<TargetString>(&val))
+    {
+        if (auto narrow = nonstd::get_if<std::string>(str))
+            return nonstd::string_view(*narrow);
+        return nonstd::wstring_view(nonstd::get<std::wstring>(*str));
+    }
+    if (auto ref = GetIf<ValueRef>(&val))
+    {
+        auto& ext = ref->get();
+        if (ext.isString())
+            return nonstd::string_view(ext.asString());
+        if (ext.isWString())
+            return nonstd::wstring_view(ext.asWString());
+        return ext;
+    }
+
+    return IntValue2Value(val);
+}
+
+UserCallableParams PreparePositionalParams(const CallParams& params, RenderContext& context, const PositionalCallableArgs& callableArgs)
+{
+    UserCallableParams result;
+    auto& argsInfo = callableArgs.args;
+
+    if (callableArgs.bindInOrder && params.kwParams.empty() && params.posParams.size() <= argsInfo.size())
+    {
+        result.argValues.reserve(argsInfo.size());
+        for (size_t idx = 0; idx != argsInfo.size(); ++ idx)
+        {
+            if (idx < params.posParams.size())
+            {
+                result.argValues.push_back(IntValue2ArgValue(params.posParams[idx]));
+                continue;
+            }
+
+            if (argsInfo[idx].mandatory)
+            {
+                result.argValues.clear();
+                return result;
+            }
+            result.argValues.push_back(IntValue2ArgValue(argsInfo[idx].defaultVal));
+        }
+        result.paramsParsed = true;
+        return result;
+    }
+
+    ParsedArguments args = helpers::ParseCallParams(argsInfo, params, result.paramsParsed);
+    if (!result.paramsParsed)
+        return result;
+
+    // Parsed args are destroyed before the call, so the values are copied
+    result.argValues.reserve(argsInfo.size());
+    for (auto& argInfo : argsInfo)
+    {
+        if (argInfo.name.size() > 1 && argInfo.name[0] == '*')
+        {
+            result.argValues.emplace_back();
+            continue;
+        }
+
+        auto p = args.args.find(argInfo.name);
+        result.argValues.push_back(IntValue2Value(p == args.args.end() ? argInfo.defaultVal : p->second));
+    }
+
+    if (callableArgs.hasExtraKwArgs)
+    {
+        ValuesMap extraKwArgs;
+        for (auto& p : args.extraKwArgs)
+            extraKwArgs[p.first] = IntValue2Value(p.second);
+        result.extraKwArgs = Value(std::move(extraKwArgs));
+    }
+
+    if (callableArgs.hasExtraPosArgs)
+    {
+        ValuesList extraPosArgs;
+        extraPosArgs.reserve(args.extraPosArgs.size());
+        for (auto& p : args.extraPosArgs)
+            extraPosArgs.push_back(IntValue2Value(p));
+        result.extraPosArgs = Value(std::move(extraPosArgs));
+    }
+
+    if (callableArgs.hasContext)
+        result.context = GenericMap([accessor = ContextMapper(&context)]() -> const MapItemAccessor* { return &accessor; });
+
+    return result;
+}
+
 namespace visitors
 {
 
 InputValueConvertor::result_t InputValueConvertor::ConvertUserCallable(const UserCallable& val)
 {
+    if (val.positionalArgs)
+    {
+        return InternalValue(Callable(Callable::UserCallable, [val, argsInfo = PositionalCallableArgs(val.argsInfo)](const CallParams& params, RenderContext& context) -> InternalValue {
+            auto ucParams = PreparePositionalParams(params, context, argsInfo);
+            // Result could refer to the string args
+            return Value2IntValue(detail::DetachValue(val.callable(ucParams)));
+        }));
+    }
+
     std::vector<ArgumentInfo> args;
     for (auto& pi : val.argsInfo)
     {
@@ -859,6 +1427,15 @@ InputValueConvertor::result_t InputValueConvertor::ConvertUserCallable(const Use
     }));
 }
 
+InputValueConvertor::result_t InputValueConvertor::ConvertLazyValue(const LazyValue& val)
+{
+    if (!val.producer)
+        return result_t(InternalValue());
+
+    auto value = val.producer();
+    return nonstd::visit(InputValueConvertor(true, false), value.data());
+}
+
 } // visitors
 
 } // jinja2
@@ -19,7 +19,9 @@
 #include <nonstd/string_view.hpp>
 #include <nonstd/variant.hpp>
 
+#include <atomic>
 #include <functional>
+#include <memory>
 
 namespace jinja2
 {
@@ -208,6 +210,14 @@ struct IListAccessorEnumerator
 
 using ListAccessorEnumeratorPtr = nonstd::value_ptr<IListAccessorEnumerator, IListAccessorEnumerator::Cloner>;
 
+// Arithmetic progression of 'count' integers produced by the 'range' global function
+struct IntegerRange
+{
+    int64_t start;
+    int64_t step;
+    size_t count;
+};
+
 struct IListAccessor
 {
     virtual ~IListAccessor() {}
@@ -217,20 +227,81 @@ struct IListAccessor
     virtual ListAccessorEnumeratorPtr CreateListAccessorEnumerator() const = 0;
     virtual GenericList CreateGenericList() const = 0;
     virtual bool ShouldExtendLifetime() const = 0;
+    // Lists of integers (see ListAdapter::CreateRangeAdapter) let the consumers compute the items instead of enumerating them
+    virtual const IntegerRange* GetIntegerRange() const { return nullptr; }
+    // Lists of the native numbers (see NumbersArrayView) let the numeric filters process the array instead of the boxed items
+    virtual NumbersArrayView GetNumbers() const { return NumbersArrayView(); }
+    // Address of the list data the accessor is the view of. Copies of the accessor (and of the adapters holding it) have the same
+    // identity. Null if the accessor owns its items
+    virtual const void* GetIdentity() const { return nullptr; }
 };
 
 
 using ListAccessorProvider = std::function<const IListAccessor*()>;
 
+// Name of the variable or the attribute with the hash computed once (at parse time for the identifiers and the constant subscripts).
+// InternalValueMap is looked up by such names without rehashing of the key
+class HashedName
+{
+public:
+    HashedName()
+        : m_hash(GetHash(m_name))
+    {
+    }
+    explicit HashedName(std::string name)
+        : m_name(std::move(name))
+        , m_hash(GetHash(m_name))
+    {
+    }
+
+    const std::string& GetName() const { return m_name; }
+    size_t GetHash() const { return m_hash; }
+
+    static size_t GetHash(const std::string& name)
+    {
+#if defined(_MSC_VER) && _MSC_VER <= 1900 // robin_hood hash map doesn't compatible with MSVC 14.0
+        return std::hash<std::string>()(name);
+#else
+        return robin_hood::hash<std::string>()(name);
+#endif
+    }
+
+private:
+    std::string m_name;
+    size_t m_hash;
+};
+
+// Enumerates the map items in place, without the snapshot of the keys and the lookups of the values. Current key and value are
+// valid until the next MoveNext call
+struct IMapAccessorEnumerator
+{
+    virtual ~IMapAccessorEnumerator() {}
+
+    virtual bool MoveNext() = 0;
+    virtual const std::string& GetKey() const = 0;
+    virtual const InternalValue& GetValue() const = 0;
+};
+
+using MapAccessorEnumeratorPtr = std::unique_ptr<IMapAccessorEnumerator>;
+
 struct IMapAccessor
 {
     virtual size_t GetSize() const = 0;
     virtual bool HasValue(const std::string& name) const = 0;
     virtual InternalValue GetItem(const std::string& name) const = 0;
+    // Single lookup replacement of HasValue + GetItem pair
+    virtual bool FindItem(const HashedName& name, InternalValue& result) const;
     virtual std::vector<std::string> GetKeys() const = 0;
+    // Default enumerator walks the snapshot of the keys and looks the values up
+    virtual MapAccessorEnumeratorPtr CreateEnumerator() const;
     virtual bool SetValue(std::string, const InternalValue&) {return false;}
     virtual GenericMap CreateGenericMap() const = 0;
     virtual bool ShouldExtendLifetime() const = 0;
+    // Fixed layout of the items (see MapItemAccessor::GetLayout). Maps of the same layout keep the items of the same names in the same
+    // slots, so the slot found once by name can be used for the other maps of that layout. Null if the items are looked up by name only
+    virtual const void* GetLayout() const {return nullptr;}
+    virtual size_t FindSlot(const std::string&) const {return static_cast<size_t>(-1);}
+    virtual bool GetItemBySlot(size_t, InternalValue&) const {return false;}
 };
 
 using MapAccessorProvider = std::function<IMapAccessor*()>;
@@ -244,12 +315,22 @@ public:
     ListAdapter(ListAdapter&&) = default;
 
     static ListAdapter CreateAdapter(InternalValueList&& values);
+    // Read-only list which copies share the items instead of copying them (e.g. the literal list built once at load time)
+    static ListAdapter CreateSharedAdapter(InternalValueList&& values);
     static ListAdapter CreateAdapter(const GenericList& values);
     static ListAdapter CreateAdapter(const ValuesList& values);
     static ListAdapter CreateAdapter(GenericList&& values);
     static ListAdapter CreateAdapter(ValuesList&& values);
     static ListAdapter CreateAdapter(std::function<nonstd::optional<InternalValue> ()> fn);
     static ListAdapter CreateAdapter(size_t listSize, std::function<InternalValue (size_t idx)> fn);
+    // Indexable list of integers which keeps the progression parameters only
+    static ListAdapter CreateRangeAdapter(const IntegerRange& range);
+    // Read-only lists of the native numbers, viewed as the arrays by the numeric filters (see GetNumbers)
+    static ListAdapter CreateNumbersAdapter(std::vector<int64_t>&& values);
+    static ListAdapter CreateNumbersAdapter(std::vector<double>&& values);
+    // Lazy list. Every enumeration gets the new items generator from 'genFactory', so the enumerated items are produced on demand and
+    // never stored. Items accessed by index are cached, so the generator should produce the same items every time
+    static ListAdapter CreateLazyAdapter(std::function<std::function<nonstd::optional<InternalValue> ()> ()> genFactory);
 
     ListAdapter& operator = (const ListAdapter&) = default;
     ListAdapter& operator = (ListAdapter&&) = default;
@@ -273,6 +354,29 @@ public:
 
         return false;
     }
+    const IntegerRange* GetIntegerRange() const
+    {
+        if (m_accessorProvider && m_accessorProvider())
+            return m_accessorProvider()->GetIntegerRange();
+
+        return nullptr;
+    }
+
+    NumbersArrayView GetNumbers() const
+    {
+        if (m_accessorProvider && m_accessorProvider())
+            return m_accessorProvider()->GetNumbers();
+
+        return NumbersArrayView();
+    }
+
+    const void* GetIdentity() const
+    {
+        if (m_accessorProvider && m_accessorProvider())
+            return m_accessorProvider()->GetIdentity();
+
+        return nullptr;
+    }
 
     ListAdapter ToSubscriptedList(const InternalValue& subscript, bool asRef = false) const;
     InternalValueList ToValueList() const;
@@ -320,6 +424,15 @@ public:
         return false;
     }
     InternalValue GetValueByName(const std::string& name) const;
+    bool FindValue(const HashedName& name, InternalValue& result) const
+    {
+        if (m_accessorProvider && m_accessorProvider())
+        {
+            return m_accessorProvider()->FindItem(name, result);
+        }
+
+        return false;
+    }
     std::vector<std::string> GetKeys() const
     {
         if (m_accessorProvider && m_accessorProvider())
@@ -329,6 +442,14 @@ public:
 
         return std::vector<std::string>();
     }
+    // Null if the map is empty-constructed. The map should be kept alive while the items are enumerated
+    MapAccessorEnumeratorPtr GetEnumerator() const
+    {
+        if (m_accessorProvider && m_accessorProvider())
+            return m_accessorProvider()->CreateEnumerator();
+
+        return MapAccessorEnumeratorPtr();
+    }
     bool SetValue(std::string name, const InternalValue& val)
     {
         if (m_accessorProvider && m_accessorProvider())
@@ -355,6 +476,11 @@ public:
 
         return GenericMap();
     }
+    // Null if the map is empty-constructed. Lets the caller make several calls without querying the provider for every one
+    const IMapAccessor* GetAccessor() const
+    {
+        return m_accessorProvider ? m_accessorProvider() : nullptr;
+    }
 
 private:
     MapAccessorProvider m_accessorProvider;
@@ -377,17 +503,17 @@ public:
 
     void SetParentData(const InternalValue& val)
     {
-        m_parentData = val.GetData();
+        m_parentData = val.IsEmpty() ? nullptr : std::make_shared<const InternalValueData>(val.GetData());
     }
 
     void SetParentData(InternalValue&& val)
     {
-        m_parentData = std::move(val.GetData());
+        m_parentData = val.IsEmpty() ? nullptr : std::make_shared<const InternalValueData>(std::move(val.GetData()));
     }
 
     bool ShouldExtendLifetime() const
     {
-        if (m_parentData.index() != 0)
+        if (m_parentData)
             return true;
 
         const MapAdapter* ma = nonstd::get_if<MapAdapter>(&m_data);
@@ -403,9 +529,16 @@ public:
 
     bool IsEmpty() const {return m_data.index() == 0;}
 
+    // Safe values (e.g. results of the 'escape' filter or output of the macros with autoescaping) are never escaped again
+    bool IsSafe() const {return m_isSafe;}
+    void SetSafe(bool isSafe) {m_isSafe = isSafe;}
+
 private:
     InternalValueData m_data;
-    InternalValueData m_parentData;
+    // Value which owns the data referenced by this one (e.g. the temporary object of the reflected field). Needed rarely, so kept
+    // out of line and shared by the copies
+    std::shared_ptr<const InternalValueData> m_parentData;
+    bool m_isSafe = false;
 };
 
 class ListAdapter::Iterator
@@ -458,12 +591,42 @@ private:
 #if defined(_MSC_VER) && _MSC_VER <= 1900 // robin_hood hash map doesn't compatible with MSVC 14.0
 typedef std::unordered_map<std::string, InternalValue> InternalValueMap;
 #else
-typedef robin_hood::unordered_map<std::string, InternalValue> InternalValueMap;
+struct InternalValueMapHash
+{
+    size_t operator()(const std::string& name) const { return HashedName::GetHash(name); }
+    size_t operator()(const HashedName& name) const { return name.GetHash(); }
+};
+
+struct InternalValueMapKeyEqual
+{
+    bool operator()(const std::string& left, const std::string& right) const { return left == right; }
+    bool operator()(const HashedName& left, const std::string& right) const { return left.GetName() == right; }
+};
+
+typedef robin_hood::unordered_map<std::string, InternalValue, InternalValueMapHash, InternalValueMapKeyEqual> InternalValueMap;
 #endif
 
+template<typename Map>
+auto FindByName(Map& map, const std::string& name)
+{
+    return map.find(name);
+}
+
+template<typename Map>
+auto FindByName(Map& map, const HashedName& name)
+{
+#if defined(_MSC_VER) && _MSC_VER <= 1900 // robin_hood hash map doesn't compatible with MSVC 14.0
+    return map.find(name.GetName());
+#else
+    return map.find(name, robin_hood::is_transparent_tag());
+#endif
+}
+
 
 MapAdapter CreateMapAdapter(InternalValueMap&& values);
 MapAdapter CreateMapAdapter(const InternalValueMap* values);
+// Read-only map which copies share the items instead of copying them (e.g. the literal dictionary built once at load time)
+MapAdapter CreateSharedMapAdapter(InternalValueMap&& values);
 MapAdapter CreateMapAdapter(const GenericMap& values);
 MapAdapter CreateMapAdapter(GenericMap&& values);
 MapAdapter CreateMapAdapter(const ValuesMap& values);
@@ -542,6 +705,15 @@ inline InternalValue MapAdapter::GetValueByName(const std::string& name) const
     return InternalValue();
 }
 
+inline bool IMapAccessor::FindItem(const HashedName& name, InternalValue& result) const
+{
+    if (!HasValue(name.GetName()))
+        return false;
+
+    result = GetItem(name.GetName());
+    return true;
+}
+
 inline ListAccessorEnumeratorPtr ListAdapter::GetEnumerator() const {return m_accessorProvider()->CreateListAccessorEnumerator();}
 inline ListAdapter::Iterator ListAdapter::begin() const {return Iterator(m_accessorProvider()->CreateListAccessorEnumerator());}
 inline ListAdapter::Iterator ListAdapter::end() const {return Iterator();}
@@ -612,9 +784,21 @@ public:
         return nonstd::get<StatementCallable>(m_callable);
     }
 
+    // Output of the statement callable is already escaped (macro with autoescaping)
+    bool IsSafeOutput() const
+    {
+        return m_isSafeOutput;
+    }
+
+    void SetSafeOutput(bool isSafe)
+    {
+        m_isSafeOutput = isSafe;
+    }
+
 private:
     Kind m_kind;
     CallableHolder m_callable;
+    bool m_isSafeOutput = false;
 };
 
 inline bool IsEmpty(const InternalValue& val)
@@ -640,11 +824,37 @@ auto sv_to_string(const nonstd::basic_string_view<CharT>& sv)
 
 InternalValue Subscript(const InternalValue& val, const InternalValue& subscript, RenderContext* values);
 InternalValue Subscript(const InternalValue& val, const std::string& subscript, RenderContext* values);
+InternalValue Subscript(const InternalValue& val, const HashedName& subscript, RenderContext* values);
+
+// Monomorphic inline cache of the single attribute access site (e.g. 'user.name' expression). Remembers the slot of the item within the
+// first fixed-layout map (see IMapAccessor::GetLayout) the site looks up and gets the item by that slot from the maps of the same layout.
+// Set once and read without locks, so the site shared by the concurrent renders stays consistent. Maps of the other layouts (and
+// the hash maps) are looked up by name as usual
+class MapSlotCache
+{
+public:
+    bool FindValue(const MapAdapter& map, const HashedName& name, InternalValue& result);
+
+private:
+    enum State
+    {
+        Empty,
+        Busy,
+        Ready
+    };
+
+    std::atomic<int> m_state{Empty};
+    const void* m_layout = nullptr;
+    size_t m_slot = 0;
+};
+
+InternalValue Subscript(const InternalValue& val, const HashedName& subscript, MapSlotCache& cache, RenderContext* values);
 std::string AsString(const InternalValue& val);
 ListAdapter ConvertToList(const InternalValue& val, bool& isConverted, bool strictConversion = true);
 ListAdapter ConvertToList(const InternalValue& val, InternalValue subscipt, bool& isConverted, bool strictConversion = true);
 Value IntValue2Value(const InternalValue& val);
 Value OptIntValue2Value(nonstd::optional<InternalValue> val);
+InternalValue Value2IntValue(const Value& val);
 
 } // jinja2
 
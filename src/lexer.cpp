@@ -1,13 +1,158 @@
 #include "lexer.h"
 
+#include <cstdint>
 #include <iostream>
 
 namespace jinja2
 {
+namespace
+{
+struct KeywordName
+{
+    const char* name;
+    size_t size;
+    Keyword type;
+};
+
+constexpr KeywordName g_keywordNames[] = {
+    {"for", 3, Keyword::For},
+    {"endfor", 6, Keyword::Endfor},
+    {"in", 2, Keyword::In},
+    {"if", 2, Keyword::If},
+    {"else", 4, Keyword::Else},
+    {"elif", 4, Keyword::ElIf},
+    {"endif", 5, Keyword::EndIf},
+    {"or", 2, Keyword::LogicalOr},
+    {"and", 3, Keyword::LogicalAnd},
+    {"not", 3, Keyword::LogicalNot},
+    {"is", 2, Keyword::Is},
+    {"block", 5, Keyword::Block},
+    {"endblock", 8, Keyword::EndBlock},
+    {"extends", 7, Keyword::Extends},
+    {"macro", 5, Keyword::Macro},
+    {"endmacro", 8, Keyword::EndMacro},
+    {"call", 4, Keyword::Call},
+    {"endcall", 7, Keyword::EndCall},
+    {"filter", 6, Keyword::Filter},
+    {"endfilter", 9, Keyword::EndFilter},
+    {"set", 3, Keyword::Set},
+    {"endset", 6, Keyword::EndSet},
+    {"include", 7, Keyword::Include},
+    {"import", 6, Keyword::Import},
+    {"true", 4, Keyword::True},
+    {"false", 5, Keyword::False},
+    {"True", 4, Keyword::True},
+    {"False", 5, Keyword::False},
+    {"none", 4, Keyword::None},
+    {"None", 4, Keyword::None},
+    {"recursive", 9, Keyword::Recursive},
+    {"scoped", 6, Keyword::Scoped},
+    {"with", 4, Keyword::With},
+    {"endwith", 7, Keyword::EndWith},
+    {"without", 7, Keyword::Without},
+    {"ignore", 6, Keyword::Ignore},
+    {"missing", 7, Keyword::Missing},
+    {"context", 7, Keyword::Context},
+    {"from", 4, Keyword::From},
+    {"as", 2, Keyword::As},
+    {"do", 2, Keyword::Do},
+    {"autoescape", 10, Keyword::Autoescape},
+    {"endautoescape", 13, Keyword::EndAutoescape},
+    {"cache", 5, Keyword::Cache},
+    {"endcache", 8, Keyword::EndCache},
+    {"cached", 6, Keyword::Cached},
+};
+
+constexpr size_t KeywordsCount = sizeof(g_keywordNames) / sizeof(g_keywordNames[0]);
+constexpr size_t KeywordSlotsCount = 128;
+constexpr size_t MaxKeywordSize = 13;
+
+// Perfect for g_keywordNames: the parameters are picked so that all the keywords get the distinct slots (checked below)
+constexpr size_t KeywordHash(size_t size, size_t first, size_t middle, size_t last)
+{
+    return (size * 15 + first * 5 + middle + last * 25) % KeywordSlotsCount;
+}
+
+constexpr size_t KeywordHash(const char* name, size_t size)
+{
+    return KeywordHash(size, static_cast<unsigned char>(name[0]), static_cast<unsigned char>(name[size / 2]), static_cast<unsigned char>(name[size - 1]));
+}
+
+struct KeywordSlots
+{
+    // Index of the keyword in g_keywordNames plus one, zero for the empty slots
+    uint8_t slots[KeywordSlotsCount];
+};
+
+constexpr KeywordSlots MakeKeywordSlots()
+{
+    KeywordSlots result{};
+    for (size_t idx = 0; idx != KeywordsCount; ++ idx)
+        result.slots[KeywordHash(g_keywordNames[idx].name, g_keywordNames[idx].size)] = static_cast<uint8_t>(idx + 1);
+    return result;
+}
+
+constexpr bool IsKeywordHashPerfect()
+{
+    auto slots = MakeKeywordSlots();
+    size_t usedSlots = 0;
+    for (auto slot : slots.slots)
+        usedSlots += slot != 0 ? 1 : 0;
+    return usedSlots == KeywordsCount;
+}
+
+constexpr bool IsMaxKeywordSizeValid()
+{
+    size_t maxSize = 0;
+    for (auto& kw : g_keywordNames)
+        maxSize = kw.size > maxSize ? kw.size : maxSize;
+    return maxSize == MaxKeywordSize;
+}
+
+static_assert(IsKeywordHashPerfect(), "Keywords hash has collisions, its parameters should be updated");
+static_assert(IsMaxKeywordSizeValid(), "MaxKeywordSize doesn't match the longest keyword");
+
+constexpr KeywordSlots g_keywordSlots = MakeKeywordSlots();
+
+template<typename CharT>
+Keyword FindKeywordImpl(nonstd::basic_string_view<CharT> name)
+{
+    auto size = name.size();
+    if (size < 2 || size > MaxKeywordSize)
+        return Keyword::Unknown;
+
+    // Non-ASCII chars never match, so their slot doesn't matter
+    auto slot = g_keywordSlots.slots[KeywordHash(size, static_cast<size_t>(name[0]), static_cast<size_t>(name[size / 2]), static_cast<size_t>(name[size - 1]))];
+    if (slot == 0)
+        return Keyword::Unknown;
+
+    auto& keyword = g_keywordNames[slot - 1];
+    if (keyword.size != size)
+        return Keyword::Unknown;
+    for (size_t idx = 0; idx != size; ++ idx)
+    {
+        if (name[idx] != static_cast<CharT>(keyword.name[idx]))
+            return Keyword::Unknown;
+    }
+
+    return keyword.type;
+}
+} // namespace
+
+Keyword FindKeyword(nonstd::string_view name)
+{
+    return FindKeywordImpl(name);
+}
+
+Keyword FindKeyword(nonstd::wstring_view name)
+{
+    return FindKeywordImpl(name);
+}
 
 bool Lexer::Preprocess()
 {
     bool result = true;
+    m_tokens.clear();
     while (1)
     {
         lexertk::token token = m_tokenizer();
@@ -82,6 +227,7 @@ bool Lexer::ProcessSymbolOrKeyword(const lexertk::token&, Token& newToken)
 {
     Keyword kwType = m_helper->GetKeyword(newToken.range);
     Token::Type tokType = Token::Unknown;
+    newToken.keyword = kwType;
     
     switch (kwType)
     {
@@ -15,6 +15,60 @@ struct CharRange
     auto size() const {return endOffset - startOffset;}
 };
 
+enum class Keyword
+{
+    Unknown,
+
+    // Keywords
+    LogicalOr,
+    LogicalAnd,
+    LogicalNot,
+    True,
+    False,
+    None,
+    In,
+    Is,
+    For,
+    Endfor,
+    If,
+    Else,
+    ElIf,
+    EndIf,
+    Block,
+    EndBlock,
+    Extends,
+    Macro,
+    EndMacro,
+    Call,
+    EndCall,
+    Filter,
+    EndFilter,
+    Set,
+    EndSet,
+    Include,
+    Import,
+    Recursive,
+    Scoped,
+    With,
+    EndWith,
+    Without,
+    Ignore,
+    Missing,
+    Context,
+    From,
+    As,
+    Do,
+    Autoescape,
+    EndAutoescape,
+    Cache,
+    EndCache,
+    Cached,
+};
+
+// Keyword by its name (e.g. `endfor`). Doesn't allocate: the name is matched by the perfect hash over its length and three of its chars
+Keyword FindKeyword(nonstd::string_view name);
+Keyword FindKeyword(nonstd::wstring_view name);
+
 struct Token
 {
     enum Type
@@ -94,6 +148,11 @@ struct Token
         From,
         As,
         Do,
+        Autoescape,
+        EndAutoescape,
+        Cache,
+        EndCache,
+        Cached,
 
         // Template control
         CommentBegin,
@@ -111,6 +170,8 @@ struct Token
     Type type = Unknown;
     CharRange range = {0, 0};
     InternalValue value;
+    // Keyword which the symbol matches. Resolved once by the lexer, so the parser doesn't look up the keywords by the token text
+    Keyword keyword = Keyword::Unknown;
 
     bool IsEof() const
     {
@@ -134,51 +195,6 @@ struct Token
     }
 };
 
-enum class Keyword
-{
-    Unknown,
-
-    // Keywords
-    LogicalOr,
-    LogicalAnd,
-    LogicalNot,
-    True,
-    False,
-    None,
-    In,
-    Is,
-    For,
-    Endfor,
-    If,
-    Else,
-    ElIf,
-    EndIf,
-    Block,
-    EndBlock,
-    Extends,
-    Macro,
-    EndMacro,
-    Call,
-    EndCall,
-    Filter,
-    EndFilter,
-    Set,
-    EndSet,
-    Include,
-    Import,
-    Recursive,
-    Scoped,
-    With,
-    EndWith,
-    Without,
-    Ignore,
-    Missing,
-    Context,
-    From,
-    As,
-    Do,
-};
-
 struct LexerHelper
 {
     virtual std::string GetAsString(const CharRange& range) = 0;
@@ -191,8 +207,10 @@ class Lexer
 {
 public:
     using TokensList = std::vector<Token>;
-    Lexer(std::function<lexertk::token ()> tokenizer, LexerHelper* helper)
+    // 'tokens' is the buffer for the result. It's shared by the lexers of all the blocks of the template, so its memory is reused
+    Lexer(std::function<lexertk::token ()> tokenizer, LexerHelper* helper, TokensList& tokens)
         : m_tokenizer(std::move(tokenizer))
+        , m_tokens(tokens)
         , m_helper(helper)
     {
     }
@@ -211,7 +229,7 @@ private:
     bool ProcessString(const lexertk::token& token, Token& newToken);
 private:
     std::function<lexertk::token ()> m_tokenizer;
-    TokensList m_tokens;
+    TokensList& m_tokens;
     LexerHelper* m_helper;
 };
 
@@ -320,7 +338,7 @@ public:
     
     auto GetAsKeyword(const Token& tok) const
     {
-        return m_helper->GetKeyword(tok.range);
+        return tok.keyword;
     }
     
     bool EatIfEqual(Keyword kwType, Token* tok = nullptr)
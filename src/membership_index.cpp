@@ -0,0 +1,125 @@
+#include "membership_index.h"
+
+#include "value_visitors.h"
+
+namespace jinja2
+{
+constexpr size_t MembershipIndexCache::ProbesBeforeIndexing;
+constexpr size_t MembershipIndexCache::MinIndexedSize;
+constexpr size_t MembershipIndexCache::MaxEntries;
+
+namespace
+{
+struct MembershipKey
+{
+    enum Kind
+    {
+        None,
+        Integer,
+        String
+    };
+
+    Kind kind = None;
+    int64_t intVal = 0;
+    // Wide strings are compared with the narrow ones after the conversion, so the keys are narrow
+    std::string strVal;
+};
+
+struct MembershipKeyGetter : visitors::BaseVisitor<MembershipKey>
+{
+    using BaseVisitor::operator();
+
+    MembershipKey operator()(int64_t val) const
+    {
+        MembershipKey result;
+        result.kind = MembershipKey::Integer;
+        result.intVal = val;
+        return result;
+    }
+    MembershipKey operator()(const std::string& str) const { return MakeStringKey(str); }
+    MembershipKey operator()(const nonstd::string_view& str) const { return MakeStringKey(std::string(str.begin(), str.end())); }
+    MembershipKey operator()(const std::wstring& str) const { return MakeStringKey(ConvertString<std::string>(str)); }
+    MembershipKey operator()(const nonstd::wstring_view& str) const { return MakeStringKey(ConvertString<std::string>(str)); }
+
+    static MembershipKey MakeStringKey(std::string str)
+    {
+        MembershipKey result;
+        result.kind = MembershipKey::String;
+        result.strVal = std::move(str);
+        return result;
+    }
+};
+} // namespace
+
+std::unique_ptr<MembershipIndex> MembershipIndex::Create(const ListAdapter& list)
+{
+    std::unique_ptr<MembershipIndex> result(new MembershipIndex());
+    for (auto& item : list)
+    {
+        auto key = Apply<MembershipKeyGetter>(item);
+        switch (key.kind)
+        {
+        case MembershipKey::Integer:
+            result->m_integers.insert(key.intVal);
+            break;
+        case MembershipKey::String:
+            result->m_strings.insert(std::move(key.strVal));
+            break;
+        case MembershipKey::None:
+            return std::unique_ptr<MembershipIndex>();
+        }
+    }
+
+    return result;
+}
+
+bool MembershipIndex::Find(const InternalValue& val, bool& found) const
+{
+    auto key = Apply<MembershipKeyGetter>(val);
+    switch (key.kind)
+    {
+    case MembershipKey::Integer:
+        found = m_integers.count(key.intVal) != 0;
+        return true;
+    case MembershipKey::String:
+        found = m_strings.count(key.strVal) != 0;
+        return true;
+    case MembershipKey::None:
+        break;
+    }
+
+    return false;
+}
+
+const MembershipIndex* MembershipIndexCache::GetIndex(const ListAdapter& list)
+{
+    auto id = list.GetIdentity();
+    if (!id)
+        return nullptr;
+
+    auto size = list.GetSize();
+    if (!size || *size < MinIndexedSize)
+        return nullptr;
+
+    std::lock_guard<std::mutex> l(m_guard);
+    auto p = m_entries.find(id);
+    if (p == m_entries.end())
+    {
+        if (m_entries.size() >= MaxEntries)
+            return nullptr;
+        p = m_entries.emplace(id, Entry()).first;
+        p->second.list = list;
+    }
+
+    auto& entry = p->second;
+    if (entry.index || !entry.isIndexable)
+        return entry.index.get();
+
+    if (++ entry.probesCount < ProbesBeforeIndexing)
+        return nullptr;
+
+    entry.index = MembershipIndex::Create(list);
+    entry.isIndexable = !!entry.index;
+    return entry.index.get();
+}
+} // jinja2
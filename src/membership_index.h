@@ -0,0 +1,59 @@
+#ifndef MEMBERSHIP_INDEX_H
+#define MEMBERSHIP_INDEX_H
+
+#include "internal_value.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace jinja2
+{
+// Hash set of the list items for the 'in' tests. Built for the lists of integers and strings only: the other values (e.g. the doubles
+// compared with the tolerance) can't be hashed consistently with the equality comparison
+class MembershipIndex
+{
+public:
+    // Returns null if the list has the items which can't be indexed
+    static std::unique_ptr<MembershipIndex> Create(const ListAdapter& list);
+
+    // Returns false if the value can't be looked up in the index, so the caller should scan the list items
+    bool Find(const InternalValue& val, bool& found) const;
+
+private:
+    std::unordered_set<int64_t> m_integers;
+    std::unordered_set<std::string> m_strings;
+};
+
+// Indexes of the runtime lists probed by the 'in' tests of the single render (see Settings::indexMembershipTests). Lists are identified
+// by the data they view (see ListAdapter::GetIdentity). The index is built once the list is probed ProbesBeforeIndexing times, so the
+// lists tested once (or a few times) are scanned as usual. Shared by all the contexts of the render call
+class MembershipIndexCache
+{
+public:
+    static constexpr size_t ProbesBeforeIndexing = 4;
+    // Shorter lists are scanned faster than the index is built
+    static constexpr size_t MinIndexedSize = 16;
+    static constexpr size_t MaxEntries = 64;
+
+    // Counts the probe of the list. Returns null if the list isn't indexed (yet)
+    const MembershipIndex* GetIndex(const ListAdapter& list);
+
+private:
+    struct Entry
+    {
+        // Keeps the viewed data alive, so its address isn't reused by the other list during the render
+        ListAdapter list;
+        size_t probesCount = 0;
+        bool isIndexable = true;
+        std::unique_ptr<MembershipIndex> index;
+    };
+
+    std::mutex m_guard;
+    std::unordered_map<const void*, Entry> m_entries;
+};
+} // jinja2
+
+#endif // MEMBERSHIP_INDEX_H
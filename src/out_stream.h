@@ -4,10 +4,13 @@
 #include "internal_value.h"
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <sstream>
 
 namespace jinja2
 {
+// Output of the renderers. Writes go straight to the writer with the single virtual call. Writer is either provided by the
+// caller (and outlives the stream) or owned by the stream (e.g. the writers on the temporary strings)
 class OutStream
 {
 public:
@@ -16,25 +19,62 @@ public:
         virtual ~StreamWriter() {}
 
         virtual void WriteBuffer(const void* ptr, size_t length) = 0;
+        // Writes the static text of the template, which stays unchanged while the template exists, so the writer may refer to it
+        // instead of copying (see RenderedSlices)
+        virtual void WriteStaticBuffer(const void* ptr, size_t length) { WriteBuffer(ptr, length); }
         virtual void WriteValue(const InternalValue &val) = 0;
+        // Writes the value with HTML special chars replaced, straight into the target
+        virtual void WriteEscapedValue(const InternalValue &val) = 0;
     };
 
-    OutStream(std::function<StreamWriter*()> writerGetter)
-        : m_writerGetter(std::move(writerGetter))
+    explicit OutStream(StreamWriter* writer)
+        : m_writer(writer)
+    {}
+
+    explicit OutStream(std::unique_ptr<StreamWriter> writer)
+        : m_writer(writer.get())
+        , m_ownWriter(std::move(writer))
     {}
 
     void WriteBuffer(const void* ptr, size_t length)
     {
-        m_writerGetter()->WriteBuffer(ptr, length);
+        m_writer->WriteBuffer(ptr, length);
+    }
+
+    void WriteStaticBuffer(const void* ptr, size_t length)
+    {
+        m_writer->WriteStaticBuffer(ptr, length);
     }
 
     void WriteValue(const InternalValue& val)
     {
-        m_writerGetter()->WriteValue(val);
+        if (m_autoescape && !val.IsSafe())
+            m_writer->WriteEscapedValue(val);
+        else
+            m_writer->WriteValue(val);
+    }
+
+    // Autoescaping applies to the values only. It's switched on by the expressions within the autoescape context
+    bool SetAutoescape(bool autoescape)
+    {
+        bool prev = m_autoescape;
+        m_autoescape = autoescape;
+        return prev;
     }
 
 private:
-    std::function<StreamWriter*()> m_writerGetter;
+    StreamWriter* m_writer;
+    std::unique_ptr<StreamWriter> m_ownWriter;
+    bool m_autoescape = false;
+};
+
+// Writer of the output nobody reads (e.g. the body of the imported template). Values aren't even rendered
+class NullStreamWriter final : public OutStream::StreamWriter
+{
+public:
+    void WriteBuffer(const void*, size_t) override {}
+    void WriteValue(const InternalValue&) override {}
+    void WriteEscapedValue(const InternalValue&) override {}
 };
 
 } // jinja2
@@ -0,0 +1,110 @@
+#include "parallel_filters.h"
+
+#include "allocation_tracker.h"
+
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <thread>
+
+namespace jinja2
+{
+namespace
+{
+// Copy of the context for the chunk processed on the separate thread (see ParallelUnit of the parallel render)
+struct ChunkContext
+{
+    explicit ChunkContext(const RenderContext& parent)
+        : extParams(parent.GetExternalScope())
+        , context(parent.Fork(extParams, &scopesPool))
+    {
+        context.SetParallelFilters(nullptr);
+    }
+
+    ExternalScope extParams;
+    ScopesPool scopesPool;
+    RenderContext context;
+};
+} // namespace
+
+ParallelFilterExecutor::ParallelFilterExecutor(size_t threshold, size_t threadsCount)
+    : m_threshold(threshold)
+    , m_threadsCount(threadsCount != 0 ? threadsCount : std::max<size_t>(std::thread::hardware_concurrency(), 1))
+{
+}
+
+size_t ParallelFilterExecutor::GetChunksCount(size_t size) const
+{
+    if (m_threshold == 0 || size < m_threshold)
+        return 1;
+
+    return std::min(m_threadsCount, size);
+}
+
+std::vector<size_t> ParallelFilterExecutor::GetChunkBounds(size_t size) const
+{
+    auto chunksCount = GetChunksCount(size);
+    std::vector<size_t> result;
+    result.reserve(chunksCount + 1);
+    for (size_t n = 0; n != chunksCount; ++ n)
+        result.push_back(size / chunksCount * n + std::min(n, size % chunksCount));
+    result.push_back(size);
+    return result;
+}
+
+void ParallelFilterExecutor::ForEachChunk(size_t size, const std::function<void (size_t, size_t)>& fn) const
+{
+    auto bounds = GetChunkBounds(size);
+    RunChunks(bounds.size() - 1, [&bounds, &fn](size_t idx) { fn(bounds[idx], bounds[idx + 1]); });
+}
+
+void ParallelFilterExecutor::ForEachChunk(size_t size, const RenderContext& context, const std::function<void (size_t, size_t, RenderContext&)>& fn) const
+{
+    auto bounds = GetChunkBounds(size);
+    std::deque<ChunkContext> contexts;
+    for (size_t n = 0; n + 1 != bounds.size(); ++ n)
+        contexts.emplace_back(context);
+
+    RunChunks(bounds.size() - 1, [&bounds, &contexts, &fn](size_t idx) { fn(bounds[idx], bounds[idx + 1], contexts[idx].context); });
+}
+
+void ParallelFilterExecutor::RunChunks(size_t chunksCount, const std::function<void (size_t)>& fn) const
+{
+    auto allocationTracker = AllocationTracker::GetCurrent();
+    std::deque<std::future<void>> chunks;
+    for (size_t idx = 1; idx < chunksCount; ++ idx)
+    {
+        chunks.push_back(std::async(std::launch::async, [&fn, idx, allocationTracker]() {
+            AllocationTracker::Scope trackerScope(allocationTracker);
+            fn(idx);
+        }));
+    }
+
+    std::exception_ptr error;
+    try
+    {
+        fn(0);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    // Exception of the first failed chunk is rethrown, as the sequential execution would do
+    for (auto& chunk : chunks)
+    {
+        try
+        {
+            chunk.get();
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+} // jinja2
@@ -0,0 +1,38 @@
+#ifndef PARALLEL_FILTERS_H
+#define PARALLEL_FILTERS_H
+
+#include "render_context.h"
+
+#include <functional>
+#include <vector>
+
+namespace jinja2
+{
+// Data-parallel execution of the built-in filters over the large indexable lists (see Settings::parallelFilterThreshold). Items are split
+// into the contiguous chunks, one per thread, and the results of the chunks are combined in order, so the filters produce the same results
+// as the sequential ones. Shared by all the contexts of the render call
+class ParallelFilterExecutor
+{
+public:
+    ParallelFilterExecutor(size_t threshold, size_t threadsCount);
+
+    // Number of the chunks the list of the specified size is split into. 1 if the list should be processed sequentially
+    size_t GetChunksCount(size_t size) const;
+    // Boundaries of the chunks: begin of each chunk followed by the size
+    std::vector<size_t> GetChunkBounds(size_t size) const;
+    // Calls fn(begin, end) for the chunks of [0, size) concurrently. The first chunk is processed by the calling thread. Exception of the
+    // chunk is rethrown once all the chunks are done
+    void ForEachChunk(size_t size, const std::function<void (size_t, size_t)>& fn) const;
+    // The same, but each chunk gets its own copy of the context. Filters applied within the chunks are executed sequentially
+    void ForEachChunk(size_t size, const RenderContext& context, const std::function<void (size_t, size_t, RenderContext&)>& fn) const;
+
+private:
+    void RunChunks(size_t chunksCount, const std::function<void (size_t)>& fn) const;
+
+private:
+    size_t m_threshold;
+    size_t m_threadsCount;
+};
+} // jinja2
+
+#endif // PARALLEL_FILTERS_H
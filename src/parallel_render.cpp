@@ -0,0 +1,117 @@
+#include "allocation_tracker.h"
+#include "renderer.h"
+
+#include <deque>
+#include <future>
+
+namespace jinja2
+{
+namespace
+{
+// Render of the independent child on the separate thread. Child gets its own copy of the context and writes into its own buffer
+struct ParallelUnit
+{
+    explicit ParallelUnit(const RenderContext& parent)
+        : extParams(parent.GetExternalScope())
+        , context(parent.Fork(extParams, &scopesPool))
+    {
+    }
+
+    ExternalScope extParams;
+    ScopesPool scopesPool;
+    RenderContext context;
+    TargetString result;
+    // Declared last: destruction waits for the render which uses the members above
+    std::future<void> done;
+};
+
+struct BufferWriter
+{
+    OutStream& os;
+
+    template<typename CharT>
+    void operator()(const std::basic_string<CharT>& str) const
+    {
+        os.WriteBuffer(str.data(), str.size());
+    }
+};
+} // namespace
+
+void ComposedRenderer::RenderParallel(OutStream& os, RenderContext& values)
+{
+    // Blocks of the parent template are replaced with the blocks of the extending one, which aren't checked for the side effects
+    bool isExtended = false;
+    values.FindValue("$$__parent_template", isExtended);
+
+    size_t idx = 0;
+    while (idx != m_renderers.size())
+    {
+        // Adjacent independent children, possibly separated by the static text
+        size_t groupEnd = idx;
+        size_t unitsCount = 0;
+        for (; groupEnd != m_renderers.size(); ++ groupEnd)
+        {
+            auto kind = m_parallelUnits[groupEnd];
+            if (kind == IncludeUnit || (kind == BlockUnit && !isExtended))
+                ++ unitsCount;
+            else if (kind != StaticTextUnit)
+                break;
+        }
+
+        if (unitsCount > 1)
+        {
+            RenderUnits(os, values, idx, groupEnd, isExtended);
+            idx = groupEnd;
+            continue;
+        }
+
+        auto end = groupEnd == m_renderers.size() ? groupEnd : groupEnd + 1;
+        for (; idx != end; ++ idx)
+            m_renderers[idx]->Render(os, values);
+    }
+}
+
+void ComposedRenderer::RenderUnits(OutStream& os, RenderContext& values, size_t begin, size_t end, bool isExtended)
+{
+    auto isUnit = [this, isExtended](size_t idx) {
+        auto kind = m_parallelUnits[idx];
+        return kind == IncludeUnit || (kind == BlockUnit && !isExtended);
+    };
+
+    auto callback = values.GetRendererCallback();
+    auto allocationTracker = AllocationTracker::GetCurrent();
+    std::deque<ParallelUnit> units;
+    for (size_t idx = begin; idx != end; ++ idx)
+    {
+        if (!isUnit(idx))
+            continue;
+
+        units.emplace_back(values);
+        auto& unit = units.back();
+        auto renderer = m_renderers[idx].get();
+        unit.done = std::async(std::launch::async, [&unit, renderer, callback, allocationTracker]() {
+            AllocationTracker::Scope trackerScope(allocationTracker);
+            auto stream = callback->GetStreamOnString(unit.result);
+            renderer->Render(stream, unit.context);
+        });
+    }
+
+    auto unit = units.begin();
+    auto& scope = values.GetCurrentScope();
+    for (size_t idx = begin; idx != end; ++ idx)
+    {
+        if (!isUnit(idx))
+        {
+            m_renderers[idx]->Render(os, values);
+            continue;
+        }
+
+        unit->done.get();
+        nonstd::visit(BufferWriter{os}, unit->result);
+        // Variables set by the child (e.g. by the template included with context) become visible in the order of the children
+        for (auto& v : unit->context.GetCurrentScope())
+            scope[v.first] = std::move(v.second);
+        ++ unit;
+    }
+}
+} // jinja2
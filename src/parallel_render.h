@@ -0,0 +1,105 @@
+#ifndef PARALLEL_RENDER_H
+#define PARALLEL_RENDER_H
+
+#include "renderer.h"
+#include "statements.h"
+
+#include <vector>
+
+namespace jinja2
+{
+// Load time pass for Settings::parallelRender. Marks the children of the template root which can be rendered concurrently: the
+// includes and the blocks which don't change the rendering context. Static text between them is written in order by the render call
+class ParallelUnitsDetector : public StatementVisitor
+{
+public:
+    using StatementVisitor::DoVisit;
+
+    static void MarkUnits(const RendererPtr& root)
+    {
+        auto composed = std::dynamic_pointer_cast<ComposedRenderer>(root);
+        if (!composed)
+            return;
+
+        std::vector<ComposedRenderer::ParallelUnitKind> units;
+        size_t unitsCount = 0;
+        for (auto& r : composed->GetRenderers())
+        {
+            auto kind = ComposedRenderer::SequentialUnit;
+            if (dynamic_cast<RawTextRenderer*>(r.get()))
+                kind = ComposedRenderer::StaticTextUnit;
+            else if (dynamic_cast<IncludeStatement*>(r.get()))
+                kind = ComposedRenderer::IncludeUnit;
+            else if (dynamic_cast<ExtendsStatement*>(r.get()))
+                return; // Output of the extending template is produced by the parent one
+            else if (auto block = dynamic_cast<ParentBlockStatement*>(r.get()))
+                kind = IsIndependent(block->GetMainBody()) ? ComposedRenderer::BlockUnit : ComposedRenderer::SequentialUnit;
+
+            if (kind == ComposedRenderer::IncludeUnit || kind == ComposedRenderer::BlockUnit)
+                ++ unitsCount;
+            units.push_back(kind);
+        }
+
+        if (unitsCount > 1)
+            composed->SetParallelUnits(std::move(units));
+    }
+
+    void DoVisit(RendererBase*) override { m_isIndependent = false; }
+    void DoVisit(Statement*) override { m_isIndependent = false; }
+    void DoVisit(SetStatement*) override { m_isIndependent = false; }
+    void DoVisit(SetBlockStatement*) override { m_isIndependent = false; }
+    void DoVisit(ImportStatement*) override { m_isIndependent = false; }
+    void DoVisit(MacroStatement*) override { m_isIndependent = false; }
+    void DoVisit(ExtendsStatement*) override { m_isIndependent = false; }
+    void DoVisit(BlockStatement*) override { m_isIndependent = false; }
+
+    void DoVisit(ComposedRenderer* renderer) override
+    {
+        for (auto& r : renderer->GetRenderers())
+            VisitRenderer(r);
+    }
+    void DoVisit(ForStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        VisitRenderer(stmt->GetElseBody());
+    }
+    void DoVisit(IfStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        for (auto& b : stmt->GetElseBranches())
+            VisitRenderer(b->GetMainBody());
+    }
+    void DoVisit(ParentBlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(MacroCallStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(WithStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(FilterStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(CacheStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+
+    // Body doesn't change the rendering context (e.g. doesn't set the variables or define the macros), so its output depends on the
+    // context only
+    static bool IsIndependent(const RendererPtr& body)
+    {
+        ParallelUnitsDetector detector;
+        detector.VisitRenderer(body);
+        return detector.m_isIndependent;
+    }
+
+private:
+    void VisitRenderer(const RendererPtr& renderer)
+    {
+        if (!renderer || !m_isIndependent)
+            return;
+
+        auto visitable = dynamic_cast<VisitableStatement*>(renderer.get());
+        if (visitable)
+            visitable->ApplyVisitor(this);
+        else
+            m_isIndependent = false;
+    }
+
+private:
+    bool m_isIndependent = true;
+};
+} // jinja2
+
+#endif // PARALLEL_RENDER_H
@@ -34,10 +34,10 @@ struct JsonInserter : visitors::BaseVisitor<rapidjson::Value>
     {
         rapidjson::Value mapNode(rapidjson::kObjectType);
 
-        const auto& keys = map.GetKeys();
-        for (auto& k : keys)
+        auto items = map.GetEnumerator();
+        while (items && items->MoveNext())
         {
-            mapNode.AddMember(rapidjson::Value(k.c_str(), m_allocator), Apply<JsonInserter>(map.GetValueByName(k), m_allocator), m_allocator);
+            mapNode.AddMember(rapidjson::Value(items->GetKey().c_str(), m_allocator), Apply<JsonInserter>(items->GetValue(), m_allocator), m_allocator);
         }
 
         return mapNode;
@@ -82,6 +82,110 @@ struct JsonInserter : visitors::BaseVisitor<rapidjson::Value>
 
     rapidjson::Document::AllocatorType& m_allocator;
 };
+
+// rapidjson output stream which appends the characters to the string
+class StringOutputStream
+{
+public:
+    using Ch = char;
+
+    StringOutputStream(std::string& str, bool escapeHtml)
+        : m_str(str)
+        , m_escapeHtml(escapeHtml)
+    {
+    }
+
+    void Put(Ch ch)
+    {
+        if (m_escapeHtml)
+        {
+            switch (ch)
+            {
+            case '<':
+                m_str.append("\\u003c");
+                return;
+            case '>':
+                m_str.append("\\u003e");
+                return;
+            case '&':
+                m_str.append("\\u0026");
+                return;
+            case '\'':
+                m_str.append("\\u0027");
+                return;
+            default:
+                break;
+            }
+        }
+        m_str.push_back(ch);
+    }
+
+    void Flush() {}
+
+private:
+    std::string& m_str;
+    bool m_escapeHtml;
+};
+
+template<typename Writer>
+struct JsonWriter : visitors::BaseVisitor<void>
+{
+    explicit JsonWriter(Writer& writer)
+        : m_writer(writer)
+    {
+    }
+
+    void operator()(const ListAdapter& list) const
+    {
+        m_writer.StartArray();
+        for (auto& v : list)
+            Apply<JsonWriter>(v, m_writer);
+        m_writer.EndArray();
+    }
+
+    void operator()(const MapAdapter& map) const
+    {
+        m_writer.StartObject();
+        auto items = map.GetEnumerator();
+        while (items && items->MoveNext())
+        {
+            auto& k = items->GetKey();
+            m_writer.Key(k.data(), static_cast<rapidjson::SizeType>(k.size()));
+            Apply<JsonWriter>(items->GetValue(), m_writer);
+        }
+        m_writer.EndObject();
+    }
+
+    void operator()(const KeyValuePair& kwPair) const
+    {
+        m_writer.StartObject();
+        m_writer.Key(kwPair.key.data(), static_cast<rapidjson::SizeType>(kwPair.key.size()));
+        Apply<JsonWriter>(kwPair.value, m_writer);
+        m_writer.EndObject();
+    }
+
+    void operator()(const std::string& str) const { m_writer.String(str.data(), static_cast<rapidjson::SizeType>(str.size())); }
+
+    void operator()(const nonstd::string_view& str) const { m_writer.String(str.data(), static_cast<rapidjson::SizeType>(str.size())); }
+
+    void operator()(const std::wstring& str) const { (*this)(ConvertString<std::string>(str)); }
+
+    void operator()(const nonstd::wstring_view& str) const { (*this)(ConvertString<std::string>(str)); }
+
+    void operator()(bool val) const { m_writer.Bool(val); }
+
+    void operator()(const Callable&) const { m_writer.String("<callable>"); }
+
+    void operator()(double val) const { m_writer.Double(val); }
+
+    void operator()(int64_t val) const { m_writer.Int64(val); }
+
+    // Empty and the other (non-serializable) values
+    template<typename T>
+    void operator()(T&&) const { m_writer.Null(); }
+
+    Writer& m_writer;
+};
 } // namespace
 
 DocumentWrapper::DocumentWrapper()
@@ -123,5 +227,25 @@ std::string ValueWrapper::AsString(const uint8_t indent) const
     return buffer.GetString();
 }
 
+void WriteJson(const InternalValue& value, std::string& result, const uint8_t indent, const bool escapeHtml)
+{
+    using Writer = rapidjson::Writer<StringOutputStream, rapidjson::UTF8<>, rapidjson::UTF8<>>;
+    using PrettyWriter = rapidjson::PrettyWriter<StringOutputStream, rapidjson::UTF8<>, rapidjson::UTF8<>>;
+
+    StringOutputStream stream(result, escapeHtml);
+    if (indent == 0)
+    {
+        Writer writer(stream);
+        Apply<JsonWriter<Writer>>(value, writer);
+    }
+    else
+    {
+        PrettyWriter writer(stream);
+        writer.SetIndent(' ', indent);
+        writer.SetFormatOptions(rapidjson::kFormatSingleLineArray);
+        Apply<JsonWriter<PrettyWriter>>(value, writer);
+    }
+}
+
 } // namespace rapidjson_serializer
 } // namespace jinja2
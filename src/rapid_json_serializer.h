@@ -44,6 +44,10 @@ private:
     std::shared_ptr<rapidjson::Document> m_document;
 };
 
+// Writes the JSON representation of the value straight to the end of 'result' without building the intermediate document. If 'escapeHtml'
+// is set, characters which are unsafe within HTML ('<', '>', '&' and '\'') are written as the unicode escape sequences
+void WriteJson(const InternalValue& value, std::string& result, uint8_t indent = 0, bool escapeHtml = false);
+
 } // namespace rapidjson_serializer
 } // namespace jinja2
 
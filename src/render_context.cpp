@@ -0,0 +1,50 @@
+#include "render_context.h"
+
+namespace jinja2
+{
+
+namespace
+{
+const std::string& GetName(const std::string& name)
+{
+    return name;
+}
+
+const std::string& GetName(const HashedName& name)
+{
+    return name.GetName();
+}
+} // namespace
+
+template<typename Name>
+InternalValueMap::const_iterator ExternalScope::FindImpl(const Name& name, bool& found) const
+{
+    if (m_readsRecorder)
+        m_readsRecorder->Add(GetName(name));
+
+    auto p = FindByName(m_values, name);
+    if (p != m_values.end() || !m_params)
+    {
+        found = p != m_values.end();
+        return p;
+    }
+
+    auto param = m_params->find(GetName(name));
+    if (param == m_params->end())
+        return m_values.end();
+
+    found = true;
+    return m_values.emplace(GetName(name), Value2IntValue(param->second)).first;
+}
+
+InternalValueMap::const_iterator ExternalScope::Find(const std::string& name, bool& found) const
+{
+    return FindImpl(name, found);
+}
+
+InternalValueMap::const_iterator ExternalScope::Find(const HashedName& name, bool& found) const
+{
+    return FindImpl(name, found);
+}
+
+} // jinja2
@@ -2,21 +2,61 @@
 #define RENDER_CONTEXT_H
 
 #include "internal_value.h"
+#include "render_limiter.h"
+#include "render_profiler.h"
 
 #include <nonstd/expected.hpp>
 #include <jinja2cpp/error_info.h>
 
+#include <atomic>
 #include <list>
 #include <deque>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
 
 namespace jinja2
 {
 template<typename CharT>
 class TemplateImpl;
+class IFragmentCache;
+class MembershipIndexCache;
+class ParallelFilterExecutor;
+
+// Runtime error of the render (e.g. the missing template of the include)
+using RenderError = nonstd::variant<ErrorInfo, ErrorInfoW>;
+
+// Error reported by the render instead of the exception (see RenderContext::SetError). Shared by all the contexts of one render call,
+// including the ones forked for the parallel render. The first reported error wins
+class RenderErrorState
+{
+public:
+    bool HasError() const { return m_hasError.load(std::memory_order_acquire); }
+
+    void Set(RenderError error)
+    {
+        std::lock_guard<std::mutex> l(m_guard);
+        if (m_error)
+            return;
+
+        m_error = std::move(error);
+        m_hasError.store(true, std::memory_order_release);
+    }
+
+    // Should be called when the render is finished
+    const nonstd::optional<RenderError>& Get() const { return m_error; }
+
+private:
+    std::atomic<bool> m_hasError{false};
+    std::mutex m_guard;
+    nonstd::optional<RenderError> m_error;
+};
 
 struct IRendererCallback
 {
     virtual TargetString GetAsTargetString(const InternalValue& val) = 0;
+    // Renders the value to the end of the string (e.g. the one produced by GetAsTargetString) without the temporary string
+    virtual void AppendAsTargetString(TargetString& str, const InternalValue& val) = 0;
     virtual OutStream GetStreamOnString(TargetString& str) = 0;
     virtual nonstd::variant<EmptyValue,
         nonstd::expected<std::shared_ptr<TemplateImpl<char>>, ErrorInfo>,
@@ -24,14 +64,123 @@ struct IRendererCallback
     virtual nonstd::variant<EmptyValue,
         nonstd::expected<std::shared_ptr<TemplateImpl<char>>, ErrorInfo>,
         nonstd::expected<std::shared_ptr<TemplateImpl<wchar_t>>, ErrorInfoW>> LoadTemplate(const InternalValue& fileName) const = 0;
-    virtual void ThrowRuntimeError(ErrorCode code, ValuesList extraParams) = 0;
+    virtual RenderError MakeRuntimeError(ErrorCode code, ValuesList extraParams) = 0;
+    // Version of the environment templates (see TemplateEnv::GetTemplatesVersion). Empty if the loaded templates can't be reused
+    // without the new request (e.g. their modifications are checked on every request)
+    virtual nonstd::optional<uint64_t> GetTemplatesVersion() const = 0;
+    // Storage of the `{% cache %}` statements bodies. Null if there is no storage (or no environment)
+    virtual IFragmentCache* GetFragmentCache() const = 0;
+};
+
+// Storage for the scope maps shared by all the contexts of one render call. Maps released on scope exit keep their
+// allocated buckets and nodes, so the subsequent scopes (e.g. loop iterations) reuse them instead of hitting the heap.
+// Capture buffers (the strings the output of the statement bodies is rendered to) are kept the same way
+class ScopesPool
+{
+public:
+    InternalValueMap Acquire()
+    {
+        if (m_maps.empty())
+            return InternalValueMap();
+
+        InternalValueMap result = std::move(m_maps.back());
+        m_maps.pop_back();
+        return result;
+    }
+
+    void Release(InternalValueMap&& map)
+    {
+        if (m_maps.size() >= MaxPooledMaps)
+            return;
+
+        map.clear();
+        m_maps.push_back(std::move(map));
+    }
+
+    TargetString AcquireBuffer()
+    {
+        if (m_buffers.empty())
+            return TargetString();
+
+        TargetString result = std::move(m_buffers.back());
+        m_buffers.pop_back();
+        return result;
+    }
+
+    void ReleaseBuffer(TargetString&& buffer)
+    {
+        if (m_buffers.size() >= MaxPooledBuffers)
+            return;
+
+        nonstd::visit([](auto& str) { str.clear(); }, buffer);
+        m_buffers.push_back(std::move(buffer));
+    }
+
+private:
+    static constexpr size_t MaxPooledMaps = 32;
+    static constexpr size_t MaxPooledBuffers = 8;
+    std::vector<InternalValueMap> m_maps;
+    std::vector<TargetString> m_buffers;
+};
+
+// Parameters of the render call. Values are converted to the internal representation on the first access, so the parameters
+// which aren't used by the template cost nothing
+// Names of the params looked up by the render (see IncrementalRenderState). Shared by the copies of the external scope made for the
+// parallel render, hence the lock
+class ParamReadsRecorder
+{
+public:
+    void Add(const std::string& name)
+    {
+        std::lock_guard<std::mutex> l(m_guard);
+        m_names.insert(name);
+    }
+    std::unordered_set<std::string> Take()
+    {
+        std::lock_guard<std::mutex> l(m_guard);
+        auto result = std::move(m_names);
+        m_names.clear();
+        return result;
+    }
+
+private:
+    std::mutex m_guard;
+    std::unordered_set<std::string> m_names;
+};
+
+class ExternalScope
+{
+public:
+    ExternalScope() = default;
+    explicit ExternalScope(const ValuesMap& params)
+        : m_params(&params)
+    {
+    }
+
+    InternalValueMap::const_iterator Find(const std::string& name, bool& found) const;
+    InternalValueMap::const_iterator Find(const HashedName& name, bool& found) const;
+
+    // Drops the converted value of the changed (or removed) parameter. Should be called before modification of the parameter
+    void Invalidate(const std::string& name) { m_values.erase(name); }
+    void InvalidateAll() { m_values.clear(); }
+    // Lookups of the params (including the ones of the absent params) are reported to the recorder while it's set
+    void SetReadsRecorder(ParamReadsRecorder* recorder) { m_readsRecorder = recorder; }
+
+private:
+    template<typename Name>
+    InternalValueMap::const_iterator FindImpl(const Name& name, bool& found) const;
+
+    const ValuesMap* m_params = nullptr;
+    mutable InternalValueMap m_values;
+    ParamReadsRecorder* m_readsRecorder = nullptr;
 };
 
 class RenderContext
 {
 public:
-    RenderContext(const InternalValueMap& extValues, const InternalValueMap& globalValues, IRendererCallback* rendererCallback)
+    RenderContext(const ExternalScope& extValues, const InternalValueMap& globalValues, IRendererCallback* rendererCallback, ScopesPool* scopesPool = nullptr)
         : m_rendererCallback(rendererCallback)
+        , m_scopesPool(scopesPool)
     {
         m_externalScope = &extValues;
         m_globalScope = &globalValues;
@@ -45,19 +194,29 @@ public:
         , m_scopes(other.m_scopes)
         , m_rendererCallback(other.m_rendererCallback)
         , m_boundScope(other.m_boundScope)
+        , m_scopesPool(other.m_scopesPool)
+        , m_limiter(other.m_limiter)
+        , m_profiler(other.m_profiler)
+        , m_errorState(other.m_errorState)
+        , m_membershipIndexes(other.m_membershipIndexes)
+        , m_parallelFilters(other.m_parallelFilters)
+        , m_nestingDepth(other.m_nestingDepth)
     {   
+        // Slot bindings refer to the values stored in the scopes of 'other' and aren't copied. Values are looked up by name instead
         m_currentScope = &m_scopes.back();
     }
 
     InternalValueMap& EnterScope()
     {
-        m_scopes.push_back(InternalValueMap());
+        m_scopes.push_back(m_scopesPool ? m_scopesPool->Acquire() : InternalValueMap());
         m_currentScope = &m_scopes.back();
         return *m_currentScope;
     }
 
     void ExitScope()
     {
+        if (m_scopesPool)
+            m_scopesPool->Release(std::move(m_scopes.back()));
         m_scopes.pop_back();
         if (!m_scopes.empty())
             m_currentScope = &m_scopes.back();
@@ -65,36 +224,23 @@ public:
             m_currentScope = nullptr;
     }
 
-    auto FindValue(const std::string& val, bool& found) const
+    // Buffer for the output captured within the statement (see IRendererCallback::GetStreamOnString) and used before the statement
+    // ends. Released buffer keeps its capacity for the next capture
+    TargetString AcquireCaptureBuffer() { return m_scopesPool ? m_scopesPool->AcquireBuffer() : TargetString(); }
+    void ReleaseCaptureBuffer(TargetString&& buffer)
     {
-        auto finder = [&val, &found](auto& map) mutable
-        {
-            auto p = map.find(val);
-            if (p != map.end())
-                found = true;
-
-            return p;
-        };
-
-        if (m_boundScope)
-        {
-            auto valP = finder(*m_boundScope);
-            if (found)
-                return valP;
-        }
-
-        for (auto p = m_scopes.rbegin(); p != m_scopes.rend(); ++ p)
-        {
-            auto valP = finder(*p);
-            if (found)
-                return valP;
-        }
+        if (m_scopesPool)
+            m_scopesPool->ReleaseBuffer(std::move(buffer));
+    }
 
-        auto valP = finder(*m_externalScope);
-        if (found)
-            return valP;
+    InternalValueMap::const_iterator FindValue(const std::string& val, bool& found) const
+    {
+        return FindValueImpl(val, found);
+    }
 
-        return finder(*m_globalScope);
+    InternalValueMap::const_iterator FindValue(const HashedName& val, bool& found) const
+    {
+        return FindValueImpl(val, found);
     }
 
     auto& GetCurrentScope() const
@@ -117,23 +263,222 @@ public:
     RenderContext Clone(bool includeCurrentContext) const
     {
         if (!includeCurrentContext)
-            return RenderContext(m_emptyScope, *m_globalScope, m_rendererCallback);
+        {
+            RenderContext result(m_emptyScope, *m_globalScope, m_rendererCallback, m_scopesPool);
+            result.m_limiter = m_limiter;
+            result.m_profiler = m_profiler;
+            result.m_errorState = m_errorState;
+            result.m_membershipIndexes = m_membershipIndexes;
+            result.m_parallelFilters = m_parallelFilters;
+            result.m_nestingDepth = m_nestingDepth;
+            return result;
+        }
 
         return RenderContext(*this);
     }
+    // Copy of the context for the render on the other thread. Converted params cache and pooled maps aren't shared with this context,
+    // the variables set by the render go to the new scope
+    RenderContext Fork(const ExternalScope& extValues, ScopesPool* scopesPool) const
+    {
+        RenderContext result(*this);
+        result.m_externalScope = &extValues;
+        result.m_scopesPool = scopesPool;
+        result.EnterScope();
+        return result;
+    }
+    auto& GetExternalScope() const
+    {
+        return *m_externalScope;
+    }
 
-    void BindScope(InternalValueMap* scope)
+    void BindScope(const InternalValueMap* scope)
     {
         m_boundScope = scope;
     }
+
+    // Binds the local variable slot (allocated at parse time for the loop variables) to the value stored in one of the scopes
+    void BindSlot(const void* owner, size_t index, InternalValue* value)
+    {
+        m_slots.push_back(SlotBinding{owner, index, value});
+    }
+    size_t GetSlotsCount() const
+    {
+        return m_slots.size();
+    }
+    void UnbindSlots(size_t count)
+    {
+        m_slots.erase(m_slots.begin() + count, m_slots.end());
+    }
+    const InternalValue* FindSlotValue(const void* owner, size_t index) const
+    {
+        for (auto p = m_slots.rbegin(); p != m_slots.rend(); ++ p)
+        {
+            if (p->owner == owner && p->index == index)
+                return p->value;
+        }
+
+        return nullptr;
+    }
+
+    // Limits of the render (null if the render isn't limited). Set for the root context and inherited by the derived ones
+    void SetLimiter(RenderLimiter* limiter)
+    {
+        m_limiter = limiter;
+    }
+    // Called on every loop iteration and call. The caller should stop if the limit is exceeded (see HasError)
+    void CountStep()
+    {
+        if (!m_limiter || HasError())
+            return;
+
+        auto exceededLimit = m_limiter->CountStep();
+        if (exceededLimit)
+            SetLimitError(exceededLimit);
+    }
+
+    // Call tree of the profiled render (null if the render isn't profiled). Set for the root context and inherited by the derived ones
+    void SetProfiler(RenderProfiler* profiler)
+    {
+        m_profiler = profiler;
+    }
+    RenderProfiler* GetProfiler() const
+    {
+        return m_profiler;
+    }
+
+    // Errors of the render (null if the errors are thrown). Set for the root context and inherited by the derived ones
+    void SetErrorState(RenderErrorState* errorState)
+    {
+        m_errorState = errorState;
+    }
+    // Reports the runtime error. The render isn't interrupted at once: the statements stop at the next boundary (see HasError), so the
+    // failed render costs about the same as the successful one. Contexts without the error state throw the error
+    void SetError(RenderError error)
+    {
+        if (m_errorState)
+        {
+            m_errorState->Set(std::move(error));
+            return;
+        }
+
+        nonstd::visit([](auto& e) { throw e; }, error);
+    }
+    void SetRuntimeError(ErrorCode code, ValuesList extraParams)
+    {
+        SetError(m_rendererCallback->MakeRuntimeError(code, std::move(extraParams)));
+    }
+    void SetLimitError(const char* limitName)
+    {
+        SetRuntimeError(ErrorCode::RenderLimitExceeded, ValuesList{Value(std::string(limitName))});
+    }
+    // Checked by the statements between their children and iterations
+    bool HasError() const
+    {
+        return m_errorState && m_errorState->HasError();
+    }
+
+    // Indexes of the lists probed by the 'in' tests (null if the indexing is disabled). Set for the root context and inherited by the derived ones
+    void SetMembershipIndexes(MembershipIndexCache* indexes)
+    {
+        m_membershipIndexes = indexes;
+    }
+    MembershipIndexCache* GetMembershipIndexes() const
+    {
+        return m_membershipIndexes;
+    }
+
+    // Executor of the filters over the large lists (null if the parallel execution is disabled). Set for the root context and inherited
+    // by the derived ones
+    void SetParallelFilters(const ParallelFilterExecutor* executor)
+    {
+        m_parallelFilters = executor;
+    }
+    const ParallelFilterExecutor* GetParallelFilters() const
+    {
+        return m_parallelFilters;
+    }
+
+    // Nested macro call, include, import or recursive loop. Depth of the nesting is checked against the render limits. The caller should
+    // stop if the limit is exceeded (see HasError)
+    class NestingGuard
+    {
+    public:
+        explicit NestingGuard(RenderContext& context)
+            : m_context(context)
+        {
+            auto exceededLimit = context.m_limiter ? context.m_limiter->CheckDepth(context.m_nestingDepth + 1) : nullptr;
+            if (exceededLimit)
+                context.SetLimitError(exceededLimit);
+            ++ context.m_nestingDepth;
+        }
+        ~NestingGuard()
+        {
+            -- m_context.m_nestingDepth;
+        }
+
+        NestingGuard(const NestingGuard&) = delete;
+        NestingGuard& operator=(const NestingGuard&) = delete;
+
+    private:
+        RenderContext& m_context;
+    };
+
 private:
+    template<typename Name>
+    InternalValueMap::const_iterator FindValueImpl(const Name& val, bool& found) const
+    {
+        auto finder = [&val, &found](auto& map) mutable
+        {
+            auto p = FindByName(map, val);
+            if (p != map.end())
+                found = true;
+
+            return p;
+        };
+
+        if (m_boundScope)
+        {
+            auto valP = finder(*m_boundScope);
+            if (found)
+                return valP;
+        }
+
+        for (auto p = m_scopes.rbegin(); p != m_scopes.rend(); ++ p)
+        {
+            auto valP = finder(*p);
+            if (found)
+                return valP;
+        }
+
+        auto valP = m_externalScope->Find(val, found);
+        if (found)
+            return valP;
+
+        return finder(*m_globalScope);
+    }
+
+    struct SlotBinding
+    {
+        const void* owner;
+        size_t index;
+        InternalValue* value;
+    };
+
     InternalValueMap* m_currentScope;
-    const InternalValueMap* m_externalScope;
+    const ExternalScope* m_externalScope;
     const InternalValueMap* m_globalScope;
-    InternalValueMap m_emptyScope;
+    ExternalScope m_emptyScope;
     std::deque<InternalValueMap> m_scopes;
     IRendererCallback* m_rendererCallback;
     const InternalValueMap* m_boundScope = nullptr;
+    std::vector<SlotBinding> m_slots;
+    ScopesPool* m_scopesPool = nullptr;
+    RenderLimiter* m_limiter = nullptr;
+    RenderProfiler* m_profiler = nullptr;
+    RenderErrorState* m_errorState = nullptr;
+    MembershipIndexCache* m_membershipIndexes = nullptr;
+    const ParallelFilterExecutor* m_parallelFilters = nullptr;
+    size_t m_nestingDepth = 0;
 };
 } // jinja2
 
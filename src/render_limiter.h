@@ -0,0 +1,61 @@
+#ifndef RENDER_LIMITER_H
+#define RENDER_LIMITER_H
+
+#include <jinja2cpp/template_env.h>
+
+#include <nonstd/optional.hpp>
+
+#include <atomic>
+#include <chrono>
+
+namespace jinja2
+{
+// State of the limits of the single render call (see Settings::RenderLimits). Shared by all the contexts of the render, including the
+// ones forked for the parallel render. Output size is limited by LimitedStreamWriter. Checks return the name of the exceeded limit (null
+// if none), which is reported as ErrorCode::RenderLimitExceeded (see RenderContext::SetLimitError)
+class RenderLimiter
+{
+public:
+    explicit RenderLimiter(const Settings::RenderLimits& limits)
+        : m_maxSteps(limits.maxSteps)
+        , m_maxDepth(limits.maxRecursionDepth)
+    {
+        if (limits.timeout.count() > 0)
+            m_deadline = Clock::now() + limits.timeout;
+    }
+
+    static bool IsRequired(const Settings::RenderLimits& limits)
+    {
+        return limits.timeout.count() > 0 || limits.maxSteps != 0 || limits.maxRecursionDepth != 0;
+    }
+
+    const char* CountStep()
+    {
+        auto steps = m_steps.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (m_maxSteps != 0 && steps > m_maxSteps)
+            return "maxSteps";
+        if (m_deadline && steps % DeadlineCheckPeriod == 0 && Clock::now() > m_deadline.value())
+            return "timeout";
+        return nullptr;
+    }
+
+    const char* CheckDepth(size_t depth) const
+    {
+        if (m_maxDepth != 0 && depth > m_maxDepth)
+            return "maxRecursionDepth";
+        return nullptr;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    // Clock is read once per this number of steps
+    static constexpr size_t DeadlineCheckPeriod = 64;
+
+    size_t m_maxSteps;
+    size_t m_maxDepth;
+    nonstd::optional<Clock::time_point> m_deadline;
+    std::atomic<size_t> m_steps{0};
+};
+} // jinja2
+
+#endif // RENDER_LIMITER_H
@@ -0,0 +1,86 @@
+#ifndef RENDER_PROFILE_BINDER_H
+#define RENDER_PROFILE_BINDER_H
+
+#include "renderer.h"
+#include "statements.h"
+
+#include <functional>
+#include <vector>
+
+namespace jinja2
+{
+// Load time pass which attaches the profiled children info to all the composed renderers of the tree (see Settings::profileRender).
+// 'getInfo' fills the info of the renderer and returns false if the renderer shouldn't be profiled
+class RenderProfileBinder : public StatementVisitor
+{
+public:
+    using InfoGetter = std::function<bool (const RendererBase* renderer, ProfiledNodeInfo& info)>;
+    using StatementVisitor::DoVisit;
+
+    static void Bind(const RendererPtr& root, InfoGetter getInfo)
+    {
+        RenderProfileBinder binder(std::move(getInfo));
+        binder.VisitRenderer(root);
+    }
+
+    void DoVisit(ComposedRenderer* renderer) override
+    {
+        std::vector<ProfiledNodeInfo> info(renderer->GetRenderers().size());
+        bool hasProfiledChildren = false;
+        for (size_t idx = 0; idx != info.size(); ++ idx)
+        {
+            auto& r = renderer->GetRenderers()[idx];
+            VisitRenderer(r);
+            if (!m_getInfo(r.get(), info[idx]))
+                info[idx] = ProfiledNodeInfo();
+            else
+                hasProfiledChildren = true;
+        }
+
+        if (hasProfiledChildren)
+            renderer->SetProfileInfo(std::move(info));
+    }
+    void DoVisit(IfStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        for (auto& b : stmt->GetElseBranches())
+            VisitRenderer(b->GetMainBody());
+    }
+    void DoVisit(ForStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        VisitRenderer(stmt->GetElseBody());
+    }
+    void DoVisit(SetBlockStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(ParentBlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(BlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(ExtendsStatement* stmt) override
+    {
+        for (auto& b : stmt->GetBlocks())
+            VisitRenderer(b.second);
+    }
+    void DoVisit(MacroStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(MacroCallStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(WithStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(FilterStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(CacheStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+
+private:
+    explicit RenderProfileBinder(InfoGetter getInfo)
+        : m_getInfo(std::move(getInfo))
+    {
+    }
+
+    void VisitRenderer(const RendererPtr& renderer)
+    {
+        auto visitable = dynamic_cast<VisitableStatement*>(renderer.get());
+        if (visitable)
+            visitable->ApplyVisitor(this);
+    }
+
+private:
+    InfoGetter m_getInfo;
+};
+} // jinja2
+
+#endif // RENDER_PROFILE_BINDER_H
@@ -0,0 +1,180 @@
+#include "render_profiler.h"
+#include "renderer.h"
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <algorithm>
+#include <tuple>
+
+namespace jinja2
+{
+namespace
+{
+// Frame of the folded stack. ';' separates the frames, so it's replaced in the source text
+std::string MakeFrameName(const RenderProfileNode& node)
+{
+    auto result = node.location.fileName + ":" + std::to_string(node.location.line) + " " + node.description;
+    std::replace(result.begin(), result.end(), ';', ',');
+    return result;
+}
+
+double ToMicroseconds(std::chrono::nanoseconds time)
+{
+    return static_cast<double>(time.count()) / 1000;
+}
+} // namespace
+
+constexpr size_t RenderProfile::NoParent;
+
+size_t RenderProfiler::Enter(const ProfiledNodeInfo& info)
+{
+    auto p = m_nodesIndex.find(std::make_pair(m_current, &info));
+    if (p != m_nodesIndex.end())
+        return p->second;
+
+    Node node;
+    node.description = info.description;
+    node.location = info.location;
+    node.parent = m_current;
+    m_nodes.push_back(std::move(node));
+    auto idx = m_nodes.size() - 1;
+    m_nodesIndex.emplace(std::make_pair(m_current, &info), idx);
+    return idx;
+}
+
+void RenderProfiler::MergeTo(RenderProfile& profile) const
+{
+    using NodeKey = std::tuple<size_t, std::string, unsigned, unsigned>;
+    auto makeKey = [](size_t parent, const SourceLocation& loc) { return NodeKey(parent, loc.fileName, loc.line, loc.col); };
+
+    std::map<NodeKey, size_t> profileIndex;
+    for (size_t idx = 0; idx != profile.nodes.size(); ++ idx)
+        profileIndex.emplace(makeKey(profile.nodes[idx].parent, profile.nodes[idx].location), idx);
+
+    // Parents precede their children in both lists
+    std::vector<size_t> mergedIndices(m_nodes.size());
+    for (size_t idx = 0; idx != m_nodes.size(); ++ idx)
+    {
+        auto& node = m_nodes[idx];
+        auto parent = node.parent == RenderProfile::NoParent ? RenderProfile::NoParent : mergedIndices[node.parent];
+        auto p = profileIndex.find(makeKey(parent, node.location));
+        if (p == profileIndex.end())
+        {
+            RenderProfileNode newNode;
+            newNode.description = node.description;
+            newNode.location = node.location;
+            newNode.parent = parent;
+            profile.nodes.push_back(std::move(newNode));
+            p = profileIndex.emplace(makeKey(parent, node.location), profile.nodes.size() - 1).first;
+        }
+
+        auto& merged = profile.nodes[p->second];
+        merged.callsCount += node.callsCount;
+        merged.inclusiveTime += std::chrono::duration_cast<std::chrono::nanoseconds>(node.time);
+        mergedIndices[idx] = p->second;
+    }
+
+    for (auto& node : profile.nodes)
+        node.exclusiveTime = node.inclusiveTime;
+    for (auto& node : profile.nodes)
+    {
+        if (node.parent != RenderProfile::NoParent)
+            profile.nodes[node.parent].exclusiveTime -= node.inclusiveTime;
+    }
+}
+
+std::string RenderProfile::ToFoldedStacks() const
+{
+    std::vector<std::string> stacks(nodes.size());
+    std::string result;
+    for (size_t idx = 0; idx != nodes.size(); ++ idx)
+    {
+        auto& node = nodes[idx];
+        stacks[idx] = node.parent == NoParent ? MakeFrameName(node) : stacks[node.parent] + ";" + MakeFrameName(node);
+        if (node.exclusiveTime.count() <= 0)
+            continue;
+
+        result += stacks[idx] + " " + std::to_string(node.exclusiveTime.count()) + "\n";
+    }
+
+    return result;
+}
+
+std::string RenderProfile::ToChromeTrace() const
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+    // Start of the next child of the node. Top-level nodes follow each other from the zero time
+    std::vector<std::chrono::nanoseconds> nextStart(nodes.size());
+    std::chrono::nanoseconds nextTopLevelStart{0};
+
+    writer.StartObject();
+    writer.Key("traceEvents");
+    writer.StartArray();
+    for (size_t idx = 0; idx != nodes.size(); ++ idx)
+    {
+        auto& node = nodes[idx];
+        auto& start = node.parent == NoParent ? nextTopLevelStart : nextStart[node.parent];
+        nextStart[idx] = start;
+
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(node.description.c_str(), static_cast<rapidjson::SizeType>(node.description.size()));
+        writer.Key("cat");
+        writer.String(node.location.fileName.c_str(), static_cast<rapidjson::SizeType>(node.location.fileName.size()));
+        writer.Key("ph");
+        writer.String("X");
+        writer.Key("ts");
+        writer.Double(ToMicroseconds(start));
+        writer.Key("dur");
+        writer.Double(ToMicroseconds(node.inclusiveTime));
+        writer.Key("pid");
+        writer.Int(1);
+        writer.Key("tid");
+        writer.Int(1);
+        writer.Key("args");
+        writer.StartObject();
+        writer.Key("line");
+        writer.Uint(node.location.line);
+        writer.Key("col");
+        writer.Uint(node.location.col);
+        writer.Key("calls");
+        writer.Uint64(node.callsCount);
+        writer.Key("selfTimeUs");
+        writer.Double(ToMicroseconds(node.exclusiveTime));
+        writer.EndObject();
+        writer.EndObject();
+
+        start += node.inclusiveTime;
+    }
+    writer.EndArray();
+    writer.Key("displayTimeUnit");
+    writer.String("ns");
+    writer.EndObject();
+
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+void ComposedRenderer::RenderProfiled(OutStream& os, RenderContext& values)
+{
+    auto& profiler = *values.GetProfiler();
+    for (size_t idx = 0; idx != m_renderers.size(); ++ idx)
+    {
+        auto& info = m_profileInfo[idx];
+        if (info.location.line == 0)
+        {
+            m_renderers[idx]->Render(os, values);
+        }
+        else
+        {
+            RenderProfiler::Scope scope(profiler, info);
+            m_renderers[idx]->Render(os, values);
+        }
+
+        if (values.HasError())
+            return;
+    }
+}
+} // jinja2
@@ -0,0 +1,77 @@
+#ifndef RENDER_PROFILER_H
+#define RENDER_PROFILER_H
+
+#include <jinja2cpp/render_profile.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace jinja2
+{
+// Statement or expression which is profiled by the render (see Settings::profileRender). Attached at load time to the composed
+// renderers for each of their children. Children without the location (line is zero) aren't profiled
+struct ProfiledNodeInfo
+{
+    std::string description;
+    SourceLocation location;
+};
+
+// Call tree of the single render call. Merged to the profile of the template when the render is finished
+class RenderProfiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Render of the node within the current one
+    class Scope
+    {
+    public:
+        Scope(RenderProfiler& profiler, const ProfiledNodeInfo& info)
+            : m_profiler(profiler)
+            , m_parent(profiler.m_current)
+        {
+            profiler.m_current = profiler.Enter(info);
+            m_start = Clock::now();
+        }
+        ~Scope()
+        {
+            auto& node = m_profiler.m_nodes[m_profiler.m_current];
+            ++ node.callsCount;
+            node.time += Clock::now() - m_start;
+            m_profiler.m_current = m_parent;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        RenderProfiler& m_profiler;
+        size_t m_parent;
+        Clock::time_point m_start;
+    };
+
+    void MergeTo(RenderProfile& profile) const;
+
+private:
+    size_t Enter(const ProfiledNodeInfo& info);
+
+    struct Node
+    {
+        std::string description;
+        SourceLocation location;
+        size_t parent;
+        uint64_t callsCount = 0;
+        Clock::duration time{0};
+    };
+
+    std::vector<Node> m_nodes;
+    // Nodes of the tree by the parent node and the profiled child
+    std::map<std::pair<size_t, const ProfiledNodeInfo*>, size_t> m_nodesIndex;
+    size_t m_current = RenderProfile::NoParent;
+};
+} // jinja2
+
+#endif // RENDER_PROFILER_H
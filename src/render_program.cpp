@@ -0,0 +1,519 @@
+#include "render_program.h"
+
+#include "value_visitors.h"
+
+#include <boost/container/small_vector.hpp>
+
+#include <algorithm>
+
+namespace jinja2
+{
+
+namespace
+{
+// Value on the stack of the interpreter. Literals of the expressions are borrowed instead of copied, the same way as with
+// ExpressionEvaluatorBase::EvaluateRef
+struct Operand
+{
+    Operand() = default;
+    Operand(InternalValue val)
+        : value(std::move(val))
+    {
+    }
+
+    const InternalValue& Get() const { return literal ? *literal : value; }
+    InternalValue& GetMutable()
+    {
+        if (literal)
+        {
+            value = *literal;
+            literal = nullptr;
+        }
+        return value;
+    }
+    // Operand which may be consumed by the operation (see BinaryExpression::Evaluate)
+    InternalValue* GetTemp() { return literal ? nullptr : &value; }
+
+    InternalValue value;
+    const InternalValue* literal = nullptr;
+};
+
+// Loop run by the program. Iterator may refer to the items, so both stay in place until the loop is finished
+struct ActiveLoop
+{
+    ActiveLoop(ForStatement* stmt, Operand loopItems, RenderContext& values)
+        : items(std::move(loopItems))
+        , iterator(stmt, items.Get(), values, 0)
+    {
+    }
+
+    Operand items;
+    ForStatement::LoopIterator iterator;
+    bool isInBody = false;
+};
+
+InternalValue FindVar(const ValueRefExpression& ref, RenderContext& values)
+{
+    bool found = false;
+    auto p = values.FindValue(ref.GetHashedName(), found);
+    if (found)
+        return p->second;
+
+    return InternalValue();
+}
+} // namespace
+
+std::shared_ptr<const RenderProgram> RenderProgram::Compile(ComposedRenderer& renderer)
+{
+    auto result = std::make_shared<RenderProgram>();
+    result->CompileRenderers(renderer.GetRenderers());
+
+    auto& instructions = result->m_instructions;
+    if (std::all_of(instructions.begin(), instructions.end(), [](auto& i) { return i.op == RenderNode; }))
+        return std::shared_ptr<const RenderProgram>();
+
+    instructions.shrink_to_fit();
+    return result;
+}
+
+void RenderProgram::CompileRenderers(const std::vector<RendererPtr>& renderers)
+{
+    for (auto& r : renderers)
+        CompileRenderer(r);
+}
+
+void RenderProgram::CompileRenderer(const RendererPtr& renderer)
+{
+    if (!renderer)
+        return;
+
+    auto r = renderer.get();
+    if (auto text = dynamic_cast<RawTextRenderer*>(r))
+    {
+        if (text->GetLength() != 0)
+            Emit(EmitText, text->GetPtr(), text->GetLength());
+        return;
+    }
+    if (auto expr = dynamic_cast<ExpressionRenderer*>(r))
+    {
+        CompileOutput(*expr);
+        return;
+    }
+    if (auto stmt = dynamic_cast<IfStatement*>(r))
+    {
+        CompileIf(*stmt);
+        return;
+    }
+    if (auto stmt = dynamic_cast<ForStatement*>(r))
+    {
+        CompileFor(*stmt);
+        return;
+    }
+    if (auto stmt = dynamic_cast<SetLineStatement*>(r))
+    {
+        if (stmt->GetExpression())
+        {
+            CompileExpression(stmt->GetExpression());
+            Emit(StoreVars, stmt);
+        }
+        return;
+    }
+    auto composed = dynamic_cast<ComposedRenderer*>(r);
+    if (composed && !composed->IsParallel())
+    {
+        CompileRenderers(composed->GetRenderers());
+        return;
+    }
+
+    Emit(RenderNode, r);
+}
+
+// Calls are rendered directly to the output (see CallExpression::Render), the rest of the expressions are evaluated and written
+void RenderProgram::CompileOutput(const ExpressionRenderer& renderer)
+{
+    auto expr = renderer.GetExpression();
+    auto full = dynamic_cast<FullExpressionEvaluator*>(expr.get());
+    while (full && !full->GetTester() && full->GetExpression())
+    {
+        expr = full->GetExpression();
+        full = dynamic_cast<FullExpressionEvaluator*>(expr.get());
+    }
+
+    if (auto call = dynamic_cast<CallExpression*>(expr.get()))
+    {
+        CompileExpression(call->GetValueRef());
+        Emit(RenderCall, call, 0, renderer.IsAutoescape());
+        return;
+    }
+
+    CompileExpression(expr);
+    Emit(EmitValue, nullptr, 0, renderer.IsAutoescape());
+}
+
+// Condition of every branch jumps to the next branch if it's false. Rendered branch jumps to the end of the statement
+void RenderProgram::CompileIf(IfStatement& stmt)
+{
+    const size_t noJump = static_cast<size_t>(-1);
+    std::vector<size_t> exitJumps;
+
+    CompileExpression(stmt.GetCondition());
+    size_t branchJump = Emit(JumpIfFalse);
+    CompileRenderer(stmt.GetMainBody());
+    for (auto& b : stmt.GetElseBranches())
+    {
+        // Branches after the unconditional one are never rendered
+        if (branchJump == noJump)
+            break;
+
+        exitJumps.push_back(Emit(Jump));
+        m_instructions[branchJump].arg = m_instructions.size();
+        auto& cond = b->GetCondition();
+        branchJump = noJump;
+        if (cond)
+        {
+            CompileExpression(cond);
+            branchJump = Emit(JumpIfFalse);
+        }
+        CompileRenderer(b->GetMainBody());
+    }
+
+    auto end = m_instructions.size();
+    if (branchJump != noJump)
+        m_instructions[branchJump].arg = end;
+    for (auto j : exitJumps)
+        m_instructions[j].arg = end;
+}
+
+// Items are iterated by ForStatement::LoopIterator, the same as by the tree render:
+//     <items> ForBegin; next: ForNext(done) <body> ForStep(next); done: ForEnd(exit) <else body>; exit: ForExit
+void RenderProgram::CompileFor(ForStatement& stmt)
+{
+    CompileExpression(stmt.GetLoopValue());
+    Emit(ForBegin, &stmt);
+    auto next = Emit(ForNext, &stmt);
+    CompileRenderer(stmt.GetMainBody());
+    Emit(ForStep, nullptr, next);
+    auto done = Emit(ForEnd);
+    m_instructions[next].arg = done;
+    CompileRenderer(stmt.GetElseBody());
+    m_instructions[done].arg = Emit(ForExit);
+}
+
+void RenderProgram::CompileExpression(const ExpressionEvaluatorPtr<>& expr)
+{
+    auto e = expr.get();
+    if (!e)
+    {
+        Emit(PushEmpty);
+        return;
+    }
+
+    if (auto literal = e->GetLiteralValue())
+    {
+        Emit(PushLiteral, literal);
+        return;
+    }
+
+    if (auto full = dynamic_cast<FullExpressionEvaluator*>(e))
+    {
+        if (!full->GetExpression())
+        {
+            Emit(PushEmpty);
+            return;
+        }
+
+        CompileExpression(full->GetExpression());
+        // 'value if condition else alt': the value is replaced with the alternative one if the condition is false
+        if (auto& tester = full->GetTester())
+        {
+            CompileExpression(tester->GetTestExpression());
+            auto jump = Emit(JumpIfTrue);
+            Emit(Pop);
+            CompileExpression(tester->GetAltValue());
+            m_instructions[jump].arg = m_instructions.size();
+        }
+        return;
+    }
+
+    if (auto ref = dynamic_cast<ValueRefExpression*>(e))
+    {
+        Emit(ref->GetSlotOwner() ? LoadSlot : LoadVar, ref);
+        return;
+    }
+
+    if (auto subscript = dynamic_cast<SubscriptExpression*>(e))
+    {
+        CompileExpression(subscript->GetValue());
+        for (size_t n = 0; n != subscript->GetIndicesCount(); ++ n)
+        {
+            if (subscript->IsNamedIndex(n))
+            {
+                Emit(GetAttr, subscript, n);
+                continue;
+            }
+
+            CompileExpression(subscript->GetIndex(n));
+            Emit(GetItem, subscript, n);
+        }
+        return;
+    }
+
+    if (auto filtered = dynamic_cast<FilteredExpression*>(e))
+    {
+        CompileExpression(filtered->GetExpression());
+        CompileFilter(*filtered->GetFilter());
+        return;
+    }
+
+    if (auto unary = dynamic_cast<UnaryExpression*>(e))
+    {
+        CompileExpression(unary->GetExpression());
+        Emit(UnaryOp, nullptr, unary->GetOperation());
+        return;
+    }
+
+    if (auto test = dynamic_cast<IsExpression*>(e))
+    {
+        CompileExpression(test->GetValue());
+        Emit(CallTester, test->GetTester().get());
+        return;
+    }
+
+    if (auto binary = dynamic_cast<BinaryExpression*>(e))
+    {
+        CompileExpression(binary->GetLeftExpression());
+        if (binary->GetOperation() == BinaryExpression::In)
+        {
+            Emit(CallTester, binary->GetInTester().get());
+            return;
+        }
+
+        CompileExpression(binary->GetRightExpression());
+        Emit(BinaryOp, binary);
+        return;
+    }
+
+    if (auto tuple = dynamic_cast<TupleCreator*>(e))
+    {
+        auto& items = tuple->GetExprs();
+        for (auto& item : items)
+            CompileExpression(item);
+        Emit(MakeList, nullptr, items.size());
+        return;
+    }
+
+    if (auto call = dynamic_cast<CallExpression*>(e))
+    {
+        CompileExpression(call->GetValueRef());
+        Emit(Call, call);
+        return;
+    }
+
+    Emit(EvalNode, e);
+}
+
+// Parent filters of the chain are applied first
+void RenderProgram::CompileFilter(const ExpressionFilter& filter)
+{
+    if (auto& parent = filter.GetParentFilter())
+        CompileFilter(*parent);
+
+    Emit(CallFilter, filter.GetFilter().get());
+}
+
+size_t RenderProgram::Emit(OpCode op, const void* ptr, size_t arg, bool autoescape)
+{
+    m_instructions.push_back(Instruction{op, autoescape, const_cast<void*>(ptr), arg});
+    return m_instructions.size() - 1;
+}
+
+void RenderProgram::Execute(OutStream& os, RenderContext& values) const
+{
+    boost::container::small_vector<Operand, 8> stack;
+    boost::container::small_vector<std::unique_ptr<ActiveLoop>, 2> loops;
+    auto pop = [&stack]() {
+        auto result = std::move(stack.back());
+        stack.pop_back();
+        return result;
+    };
+
+    auto instructions = m_instructions.data();
+    auto count = m_instructions.size();
+    size_t pc = 0;
+    while (pc < count)
+    {
+        auto& i = instructions[pc ++];
+        bool isStatementEnd = false;
+        switch (i.op)
+        {
+        case EmitText:
+            os.WriteStaticBuffer(i.ptr, i.arg);
+            break;
+        case EmitValue:
+        {
+            auto val = pop();
+            bool prevAutoescape = os.SetAutoescape(i.autoescape);
+            os.WriteValue(val.Get());
+            os.SetAutoescape(prevAutoescape);
+            isStatementEnd = true;
+            break;
+        }
+        case RenderCall:
+        {
+            auto fn = pop();
+            bool prevAutoescape = os.SetAutoescape(i.autoescape);
+            static_cast<CallExpression*>(i.ptr)->RenderCall(std::move(fn.GetMutable()), os, values);
+            os.SetAutoescape(prevAutoescape);
+            isStatementEnd = true;
+            break;
+        }
+        case RenderNode:
+            static_cast<RendererBase*>(i.ptr)->Render(os, values);
+            isStatementEnd = true;
+            break;
+        case StoreVars:
+        {
+            auto val = pop();
+            static_cast<SetLineStatement*>(i.ptr)->AssignBody(std::move(val.GetMutable()), values);
+            isStatementEnd = true;
+            break;
+        }
+        case ForBegin:
+            loops.push_back(std::make_unique<ActiveLoop>(static_cast<ForStatement*>(i.ptr), pop(), values));
+            break;
+        case ForNext:
+        {
+            auto& loop = *loops.back();
+            if (loop.iterator.MoveNext())
+            {
+                values.EnterScope();
+                loop.isInBody = true;
+            }
+            else
+                pc = i.arg;
+            break;
+        }
+        case ForStep:
+            values.ExitScope();
+            loops.back()->isInBody = false;
+            if (!values.HasError())
+                pc = i.arg;
+            break;
+        case ForEnd:
+            if (!loops.back()->iterator.Finish())
+                pc = i.arg;
+            break;
+        case ForExit:
+            loops.pop_back();
+            values.ExitScope();
+            isStatementEnd = true;
+            break;
+        case Jump:
+            pc = i.arg;
+            break;
+        case JumpIfFalse:
+            if (!ConvertToBool(pop().Get()))
+                pc = i.arg;
+            break;
+        case JumpIfTrue:
+            if (ConvertToBool(pop().Get()))
+                pc = i.arg;
+            break;
+        case PushLiteral:
+            stack.emplace_back();
+            stack.back().literal = static_cast<const InternalValue*>(i.ptr);
+            break;
+        case PushEmpty:
+            stack.emplace_back();
+            break;
+        case LoadSlot:
+        {
+            auto ref = static_cast<const ValueRefExpression*>(i.ptr);
+            auto value = values.FindSlotValue(ref->GetSlotOwner(), ref->GetSlotIndex());
+            stack.emplace_back(value ? *value : FindVar(*ref, values));
+            break;
+        }
+        case LoadVar:
+            stack.emplace_back(FindVar(*static_cast<const ValueRefExpression*>(i.ptr), values));
+            break;
+        case GetAttr:
+            static_cast<SubscriptExpression*>(i.ptr)->ApplyIndex(i.arg, stack.back().GetMutable(), nullptr, values);
+            break;
+        case GetItem:
+        {
+            auto index = pop();
+            static_cast<SubscriptExpression*>(i.ptr)->ApplyIndex(i.arg, stack.back().GetMutable(), &index.Get(), values);
+            break;
+        }
+        case CallFilter:
+        {
+            auto& top = stack.back();
+            top = Operand(static_cast<ExpressionFilter::IExpressionFilter*>(i.ptr)->Filter(top.Get(), values));
+            break;
+        }
+        case CallTester:
+        {
+            auto& top = stack.back();
+            top = Operand(static_cast<IsExpression::ITester*>(i.ptr)->Test(top.Get(), values));
+            break;
+        }
+        case UnaryOp:
+        {
+            auto& top = stack.back();
+            top = Operand(Apply<visitors::UnaryOperation>(top.Get(), static_cast<UnaryExpression::Operation>(i.arg)));
+            break;
+        }
+        case BinaryOp:
+        {
+            auto right = pop();
+            auto& left = stack.back();
+            left = Operand(static_cast<BinaryExpression*>(i.ptr)->Evaluate(left.Get(), right.Get(), left.GetTemp(), values));
+            break;
+        }
+        case MakeList:
+        {
+            InternalValueList items;
+            items.reserve(i.arg);
+            auto first = stack.end() - static_cast<std::ptrdiff_t>(i.arg);
+            for (auto p = first; p != stack.end(); ++ p)
+                items.push_back(std::move(p->GetMutable()));
+            stack.erase(first, stack.end());
+            stack.emplace_back(ListAdapter::CreateAdapter(std::move(items)));
+            break;
+        }
+        case Call:
+        {
+            auto& top = stack.back();
+            values.CountStep();
+            top = values.HasError() ? Operand() : Operand(static_cast<CallExpression*>(i.ptr)->Call(top.Get(), values));
+            break;
+        }
+        case EvalNode:
+            stack.emplace_back(static_cast<ExpressionEvaluatorBase*>(i.ptr)->Evaluate(values));
+            break;
+        case Pop:
+            stack.pop_back();
+            break;
+        }
+
+        // Same as the tree render, statements stop after the one which reported the error
+        if (isStatementEnd && values.HasError())
+            break;
+    }
+
+    // Scopes of the loops interrupted by the error
+    for (auto p = loops.rbegin(); p != loops.rend(); ++ p)
+    {
+        if ((*p)->isInBody)
+            values.ExitScope();
+        (*p)->iterator.Finish();
+        values.ExitScope();
+    }
+}
+
+void ComposedRenderer::ExecuteProgram(OutStream& os, RenderContext& values)
+{
+    m_program->Execute(os, values);
+}
+
+} // jinja2
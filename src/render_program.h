@@ -0,0 +1,136 @@
+#ifndef RENDER_PROGRAM_H
+#define RENDER_PROGRAM_H
+
+#include "renderer.h"
+#include "statements.h"
+
+#include <vector>
+
+namespace jinja2
+{
+// Linear form of the renderers tree for Settings::renderEngine == RenderEngine::Bytecode. Static text, output of the expressions and
+// the 'if', 'for' and 'set' statements of the composed renderer (and of the nested ones) are flattened to the instructions stream.
+// Expressions are compiled to the stack operations: loads of the variables, subscripts, filters and testers calls, operators and
+// function calls. The interpreter runs the stream in the single dispatch loop instead of the virtual calls of the tree nodes. The
+// rest of the statements (and expressions) are rendered by the tree nodes, their bodies have own programs
+class RenderProgram
+{
+public:
+    enum OpCode : uint8_t
+    {
+        // Statements
+        EmitText,    // Write 'arg' chars from 'ptr'
+        EmitValue,   // Pop the value and write it with the 'autoescape' mode
+        RenderCall,  // Pop the callable and render the result of the call 'ptr' (CallExpression) with the 'autoescape' mode
+        RenderNode,  // Render the tree node 'ptr'
+        StoreVars,   // Pop the value and assign it to the fields of the 'set' statement 'ptr'
+        ForBegin,    // Pop the items and enter the scope of the loop 'ptr'
+        ForNext,     // Move to the next item of the current loop and enter the body scope. Go to 'arg' at the end of the items
+        ForStep,     // Exit the body scope and go to 'arg' (the ForNext instruction) unless the render is stopped
+        ForEnd,      // Finish the iteration of the current loop. Go to 'arg' unless the else body should be rendered
+        ForExit,     // Exit the scope of the current loop
+        Jump,        // Go to 'arg'
+        JumpIfFalse, // Pop the condition and go to 'arg' if it's false
+        JumpIfTrue,  // Pop the condition and go to 'arg' if it's true
+        // Expressions
+        PushLiteral, // Push the literal 'ptr'. The literal is borrowed, not copied
+        PushEmpty,   // Push the empty value
+        LoadSlot,    // Push the value of the loop variable 'ptr' (ValueRefExpression) from the slot, or by name if it's not bound
+        LoadVar,     // Push the value of the variable 'ptr' (ValueRefExpression)
+        GetAttr,     // Replace the value on the top with its constant subscript 'arg' of 'ptr' (SubscriptExpression)
+        GetItem,     // Pop the index and replace the value on the top with its subscript 'arg' of 'ptr' (SubscriptExpression)
+        CallFilter,  // Replace the value on the top with the result of the filter 'ptr'
+        CallTester,  // Replace the value on the top with the result of the tester 'ptr'
+        UnaryOp,     // Replace the value on the top with the result of the unary operation 'arg'
+        BinaryOp,    // Pop the right operand and replace the left one with the result of the operation 'ptr' (BinaryExpression)
+        MakeList,    // Replace 'arg' values on the top with the list of them
+        Call,        // Replace the callable on the top with the result of the call 'ptr' (CallExpression)
+        EvalNode,    // Push the value of the expression 'ptr'
+        Pop          // Drop the value on the top
+    };
+
+    struct Instruction
+    {
+        OpCode op;
+        bool autoescape;
+        void* ptr;
+        size_t arg;
+    };
+
+    // Empty (null) program means the renderer gains nothing from the compilation (e.g. it consists of the single statement)
+    static std::shared_ptr<const RenderProgram> Compile(ComposedRenderer& renderer);
+
+    void Execute(OutStream& os, RenderContext& values) const;
+
+    auto& GetInstructions() const {return m_instructions;}
+
+private:
+    void CompileRenderers(const std::vector<RendererPtr>& renderers);
+    void CompileRenderer(const RendererPtr& renderer);
+    void CompileOutput(const ExpressionRenderer& renderer);
+    void CompileIf(IfStatement& stmt);
+    void CompileFor(ForStatement& stmt);
+    void CompileExpression(const ExpressionEvaluatorPtr<>& expr);
+    void CompileFilter(const ExpressionFilter& filter);
+    size_t Emit(OpCode op, const void* ptr = nullptr, size_t arg = 0, bool autoescape = false);
+
+private:
+    std::vector<Instruction> m_instructions;
+};
+
+// Load time pass which attaches the programs to all the composed renderers of the tree
+class RenderProgramCompiler : public StatementVisitor
+{
+public:
+    using StatementVisitor::DoVisit;
+
+    static void Compile(const RendererPtr& root)
+    {
+        RenderProgramCompiler compiler;
+        compiler.VisitRenderer(root);
+    }
+
+    void DoVisit(ComposedRenderer* renderer) override
+    {
+        for (auto& r : renderer->GetRenderers())
+            VisitRenderer(r);
+        // Units of the parallel render are scheduled by the composed renderer itself
+        if (!renderer->IsParallel())
+            renderer->SetProgram(RenderProgram::Compile(*renderer));
+    }
+    void DoVisit(IfStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        for (auto& b : stmt->GetElseBranches())
+            VisitRenderer(b->GetMainBody());
+    }
+    void DoVisit(ForStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        VisitRenderer(stmt->GetElseBody());
+    }
+    void DoVisit(SetBlockStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(ParentBlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(BlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(ExtendsStatement* stmt) override
+    {
+        for (auto& b : stmt->GetBlocks())
+            VisitRenderer(b.second);
+    }
+    void DoVisit(MacroStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(MacroCallStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(WithStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(FilterStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(CacheStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+
+private:
+    void VisitRenderer(const RendererPtr& renderer)
+    {
+        auto visitable = dynamic_cast<VisitableStatement*>(renderer.get());
+        if (visitable)
+            visitable->ApplyVisitor(this);
+    }
+};
+} // jinja2
+
+#endif // RENDER_PROGRAM_H
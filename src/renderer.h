@@ -7,6 +7,7 @@
 #include "expression_evaluator.h"
 #include "render_context.h"
 #include "ast_visitor.h"
+#include "ast_serializer.h"
 
 #include <iostream>
 #include <string>
@@ -20,6 +21,7 @@ class RendererBase
 public:
     virtual ~RendererBase() = default;
     virtual void Render(OutStream& os, RenderContext& values) = 0;
+    virtual void Serialize(AstWriter& writer) const;
 };
 
 class VisitableRendererBase : public RendererBase,  public VisitableStatement
@@ -28,29 +30,80 @@ class VisitableRendererBase : public RendererBase,  public VisitableStatement
 
 using RendererPtr = std::shared_ptr<RendererBase>;
 
+class RenderProgram;
+
 class ComposedRenderer : public VisitableRendererBase
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
+
+    // Role of the child in the parallel render (see Settings::parallelRender)
+    enum ParallelUnitKind : uint8_t
+    {
+        SequentialUnit,
+        StaticTextUnit,
+        IncludeUnit,
+        BlockUnit
+    };
 
     void AddRenderer(RendererPtr r)
     {
         m_renderers.push_back(std::move(r));
     }
+    auto& GetRenderers() {return m_renderers;}
+    void SetParallelUnits(std::vector<ParallelUnitKind> units) {m_parallelUnits = std::move(units);}
+    bool IsParallel() const {return !m_parallelUnits.empty();}
+    // Linear form of the children used by the bytecode render engine (see RenderProgram)
+    void SetProgram(std::shared_ptr<const RenderProgram> program) {m_program = std::move(program);}
+    // Profiled children (see Settings::profileRender). Either empty or has the info for each child
+    void SetProfileInfo(std::vector<ProfiledNodeInfo> info) {m_profileInfo = std::move(info);}
     void Render(OutStream& os, RenderContext& values) override
     {
+        if (!m_profileInfo.empty() && values.GetProfiler())
+        {
+            RenderProfiled(os, values);
+            return;
+        }
+
+        if (!m_parallelUnits.empty())
+        {
+            RenderParallel(os, values);
+            return;
+        }
+
+        if (m_program)
+        {
+            ExecuteProgram(os, values);
+            return;
+        }
+
         for (auto& r : m_renderers)
+        {
             r->Render(os, values);
+            if (values.HasError())
+                return;
+        }
     }
 
+private:
+    void RenderParallel(OutStream& os, RenderContext& values);
+    void RenderUnits(OutStream& os, RenderContext& values, size_t begin, size_t end, bool isExtended);
+    void RenderProfiled(OutStream& os, RenderContext& values);
+    void ExecuteProgram(OutStream& os, RenderContext& values);
+
 private:
     std::vector<RendererPtr> m_renderers;
+    std::vector<ParallelUnitKind> m_parallelUnits;
+    std::vector<ProfiledNodeInfo> m_profileInfo;
+    std::shared_ptr<const RenderProgram> m_program;
 };
 
 class RawTextRenderer : public VisitableRendererBase
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
     
     RawTextRenderer(const void* ptr, size_t len)
         : m_ptr(ptr)
@@ -58,31 +111,54 @@ public:
     {
     }
 
+    // Text which doesn't belong to the template source (e.g. merged text blocks or folded constants)
+    template<typename CharT>
+    explicit RawTextRenderer(std::basic_string<CharT> text)
+    {
+        auto storage = std::make_shared<std::basic_string<CharT>>(std::move(text));
+        m_ptr = storage->data();
+        m_length = storage->size();
+        m_storage = std::move(storage);
+    }
+
+    const void* GetPtr() const {return m_ptr;}
+    size_t GetLength() const {return m_length;}
+    bool IsOwnText() const {return !!m_storage;}
+
     void Render(OutStream& os, RenderContext&) override
     {
-        os.WriteBuffer(m_ptr, m_length);
+        os.WriteStaticBuffer(m_ptr, m_length);
     }
 private:
     const void* m_ptr;
     size_t m_length;
+    std::shared_ptr<const void> m_storage;
 };
 
 class ExpressionRenderer : public VisitableRendererBase
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     explicit ExpressionRenderer(ExpressionEvaluatorPtr<> expr)
         : m_expression(std::move(expr))
     {
     }
 
+    auto& GetExpression() const {return m_expression;}
+    bool IsAutoescape() const {return m_autoescape;}
+    void SetAutoescape(bool autoescape) {m_autoescape = autoescape;}
+
     void Render(OutStream& os, RenderContext& values) override
     {
+        bool prevAutoescape = os.SetAutoescape(m_autoescape);
         m_expression->Render(os, values);
+        os.SetAutoescape(prevAutoescape);
     }
 private:
     ExpressionEvaluatorPtr<> m_expression;
+    bool m_autoescape = false;
 };
 } // jinja2
 
@@ -0,0 +1,290 @@
+#ifndef RENDERER_OPTIMIZER_H
+#define RENDERER_OPTIMIZER_H
+
+#include "frozen_globals.h"
+#include "renderer.h"
+#include "statements.h"
+#include "string_escape.h"
+#include "value_visitors.h"
+
+#include <boost/optional.hpp>
+
+#include <string>
+#include <vector>
+
+namespace jinja2
+{
+// Load time optimization pass over the parsed renderers tree. Evaluates the constant expressions into static text, drops the 'if'
+// branches with constant conditions and merges the adjacent static text blocks, so they are written with the single call. References
+// to the frozen globals installed on the current thread (see FrozenGlobals) are the constants as well
+template<typename CharT>
+class RendererOptimizer : public StatementVisitor
+{
+public:
+    using StatementVisitor::DoVisit;
+
+    void Optimize(const RendererPtr& root) { VisitRenderer(root); }
+
+    void DoVisit(ComposedRenderer* renderer) override
+    {
+        auto& renderers = renderer->GetRenderers();
+        std::vector<RendererPtr> result;
+        result.reserve(renderers.size());
+        for (auto& r : renderers)
+        {
+            m_replacement = boost::none;
+            VisitRenderer(r);
+            if (!m_replacement)
+            {
+                result.push_back(r);
+                continue;
+            }
+            for (auto& item : *m_replacement)
+                result.push_back(std::move(item));
+        }
+        m_replacement = boost::none;
+        renderers = MergeStaticText(std::move(result));
+    }
+
+    void DoVisit(ExpressionRenderer* renderer) override
+    {
+        std::basic_string<CharT> text;
+        bool isAutoescape = renderer->IsAutoescape();
+        bool isFolded = EvaluateConstant(renderer->GetExpression(), [&text, isAutoescape](const InternalValue& val) {
+            if (!isAutoescape || val.IsSafe())
+            {
+                Apply<visitors::ValueRenderer<CharT>>(val, text);
+                return true;
+            }
+            std::basic_string<CharT> plain;
+            Apply<visitors::ValueRenderer<CharT>>(val, plain);
+            escape::AppendHtmlEscaped(text, plain.data(), plain.data() + plain.size());
+            return true;
+        });
+        if (!isFolded)
+            return;
+
+        m_replacement = std::vector<RendererPtr>();
+        if (!text.empty())
+            m_replacement->push_back(std::make_shared<RawTextRenderer>(std::move(text)));
+    }
+
+    void DoVisit(IfStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        auto& branches = stmt->GetElseBranches();
+        for (auto& b : branches)
+            VisitRenderer(b->GetMainBody());
+
+        // Branches with the constant false conditions are never rendered. Branches after the constant true one as well
+        std::vector<StatementPtr<ElseBranchStatement>> activeBranches;
+        for (auto& b : branches)
+        {
+            auto& cond = b->GetCondition();
+            bool isTrue = false;
+            if (!cond || EvaluateCondition(cond, isTrue))
+            {
+                if (cond && !isTrue)
+                    continue;
+                activeBranches.push_back(b);
+                activeBranches.back()->SetCondition(ExpressionEvaluatorPtr<>());
+                break;
+            }
+            activeBranches.push_back(b);
+        }
+        branches = activeBranches;
+
+        bool isTrue = false;
+        if (!EvaluateCondition(stmt->GetCondition(), isTrue))
+            return;
+
+        if (isTrue)
+        {
+            m_replacement = GetBodyRenderers(stmt->GetMainBody());
+            return;
+        }
+
+        if (branches.empty())
+        {
+            m_replacement = std::vector<RendererPtr>();
+            return;
+        }
+
+        auto& first = branches.front();
+        if (!first->GetCondition())
+        {
+            m_replacement = GetBodyRenderers(first->GetMainBody());
+            return;
+        }
+
+        auto newStmt = std::make_shared<IfStatement>(first->GetCondition());
+        newStmt->SetMainBody(first->GetMainBody());
+        for (auto p = branches.begin() + 1; p != branches.end(); ++ p)
+            newStmt->AddElseBranch(*p);
+        m_replacement = std::vector<RendererPtr>{newStmt};
+    }
+
+    void DoVisit(ForStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        VisitRenderer(stmt->GetElseBody());
+    }
+    void DoVisit(SetBlockStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(ParentBlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(BlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(ExtendsStatement* stmt) override
+    {
+        for (auto& b : stmt->GetBlocks())
+            VisitRenderer(b.second);
+    }
+    void DoVisit(MacroStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(MacroCallStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(WithStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(FilterStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(CacheStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+
+private:
+    struct FoldingError
+    {
+    };
+
+    // Constant expressions don't use the templates or the output streams, so evaluation of such expressions is simply aborted
+    class FoldingCallback : public IRendererCallback
+    {
+    public:
+        TargetString GetAsTargetString(const InternalValue& val) override
+        {
+            std::basic_string<CharT> os;
+            Apply<visitors::ValueRenderer<CharT>>(val, os);
+            return TargetString(std::move(os));
+        }
+        void AppendAsTargetString(TargetString& str, const InternalValue& val) override
+        {
+            using string_t = std::basic_string<CharT>;
+            if (!nonstd::holds_alternative<string_t>(str))
+                str = GetAsTargetString(InternalValue(std::move(str)));
+            Apply<visitors::ValueRenderer<CharT>>(val, nonstd::get<string_t>(str));
+        }
+        OutStream GetStreamOnString(TargetString&) override { throw FoldingError(); }
+        nonstd::variant<EmptyValue,
+            nonstd::expected<std::shared_ptr<TemplateImpl<char>>, ErrorInfo>,
+            nonstd::expected<std::shared_ptr<TemplateImpl<wchar_t>>, ErrorInfoW>> LoadTemplate(const std::string&) const override
+        {
+            throw FoldingError();
+        }
+        nonstd::variant<EmptyValue,
+            nonstd::expected<std::shared_ptr<TemplateImpl<char>>, ErrorInfo>,
+            nonstd::expected<std::shared_ptr<TemplateImpl<wchar_t>>, ErrorInfoW>> LoadTemplate(const InternalValue&) const override
+        {
+            throw FoldingError();
+        }
+        RenderError MakeRuntimeError(ErrorCode, ValuesList) override { throw FoldingError(); }
+        nonstd::optional<uint64_t> GetTemplatesVersion() const override { throw FoldingError(); }
+        IFragmentCache* GetFragmentCache() const override { throw FoldingError(); }
+    };
+
+    void VisitRenderer(const RendererPtr& renderer)
+    {
+        auto visitable = dynamic_cast<VisitableStatement*>(renderer.get());
+        if (visitable)
+            visitable->ApplyVisitor(this);
+    }
+
+public:
+    // Evaluated value may refer to the evaluation context, so it's processed by 'fn' in place
+    template<typename Fn>
+    static bool EvaluateConstant(const ExpressionEvaluatorPtr<>& expr, Fn&& fn)
+    {
+        if (!expr || !expr->IsConstant())
+            return false;
+
+        try
+        {
+            ExternalScope emptyParams;
+            InternalValueMap emptyScope;
+            FoldingCallback callback;
+            auto frozen = FrozenGlobals::GetCurrent();
+            RenderContext context(emptyParams, frozen ? frozen->GetValues() : emptyScope, &callback);
+            return fn(expr->Evaluate(context));
+        }
+        catch (...)
+        {
+            // Expression is kept as is. The error (if any) is reported by the render call
+            return false;
+        }
+    }
+
+private:
+    bool EvaluateCondition(const ExpressionEvaluatorPtr<>& expr, bool& isTrue)
+    {
+        return EvaluateConstant(expr, [&isTrue](const InternalValue& val) {
+            isTrue = Apply<visitors::BooleanEvaluator>(val);
+            return true;
+        });
+    }
+
+    static std::vector<RendererPtr> GetBodyRenderers(const RendererPtr& body)
+    {
+        auto composed = std::dynamic_pointer_cast<ComposedRenderer>(body);
+        if (composed)
+            return composed->GetRenderers();
+
+        return body ? std::vector<RendererPtr>{body} : std::vector<RendererPtr>();
+    }
+
+    static std::vector<RendererPtr> MergeStaticText(std::vector<RendererPtr> renderers)
+    {
+        std::vector<RendererPtr> result;
+        std::vector<std::shared_ptr<RawTextRenderer>> textBlocks;
+        auto flushText = [&result, &textBlocks]() {
+            if (textBlocks.size() == 1)
+                result.push_back(textBlocks.front());
+            else if (!textBlocks.empty())
+                result.push_back(MergeTextBlocks(textBlocks));
+            textBlocks.clear();
+        };
+
+        for (auto& r : renderers)
+        {
+            auto text = std::dynamic_pointer_cast<RawTextRenderer>(r);
+            if (!text)
+            {
+                flushText();
+                result.push_back(std::move(r));
+            }
+            else if (text->GetLength() != 0)
+                textBlocks.push_back(std::move(text));
+        }
+        flushText();
+        return result;
+    }
+
+    static RendererPtr MergeTextBlocks(const std::vector<std::shared_ptr<RawTextRenderer>>& blocks)
+    {
+        // Adjacent blocks of the template source (e.g. split by the raw blocks) are merged without copying
+        bool isContiguous = true;
+        size_t length = 0;
+        auto start = static_cast<const CharT*>(blocks.front()->GetPtr());
+        for (auto& b : blocks)
+        {
+            if (b->IsOwnText() || b->GetPtr() != start + length)
+                isContiguous = false;
+            length += b->GetLength();
+        }
+        if (isContiguous)
+            return std::make_shared<RawTextRenderer>(start, length);
+
+        std::basic_string<CharT> text;
+        text.reserve(length);
+        for (auto& b : blocks)
+            text.append(static_cast<const CharT*>(b->GetPtr()), b->GetLength());
+
+        return std::make_shared<RawTextRenderer>(std::move(text));
+    }
+
+private:
+    boost::optional<std::vector<RendererPtr>> m_replacement;
+};
+} // jinja2
+
+#endif // RENDERER_OPTIMIZER_H
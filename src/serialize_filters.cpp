@@ -2,12 +2,12 @@
 #include "generic_adapters.h"
 #include "out_stream.h"
 #include "rapid_json_serializer.h"
+#include "string_escape.h"
 #include "testers.h"
 #include "value_helpers.h"
 #include "value_visitors.h"
 
 #include <algorithm>
-#include <numeric>
 #include <random>
 #include <sstream>
 #include <string>
@@ -55,18 +55,18 @@ struct PrettyPrinter : visitors::BaseVisitor<std::string>
 
         fmt::format_to(os, "{{");
 
-        const auto& keys = map.GetKeys();
+        auto items = map.GetEnumerator();
 
         bool isFirst = true;
-        for (auto& k : keys)
+        while (items && items->MoveNext())
         {
             if (isFirst)
                 isFirst = false;
             else
                 fmt::format_to(os, ", ");
 
-            fmt::format_to(os, "'{}': ", k);
-            fmt::format_to(os, "{}", Apply<PrettyPrinter>(map.GetValueByName(k), m_context));
+            fmt::format_to(os, "'{}': ", items->GetKey());
+            fmt::format_to(os, "{}", Apply<PrettyPrinter>(items->GetValue(), m_context));
         }
 
         fmt::format_to(os, "}}");
@@ -102,14 +102,11 @@ struct PrettyPrinter : visitors::BaseVisitor<std::string>
     std::string operator()(double val) const
     {
         std::string str;
-        auto os = std::back_inserter(str);
-
-        fmt::format_to(os, "{:.8g}", val);
-
+        visitors::AppendDouble(str, val);
         return str;
     }
 
-    std::string operator()(int64_t val) const { return fmt::format("{}", val); }
+    std::string operator()(int64_t val) const { return fmt::format_int(val).str(); }
 
     const RenderContext* m_context;
 };
@@ -139,31 +136,8 @@ InternalValue Serialize::Filter(const InternalValue& value, RenderContext& conte
     if (m_mode == JsonMode)
     {
         const auto indent = ConvertToInt(this->GetArgumentValue("indent", context));
-        jinja2::rapidjson_serializer::DocumentWrapper jsonDoc;
-        const auto jsonValue = jsonDoc.CreateValue(value);
-        const auto jsonString = jsonValue.AsString(static_cast<uint8_t>(indent));
-        const auto result = std::accumulate(jsonString.begin(), jsonString.end(), ""s, [](const auto &str, const auto &c)
-        {
-            switch (c)
-            {
-            case '<':
-                return str + "\\u003c";
-                break;
-            case '>':
-                return str +"\\u003e";
-                break;
-            case '&':
-                return str +"\\u0026"; 
-                break;
-            case '\'':
-                return str +"\\u0027";
-                break;
-            default:
-                return str + c;
-                break;
-            }
-        });
-
+        std::string result;
+        jinja2::rapidjson_serializer::WriteJson(value, result, static_cast<uint8_t>(indent), true);
         return result;
     }
 
@@ -193,9 +167,10 @@ struct FormatArgumentConverter : visitors::BaseVisitor<FormatArgument>
 
     result_t operator()(const MapAdapter& map) const { return make_result(Apply<PrettyPrinter>(map, m_context)); }
 
-    result_t operator()(const std::string& str) const { return make_result(str); }
+    // Strings are passed by the views, so the formatted values should outlive the arguments
+    result_t operator()(const std::string& str) const { return make_result(fmt::string_view(str.data(), str.size())); }
 
-    result_t operator()(const nonstd::string_view& str) const { return make_result(std::string(str.data(), str.size())); }
+    result_t operator()(const nonstd::string_view& str) const { return make_result(fmt::string_view(str.data(), str.size())); }
 
     result_t operator()(const std::wstring& str) const { return make_result(ConvertString<std::string>(str)); }
 
@@ -224,8 +199,16 @@ struct FormatArgumentConverter : visitors::BaseVisitor<FormatArgument>
 template<typename T>
 using NamedArgument = fmt::internal::named_arg<T, char>;
 
-using ValueHandle =
-  nonstd::variant<bool, std::string, int64_t, double, NamedArgument<bool>, NamedArgument<std::string>, NamedArgument<int64_t>, NamedArgument<double>>;
+using ValueHandle = nonstd::variant<bool,
+                                    std::string,
+                                    fmt::string_view,
+                                    int64_t,
+                                    double,
+                                    NamedArgument<bool>,
+                                    NamedArgument<std::string>,
+                                    NamedArgument<fmt::string_view>,
+                                    NamedArgument<int64_t>,
+                                    NamedArgument<double>>;
 using ValuesBuffer = std::vector<ValueHandle>;
 
 struct CachingIdentity
@@ -274,24 +257,172 @@ private:
 
 }
 
+// Format string split into the literal text and the replacement fields once (see StringFormat::PrepareForBase). Only the plain fields are
+// supported: the automatic or explicit argument index or the argument name, with the optional spec without the nested fields. Other
+// strings (and the invalid ones) are formatted by fmt as is, so the errors are the same
+struct StringFormat::CompiledFormat
+{
+    struct Segment
+    {
+        // Literal text (with the escaped braces resolved) if 'isField' is false
+        std::string text;
+        bool isField = false;
+        size_t argIndex = 0;
+        std::string argName;
+        // Format of the single argument, e.g. "{:.2f}". Empty if the field has no spec
+        std::string format;
+    };
+
+    std::string source;
+    std::vector<Segment> segments;
+
+    static std::shared_ptr<const CompiledFormat> Compile(std::string source);
+};
+
+std::shared_ptr<const StringFormat::CompiledFormat> StringFormat::CompiledFormat::Compile(std::string source)
+{
+    auto result = std::make_shared<CompiledFormat>();
+    auto& segments = result->segments;
+    auto appendText = [&segments](char ch) {
+        if (segments.empty() || segments.back().isField)
+            segments.emplace_back();
+        segments.back().text.push_back(ch);
+    };
+
+    bool hasAutoIndex = false;
+    bool hasManualIndex = false;
+    size_t nextIndex = 0;
+    for (size_t pos = 0; pos < source.size(); ++ pos)
+    {
+        auto ch = source[pos];
+        if (ch == '}')
+        {
+            if (pos + 1 == source.size() || source[pos + 1] != '}')
+                return nullptr;
+            appendText(ch);
+            ++ pos;
+            continue;
+        }
+        if (ch != '{')
+        {
+            appendText(ch);
+            continue;
+        }
+        if (pos + 1 < source.size() && source[pos + 1] == '{')
+        {
+            appendText(ch);
+            ++ pos;
+            continue;
+        }
+
+        auto end = source.find_first_of("{}", pos + 1);
+        if (end == std::string::npos || source[end] == '{')
+            return nullptr;
+
+        auto field = source.substr(pos + 1, end - pos - 1);
+        auto specPos = field.find(':');
+        auto argId = field.substr(0, specPos);
+        Segment segment;
+        segment.isField = true;
+        if (specPos != std::string::npos)
+            segment.format = "{:" + field.substr(specPos + 1) + "}";
+
+        auto isDigit = [](char c) { return c >= '0' && c <= '9'; };
+        auto isIdChar = [&isDigit](char c) { return isDigit(c) || c == '_' || static_cast<unsigned>((c | 0x20) - 'a') < 26; };
+        if (argId.empty())
+        {
+            hasAutoIndex = true;
+            segment.argIndex = nextIndex ++;
+        }
+        else if (std::all_of(argId.begin(), argId.end(), isDigit))
+        {
+            hasManualIndex = true;
+            segment.argIndex = static_cast<size_t>(std::stoull(argId));
+        }
+        else if (!isDigit(argId[0]) && std::all_of(argId.begin(), argId.end(), isIdChar))
+            segment.argName = std::move(argId);
+        else
+            return nullptr;
+
+        if (hasAutoIndex && hasManualIndex)
+            return nullptr;
+
+        segments.push_back(std::move(segment));
+        pos = end;
+    }
+
+    result->source = std::move(source);
+    return result;
+}
+
+// Narrow string held by the value directly or as the target string (view)
+static bool GetNarrowString(const InternalValue& val, fmt::string_view& result)
+{
+    const std::string* str = GetIf<std::string>(&val);
+    if (!str)
+    {
+        auto targetStr = GetIf<TargetString>(&val);
+        str = targetStr ? nonstd::get_if<std::string>(targetStr) : nullptr;
+    }
+    if (str)
+    {
+        result = fmt::string_view(str->data(), str->size());
+        return true;
+    }
+
+    auto targetView = GetIf<TargetStringView>(&val);
+    auto view = targetView ? nonstd::get_if<nonstd::string_view>(targetView) : nullptr;
+    if (view)
+    {
+        result = fmt::string_view(view->data(), view->size());
+        return true;
+    }
+
+    return false;
+}
+
+void StringFormat::PrepareForBase(const InternalValue& baseVal)
+{
+    fmt::string_view format;
+    if (GetNarrowString(baseVal, format))
+        m_compiledFormat = CompiledFormat::Compile(std::string(format.data(), format.size()));
+}
+
 InternalValue StringFormat::Filter(const InternalValue& baseVal, RenderContext& context)
 {
-    // Format library internally likes using non-owning views to complex arguments.
+    // Format library internally likes using non-owning views to complex arguments (and the strings are passed by the views).
     // In order to ensure proper lifetime of values and named args,
-    // helper buffer is created and passed to visitors.
+    // helper buffers are created and passed to visitors.
+    InternalValueList argValues;
+    argValues.reserve(m_params.posParams.size() + m_params.kwParams.size());
+    for (auto& arg : m_params.posParams)
+        argValues.push_back(arg->Evaluate(context));
+    for (auto& arg : m_params.kwParams)
+        argValues.push_back(arg.second->Evaluate(context));
+
+    fmt::string_view format;
+    if (m_compiledFormat && GetNarrowString(baseVal, format) && format.size() == m_compiledFormat->source.size() &&
+        std::equal(format.data(), format.data() + format.size(), m_compiledFormat->source.data()))
+    {
+        nonstd::optional<std::string> result = FormatCompiled(*m_compiledFormat, argValues, context);
+        if (result)
+            return InternalValue(std::move(result.value()));
+    }
+
     ValuesBuffer valuesBuffer;
     valuesBuffer.reserve(m_params.posParams.size() + 3 * m_params.kwParams.size());
 
     std::vector<FormatArgument> args;
-    for (auto& arg : m_params.posParams)
+    size_t idx = 0;
+    for (; idx != m_params.posParams.size(); ++ idx)
     {
-        args.push_back(Apply<FormatArgumentConverter<CachingIdentity>>(arg->Evaluate(context), &context, CachingIdentity{ valuesBuffer }));
+        args.push_back(Apply<FormatArgumentConverter<CachingIdentity>>(argValues[idx], &context, CachingIdentity{ valuesBuffer }));
     }
 
     for (auto& arg : m_params.kwParams)
     {
         args.push_back(
-          Apply<FormatArgumentConverter<NamedArgumentCreator>>(arg.second->Evaluate(context), &context, NamedArgumentCreator{ arg.first, valuesBuffer }));
+          Apply<FormatArgumentConverter<NamedArgumentCreator>>(argValues[idx ++], &context, NamedArgumentCreator{ arg.first, valuesBuffer }));
     }
     // fmt process arguments until reaching empty argument
     args.push_back(FormatArgument{});
@@ -299,6 +430,61 @@ InternalValue StringFormat::Filter(const InternalValue& baseVal, RenderContext&
     return InternalValue(fmt::vformat(AsString(baseVal), fmt::format_args(args.data(), static_cast<unsigned>(args.size() - 1))));
 }
 
+nonstd::optional<std::string> StringFormat::FormatCompiled(const CompiledFormat& format, const InternalValueList& argValues, RenderContext& context) const
+{
+    fmt::memory_buffer out;
+    ValuesBuffer valuesBuffer;
+    valuesBuffer.reserve(1);
+    for (auto& segment : format.segments)
+    {
+        if (!segment.isField)
+        {
+            out.append(segment.text.data(), segment.text.data() + segment.text.size());
+            continue;
+        }
+
+        const InternalValue* value = nullptr;
+        if (segment.argName.empty())
+        {
+            if (segment.argIndex < m_params.posParams.size())
+                value = &argValues[segment.argIndex];
+        }
+        else
+        {
+            size_t idx = m_params.posParams.size();
+            for (auto p = m_params.kwParams.begin(); p != m_params.kwParams.end() && !value; ++ p, ++ idx)
+            {
+                if (p->first == segment.argName)
+                    value = &argValues[idx];
+            }
+        }
+        // fmt reports the missing argument
+        if (!value)
+            return nonstd::optional<std::string>();
+
+        fmt::string_view str;
+        if (segment.format.empty() && GetNarrowString(*value, str))
+        {
+            out.append(str.data(), str.data() + str.size());
+            continue;
+        }
+
+        valuesBuffer.clear();
+        auto arg = Apply<FormatArgumentConverter<CachingIdentity>>(*value, &context, CachingIdentity{ valuesBuffer });
+        try
+        {
+            fmt::vformat_to(out, segment.format.empty() ? fmt::string_view("{}") : fmt::string_view(segment.format), fmt::format_args(&arg, 1));
+        }
+        catch (const fmt::format_error&)
+        {
+            // The spec doesn't fit the argument, fmt reports it for the whole string
+            return nonstd::optional<std::string>();
+        }
+    }
+
+    return fmt::to_string(out);
+}
+
 class XmlAttrPrinter : public visitors::BaseVisitor<std::string>
 {
 public:
@@ -312,7 +498,8 @@ public:
 
     std::string operator()(const ListAdapter& list) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         return EscapeHtml(Apply<PrettyPrinter>(list, m_context));
     }
@@ -327,13 +514,13 @@ public:
         std::string str;
         auto os = std::back_inserter(str);
 
-        const auto& keys = map.GetKeys();
+        auto items = map.GetEnumerator();
 
         bool isFirst = true;
-        for (auto& k : keys)
+        while (items && items->MoveNext())
         {
-            const auto& v = map.GetValueByName(k);
-            const auto item = Apply<XmlAttrPrinter>(v, m_context, false);
+            const auto& k = items->GetKey();
+            const auto item = Apply<XmlAttrPrinter>(items->GetValue(), m_context, false);
             if (item.length() > 0)
             {
                 if (isFirst)
@@ -350,21 +537,24 @@ public:
 
     std::string operator()(const KeyValuePair& kwPair) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         return EscapeHtml(Apply<PrettyPrinter>(kwPair, m_context));
     }
 
     std::string operator()(const std::string& str) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         return EscapeHtml(str);
     }
 
     std::string operator()(const nonstd::string_view& str) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         const auto result = fmt::format("{}", fmt::basic_string_view<char>(str.data(), str.size()));
         return EscapeHtml(result);
@@ -372,14 +562,16 @@ public:
 
     std::string operator()(const std::wstring& str) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         return EscapeHtml(ConvertString<std::string>(str));
     }
 
     std::string operator()(const nonstd::wstring_view& str) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         const auto result = fmt::format("{}", ConvertString<std::string>(str));
         return EscapeHtml(result);
@@ -387,78 +579,61 @@ public:
 
     std::string operator()(bool val) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         return val ? "true"s : "false"s;
     }
 
     std::string operator()(EmptyValue) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         return ""s;
     }
 
     std::string operator()(const Callable&) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         return ""s;
     }
 
     std::string operator()(double val) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
         std::string str;
-        auto os = std::back_inserter(str);
-
-        fmt::format_to(os, "{:.8g}", val);
-
+        visitors::AppendDouble(str, val);
         return str;
     }
 
     std::string operator()(int64_t val) const
     {
-        EnforceThatNested();
+        if (!EnforceThatNested())
+            return std::string();
 
-        return fmt::format("{}", val);
+        return fmt::format_int(val).str();
     }
 
 private:
-    void EnforceThatNested() const
+    // Reports the error for the top-level value which isn't the map. The value isn't serialized then
+    bool EnforceThatNested() const
     {
-        if (m_isFirstLevel)
-            m_context->GetRendererCallback()->ThrowRuntimeError(ErrorCode::InvalidValueType, ValuesList{});
+        if (!m_isFirstLevel)
+            return true;
+
+        m_context->SetRuntimeError(ErrorCode::InvalidValueType, ValuesList{});
+        return false;
     }
 
     std::string EscapeHtml(const std::string &str) const
     {
-        const auto result = std::accumulate(str.begin(), str.end(), ""s, [](const auto &str, const auto &c)
-        {
-            switch (c)
-            {
-            case '<':
-                return str + "&lt;";
-                break;
-            case '>':
-                return str +"&gt;";
-                break;
-            case '&':
-                return str +"&amp;"; 
-                break;
-            case '\'':
-                return str +"&#39;";
-                break;
-            case '\"':
-                return str +"&#34;";
-                break;
-            default:
-                return str + c;
-                break;
-            }
-        });
-
+        std::string result;
+        escape::AppendHtmlEscaped(result, str.data(), str.data() + str.size());
         return result;
     }
 
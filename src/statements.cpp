@@ -4,15 +4,195 @@
 #include "template_impl.h"
 #include "value_visitors.h"
 
+#include <jinja2cpp/fragment_cache.h>
+
+#include <boost/container/small_vector.hpp>
 #include <boost/core/null_deleter.hpp>
 
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std::string_literals;
 
 namespace jinja2
 {
 
+namespace
+{
+struct LoopVarAttrInfo
+{
+    const char* name;
+    ForStatement::LoopVarAttr attr;
+};
+
+const LoopVarAttrInfo s_loopVarAttrs[] = {
+    { "index", ForStatement::LoopVarIndex },
+    { "index0", ForStatement::LoopVarIndex0 },
+    { "first", ForStatement::LoopVarFirst },
+    { "last", ForStatement::LoopVarLast },
+    { "length", ForStatement::LoopVarLength },
+    { "previtem", ForStatement::LoopVarPrevItem },
+    { "nextitem", ForStatement::LoopVarNextItem },
+    { "cycle", ForStatement::LoopVarCycle },
+    { "depth", ForStatement::LoopVarDepth },
+    { "depth0", ForStatement::LoopVarDepth0 },
+    { "revindex", ForStatement::LoopVarRevIndex },
+    { "revindex0", ForStatement::LoopVarRevIndex0 },
+    { "operator()", ForStatement::LoopVarCall },
+};
+
+struct MacroVarAttrInfo
+{
+    const char* name;
+    MacroStatement::MacroVarAttr attr;
+};
+
+const MacroVarAttrInfo s_macroVarAttrs[] = {
+    { "kwargs", MacroStatement::MacroVarKwargs },
+    { "varargs", MacroStatement::MacroVarVarargs },
+    { "name", MacroStatement::MacroVarName },
+    { "arguments", MacroStatement::MacroVarArguments },
+    { "defaults", MacroStatement::MacroVarDefaults },
+};
+} // namespace
+
+ForStatement::LoopVarAttr ForStatement::GetLoopVarAttr(const std::string& name)
+{
+    for (auto& info : s_loopVarAttrs)
+    {
+        if (name == info.name)
+            return info.attr;
+    }
+
+    return LoopVarNone;
+}
+
+std::vector<std::string> ForStatement::LoopVarAccessor::GetKeys() const
+{
+    std::vector<std::string> result;
+    for (auto& info : s_loopVarAttrs)
+    {
+        if (IsAvailable(info.attr))
+            result.push_back(info.name);
+    }
+    return result;
+}
+
+GenericMap ForStatement::LoopVarAccessor::CreateGenericMap() const
+{
+    // Loop state is gone after the loop, so the generic map gets the snapshot of it
+    InternalValueMap items;
+    for (auto& key : GetKeys())
+        items[key] = GetItem(key);
+    return CreateMapAdapter(std::move(items)).CreateGenericMap();
+}
+
+bool ForStatement::LoopVarAccessor::IsAvailable(LoopVarAttr attr) const
+{
+    if (attr == LoopVarNone || (m_owner->m_loopVarUsage & attr) == 0)
+        return false;
+
+    switch (attr)
+    {
+    case LoopVarIndex:
+    case LoopVarIndex0:
+    case LoopVarFirst:
+    case LoopVarLast:
+    case LoopVarRevIndex:
+    case LoopVarRevIndex0:
+        return isIterating;
+    case LoopVarPrevItem:
+        return isIterating && itemIdx != 0;
+    case LoopVarNextItem:
+        return isIterating && !isLast;
+    case LoopVarDepth:
+    case LoopVarDepth0:
+    case LoopVarCall:
+        return m_owner->m_isRecursive;
+    default:
+        return true;
+    }
+}
+
+InternalValue ForStatement::LoopVarAccessor::GetItem(const std::string& name) const
+{
+    auto attr = GetLoopVarAttr(name);
+    if (!IsAvailable(attr))
+        return InternalValue();
+
+    switch (attr)
+    {
+    case LoopVarIndex:
+        return static_cast<int64_t>(itemIdx + 1);
+    case LoopVarIndex0:
+        return static_cast<int64_t>(itemIdx);
+    case LoopVarFirst:
+        return itemIdx == 0;
+    case LoopVarLast:
+        return isLast;
+    case LoopVarLength:
+        return MakeSizeBasedValue([](const LoopVarAccessor& accessor) { return accessor.listSize.value(); });
+    case LoopVarRevIndex:
+        return MakeSizeBasedValue([](const LoopVarAccessor& accessor) { return accessor.listSize.value() - accessor.itemIdx; });
+    case LoopVarRevIndex0:
+        return MakeSizeBasedValue([](const LoopVarAccessor& accessor) { return accessor.listSize.value() - accessor.itemIdx - 1; });
+    case LoopVarPrevItem:
+        return prevValue;
+    case LoopVarNextItem:
+        return nextValue;
+    case LoopVarCycle:
+        return static_cast<int64_t>(LoopCycleFn);
+    case LoopVarDepth:
+        return static_cast<int64_t>(m_level + 1);
+    case LoopVarDepth0:
+        return static_cast<int64_t>(m_level);
+    case LoopVarCall:
+        if (m_callable.IsEmpty())
+        {
+            m_callable = Callable(Callable::GlobalFunc, [owner = m_owner, level = m_level](const CallParams& params, OutStream& stream, RenderContext& context) {
+                bool isSucceeded = false;
+                auto parsedParams = helpers::ParseCallParams({ { "var", true } }, params, isSucceeded);
+                if (!isSucceeded)
+                    return;
+
+                auto var = parsedParams["var"];
+                if (var.IsEmpty())
+                    return;
+
+                RenderContext::NestingGuard nesting(context);
+                if (!context.HasError())
+                    owner->RenderLoop(var, stream, context, level + 1);
+            });
+        }
+        return m_callable;
+    default:
+        return InternalValue();
+    }
+}
+
+void ForStatement::LoopVarAccessor::MakeIndexedList()
+{
+    // The current item is the last one, the list is read to the end already
+    if (isLast)
+    {
+        listSize = itemIdx + 1;
+        return;
+    }
+
+    InternalValueList items;
+    do
+    {
+        items.push_back(enumerator->GetCurrent());
+    } while (enumerator->MoveNext());
+
+    listSize = itemIdx + items.size() + 1;
+    indexedList = ListAdapter::CreateAdapter(std::move(items));
+    enumerator = indexedList.GetEnumerator();
+    isLast = !enumerator->MoveNext();
+}
+
 void ForStatement::Render(OutStream& os, RenderContext& values)
 {
     InternalValue loopVal = m_value->Evaluate(values);
@@ -22,145 +202,180 @@ void ForStatement::Render(OutStream& os, RenderContext& values)
 
 void ForStatement::RenderLoop(const InternalValue& loopVal, OutStream& os, RenderContext& values, int level)
 {
-    auto& context = values.EnterScope();
-
-    InternalValueMap loopVar;
-    context["loop"s] = CreateMapAdapter(&loopVar);
-    if (m_isRecursive)
+    LoopIterator it(this, loopVal, values, level);
+    while (it.MoveNext())
     {
-        loopVar["operator()"s] = Callable(Callable::GlobalFunc, [this, level](const CallParams& params, OutStream& stream, RenderContext& context) {
-            bool isSucceeded = false;
-            auto parsedParams = helpers::ParseCallParams({ { "var", true } }, params, isSucceeded);
-            if (!isSucceeded)
-                return;
+        values.EnterScope();
+        m_mainBody->Render(os, values);
+        values.ExitScope();
+        if (values.HasError())
+            break;
+    }
+
+    if (it.Finish() && m_elseBody)
+        m_elseBody->Render(os, values);
 
-            auto var = parsedParams["var"];
-            if (var.IsEmpty())
-                return;
+    values.ExitScope();
+}
 
-            RenderLoop(var, stream, context, level + 1);
-        });
-        loopVar["depth"s] = static_cast<int64_t>(level + 1);
-        loopVar["depth0"s] = static_cast<int64_t>(level);
+ForStatement::LoopIterator::LoopIterator(ForStatement* owner, const InternalValue& loopVal, RenderContext& values, int level)
+    : m_owner(owner)
+    , m_values(values)
+    , m_context(values.EnterScope())
+    , m_slotsCount(values.GetSlotsCount())
+    , m_loopVar(owner, level)
+    , m_varSlots(owner->m_vars.size(), nullptr)
+{
+    auto usage = owner->m_loopVarUsage;
+    if (usage != LoopVarNone)
+    {
+        auto& loopSlot = m_context["loop"s];
+        loopSlot = MapAdapter([accessor = &m_loopVar]() { return accessor; });
+        // Both map implementations keep values in the separate nodes, so pointers to them stay valid while the scope is alive
+        values.BindSlot(owner, owner->m_vars.size(), &loopSlot);
     }
 
-    bool isConverted = false;
-    auto loopItems = ConvertToList(loopVal, isConverted, false);
-    ListAdapter filteredList;
-    ListAdapter indexedList;
-    ListAccessorEnumeratorPtr enumerator;
-    size_t itemIdx = 0;
-    if (!isConverted)
+    m_loopItems = ConvertToList(loopVal, m_isConverted, false);
+    if (!m_isConverted)
+        return;
+
+    m_range = !owner->m_ifExpr && owner->m_vars.size() == 1 ? m_loopItems.GetIntegerRange() : nullptr;
+    if (m_range)
     {
-        if (m_elseBody)
-            m_elseBody->Render(os, values);
-        values.ExitScope();
+        m_loopVar.listSize = m_range->count;
         return;
     }
 
-    nonstd::optional<size_t> listSize;
-    if (m_ifExpr)
+    if (owner->m_ifExpr)
     {
-        filteredList = CreateFilteredAdapter(loopItems, values);
-        enumerator = filteredList.GetEnumerator();
+        m_filteredList = owner->CreateFilteredAdapter(m_loopItems, values);
+        m_loopVar.enumerator = m_filteredList.GetEnumerator();
     }
     else
     {
-        enumerator = loopItems.GetEnumerator();
-        listSize = loopItems.GetSize();
+        m_loopVar.enumerator = m_loopItems.GetEnumerator();
+        // Size of the list isn't requested unless the body needs it: accessors of the streamed lists may compute it by reading
+        // the whole sequence
+        if ((usage & LoopVarSizeBased) != 0)
+            m_loopVar.listSize = m_loopItems.GetSize();
     }
+}
 
-    bool isLast = false;
-    auto makeIndexedList = [&enumerator, &listSize, &indexedList, &itemIdx, &isLast] {
-        if (isLast)
-            listSize = itemIdx;
-
-        InternalValueList items;
-        do
-        {
-            items.push_back(enumerator->GetCurrent());
-        } while (enumerator->MoveNext());
-
-        listSize = itemIdx + items.size() + 1;
-        indexedList = ListAdapter::CreateAdapter(std::move(items));
-        enumerator = indexedList.GetEnumerator();
-        isLast = !enumerator->MoveNext();
-    };
-
-    if (listSize)
+void ForStatement::LoopIterator::SetVar(size_t idx, const InternalValue& val)
+{
+    auto& slot = m_varSlots[idx];
+    if (!slot)
     {
-        int64_t itemsNum = static_cast<int64_t>(listSize.value());
-        loopVar["length"s] = InternalValue(itemsNum);
+        slot = &m_context[m_owner->m_vars[idx]];
+        m_values.BindSlot(m_owner, idx, slot);
     }
-    else
+    *slot = val;
+}
+
+bool ForStatement::LoopIterator::MoveNextInRange()
+{
+    auto& itemIdx = m_loopVar.itemIdx;
+    if (m_isStarted)
+        ++ itemIdx;
+    m_isStarted = true;
+    if (itemIdx == m_range->count)
+        return false;
+
+    int64_t item = m_range->start + m_range->step * static_cast<int64_t>(itemIdx);
+    m_loopVar.isLast = itemIdx + 1 == m_range->count;
+    if ((m_owner->m_loopVarUsage & (LoopVarPrevItem | LoopVarNextItem)) != 0)
     {
-        loopVar["length"s] = MakeDynamicProperty([&listSize, &makeIndexedList](const CallParams& /*params*/, RenderContext & /*context*/) -> InternalValue {
-            if (!listSize)
-                makeIndexedList();
-            return static_cast<int64_t>(listSize.value());
-        });
+        m_loopVar.prevValue = item - m_range->step;
+        m_loopVar.nextValue = item + m_range->step;
     }
-    bool loopRendered = false;
-    isLast = !enumerator->MoveNext();
-    InternalValue prevValue;
-    InternalValue curValue;
-    InternalValue nextValue;
-    loopVar["cycle"s] = static_cast<int64_t>(LoopCycleFn);
-    for (; !isLast; ++itemIdx)
+    m_loopVar.isIterating = true;
+    m_isRendered = true;
+    SetVar(0, item);
+    m_values.CountStep();
+    return !m_values.HasError();
+}
+
+bool ForStatement::LoopIterator::MoveNext()
+{
+    if (!m_isConverted)
+        return false;
+
+    if (m_range)
+        return MoveNextInRange();
+
+    auto& vars = m_owner->m_vars;
+    bool keepPrevItem = (m_owner->m_loopVarUsage & LoopVarPrevItem) != 0;
+    auto& itemIdx = m_loopVar.itemIdx;
+    auto& isLast = m_loopVar.isLast;
+    auto& curValue = m_loopVar.curValue;
+    auto& nextValue = m_loopVar.nextValue;
+    for (;;)
     {
-        prevValue = std::move(curValue);
+        if (m_isStarted)
+            ++ itemIdx;
+        else
+            isLast = !m_loopVar.enumerator->MoveNext();
+        m_isStarted = true;
+        if (isLast)
+            return false;
+
         if (itemIdx != 0)
         {
-            std::swap(curValue, nextValue);
-            loopVar["previtem"s] = prevValue;
+            if (keepPrevItem)
+                m_loopVar.prevValue = std::move(curValue);
+            curValue = std::move(nextValue);
         }
         else
-            curValue = enumerator->GetCurrent();
+            curValue = m_loopVar.enumerator->GetCurrent();
 
-        isLast = !enumerator->MoveNext();
+        isLast = !m_loopVar.enumerator->MoveNext();
         if (!isLast)
-        {
-            nextValue = enumerator->GetCurrent();
-            loopVar["nextitem"s] = nextValue;
-        }
-        else
-            loopVar.erase("nextitem"s);
+            nextValue = m_loopVar.enumerator->GetCurrent();
 
-        loopRendered = true;
-        loopVar["index"s] = static_cast<int64_t>(itemIdx + 1);
-        loopVar["index0"s] = static_cast<int64_t>(itemIdx);
-        loopVar["first"s] = itemIdx == 0;
-        loopVar["last"s] = isLast;
+        m_isRendered = true;
+        m_loopVar.isIterating = true;
+        m_values.CountStep();
+        if (m_values.HasError())
+            return false;
 
-        if (m_vars.size() > 1)
+        auto kvPair = vars.size() > 1 ? GetIf<KeyValuePair>(&curValue) : nullptr;
+        if (kvPair)
+        {
+            // Items of the dictsort filter are unpacked in place, without the list of the pair fields
+            SetVar(0, InternalValue(kvPair->key));
+            SetVar(1, kvPair->value);
+        }
+        else if (vars.size() > 1)
         {
+            bool isConverted = false;
             const auto& valList = ConvertToList(curValue, isConverted);
+            // Items which can't be unpacked are skipped
             if (!isConverted)
                 continue;
 
             auto b = valList.begin();
             auto e = valList.end();
 
-            for (auto& varName : m_vars)
+            for (size_t idx = 0; idx != vars.size(); ++ idx)
             {
                 if (b == e)
                     continue;
-                context[varName] = *b;
+                SetVar(idx, *b);
                 ++ b;
             }
         }
         else
-            context[m_vars[0]] = curValue;
+            SetVar(0, curValue);
 
-        values.EnterScope();
-        m_mainBody->Render(os, values);
-        values.ExitScope();
+        return true;
     }
+}
 
-    if (!loopRendered && m_elseBody)
-        m_elseBody->Render(os, values);
-
-    values.ExitScope();
+bool ForStatement::LoopIterator::Finish()
+{
+    m_loopVar.isIterating = false;
+    m_values.UnbindSlots(m_slotsCount);
+    return !m_isRendered;
 }
 
 ListAdapter ForStatement::CreateFilteredAdapter(const ListAdapter& loopItems, RenderContext& values) const
@@ -251,9 +466,12 @@ InternalValue SetBlockStatement::RenderBody(RenderContext& values)
 {
     TargetString result;
     auto stream = values.GetRendererCallback()->GetStreamOnString(result);
-    auto innerValues = values.Clone(true);
-    m_body->Render(stream, innerValues);
-    return result;
+    values.EnterScope();
+    m_body->Render(stream, values);
+    values.ExitScope();
+    InternalValue resultVal(std::move(result));
+    resultVal.SetSafe(m_autoescape);
+    return resultVal;
 }
 
 void SetRawBlockStatement::Render(OutStream&, RenderContext& values)
@@ -383,30 +601,28 @@ private:
     ExtendsStatement::BlocksCollection* m_blocks;
 };
 
+// Load errors are reported to 'errorContext' (see RenderContext::SetError) or ignored if it's null
 template<typename Result, typename Fn>
 struct TemplateImplVisitor
 {
-    // ExtendsStatement::BlocksCollection* m_blocks;
     const Fn& m_fn;
-    bool m_throwError;
+    RenderContext* m_errorContext;
 
-    explicit TemplateImplVisitor(const Fn& fn, bool throwError)
+    explicit TemplateImplVisitor(const Fn& fn, RenderContext* errorContext)
         : m_fn(fn)
-        , m_throwError(throwError)
+        , m_errorContext(errorContext)
     {
     }
 
     template<typename CharT>
     Result operator()(nonstd::expected<std::shared_ptr<TemplateImpl<CharT>>, ErrorInfoTpl<CharT>> tpl) const
     {
-        if (!m_throwError && !tpl)
+        if (!tpl)
         {
+            if (m_errorContext)
+                m_errorContext->SetError(tpl.error());
             return Result{};
         }
-        else if (!tpl)
-        {
-            throw tpl.error();
-        }
         return m_fn(tpl.value());
     }
 
@@ -414,17 +630,201 @@ struct TemplateImplVisitor
 };
 
 template<typename Result, typename Fn, typename Arg>
-Result VisitTemplateImpl(Arg&& tpl, bool throwError, Fn&& fn)
+Result VisitTemplateImpl(Arg&& tpl, RenderContext* errorContext, Fn&& fn)
 {
-    return visit(TemplateImplVisitor<Result, Fn>(fn, throwError), tpl);
+    return visit(TemplateImplVisitor<Result, Fn>(fn, errorContext), tpl);
 }
 
+struct TemplateNotFoundChecker
+{
+    template<typename CharT>
+    bool operator()(const nonstd::expected<std::shared_ptr<TemplateImpl<CharT>>, ErrorInfoTpl<CharT>>& tpl) const
+    {
+        return !tpl && tpl.error().GetCode() == ErrorCode::FileNotFound;
+    }
+
+    bool operator()(EmptyValue) const { return false; }
+};
+
 template<template<typename T> class RendererTpl, typename CharT, typename... Args>
 auto CreateTemplateRenderer(std::shared_ptr<TemplateImpl<CharT>> tpl, Args&&... args)
 {
     return std::make_shared<RendererTpl<CharT>>(tpl, std::forward<Args>(args)...);
 }
 
+// Inheritance chain of the extending template: the parent templates of all the levels and the blocks table which gives the
+// same block implementations as the per-render lookup in the '$$__parent_template' list. The chain is linked by the first render
+// of the most derived template and is used while the environment templates aren't changed
+class LinkedParentTemplates : public BlocksRenderer
+{
+public:
+    LinkedParentTemplates()
+        : m_parentTemplates(ListAdapter::CreateAdapter(InternalValueList{InternalValue(RendererPtr(this, boost::null_deleter()))}))
+    {
+    }
+
+    void Render(OutStream& os, RenderContext& values) override
+    {
+        values.GetCurrentScope()["$$__parent_template"] = m_parentTemplates;
+        RenderLevel(0, os, values);
+    }
+
+    // Renders the parent of the intermediate template of the chain. Returns false if the statement doesn't belong to the chain
+    bool RenderParent(const ExtendsStatement* stmt, OutStream& os, RenderContext& values)
+    {
+        for (size_t idx = 1; idx < m_extends.size(); ++ idx)
+        {
+            if (m_extends[idx] != stmt)
+                continue;
+
+            RenderLevel(idx, os, values);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool HasBlock(const std::string& blockName) override { return m_blocks.count(blockName) != 0; }
+
+    void RenderBlock(const std::string& blockName, OutStream& os, RenderContext& values) override
+    {
+        auto p = m_blocks.find(blockName);
+        if (p != m_blocks.end())
+            p->second->Render(os, values);
+    }
+
+    virtual bool IsActual(IRendererCallback* callback) const = 0;
+
+protected:
+    virtual void RenderLevel(size_t idx, OutStream& os, RenderContext& values) = 0;
+
+    // Blocks of the templates closer to the root of the chain take precedence, the same way as in the list of the parent templates
+    void BuildBlocksTable()
+    {
+        for (auto p = m_extends.rbegin(); p != m_extends.rend(); ++ p)
+        {
+            for (auto& block : (*p)->GetBlocks())
+                m_blocks.emplace(block.first, block.second.get());
+        }
+    }
+
+protected:
+    // Extends statements of the chain levels. Statement with the index 'N' loads the template of the level 'N'
+    std::vector<const ExtendsStatement*> m_extends;
+
+private:
+    InternalValue m_parentTemplates;
+    std::unordered_map<std::string, BlockStatement*> m_blocks;
+};
+
+template<typename CharT>
+class LinkedParentTemplatesImpl : public LinkedParentTemplates
+{
+public:
+    using TemplateImplPtr = std::shared_ptr<TemplateImpl<CharT>>;
+
+    static std::shared_ptr<LinkedParentTemplates> Link(const ExtendsStatement* stmt, TemplateImplPtr parent, IRendererCallback* callback)
+    {
+        auto result = std::make_shared<LinkedParentTemplatesImpl<CharT>>();
+        result->m_templatesVersion = callback->GetTemplatesVersion();
+        std::unordered_set<std::string> names;
+        for (;;)
+        {
+            if (!names.insert(stmt->GetTemplateName()).second)
+                return nullptr;
+
+            result->m_extends.push_back(stmt);
+            result->m_templates.push_back(parent);
+
+            stmt = FindExtends(parent->GetRenderer());
+            if (!stmt)
+                break;
+            if (!stmt->IsPath())
+                return nullptr;
+
+            auto tpl = callback->LoadTemplate(stmt->GetTemplateName());
+            auto loaded = nonstd::get_if<nonstd::expected<TemplateImplPtr, ErrorInfoTpl<CharT>>>(&tpl);
+            if (!loaded || !*loaded)
+                return nullptr;
+            parent = loaded->value();
+        }
+
+        result->BuildBlocksTable();
+        return result;
+    }
+
+    bool IsActual(IRendererCallback* callback) const override
+    {
+        auto version = callback->GetTemplatesVersion();
+        if (version)
+            return m_templatesVersion == version;
+
+        for (size_t idx = 0; idx != m_extends.size(); ++ idx)
+        {
+            auto tpl = callback->LoadTemplate(m_extends[idx]->GetTemplateName());
+            auto loaded = nonstd::get_if<nonstd::expected<TemplateImplPtr, ErrorInfoTpl<CharT>>>(&tpl);
+            if (!loaded || !*loaded || loaded->value() != m_templates[idx])
+                return false;
+        }
+
+        return true;
+    }
+
+protected:
+    void RenderLevel(size_t idx, OutStream& os, RenderContext& values) override
+    {
+        m_templates[idx]->GetRenderer()->Render(os, values);
+    }
+
+private:
+    // Top level extends statement of the template. Templates with several (or conditional) extends statements aren't linked
+    static const ExtendsStatement* FindExtends(const RendererPtr& renderer)
+    {
+        auto composed = dynamic_cast<ComposedRenderer*>(renderer.get());
+        if (!composed)
+            return dynamic_cast<const ExtendsStatement*>(renderer.get());
+
+        const ExtendsStatement* result = nullptr;
+        for (auto& r : composed->GetRenderers())
+        {
+            auto stmt = dynamic_cast<const ExtendsStatement*>(r.get());
+            if (!stmt)
+                continue;
+            if (result)
+                return nullptr;
+            result = stmt;
+        }
+
+        return result;
+    }
+
+private:
+    std::vector<TemplateImplPtr> m_templates;
+    nonstd::optional<uint64_t> m_templatesVersion;
+};
+
+template<typename CharT>
+std::shared_ptr<LinkedParentTemplates> LinkParentTemplates(const ExtendsStatement* stmt, std::shared_ptr<TemplateImpl<CharT>> parent, IRendererCallback* callback)
+{
+    return LinkedParentTemplatesImpl<CharT>::Link(stmt, std::move(parent), callback);
+}
+
+std::shared_ptr<LinkedParentTemplates> ExtendsStatement::GetLinkedParents(RenderContext& values) const
+{
+    auto callback = values.GetRendererCallback();
+    auto linked = std::atomic_load(&m_linkedParents);
+    if (linked && linked->IsActual(callback))
+        return linked;
+
+    auto tpl = callback->LoadTemplate(m_templateName);
+    linked = VisitTemplateImpl<std::shared_ptr<LinkedParentTemplates>>(
+      tpl, nullptr, [this, callback](auto tplPtr) { return LinkParentTemplates(this, tplPtr, callback); });
+    if (linked)
+        std::atomic_store(&m_linkedParents, linked);
+
+    return linked;
+}
+
 void ExtendsStatement::Render(OutStream& os, RenderContext& values)
 {
     if (!m_isPath)
@@ -432,9 +832,33 @@ void ExtendsStatement::Render(OutStream& os, RenderContext& values)
         // FIXME: Implement processing of templates
         return;
     }
+
+    bool isFound = false;
+    auto parentTplVal = values.FindValue("$$__parent_template", isFound);
+    if (!isFound)
+    {
+        auto linked = GetLinkedParents(values);
+        if (linked)
+        {
+            linked->Render(os, values);
+            return;
+        }
+    }
+    else
+    {
+        // Intermediate template of the linked chain renders the next level of the chain
+        bool isConverted = false;
+        auto parentTplsList = ConvertToList(parentTplVal->second, isConverted);
+        InternalValue firstTpl = isConverted && parentTplsList.GetSize().value_or(0) == 1 ? parentTplsList.GetValueByIndex(0) : InternalValue();
+        auto ptr = GetIf<RendererPtr>(&firstTpl);
+        auto linked = ptr ? dynamic_cast<LinkedParentTemplates*>(ptr->get()) : nullptr;
+        if (linked && linked->RenderParent(this, os, values))
+            return;
+    }
+
     auto tpl = values.GetRendererCallback()->LoadTemplate(m_templateName);
     auto renderer =
-      VisitTemplateImpl<RendererPtr>(tpl, true, [this](auto tplPtr) { return CreateTemplateRenderer<ParentTemplateRenderer>(tplPtr, &m_blocks); });
+      VisitTemplateImpl<RendererPtr>(tpl, &values, [this](auto tplPtr) { return CreateTemplateRenderer<ParentTemplateRenderer>(tplPtr, &m_blocks); });
     if (renderer)
         renderer->Render(os, values);
 }
@@ -452,6 +876,9 @@ public:
     void Render(OutStream& os, RenderContext& values) override
     {
         RenderContext innerContext = values.Clone(m_withContext);
+        RenderContext::NestingGuard nesting(innerContext);
+        if (innerContext.HasError())
+            return;
         if (m_withContext)
             innerContext.EnterScope();
 
@@ -480,30 +907,16 @@ void IncludeStatement::Render(OutStream& os, RenderContext& values)
 
     auto doRender = [this, &values, &os](auto&& name) -> bool {
         auto tpl = values.GetRendererCallback()->LoadTemplate(name);
+        if (visit(TemplateNotFoundChecker(), tpl))
+            return false;
 
-        try
-        {
-            auto renderer = VisitTemplateImpl<RendererPtr>(
-              tpl, true, [this](auto tplPtr) { return CreateTemplateRenderer<IncludedTemplateRenderer>(tplPtr, m_withContext); });
+        auto renderer = VisitTemplateImpl<RendererPtr>(
+          tpl, &values, [this](auto tplPtr) { return CreateTemplateRenderer<IncludedTemplateRenderer>(tplPtr, m_withContext); });
+        if (renderer)
+            renderer->Render(os, values);
 
-            if (renderer)
-            {
-                renderer->Render(os, values);
-                return true;
-            }
-        }
-        catch (const ErrorInfoTpl<char>& err)
-        {
-            if (err.GetCode() != ErrorCode::FileNotFound)
-                throw;
-        }
-        catch (const ErrorInfoTpl<wchar_t>& err)
-        {
-            if (err.GetCode() != ErrorCode::FileNotFound)
-                throw;
-        }
-
-        return false;
+        // Load errors other than the missing template fail the render, so the rest of the alternatives aren't tried
+        return renderer || values.HasError();
     };
 
     bool rendered = false;
@@ -535,14 +948,14 @@ void IncludeStatement::Render(OutStream& os, RenderContext& values)
             extraParams.push_back(IntValue2Value(ListAdapter::CreateAdapter(std::move(files))));
         }
 
-        values.GetRendererCallback()->ThrowRuntimeError(ErrorCode::TemplateNotFound, std::move(extraParams));
+        values.SetRuntimeError(ErrorCode::TemplateNotFound, std::move(extraParams));
     }
 }
 
 class ImportedMacroRenderer : public RendererBase
 {
 public:
-    explicit ImportedMacroRenderer(InternalValueMap&& map, bool withContext)
+    explicit ImportedMacroRenderer(std::shared_ptr<const InternalValueMap> map, bool withContext)
         : m_importedContext(std::move(map))
         , m_withContext(withContext)
     {
@@ -553,7 +966,7 @@ public:
     void InvokeMacro(const Callable& callable, const CallParams& params, OutStream& stream, RenderContext& context)
     {
         auto ctx = context.Clone(m_withContext);
-        ctx.BindScope(&m_importedContext);
+        ctx.BindScope(m_importedContext.get());
         callable.GetStatementCallable()(params, stream, ctx);
     }
 
@@ -573,21 +986,50 @@ public:
     }
 
 private:
-    InternalValueMap m_importedContext;
+    std::shared_ptr<const InternalValueMap> m_importedContext;
     bool m_withContext;
 };
 
-void ImportStatement::Render(OutStream& /*os*/, RenderContext& values)
+template<typename CharT>
+std::shared_ptr<const InternalValueMap> GetImportedScope(const std::shared_ptr<TemplateImpl<CharT>>& tpl, bool withContext, RenderContext& values)
 {
-    auto name = m_nameExpr->Evaluate(values);
-
-    if (!m_renderer)
+    bool isShared = !withContext && tpl->IsMacroModule();
+    if (isShared)
     {
-        auto tpl = values.GetRendererCallback()->LoadTemplate(name);
-        m_renderer = VisitTemplateImpl<RendererPtr>(tpl, true, [](auto tplPtr) { return CreateTemplateRenderer<IncludedTemplateRenderer>(tplPtr, true); });
+        auto scope = tpl->GetModuleScope();
+        if (scope)
+            return scope;
     }
 
-    if (!m_renderer)
+    NullStreamWriter nullWriter;
+    OutStream tmpStream(&nullWriter);
+
+    RenderContext newContext = values.Clone(withContext);
+    RenderContext::NestingGuard nesting(newContext);
+    if (newContext.HasError())
+        return nullptr;
+    auto& intImportedScope = newContext.EnterScope();
+    tpl->GetRenderer()->Render(tmpStream, newContext);
+    // Scope of the failed render is incomplete
+    if (newContext.HasError())
+        return nullptr;
+
+    std::shared_ptr<const InternalValueMap> result = std::make_shared<InternalValueMap>(std::move(intImportedScope));
+    if (isShared)
+        tpl->SetModuleScope(result);
+    return result;
+}
+
+void ImportStatement::Render(OutStream& /*os*/, RenderContext& values)
+{
+    auto name = m_nameExpr->Evaluate(values);
+
+    // The imported template is resolved per render (the environment caches it) so the statement stays immutable
+    // and can be rendered concurrently
+    auto tpl = values.GetRendererCallback()->LoadTemplate(name);
+    auto importedScope = VisitTemplateImpl<std::shared_ptr<const InternalValueMap>>(
+      tpl, &values, [this, &values](auto tplPtr) { return GetImportedScope(tplPtr, m_withContext, values); });
+    if (!importedScope)
         return;
 
     std::string scopeName;
@@ -596,23 +1038,12 @@ void ImportStatement::Render(OutStream& /*os*/, RenderContext& values)
         scopeName = "$$_imported_" + GetAsSameString(scopeName, tsScopeName).value();
     }
 
-    TargetString str;
-    auto tmpStream = values.GetRendererCallback()->GetStreamOnString(str);
-
-    RenderContext newContext = values.Clone(m_withContext);
-    InternalValueMap importedScope;
-    {
-        auto& intImportedScope = newContext.EnterScope();
-        m_renderer->Render(tmpStream, newContext);
-        importedScope = std::move(intImportedScope);
-    }
-
-    ImportNames(values, importedScope, scopeName);
+    ImportNames(values, *importedScope, scopeName);
     values.GetCurrentScope()[scopeName] =
       std::static_pointer_cast<RendererBase>(std::make_shared<ImportedMacroRenderer>(std::move(importedScope), m_withContext));
 }
 
-void ImportStatement::ImportNames(RenderContext& values, InternalValueMap& importedScope, const std::string& scopeName) const
+void ImportStatement::ImportNames(RenderContext& values, const InternalValueMap& importedScope, const std::string& scopeName) const
 {
     InternalValueMap importedNs;
 
@@ -632,13 +1063,21 @@ void ImportStatement::ImportNames(RenderContext& values, InternalValueMap& impor
         auto callable = GetIf<Callable>(&var.second);
         if (!callable)
         {
-            imported = std::move(var.second);
+            // Lazy lists refer to the render context of the imported template, so they are materialized before it's gone
+            auto list = GetIf<ListAdapter>(&var.second);
+            if (list && !list->GetSize())
+                imported = ListAdapter::CreateAdapter(list->ToValueList());
+            else
+                imported = var.second;
         }
         else if (callable->GetKind() == Callable::Macro)
         {
-            imported = Callable(Callable::Macro, [fn = std::move(*callable), scopeName](const CallParams& params, OutStream& stream, RenderContext& context) {
+            bool isSafeOutput = callable->IsSafeOutput();
+            Callable importedMacro(Callable::Macro, [fn = *callable, scopeName](const CallParams& params, OutStream& stream, RenderContext& context) {
                 ImportedMacroRenderer::InvokeMacro(scopeName, fn, params, stream, context);
             });
+            importedMacro.SetSafeOutput(isSafeOutput);
+            imported = std::move(importedMacro);
         }
         else
         {
@@ -655,79 +1094,284 @@ void ImportStatement::ImportNames(RenderContext& values, InternalValueMap& impor
         values.GetCurrentScope()[m_namespace.value()] = CreateMapAdapter(std::move(importedNs));
 }
 
-std::vector<ArgumentInfo> MacroStatement::PrepareMacroParams(RenderContext& values)
+MacroStatement::MacroVarAttr MacroStatement::GetMacroVarAttr(const std::string& name)
 {
-    std::vector<ArgumentInfo> preparedParams;
+    for (auto& info : s_macroVarAttrs)
+    {
+        if (name == info.name)
+            return info.attr;
+    }
 
+    return MacroVarNone;
+}
+
+MacroStatement::PreparedParams MacroStatement::PrepareMacroParams(RenderContext& values)
+{
+    if (m_hasConstantDefaults)
+    {
+        auto constantParams = std::atomic_load(&m_constantParams);
+        if (constantParams)
+            return constantParams;
+    }
+
+    auto preparedParams = std::make_shared<std::vector<ArgumentInfo>>();
+    preparedParams->reserve(m_params.size());
     for (auto& p : m_params)
     {
         ArgumentInfo info(p.paramName, !p.defaultValue);
         if (p.defaultValue)
             info.defaultVal = p.defaultValue->Evaluate(values);
-        preparedParams.push_back(std::move(info));
+        preparedParams->push_back(std::move(info));
     }
 
+    // Values which refer to the render context (e.g. lazy lists) can't outlive it
+    bool isReusable = m_hasConstantDefaults && std::all_of(preparedParams->begin(), preparedParams->end(), [](auto& info) {
+        auto list = GetIf<ListAdapter>(&info.defaultVal);
+        return !info.defaultVal.ShouldExtendLifetime() && (!list || list->GetSize());
+    });
+    if (isReusable)
+        std::atomic_store(&m_constantParams, PreparedParams(preparedParams));
+
     return preparedParams;
 }
 
+struct MacroStatement::MacroMemo
+{
+    static constexpr size_t MaxEntries = 256;
+
+    std::mutex guard;
+    std::unordered_map<std::string, TargetString> outputs;
+};
+
+namespace
+{
+// Appends the type and the value of the macro arg to the memo key. Lists, maps and callables aren't comparable this way, the calls
+// with such args aren't memoized
+struct MacroMemoKeyBuilder
+{
+    std::string* key;
+
+    template<typename T>
+    bool operator()(const T&) const { return false; }
+    bool operator()(const EmptyValue&) const
+    {
+        *key += 'e';
+        return true;
+    }
+    bool operator()(bool val) const
+    {
+        *key += val ? 't' : 'f';
+        return true;
+    }
+    bool operator()(int64_t val) const
+    {
+        *key += 'i';
+        *key += std::to_string(val);
+        *key += ';';
+        return true;
+    }
+    bool operator()(double val) const
+    {
+        *key += 'd';
+        key->append(reinterpret_cast<const char*>(&val), sizeof(val));
+        return true;
+    }
+    template<typename CharT>
+    bool operator()(const std::basic_string<CharT>& val) const
+    {
+        return (*this)(nonstd::basic_string_view<CharT>(val));
+    }
+    template<typename CharT>
+    bool operator()(const nonstd::basic_string_view<CharT>& val) const
+    {
+        *key += sizeof(CharT) == 1 ? 's' : 'w';
+        *key += std::to_string(val.size());
+        *key += ':';
+        key->append(reinterpret_cast<const char*>(val.data()), val.size() * sizeof(CharT));
+        return true;
+    }
+    bool operator()(const TargetString& val) const { return nonstd::visit(*this, val); }
+    bool operator()(const TargetStringView& val) const { return nonstd::visit(*this, val); }
+};
+
+bool BuildMacroMemoKey(const CallParams& callParams, std::string& key)
+{
+    auto appendValue = [&key](const InternalValue& val) {
+        key += val.IsSafe() ? '+' : '-';
+        return nonstd::visit(MacroMemoKeyBuilder{&key}, val.GetData());
+    };
+
+    for (auto& p : callParams.posParams)
+    {
+        if (!appendValue(p))
+            return false;
+    }
+
+    // Keyword args are ordered by name, so the same args passed in the different order give the same key
+    std::vector<const std::pair<const std::string, InternalValue>*> kwParams;
+    kwParams.reserve(callParams.kwParams.size());
+    for (auto& p : callParams.kwParams)
+        kwParams.push_back(&p);
+    std::sort(kwParams.begin(), kwParams.end(), [](auto left, auto right) { return left->first < right->first; });
+    for (auto p : kwParams)
+    {
+        key += '|';
+        key += p->first;
+        key += '=';
+        if (!appendValue(p->second))
+            return false;
+    }
+
+    return true;
+}
+} // namespace
+
 void MacroStatement::Render(OutStream&, RenderContext& values)
 {
     auto p = PrepareMacroParams(values);
 
-    values.GetCurrentScope()[m_name] = Callable(Callable::Macro, [this, params = std::move(p)](const CallParams& callParams, OutStream& stream, RenderContext& context) {
-          InvokeMacroRenderer(params, callParams, stream, context);
+    // Memo is shared by the copies of the macro value, i.e. it lives as long as the scope of the macro definition
+    auto memo = m_isCached ? std::make_shared<MacroMemo>() : std::shared_ptr<MacroMemo>();
+    Callable macro(Callable::Macro, [this, params = std::move(p), memo](const CallParams& callParams, OutStream& stream, RenderContext& context) {
+          if (memo)
+              InvokeCachedMacroRenderer(*params, *memo, callParams, stream, context);
+          else
+              InvokeMacroRenderer(*params, callParams, stream, context);
       });
+    macro.SetSafeOutput(m_autoescape);
+    values.GetCurrentScope()[m_name] = std::move(macro);
 }
 
 void MacroStatement::InvokeMacroRenderer(const std::vector<ArgumentInfo>& params, const CallParams& callParams, OutStream& stream, RenderContext& context)
 {
-    InternalValueMap callArgs;
+    RenderContext::NestingGuard nesting(context);
+    if (context.HasError())
+        return;
+    auto& scope = context.EnterScope();
     InternalValueMap kwArgs;
     InternalValueList varArgs;
-
-    SetupCallArgs(params, callParams, context, callArgs, kwArgs, varArgs);
-    InternalValueList arguments;
-    InternalValueList defaults;
-    for (auto& a : params)
+    SetupCallArgs(params, callParams, scope, kwArgs, varArgs);
+
+    if (m_macroVarUsage & MacroVarKwargs)
+        scope["kwargs"s] = CreateMapAdapter(std::move(kwArgs));
+    if (m_macroVarUsage & MacroVarVarargs)
+        scope["varargs"s] = ListAdapter::CreateAdapter(std::move(varArgs));
+    if (m_macroVarUsage & MacroVarName)
+        scope["name"s] = static_cast<std::string>(m_name);
+    if (m_macroVarUsage & (MacroVarArguments | MacroVarDefaults))
     {
-        arguments.emplace_back(a.name);
-        defaults.emplace_back(a.defaultVal);
+        InternalValueList arguments;
+        InternalValueList defaults;
+        for (auto& a : params)
+        {
+            arguments.emplace_back(a.name);
+            defaults.emplace_back(a.defaultVal);
+        }
+        scope["arguments"s] = ListAdapter::CreateAdapter(std::move(arguments));
+        scope["defaults"s] = ListAdapter::CreateAdapter(std::move(defaults));
     }
 
-    auto& scope = context.EnterScope();
-    for (auto& a : callArgs)
-        scope[a.first] = std::move(a.second);
+    m_mainBody->Render(stream, context);
 
-    scope["kwargs"s] = CreateMapAdapter(std::move(kwArgs));
-    scope["varargs"s] = ListAdapter::CreateAdapter(std::move(varArgs));
+    context.ExitScope();
+}
 
-    scope["name"s] = static_cast<std::string>(m_name);
-    scope["arguments"s] = ListAdapter::CreateAdapter(std::move(arguments));
-    scope["defaults"s] = ListAdapter::CreateAdapter(std::move(defaults));
+void MacroStatement::InvokeCachedMacroRenderer(const std::vector<ArgumentInfo>& params, MacroMemo& memo, const CallParams& callParams, OutStream& stream, RenderContext& context)
+{
+    // Output of the macro called from the 'call' block depends on the caller body, so such calls are always rendered
+    bool hasCaller = false;
+    context.FindValue("caller"s, hasCaller);
+    std::string key;
+    if (hasCaller || !BuildMacroMemoKey(callParams, key))
+    {
+        InvokeMacroRenderer(params, callParams, stream, context);
+        return;
+    }
 
-    m_mainBody->Render(stream, context);
+    {
+        std::lock_guard<std::mutex> l(memo.guard);
+        auto p = memo.outputs.find(key);
+        if (p != memo.outputs.end())
+        {
+            nonstd::visit([&stream](auto& str) { stream.WriteBuffer(str.data(), str.size()); }, p->second);
+            return;
+        }
+    }
 
-    context.ExitScope();
+    auto buffer = context.AcquireCaptureBuffer();
+    {
+        auto bodyStream = context.GetRendererCallback()->GetStreamOnString(buffer);
+        InvokeMacroRenderer(params, callParams, bodyStream, context);
+    }
+    nonstd::visit([&stream](auto& str) { stream.WriteBuffer(str.data(), str.size()); }, buffer);
+
+    // Output of the failed call is incomplete
+    if (context.HasError())
+    {
+        context.ReleaseCaptureBuffer(std::move(buffer));
+        return;
+    }
+
+    std::lock_guard<std::mutex> l(memo.guard);
+    if (memo.outputs.size() < MacroMemo::MaxEntries)
+        memo.outputs.emplace(std::move(key), std::move(buffer));
+    else
+        context.ReleaseCaptureBuffer(std::move(buffer));
 }
 
 void MacroStatement::SetupCallArgs(const std::vector<ArgumentInfo>& argsInfo,
                                    const CallParams& callParams,
-                                   RenderContext& /* context */,
                                    InternalValueMap& callArgs,
                                    InternalValueMap& kwArgs,
                                    InternalValueList& varArgs)
 {
-    bool isSucceeded = true;
-    ParsedArguments args = helpers::ParseCallParams(argsInfo, callParams, isSucceeded);
+    // Positional args are bound to the params in order unless the macro has the optional params before the mandatory ones. Calls
+    // which mix such positional args with the keyword ones are bound by the generic rules
+    bool isMandatoryFirst = argsInfo.empty() || argsInfo.front().mandatory ||
+        std::none_of(argsInfo.begin(), argsInfo.end(), [](auto& a) { return a.mandatory; });
+    bool isPositionalCall = callParams.kwParams.empty() && isMandatoryFirst;
+    if (!isPositionalCall && !callParams.posParams.empty())
+    {
+        bool isSucceeded = true;
+        ParsedArguments args = helpers::ParseCallParams(argsInfo, callParams, isSucceeded);
+
+        for (auto& a : args.args)
+            callArgs[a.first] = std::move(a.second);
 
-    for (auto& a : args.args)
-        callArgs[a.first] = std::move(a.second);
+        for (auto& a : args.extraKwArgs)
+            kwArgs[a.first] = std::move(a.second);
 
-    for (auto& a : args.extraKwArgs)
-        kwArgs[a.first] = std::move(a.second);
+        for (auto& a : args.extraPosArgs)
+            varArgs.push_back(std::move(a));
+        return;
+    }
+
+    auto posCount = isPositionalCall ? std::min(argsInfo.size(), callParams.posParams.size()) : 0;
+    for (size_t idx = 0; idx != argsInfo.size(); ++ idx)
+    {
+        auto& info = argsInfo[idx];
+        if (idx < posCount)
+        {
+            callArgs[info.name] = callParams.posParams[idx];
+            continue;
+        }
+
+        auto kwP = callParams.kwParams.empty() ? callParams.kwParams.end() : callParams.kwParams.find(info.name);
+        if (kwP != callParams.kwParams.end())
+            callArgs[info.name] = kwP->second;
+        else if (!IsEmpty(info.defaultVal))
+            callArgs[info.name] = info.defaultVal;
+    }
+
+    for (auto& kw : callParams.kwParams)
+    {
+        bool isParam = std::any_of(argsInfo.begin(), argsInfo.end(), [&kw](auto& a) { return a.name == kw.first; });
+        if (!isParam)
+            kwArgs[kw.first] = kw.second;
+    }
 
-    for (auto& a : args.extraPosArgs)
-        varArgs.push_back(std::move(a));
+    for (auto idx = posCount; idx < callParams.posParams.size(); ++ idx)
+        varArgs.push_back(callParams.posParams[idx]);
 }
 
 void MacroStatement::SetupMacroScope(InternalValueMap&)
@@ -756,12 +1400,18 @@ void MacroCallStatement::Render(OutStream& os, RenderContext& values)
 
     auto p = PrepareMacroParams(values);
 
-    curScope["caller"] = Callable(Callable::Macro, [this, params = std::move(p)](const CallParams& callParams, OutStream& stream, RenderContext& context) {
-        InvokeMacroRenderer(params, callParams, stream, context);
+    Callable caller(Callable::Macro, [this, params = std::move(p)](const CallParams& callParams, OutStream& stream, RenderContext& context) {
+        InvokeMacroRenderer(*params, callParams, stream, context);
     });
+    caller.SetSafeOutput(m_autoescape);
+    curScope["caller"] = std::move(caller);
 
-    auto callParams = helpers::EvaluateCallParams(m_callParams, values);
-    callable->GetStatementCallable()(callParams, os, values);
+    values.CountStep();
+    if (!values.HasError())
+    {
+        auto callParams = helpers::EvaluateCallParams(m_callParams, values);
+        callable->GetStatementCallable()(callParams, os, values);
+    }
 
     if (hasCallerVal)
         curScope["caller"] = prevCaller;
@@ -778,24 +1428,79 @@ void DoStatement::Render(OutStream& /*os*/, RenderContext& values)
 
 void WithStatement::Render(OutStream& os, RenderContext& values)
 {
-    auto innerValues = values.Clone(true);
-    auto& scope = innerValues.EnterScope();
-
+    // Scope variables are evaluated in the outer scope, so they are calculated before the new scope goes live
+    boost::container::small_vector<InternalValue, 4> scopeValues;
     for (auto& var : m_scopeVars)
-        scope[var.first] = var.second->Evaluate(values);
+        scopeValues.push_back(var.second->Evaluate(values));
+
+    auto& scope = values.EnterScope();
+    for (size_t idx = 0; idx != m_scopeVars.size(); ++ idx)
+        scope[m_scopeVars[idx].first] = std::move(scopeValues[idx]);
 
-    m_mainBody->Render(os, innerValues);
+    m_mainBody->Render(os, values);
 
-    innerValues.ExitScope();
+    values.ExitScope();
 }
 
 void FilterStatement::Render(OutStream& os, RenderContext& values)
 {
-    TargetString arg;
-    auto argStream = values.GetRendererCallback()->GetStreamOnString(arg);
-    auto innerValues = values.Clone(true);
-    m_body->Render(argStream, innerValues);
-    const auto result = m_expr->Evaluate(std::move(arg), values);
-    os.WriteValue(result);
+    auto buffer = values.AcquireCaptureBuffer();
+    {
+        auto argStream = values.GetRendererCallback()->GetStreamOnString(buffer);
+        values.EnterScope();
+        m_body->Render(argStream, values);
+        values.ExitScope();
+        // Filtered value is written right away, so the filter gets the view of the captured body (and the result may refer to it)
+        auto arg = nonstd::visit([](auto& str) { return TargetStringView(nonstd::basic_string_view<typename std::decay_t<decltype(str)>::value_type>(str)); }, buffer);
+        const auto result = m_expr->Evaluate(InternalValue(arg), values);
+        os.WriteValue(result);
+    }
+    values.ReleaseCaptureBuffer(std::move(buffer));
+}
+
+void CacheStatement::Render(OutStream& os, RenderContext& values)
+{
+    auto callback = values.GetRendererCallback();
+    auto cache = callback->GetFragmentCache();
+    if (!cache)
+    {
+        values.EnterScope();
+        m_body->Render(os, values);
+        values.ExitScope();
+        return;
+    }
+
+    auto toNarrow = [](auto& str) { return ConvertString<std::string>(str); };
+    auto keyStr = callback->GetAsTargetString(m_keyExpr->Evaluate(values));
+    auto key = m_fragmentId;
+    key += '\n';
+    key += nonstd::visit(toNarrow, keyStr);
+
+    auto fragment = cache->Get(key);
+    if (fragment)
+    {
+        // Body output is stored already escaped, so the fragment goes to the output as is
+        os.WriteValue(InternalValue(std::move(fragment.value())));
+        return;
+    }
+
+    auto buffer = values.AcquireCaptureBuffer();
+    {
+        auto bodyStream = callback->GetStreamOnString(buffer);
+        values.EnterScope();
+        m_body->Render(bodyStream, values);
+        values.ExitScope();
+    }
+    nonstd::visit([&os](auto& str) { os.WriteBuffer(str.data(), str.size()); }, buffer);
+    // Output of the failed body is incomplete
+    if (values.HasError())
+    {
+        values.ReleaseCaptureBuffer(std::move(buffer));
+        return;
+    }
+
+    auto ttl = m_ttlExpr ? ConvertToInt(m_ttlExpr->Evaluate(values)) : 0;
+    cache->Put(key, nonstd::visit(toNarrow, buffer), std::chrono::seconds(ttl > 0 ? ttl : 0));
+    values.ReleaseCaptureBuffer(std::move(buffer));
 }
 } // jinja2
@@ -4,6 +4,9 @@
 #include "renderer.h"
 #include "expression_evaluator.h"
 
+#include <boost/container/small_vector.hpp>
+
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -33,7 +36,30 @@ class ForStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
     
+    // Attributes of the 'loop' variable. Loop constructs only the attributes referenced from its body
+    enum LoopVarAttr : uint32_t
+    {
+        LoopVarNone = 0,
+        LoopVarIndex = 1 << 0,
+        LoopVarIndex0 = 1 << 1,
+        LoopVarFirst = 1 << 2,
+        LoopVarLast = 1 << 3,
+        LoopVarLength = 1 << 4,
+        LoopVarPrevItem = 1 << 5,
+        LoopVarNextItem = 1 << 6,
+        LoopVarCycle = 1 << 7,
+        LoopVarDepth = 1 << 8,
+        LoopVarDepth0 = 1 << 9,
+        LoopVarCall = 1 << 10,
+        LoopVarRevIndex = 1 << 11,
+        LoopVarRevIndex0 = 1 << 12,
+        // Attributes which need the size of the list. Lists of the unknown size are read to the end only if the body uses them
+        LoopVarSizeBased = LoopVarLength | LoopVarRevIndex | LoopVarRevIndex0,
+        LoopVarAll = 0xffffffff
+    };
+
     ForStatement(std::vector<std::string> vars, ExpressionEvaluatorPtr<> expr, ExpressionEvaluatorPtr<> ifExpr, bool isRecursive)
         : m_vars(std::move(vars))
         , m_value(expr)
@@ -42,6 +68,8 @@ public:
     {
     }
 
+    static LoopVarAttr GetLoopVarAttr(const std::string& name);
+
     void SetMainBody(RendererPtr renderer)
     {
         m_mainBody = std::move(renderer);
@@ -52,9 +80,24 @@ public:
         m_elseBody = std::move(renderer);
     }
 
+    void SetLoopVarUsage(uint32_t usage)
+    {
+        // 'loop.cycle()' picks the item by the 'loop.index0' value
+        m_loopVarUsage = (usage & LoopVarCycle) != 0 ? usage | LoopVarIndex0 : usage;
+    }
+
+    auto& GetLoopValue() const {return m_value;}
+    auto& GetMainBody() const {return m_mainBody;}
+    auto& GetElseBody() const {return m_elseBody;}
+    auto GetLoopVarUsage() const {return m_loopVarUsage;}
+
     void Render(OutStream& os, RenderContext& values) override;
 
+    class LoopIterator;
+
 private:
+    class LoopVarAccessor;
+
   void RenderLoop(const InternalValue &loopVal, OutStream &os,
                   RenderContext &values, int level);
     ListAdapter CreateFilteredAdapter(const ListAdapter& loopItems, RenderContext& values) const;
@@ -64,17 +107,107 @@ private:
     ExpressionEvaluatorPtr<> m_value;
     ExpressionEvaluatorPtr<> m_ifExpr;
     bool m_isRecursive;
+    uint32_t m_loopVarUsage = LoopVarAll;
     RendererPtr m_mainBody;
     RendererPtr m_elseBody;
 
 };
 
+// State of the loop iteration, updated in place. Values of the 'loop' variable attributes are produced from it on access
+class ForStatement::LoopVarAccessor : public IMapAccessor
+{
+public:
+    LoopVarAccessor(ForStatement* owner, int level)
+        : m_owner(owner)
+        , m_level(level)
+    {
+    }
+
+    size_t GetSize() const override { return GetKeys().size(); }
+    bool HasValue(const std::string& name) const override { return IsAvailable(GetLoopVarAttr(name)); }
+    InternalValue GetItem(const std::string& name) const override;
+    std::vector<std::string> GetKeys() const override;
+    GenericMap CreateGenericMap() const override;
+    bool ShouldExtendLifetime() const override { return false; }
+
+    void MakeIndexedList();
+
+    ListAccessorEnumeratorPtr enumerator;
+    ListAdapter indexedList;
+    nonstd::optional<size_t> listSize;
+    size_t itemIdx = 0;
+    bool isIterating = false;
+    bool isLast = false;
+    InternalValue prevValue;
+    InternalValue curValue;
+    InternalValue nextValue;
+
+private:
+    bool IsAvailable(LoopVarAttr attr) const;
+
+    // Size of the streamed list is unknown until the end of it. In this case the value is computed (and the rest of the list is
+    // read) only when it's actually used
+    template<typename Fn>
+    InternalValue MakeSizeBasedValue(Fn fn) const
+    {
+        if (listSize)
+            return static_cast<int64_t>(fn(*this));
+
+        return MakeDynamicProperty([accessor = const_cast<LoopVarAccessor*>(this), fn](const CallParams& /*params*/, RenderContext & /*context*/) -> InternalValue {
+            if (!accessor->listSize)
+                accessor->MakeIndexedList();
+            return static_cast<int64_t>(fn(*accessor));
+        });
+    }
+
+private:
+    ForStatement* m_owner;
+    int m_level;
+    mutable InternalValue m_callable;
+};
+
+// Iteration over the loop items, shared by the tree render and the bytecode engine (see RenderProgram). Enters the loop scope and
+// binds the loop variables to each item. The 'loop' variable refers to the iterator, so it isn't copyable
+class ForStatement::LoopIterator
+{
+public:
+    LoopIterator(ForStatement* owner, const InternalValue& loopVal, RenderContext& values, int level);
+    LoopIterator(const LoopIterator&) = delete;
+    LoopIterator& operator=(const LoopIterator&) = delete;
+
+    // Moves to the next item. False at the end of the items or if the render is stopped (see RenderContext::HasError)
+    bool MoveNext();
+    // Unbinds the loop variables. Returns true if no item was iterated, so the else body should be rendered. The caller exits the
+    // loop scope after the else body
+    bool Finish();
+
+private:
+    bool MoveNextInRange();
+    void SetVar(size_t idx, const InternalValue& val);
+
+private:
+    ForStatement* m_owner;
+    RenderContext& m_values;
+    InternalValueMap& m_context;
+    size_t m_slotsCount;
+    LoopVarAccessor m_loopVar;
+    boost::container::small_vector<InternalValue*, 4> m_varSlots;
+    ListAdapter m_loopItems;
+    ListAdapter m_filteredList;
+    // Items of the integer loop are computed in place, without the enumerator
+    const IntegerRange* m_range = nullptr;
+    bool m_isConverted = false;
+    bool m_isStarted = false;
+    bool m_isRendered = false;
+};
+
 class ElseBranchStatement;
 
 class IfStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     IfStatement(ExpressionEvaluatorPtr<> expr)
         : m_expr(expr)
@@ -91,6 +224,10 @@ public:
         m_elseBranches.push_back(branch);
     }
 
+    auto& GetCondition() const {return m_expr;}
+    auto& GetMainBody() const {return m_mainBody;}
+    auto& GetElseBranches() {return m_elseBranches;}
+
     void Render(OutStream& os, RenderContext& values) override;
 
 private:
@@ -104,6 +241,7 @@ class ElseBranchStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     ElseBranchStatement(ExpressionEvaluatorPtr<> expr)
         : m_expr(expr)
@@ -115,6 +253,12 @@ public:
     {
         m_mainBody = std::move(renderer);
     }
+    void SetCondition(ExpressionEvaluatorPtr<> expr)
+    {
+        m_expr = std::move(expr);
+    }
+    auto& GetCondition() const {return m_expr;}
+    auto& GetMainBody() const {return m_mainBody;}
     void Render(OutStream& os, RenderContext& values) override;
 
 private:
@@ -130,9 +274,12 @@ public:
     {
     }
 
-protected:
+    // Assigns the value to the fields in the current scope
     void AssignBody(InternalValue, RenderContext&);
 
+protected:
+    const std::vector<std::string>& GetFields() const {return m_fields;}
+
 private:
     const std::vector<std::string> m_fields;
 };
@@ -141,6 +288,7 @@ class SetLineStatement final : public SetStatement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     SetLineStatement(std::vector<std::string> fields, ExpressionEvaluatorPtr<> expr)
         : SetStatement(std::move(fields)), m_expr(std::move(expr))
@@ -149,6 +297,8 @@ public:
 
     void Render(OutStream& os, RenderContext& values) override;
 
+    auto& GetExpression() const {return m_expr;}
+
 private:
     const ExpressionEvaluatorPtr<> m_expr;
 };
@@ -162,18 +312,24 @@ public:
     {
         m_body = std::move(renderer);
     }
+    const RendererPtr& GetBody() const {return m_body;}
+    // Body with autoescaping produces the safe value
+    bool IsAutoescape() const {return m_autoescape;}
+    void SetAutoescape(bool autoescape) {m_autoescape = autoescape;}
 
 protected:
     InternalValue RenderBody(RenderContext&);
 
 private:
     RendererPtr m_body;
+    bool m_autoescape = false;
 };
 
 class SetRawBlockStatement final : public SetBlockStatement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     using SetBlockStatement::SetBlockStatement;
 
@@ -184,6 +340,7 @@ class SetFilteredBlockStatement final : public SetBlockStatement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     explicit SetFilteredBlockStatement(std::vector<std::string> fields, ExpressionEvaluatorPtr<ExpressionFilter> expr)
         : SetBlockStatement(std::move(fields)), m_expr(std::move(expr))
@@ -200,6 +357,7 @@ class ParentBlockStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     ParentBlockStatement(std::string name, bool isScoped)
         : m_name(std::move(name))
@@ -211,6 +369,7 @@ public:
     {
         m_mainBody = std::move(renderer);
     }
+    auto& GetMainBody() const {return m_mainBody;}
     void Render(OutStream &os, RenderContext &values) override;
 
 private:
@@ -223,6 +382,7 @@ class BlockStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     BlockStatement(std::string name)
         : m_name(std::move(name))
@@ -235,6 +395,7 @@ public:
     {
         m_mainBody = std::move(renderer);
     }
+    auto& GetMainBody() const {return m_mainBody;}
     void Render(OutStream &os, RenderContext &values) override;
 
 private:
@@ -242,10 +403,13 @@ private:
     RendererPtr m_mainBody;
 };
 
+class LinkedParentTemplates;
+
 class ExtendsStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     using BlocksCollection = std::unordered_map<std::string, StatementPtr<BlockStatement>>;
 
@@ -260,10 +424,18 @@ public:
     {
         m_blocks[block->GetName()] = block;
     }
+    auto& GetBlocks() const {return m_blocks;}
+    auto& GetTemplateName() const {return m_templateName;}
+    bool IsPath() const {return m_isPath;}
+private:
+    std::shared_ptr<LinkedParentTemplates> GetLinkedParents(RenderContext& values) const;
+
 private:
     std::string m_templateName;
     bool m_isPath;
     BlocksCollection m_blocks;
+    // Inheritance chain of the most derived template, resolved by the first render and shared by the concurrent ones
+    mutable std::shared_ptr<LinkedParentTemplates> m_linkedParents;
     void DoRender(OutStream &os, RenderContext &values);
 };
 
@@ -271,6 +443,7 @@ class IncludeStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     IncludeStatement(bool ignoreMissing, bool withContext)
         : m_ignoreMissing(ignoreMissing)
@@ -281,6 +454,7 @@ public:
     {
         m_expr = std::move(expr);
     }
+    auto& GetIncludeNamesExpr() const {return m_expr;}
 
     void Render(OutStream& os, RenderContext& values) override;
 private:
@@ -293,6 +467,7 @@ class ImportStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     explicit ImportStatement(bool withContext)
         : m_withContext(withContext)
@@ -302,6 +477,7 @@ public:
     {
         m_nameExpr = std::move(expr);
     }
+    auto& GetImportNameExpr() const {return m_nameExpr;}
 
     void SetNamespace(std::string name)
     {
@@ -316,11 +492,10 @@ public:
     void Render(OutStream& os, RenderContext& values) override;
 
 private:
-    void ImportNames(RenderContext& values, InternalValueMap& importedScope, const std::string& scopeName) const;
+    void ImportNames(RenderContext& values, const InternalValueMap& importedScope, const std::string& scopeName) const;
 
 private:
     bool m_withContext;
-    RendererPtr m_renderer;
     ExpressionEvaluatorPtr<> m_nameExpr;
     nonstd::optional<std::string> m_namespace;
     std::unordered_map<std::string, std::string> m_namesToImport;
@@ -330,36 +505,73 @@ class MacroStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
+
+    // Special variables of the macro scope. Macro sets only the variables referenced from its body
+    enum MacroVarAttr : uint32_t
+    {
+        MacroVarNone = 0,
+        MacroVarKwargs = 1 << 0,
+        MacroVarVarargs = 1 << 1,
+        MacroVarName = 1 << 2,
+        MacroVarArguments = 1 << 3,
+        MacroVarDefaults = 1 << 4,
+        MacroVarAll = 0xffffffff
+    };
 
     MacroStatement(std::string name, MacroParams params)
         : m_name(std::move(name))
         , m_params(std::move(params))
     {
+        m_hasConstantDefaults = std::all_of(m_params.begin(), m_params.end(), [](auto& p) { return !p.defaultValue || p.defaultValue->IsConstant(); });
     }
 
+    static MacroVarAttr GetMacroVarAttr(const std::string& name);
+
     void SetMainBody(RendererPtr renderer)
     {
         m_mainBody = std::move(renderer);
     }
+    auto& GetMainBody() const {return m_mainBody;}
+    auto& GetParams() const {return m_params;}
+    // Output of the macro defined with autoescaping is safe
+    bool IsAutoescape() const {return m_autoescape;}
+    void SetAutoescape(bool autoescape) {m_autoescape = autoescape;}
+    void SetMacroVarUsage(uint32_t usage) {m_macroVarUsage = usage;}
+    auto GetMacroVarUsage() const {return m_macroVarUsage;}
+    // Output of the cached macro ('{% macro name(...) cached %}') is memoized by the call args for the lifetime of the macro definition
+    bool IsCached() const {return m_isCached;}
+    void SetCached(bool cached) {m_isCached = cached;}
 
     void Render(OutStream &os, RenderContext &values) override;
 
 protected:
+    using PreparedParams = std::shared_ptr<const std::vector<ArgumentInfo>>;
+    struct MacroMemo;
+
     void InvokeMacroRenderer(const std::vector<ArgumentInfo>& params, const CallParams& callParams, OutStream& stream, RenderContext& context);
-    void SetupCallArgs(const std::vector<ArgumentInfo>& argsInfo, const CallParams& callParams, RenderContext& context, InternalValueMap& callArgs, InternalValueMap& kwArgs, InternalValueList& varArgs);
+    void InvokeCachedMacroRenderer(const std::vector<ArgumentInfo>& params, MacroMemo& memo, const CallParams& callParams, OutStream& stream, RenderContext& context);
+    void SetupCallArgs(const std::vector<ArgumentInfo>& argsInfo, const CallParams& callParams, InternalValueMap& callArgs, InternalValueMap& kwArgs, InternalValueList& varArgs);
     virtual void SetupMacroScope(InternalValueMap& scope);
-    std::vector<ArgumentInfo> PrepareMacroParams(RenderContext& values);
+    PreparedParams PrepareMacroParams(RenderContext& values);
 
 protected:
     std::string m_name;
     MacroParams m_params;
     RendererPtr m_mainBody;
+    bool m_autoescape = false;
+    uint32_t m_macroVarUsage = MacroVarAll;
+    bool m_isCached = false;
+    bool m_hasConstantDefaults = false;
+    // Params with the constant default values are prepared once, on the first render
+    PreparedParams m_constantParams;
 };
 
 class MacroCallStatement : public MacroStatement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     MacroCallStatement(std::string macroName, CallParamsInfo callParams, MacroParams callbackParams)
         : MacroStatement("$call$", std::move(callbackParams))
@@ -382,6 +594,7 @@ class DoStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     DoStatement(ExpressionEvaluatorPtr<> expr) : m_expr(expr) {}
 
@@ -395,6 +608,7 @@ class WithStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     void SetScopeVars(std::vector<std::pair<std::string, ExpressionEvaluatorPtr<>>> vars)
     {
@@ -404,6 +618,7 @@ public:
     {
         m_mainBody = std::move(renderer);
     }
+    auto& GetMainBody() const {return m_mainBody;}
 
     void Render(OutStream &os, RenderContext &values) override;
 
@@ -416,6 +631,7 @@ class FilterStatement : public Statement
 {
 public:
     VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
 
     explicit FilterStatement(ExpressionEvaluatorPtr<ExpressionFilter> expr)
       : m_expr(std::move(expr)) {}
@@ -424,6 +640,7 @@ public:
     {
         m_body = std::move(renderer);
     }
+    auto& GetBody() const {return m_body;}
     
     void Render(OutStream &, RenderContext &) override;
 
@@ -431,6 +648,36 @@ private:
     ExpressionEvaluatorPtr<ExpressionFilter> m_expr;
     RendererPtr m_body;
 };
+
+// Renders the body once and takes it from the fragment cache of the environment (see IFragmentCache) until the ttl expires
+class CacheStatement : public Statement
+{
+public:
+    VISITABLE_STATEMENT();
+    SERIALIZABLE_STATEMENT()
+
+    // Fragment id distinguishes the statement among the other ones of the environment ('<template name>:<statement offset>')
+    CacheStatement(std::string fragmentId, ExpressionEvaluatorPtr<> keyExpr, ExpressionEvaluatorPtr<> ttlExpr)
+        : m_fragmentId(std::move(fragmentId))
+        , m_keyExpr(std::move(keyExpr))
+        , m_ttlExpr(std::move(ttlExpr))
+    {
+    }
+
+    void SetBody(RendererPtr renderer)
+    {
+        m_body = std::move(renderer);
+    }
+    auto& GetBody() const {return m_body;}
+
+    void Render(OutStream &, RenderContext &) override;
+
+private:
+    std::string m_fragmentId;
+    ExpressionEvaluatorPtr<> m_keyExpr;
+    ExpressionEvaluatorPtr<> m_ttlExpr;
+    RendererPtr m_body;
+};
 } // jinja2
 
 
@@ -1,24 +1,196 @@
 #include "filters.h"
+#include "string_escape.h"
 #include "testers.h"
 #include "value_visitors.h"
 #include "value_helpers.h"
 
 #include <algorithm>
+#include <locale>
 #include <numeric>
 #include <regex>
 #include <sstream>
 
-#include <boost/algorithm/string/trim_all.hpp>
-#include <boost/algorithm/string/replace.hpp>
-
-namespace ba = boost::algorithm;
-
 namespace jinja2
 {
 
 namespace filters
 {
 
+// Classification and case conversion of the string chars. ASCII chars are handled arithmetically (so the loops over the
+// narrow strings are vectorized). Bytes of the UTF-8 multibyte sequences are kept as is and are treated as letters. Non-ASCII
+// wide chars are handled with the ctype facet of the global locale, which is requested only if such chars are met
+template<typename CharT>
+class StringChars
+{
+public:
+    bool IsAlpha(CharT ch) const
+    {
+        if (IsAscii(ch))
+            return static_cast<unsigned>((ch | 0x20) - 'a') < 26;
+        return !IsWide() || GetFacet().is(std::ctype_base::alpha, ch);
+    }
+
+    bool IsAlNum(CharT ch) const
+    {
+        if (IsAscii(ch))
+            return static_cast<unsigned>((ch | 0x20) - 'a') < 26 || static_cast<unsigned>(ch - '0') < 10;
+        return !IsWide() || GetFacet().is(std::ctype_base::alnum, ch);
+    }
+
+    CharT ToUpper(CharT ch) const
+    {
+        if (IsAscii(ch))
+            return static_cast<unsigned>(ch - 'a') < 26 ? static_cast<CharT>(ch - 'a' + 'A') : ch;
+        return IsWide() ? GetFacet().toupper(ch) : ch;
+    }
+
+    CharT ToLower(CharT ch) const
+    {
+        if (IsAscii(ch))
+            return static_cast<unsigned>(ch - 'A') < 26 ? static_cast<CharT>(ch - 'A' + 'a') : ch;
+        return IsWide() ? GetFacet().tolower(ch) : ch;
+    }
+
+    bool IsSpace(CharT ch) const
+    {
+        if (IsAscii(ch))
+            return ch == ' ' || static_cast<unsigned>(ch - '\t') < 5;
+        return IsWide() && GetFacet().is(std::ctype_base::space, ch);
+    }
+
+private:
+    static bool IsAscii(CharT ch) { return static_cast<std::make_unsigned_t<CharT>>(ch) < 0x80; }
+    static constexpr bool IsWide() { return sizeof(CharT) != 1; }
+
+    const std::ctype<CharT>& GetFacet() const
+    {
+        if (!m_facet)
+        {
+            m_locale = std::locale();
+            m_facet = &std::use_facet<std::ctype<CharT>>(m_locale.value());
+        }
+        return *m_facet;
+    }
+
+private:
+    mutable nonstd::optional<std::locale> m_locale;
+    mutable const std::ctype<CharT>* m_facet = nullptr;
+};
+
+template<typename CharT, typename Fn>
+auto ConvertChars(const nonstd::basic_string_view<CharT>& srcStr, Fn&& fn)
+{
+    std::basic_string<CharT> result(srcStr.size(), CharT());
+    std::transform(srcStr.begin(), srcStr.end(), result.begin(), std::forward<Fn>(fn));
+    return result;
+}
+
+// Position of the first occurrence of 'pattern' in 'str' at or after 'pos', npos if there is none. Candidates are found by the first char
+// of the pattern with char_traits::find (memchr for the narrow strings), the rest of the pattern is compared in place
+template<typename CharT>
+size_t FindSubstring(const nonstd::basic_string_view<CharT>& str, const nonstd::basic_string_view<CharT>& pattern, size_t pos)
+{
+    using Traits = std::char_traits<CharT>;
+    auto npos = nonstd::basic_string_view<CharT>::npos;
+    if (pattern.empty() || pos > str.size() || str.size() - pos < pattern.size())
+        return npos;
+
+    auto last = str.data() + (str.size() - pattern.size());
+    for (auto p = str.data() + pos; p <= last; ++ p)
+    {
+        p = Traits::find(p, static_cast<size_t>(last - p) + 1, pattern[0]);
+        if (!p)
+            break;
+        if (Traits::compare(p + 1, pattern.data() + 1, pattern.size() - 1) == 0)
+            return static_cast<size_t>(p - str.data());
+    }
+    return npos;
+}
+
+// Replaces the first 'count' (all if zero) occurrences of 'oldStr' in one pass. Occurrences are counted first, so the result is allocated
+// once. Returns false (and leaves 'result' untouched) if there is nothing to replace
+template<typename CharT>
+bool ReplaceSubstrings(const nonstd::basic_string_view<CharT>& str, const nonstd::basic_string_view<CharT>& oldStr,
+                       const nonstd::basic_string_view<CharT>& newStr, int64_t count, std::basic_string<CharT>& result)
+{
+    auto npos = nonstd::basic_string_view<CharT>::npos;
+    size_t matchesCount = 0;
+    for (auto pos = FindSubstring(str, oldStr, 0); pos != npos && (count == 0 || static_cast<int64_t>(matchesCount) < count);
+         pos = FindSubstring(str, oldStr, pos + oldStr.size()))
+        ++ matchesCount;
+
+    if (matchesCount == 0)
+        return false;
+
+    result.clear();
+    result.reserve(str.size() - matchesCount * oldStr.size() + matchesCount * newStr.size());
+    size_t prev = 0;
+    for (size_t n = 0; n != matchesCount; ++ n)
+    {
+        auto pos = FindSubstring(str, oldStr, prev);
+        result.append(str.data() + prev, pos - prev);
+        result.append(newStr.data(), newStr.size());
+        prev = pos + oldStr.size();
+    }
+    result.append(str.data() + prev, str.size() - prev);
+    return true;
+}
+
+// Bounds of the string without the leading and trailing spaces
+template<typename CharT>
+void GetTrimmedBounds(const nonstd::basic_string_view<CharT>& str, const StringChars<CharT>& chars, size_t& begin, size_t& end)
+{
+    begin = 0;
+    end = str.size();
+    for (; begin != end && chars.IsSpace(str[begin]); ++ begin);
+    for (; end != begin && chars.IsSpace(str[end - 1]); -- end);
+}
+
+// Trims the string and compresses the inner runs of spaces into their first chars (as boost::algorithm::trim_all does). Returns false (and
+// leaves 'result' untouched) if there are no inner runs, so the trimmed bounds are the result
+template<typename CharT>
+bool CompressSpaces(const nonstd::basic_string_view<CharT>& str, size_t begin, size_t end, const StringChars<CharT>& chars, std::basic_string<CharT>& result)
+{
+    size_t runPos = begin + 1;
+    for (; runPos < end && !(chars.IsSpace(str[runPos]) && chars.IsSpace(str[runPos - 1])); ++ runPos);
+    if (runPos >= end)
+        return false;
+
+    result.assign(str.data() + begin, runPos - begin);
+    for (auto idx = runPos + 1; idx < end; ++ idx)
+    {
+        if (!(chars.IsSpace(str[idx]) && chars.IsSpace(str[idx - 1])))
+            result.push_back(str[idx]);
+    }
+    return true;
+}
+
+// Part of the source string kept by the filter as is. Returned as the view of the source if the source is the view itself (so the result
+// may refer to the same data for as long as the source does), and is copied otherwise
+template<typename CharT>
+InternalValue MakeStringPart(const nonstd::basic_string_view<CharT>& str, size_t offset, size_t size, bool canReferSource)
+{
+    auto part = str.substr(offset, size);
+    if (canReferSource)
+        return InternalValue(TargetStringView(part));
+
+    return InternalValue(TargetString(sv_to_string(part)));
+}
+
+static bool CanReferSource(const InternalValue& val)
+{
+    return GetIf<TargetStringView>(&val) != nullptr && !val.ShouldExtendLifetime();
+}
+
+// Applies the converter which may return the part of the source (see MakeStringPart). Non-string values are converted to the empty string,
+// as the other string converters do
+template<typename Fn>
+InternalValue ApplyStringPartConverter(const InternalValue& val, Fn&& fn)
+{
+    auto result = ApplyStringConverter(val, std::forward<Fn>(fn));
+    return result.IsEmpty() ? InternalValue(TargetString()) : result;
+}
+
 template<typename D>
 struct StringEncoder : public visitors::BaseVisitor<TargetString>
 {
@@ -63,20 +235,6 @@ struct StringEncoder : public visitors::BaseVisitor<TargetString>
     }
 };
 
-template<typename Fn>
-struct GenericStringEncoder : public StringEncoder<GenericStringEncoder<Fn>>
-{
-    GenericStringEncoder(Fn fn) : m_fn(std::move(fn)) {}
-
-    template<typename CharT, typename AppendFn>
-    void EncodeChar(CharT ch, AppendFn&& fn) const
-    {
-        m_fn(ch, std::forward<AppendFn>(fn));
-    }
-
-    mutable Fn m_fn;
-};
-
 struct UrlStringEncoder : public StringEncoder<UrlStringEncoder>
 {
     template<typename CharT, typename Fn>
@@ -185,166 +343,157 @@ StringConverter::StringConverter(FilterParams params, StringConverter::Mode mode
 
 InternalValue StringConverter::Filter(const InternalValue& baseVal, RenderContext& context)
 {
-    TargetString result;
+    // Already escaped values are passed through as is
+    if (m_mode == SafeMode || (m_mode == EscapeHtmlMode && baseVal.IsSafe()))
+    {
+        InternalValue safeVal = baseVal;
+        safeVal.SetSafe(true);
+        return safeVal;
+    }
 
-    auto isAlpha = ba::is_alpha();
-    auto isAlNum = ba::is_alnum();
+    TargetString result;
 
     switch (m_mode)
     {
     case TrimMode:
-        result = ApplyStringConverter(baseVal, [](auto strView) -> TargetString {
-            auto str = sv_to_string(strView);
-            ba::trim_all(str);
-            return TargetString(str);
+        return ApplyStringPartConverter(baseVal, [canReferSource = CanReferSource(baseVal)](auto srcStr) -> InternalValue {
+            using CharT = typename decltype(srcStr)::value_type;
+            StringChars<CharT> chars;
+            size_t begin = 0;
+            size_t end = 0;
+            GetTrimmedBounds(srcStr, chars, begin, end);
+            std::basic_string<CharT> str;
+            if (CompressSpaces(srcStr, begin, end, chars, str))
+                return InternalValue(TargetString(std::move(str)));
+
+            return MakeStringPart(srcStr, begin, end - begin, canReferSource);
         });
-        break;
     case TitleMode:
-        result = ApplyStringConverter<GenericStringEncoder>(baseVal, [isDelim = true, &isAlpha, &isAlNum](auto ch, auto&& fn) mutable {
-            if (isDelim && isAlpha(ch))
-            {
-                isDelim = false;
-                fn(std::toupper(ch, std::locale()));
-                return;
-            }
-
-            isDelim = !isAlNum(ch);
-            fn(ch);
+        result = ApplyStringConverter(baseVal, [](auto srcStr) -> TargetString {
+            using CharT = typename decltype(srcStr)::value_type;
+            StringChars<CharT> chars;
+            bool isDelim = true;
+            return ConvertChars(srcStr, [&chars, &isDelim](CharT ch) {
+                bool isStart = isDelim && chars.IsAlpha(ch);
+                isDelim = !isStart && !chars.IsAlNum(ch);
+                return isStart ? chars.ToUpper(ch) : ch;
+            });
         });
         break;
     case WordCountMode:
-    {
-        int64_t wc = 0;
-        ApplyStringConverter<GenericStringEncoder>(baseVal, [isDelim = true, &wc, &isAlNum](auto ch, auto&&) mutable {
-            if (isDelim && isAlNum(ch))
+        return InternalValue(ApplyStringConverter(baseVal, [](auto srcStr) -> int64_t {
+            using CharT = typename decltype(srcStr)::value_type;
+            StringChars<CharT> chars;
+            int64_t wc = 0;
+            bool isDelim = true;
+            for (auto ch : srcStr)
             {
-                isDelim = false;
-                wc ++;
-                return;
+                bool isAlNum = chars.IsAlNum(ch);
+                if (isDelim && isAlNum)
+                    ++ wc;
+                isDelim = !isAlNum;
             }
-            isDelim = !isAlNum(ch);
-        });
-        return InternalValue(wc);
-    }
+            return wc;
+        }));
     case UpperMode:
-        result = ApplyStringConverter<GenericStringEncoder>(baseVal, [&isAlpha](auto ch, auto&& fn) mutable {
-            if (isAlpha(ch))
-                fn(std::toupper(ch, std::locale()));
-            else
-                fn(ch);
+        result = ApplyStringConverter(baseVal, [](auto srcStr) -> TargetString {
+            using CharT = typename decltype(srcStr)::value_type;
+            StringChars<CharT> chars;
+            return ConvertChars(srcStr, [&chars](CharT ch) { return chars.ToUpper(ch); });
         });
         break;
     case LowerMode:
-        result = ApplyStringConverter<GenericStringEncoder>(baseVal, [&isAlpha](auto ch, auto&& fn) mutable {
-            if (isAlpha(ch))
-                fn(std::tolower(ch, std::locale()));
-            else
-                fn(ch);
+        result = ApplyStringConverter(baseVal, [](auto srcStr) -> TargetString {
+            using CharT = typename decltype(srcStr)::value_type;
+            StringChars<CharT> chars;
+            return ConvertChars(srcStr, [&chars](CharT ch) { return chars.ToLower(ch); });
         });
         break;
     case ReplaceMode:
-        result = ApplyStringConverter(baseVal, [this, &context](auto srcStr) -> TargetString {
-            std::decay_t<decltype(srcStr)> emptyStrView;
-            using CharT = typename decltype(emptyStrView)::value_type;
+        return ApplyStringPartConverter(baseVal, [this, &context, canReferSource = CanReferSource(baseVal)](auto srcStr) -> InternalValue {
+            using StringViewT = decltype(srcStr);
+            using CharT = typename StringViewT::value_type;
             std::basic_string<CharT> emptyStr;
             auto oldStr = GetAsSameString(srcStr, this->GetArgumentValue("old", context)).value_or(emptyStr);
             auto newStr = GetAsSameString(srcStr, this->GetArgumentValue("new", context)).value_or(emptyStr);
             auto count = ConvertToInt(this->GetArgumentValue("count", context));
-            auto str = sv_to_string(srcStr);
-            if (count == 0)
-                ba::replace_all(str, oldStr, newStr);
-            else
-            {
-                for (int64_t n = 0; n < count; ++ n)
-                    ba::replace_first(str, oldStr, newStr);
-            }
-            return str;
+            std::basic_string<CharT> str;
+            if (count >= 0 && ReplaceSubstrings(srcStr, StringViewT(oldStr), StringViewT(newStr), count, str))
+                return InternalValue(TargetString(std::move(str)));
+
+            return MakeStringPart(srcStr, 0, srcStr.size(), canReferSource);
         });
-        break;
     case TruncateMode:
-        result = ApplyStringConverter(baseVal, [this, &context, &isAlNum](auto srcStr) -> TargetString {
-            std::decay_t<decltype(srcStr)> emptyStrView;
-            using CharT = typename decltype(emptyStrView)::value_type;
+        return ApplyStringPartConverter(baseVal, [this, &context, canReferSource = CanReferSource(baseVal)](auto srcStr) -> InternalValue {
+            using CharT = typename decltype(srcStr)::value_type;
             std::basic_string<CharT> emptyStr;
-            auto length = ConvertToInt(this->GetArgumentValue("length", context));
+            StringChars<CharT> chars;
+            auto isAlNum = [&chars](CharT ch) { return chars.IsAlNum(ch); };
+            auto length = std::max<int64_t>(ConvertToInt(this->GetArgumentValue("length", context)), 0);
             auto killWords = ConvertToBool(this->GetArgumentValue("killwords", context));
-            auto end = GetAsSameString(srcStr, this->GetArgumentValue("end", context));
+            auto end = GetAsSameString(srcStr, this->GetArgumentValue("end", context)).value_or(emptyStr);
             auto leeway = ConvertToInt(this->GetArgumentValue("leeway", context), 5);
-            if (static_cast<long long int>(srcStr.size()) <= length)
-                return sv_to_string(srcStr);
+            auto size = srcStr.size();
+            // Truncated string is the prefix of the source followed by 'end'
+            auto makeResult = [&srcStr, &end, canReferSource](size_t prefixSize) {
+                if (end.empty())
+                    return MakeStringPart(srcStr, 0, prefixSize, canReferSource);
+
+                std::basic_string<CharT> str;
+                str.reserve(prefixSize + end.size());
+                str.append(srcStr.data(), prefixSize);
+                str.append(end);
+                return InternalValue(TargetString(std::move(str)));
+            };
 
-            auto str = sv_to_string(srcStr);
+            if (static_cast<long long int>(size) <= length)
+                return MakeStringPart(srcStr, 0, size, canReferSource);
 
             if (killWords)
             {
-                if (static_cast<long long int>(str.size()) > (length + leeway))
-                {
-                    str.erase(str.begin() + static_cast<std::ptrdiff_t>(length), str.end());
-                    str += end.value_or(emptyStr);
-                }
-                return str;
+                if (static_cast<long long int>(size) > (length + leeway))
+                    return makeResult(static_cast<size_t>(length));
+                return MakeStringPart(srcStr, 0, size, canReferSource);
             }
 
-            auto p = str.begin() + static_cast<std::ptrdiff_t>(length);
-            if (leeway != 0)
-            {
-                for (; leeway != 0 && p != str.end() && isAlNum(*p); -- leeway, ++ p);
-                if (p == str.end())
-                    return TargetString(str);
-            }
+            auto p = static_cast<size_t>(length);
+            for (; leeway != 0 && p != size && isAlNum(srcStr[p]); -- leeway, ++ p);
+            if (p == size)
+                return MakeStringPart(srcStr, 0, size, canReferSource);
 
-            if (isAlNum(*p))
+            if (isAlNum(srcStr[p]))
             {
-                for (; p != str.begin() && isAlNum(*p); -- p);
+                for (; p != 0 && isAlNum(srcStr[p]); -- p);
             }
-            str.erase(p, str.end());
-            ba::trim_right(str);
-            str += end.value_or(emptyStr);
+            for (; p != 0 && chars.IsSpace(srcStr[p - 1]); -- p);
 
-            return TargetString(std::move(str));
+            return makeResult(p);
         });
-        break;
     case UrlEncodeMode:
         result = Apply<UrlStringEncoder>(baseVal);
         break;
     case CapitalMode:
-        result = ApplyStringConverter<GenericStringEncoder>(baseVal, [isFirstChar = true, &isAlpha](auto ch, auto&& fn) mutable {
-            if (isAlpha(ch))
-            {
-                if (isFirstChar)
-                    fn(std::toupper(ch, std::locale()));
-                else
-                    fn(std::tolower(ch, std::locale()));
-            }
-            else
-                fn(ch);
-
-            isFirstChar = false;
+        result = ApplyStringConverter(baseVal, [](auto srcStr) -> TargetString {
+            using CharT = typename decltype(srcStr)::value_type;
+            StringChars<CharT> chars;
+            auto str = ConvertChars(srcStr, [&chars](CharT ch) { return chars.ToLower(ch); });
+            if (!str.empty())
+                str[0] = chars.ToUpper(srcStr[0]);
+            return TargetString(std::move(str));
         });
         break;
     case EscapeHtmlMode:
-        result = ApplyStringConverter<GenericStringEncoder>(baseVal, [](auto ch, auto&& fn) mutable {
-            switch(ch)
-            {
-                case '<':
-                    fn('&', 'l', 't', ';');
-                    break;
-                case '>':
-                    fn('&', 'g', 't', ';');
-                    break;
-                case '&':
-                    fn('&', 'a', 'm', 'p', ';');
-                    break;
-                case '\'':
-                    fn('&', '#', '3', '9', ';');
-                    break;
-                case '\"':
-                    fn('&', '#', '3', '4', ';');
-                    break;
-                default:
-                    fn(ch);
-                    break;
-            }
+        result = ApplyStringConverter(baseVal, [](auto srcStr) -> TargetString {
+            std::basic_string<typename decltype(srcStr)::value_type> str;
+            escape::AppendHtmlEscaped(str, srcStr.data(), srcStr.data() + srcStr.size());
+            return TargetString(std::move(str));
+        });
+        break;
+    case EscapeCppMode:
+        result = ApplyStringConverter(baseVal, [](auto srcStr) -> TargetString {
+            std::basic_string<typename decltype(srcStr)::value_type> str;
+            escape::AppendCppEscaped(str, srcStr.data(), srcStr.data() + srcStr.size());
+            return TargetString(std::move(str));
         });
         break;
      case StriptagsMode:
@@ -352,9 +501,18 @@ InternalValue StringConverter::Filter(const InternalValue& baseVal, RenderContex
             auto str = sv_to_string(srcStr);
             using StringT = decltype(str);
             using CharT = typename StringT::value_type;
+            using StringViewT = nonstd::basic_string_view<CharT>;
             static const std::basic_regex<CharT> STRIPTAGS_RE(UNIVERSAL_STR("(<!--.*?-->|<[^>]*>)").GetValue<CharT>());
             str = std::regex_replace(str, STRIPTAGS_RE, UNIVERSAL_STR("").GetValue<CharT>());
-            ba::trim_all(str);
+            StringChars<CharT> chars;
+            size_t begin = 0;
+            size_t end = 0;
+            GetTrimmedBounds(StringViewT(str), chars, begin, end);
+            StringT trimmed;
+            if (CompressSpaces(StringViewT(str), begin, end, chars, trimmed))
+                str = std::move(trimmed);
+            else
+                str = str.substr(begin, end - begin);
             static const StringT html_entities [] {
                 UNIVERSAL_STR("&amp;").GetValue<CharT>(), UNIVERSAL_STR("&").GetValue<CharT>(),
                 UNIVERSAL_STR("&apos;").GetValue<CharT>(), UNIVERSAL_STR("\'").GetValue<CharT>(),
@@ -364,9 +522,10 @@ InternalValue StringConverter::Filter(const InternalValue& baseVal, RenderContex
                 UNIVERSAL_STR("&#39;").GetValue<CharT>(), UNIVERSAL_STR("\'").GetValue<CharT>(),
                 UNIVERSAL_STR("&#34;").GetValue<CharT>(), UNIVERSAL_STR("\"").GetValue<CharT>(),
             };
-            for (auto it = std::begin(html_entities), end = std::end(html_entities); it < end; it += 2)
+            for (auto it = std::begin(html_entities), last = std::end(html_entities); it < last; it += 2)
             {
-                ba::replace_all(str, *it, *(it + 1));
+                if (ReplaceSubstrings(StringViewT(str), StringViewT(*it), StringViewT(*(it + 1)), 0, trimmed))
+                    str.swap(trimmed);
             }
             return str;
         });
@@ -388,7 +547,9 @@ InternalValue StringConverter::Filter(const InternalValue& baseVal, RenderContex
         break;
     }
 
-    return std::move(result);
+    InternalValue resultVal(std::move(result));
+    resultVal.SetSafe(m_mode == EscapeHtmlMode);
+    return resultVal;
 }
 
 }
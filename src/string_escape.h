@@ -0,0 +1,315 @@
+#ifndef STRING_ESCAPE_H
+#define STRING_ESCAPE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define JINJA2CPP_ESCAPE_AVX2
+#define JINJA2CPP_ESCAPE_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JINJA2CPP_ESCAPE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define JINJA2CPP_ESCAPE_NEON
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace jinja2
+{
+namespace escape
+{
+// Characters which are replaced by the 'escape' (HTML) filter
+struct HtmlChars
+{
+    template<typename CharT>
+    static bool IsSpecial(CharT ch)
+    {
+        return ch == '<' || ch == '>' || ch == '&' || ch == '\'' || ch == '\"';
+    }
+
+    // Vector kernels: lanes with the special chars are set to all ones
+    template<typename Isa, size_t Sz>
+    static typename Isa::Vec Match(typename Isa::Vec v)
+    {
+        using S = std::integral_constant<size_t, Sz>;
+        auto result = Isa::Eq(v, Isa::Set('<', S()), S());
+        result = Isa::Or(result, Isa::Eq(v, Isa::Set('>', S()), S()));
+        result = Isa::Or(result, Isa::Eq(v, Isa::Set('&', S()), S()));
+        result = Isa::Or(result, Isa::Eq(v, Isa::Set('\'', S()), S()));
+        return Isa::Or(result, Isa::Eq(v, Isa::Set('\"', S()), S()));
+    }
+};
+
+// Characters which are replaced by the 'escapecpp' filter: quotes, backslash and ASCII control chars
+struct CppChars
+{
+    template<typename CharT>
+    static bool IsSpecial(CharT ch)
+    {
+        auto code = static_cast<std::make_unsigned_t<CharT>>(ch);
+        return code < 0x20 || code == 0x7f || ch == '\\' || ch == '\'' || ch == '\"';
+    }
+
+    template<typename Isa, size_t Sz>
+    static typename Isa::Vec Match(typename Isa::Vec v)
+    {
+        using S = std::integral_constant<size_t, Sz>;
+        auto result = Isa::LessUnsigned(v, 0x20, S());
+        result = Isa::Or(result, Isa::Eq(v, Isa::Set(0x7f, S()), S()));
+        result = Isa::Or(result, Isa::Eq(v, Isa::Set('\\', S()), S()));
+        result = Isa::Or(result, Isa::Eq(v, Isa::Set('\'', S()), S()));
+        return Isa::Or(result, Isa::Eq(v, Isa::Set('\"', S()), S()));
+    }
+};
+
+namespace detail
+{
+inline unsigned CountTrailingZeros(uint32_t mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long idx = 0;
+    _BitScanForward(&idx, mask);
+    return static_cast<unsigned>(idx);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+template<typename Traits, typename CharT>
+const CharT* FindSpecialScalar(const CharT* p, const CharT* end)
+{
+    for (; p != end; ++ p)
+    {
+        if (Traits::IsSpecial(*p))
+            break;
+    }
+    return p;
+}
+
+#ifdef JINJA2CPP_ESCAPE_SSE2
+struct Sse2
+{
+    using Vec = __m128i;
+    static constexpr size_t Width = 16;
+
+    static Vec Load(const void* p) { return _mm_loadu_si128(static_cast<const __m128i*>(p)); }
+    static Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+    static uint32_t MoveMask(Vec v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+
+    static Vec Set(int v, std::integral_constant<size_t, 1>) { return _mm_set1_epi8(static_cast<char>(v)); }
+    static Vec Set(int v, std::integral_constant<size_t, 2>) { return _mm_set1_epi16(static_cast<short>(v)); }
+    static Vec Set(int v, std::integral_constant<size_t, 4>) { return _mm_set1_epi32(v); }
+    static Vec Eq(Vec a, Vec b, std::integral_constant<size_t, 1>) { return _mm_cmpeq_epi8(a, b); }
+    static Vec Eq(Vec a, Vec b, std::integral_constant<size_t, 2>) { return _mm_cmpeq_epi16(a, b); }
+    static Vec Eq(Vec a, Vec b, std::integral_constant<size_t, 4>) { return _mm_cmpeq_epi32(a, b); }
+
+    // SSE2 has the signed comparisons only, so the sign bit of both operands is flipped
+    static Vec LessUnsigned(Vec v, int limit, std::integral_constant<size_t, 1>)
+    {
+        auto bias = _mm_set1_epi8(static_cast<char>(0x80));
+        return _mm_cmplt_epi8(_mm_xor_si128(v, bias), _mm_set1_epi8(static_cast<char>(limit ^ 0x80)));
+    }
+    static Vec LessUnsigned(Vec v, int limit, std::integral_constant<size_t, 2>)
+    {
+        auto bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        return _mm_cmplt_epi16(_mm_xor_si128(v, bias), _mm_set1_epi16(static_cast<short>(limit ^ 0x8000)));
+    }
+    static Vec LessUnsigned(Vec v, int limit, std::integral_constant<size_t, 4>)
+    {
+        auto bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+        return _mm_cmplt_epi32(_mm_xor_si128(v, bias), _mm_set1_epi32(static_cast<int>(limit ^ 0x80000000u)));
+    }
+};
+#endif
+
+#ifdef JINJA2CPP_ESCAPE_AVX2
+struct Avx2
+{
+    using Vec = __m256i;
+    static constexpr size_t Width = 32;
+
+    static Vec Load(const void* p) { return _mm256_loadu_si256(static_cast<const __m256i*>(p)); }
+    static Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+    static uint32_t MoveMask(Vec v) { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+
+    static Vec Set(int v, std::integral_constant<size_t, 1>) { return _mm256_set1_epi8(static_cast<char>(v)); }
+    static Vec Set(int v, std::integral_constant<size_t, 2>) { return _mm256_set1_epi16(static_cast<short>(v)); }
+    static Vec Set(int v, std::integral_constant<size_t, 4>) { return _mm256_set1_epi32(v); }
+    static Vec Eq(Vec a, Vec b, std::integral_constant<size_t, 1>) { return _mm256_cmpeq_epi8(a, b); }
+    static Vec Eq(Vec a, Vec b, std::integral_constant<size_t, 2>) { return _mm256_cmpeq_epi16(a, b); }
+    static Vec Eq(Vec a, Vec b, std::integral_constant<size_t, 4>) { return _mm256_cmpeq_epi32(a, b); }
+
+    // Unsigned 'v < limit' is the same as 'max(v, limit - 1) == limit - 1'
+    static Vec LessUnsigned(Vec v, int limit, std::integral_constant<size_t, 1>)
+    {
+        auto top = _mm256_set1_epi8(static_cast<char>(limit - 1));
+        return _mm256_cmpeq_epi8(_mm256_max_epu8(v, top), top);
+    }
+    static Vec LessUnsigned(Vec v, int limit, std::integral_constant<size_t, 2>)
+    {
+        auto top = _mm256_set1_epi16(static_cast<short>(limit - 1));
+        return _mm256_cmpeq_epi16(_mm256_max_epu16(v, top), top);
+    }
+    static Vec LessUnsigned(Vec v, int limit, std::integral_constant<size_t, 4>)
+    {
+        auto top = _mm256_set1_epi32(limit - 1);
+        return _mm256_cmpeq_epi32(_mm256_max_epu32(v, top), top);
+    }
+};
+#endif
+
+#if defined(JINJA2CPP_ESCAPE_SSE2)
+template<typename Isa, typename Traits, typename CharT>
+const CharT* FindSpecialVector(const CharT* p, const CharT* end)
+{
+    constexpr size_t charsPerVec = Isa::Width / sizeof(CharT);
+    while (static_cast<size_t>(end - p) >= charsPerVec)
+    {
+        auto mask = Isa::MoveMask(Traits::template Match<Isa, sizeof(CharT)>(Isa::Load(p)));
+        if (mask)
+            return p + CountTrailingZeros(mask) / sizeof(CharT);
+        p += charsPerVec;
+    }
+    return p;
+}
+#endif
+
+#ifdef JINJA2CPP_ESCAPE_NEON
+inline uint8x16_t MatchNeon(uint8x16_t v, HtmlChars*)
+{
+    auto result = vceqq_u8(v, vdupq_n_u8('<'));
+    result = vorrq_u8(result, vceqq_u8(v, vdupq_n_u8('>')));
+    result = vorrq_u8(result, vceqq_u8(v, vdupq_n_u8('&')));
+    result = vorrq_u8(result, vceqq_u8(v, vdupq_n_u8('\'')));
+    return vorrq_u8(result, vceqq_u8(v, vdupq_n_u8('\"')));
+}
+
+inline uint8x16_t MatchNeon(uint8x16_t v, CppChars*)
+{
+    auto result = vcltq_u8(v, vdupq_n_u8(0x20));
+    result = vorrq_u8(result, vceqq_u8(v, vdupq_n_u8(0x7f)));
+    result = vorrq_u8(result, vceqq_u8(v, vdupq_n_u8('\\')));
+    result = vorrq_u8(result, vceqq_u8(v, vdupq_n_u8('\'')));
+    return vorrq_u8(result, vceqq_u8(v, vdupq_n_u8('\"')));
+}
+
+// Blocks without the special chars are skipped. The position within the block is found by the scalar loop
+template<typename Traits>
+const char* FindSpecialNeon(const char* p, const char* end)
+{
+    while (end - p >= 16)
+    {
+        auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        if (vmaxvq_u8(MatchNeon(v, static_cast<Traits*>(nullptr))) != 0)
+            return FindSpecialScalar<Traits>(p, p + 16);
+        p += 16;
+    }
+    return p;
+}
+#endif
+} // detail
+
+// Returns the pointer to the first character in [p, end) which should be escaped or 'end' if there is no such chars
+template<typename Traits, typename CharT>
+const CharT* FindSpecialChar(const CharT* p, const CharT* end)
+{
+#if defined(JINJA2CPP_ESCAPE_SSE2)
+#if defined(JINJA2CPP_ESCAPE_AVX2)
+    p = detail::FindSpecialVector<detail::Avx2, Traits>(p, end);
+#endif
+    p = detail::FindSpecialVector<detail::Sse2, Traits>(p, end);
+#elif defined(JINJA2CPP_ESCAPE_NEON)
+    if (sizeof(CharT) == 1)
+    {
+        auto pos = detail::FindSpecialNeon<Traits>(reinterpret_cast<const char*>(p), reinterpret_cast<const char*>(end));
+        p = reinterpret_cast<const CharT*>(pos);
+    }
+#endif
+    return detail::FindSpecialScalar<Traits>(p, end);
+}
+
+// Appends the text with HTML special chars replaced with the entities. Runs of the regular chars are copied as a whole
+template<typename CharT>
+void AppendHtmlEscaped(std::basic_string<CharT>& out, const CharT* p, const CharT* end)
+{
+    static const CharT lt[] = {'&', 'l', 't', ';'};
+    static const CharT gt[] = {'&', 'g', 't', ';'};
+    static const CharT amp[] = {'&', 'a', 'm', 'p', ';'};
+    static const CharT apos[] = {'&', '#', '3', '9', ';'};
+    static const CharT quot[] = {'&', '#', '3', '4', ';'};
+
+    out.reserve(out.size() + (end - p));
+    while (p != end)
+    {
+        auto special = FindSpecialChar<HtmlChars>(p, end);
+        out.append(p, special - p);
+        if (special == end)
+            break;
+
+        switch (*special)
+        {
+        case '<': out.append(lt, sizeof(lt) / sizeof(CharT)); break;
+        case '>': out.append(gt, sizeof(gt) / sizeof(CharT)); break;
+        case '&': out.append(amp, sizeof(amp) / sizeof(CharT)); break;
+        case '\'': out.append(apos, sizeof(apos) / sizeof(CharT)); break;
+        default: out.append(quot, sizeof(quot) / sizeof(CharT)); break;
+        }
+        p = special + 1;
+    }
+}
+
+// Appends the text escaped for the C++ string literal. Control chars without short escape sequences are written in octal
+template<typename CharT>
+void AppendCppEscaped(std::basic_string<CharT>& out, const CharT* p, const CharT* end)
+{
+    out.reserve(out.size() + (end - p));
+    while (p != end)
+    {
+        auto special = FindSpecialChar<CppChars>(p, end);
+        out.append(p, special - p);
+        if (special == end)
+            break;
+
+        CharT shortEscape = 0;
+        switch (*special)
+        {
+        case '\n': shortEscape = 'n'; break;
+        case '\r': shortEscape = 'r'; break;
+        case '\t': shortEscape = 't'; break;
+        case '\a': shortEscape = 'a'; break;
+        case '\b': shortEscape = 'b'; break;
+        case '\f': shortEscape = 'f'; break;
+        case '\v': shortEscape = 'v'; break;
+        case '\\': shortEscape = '\\'; break;
+        case '\'': shortEscape = '\''; break;
+        case '\"': shortEscape = '\"'; break;
+        default: break;
+        }
+
+        out.push_back('\\');
+        if (shortEscape)
+        {
+            out.push_back(shortEscape);
+        }
+        else
+        {
+            auto code = static_cast<unsigned>(static_cast<std::make_unsigned_t<CharT>>(*special));
+            out.push_back(static_cast<CharT>('0' + ((code >> 6) & 7)));
+            out.push_back(static_cast<CharT>('0' + ((code >> 3) & 7)));
+            out.push_back(static_cast<CharT>('0' + (code & 7)));
+        }
+        p = special + 1;
+    }
+}
+} // escape
+} // jinja2
+
+#endif // STRING_ESCAPE_H
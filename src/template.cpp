@@ -15,6 +15,12 @@ auto GetImpl(std::shared_ptr<ITemplateImpl> impl)
     return static_cast<TemplateImpl<CharT>*>(impl.get());
 }
 
+template<typename CharT>
+auto GetSessionImpl(const std::shared_ptr<IRenderSessionImpl>& impl)
+{
+    return static_cast<RenderSessionImpl<CharT>*>(impl.get());
+}
+
 Template::Template(TemplateEnv* env)
     : m_impl(new TemplateImpl<char>(env))
 {
@@ -53,6 +59,12 @@ Result<void> Template::Load(std::istream& stream, std::string tplName)
     return !result ? Result<void>() : nonstd::make_unexpected(std::move(result.get()));
 }
 
+Result<void> Template::Load(nonstd::string_view tpl, std::shared_ptr<const void> sourceOwner, std::string tplName)
+{
+    auto result = GetImpl<char>(m_impl)->Load(tpl, std::move(sourceOwner), std::move(tplName));
+    return !result ? Result<void>() : nonstd::make_unexpected(std::move(result.get()));
+}
+
 Result<void> Template::LoadFromFile(const std::string& fileName)
 {
     std::ifstream file(fileName);
@@ -63,14 +75,26 @@ Result<void> Template::LoadFromFile(const std::string& fileName)
     return Load(file, fileName);
 }
 
-Result<void> Template::Render(std::ostream& os, const jinja2::ValuesMap& params)
+Result<void> Template::LoadCompiled(const std::string& image, const std::string& tpl, std::string tplName)
 {
-    std::string buffer;
-    auto result = GetImpl<char>(m_impl)->Render(buffer, params);
+    auto result = GetImpl<char>(m_impl)->LoadCompiled(image, tpl, std::move(tplName));
+    return !result ? Result<void>() : nonstd::make_unexpected(std::move(result.get()));
+}
 
-    if (!result)
-        os.write(buffer.data(), buffer.size());
+Result<void> Template::SaveCompiled(std::string& image)
+{
+    auto result = GetImpl<char>(m_impl)->SaveCompiled(image);
+    return !result ? Result<void>() : nonstd::make_unexpected(std::move(result.get()));
+}
 
+Result<void> Template::Render(std::ostream& os, const jinja2::ValuesMap& params)
+{
+    return Render(OutputSink([&os](const char* data, size_t size) { os.write(data, size); }), params);
+}
+
+Result<void> Template::Render(const OutputSink& sink, const jinja2::ValuesMap& params)
+{
+    auto result = GetImpl<char>(m_impl)->Render(sink, params);
     return !result ? Result<void>() : nonstd::make_unexpected(std::move(result.get()));
 }
 
@@ -81,6 +105,48 @@ Result<std::string> Template::RenderAsString(const jinja2::ValuesMap& params)
     return !result ? Result<std::string>(std::move(buffer)) : Result<std::string>(nonstd::make_unexpected(std::move(result.get())));;
 }
 
+Result<void> Template::RenderTo(std::string& buffer, const jinja2::ValuesMap& params)
+{
+    buffer.clear();
+    auto result = GetImpl<char>(m_impl)->Render(buffer, params);
+    return !result ? Result<void>() : Result<void>(nonstd::make_unexpected(std::move(result.get())));
+}
+
+Result<RenderedSlices<char>> Template::RenderSlices(const jinja2::ValuesMap& params)
+{
+    RenderedSlices<char> slices;
+    auto result = GetImpl<char>(m_impl)->Render(slices, m_impl, params);
+    return !result ? Result<RenderedSlices<char>>(std::move(slices)) : Result<RenderedSlices<char>>(nonstd::make_unexpected(std::move(result.get())));
+}
+
+void Template::RenderBatch(const std::vector<ValuesMap>& paramsList, const BatchOutputSink& sink, size_t threadsCount)
+{
+    GetImpl<char>(m_impl)->RenderBatch(paramsList, threadsCount, [&sink](size_t idx, const auto& buffer, auto& error) {
+        if (error)
+            sink(idx, nonstd::make_unexpected(std::move(error.get())));
+        else
+            sink(idx, nonstd::string_view(buffer.data(), buffer.size()));
+    });
+}
+
+std::vector<Result<std::string>> Template::RenderBatch(const std::vector<ValuesMap>& paramsList, size_t threadsCount)
+{
+    std::vector<Result<std::string>> results(paramsList.size());
+    GetImpl<char>(m_impl)->RenderBatch(paramsList, threadsCount, [&results](size_t idx, const auto& buffer, auto& error) {
+        if (error)
+            results[idx] = nonstd::make_unexpected(std::move(error.get()));
+        else
+            results[idx] = buffer;
+    });
+    return results;
+}
+
+RenderSession Template::CreateRenderSession(ValuesMap params)
+{
+    auto impl = std::static_pointer_cast<TemplateImpl<char>>(m_impl);
+    return RenderSession(std::make_shared<RenderSessionImpl<char>>(std::move(impl), std::move(params)));
+}
+
 Result<GenericMap> Template::GetMetadata()
 {
     return GetImpl<char>(m_impl)->GetMetadata();
@@ -91,6 +157,43 @@ Result<MetadataInfo<char>> Template::GetMetadataRaw()
     return GetImpl<char>(m_impl)->GetMetadataRaw();
 }
 
+std::vector<std::string> Template::GetDependencies() const
+{
+    return GetImpl<char>(m_impl)->GetDependencies();
+}
+
+TemplateVariablesUsage Template::GetUsedVariables() const
+{
+    return GetImpl<char>(m_impl)->GetUsedVariables();
+}
+
+size_t Template::GetParsedSize() const
+{
+    return GetImpl<char>(m_impl)->GetParsedSize();
+}
+
+RenderProfile Template::GetRenderProfile() const
+{
+    return GetImpl<char>(m_impl)->GetRenderProfile();
+}
+
+void Template::ResetRenderProfile()
+{
+    GetImpl<char>(m_impl)->ResetRenderProfile();
+}
+
+Result<Template> Template::Specialize() const
+{
+    auto impl = GetImpl<char>(m_impl)->GetSpecialized();
+    if (!impl)
+        return nonstd::make_unexpected(impl.error());
+
+    Template result(*this);
+    if (impl.value())
+        result.m_impl = impl.value();
+    return result;
+}
+
 TemplateW::TemplateW(TemplateEnv* env)
     : m_impl(new TemplateImpl<wchar_t>(env))
 {
@@ -129,6 +232,12 @@ ResultW<void> TemplateW::Load(std::wistream& stream, std::string tplName)
     return !result ? ResultW<void>() : nonstd::make_unexpected(std::move(result.get()));
 }
 
+ResultW<void> TemplateW::Load(nonstd::wstring_view tpl, std::shared_ptr<const void> sourceOwner, std::string tplName)
+{
+    auto result = GetImpl<wchar_t>(m_impl)->Load(tpl, std::move(sourceOwner), std::move(tplName));
+    return !result ? ResultW<void>() : nonstd::make_unexpected(std::move(result.get()));
+}
+
 ResultW<void> TemplateW::LoadFromFile(const std::string& fileName)
 {
     std::wifstream file(fileName);
@@ -139,12 +248,26 @@ ResultW<void> TemplateW::LoadFromFile(const std::string& fileName)
     return Load(file, fileName);
 }
 
+ResultW<void> TemplateW::LoadCompiled(const std::string& image, const std::wstring& tpl, std::string tplName)
+{
+    auto result = GetImpl<wchar_t>(m_impl)->LoadCompiled(image, tpl, std::move(tplName));
+    return !result ? ResultW<void>() : nonstd::make_unexpected(std::move(result.get()));
+}
+
+ResultW<void> TemplateW::SaveCompiled(std::string& image)
+{
+    auto result = GetImpl<wchar_t>(m_impl)->SaveCompiled(image);
+    return !result ? ResultW<void>() : nonstd::make_unexpected(std::move(result.get()));
+}
+
 ResultW<void> TemplateW::Render(std::wostream& os, const jinja2::ValuesMap& params)
 {
-    std::wstring buffer;
-    auto result = GetImpl<wchar_t>(m_impl)->Render(buffer, params);
-    if (!result)
-        os.write(buffer.data(), buffer.size());
+    return Render(OutputSinkW([&os](const wchar_t* data, size_t size) { os.write(data, size); }), params);
+}
+
+ResultW<void> TemplateW::Render(const OutputSinkW& sink, const jinja2::ValuesMap& params)
+{
+    auto result = GetImpl<wchar_t>(m_impl)->Render(sink, params);
     return !result ? ResultW<void>() : ResultW<void>(nonstd::make_unexpected(std::move(result.get())));
 }
 
@@ -156,6 +279,48 @@ ResultW<std::wstring> TemplateW::RenderAsString(const jinja2::ValuesMap& params)
     return !result ? buffer : ResultW<std::wstring>(nonstd::make_unexpected(std::move(result.get())));
 }
 
+ResultW<void> TemplateW::RenderTo(std::wstring& buffer, const jinja2::ValuesMap& params)
+{
+    buffer.clear();
+    auto result = GetImpl<wchar_t>(m_impl)->Render(buffer, params);
+    return !result ? ResultW<void>() : ResultW<void>(nonstd::make_unexpected(std::move(result.get())));
+}
+
+ResultW<RenderedSlices<wchar_t>> TemplateW::RenderSlices(const jinja2::ValuesMap& params)
+{
+    RenderedSlices<wchar_t> slices;
+    auto result = GetImpl<wchar_t>(m_impl)->Render(slices, m_impl, params);
+    return !result ? ResultW<RenderedSlices<wchar_t>>(std::move(slices)) : ResultW<RenderedSlices<wchar_t>>(nonstd::make_unexpected(std::move(result.get())));
+}
+
+void TemplateW::RenderBatch(const std::vector<ValuesMap>& paramsList, const BatchOutputSinkW& sink, size_t threadsCount)
+{
+    GetImpl<wchar_t>(m_impl)->RenderBatch(paramsList, threadsCount, [&sink](size_t idx, const auto& buffer, auto& error) {
+        if (error)
+            sink(idx, nonstd::make_unexpected(std::move(error.get())));
+        else
+            sink(idx, nonstd::wstring_view(buffer.data(), buffer.size()));
+    });
+}
+
+std::vector<ResultW<std::wstring>> TemplateW::RenderBatch(const std::vector<ValuesMap>& paramsList, size_t threadsCount)
+{
+    std::vector<ResultW<std::wstring>> results(paramsList.size());
+    GetImpl<wchar_t>(m_impl)->RenderBatch(paramsList, threadsCount, [&results](size_t idx, const auto& buffer, auto& error) {
+        if (error)
+            results[idx] = nonstd::make_unexpected(std::move(error.get()));
+        else
+            results[idx] = buffer;
+    });
+    return results;
+}
+
+RenderSessionW TemplateW::CreateRenderSession(ValuesMap params)
+{
+    auto impl = std::static_pointer_cast<TemplateImpl<wchar_t>>(m_impl);
+    return RenderSessionW(std::make_shared<RenderSessionImpl<wchar_t>>(std::move(impl), std::move(params)));
+}
+
 ResultW<GenericMap> TemplateW::GetMetadata()
 {
     return GenericMap();
@@ -168,4 +333,114 @@ ResultW<MetadataInfo<wchar_t>> TemplateW::GetMetadataRaw()
     // GetImpl<wchar_t>(m_impl)->GetMetadataRaw();
     ;
 }
+
+std::vector<std::string> TemplateW::GetDependencies() const
+{
+    return GetImpl<wchar_t>(m_impl)->GetDependencies();
+}
+
+TemplateVariablesUsage TemplateW::GetUsedVariables() const
+{
+    return GetImpl<wchar_t>(m_impl)->GetUsedVariables();
+}
+
+size_t TemplateW::GetParsedSize() const
+{
+    return GetImpl<wchar_t>(m_impl)->GetParsedSize();
+}
+
+RenderProfile TemplateW::GetRenderProfile() const
+{
+    return GetImpl<wchar_t>(m_impl)->GetRenderProfile();
+}
+
+void TemplateW::ResetRenderProfile()
+{
+    GetImpl<wchar_t>(m_impl)->ResetRenderProfile();
+}
+
+ResultW<TemplateW> TemplateW::Specialize() const
+{
+    auto impl = GetImpl<wchar_t>(m_impl)->GetSpecialized();
+    if (!impl)
+        return nonstd::make_unexpected(impl.error());
+
+    TemplateW result(*this);
+    if (impl.value())
+        result.m_impl = impl.value();
+    return result;
+}
+
+void RenderSession::SetParam(const std::string& name, Value value)
+{
+    GetSessionImpl<char>(m_impl)->SetParam(name, std::move(value));
+}
+
+void RenderSession::RemoveParam(const std::string& name)
+{
+    GetSessionImpl<char>(m_impl)->RemoveParam(name);
+}
+
+void RenderSession::SetParams(ValuesMap params)
+{
+    GetSessionImpl<char>(m_impl)->SetParams(std::move(params));
+}
+
+void RenderSession::SetIncrementalRender(bool enable)
+{
+    GetSessionImpl<char>(m_impl)->SetIncrementalRender(enable);
+}
+
+const ValuesMap& RenderSession::GetParams() const
+{
+    return GetSessionImpl<char>(m_impl)->GetParams();
+}
+
+Result<nonstd::string_view> RenderSession::RenderAsString()
+{
+    auto impl = GetSessionImpl<char>(m_impl);
+    auto result = impl->Render();
+    if (result)
+        return nonstd::make_unexpected(std::move(result.get()));
+
+    auto& buffer = impl->GetResult();
+    return nonstd::string_view(buffer.data(), buffer.size());
+}
+
+void RenderSessionW::SetParam(const std::string& name, Value value)
+{
+    GetSessionImpl<wchar_t>(m_impl)->SetParam(name, std::move(value));
+}
+
+void RenderSessionW::RemoveParam(const std::string& name)
+{
+    GetSessionImpl<wchar_t>(m_impl)->RemoveParam(name);
+}
+
+void RenderSessionW::SetParams(ValuesMap params)
+{
+    GetSessionImpl<wchar_t>(m_impl)->SetParams(std::move(params));
+}
+
+void RenderSessionW::SetIncrementalRender(bool enable)
+{
+    GetSessionImpl<wchar_t>(m_impl)->SetIncrementalRender(enable);
+}
+
+const ValuesMap& RenderSessionW::GetParams() const
+{
+    return GetSessionImpl<wchar_t>(m_impl)->GetParams();
+}
+
+ResultW<nonstd::wstring_view> RenderSessionW::RenderAsString()
+{
+    auto impl = GetSessionImpl<wchar_t>(m_impl);
+    auto result = impl->Render();
+    if (result)
+        return nonstd::make_unexpected(std::move(result.get()));
+
+    auto& buffer = impl->GetResult();
+    return nonstd::wstring_view(buffer.data(), buffer.size());
+}
+
 } // jinga2
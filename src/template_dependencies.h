@@ -0,0 +1,108 @@
+#ifndef TEMPLATE_DEPENDENCIES_H
+#define TEMPLATE_DEPENDENCIES_H
+
+#include "renderer.h"
+#include "renderer_optimizer.h"
+#include "statements.h"
+#include "value_visitors.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace jinja2
+{
+// Load time pass which collects the names of the templates referred by the 'extends', 'include' and 'import' statements of the
+// template. Only the constant names are known at load time, the rest ones are resolved by the render
+template<typename CharT>
+class TemplateDependenciesCollector : public StatementVisitor
+{
+public:
+    using StatementVisitor::DoVisit;
+
+    static std::vector<std::string> Collect(const RendererPtr& root)
+    {
+        TemplateDependenciesCollector collector;
+        collector.VisitRenderer(root);
+        return std::move(collector.m_names);
+    }
+
+    void DoVisit(ComposedRenderer* renderer) override
+    {
+        for (auto& r : renderer->GetRenderers())
+            VisitRenderer(r);
+    }
+    void DoVisit(IfStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        for (auto& b : stmt->GetElseBranches())
+            VisitRenderer(b->GetMainBody());
+    }
+    void DoVisit(ForStatement* stmt) override
+    {
+        VisitRenderer(stmt->GetMainBody());
+        VisitRenderer(stmt->GetElseBody());
+    }
+    void DoVisit(SetBlockStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(ParentBlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(BlockStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(ExtendsStatement* stmt) override
+    {
+        if (stmt->IsPath())
+            AddName(stmt->GetTemplateName());
+        for (auto& b : stmt->GetBlocks())
+            VisitRenderer(b.second);
+    }
+    void DoVisit(IncludeStatement* stmt) override { AddNames(stmt->GetIncludeNamesExpr()); }
+    void DoVisit(ImportStatement* stmt) override { AddNames(stmt->GetImportNameExpr()); }
+    void DoVisit(MacroStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(MacroCallStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(WithStatement* stmt) override { VisitRenderer(stmt->GetMainBody()); }
+    void DoVisit(FilterStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+    void DoVisit(CacheStatement* stmt) override { VisitRenderer(stmt->GetBody()); }
+
+private:
+    void VisitRenderer(const RendererPtr& renderer)
+    {
+        auto visitable = dynamic_cast<VisitableStatement*>(renderer.get());
+        if (visitable)
+            visitable->ApplyVisitor(this);
+    }
+
+    // Name expression of the 'include' can be evaluated to the list of the alternative names
+    void AddNames(const ExpressionEvaluatorPtr<>& expr)
+    {
+        RendererOptimizer<CharT>::EvaluateConstant(expr, [this](const InternalValue& val) {
+            bool isConverted = false;
+            auto list = ConvertToList(val, isConverted);
+            if (!isConverted)
+                return AddName(val);
+
+            for (auto& item : list)
+                AddName(item);
+            return true;
+        });
+    }
+
+    bool AddName(const InternalValue& val)
+    {
+        auto name = GetAsSameString(std::string(), val);
+        if (!name)
+            return false;
+
+        AddName(name.value());
+        return true;
+    }
+
+    void AddName(const std::string& name)
+    {
+        if (std::find(m_names.begin(), m_names.end(), name) == m_names.end())
+            m_names.push_back(name);
+    }
+
+private:
+    std::vector<std::string> m_names;
+};
+} // jinja2
+
+#endif // TEMPLATE_DEPENDENCIES_H
@@ -1,8 +1,82 @@
 #include <jinja2cpp/template.h>
 #include <jinja2cpp/template_env.h>
 
+#include "ast_serializer.h"
+#include "template_metadata.h"
+
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <unordered_set>
+#include <vector>
+
 namespace jinja2
 {
+constexpr size_t DurationHistogram::BucketsCount;
+
+namespace
+{
+// Lower bound of the number of the template names the load times are collected for (see TemplateEnvMetrics::loadTime)
+constexpr size_t LoadTimeNamesLimit = 1024;
+
+// '*' matches any sequence of chars, '?' matches any single char
+bool MatchPattern(const std::string& pattern, const std::string& name)
+{
+    size_t patternPos = 0;
+    size_t namePos = 0;
+    size_t starPos = std::string::npos;
+    size_t starMatchPos = 0;
+    while (namePos != name.size())
+    {
+        if (patternPos != pattern.size() && pattern[patternPos] == '*')
+        {
+            starPos = patternPos ++;
+            starMatchPos = namePos;
+        }
+        else if (patternPos != pattern.size() && (pattern[patternPos] == '?' || pattern[patternPos] == name[namePos]))
+        {
+            ++ patternPos;
+            ++ namePos;
+        }
+        else if (starPos != std::string::npos)
+        {
+            // Last '*' consumes one more char
+            patternPos = starPos + 1;
+            namePos = ++ starMatchPos;
+        }
+        else
+            return false;
+    }
+
+    while (patternPos != pattern.size() && pattern[patternPos] == '*')
+        ++ patternPos;
+    return patternPos == pattern.size();
+}
+
+template<typename CharT>
+std::shared_ptr<const nonstd::basic_string_view<CharT>> ReadSharedSource(std::basic_istream<CharT>& stream)
+{
+    struct SourceHolder
+    {
+        std::basic_string<CharT> text;
+        nonstd::basic_string_view<CharT> view;
+    };
+
+    auto holder = std::make_shared<SourceHolder>();
+    holder->text.assign(std::istreambuf_iterator<CharT>(stream), std::istreambuf_iterator<CharT>());
+    holder->view = holder->text;
+    return std::shared_ptr<const nonstd::basic_string_view<CharT>>(holder, &holder->view);
+}
+
+// Looks for the cached template with the same source. Sources are compared as well as the hashes, so the collision of the hashes
+// doesn't mix the templates up
+template<typename Cache, typename CharT>
+typename Cache::EntryPtr FindDuplicate(const Cache& cache, const nonstd::basic_string_view<CharT>& source, uint64_t contentHash)
+{
+    return cache.FindByContentHash(contentHash, [&source](auto& info) { return info.source && *info.source == source; });
+}
+} // namespace
+
 template<typename CharT>
 struct TemplateFunctions;
 
@@ -10,62 +84,238 @@ template<>
 struct TemplateFunctions<char>
 {
     using ResultType = nonstd::expected<Template, ErrorInfo>;
+    using LoadResultType = Result<void>;
     static Template CreateTemplate(TemplateEnv* env) { return Template(env); }
+    static ResultType LoadTemplate(TemplateEnv* env, const std::string& fileName) { return env->LoadTemplate(fileName); }
     static auto LoadFile(const std::string& fileName, const IFilesystemHandler* fs) { return fs->OpenStream(fileName); }
+    // Shared content of the file (see IFilesystemHandler::OpenBuffer) is referred by the template instead of being copied
+    static std::shared_ptr<const nonstd::string_view> OpenBuffer(const std::string& fileName, const IFilesystemHandler* fs) { return fs->OpenBuffer(fileName); }
 };
 
 template<>
 struct TemplateFunctions<wchar_t>
 {
     using ResultType = nonstd::expected<TemplateW, ErrorInfoW>;
+    using LoadResultType = ResultW<void>;
     static TemplateW CreateTemplate(TemplateEnv* env) { return TemplateW(env); }
+    static ResultType LoadTemplate(TemplateEnv* env, const std::string& fileName) { return env->LoadTemplateW(fileName); }
     static auto LoadFile(const std::string& fileName, const IFilesystemHandler* fs) { return fs->OpenWStream(fileName); }
+    static std::shared_ptr<const nonstd::wstring_view> OpenBuffer(const std::string&, const IFilesystemHandler*) { return nullptr; }
 };
 
+// Compiled image of the template ('<file name>.j2c') is requested before the source is read, so the remote stores can fetch both of
+// them concurrently (see IFilesystemHandler::OpenStreamAsync)
+std::future<CharFileStreamPtr> OpenCompiledImage(const std::string& fileName, const IFilesystemHandler* fs)
+{
+    auto realFs = dynamic_cast<const RealFileSystem*>(fs);
+    auto imageFileName = fileName + ".j2c";
+    if (realFs)
+        return std::async(std::launch::deferred, [realFs, imageFileName]() { return realFs->OpenByteStream(imageFileName); });
+
+    return fs->OpenStreamAsync(imageFileName);
+}
+
+// Prefers the compiled image of the template if it matches the source. Falls back to the source parsing otherwise
+template<typename TemplateT, typename CharT>
+auto LoadTemplateSource(TemplateT& tpl, std::basic_istream<CharT>& stream, const std::string& fileName, std::future<CharFileStreamPtr> image)
+{
+    if (!image.valid())
+        return tpl.Load(stream, fileName);
+
+    std::basic_string<CharT> source{std::istreambuf_iterator<CharT>(stream), std::istreambuf_iterator<CharT>()};
+    auto imageStream = image.get();
+    if (imageStream)
+    {
+        std::string image{std::istreambuf_iterator<char>(*imageStream), std::istreambuf_iterator<char>()};
+        auto result = tpl.LoadCompiled(image, source, fileName);
+        if (result)
+            return result;
+    }
+
+    return tpl.Load(source, fileName);
+}
+
+// Duration of the call is recorded if the metrics are collected
+template<typename Fn>
+auto TemplateEnv::CallFilesystem(MetricsEvent event, const std::string& fileName, Fn&& fn)
+{
+    if (!m_settings.collectMetrics)
+        return fn();
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = fn();
+    RecordMetric(event, fileName, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+    return result;
+}
+
+template<typename CharT, typename T, typename Cache, typename InFlightLoads>
+auto TemplateEnv::LoadTemplateImpl(TemplateEnv* env, std::string fileName, const T& filesystemHandlers, Cache& cache, InFlightLoads& inFlightLoads)
+{
+    using ResultType = typename TemplateFunctions<CharT>::ResultType;
+
+    auto findCached = [this, &cache, &fileName](ResultType& result) {
+        auto cached = cache.Find(fileName);
+        if (!cached)
+            return false;
+
+        auto& entry = *cached;
+        if (m_settings.autoReload && m_settings.autoReloadInterval.count() == 0)
+        {
+            auto lastModified = CallFilesystem(MetricsEvent::FilesystemCheck, fileName, [&entry, &fileName]() {
+                return entry.handler->GetLastModificationDate(fileName);
+            });
+            if (lastModified && (!entry.lastModification || lastModified.value() > entry.lastModification.value()))
+                return false;
+        }
+
+        // Bit is checked first, so the requests of the hot templates don't write to the shared entry
+        if (!entry.isReferenced.load(std::memory_order_relaxed))
+            entry.isReferenced.store(true, std::memory_order_relaxed);
+        m_cacheHits.fetch_add(1, std::memory_order_relaxed);
+        result = ResultType(entry.tpl);
+        return true;
+    };
+
+    ResultType result;
+    if (findCached(result))
+        return result;
+
+    // The first of the concurrent requests of the template loads it, the rest ones wait for the result of this load
+    std::promise<ResultType> loadPromise;
+    {
+        std::unique_lock<std::mutex> l(m_inFlightGuard);
+        auto p = inFlightLoads.find(fileName);
+        if (p != inFlightLoads.end())
+        {
+            auto inFlightLoad = p->second;
+            l.unlock();
+            m_cacheHits.fetch_add(1, std::memory_order_relaxed);
+            return inFlightLoad.get();
+        }
+
+        // Template could be loaded by the other request after the first lookup
+        if (findCached(result))
+            return result;
+
+        inFlightLoads.emplace(fileName, loadPromise.get_future().share());
+    }
+
+    auto finishLoad = [this, &inFlightLoads, &fileName]() {
+        std::lock_guard<std::mutex> l(m_inFlightGuard);
+        inFlightLoads.erase(fileName);
+    };
+
+    m_cacheMisses.fetch_add(1, std::memory_order_relaxed);
+    try
+    {
+        result = ReadTemplateImpl<CharT>(env, fileName, filesystemHandlers, cache);
+    }
+    catch (...)
+    {
+        finishLoad();
+        loadPromise.set_exception(std::current_exception());
+        throw;
+    }
+
+    finishLoad();
+    loadPromise.set_value(result);
+    return result;
+}
+
 template<typename CharT, typename T, typename Cache>
-auto TemplateEnv::LoadTemplateImpl(TemplateEnv* env, std::string fileName, const T& filesystemHandlers, Cache& cache)
+auto TemplateEnv::ReadTemplateImpl(TemplateEnv* env, const std::string& fileName, const T& filesystemHandlers, Cache& cache)
 {
     using Functions = TemplateFunctions<CharT>;
     using ResultType = typename Functions::ResultType;
     using ErrorType = typename ResultType::error_type;
     auto tpl = Functions::CreateTemplate(env);
+    bool deduplicate = m_settings.deduplicateTemplates && !m_settings.usePrecompiledTemplates && m_settings.cacheSize != 0;
 
+    for (auto& fh : filesystemHandlers)
     {
-        std::shared_lock<std::shared_timed_mutex> l(m_guard);
-        auto p = cache.find(fileName);
-        if (p != cache.end())
+        if (!fh.prefix.empty() && fileName.find(fh.prefix) != 0)
+            continue;
+
+        auto fs = fh.handler.get();
+        auto loadStart = std::chrono::steady_clock::now();
+        nonstd::optional<typename Functions::LoadResultType> res;
+        decltype(Functions::OpenBuffer(fileName, fs)) source;
+        uint64_t contentHash = 0;
+        // Compiled images are checked against the copy of the source
+        if (!m_settings.usePrecompiledTemplates)
+            source = CallFilesystem(MetricsEvent::FilesystemOpen, fileName, [&]() { return Functions::OpenBuffer(fileName, fs); });
+
+        if (deduplicate)
         {
-            if (m_settings.autoReload)
+            if (!source)
             {
-                auto lastModified = p->second.handler->GetLastModificationDate(fileName);
-                if (!lastModified || (p->second.lastModification && lastModified.value() <= p->second.lastModification.value()))
-                    return ResultType(p->second.tpl);
+                auto stream = CallFilesystem(MetricsEvent::FilesystemOpen, fileName, [&]() { return Functions::LoadFile(fileName, fs); });
+                if (!stream)
+                    continue;
+                source = ReadSharedSource(*stream);
+            }
+
+            contentHash = CalcSourceHash(source->data(), source->size() * sizeof(CharT));
+            auto duplicate = FindDuplicate(cache, *source, contentHash);
+            if (duplicate)
+            {
+                m_cacheDuplicates.fetch_add(1, std::memory_order_relaxed);
+                tpl = duplicate->tpl;
+                source = duplicate->source;
+                res.emplace();
             }
             else
-                return ResultType(p->second.tpl);
+                res = tpl.Load(*source, source, fileName);
+        }
+        else if (source)
+            res = tpl.Load(*source, source, fileName);
+        else
+        {
+            std::future<CharFileStreamPtr> image;
+            if (m_settings.usePrecompiledTemplates)
+                image = OpenCompiledImage(fileName, fs);
+            auto stream = CallFilesystem(MetricsEvent::FilesystemOpen, fileName, [&]() { return Functions::LoadFile(fileName, fs); });
+            if (stream)
+                res = LoadTemplateSource(tpl, *stream, fileName, std::move(image));
         }
-    }
-
-    for (auto& fh : filesystemHandlers)
-    {
-        if (!fh.prefix.empty() && fileName.find(fh.prefix) != 0)
-            continue;
 
-        auto stream = Functions::LoadFile(fileName, fh.handler.get());
-        if (stream)
+        if (res)
         {
-            auto res = tpl.Load(*stream, fileName);
-            if (!res)
-                return ResultType(res.get_unexpected());
+            if (m_settings.collectMetrics)
+                RecordMetric(MetricsEvent::TemplateLoaded, fileName, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - loadStart));
+            if (!res.value())
+                return ResultType(res.value().get_unexpected());
 
             if (m_settings.cacheSize != 0)
             {
-                auto lastModified = fh.handler->GetLastModificationDate(fileName);
-                std::unique_lock<std::shared_timed_mutex> l(m_guard);
-                auto& cacheEntry = cache[fileName];
-                cacheEntry.tpl = tpl;
-                cacheEntry.handler = fh.handler;
-                cacheEntry.lastModification = lastModified;
+                using CacheEntry = typename std::decay_t<decltype(cache)>::EntryPtr::element_type;
+                auto cacheEntry = std::make_shared<CacheEntry>();
+                cacheEntry->tpl = tpl;
+                cacheEntry->handler = fh.handler;
+                cacheEntry->lastModification = CallFilesystem(MetricsEvent::FilesystemCheck, fileName, [fs, &fileName]() {
+                    return fs->GetLastModificationDate(fileName);
+                });
+                cacheEntry->dependencies = tpl.GetDependencies();
+                cacheEntry->source = std::move(source);
+                cacheEntry->contentHash = contentHash;
+                auto dependencies = cacheEntry->dependencies;
+
+                UpdateCache(cache, [this, &fileName, &cacheEntry](auto& entries) {
+                    EvictCacheEntries(entries, fileName);
+                    if (entries.Contains(fileName))
+                    {
+                        m_cacheReloads.fetch_add(1, std::memory_order_relaxed);
+                        ++ m_templatesVersion;
+                        EraseDependentEntries(entries, fileName);
+                    }
+                    entries.Insert(fileName, std::move(cacheEntry));
+                });
+
+                if (m_settings.prefetchDependencies && !dependencies.empty())
+                    PrefetchDependencies<CharT>(dependencies, cache);
+
+                if (m_settings.autoReload && m_settings.autoReloadInterval.count() != 0)
+                    std::call_once(m_reloadCheckerStarted, [this]() { StartReloadChecker(); });
             }
 
             return ResultType(tpl);
@@ -82,14 +332,626 @@ auto TemplateEnv::LoadTemplateImpl(TemplateEnv* env, std::string fileName, const
     return ResultType(nonstd::make_unexpected(ErrorType(errorData)));
 }
 
+nonstd::expected<GenericMap, ErrorInfo> TemplateEnv::LoadMetadata(const std::string& fileName)
+{
+    // Sources are checked on every request only with the zero reload interval. Otherwise the modified entries are dropped by the
+    // reload checker
+    bool checkModification = m_settings.autoReload && m_settings.autoReloadInterval.count() == 0;
+    if (!checkModification)
+    {
+        auto cached = m_templateCache.Find(fileName);
+        if (cached)
+            return cached->tpl.GetMetadata();
+    }
+
+    std::shared_ptr<const MetadataCacheEntry> cached;
+    {
+        std::lock_guard<std::mutex> l(m_metadataCacheGuard);
+        auto p = m_metadataCache.find(fileName);
+        if (p != m_metadataCache.end())
+            cached = p->second;
+    }
+    if (cached)
+    {
+        if (!checkModification)
+            return cached->values;
+
+        auto lastModified = CallFilesystem(MetricsEvent::FilesystemCheck, fileName, [&cached, &fileName]() {
+            return cached->handler->GetLastModificationDate(fileName);
+        });
+        if (!lastModified || (cached->lastModification && lastModified.value() <= cached->lastModification.value()))
+            return cached->values;
+    }
+
+    for (auto& fh : m_filesystemHandlers)
+    {
+        if (!fh.prefix.empty() && fileName.find(fh.prefix) != 0)
+            continue;
+
+        auto fs = fh.handler.get();
+        // Memory-mapped sources are scanned in place. The streamed ones are read entirely, but only the beginning of them is scanned
+        // if the metadata block is found
+        auto buffer = CallFilesystem(MetricsEvent::FilesystemOpen, fileName, [&]() { return fs->OpenBuffer(fileName); });
+        std::string content;
+        nonstd::string_view source;
+        if (buffer)
+            source = *buffer;
+        else
+        {
+            auto stream = CallFilesystem(MetricsEvent::FilesystemOpen, fileName, [&]() { return fs->OpenStream(fileName); });
+            if (!stream)
+                continue;
+            content.assign(std::istreambuf_iterator<char>(*stream), std::istreambuf_iterator<char>());
+            source = content;
+        }
+
+        auto metadata = ScanMetadata(source, m_settings, fileName);
+        if (!metadata || m_settings.cacheSize == 0)
+            return metadata;
+
+        auto entry = std::make_shared<MetadataCacheEntry>();
+        entry->handler = fh.handler;
+        entry->lastModification = CallFilesystem(MetricsEvent::FilesystemCheck, fileName, [fs, &fileName]() {
+            return fs->GetLastModificationDate(fileName);
+        });
+        entry->values = metadata.value();
+        {
+            std::lock_guard<std::mutex> l(m_metadataCacheGuard);
+            m_metadataCache[fileName] = std::move(entry);
+        }
+
+        if (m_settings.autoReload && m_settings.autoReloadInterval.count() != 0)
+            std::call_once(m_reloadCheckerStarted, [this]() { StartReloadChecker(); });
+        return metadata;
+    }
+
+    ErrorInfo::Data errorData;
+    errorData.code = ErrorCode::FileNotFound;
+    errorData.srcLoc.col = 1;
+    errorData.srcLoc.line = 1;
+    errorData.srcLoc.fileName = "";
+    errorData.extraParams.push_back(Value(fileName));
+
+    return nonstd::make_unexpected(ErrorInfo(errorData));
+}
+
+// Modifies the cache by 'fn'. Modifications are serialized, so 'fn' sees the consistent set of the entries. Concurrent template
+// requests see each of the single entry changes as soon as it's made
+template<typename Cache, typename Fn>
+void TemplateEnv::UpdateCache(Cache& cache, Fn&& fn)
+{
+    std::lock_guard<std::mutex> l(m_cacheUpdateGuard);
+    fn(cache);
+}
+
+// Should be called by the UpdateCache function. Makes room for the 'newEntryName' entry by removing the entries which aren't requested
+// recently (see TemplatesCache::EvictOne)
+template<typename Cache>
+void TemplateEnv::EvictCacheEntries(Cache& cache, const std::string& newEntryName)
+{
+    if (m_settings.cacheSize < 0 || cache.Contains(newEntryName))
+        return;
+
+    auto maxSize = static_cast<size_t>(m_settings.cacheSize);
+    while (cache.GetSize() >= maxSize)
+    {
+        auto evictedName = cache.EvictOne();
+        if (!evictedName)
+            break;
+
+        m_cacheEvictions.fetch_add(1, std::memory_order_relaxed);
+        ++ m_templatesVersion;
+        // Load times are kept while the template is cached, so the counters of the dynamic template names don't pile up
+        if (m_settings.collectMetrics && !m_templateCache.Contains(evictedName.value()) && !m_templateWCache.Contains(evictedName.value()))
+        {
+            std::lock_guard<std::mutex> l(m_loadTimeGuard);
+            m_loadTime.erase(evictedName.value());
+        }
+    }
+}
+
+// Should be called by the UpdateCache function. Templates which depend on the changed one are reloaded by the next requests
+template<typename Cache>
+void TemplateEnv::EraseDependentEntries(Cache& cache, const std::string& fileName)
+{
+    std::vector<std::string> changedNames{fileName};
+    auto entries = cache.GetEntries();
+    while (!changedNames.empty())
+    {
+        auto changedName = std::move(changedNames.back());
+        changedNames.pop_back();
+        for (auto& e : entries)
+        {
+            if (!e.second)
+                continue;
+
+            auto& deps = e.second->dependencies;
+            if (std::find(deps.begin(), deps.end(), changedName) == deps.end())
+                continue;
+
+            changedNames.push_back(e.first);
+            cache.Erase(e.first);
+            e.second.reset();
+            ++ m_templatesVersion;
+        }
+    }
+}
+
+// Loads the dependencies of the just loaded template into the cache in the background. Filesystem handlers are notified of the names
+// first, so they can fetch the files in a batch. Requests of the templates being loaded wait for the background loads (see
+// LoadTemplateImpl)
+template<typename CharT, typename Cache>
+void TemplateEnv::PrefetchDependencies(const std::vector<std::string>& fileNames, const Cache& cache)
+{
+    std::vector<std::string> names;
+    std::copy_if(fileNames.begin(), fileNames.end(), std::back_inserter(names), [&cache](auto& name) { return !cache.Contains(name); });
+    if (names.empty())
+        return;
+
+    for (auto& fh : m_filesystemHandlers)
+    {
+        std::vector<std::string> handlerNames;
+        std::copy_if(names.begin(), names.end(), std::back_inserter(handlerNames), [&fh](auto& name) {
+            return fh.prefix.empty() || name.find(fh.prefix) == 0;
+        });
+        if (!handlerNames.empty())
+            fh.handler->Prefetch(handlerNames);
+    }
+
+    std::lock_guard<std::mutex> l(m_prefetchGuard);
+    if (m_isPrefetchStopped)
+        return;
+
+    m_prefetchTasks.erase(std::remove_if(m_prefetchTasks.begin(), m_prefetchTasks.end(), [](auto& task) {
+        return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), m_prefetchTasks.end());
+    for (auto& name : names)
+    {
+        m_prefetchTasks.push_back(std::async(std::launch::async, [this, name]() {
+            try
+            {
+                TemplateFunctions<CharT>::LoadTemplate(this, name);
+            }
+            catch (...)
+            {
+                // Error (if any) is reported by the request of the template
+            }
+        }));
+    }
+}
+
+TemplateEnv::~TemplateEnv()
+{
+    // Background loads may start the other ones, so the new ones are refused before the running ones are waited for
+    std::vector<std::future<void>> prefetchTasks;
+    {
+        std::lock_guard<std::mutex> l(m_prefetchGuard);
+        m_isPrefetchStopped = true;
+        prefetchTasks.swap(m_prefetchTasks);
+    }
+    for (auto& task : prefetchTasks)
+        task.wait();
+
+    if (!m_reloadChecker.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> l(m_reloadCheckerGuard);
+        m_isStopping = true;
+    }
+    m_reloadCheckerStop.notify_all();
+    m_reloadChecker.join();
+}
+
+void TemplateEnv::StartReloadChecker()
+{
+    auto interval = m_settings.autoReloadInterval;
+    m_reloadChecker = std::thread([this, interval]() {
+        std::unique_lock<std::mutex> l(m_reloadCheckerGuard);
+        while (!m_reloadCheckerStop.wait_for(l, interval, [this]() { return m_isStopping; }))
+        {
+            l.unlock();
+            CheckModifiedTemplates();
+            l.lock();
+        }
+    });
+}
+
+void TemplateEnv::CheckModifiedTemplates()
+{
+    DropModifiedTemplates(m_templateCache);
+    DropModifiedTemplates(m_templateWCache);
+    DropModifiedMetadata();
+}
+
+// Modification dates of the entries are requested by the single call per filesystem handler (see
+// IFilesystemHandler::GetLastModificationDates). Returns the flags of the modified entries
+template<typename Entries>
+std::vector<bool> TemplateEnv::CheckModifiedEntries(const Entries& entries)
+{
+    std::unordered_map<const IFilesystemHandler*, std::vector<size_t>> handlerEntries;
+    for (size_t idx = 0; idx != entries.size(); ++ idx)
+        handlerEntries[entries[idx].second->handler.get()].push_back(idx);
+
+    std::vector<bool> result(entries.size(), false);
+    for (auto& h : handlerEntries)
+    {
+        std::vector<std::string> names;
+        for (auto idx : h.second)
+            names.push_back(entries[idx].first);
+
+        std::vector<nonstd::optional<TimePoint>> dates;
+        try
+        {
+            // Batched check isn't attributed to the single template
+            dates = CallFilesystem(MetricsEvent::FilesystemCheck, std::string(), [&h, &names]() { return h.first->GetLastModificationDates(names); });
+        }
+        catch (...)
+        {
+            dates.clear();
+        }
+
+        // Failure of the batched check may be transient (e.g. of the remote store), so it doesn't drop the entries of the handler. They
+        // are checked one by one instead. Entries which can't be checked are kept, the errors are reported by their next reloads
+        if (dates.size() != names.size())
+        {
+            dates.assign(names.size(), nonstd::optional<TimePoint>());
+            for (size_t n = 0; n != names.size(); ++ n)
+            {
+                try
+                {
+                    dates[n] = CallFilesystem(MetricsEvent::FilesystemCheck, names[n], [&h, &names, n]() { return h.first->GetLastModificationDate(names[n]); });
+                }
+                catch (...)
+                {
+                }
+            }
+        }
+
+        for (size_t n = 0; n != h.second.size(); ++ n)
+        {
+            auto& entry = *entries[h.second[n]].second;
+            if (dates[n])
+                result[h.second[n]] = !entry.lastModification || dates[n].value() > entry.lastModification.value();
+        }
+    }
+    return result;
+}
+
+// Modification dates are requested for the copy of the entries list, so the template requests aren't blocked by the filesystem access
+template<typename Cache>
+void TemplateEnv::DropModifiedTemplates(Cache& cache)
+{
+    auto entries = cache.GetEntries();
+    auto isModified = CheckModifiedEntries(entries);
+
+    std::vector<typename Cache::value_type> modified;
+    for (size_t idx = 0; idx != entries.size(); ++ idx)
+    {
+        if (isModified[idx])
+            modified.push_back(entries[idx]);
+    }
+    if (modified.empty())
+        return;
+
+    UpdateCache(cache, [this, &modified](auto& entries) {
+        for (auto& e : modified)
+        {
+            // Entry could be already reloaded by the template request
+            if (entries.Find(e.first) == e.second)
+            {
+                m_cacheReloads.fetch_add(1, std::memory_order_relaxed);
+                entries.Erase(e.first);
+                ++ m_templatesVersion;
+                EraseDependentEntries(entries, e.first);
+            }
+        }
+    });
+}
+
+void TemplateEnv::DropModifiedMetadata()
+{
+    std::vector<std::pair<std::string, std::shared_ptr<const MetadataCacheEntry>>> entries;
+    {
+        std::lock_guard<std::mutex> l(m_metadataCacheGuard);
+        entries.assign(m_metadataCache.begin(), m_metadataCache.end());
+    }
+
+    auto isModified = CheckModifiedEntries(entries);
+    for (size_t idx = 0; idx != entries.size(); ++ idx)
+    {
+        if (!isModified[idx])
+            continue;
+
+        auto& e = entries[idx];
+        std::lock_guard<std::mutex> l(m_metadataCacheGuard);
+        auto p = m_metadataCache.find(e.first);
+        if (p != m_metadataCache.end() && p->second == e.second)
+            m_metadataCache.erase(p);
+    }
+}
+
 nonstd::expected<Template, ErrorInfo> TemplateEnv::LoadTemplate(std::string fileName)
 {
-    return LoadTemplateImpl<char>(this, std::move(fileName), m_filesystemHandlers, m_templateCache);
+    return LoadTemplateImpl<char>(this, std::move(fileName), m_filesystemHandlers, m_templateCache, m_inFlightLoads);
 }
 
 nonstd::expected<TemplateW, ErrorInfoW> TemplateEnv::LoadTemplateW(std::string fileName)
 {
-    return LoadTemplateImpl<wchar_t>(this, std::move(fileName), m_filesystemHandlers, m_templateWCache);
+    return LoadTemplateImpl<wchar_t>(this, std::move(fileName), m_filesystemHandlers, m_templateWCache, m_inFlightWLoads);
+}
+
+nonstd::expected<Template, ErrorInfo> TemplateEnv::LoadSpecializedTemplate(std::string fileName)
+{
+    auto tpl = LoadTemplate(std::move(fileName));
+    if (!tpl)
+        return tpl;
+
+    return tpl.value().Specialize();
+}
+
+nonstd::expected<TemplateW, ErrorInfoW> TemplateEnv::LoadSpecializedTemplateW(std::string fileName)
+{
+    auto tpl = LoadTemplateW(std::move(fileName));
+    if (!tpl)
+        return tpl;
+
+    return tpl.value().Specialize();
+}
+
+std::vector<ErrorInfo> TemplateEnv::Preload(std::vector<std::string> fileNames, size_t threadsCount)
+{
+    if (threadsCount == 0)
+        threadsCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+    // Dependencies of the loaded templates are appended to the list of the names. Workers wait for them while any of the
+    // templates is being loaded
+    auto requestedCount = fileNames.size();
+    std::vector<nonstd::optional<ErrorInfo>> errors(requestedCount);
+    std::unordered_set<std::string> knownNames(fileNames.begin(), fileNames.end());
+    std::mutex guard;
+    std::condition_variable namesAdded;
+    size_t nextItem = 0;
+    size_t activeWorkers = 0;
+    bool isCancelled = false;
+
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> l(guard);
+        for (;;)
+        {
+            namesAdded.wait(l, [&]() { return isCancelled || nextItem != fileNames.size() || activeWorkers == 0; });
+            if (isCancelled || nextItem == fileNames.size())
+                break;
+
+            auto idx = nextItem ++;
+            auto fileName = fileNames[idx];
+            ++ activeWorkers;
+            l.unlock();
+            std::vector<std::string> dependencies;
+            nonstd::optional<ErrorInfo> error;
+            try
+            {
+                auto tpl = LoadTemplate(fileName);
+                if (tpl)
+                    dependencies = tpl.value().GetDependencies();
+                else
+                    error = tpl.error();
+            }
+            catch (...)
+            {
+                l.lock();
+                -- activeWorkers;
+                isCancelled = true;
+                namesAdded.notify_all();
+                throw;
+            }
+            l.lock();
+            -- activeWorkers;
+
+            if (error && idx < requestedCount)
+                errors[idx] = std::move(error);
+            for (auto& dep : dependencies)
+            {
+                if (knownNames.insert(dep).second)
+                    fileNames.push_back(std::move(dep));
+            }
+            namesAdded.notify_all();
+        }
+    };
+
+    std::vector<std::future<void>> workers;
+    for (size_t idx = 1; idx < threadsCount; ++ idx)
+        workers.push_back(std::async(std::launch::async, worker));
+    worker();
+    for (auto& w : workers)
+        w.get();
+
+    std::vector<ErrorInfo> result;
+    for (auto& e : errors)
+    {
+        if (e)
+            result.push_back(std::move(e.value()));
+    }
+
+    return result;
+}
+
+std::vector<ErrorInfo> TemplateEnv::PreloadByPattern(const std::string& pattern, size_t threadsCount)
+{
+    std::vector<std::string> fileNames;
+    std::unordered_set<std::string> knownNames;
+    for (auto& fh : m_filesystemHandlers)
+    {
+        for (auto& name : fh.handler->ListFiles())
+        {
+            if (!fh.prefix.empty() && name.find(fh.prefix) != 0)
+                continue;
+
+            if (MatchPattern(pattern, name) && knownNames.insert(name).second)
+                fileNames.push_back(std::move(name));
+        }
+    }
+    std::sort(fileNames.begin(), fileNames.end());
+
+    return Preload(std::move(fileNames), threadsCount);
+}
+
+TemplateCacheStats TemplateEnv::GetCacheStats() const
+{
+    TemplateCacheStats result;
+    result.size = m_templateCache.GetSize() + m_templateWCache.GetSize();
+    result.hits = m_cacheHits.load(std::memory_order_relaxed);
+    result.misses = m_cacheMisses.load(std::memory_order_relaxed);
+    result.evictions = m_cacheEvictions.load(std::memory_order_relaxed);
+    result.reloads = m_cacheReloads.load(std::memory_order_relaxed);
+    result.duplicates = m_cacheDuplicates.load(std::memory_order_relaxed);
+
+    return result;
+}
+
+TemplateEnvMetrics TemplateEnv::GetMetrics() const
+{
+    TemplateEnvMetrics result;
+    result.cache = GetCacheStats();
+    {
+        std::lock_guard<std::mutex> l(m_loadTimeGuard);
+        for (auto& h : m_loadTime)
+            result.loadTime[h.first] = h.second.Get();
+    }
+    result.renderTime = m_renderTime.Get();
+    result.failedRenders = m_failedRenders.load(std::memory_order_relaxed);
+    result.renderedBytes = m_renderedBytes.load(std::memory_order_relaxed);
+    result.filesystemOpenTime = m_filesystemOpenTime.Get();
+    result.filesystemCheckTime = m_filesystemCheckTime.Get();
+
+    return result;
+}
+
+void TemplateEnv::SetMetricsListener(MetricsListener listener)
+{
+    std::shared_ptr<const MetricsListener> newListener;
+    if (listener)
+        newListener = std::make_shared<const MetricsListener>(std::move(listener));
+    std::atomic_store(&m_metricsListener, std::move(newListener));
+}
+
+void TemplateEnv::SetAllocationListener(AllocationListener listener)
+{
+    std::shared_ptr<const AllocationListener> newListener;
+    if (listener)
+        newListener = std::make_shared<const AllocationListener>(std::move(listener));
+    std::atomic_store(&m_allocationListener, std::move(newListener));
+}
+
+void TemplateEnv::RecordMetric(MetricsEvent event, const std::string& templateName, std::chrono::nanoseconds duration, uint64_t bytes)
+{
+    switch (event)
+    {
+    case MetricsEvent::TemplateLoaded:
+    {
+        // Counters of the evicted templates are dropped (see EvictCacheEntries), but the ones of the templates which aren't cached (the
+        // failed loads, the disabled cache) aren't, so the number of the names is limited
+        auto maxNames = std::max<size_t>(LoadTimeNamesLimit, m_settings.cacheSize > 0 ? static_cast<size_t>(m_settings.cacheSize) : 0);
+        std::lock_guard<std::mutex> l(m_loadTimeGuard);
+        if (m_loadTime.size() < maxNames || m_loadTime.count(templateName) != 0)
+            m_loadTime[templateName].Add(duration);
+        break;
+    }
+    case MetricsEvent::RenderFailed:
+        m_failedRenders.fetch_add(1, std::memory_order_relaxed);
+        // fallthrough
+    case MetricsEvent::TemplateRendered:
+        m_renderTime.Add(duration);
+        m_renderedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        break;
+    case MetricsEvent::FilesystemOpen:
+        m_filesystemOpenTime.Add(duration);
+        break;
+    case MetricsEvent::FilesystemCheck:
+        m_filesystemCheckTime.Add(duration);
+        break;
+    }
+
+    auto listener = std::atomic_load(&m_metricsListener);
+    if (listener)
+        (*listener)(event, templateName, duration, bytes);
+}
+
+void TemplateEnv::HistogramCounters::Add(std::chrono::nanoseconds duration)
+{
+    size_t bucket = 0;
+    while (bucket + 1 < DurationHistogram::BucketsCount && duration > DurationHistogram::GetBucketBound(bucket))
+        ++ bucket;
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(duration.count(), std::memory_order_relaxed);
+}
+
+DurationHistogram TemplateEnv::HistogramCounters::Get() const
+{
+    DurationHistogram result;
+    for (size_t idx = 0; idx != DurationHistogram::BucketsCount; ++ idx)
+        result.buckets[idx] = buckets[idx].load(std::memory_order_relaxed);
+    result.count = count.load(std::memory_order_relaxed);
+    result.sum = std::chrono::nanoseconds(sum.load(std::memory_order_relaxed));
+
+    return result;
+}
+
+TemplateDependencyGraph TemplateEnv::GetDependencyGraph() const
+{
+    TemplateDependencyGraph result;
+    auto addEntries = [&result](const auto& cache) {
+        for (auto& e : cache.GetEntries())
+        {
+            auto& deps = result[e.first];
+            for (auto& d : e.second->dependencies)
+            {
+                if (std::find(deps.begin(), deps.end(), d) == deps.end())
+                    deps.push_back(d);
+            }
+        }
+    };
+    addEntries(m_templateCache);
+    addEntries(m_templateWCache);
+
+    return result;
+}
+
+std::vector<std::string> TemplateEnv::GetDependentTemplates(const std::string& fileName) const
+{
+    auto graph = GetDependencyGraph();
+
+    std::vector<std::string> result;
+    std::unordered_set<std::string> knownNames{fileName};
+    // Breadth-first walk over the reversed edges
+    for (size_t idx = 0; idx <= result.size(); ++ idx)
+    {
+        auto name = idx == 0 ? fileName : result[idx - 1];
+        for (auto& node : graph)
+        {
+            auto& deps = node.second;
+            if (std::find(deps.begin(), deps.end(), name) != deps.end() && knownNames.insert(node.first).second)
+                result.push_back(node.first);
+        }
+    }
+
+    return result;
+}
+
+void TemplateEnv::InvalidateTemplate(const std::string& fileName)
+{
+    auto invalidate = [this, &fileName](auto& entries) {
+        if (entries.Erase(fileName))
+            ++ m_templatesVersion;
+        EraseDependentEntries(entries, fileName);
+    };
+    UpdateCache(m_templateCache, invalidate);
+    UpdateCache(m_templateWCache, invalidate);
+
+    std::lock_guard<std::mutex> l(m_metadataCacheGuard);
+    m_metadataCache.erase(fileName);
 }
 
 } // jinja2
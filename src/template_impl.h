@@ -1,61 +1,43 @@
 #ifndef TEMPLATE_IMPL_H
 #define TEMPLATE_IMPL_H
 
+#include "allocation_tracker.h"
+#include "ast_serializer.h"
+#include "incremental_render.h"
 #include "internal_value.h"
 #include "jinja2cpp/binding/rapid_json.h"
 #include "jinja2cpp/template_env.h"
 #include "jinja2cpp/value.h"
+#include "membership_index.h"
+#include "parallel_filters.h"
+#include "parallel_render.h"
+#include "render_program.h"
+#include "render_limiter.h"
+#include "render_profiler.h"
 #include "renderer.h"
+#include "string_escape.h"
+#include "template_dependencies.h"
+#include "template_metadata.h"
 #include "template_parser.h"
 #include "value_visitors.h"
 
 #include <boost/optional.hpp>
-#include <boost/predef/other/endian.h>
 #include <nonstd/expected.hpp>
-#include <rapidjson/error/en.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace jinja2
 {
-namespace detail
-{
-template<size_t Sz>
-struct RapidJsonEncodingType;
-
-template<>
-struct RapidJsonEncodingType<1>
-{
-    using type = rapidjson::UTF8<char>;
-};
-
-#ifdef BOOST_ENDIAN_BIG_BYTE
-template<>
-struct RapidJsonEncodingType<2>
-{
-    using type = rapidjson::UTF16BE<wchar_t>;
-};
-
-template<>
-struct RapidJsonEncodingType<4>
-{
-    using type = rapidjson::UTF32BE<wchar_t>;
-};
-#else
-template<>
-struct RapidJsonEncodingType<2>
-{
-    using type = rapidjson::UTF16LE<wchar_t>;
-};
-
-template<>
-struct RapidJsonEncodingType<4>
-{
-    using type = rapidjson::UTF32LE<wchar_t>;
-};
-#endif
-}
-
 extern void SetupGlobals(InternalValueMap& globalParams);
 
 class ITemplateImpl
@@ -86,8 +68,54 @@ struct TemplateLoader<wchar_t>
     }
 };
 
+namespace detail
+{
+inline const std::string* GetPlainString(const InternalValueData& data, char*)
+{
+    return nonstd::get_if<std::string>(&data);
+}
+
+inline const std::wstring* GetPlainString(const InternalValueData&, wchar_t*)
+{
+    return nullptr;
+}
+} // detail
+
+// Strings of the same char type are escaped straight into the target. Other values are rendered to the temporary string first
 template<typename CharT>
-class GenericStreamWriter : public OutStream::StreamWriter
+void AppendEscapedValue(const InternalValue& val, std::basic_string<CharT>& os)
+{
+    using String = std::basic_string<CharT>;
+    using StringView = nonstd::basic_string_view<CharT>;
+
+    auto& data = val.GetData();
+    const String* str = detail::GetPlainString(data, static_cast<CharT*>(nullptr));
+    if (!str)
+    {
+        auto targetStr = nonstd::get_if<TargetString>(&data);
+        str = targetStr ? nonstd::get_if<String>(targetStr) : nullptr;
+    }
+    if (str)
+    {
+        escape::AppendHtmlEscaped(os, str->data(), str->data() + str->size());
+        return;
+    }
+
+    auto targetView = nonstd::get_if<TargetStringView>(&data);
+    auto view = targetView ? nonstd::get_if<StringView>(targetView) : nullptr;
+    if (view)
+    {
+        escape::AppendHtmlEscaped(os, view->data(), view->data() + view->size());
+        return;
+    }
+
+    String tmp;
+    Apply<visitors::ValueRenderer<CharT>>(val, tmp);
+    escape::AppendHtmlEscaped(os, tmp.data(), tmp.data() + tmp.size());
+}
+
+template<typename CharT>
+class GenericStreamWriter final : public OutStream::StreamWriter
 {
 public:
     explicit GenericStreamWriter(std::basic_string<CharT>& os)
@@ -103,13 +131,17 @@ public:
     {
         Apply<visitors::ValueRenderer<CharT>>(val, m_os);
     }
+    void WriteEscapedValue(const InternalValue& val) override
+    {
+        AppendEscapedValue(val, m_os);
+    }
 
 private:
     std::basic_string<CharT>& m_os;
 };
 
 template<typename CharT>
-class StringStreamWriter : public OutStream::StreamWriter
+class StringStreamWriter final : public OutStream::StreamWriter
 {
 public:
     explicit StringStreamWriter(std::basic_string<CharT>* targetStr)
@@ -126,11 +158,190 @@ public:
     {
         Apply<visitors::ValueRenderer<CharT>>(val, *m_targetStr);
     }
+    void WriteEscapedValue(const InternalValue& val) override
+    {
+        AppendEscapedValue(val, *m_targetStr);
+    }
 
 private:
     std::basic_string<CharT>* m_targetStr;
 };
 
+template<typename CharT>
+class SinkStreamWriter final : public OutStream::StreamWriter
+{
+public:
+    using SinkFn = std::function<void (const CharT*, size_t)>;
+
+    explicit SinkStreamWriter(const SinkFn& sink, size_t bufferSize = 4096)
+        : m_sink(sink)
+        , m_bufferSize(bufferSize)
+    {
+        m_buffer.reserve(bufferSize);
+    }
+
+    // StreamWriter interface
+    void WriteBuffer(const void* ptr, size_t length) override
+    {
+        auto str = reinterpret_cast<const CharT*>(ptr);
+        if (m_buffer.size() + length <= m_bufferSize)
+        {
+            m_buffer.append(str, length);
+            return;
+        }
+
+        Flush();
+        if (length < m_bufferSize)
+            m_buffer.append(str, length);
+        else
+            m_sink(str, length);
+    }
+    void WriteValue(const InternalValue& val) override
+    {
+        Apply<visitors::ValueRenderer<CharT>>(val, m_buffer);
+        if (m_buffer.size() >= m_bufferSize)
+            Flush();
+    }
+    void WriteEscapedValue(const InternalValue& val) override
+    {
+        AppendEscapedValue(val, m_buffer);
+        if (m_buffer.size() >= m_bufferSize)
+            Flush();
+    }
+
+    void Flush()
+    {
+        if (m_buffer.empty())
+            return;
+
+        m_sink(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+
+private:
+    const SinkFn& m_sink;
+    size_t m_bufferSize;
+    std::basic_string<CharT> m_buffer;
+};
+
+// Writer of the output slices (see RenderedSlices). Static text long enough is referenced in place, the rest of the output is gathered
+// to the pending chunk which is moved to the result once the next static slice or the end of the output is reached
+template<typename CharT>
+class SlicesStreamWriter final : public OutStream::StreamWriter
+{
+public:
+    explicit SlicesStreamWriter(RenderedSlices<CharT>& slices)
+        : m_slices(slices)
+    {
+    }
+
+    // StreamWriter interface
+    void WriteBuffer(const void* ptr, size_t length) override
+    {
+        m_pending.append(reinterpret_cast<const CharT*>(ptr), length);
+    }
+    void WriteStaticBuffer(const void* ptr, size_t length) override
+    {
+        if (length < RenderedSlices<CharT>::MinReferencedSize)
+        {
+            WriteBuffer(ptr, length);
+            return;
+        }
+
+        Flush();
+        m_slices.m_slices.push_back(OutputSlice<CharT>{reinterpret_cast<const CharT*>(ptr), length});
+    }
+    void WriteValue(const InternalValue& val) override
+    {
+        Apply<visitors::ValueRenderer<CharT>>(val, m_pending);
+    }
+    void WriteEscapedValue(const InternalValue& val) override
+    {
+        AppendEscapedValue(val, m_pending);
+    }
+
+    void Flush()
+    {
+        if (m_pending.empty())
+            return;
+
+        m_slices.m_chunks.push_back(std::move(m_pending));
+        m_pending.clear();
+        auto& chunk = m_slices.m_chunks.back();
+        m_slices.m_slices.push_back(OutputSlice<CharT>{chunk.data(), chunk.size()});
+    }
+
+    // Keeps the template which static text is referenced by the slices alive
+    void AddOwner(std::shared_ptr<const void> owner) { m_slices.m_owners.push_back(std::move(owner)); }
+
+private:
+    RenderedSlices<CharT>& m_slices;
+    std::basic_string<CharT> m_pending;
+};
+
+// Writer which stops the render when the output exceeds Settings::RenderLimits::maxOutputSize. Values are rendered to the intermediate
+// buffer in order to check their size before they are written. The exceeded limit is reported to 'context', the output written after it
+// is dropped. Context may be null for the zero limit
+template<typename CharT>
+class LimitedStreamWriter final : public OutStream::StreamWriter
+{
+public:
+    LimitedStreamWriter(OutStream::StreamWriter& writer, size_t maxSize, RenderContext* context = nullptr)
+        : m_writer(writer)
+        , m_maxSize(maxSize)
+        , m_context(context)
+    {
+    }
+
+    // StreamWriter interface
+    void WriteBuffer(const void* ptr, size_t length) override
+    {
+        if (CheckSize(length))
+            m_writer.WriteBuffer(ptr, length);
+    }
+    void WriteStaticBuffer(const void* ptr, size_t length) override
+    {
+        if (CheckSize(length))
+            m_writer.WriteStaticBuffer(ptr, length);
+    }
+    void WriteValue(const InternalValue& val) override
+    {
+        m_buffer.clear();
+        Apply<visitors::ValueRenderer<CharT>>(val, m_buffer);
+        WriteBuffer(m_buffer.data(), m_buffer.size());
+    }
+    void WriteEscapedValue(const InternalValue& val) override
+    {
+        m_buffer.clear();
+        AppendEscapedValue(val, m_buffer);
+        WriteBuffer(m_buffer.data(), m_buffer.size());
+    }
+
+    size_t GetWrittenSize() const { return m_written; }
+
+private:
+    bool CheckSize(size_t length)
+    {
+        if (m_isExceeded)
+            return false;
+
+        m_written += length;
+        if (m_maxSize == 0 || m_written <= m_maxSize)
+            return true;
+
+        m_isExceeded = true;
+        m_context->SetLimitError("maxOutputSize");
+        return false;
+    }
+
+    OutStream::StreamWriter& m_writer;
+    size_t m_maxSize;
+    RenderContext* m_context;
+    size_t m_written = 0;
+    bool m_isExceeded = false;
+    std::basic_string<CharT> m_buffer;
+};
+
 template<typename ErrorTpl1, typename ErrorTpl2>
 struct ErrorConverter;
 
@@ -172,13 +383,40 @@ public:
     }
 
     auto GetRenderer() const {return m_renderer;}
+    // Root of the tree is replaced with the one which renders it by the generated code (see generated_template.h)
+    void SetRenderer(RendererPtr renderer) {m_renderer = std::move(renderer);}
     auto GetTemplateName() const {};
 
+    template<typename TplT>
+    static std::shared_ptr<ThisType> GetTemplateImpl(const TplT& tpl)
+    {
+        return std::static_pointer_cast<ThisType>(tpl.m_impl);
+    }
+
     boost::optional<ErrorInfoTpl<CharT>> Load(std::basic_string<CharT> tpl, std::string tplName)
     {
-        m_template = std::move(tpl);
+        SetSource(std::move(tpl));
+        return Parse(std::move(tplName));
+    }
+
+    // Parsed template refers to the source (e.g. by the static text blocks) instead of the copy of it. 'sourceOwner' keeps the
+    // source alive while the template exists
+    boost::optional<ErrorInfoTpl<CharT>> Load(nonstd::basic_string_view<CharT> tpl, std::shared_ptr<const void> sourceOwner, std::string tplName)
+    {
+        m_template.clear();
+        m_template.shrink_to_fit();
+        m_sourceOwner = std::move(sourceOwner);
+        m_source = tpl;
+        return Parse(std::move(tplName));
+    }
+
+    boost::optional<ErrorInfoTpl<CharT>> Parse(std::string tplName, const InternalValueMap* frozenGlobals = nullptr)
+    {
         m_templateName = tplName.empty() ? std::string("noname.j2tpl") : std::move(tplName);
-        TemplateParser<CharT> parser(&m_template, m_settings, m_env, m_templateName);
+        ResetMetadata();
+        m_outputSizeHint = 0;
+        TemplateParser<CharT> parser(&m_source, m_settings, m_env, m_templateName);
+        parser.SetFrozenGlobals(frozenGlobals);
 
         auto parseResult = parser.Parse();
         if (!parseResult)
@@ -186,10 +424,279 @@ public:
 
         m_renderer = *parseResult;
         m_metadataInfo = parser.GetMetadataInfo();
+        m_variablesUsage = parser.GetVariablesUsage();
+        RemoveBuiltinGlobals(m_variablesUsage);
+        m_isMacroModule = IsMacroModule(m_renderer);
+        m_dependencies = TemplateDependenciesCollector<CharT>::Collect(m_renderer);
+        std::atomic_store(&m_moduleScope, std::shared_ptr<const InternalValueMap>());
+        ResetRenderProfile();
+        // Profiled children are rendered one by one by the tree nodes
+        if (m_settings.parallelRender && !m_settings.profileRender)
+            ParallelUnitsDetector::MarkUnits(m_renderer);
+        if (m_settings.renderEngine == RenderEngine::Bytecode && !m_settings.profileRender)
+            RenderProgramCompiler::Compile(m_renderer);
         return boost::optional<ErrorInfoTpl<CharT>>();
     }
 
+    boost::optional<ErrorInfoTpl<CharT>> SaveCompiled(std::string& image) const
+    {
+        if (!m_renderer)
+            return MakeCompiledImageError(ErrorCode::TemplateNotParsed, std::string());
+
+        try
+        {
+            AstWriter writer(m_source.data(), m_source.size(), sizeof(CharT));
+            WriteImageHeader(writer);
+            writer.WriteString(m_metadataInfo.metadataType);
+            writer.WriteBool(!m_metadataInfo.metadata.empty());
+            if (!m_metadataInfo.metadata.empty())
+            {
+                writer.WriteUInt(m_metadataInfo.metadata.size());
+                writer.WriteSourcePtr(m_metadataInfo.metadata.data());
+                writer.WriteUInt(m_metadataInfo.location.line);
+                writer.WriteUInt(m_metadataInfo.location.col);
+            }
+            WriteNames(writer, m_variablesUsage.variables);
+            WriteNames(writer, m_variablesUsage.attributePaths);
+            writer.WriteRenderer(m_renderer);
+            image = writer.GetData();
+        }
+        catch (const AstFormatError& ex)
+        {
+            return MakeCompiledImageError(ErrorCode::InvalidCompiledTemplate, ex.what());
+        }
+
+        return boost::optional<ErrorInfoTpl<CharT>>();
+    }
+
+    boost::optional<ErrorInfoTpl<CharT>> LoadCompiled(const std::string& image, std::basic_string<CharT> tpl, std::string tplName)
+    {
+        SetSource(std::move(tpl));
+        m_templateName = tplName.empty() ? std::string("noname.j2tpl") : std::move(tplName);
+        m_renderer.reset();
+        m_metadataInfo = MetadataInfo<CharT>();
+        m_variablesUsage = TemplateVariablesUsage();
+        ResetMetadata();
+        m_outputSizeHint = 0;
+
+        try
+        {
+            AstReader reader(image.data(), image.size(), m_source.data(), m_source.size(), sizeof(CharT));
+            ReadImageHeader(reader);
+
+            MetadataInfo<CharT> metadataInfo;
+            metadataInfo.metadataType = reader.ReadString();
+            if (reader.ReadBool())
+            {
+                auto length = static_cast<size_t>(reader.ReadUInt());
+                metadataInfo.metadata = nonstd::basic_string_view<CharT>(static_cast<const CharT*>(reader.ReadSourcePtr(length)), length);
+                metadataInfo.location.line = static_cast<unsigned>(reader.ReadUInt());
+                metadataInfo.location.col = static_cast<unsigned>(reader.ReadUInt());
+                metadataInfo.location.fileName = m_templateName;
+            }
+
+            TemplateVariablesUsage variablesUsage;
+            variablesUsage.variables = ReadNames(reader);
+            variablesUsage.attributePaths = ReadNames(reader);
+
+            auto renderer = reader.ReadRenderer();
+            if (!renderer || !reader.IsAtEnd())
+                throw AstFormatError("Invalid image structure");
+
+            m_renderer = std::move(renderer);
+            m_metadataInfo = std::move(metadataInfo);
+            m_variablesUsage = std::move(variablesUsage);
+            m_isMacroModule = IsMacroModule(m_renderer);
+            m_dependencies = TemplateDependenciesCollector<CharT>::Collect(m_renderer);
+            std::atomic_store(&m_moduleScope, std::shared_ptr<const InternalValueMap>());
+            if (m_settings.parallelRender)
+                ParallelUnitsDetector::MarkUnits(m_renderer);
+            if (m_settings.renderEngine == RenderEngine::Bytecode)
+                RenderProgramCompiler::Compile(m_renderer);
+        }
+        catch (const std::exception& ex)
+        {
+            return MakeCompiledImageError(ErrorCode::InvalidCompiledTemplate, ex.what());
+        }
+
+        return boost::optional<ErrorInfoTpl<CharT>>();
+    }
+
+    // Variant of the template specialized for the current values of the frozen globals of the environment (see
+    // TemplateEnv::FreezeGlobals). Built once per version of the frozen globals and shared by the requests until they are changed.
+    // Null if the template isn't bound to the environment, so there is nothing to specialize for
+    nonstd::expected<std::shared_ptr<ThisType>, ErrorInfoTpl<CharT>> GetSpecialized() const
+    {
+        if (!m_env)
+            return std::shared_ptr<ThisType>();
+        if (!m_renderer)
+            return nonstd::make_unexpected(MakeCompiledImageError(ErrorCode::TemplateNotParsed, std::string()));
+
+        auto isActual = [this](const std::shared_ptr<ThisType>& tpl) {
+            return tpl && tpl->m_frozenGlobalsVersion == m_env->GetFrozenGlobalsVersion();
+        };
+        auto specialized = std::atomic_load(&m_specialized);
+        if (isActual(specialized))
+            return specialized;
+
+        std::lock_guard<std::mutex> l(m_specializationGuard);
+        specialized = std::atomic_load(&m_specialized);
+        if (isActual(specialized))
+            return specialized;
+
+        specialized = std::make_shared<ThisType>(m_env);
+        specialized->m_settings = m_settings;
+        auto error = specialized->LoadSpecialized(*this);
+        if (error)
+            return nonstd::make_unexpected(error.value());
+
+        std::atomic_store(&m_specialized, specialized);
+        return specialized;
+    }
+
     boost::optional<ErrorInfoTpl<CharT>> Render(std::basic_string<CharT>& os, const ValuesMap& params)
+    {
+        auto start = os.size();
+        os.reserve(start + GetOutputSizeHint());
+        GenericStreamWriter<CharT> writer(os);
+        auto result = Render(static_cast<OutStream::StreamWriter&>(writer), params);
+        if (!result)
+            UpdateOutputSizeHint(os.size() - start);
+
+        return result;
+    }
+
+    // 'owner' keeps this template alive while the slices exist. Templates loaded by the render are kept by the slices too
+    boost::optional<ErrorInfoTpl<CharT>> Render(RenderedSlices<CharT>& slices, std::shared_ptr<const void> owner, const ValuesMap& params)
+    {
+        SlicesStreamWriter<CharT> writer(slices);
+        ExternalScope extParams(params);
+        RendererCallback callback(this);
+        ScopesPool scopesPool;
+        auto result = Render(writer, extParams, callback, scopesPool);
+        if (result)
+            return result;
+
+        writer.Flush();
+        writer.AddOwner(std::move(owner));
+        callback.VisitLoadedTemplates([&writer](auto tpl) { writer.AddOwner(std::move(tpl)); });
+        return result;
+    }
+
+    boost::optional<ErrorInfoTpl<CharT>> Render(const std::function<void (const CharT*, size_t)>& sink, const ValuesMap& params)
+    {
+        SinkStreamWriter<CharT> writer(sink, std::max<size_t>(m_settings.outputChunkSize, 1));
+        auto result = Render(static_cast<OutStream::StreamWriter&>(writer), params);
+        if (!result)
+            writer.Flush();
+
+        return result;
+    }
+
+    // Renders the template for each set of params on the pool of threads. Workers pick the items one by one, share the parsed
+    // template and the converted globals and keep their own output buffer, scopes pool and renderer callback between the items.
+    // 'fn' is called from the workers with the index of the item, the rendered text and the render error (if any)
+    template<typename Fn>
+    void RenderBatch(const std::vector<ValuesMap>& paramsList, size_t threadsCount, Fn&& fn)
+    {
+        if (threadsCount == 0)
+            threadsCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        threadsCount = std::min(threadsCount, paramsList.size());
+
+        std::atomic<size_t> nextItem{0};
+        auto worker = [this, &paramsList, &nextItem, &fn]() {
+            RendererCallback callback(this);
+            ScopesPool scopesPool;
+            std::basic_string<CharT> buffer;
+            try
+            {
+                for (auto idx = nextItem++; idx < paramsList.size(); idx = nextItem++)
+                {
+                    buffer.clear();
+                    buffer.reserve(GetOutputSizeHint());
+                    callback.ResetLoadedTemplates();
+                    GenericStreamWriter<CharT> writer(buffer);
+                    ExternalScope extParams(paramsList[idx]);
+                    auto result = Render(writer, extParams, callback, scopesPool);
+                    if (!result)
+                        UpdateOutputSizeHint(buffer.size());
+                    fn(idx, buffer, result);
+                }
+            }
+            catch (...)
+            {
+                // Exception is thrown by 'fn'. The rest of the items are skipped
+                nextItem = paramsList.size();
+                throw;
+            }
+        };
+
+        std::vector<std::future<void>> workers;
+        for (size_t idx = 1; idx < threadsCount; ++ idx)
+            workers.push_back(std::async(std::launch::async, worker));
+        worker();
+        for (auto& w : workers)
+            w.get();
+    }
+
+    boost::optional<ErrorInfoTpl<CharT>> Render(OutStream::StreamWriter& writer, const ValuesMap& params)
+    {
+        ExternalScope extParams(params);
+        RendererCallback callback(this);
+        ScopesPool scopesPool;
+        return Render(writer, extParams, callback, scopesPool);
+    }
+
+    boost::optional<ErrorInfoTpl<CharT>> Render(OutStream::StreamWriter& writer, const ExternalScope& extParams, IRendererCallback& callback, ScopesPool& scopesPool,
+                                                IncrementalRenderState* incremental = nullptr)
+    {
+        // Metrics are the environment ones, so the current settings of it apply to the templates cached before the change
+        bool collectMetrics = m_env && m_env->GetSettings().collectMetrics;
+        bool trackAllocations = m_env && m_env->GetSettings().trackAllocations;
+        if (!m_settings.profileRender && !collectMetrics && !trackAllocations)
+            return Render(writer, extParams, callback, scopesPool, nullptr, incremental);
+
+        // Tracker is installed before the rest of the render state is created, so the allocations of it are counted too
+        nonstd::optional<AllocationTracker> allocationTracker;
+        if (trackAllocations)
+            allocationTracker.emplace();
+        AllocationTracker::Scope trackerScope(allocationTracker ? &allocationTracker.value() : AllocationTracker::GetCurrent());
+
+        nonstd::optional<RenderProfiler> profiler;
+        if (m_settings.profileRender)
+            profiler.emplace();
+
+        // Zero size limit only counts the written characters
+        LimitedStreamWriter<CharT> countingWriter(writer, 0);
+        auto start = std::chrono::steady_clock::now();
+        auto result = Render(countingWriter, extParams, callback, scopesPool, profiler ? &profiler.value() : nullptr, incremental);
+        if (collectMetrics)
+        {
+            auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            m_env->RecordMetric(result ? MetricsEvent::RenderFailed : MetricsEvent::TemplateRendered, m_templateName, duration,
+                                countingWriter.GetWrittenSize() * sizeof(CharT));
+        }
+
+        if (allocationTracker)
+        {
+            auto stats = allocationTracker->GetStats();
+            AllocationTracker::Scope suspendedScope(nullptr);
+            auto listener = m_env->GetAllocationListener();
+            if (listener)
+                (*listener)(m_templateName, stats);
+        }
+
+        // Renders (including the failed ones) are accumulated by the profile of the template
+        if (profiler)
+        {
+            std::lock_guard<std::mutex> l(m_profileGuard);
+            profiler->MergeTo(m_renderProfile);
+        }
+        return result;
+    }
+
+    boost::optional<ErrorInfoTpl<CharT>> Render(OutStream::StreamWriter& writer, const ExternalScope& extParams, IRendererCallback& callback, ScopesPool& scopesPool, RenderProfiler* profiler,
+                                                IncrementalRenderState* incremental)
     {
         boost::optional<ErrorInfoTpl<CharT>> normalResult;
 
@@ -204,37 +711,54 @@ public:
             return ErrorInfoTpl<CharT>(errorData);
         }
 
+        // Specialized tree is stale once the frozen globals are changed, the generic one is rendered instead
+        auto renderer = m_renderer;
+        if (m_genericRenderer && m_env->GetFrozenGlobalsVersion() != m_frozenGlobalsVersion)
+            renderer = m_genericRenderer;
+
         try
         {
-            InternalValueMap extParams;
-            InternalValueMap intParams;
-
-            auto convertFn = [&intParams](auto& params) {
-                for (auto& ip : params)
-                {
-                    auto valRef = &ip.second.data();
-                    auto newParam = visit(visitors::InputValueConvertor(false, true), *valRef);
-                    if (!newParam)
-                        intParams[ip.first] = ValueRef(static_cast<const Value&>(*valRef));
-                    else
-                        intParams[ip.first] = newParam.get();
-                }
-            };
+            auto globals = GetGlobals();
+            RenderContext context(extParams, globals->params, &callback, &scopesPool);
+            InitRenderContext(context);
+            context.SetProfiler(profiler);
+            RenderErrorState errorState;
+            context.SetErrorState(&errorState);
+            nonstd::optional<MembershipIndexCache> membershipIndexes;
+            if (m_settings.indexMembershipTests)
+            {
+                membershipIndexes.emplace();
+                context.SetMembershipIndexes(&membershipIndexes.value());
+            }
+            nonstd::optional<ParallelFilterExecutor> parallelFilters;
+            if (m_settings.parallelFilterThreshold != 0)
+            {
+                parallelFilters.emplace(m_settings.parallelFilterThreshold, m_settings.parallelFilterThreads);
+                context.SetParallelFilters(&parallelFilters.value());
+            }
 
-            if (m_env)
+            auto& limits = m_settings.renderLimits;
+            nonstd::optional<RenderLimiter> limiter;
+            if (RenderLimiter::IsRequired(limits))
             {
-                m_env->ApplyGlobals(convertFn);
-                std::swap(extParams, intParams);
+                limiter.emplace(limits);
+                context.SetLimiter(&limiter.value());
             }
+            nonstd::optional<LimitedStreamWriter<CharT>> limitedWriter;
+            if (limits.maxOutputSize != 0)
+                limitedWriter.emplace(writer, limits.maxOutputSize, &context);
 
-            convertFn(params);
-            SetupGlobals(extParams);
+            OutStream outStream(limitedWriter ? &limitedWriter.value() : &writer);
+            if (incremental)
+                incremental->Render(renderer, outStream, context, GetEnvVersion(*globals));
+            else
+                renderer->Render(outStream, context);
 
-            RendererCallback callback(this);
-            RenderContext context(intParams, extParams, &callback);
-            InitRenderContext(context);
-            OutStream outStream([writer = GenericStreamWriter<CharT>(os)]() mutable -> OutStream::StreamWriter* {return &writer;});
-            m_renderer->Render(outStream, context);
+            auto& error = errorState.Get();
+            if (error)
+            {
+                return nonstd::visit([](auto& e) { return ErrorConverter<ErrorInfoTpl<CharT>, std::decay_t<decltype(e)>>::Convert(e); }, *error);
+            }
         }
         catch (const ErrorInfoTpl<char>& error)
         {
@@ -302,33 +826,317 @@ public:
 
     nonstd::expected<GenericMap, ErrorInfoTpl<CharT>> GetMetadata() const
     {
-        auto& metadataString = m_metadataInfo.metadata;
-        if (metadataString.empty())
+        if (m_metadataInfo.metadata.empty())
             return GenericMap();
 
-        if (m_metadataInfo.metadataType == "json")
+        // Metadata is parsed once and published: the readers of the parsed one don't lock anything
+        auto parsed = std::atomic_load(&m_parsedMetadata);
+        if (parsed)
+            return MakeMetadataMap(std::move(parsed));
+
+        std::lock_guard<std::mutex> lock(m_metadataGuard);
+        parsed = std::atomic_load(&m_parsedMetadata);
+        if (parsed)
+            return MakeMetadataMap(std::move(parsed));
+
+        auto result = ParseMetadata(m_metadataInfo);
+        if (!result)
+            return result.get_unexpected();
+
+        std::atomic_store(&m_parsedMetadata, result.value());
+        return MakeMetadataMap(result.value());
+    }
+
+    nonstd::expected<MetadataInfo<CharT>, ErrorInfoTpl<CharT>> GetMetadataRaw() const { return m_metadataInfo; }
+
+    nonstd::optional<uint64_t> GetTemplatesVersion() const
+    {
+        if (!m_env)
+            return nonstd::optional<uint64_t>();
+
+        auto& settings = m_env->GetSettings();
+        if (settings.cacheSize == 0 || (settings.autoReload && settings.autoReloadInterval.count() == 0))
+            return nonstd::optional<uint64_t>();
+
+        return m_env->GetTemplatesVersion();
+    }
+
+    // Template which only defines the macros (with the constant default values) doesn't depend on the render context when it's
+    // imported without context. Top level scope of such template is evaluated by the first import and shared by the rest ones
+    bool IsMacroModule() const {return m_isMacroModule;}
+    // Names of the templates referred by the 'extends', 'include' and 'import' statements with the constant names
+    const std::vector<std::string>& GetDependencies() const {return m_dependencies;}
+    // Variables used by the template itself and by the templates it refers to by the constant names
+    TemplateVariablesUsage GetUsedVariables() const
+    {
+        TemplateVariablesUsage result;
+        if (!m_renderer)
+            return result;
+
+        std::unordered_set<std::string> visited = {m_templateName};
+        CollectUsedVariables(result, visited);
+        return result;
+    }
+    size_t GetParsedSize() const
+    {
+        if (!m_renderer)
+            return 0;
+
+        // Source shared with the external owner (e.g. memory-mapped file) isn't counted
+        return m_template.capacity() * sizeof(CharT) + EstimateAstFootprint(m_renderer.get(), m_source.data(), m_source.size(), sizeof(CharT));
+    }
+    RenderProfile GetRenderProfile() const
+    {
+        std::lock_guard<std::mutex> l(m_profileGuard);
+        return m_renderProfile;
+    }
+    void ResetRenderProfile()
+    {
+        std::lock_guard<std::mutex> l(m_profileGuard);
+        m_renderProfile = RenderProfile();
+    }
+    std::shared_ptr<const InternalValueMap> GetModuleScope() const {return std::atomic_load(&m_moduleScope);}
+    void SetModuleScope(std::shared_ptr<const InternalValueMap> scope) const {std::atomic_store(&m_moduleScope, std::move(scope));}
+
+private:
+    struct GlobalsSnapshot
+    {
+        uint64_t version = 0;
+        // Copy of the environment globals. Converted params may refer to these values
+        ValuesMap values;
+        InternalValueMap params;
+    };
+
+    // Included templates may be reloaded unnoticed unless the environment caches them
+    IncrementalRenderState::EnvVersion GetEnvVersion(const GlobalsSnapshot& globals) const
+    {
+        if (!m_env)
+            return std::make_pair(uint64_t(0), uint64_t(0));
+
+        auto templatesVersion = GetTemplatesVersion();
+        if (!templatesVersion)
+            return IncrementalRenderState::EnvVersion();
+
+        return std::make_pair(globals.version, templatesVersion.value());
+    }
+
+    // Converted environment globals are shared by the render calls until the set of globals is changed
+    std::shared_ptr<const GlobalsSnapshot> GetGlobals() const
+    {
+        auto version = m_env ? m_env->GetGlobalsVersion() : 0;
+        auto globals = std::atomic_load(&m_globals);
+        if (globals && globals->version == version)
+            return globals;
+
+        auto snapshot = std::make_shared<GlobalsSnapshot>();
+        if (m_env)
+        {
+            m_env->ApplyGlobals([this, &snapshot](const ValuesMap& values) {
+                snapshot->version = m_env->GetGlobalsVersion();
+                snapshot->values = values;
+            });
+        }
+        for (auto& v : snapshot->values)
+            snapshot->params[v.first] = Value2IntValue(v.second);
+        SetupGlobals(snapshot->params);
+
+        std::shared_ptr<const GlobalsSnapshot> result = std::move(snapshot);
+        std::atomic_store(&m_globals, result);
+        return result;
+    }
+
+    // Expected size of the rendered output: moving average of the previous results or the size of the source before the
+    // first render. Concurrent renders may lose updates of each other, which only makes the estimation a bit less precise
+    size_t GetOutputSizeHint() const
+    {
+        auto hint = m_outputSizeHint.load(std::memory_order_relaxed);
+        return hint ? hint : m_source.size();
+    }
+
+    void UpdateOutputSizeHint(size_t size) const
+    {
+        auto hint = m_outputSizeHint.load(std::memory_order_relaxed);
+        m_outputSizeHint.store(hint ? (hint * 3 + size) / 4 + 1 : size + 1, std::memory_order_relaxed);
+    }
+
+    // Parses the source of 'base' twice: as is (the fallback for the renders after the change of the frozen globals) and with the
+    // references to the frozen globals folded
+    boost::optional<ErrorInfoTpl<CharT>> LoadSpecialized(const ThisType& base)
+    {
+        if (base.m_sourceOwner)
+        {
+            m_sourceOwner = base.m_sourceOwner;
+            m_source = base.m_source;
+        }
+        else
+            SetSource(std::basic_string<CharT>(base.m_source.begin(), base.m_source.end()));
+
+        auto error = Parse(base.m_templateName);
+        if (error)
+            return error;
+        m_genericRenderer = m_renderer;
+
+        // Values are converted under the lock along with the version, so the change of them makes the variant stale rather than
+        // inconsistent. Converted values may refer to the copy of the globals
+        ValuesMap values;
+        m_env->ApplyFrozenGlobals([this, &values](const ValuesMap& globals, const std::unordered_set<std::string>& names) {
+            m_frozenGlobalsVersion = m_env->GetFrozenGlobalsVersion();
+            for (auto& name : names)
+            {
+                auto p = globals.find(name);
+                if (p != globals.end())
+                    values.insert(*p);
+            }
+        });
+        InternalValueMap frozenGlobals;
+        for (auto& v : values)
+            frozenGlobals[v.first] = Value2IntValue(v.second);
+        return Parse(m_templateName, &frozenGlobals);
+    }
+
+    void SetSource(std::basic_string<CharT> tpl)
+    {
+        m_template = std::move(tpl);
+        m_sourceOwner.reset();
+        m_source = nonstd::basic_string_view<CharT>(m_template.data(), m_template.size());
+    }
+
+    static bool IsMacroModule(const RendererPtr& renderer)
+    {
+        auto composed = std::dynamic_pointer_cast<ComposedRenderer>(renderer);
+        if (!composed)
+            return false;
+
+        for (auto& r : composed->GetRenderers())
+        {
+            if (dynamic_cast<RawTextRenderer*>(r.get()))
+                continue;
+
+            auto macro = dynamic_cast<MacroStatement*>(r.get());
+            if (!macro || dynamic_cast<MacroCallStatement*>(r.get()))
+                return false;
+
+            for (auto& p : macro->GetParams())
+            {
+                if (p.defaultValue && !p.defaultValue->IsConstant())
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    void ResetMetadata()
+    {
+        std::atomic_store(&m_parsedMetadata, ParsedMetadataPtr<CharT>());
+    }
+
+    void CollectUsedVariables(TemplateVariablesUsage& result, std::unordered_set<std::string>& visited) const
+    {
+        result.variables.insert(m_variablesUsage.variables.begin(), m_variablesUsage.variables.end());
+        result.attributePaths.insert(m_variablesUsage.attributePaths.begin(), m_variablesUsage.attributePaths.end());
+        for (auto& name : m_dependencies)
         {
-            m_metadataJson = JsonDocumentType();
-            rapidjson::ParseResult res = m_metadataJson.value().Parse(metadataString.data(), metadataString.size());
-            if (!res)
+            if (!visited.insert(name).second)
+                continue;
+
+            if (!m_env)
+            {
+                result.unresolvedTemplates.push_back(name);
+                continue;
+            }
+
+            auto tpl = TemplateLoader<CharT>::Load(name, m_env);
+            if (!tpl)
             {
-                typename ErrorInfoTpl<CharT>::Data errorData;
-                errorData.code = ErrorCode::MetadataParseError;
-                errorData.srcLoc = m_metadataInfo.location;
-                std::string jsonError = rapidjson::GetParseError_En(res.Code());
-                errorData.extraParams.push_back(Value(std::move(jsonError)));
-                return nonstd::make_unexpected(ErrorInfoTpl<CharT>(errorData));
+                result.unresolvedTemplates.push_back(name);
+                continue;
             }
-            m_metadata = std::move(nonstd::get<GenericMap>(Reflect(m_metadataJson.value()).data()));
-            return m_metadata.value();
+            std::static_pointer_cast<ThisType>(tpl.value().m_impl)->CollectUsedVariables(result, visited);
         }
-        return GenericMap();
     }
 
-    nonstd::expected<MetadataInfo<CharT>, ErrorInfoTpl<CharT>> GetMetadataRaw() const { return m_metadataInfo; }
+    // Built-in global functions (see SetupGlobals) are always available, so the callers don't need to provide them
+    static void RemoveBuiltinGlobals(TemplateVariablesUsage& usage)
+    {
+        InternalValueMap builtins;
+        SetupGlobals(builtins);
+        for (auto& item : builtins)
+            usage.variables.erase(item.first);
+    }
 
-private:
-    void ThrowRuntimeError(ErrorCode code, ValuesList extraParams)
+    static void WriteNames(AstWriter& writer, const std::set<std::string>& names)
+    {
+        writer.WriteUInt(names.size());
+        for (auto& name : names)
+            writer.WriteString(name);
+    }
+
+    static std::set<std::string> ReadNames(AstReader& reader)
+    {
+        std::set<std::string> result;
+        for (auto count = reader.ReadUInt(); count != 0; -- count)
+            result.insert(reader.ReadString());
+        return result;
+    }
+
+    // The image is valid only for the same template source and the same parsing-related settings
+    void WriteImageHeader(AstWriter& writer) const
+    {
+        writer.WriteString(CompiledImageMagic);
+        writer.WriteUInt(AstFormatVersion);
+        writer.WriteUInt(sizeof(CharT));
+        writer.WriteUInt(m_source.size());
+        writer.WriteUInt(CalcSourceHash(m_source.data(), m_source.size() * sizeof(CharT)));
+        writer.WriteBool(m_settings.trimBlocks);
+        writer.WriteBool(m_settings.lstripBlocks);
+        writer.WriteBool(m_settings.autoescape);
+        writer.WriteBool(m_settings.useLineStatements);
+        writer.WriteBool(m_settings.extensions.Do);
+        writer.WriteBool(m_settings.extensions.Cache);
+        writer.WriteUInt(static_cast<uint64_t>(m_settings.jinja2CompatMode));
+        writer.WriteString(m_settings.m_defaultMetadataType);
+    }
+
+    void ReadImageHeader(AstReader& reader) const
+    {
+        if (reader.ReadString() != CompiledImageMagic)
+            throw AstFormatError("Not a compiled template image");
+        if (reader.ReadUInt() != AstFormatVersion)
+            throw AstFormatError("Unsupported image format version");
+        if (reader.ReadUInt() != sizeof(CharT))
+            throw AstFormatError("Image was compiled for the different char type");
+        auto sourceLength = reader.ReadUInt();
+        auto sourceHash = reader.ReadUInt();
+        if (sourceLength != m_source.size() || sourceHash != CalcSourceHash(m_source.data(), m_source.size() * sizeof(CharT)))
+            throw AstFormatError("Image doesn't match the template source");
+
+        bool settingsMatch = reader.ReadBool() == m_settings.trimBlocks;
+        settingsMatch = reader.ReadBool() == m_settings.lstripBlocks && settingsMatch;
+        settingsMatch = reader.ReadBool() == m_settings.autoescape && settingsMatch;
+        settingsMatch = reader.ReadBool() == m_settings.useLineStatements && settingsMatch;
+        settingsMatch = reader.ReadBool() == m_settings.extensions.Do && settingsMatch;
+        settingsMatch = reader.ReadBool() == m_settings.extensions.Cache && settingsMatch;
+        settingsMatch = reader.ReadUInt() == static_cast<uint64_t>(m_settings.jinja2CompatMode) && settingsMatch;
+        settingsMatch = reader.ReadString() == m_settings.m_defaultMetadataType && settingsMatch;
+        if (!settingsMatch)
+            throw AstFormatError("Image was compiled with the different settings");
+    }
+
+    ErrorInfoTpl<CharT> MakeCompiledImageError(ErrorCode code, std::string reason) const
+    {
+        typename ErrorInfoTpl<CharT>::Data errorData;
+        errorData.code = code;
+        errorData.srcLoc.col = 1;
+        errorData.srcLoc.line = 1;
+        errorData.srcLoc.fileName = m_templateName;
+        if (code == ErrorCode::InvalidCompiledTemplate)
+            errorData.extraParams.push_back(Value(std::move(reason)));
+
+        return ErrorInfoTpl<CharT>(std::move(errorData));
+    }
+
+    ErrorInfoTpl<CharT> MakeRuntimeError(ErrorCode code, ValuesList extraParams)
     {
         typename ErrorInfoTpl<CharT>::Data errorData;
         errorData.code = code;
@@ -337,7 +1145,7 @@ private:
         errorData.srcLoc.fileName = m_templateName;
         errorData.extraParams = std::move(extraParams);
 
-        throw ErrorInfoTpl<CharT>(std::move(errorData));
+        return ErrorInfoTpl<CharT>(std::move(errorData));
     }
 
     class RendererCallback : public IRendererCallback
@@ -354,47 +1162,213 @@ private:
             return TargetString(std::move(os));
         }
 
+        void AppendAsTargetString(TargetString& str, const InternalValue& val) override
+        {
+            using string_t = std::basic_string<CharT>;
+            if (!nonstd::holds_alternative<string_t>(str))
+                str = GetAsTargetString(InternalValue(std::move(str)));
+            Apply<visitors::ValueRenderer<CharT>>(val, nonstd::get<string_t>(str));
+        }
+
         OutStream GetStreamOnString(TargetString& str) override
         {
             using string_t = std::basic_string<CharT>;
-            str = string_t();
-            return OutStream([writer = StringStreamWriter<CharT>(&nonstd::get<string_t>(str))]() mutable -> OutStream::StreamWriter* { return &writer; });
+            // Pooled capture buffers are cleared in place to keep their capacity
+            auto buffer = nonstd::get_if<string_t>(&str);
+            if (buffer != nullptr)
+                buffer->clear();
+            else
+                str = string_t();
+            return OutStream(std::unique_ptr<OutStream::StreamWriter>(new StringStreamWriter<CharT>(&nonstd::get<string_t>(str))));
         }
 
+        // Loaded templates are remembered by the callback, so the includes and imports repeated within the render (e.g. in the
+        // loops) don't go to the environment. Callback is shared by the parallel render units, hence the lock
         nonstd::variant<EmptyValue,
             nonstd::expected<std::shared_ptr<TemplateImpl<char>>, ErrorInfo>,
             nonstd::expected<std::shared_ptr<TemplateImpl<wchar_t>>, ErrorInfoW>> LoadTemplate(const std::string& fileName) const override
         {
-            return m_host->LoadTemplate(fileName);
+            {
+                std::lock_guard<std::mutex> lock(m_loadedTemplatesGuard);
+                auto p = m_loadedTemplates.find(fileName);
+                if (p != m_loadedTemplates.end())
+                    return p->second;
+            }
+
+            auto result = m_host->LoadTemplate(fileName);
+            std::lock_guard<std::mutex> lock(m_loadedTemplatesGuard);
+            m_loadedTemplates.emplace(fileName, result);
+            return result;
         }
 
         nonstd::variant<EmptyValue,
                 nonstd::expected<std::shared_ptr<TemplateImpl<char>>, ErrorInfo>,
                 nonstd::expected<std::shared_ptr<TemplateImpl<wchar_t>>, ErrorInfoW>> LoadTemplate(const InternalValue& fileName) const override
         {
-            return m_host->LoadTemplate(fileName);
+            auto name = GetAsSameString(std::string(), fileName);
+            if (!name)
+                return m_host->LoadTemplate(fileName);
+
+            return LoadTemplate(name.value());
         }
 
-        void ThrowRuntimeError(ErrorCode code, ValuesList extraParams) override
+        RenderError MakeRuntimeError(ErrorCode code, ValuesList extraParams) override
         {
-            m_host->ThrowRuntimeError(code, std::move(extraParams));
+            return m_host->MakeRuntimeError(code, std::move(extraParams));
+        }
+
+        nonstd::optional<uint64_t> GetTemplatesVersion() const override
+        {
+            return m_host->GetTemplatesVersion();
+        }
+
+        IFragmentCache* GetFragmentCache() const override
+        {
+            return m_host->m_env ? m_host->m_env->GetFragmentCache() : nullptr;
+        }
+
+        template<typename Fn>
+        void VisitLoadedTemplates(Fn&& fn) const
+        {
+            std::lock_guard<std::mutex> lock(m_loadedTemplatesGuard);
+            for (auto& p : m_loadedTemplates)
+            {
+                nonstd::visit([&fn](auto& loaded) { VisitLoadedTemplate(loaded, fn); }, p.second);
+            }
+        }
+
+        // Should be called before each render with the reused callback, so the changed templates are reloaded
+        void ResetLoadedTemplates()
+        {
+            std::lock_guard<std::mutex> lock(m_loadedTemplatesGuard);
+            m_loadedTemplates.clear();
         }
 
     private:
+        template<typename Fn>
+        static void VisitLoadedTemplate(const EmptyValue&, Fn&&) {}
+        template<typename Loaded, typename Fn>
+        static void VisitLoadedTemplate(const Loaded& loaded, Fn&& fn)
+        {
+            if (loaded)
+                fn(loaded.value());
+        }
+
         ThisType* m_host;
+        mutable std::mutex m_loadedTemplatesGuard;
+        mutable std::unordered_map<std::string, TplLoadResultType> m_loadedTemplates;
     };
 
 private:
-    using JsonDocumentType = rapidjson::GenericDocument<typename detail::RapidJsonEncodingType<sizeof(CharT)>::type>;
+    template<typename>
+    friend class RenderSessionImpl;
 
     TemplateEnv* m_env;
     Settings m_settings;
+    // Source is either owned by the template or shared with the external owner (e.g. memory-mapped file)
     std::basic_string<CharT> m_template;
+    std::shared_ptr<const void> m_sourceOwner;
+    nonstd::basic_string_view<CharT> m_source;
     std::string m_templateName;
     RendererPtr m_renderer;
-    mutable nonstd::optional<GenericMap> m_metadata;
-    mutable nonstd::optional<JsonDocumentType> m_metadataJson;
+    // Specialized template (see GetSpecialized) keeps the tree without the frozen globals folded along with their version
+    RendererPtr m_genericRenderer;
+    uint64_t m_frozenGlobalsVersion = 0;
+    mutable std::shared_ptr<ThisType> m_specialized;
+    mutable std::mutex m_specializationGuard;
+    mutable ParsedMetadataPtr<CharT> m_parsedMetadata;
+    mutable std::mutex m_metadataGuard;
+    mutable std::shared_ptr<const GlobalsSnapshot> m_globals;
+    bool m_isMacroModule = false;
+    std::vector<std::string> m_dependencies;
+    TemplateVariablesUsage m_variablesUsage;
+    mutable std::shared_ptr<const InternalValueMap> m_moduleScope;
+    mutable std::atomic<size_t> m_outputSizeHint{0};
     MetadataInfo<CharT> m_metadataInfo;
+    // Statistics of the renders collected if Settings::profileRender is enabled
+    RenderProfile m_renderProfile;
+    mutable std::mutex m_profileGuard;
+};
+
+class IRenderSessionImpl
+{
+public:
+    virtual ~IRenderSessionImpl() = default;
+};
+
+// State of the repeated renders of the same template: parameters (converted on demand and kept between the renders while
+// they aren't changed), renderer callback, scopes pool and the output buffer which keeps its capacity
+template<typename CharT>
+class RenderSessionImpl : public IRenderSessionImpl
+{
+public:
+    using TemplateImplType = TemplateImpl<CharT>;
+
+    RenderSessionImpl(std::shared_ptr<TemplateImplType> tpl, ValuesMap params)
+        : m_template(std::move(tpl))
+        , m_params(std::move(params))
+        , m_extParams(m_params)
+        , m_callback(m_template.get())
+    {
+    }
+
+    void SetParam(const std::string& name, Value value)
+    {
+        m_extParams.Invalidate(name);
+        if (m_incremental)
+            m_incremental->Invalidate(name);
+        m_params[name] = std::move(value);
+    }
+
+    void RemoveParam(const std::string& name)
+    {
+        m_extParams.Invalidate(name);
+        if (m_incremental)
+            m_incremental->Invalidate(name);
+        m_params.erase(name);
+    }
+
+    void SetParams(ValuesMap params)
+    {
+        m_extParams.InvalidateAll();
+        if (m_incremental)
+            m_incremental->InvalidateAll();
+        m_params = std::move(params);
+    }
+
+    void SetIncrementalRender(bool enable)
+    {
+        if (!enable)
+        {
+            m_extParams.SetReadsRecorder(nullptr);
+            m_incremental.reset();
+        }
+        else if (!m_incremental)
+        {
+            m_incremental.reset(new IncrementalRenderState(m_extParams));
+        }
+    }
+
+    const ValuesMap& GetParams() const { return m_params; }
+
+    boost::optional<ErrorInfoTpl<CharT>> Render()
+    {
+        m_buffer.clear();
+        m_callback.ResetLoadedTemplates();
+        GenericStreamWriter<CharT> writer(m_buffer);
+        return m_template->Render(writer, m_extParams, m_callback, m_scopesPool, m_incremental.get());
+    }
+
+    const std::basic_string<CharT>& GetResult() const { return m_buffer; }
+
+private:
+    std::shared_ptr<TemplateImplType> m_template;
+    ValuesMap m_params;
+    ExternalScope m_extParams;
+    typename TemplateImplType::RendererCallback m_callback;
+    ScopesPool m_scopesPool;
+    std::basic_string<CharT> m_buffer;
+    std::unique_ptr<IncrementalRenderState> m_incremental;
 };
 
 } // jinja2
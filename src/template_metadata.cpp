@@ -0,0 +1,20 @@
+#include "template_metadata.h"
+
+#include "template_parser.h"
+
+namespace jinja2
+{
+nonstd::expected<GenericMap, ErrorInfo> ScanMetadata(nonstd::string_view source, const Settings& settings, const std::string& tplName)
+{
+    TemplateParser<char> parser(&source, settings, nullptr, tplName);
+    auto metadataInfo = parser.ScanMetadata();
+    if (!metadataInfo)
+        return nonstd::make_unexpected(metadataInfo.error()[0]);
+
+    auto metadata = ParseMetadata(metadataInfo.value());
+    if (!metadata)
+        return metadata.get_unexpected();
+
+    return MakeMetadataMap(metadata.value());
+}
+} // jinja2
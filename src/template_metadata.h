@@ -0,0 +1,105 @@
+#ifndef TEMPLATE_METADATA_H
+#define TEMPLATE_METADATA_H
+
+#include "jinja2cpp/binding/rapid_json.h"
+#include "jinja2cpp/error_info.h"
+#include "jinja2cpp/template.h"
+#include "jinja2cpp/template_env.h"
+#include "jinja2cpp/value.h"
+
+#include <boost/predef/other/endian.h>
+#include <nonstd/expected.hpp>
+#include <rapidjson/error/en.h>
+
+#include <memory>
+#include <string>
+
+namespace jinja2
+{
+namespace detail
+{
+template<size_t Sz>
+struct RapidJsonEncodingType;
+
+template<>
+struct RapidJsonEncodingType<1>
+{
+    using type = rapidjson::UTF8<char>;
+};
+
+#ifdef BOOST_ENDIAN_BIG_BYTE
+template<>
+struct RapidJsonEncodingType<2>
+{
+    using type = rapidjson::UTF16BE<wchar_t>;
+};
+
+template<>
+struct RapidJsonEncodingType<4>
+{
+    using type = rapidjson::UTF32BE<wchar_t>;
+};
+#else
+template<>
+struct RapidJsonEncodingType<2>
+{
+    using type = rapidjson::UTF16LE<wchar_t>;
+};
+
+template<>
+struct RapidJsonEncodingType<4>
+{
+    using type = rapidjson::UTF32LE<wchar_t>;
+};
+#endif
+}
+
+// Parsed metadata of the template. Immutable once built, so it's shared by the concurrent readers without locking. The reflected
+// values reference the parsed document (see MakeMetadataMap)
+template<typename CharT>
+struct ParsedMetadata
+{
+    rapidjson::GenericDocument<typename detail::RapidJsonEncodingType<sizeof(CharT)>::type> json;
+    GenericMap values;
+};
+
+template<typename CharT>
+using ParsedMetadataPtr = std::shared_ptr<const ParsedMetadata<CharT>>;
+
+// Metadata of the unknown type is represented by the empty map, as well as the absent one
+template<typename CharT>
+nonstd::expected<ParsedMetadataPtr<CharT>, ErrorInfoTpl<CharT>> ParseMetadata(const MetadataInfo<CharT>& info)
+{
+    auto result = std::make_shared<ParsedMetadata<CharT>>();
+    if (info.metadata.empty() || info.metadataType != "json")
+        return ParsedMetadataPtr<CharT>(std::move(result));
+
+    rapidjson::ParseResult res = result->json.Parse(info.metadata.data(), info.metadata.size());
+    if (!res)
+    {
+        typename ErrorInfoTpl<CharT>::Data errorData;
+        errorData.code = ErrorCode::MetadataParseError;
+        errorData.srcLoc = info.location;
+        std::string jsonError = rapidjson::GetParseError_En(res.Code());
+        errorData.extraParams.push_back(Value(std::move(jsonError)));
+        return nonstd::make_unexpected(ErrorInfoTpl<CharT>(errorData));
+    }
+    result->values = std::move(nonstd::get<GenericMap>(Reflect(result->json).data()));
+    return ParsedMetadataPtr<CharT>(std::move(result));
+}
+
+// Returns the map which keeps the parsed metadata alive, so it can outlive the template
+template<typename CharT>
+GenericMap MakeMetadataMap(ParsedMetadataPtr<CharT> metadata)
+{
+    if (!metadata->json.IsObject())
+        return GenericMap();
+
+    return GenericMap([metadata]() { return metadata->values.GetAccessor(); });
+}
+
+// Extracts and parses the metadata of the template source without parsing the template body (see TemplateEnv::LoadMetadata)
+nonstd::expected<GenericMap, ErrorInfo> ScanMetadata(nonstd::string_view source, const Settings& settings, const std::string& tplName);
+} // jinja2
+
+#endif // TEMPLATE_METADATA_H
@@ -82,6 +82,22 @@ StatementsParser::ParseResult StatementsParser::Parse(LexScanner& lexer, Stateme
     case Keyword::EndFilter:
         result = ParseEndFilter(lexer, statementsInfo, tok);
         break;
+    case Keyword::Autoescape:
+        result = ParseAutoescape(lexer, statementsInfo, tok);
+        break;
+    case Keyword::EndAutoescape:
+        result = ParseEndAutoescape(lexer, statementsInfo, tok);
+        break;
+    case Keyword::Cache:
+        if (!m_settings.extensions.Cache)
+            return MakeParseError(ErrorCode::ExtensionDisabled, tok);
+        result = ParseCache(lexer, statementsInfo, tok);
+        break;
+    case Keyword::EndCache:
+        if (!m_settings.extensions.Cache)
+            return MakeParseError(ErrorCode::ExtensionDisabled, tok);
+        result = ParseEndCache(lexer, statementsInfo, tok);
+        break;
     default:
         return MakeParseError(ErrorCode::UnexpectedToken, tok);
     }
@@ -158,7 +174,7 @@ StatementsParser::ParseResult StatementsParser::ParseFor(LexScanner &lexer, Stat
     }
 
     auto pivotToken = lexer.PeekNextToken();
-    ExpressionParser exprPraser(m_settings);
+    ExpressionParser exprPraser(m_settings, m_env, m_slotsResolver);
     auto valueExpr = exprPraser.ParseFullExpression(lexer, false);
     if (!valueExpr)
         return valueExpr.get_unexpected();
@@ -172,9 +188,15 @@ StatementsParser::ParseResult StatementsParser::ParseFor(LexScanner &lexer, Stat
     }
 
     ExpressionEvaluatorPtr<> ifExpr;
+    uint32_t filterLoopVarUsage = ForStatement::LoopVarNone;
     if (lexer.EatIfEqual(Keyword::If))
     {
+        // Loop filter is evaluated within the temporary scope, so loop variables can't be bound to slots here
+        if (m_slotsResolver)
+            m_slotsResolver->EnterOpaqueScope(vars);
         auto parsedExpr = exprPraser.ParseFullExpression(lexer, false);
+        if (m_slotsResolver)
+            filterLoopVarUsage = m_slotsResolver->ExitOpaqueScope();
         if (!parsedExpr)
             return parsedExpr.get_unexpected();
         ifExpr = *parsedExpr;
@@ -186,6 +208,11 @@ StatementsParser::ParseResult StatementsParser::ParseFor(LexScanner &lexer, Stat
     }
 
     auto renderer = std::make_shared<ForStatement>(vars, *valueExpr, ifExpr, isRecursive);
+    if (m_slotsResolver)
+    {
+        m_slotsResolver->EnterLoop(renderer.get(), vars);
+        m_slotsResolver->AddLoopVarUsage(filterLoopVarUsage);
+    }
     StatementInfo statementInfo = StatementInfo::Create(StatementInfo::ForStatement, stmtTok);
     statementInfo.renderer = renderer;
     statementsInfo.push_back(statementInfo);
@@ -219,6 +246,8 @@ StatementsParser::ParseResult StatementsParser::ParseEndFor(LexScanner&, Stateme
     renderer->SetMainBody(info.compositions[0]);
     if (elseRenderer)
         renderer->SetElseBody(elseRenderer);
+    if (m_slotsResolver)
+        renderer->SetLoopVarUsage(m_slotsResolver->ExitLoop());
 
     statementsInfo.back().currentComposition->AddRenderer(info.renderer);
 
@@ -229,7 +258,7 @@ StatementsParser::ParseResult StatementsParser::ParseIf(LexScanner &lexer, State
                                                         const Token &stmtTok)
 {
     auto pivotTok = lexer.PeekNextToken();
-    ExpressionParser exprParser(m_settings);
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     auto valueExpr = exprParser.ParseFullExpression(lexer);
     if (!valueExpr)
         return MakeParseError(ErrorCode::ExpectedExpression, pivotTok);
@@ -244,6 +273,9 @@ StatementsParser::ParseResult StatementsParser::ParseIf(LexScanner &lexer, State
 StatementsParser::ParseResult StatementsParser::ParseElse(LexScanner& /*lexer*/, StatementInfoList& statementsInfo
                                                           , const Token& stmtTok)
 {
+    if (m_slotsResolver && !statementsInfo.empty() && statementsInfo.back().type == StatementInfo::ForStatement)
+        m_slotsResolver->LeaveLoopBody();
+
     auto renderer = std::make_shared<ElseBranchStatement>(ExpressionEvaluatorPtr<>());
     StatementInfo statementInfo = StatementInfo::Create(StatementInfo::ElseIfStatement, stmtTok);
     statementInfo.renderer = renderer;
@@ -255,7 +287,7 @@ StatementsParser::ParseResult StatementsParser::ParseElIf(LexScanner& lexer, Sta
                                                           , const Token& stmtTok)
 {
     auto pivotTok = lexer.PeekNextToken();
-    ExpressionParser exprParser(m_settings);
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     auto valueExpr = exprParser.ParseFullExpression(lexer);
     if (!valueExpr)
         return MakeParseError(ErrorCode::ExpectedExpression, pivotTok);
@@ -321,35 +353,50 @@ StatementsParser::ParseResult StatementsParser::ParseSet(LexScanner& lexer, Stat
     if (vars.empty())
         return MakeParseError(ErrorCode::ExpectedIdentifier, lexer.PeekNextToken());
 
-    ExpressionParser exprParser(m_settings);
+    auto bindVars = [this, &vars]() {
+        if (!m_slotsResolver)
+            return;
+        for (auto& var : vars)
+            m_slotsResolver->AddBinding(var);
+    };
+
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     if (lexer.EatIfEqual('='))
     {
+        // Names are bound after the value, so the references within it (e.g. 'x' in 'set x = x + 1') stay free
         const auto expr = exprParser.ParseFullExpression(lexer);
         if (!expr)
             return expr.get_unexpected();
+        bindVars();
         statementsInfo.back().currentComposition->AddRenderer(
             std::make_shared<SetLineStatement>(std::move(vars), *expr));
     }
     else if (lexer.EatIfEqual('|'))
     {
+         bindVars();
          const auto expr = exprParser.ParseFilterExpression(lexer);
          if (!expr)
             return expr.get_unexpected();
          auto statementInfo = StatementInfo::Create(
             StatementInfo::SetStatement, stmtTok);
-         statementInfo.renderer = std::make_shared<SetFilteredBlockStatement>(
+         auto renderer = std::make_shared<SetFilteredBlockStatement>(
             std::move(vars), *expr);
+         renderer->SetAutoescape(IsAutoescapeEnabled(statementsInfo));
+         statementInfo.renderer = std::move(renderer);
          statementsInfo.push_back(std::move(statementInfo));
     }
     else
     {
+        bindVars();
         auto operTok = lexer.NextToken();
         if (lexer.NextToken() != Token::Eof)
             return MakeParseError(ErrorCode::YetUnsupported, operTok, {std::move(stmtTok)});
         auto statementInfo = StatementInfo::Create(
             StatementInfo::SetStatement, stmtTok);
-        statementInfo.renderer = std::make_shared<SetRawBlockStatement>(
+        auto renderer = std::make_shared<SetRawBlockStatement>(
             std::move(vars));
+        renderer->SetAutoescape(IsAutoescapeEnabled(statementsInfo));
+        statementInfo.renderer = std::move(renderer);
         statementsInfo.push_back(std::move(statementInfo));
     }
 
@@ -388,6 +435,11 @@ StatementsParser::ParseResult StatementsParser::ParseBlock(LexScanner& lexer, St
         return MakeParseError(ErrorCode::ExpectedIdentifier, nextTok);
 
     std::string blockName = AsString(nextTok.value);
+    if (m_slotsResolver)
+    {
+        m_slotsResolver->ExposeLoopVars();
+        m_slotsResolver->ExposeMacroVars();
+    }
 
     auto& info = statementsInfo.back();
     RendererPtr blockRenderer;
@@ -479,6 +531,12 @@ StatementsParser::ParseResult StatementsParser::ParseExtends(LexScanner& lexer,
         return MakeParseErrorTL(ErrorCode::ExpectedToken, tok, tok2, Token::String);
     }
 
+    if (m_slotsResolver)
+    {
+        m_slotsResolver->ExposeLoopVars();
+        m_slotsResolver->ExposeMacroVars();
+    }
+
     auto renderer = std::make_shared<ExtendsStatement>(AsString(tok.value), tok == Token::String);
     statementsInfo.back().currentComposition->AddRenderer(renderer);
 
@@ -501,6 +559,12 @@ StatementsParser::ParseResult StatementsParser::ParseMacro(LexScanner& lexer, St
     std::string macroName = AsString(nextTok.value);
     MacroParams macroParams;
 
+    if (m_slotsResolver)
+    {
+        m_slotsResolver->AddBinding(macroName);
+        m_slotsResolver->EnterOpaqueScope();
+    }
+
     if (lexer.EatIfEqual('('))
     {
         auto result = ParseMacroParams(lexer);
@@ -509,7 +573,7 @@ StatementsParser::ParseResult StatementsParser::ParseMacro(LexScanner& lexer, St
 
         macroParams = std::move(result.value());
     }
-    else if (lexer.PeekNextToken() != Token::Eof)
+    else if (lexer.PeekNextToken() != Token::Eof && lexer.PeekNextToken() != Token::Cached)
     {
         Token tok = lexer.PeekNextToken();
 
@@ -517,6 +581,8 @@ StatementsParser::ParseResult StatementsParser::ParseMacro(LexScanner& lexer, St
     }
 
     auto renderer = std::make_shared<MacroStatement>(std::move(macroName), std::move(macroParams));
+    renderer->SetAutoescape(IsAutoescapeEnabled(statementsInfo));
+    renderer->SetCached(lexer.EatIfEqual(Keyword::Cached));
     StatementInfo statementInfo = StatementInfo::Create(StatementInfo::MacroStatement, stmtTok);
     statementInfo.renderer = renderer;
     statementsInfo.push_back(statementInfo);
@@ -531,7 +597,7 @@ nonstd::expected<MacroParams, ParseError> StatementsParser::ParseMacroParams(Lex
     if (lexer.EatIfEqual(')'))
         return std::move(items);
 
-    ExpressionParser exprParser(m_settings);
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
 
     do
     {
@@ -551,6 +617,8 @@ nonstd::expected<MacroParams, ParseError> StatementsParser::ParseMacroParams(Lex
 
         MacroParam p;
         p.paramName = AsString(name.value);
+        if (m_slotsResolver)
+            m_slotsResolver->AddParam(p.paramName);
         p.defaultValue = std::move(defVal);
         items.push_back(std::move(p));
 
@@ -578,6 +646,11 @@ StatementsParser::ParseResult StatementsParser::ParseEndMacro(LexScanner&, State
     statementsInfo.pop_back();
     auto renderer = static_cast<MacroStatement*>(info.renderer.get());
     renderer->SetMainBody(info.compositions[0]);
+    if (m_slotsResolver)
+    {
+        renderer->SetMacroVarUsage(m_slotsResolver->GetMacroVarUsage());
+        m_slotsResolver->ExitOpaqueScope();
+    }
 
     statementsInfo.back().currentComposition->AddRenderer(info.renderer);
 
@@ -591,6 +664,13 @@ StatementsParser::ParseResult StatementsParser::ParseCall(LexScanner& lexer, Sta
 
     MacroParams callbackParams;
 
+    if (m_slotsResolver)
+    {
+        m_slotsResolver->ExposeLoopVars();
+        m_slotsResolver->AddBinding("caller");
+        m_slotsResolver->EnterOpaqueScope();
+    }
+
     if (lexer.EatIfEqual('('))
     {
         auto result = ParseMacroParams(lexer);
@@ -615,7 +695,7 @@ StatementsParser::ParseResult StatementsParser::ParseCall(LexScanner& lexer, Sta
     CallParamsInfo callParams;
     if (lexer.EatIfEqual('('))
     {
-        ExpressionParser exprParser(m_settings);
+        ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
         auto result = exprParser.ParseCallParams(lexer);
         if (!result)
             return result.get_unexpected();
@@ -624,6 +704,7 @@ StatementsParser::ParseResult StatementsParser::ParseCall(LexScanner& lexer, Sta
     }
 
     auto renderer = std::make_shared<MacroCallStatement>(std::move(macroName), std::move(callParams), std::move(callbackParams));
+    renderer->SetAutoescape(IsAutoescapeEnabled(statementsInfo));
     StatementInfo statementInfo = StatementInfo::Create(StatementInfo::MacroCallStatement, stmtTok);
     statementInfo.renderer = renderer;
     statementsInfo.push_back(statementInfo);
@@ -646,6 +727,11 @@ StatementsParser::ParseResult StatementsParser::ParseEndCall(LexScanner&, Statem
     statementsInfo.pop_back();
     auto renderer = static_cast<MacroCallStatement*>(info.renderer.get());
     renderer->SetMainBody(info.compositions[0]);
+    if (m_slotsResolver)
+    {
+        renderer->SetMacroVarUsage(m_slotsResolver->GetMacroVarUsage());
+        m_slotsResolver->ExitOpaqueScope();
+    }
 
     statementsInfo.back().currentComposition->AddRenderer(info.renderer);
 
@@ -659,7 +745,7 @@ StatementsParser::ParseResult StatementsParser::ParseInclude(LexScanner& lexer,
 
     // auto operTok = lexer.NextToken();
     ExpressionEvaluatorPtr<> valueExpr;
-    ExpressionParser exprParser(m_settings);
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     auto expr = exprParser.ParseFullExpression(lexer);
     if (!expr)
         return expr.get_unexpected();
@@ -707,6 +793,12 @@ StatementsParser::ParseResult StatementsParser::ParseInclude(LexScanner& lexer,
     if (!m_env && !isIgnoreMissing)
         return MakeParseError(ErrorCode::TemplateEnvAbsent, stmtTok);
 
+    if (m_slotsResolver)
+    {
+        m_slotsResolver->ExposeLoopVars();
+        m_slotsResolver->ExposeMacroVars();
+    }
+
     auto renderer = std::make_shared<IncludeStatement>(isIgnoreMissing, isWithContext);
     renderer->SetIncludeNamesExpr(valueExpr);
     statementsInfo.back().currentComposition->AddRenderer(renderer);
@@ -720,7 +812,7 @@ StatementsParser::ParseResult StatementsParser::ParseImport(LexScanner& lexer, S
         return MakeParseError(ErrorCode::TemplateEnvAbsent, stmtTok);
 
     ExpressionEvaluatorPtr<> valueExpr;
-    ExpressionParser exprParser(m_settings);
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     auto expr = exprParser.ParseFullExpression(lexer);
     if (!expr)
         return expr.get_unexpected();
@@ -756,6 +848,13 @@ StatementsParser::ParseResult StatementsParser::ParseImport(LexScanner& lexer, S
         return MakeParseErrorTL(ErrorCode::UnexpectedToken, nextTok, Token::Eof, Token::With, Token::Without);
     }
 
+    if (m_slotsResolver)
+    {
+        m_slotsResolver->ExposeLoopVars();
+        m_slotsResolver->ExposeMacroVars();
+        m_slotsResolver->AddBinding(AsString(name.value));
+    }
+
     auto renderer = std::make_shared<ImportStatement>(isWithContext);
     renderer->SetImportNameExpr(valueExpr);
     renderer->SetNamespace(AsString(name.value));
@@ -770,7 +869,7 @@ StatementsParser::ParseResult StatementsParser::ParseFrom(LexScanner& lexer, Sta
         return MakeParseError(ErrorCode::TemplateEnvAbsent, stmtTok);
 
     ExpressionEvaluatorPtr<> valueExpr;
-    ExpressionParser exprParser(m_settings);
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     auto expr = exprParser.ParseFullExpression(lexer);
     if (!expr)
         return expr.get_unexpected();
@@ -845,11 +944,21 @@ StatementsParser::ParseResult StatementsParser::ParseFrom(LexScanner& lexer, Sta
             MakeParseErrorTL(ErrorCode::UnexpectedToken, nextTok, Token::Eof, Token::Comma, Token::With, Token::Without);
     }
 
+    if (m_slotsResolver)
+    {
+        m_slotsResolver->ExposeLoopVars();
+        m_slotsResolver->ExposeMacroVars();
+    }
+
     auto renderer = std::make_shared<ImportStatement>(isWithContext);
     renderer->SetImportNameExpr(valueExpr);
 
     for (auto& nameInfo : mappedNames)
+    {
+        if (m_slotsResolver)
+            m_slotsResolver->AddBinding(nameInfo.second);
         renderer->AddNameToImport(std::move(nameInfo.first), std::move(nameInfo.second));
+    }
 
     statementsInfo.back().currentComposition->AddRenderer(renderer);
 
@@ -859,7 +968,7 @@ StatementsParser::ParseResult StatementsParser::ParseFrom(LexScanner& lexer, Sta
 StatementsParser::ParseResult StatementsParser::ParseDo(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& /*stmtTok*/)
 {
     ExpressionEvaluatorPtr<> valueExpr;
-    ExpressionParser exprParser(m_settings);
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     auto expr = exprParser.ParseFullExpression(lexer);
     if (!expr)
         return expr.get_unexpected();
@@ -875,7 +984,9 @@ StatementsParser::ParseResult StatementsParser::ParseWith(LexScanner& lexer, Sta
 {
     std::vector<std::pair<std::string, ExpressionEvaluatorPtr<>>> vars;
 
-    ExpressionParser exprParser(m_settings);
+    if (m_slotsResolver)
+        m_slotsResolver->EnterScope();
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     while (lexer.PeekNextToken() == Token::Identifier)
     {
         auto nameTok = lexer.NextToken();
@@ -888,6 +999,8 @@ StatementsParser::ParseResult StatementsParser::ParseWith(LexScanner& lexer, Sta
         auto valueExpr = *expr;
 
         vars.emplace_back(AsString(nameTok.value), valueExpr);
+        if (m_slotsResolver)
+            m_slotsResolver->AddBinding(vars.back().first);
 
         if (!lexer.EatIfEqual(','))
             break;
@@ -924,6 +1037,8 @@ StatementsParser::ParseResult StatementsParser::ParseEndWith(LexScanner& /*lexer
     statementsInfo.pop_back();
     auto renderer = static_cast<WithStatement*>(info.renderer.get());
     renderer->SetMainBody(info.compositions[0]);
+    if (m_slotsResolver)
+        m_slotsResolver->ExitScope();
 
     statementsInfo.back().currentComposition->AddRenderer(info.renderer);
 
@@ -932,7 +1047,7 @@ StatementsParser::ParseResult StatementsParser::ParseEndWith(LexScanner& /*lexer
 
 StatementsParser::ParseResult StatementsParser::ParseFilter(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok)
 {
-    ExpressionParser exprParser(m_settings);
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
     auto filterExpr = exprParser.ParseFilterExpression(lexer);
     if (!filterExpr)
     {
@@ -968,4 +1083,76 @@ StatementsParser::ParseResult StatementsParser::ParseEndFilter(LexScanner&, Stat
     return {};
 }
 
+StatementsParser::ParseResult StatementsParser::ParseAutoescape(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok)
+{
+    auto valueTok = lexer.NextToken();
+    if (valueTok != Token::True && valueTok != Token::False)
+        return MakeParseErrorTL(ErrorCode::ExpectedToken, valueTok, Token::True, Token::False);
+
+    auto statementInfo = StatementInfo::Create(StatementInfo::AutoescapeStatement, stmtTok);
+    statementInfo.autoescape = valueTok == Token::True;
+    statementsInfo.push_back(std::move(statementInfo));
+
+    return ParseResult();
+}
+
+StatementsParser::ParseResult StatementsParser::ParseEndAutoescape(LexScanner&, StatementInfoList& statementsInfo, const Token& stmtTok)
+{
+    if (statementsInfo.size() <= 1)
+        return MakeParseError(ErrorCode::UnexpectedStatement, stmtTok);
+
+    const auto info = statementsInfo.back();
+    if (info.type != StatementInfo::AutoescapeStatement)
+        return MakeParseError(ErrorCode::UnexpectedStatement, stmtTok);
+
+    // Autoescaping is resolved at parse time, so the body is simply inlined into the enclosing statement
+    statementsInfo.pop_back();
+    statementsInfo.back().currentComposition->AddRenderer(info.compositions[0]);
+
+    return ParseResult();
+}
+
+StatementsParser::ParseResult StatementsParser::ParseCache(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok)
+{
+    ExpressionParser exprParser(m_settings, m_env, m_slotsResolver);
+    auto keyExpr = exprParser.ParseFullExpression(lexer);
+    if (!keyExpr)
+        return keyExpr.get_unexpected();
+
+    ExpressionEvaluatorPtr<> ttlExpr;
+    if (lexer.EatIfEqual(','))
+    {
+        auto expr = exprParser.ParseFullExpression(lexer);
+        if (!expr)
+            return expr.get_unexpected();
+        ttlExpr = *expr;
+    }
+
+    auto fragmentId = statementsInfo.front().templateName + ":" + std::to_string(stmtTok.range.startOffset);
+    auto renderer = std::make_shared<CacheStatement>(std::move(fragmentId), *keyExpr, std::move(ttlExpr));
+    auto statementInfo = StatementInfo::Create(StatementInfo::CacheStatement, stmtTok);
+    statementInfo.renderer = std::move(renderer);
+    statementsInfo.push_back(std::move(statementInfo));
+
+    return ParseResult();
+}
+
+StatementsParser::ParseResult StatementsParser::ParseEndCache(LexScanner&, StatementInfoList& statementsInfo, const Token& stmtTok)
+{
+    if (statementsInfo.size() <= 1)
+        return MakeParseError(ErrorCode::UnexpectedStatement, stmtTok);
+
+    const auto info = statementsInfo.back();
+    if (info.type != StatementInfo::CacheStatement)
+        return MakeParseError(ErrorCode::UnexpectedStatement, stmtTok);
+
+    statementsInfo.pop_back();
+    auto& renderer = *boost::polymorphic_downcast<CacheStatement*>(info.renderer.get());
+    renderer.SetBody(info.compositions[0]);
+
+    statementsInfo.back().currentComposition->AddRenderer(info.renderer);
+
+    return ParseResult();
+}
+
 }
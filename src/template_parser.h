@@ -3,23 +3,28 @@
 
 #include "error_handling.h"
 #include "expression_parser.h"
+#include "frozen_globals.h"
 #include "helpers.h"
 #include "lexer.h"
 #include "lexertk.h"
 #include "renderer.h"
+#include "render_profile_binder.h"
+#include "renderer_optimizer.h"
 #include "statements.h"
 #include "template_parser.h"
 #include "value_visitors.h"
 
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <jinja2cpp/error_info.h>
 #include <jinja2cpp/template_env.h>
 #include <nonstd/expected.hpp>
 
+#include <algorithm>
 #include <list>
-#include <regex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace jinja2
@@ -27,12 +32,6 @@ namespace jinja2
 template<typename CharT>
 struct ParserTraits;
 
-struct KeywordsInfo
-{
-    MultiStringLiteral name;
-    Keyword type;
-};
-
 struct TokenStrInfo : MultiStringLiteral
 {
     template<typename CharT>
@@ -46,40 +45,14 @@ template<typename T = void>
 struct ParserTraitsBase
 {
     static Token::Type s_keywords[];
-    static KeywordsInfo s_keywordsInfo[41];
     static std::unordered_map<int, MultiStringLiteral> s_tokens;
-    static MultiStringLiteral s_regexp;
 };
 
-template<typename T>
-MultiStringLiteral ParserTraitsBase<T>::s_regexp = UNIVERSAL_STR(
-  R"((\{\{)|(\}\})|(\{%[\+\-]?\s+raw\s+[\+\-]?%\})|(\{%[\+\-]?\s+endraw\s+[\+\-]?%\})|(\{%\s+meta\s+%\})|(\{%\s+endmeta\s+%\})|(\{%)|(%\})|(\{#)|(#\})|(\n))");
-
 template<>
 struct ParserTraits<char> : public ParserTraitsBase<>
 {
-    static std::regex GetRoughTokenizer()
-    { return std::regex(s_regexp.GetValue<char>()); }
-    static std::regex GetKeywords()
-    {
-        std::string pattern;
-        std::string prefix("(^");
-        std::string postfix("$)");
-
-        bool isFirst = true;
-        for (auto& info : s_keywordsInfo)
-        {
-            if (!isFirst)
-                pattern += "|";
-            else
-                isFirst = false;
-
-            pattern += prefix + info.name.charValue + postfix;
-        }
-        return std::regex(pattern);
-    }
-    static std::string GetAsString(const std::string& str, CharRange range) { return str.substr(range.startOffset, range.size()); }
-    static InternalValue RangeToNum(const std::string& str, CharRange range, Token::Type hint)
+    static std::string GetAsString(nonstd::string_view str, CharRange range) { return std::string(str.data() + range.startOffset, range.size()); }
+    static InternalValue RangeToNum(nonstd::string_view str, CharRange range, Token::Type hint)
     {
         char buff[std::max(std::numeric_limits<int64_t>::max_digits10, std::numeric_limits<double>::max_digits10) * 2 + 1];
         std::copy(str.data() + range.startOffset, str.data() + range.endOffset, buff);
@@ -109,32 +82,12 @@ struct ParserTraits<char> : public ParserTraitsBase<>
 template<>
 struct ParserTraits<wchar_t> : public ParserTraitsBase<>
 {
-    static std::wregex GetRoughTokenizer()
-    { return std::wregex(s_regexp.GetValue<wchar_t>()); }
-    static std::wregex GetKeywords()
+    static std::string GetAsString(nonstd::wstring_view str, CharRange range)
     {
-        std::wstring pattern;
-        std::wstring prefix(L"(^");
-        std::wstring postfix(L"$)");
-
-        bool isFirst = true;
-        for (auto& info : s_keywordsInfo)
-        {
-            if (!isFirst)
-                pattern += L"|";
-            else
-                isFirst = false;
-
-            pattern += prefix + info.name.wcharValue + postfix;
-        }
-        return std::wregex(pattern);
-    }
-    static std::string GetAsString(const std::wstring& str, CharRange range)
-    {
-        auto srcStr = str.substr(range.startOffset, range.size());
+        std::wstring srcStr(str.data() + range.startOffset, range.size());
         return detail::StringConverter<std::wstring, std::string>::DoConvert(srcStr);
     }
-    static InternalValue RangeToNum(const std::wstring& str, CharRange range, Token::Type hint)
+    static InternalValue RangeToNum(nonstd::wstring_view str, CharRange range, Token::Type hint)
     {
         wchar_t buff[std::max(std::numeric_limits<int64_t>::max_digits10, std::numeric_limits<double>::max_digits10) * 2 + 1];
         std::copy(str.data() + range.startOffset, str.data() + range.endOffset, buff);
@@ -175,7 +128,9 @@ struct StatementInfo
         MacroStatement,
         MacroCallStatement,
         WithStatement,
-        FilterStatement
+        FilterStatement,
+        AutoescapeStatement,
+        CacheStatement
     };
 
     using ComposedPtr = std::shared_ptr<ComposedRenderer>;
@@ -184,6 +139,10 @@ struct StatementInfo
     std::vector<ComposedPtr> compositions;
     Token token;
     RendererPtr renderer;
+    // Autoescaping mode set by the template root (from settings) or by the 'autoescape' block
+    bool autoescape = false;
+    // Name of the parsed template. Set for the template root only
+    std::string templateName;
 
     static StatementInfo Create(Type type, const Token& tok, ComposedPtr renderers = std::make_shared<ComposedRenderer>())
     {
@@ -198,14 +157,26 @@ struct StatementInfo
 
 using StatementInfoList = std::list<StatementInfo>;
 
+inline bool IsAutoescapeEnabled(const StatementInfoList& statementsInfo)
+{
+    for (auto p = statementsInfo.rbegin(); p != statementsInfo.rend(); ++ p)
+    {
+        if (p->type == StatementInfo::AutoescapeStatement || p->type == StatementInfo::TemplateRoot)
+            return p->autoescape;
+    }
+
+    return false;
+}
+
 class StatementsParser
 {
 public:
     using ParseResult = nonstd::expected<void, ParseError>;
 
-    StatementsParser(const Settings& settings, TemplateEnv* env)
+    StatementsParser(const Settings& settings, TemplateEnv* env, LocalSlotsResolver* slotsResolver = nullptr)
         : m_settings(settings)
         , m_env(env)
+        , m_slotsResolver(slotsResolver)
     {
     }
 
@@ -236,10 +207,15 @@ private:
     ParseResult ParseEndWith(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok);
     ParseResult ParseFilter(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok);
     ParseResult ParseEndFilter(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok);
+    ParseResult ParseAutoescape(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok);
+    ParseResult ParseEndAutoescape(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok);
+    ParseResult ParseCache(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok);
+    ParseResult ParseEndCache(LexScanner& lexer, StatementInfoList& statementsInfo, const Token& stmtTok);
 
 private:
     Settings m_settings;
     TemplateEnv* m_env;
+    LocalSlotsResolver* m_slotsResolver;
 };
 
 template<typename CharT>
@@ -247,22 +223,23 @@ class TemplateParser : public LexerHelper
 {
 public:
     using string_t = std::basic_string<CharT>;
+    using string_view_t = nonstd::basic_string_view<CharT>;
     using traits_t = ParserTraits<CharT>;
-    using sregex_iterator = std::regex_iterator<typename string_t::const_iterator>;
     using ErrorInfo = ErrorInfoTpl<CharT>;
     using ParseResult = nonstd::expected<RendererPtr, std::vector<ErrorInfo>>;
 
-    TemplateParser(const string_t* tpl, const Settings& setts, TemplateEnv* env, std::string tplName)
+    TemplateParser(const string_view_t* tpl, const Settings& setts, TemplateEnv* env, std::string tplName)
         : m_template(tpl)
         , m_templateName(std::move(tplName))
         , m_settings(setts)
         , m_env(env)
-        , m_roughTokenizer(traits_t::GetRoughTokenizer())
-        , m_keywords(traits_t::GetKeywords())
         , m_metadataType(setts.m_defaultMetadataType)
     {
     }
 
+    // Parsed template is specialized for the values of the frozen globals (see TemplateEnv::FreezeGlobals)
+    void SetFrozenGlobals(const InternalValueMap* values) { m_frozenGlobals = values; }
+
     ParseResult Parse()
     {
         auto roughResult = DoRoughParsing();
@@ -278,9 +255,54 @@ public:
         if (!fineResult)
             return ParseErrorsToErrorInfo(fineResult.error());
 
+        if (m_frozenGlobals)
+        {
+            FrozenGlobals frozen(*m_frozenGlobals, m_slotsResolver.GetBoundNames());
+            FrozenGlobals::Scope frozenScope(&frozen);
+            RendererOptimizer<CharT>().Optimize(composeRenderer);
+        }
+        else
+            RendererOptimizer<CharT>().Optimize(composeRenderer);
+        if (m_settings.profileRender)
+        {
+            RenderProfileBinder::Bind(composeRenderer, [this](const RendererBase* renderer, ProfiledNodeInfo& info) {
+                auto p = m_profiledBlocks.find(renderer);
+                if (p == m_profiledBlocks.end())
+                    return false;
+
+                info = MakeProfiledNodeInfo(p->second);
+                return true;
+            });
+        }
+
         return composeRenderer;
     }
 
+    // Variables referred by the parsed template itself
+    TemplateVariablesUsage GetVariablesUsage() const
+    {
+        TemplateVariablesUsage result;
+        result.variables = m_slotsResolver.GetFreeNames();
+        result.attributePaths = m_slotsResolver.GetAttributePaths();
+        return result;
+    }
+
+    // Extracts the metadata block without parsing the template body. The delimiters scan stops right after the '{% meta %}' block
+    nonstd::expected<MetadataInfo<CharT>, std::vector<ErrorInfo>> ScanMetadata()
+    {
+        auto roughResult = DoRoughParsing(true);
+        if (!roughResult)
+            return ParseErrorsToErrorInfo(roughResult.error());
+
+        for (auto& block : m_textBlocks)
+        {
+            if (block.type == TextBlockType::MetaBlock)
+                ExtractMetadata(block);
+        }
+
+        return GetMetadataInfo();
+    }
+
     MetadataInfo<CharT> GetMetadataInfo() const
     {
         MetadataInfo<CharT> result;
@@ -306,6 +328,13 @@ private:
         RM_NewLine
     };
 
+    struct RoughMatch
+    {
+        unsigned type;
+        size_t position;
+        size_t length;
+    };
+
     struct LineInfo
     {
         CharRange range;
@@ -320,16 +349,14 @@ private:
         TextBlockType type;
     };
 
-    nonstd::expected<void, std::vector<ParseError>> DoRoughParsing()
+    nonstd::expected<void, std::vector<ParseError>> DoRoughParsing(bool stopAfterMeta = false)
     {
         std::vector<ParseError> foundErrors;
 
-        auto matchBegin = sregex_iterator(m_template->begin(), m_template->end(), m_roughTokenizer);
-        auto matchEnd = sregex_iterator();
-
-        auto matches = std::distance(matchBegin, matchEnd);
+        RoughMatch match;
+        size_t scanPos = 0;
         // One line, no customization
-        if (matches == 0)
+        if (!FindNextRoughMatch(scanPos, match))
         {
             CharRange range{ 0ULL, m_template->size() };
             m_lines.push_back(LineInfo{ range, 0 });
@@ -348,13 +375,16 @@ private:
             m_currentBlockInfo.type = TextBlockType::RawText;
         do
         {
-            auto result = ParseRoughMatch(matchBegin, matchEnd);
+            auto result = ParseRoughMatch(match);
             if (!result)
             {
                 foundErrors.push_back(result.error());
                 return nonstd::make_unexpected(std::move(foundErrors));
             }
-        } while (matchBegin != matchEnd);
+            // Blocks following the metadata aren't needed for the metadata scan
+            if (stopAfterMeta && m_hasMetaBlock)
+                return nonstd::expected<void, std::vector<ParseError>>();
+        } while (FindNextRoughMatch(scanPos, match));
         FinishCurrentLine(m_template->size());
 
         if (m_currentBlockInfo.type == TextBlockType::RawBlock)
@@ -378,26 +408,135 @@ private:
             return nonstd::make_unexpected(std::move(foundErrors));
         return nonstd::expected<void, std::vector<ParseError>>();
     }
-    nonstd::expected<void, ParseError> ParseRoughMatch(sregex_iterator& curMatch, const sregex_iterator& /*endMatch*/)
+    static bool IsBlockSpace(CharT ch)
+    {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\v' || ch == '\f';
+    }
+
+    // Matches '{%[+-]? <keyword> [+-]?%}' (or '{% <keyword> %}' if 'allowCtrlChars' is false) starting at 'pos'. Returns the matched length or zero
+    size_t MatchSpecialStatement(size_t pos, const char* keyword, bool allowCtrlChars) const
     {
-        auto match = *curMatch;
-        ++curMatch;
-        unsigned matchType = RM_Unknown;
-        for (unsigned idx = 1; idx != match.size(); ++idx)
+        const auto& tpl = *m_template;
+        const size_t size = tpl.size();
+
+        pos += 2;
+        size_t start = pos - 2;
+        if (allowCtrlChars && pos < size && (tpl[pos] == '+' || tpl[pos] == '-'))
+            ++pos;
+
+        size_t wsStart = pos;
+        while (pos < size && IsBlockSpace(tpl[pos]))
+            ++pos;
+        if (pos == wsStart)
+            return 0;
+
+        for (; *keyword; ++keyword, ++pos)
         {
-            if (match.length(idx) != 0)
+            if (pos == size || tpl[pos] != static_cast<CharT>(*keyword))
+                return 0;
+        }
+
+        wsStart = pos;
+        while (pos < size && IsBlockSpace(tpl[pos]))
+            ++pos;
+        if (pos == wsStart)
+            return 0;
+
+        if (allowCtrlChars && pos < size && (tpl[pos] == '+' || tpl[pos] == '-'))
+            ++pos;
+
+        if (pos + 1 >= size || tpl[pos] != '%' || tpl[pos + 1] != '}')
+            return 0;
+
+        return pos + 2 - start;
+    }
+
+    // Finds the next delimiter ('{{', '}}', '{%', '%}', '{#', '#}', raw/meta block tags or line break) starting from 'pos'.
+    // On success fills 'match' and moves 'pos' right after the matched delimiter
+    bool FindNextRoughMatch(size_t& pos, RoughMatch& match) const
+    {
+        const auto& tpl = *m_template;
+        const size_t size = tpl.size();
+
+        for (; pos < size; ++pos)
+        {
+            const CharT ch = tpl[pos];
+            unsigned type = RM_Unknown;
+            size_t length = 2;
+
+            switch (ch)
             {
-                matchType = idx;
+            case '\n':
+                type = RM_NewLine;
+                length = 1;
+                break;
+            case '{':
+                if (pos + 1 == size)
+                    break;
+                switch (tpl[pos + 1])
+                {
+                case '{':
+                    type = RM_ExprBegin;
+                    break;
+                case '#':
+                    type = RM_CommentBegin;
+                    break;
+                case '%':
+                    if ((length = MatchSpecialStatement(pos, "raw", true)) != 0)
+                        type = RM_RawBegin;
+                    else if ((length = MatchSpecialStatement(pos, "endraw", true)) != 0)
+                        type = RM_RawEnd;
+                    else if ((length = MatchSpecialStatement(pos, "meta", false)) != 0)
+                        type = RM_MetaBegin;
+                    else if ((length = MatchSpecialStatement(pos, "endmeta", false)) != 0)
+                        type = RM_MetaEnd;
+                    else
+                    {
+                        type = RM_StmtBegin;
+                        length = 2;
+                    }
+                    break;
+                default:
+                    break;
+                }
+                break;
+            case '}':
+                if (pos + 1 < size && tpl[pos + 1] == '}')
+                    type = RM_ExprEnd;
+                break;
+            case '%':
+                if (pos + 1 < size && tpl[pos + 1] == '}')
+                    type = RM_StmtEnd;
+                break;
+            case '#':
+                if (pos + 1 < size && tpl[pos + 1] == '}')
+                    type = RM_CommentEnd;
                 break;
+            default:
+                break;
+            }
+
+            if (type != RM_Unknown)
+            {
+                match.type = type;
+                match.position = pos;
+                match.length = length;
+                pos += length;
+                return true;
             }
         }
 
-        size_t matchStart = static_cast<size_t>(match.position());
+        return false;
+    }
+
+    nonstd::expected<void, ParseError> ParseRoughMatch(const RoughMatch& match)
+    {
+        size_t matchStart = match.position;
 
-        switch (matchType)
+        switch (match.type)
         {
             case RM_NewLine:
-                FinishCurrentLine(match.position());
+                FinishCurrentLine(match.position);
                 m_currentLineInfo.range.startOffset = m_currentLineInfo.range.endOffset + 1;
                 if (m_currentLineInfo.range.startOffset < m_template->size() &&
                     (m_currentBlockInfo.type == TextBlockType::RawText || m_currentBlockInfo.type == TextBlockType::LineStatement))
@@ -420,7 +559,7 @@ private:
                     break;
                 if (m_currentBlockInfo.type != TextBlockType::RawText)
                 {
-                    FinishCurrentLine(match.position() + 2);
+                    FinishCurrentLine(match.position + 2);
                     return MakeParseError(ErrorCode::UnexpectedCommentBegin, MakeToken(Token::CommentBegin, { matchStart, matchStart + 2 }));
                 }
 
@@ -434,7 +573,7 @@ private:
                     break;
                 if (m_currentBlockInfo.type != TextBlockType::Comment)
                 {
-                    FinishCurrentLine(match.position() + 2);
+                    FinishCurrentLine(match.position + 2);
                     return MakeParseError(ErrorCode::UnexpectedCommentEnd, MakeToken(Token::CommentEnd, { matchStart, matchStart + 2 }));
                 }
                 
@@ -446,10 +585,10 @@ private:
             case RM_ExprEnd:
                 if (m_currentBlockInfo.type == TextBlockType::RawText)
                 {
-                    FinishCurrentLine(match.position() + 2);
+                    FinishCurrentLine(match.position + 2);
                     return MakeParseError(ErrorCode::UnexpectedExprEnd, MakeToken(Token::ExprEnd, { matchStart, matchStart + 2 }));
                 }
-                else if (m_currentBlockInfo.type != TextBlockType::Expression || (*m_template)[match.position() - 1] == '\'')
+                else if (m_currentBlockInfo.type != TextBlockType::Expression || (*m_template)[match.position - 1] == '\'')
                     break;
 
                 m_currentBlockInfo.range.startOffset = FinishCurrentBlock(matchStart, TextBlockType::RawText);
@@ -460,10 +599,10 @@ private:
             case RM_StmtEnd:
                 if (m_currentBlockInfo.type == TextBlockType::RawText)
                 {
-                    FinishCurrentLine(match.position() + 2);
+                    FinishCurrentLine(match.position + 2);
                     return MakeParseError(ErrorCode::UnexpectedStmtEnd, MakeToken(Token::StmtEnd, { matchStart, matchStart + 2 }));
                 }
-                else if (m_currentBlockInfo.type != TextBlockType::Statement || (*m_template)[match.position() - 1] == '\'')
+                else if (m_currentBlockInfo.type != TextBlockType::Statement || (*m_template)[match.position - 1] == '\'')
                     break;
 
                 m_currentBlockInfo.range.startOffset = FinishCurrentBlock(matchStart, TextBlockType::RawText);
@@ -473,32 +612,32 @@ private:
                     break;
                 else if (m_currentBlockInfo.type != TextBlockType::RawText && m_currentBlockInfo.type != TextBlockType::Comment)
                 {
-                    FinishCurrentLine(match.position() + match.length());
-                    return MakeParseError(ErrorCode::UnexpectedRawBegin, MakeToken(Token::RawBegin, { matchStart, matchStart + match.length() }));
+                    FinishCurrentLine(match.position + match.length);
+                    return MakeParseError(ErrorCode::UnexpectedRawBegin, MakeToken(Token::RawBegin, { matchStart, matchStart + match.length }));
                 }
-                StartControlBlock(TextBlockType::RawBlock, matchStart, matchStart + match.length());
+                StartControlBlock(TextBlockType::RawBlock, matchStart, matchStart + match.length);
                 break;
             case RM_RawEnd:
                 if (m_currentBlockInfo.type == TextBlockType::Comment)
                     break;
                 else if (m_currentBlockInfo.type != TextBlockType::RawBlock)
                 {
-                    FinishCurrentLine(match.position() + match.length());
-                    return MakeParseError(ErrorCode::UnexpectedRawEnd, MakeToken(Token::RawEnd, { matchStart, matchStart + match.length() }));
+                    FinishCurrentLine(match.position + match.length);
+                    return MakeParseError(ErrorCode::UnexpectedRawEnd, MakeToken(Token::RawEnd, { matchStart, matchStart + match.length }));
                 }
-                m_currentBlockInfo.range.startOffset = FinishCurrentBlock(matchStart + match.length() - 2, TextBlockType::RawText, matchStart);
+                m_currentBlockInfo.range.startOffset = FinishCurrentBlock(matchStart + match.length - 2, TextBlockType::RawText, matchStart);
                 break;
             case RM_MetaBegin:
                 if (m_currentBlockInfo.type == TextBlockType::Comment)
                     break;
                 if ((m_currentBlockInfo.type != TextBlockType::RawText && m_currentBlockInfo.type != TextBlockType::Comment) || m_hasMetaBlock)
                 {
-                    FinishCurrentLine(match.position() + match.length());
-                    return MakeParseError(ErrorCode::UnexpectedMetaBegin, MakeToken(Token::MetaBegin, { matchStart, matchStart + match.length() }));
+                    FinishCurrentLine(match.position + match.length);
+                    return MakeParseError(ErrorCode::UnexpectedMetaBegin, MakeToken(Token::MetaBegin, { matchStart, matchStart + match.length }));
                 }
-                StartControlBlock(TextBlockType::MetaBlock, matchStart, matchStart + match.length());
+                StartControlBlock(TextBlockType::MetaBlock, matchStart, matchStart + match.length);
                 m_metadataLocation.line = m_currentLineInfo.lineNumber + 1;
-                m_metadataLocation.col = static_cast<unsigned>(match.position() - m_currentLineInfo.range.startOffset + 1);
+                m_metadataLocation.col = static_cast<unsigned>(match.position - m_currentLineInfo.range.startOffset + 1);
                 m_metadataLocation.fileName = m_templateName;
                 break;
             case RM_MetaEnd:
@@ -506,10 +645,10 @@ private:
                     break;
                 if (m_currentBlockInfo.type != TextBlockType::MetaBlock)
                 {
-                    FinishCurrentLine(match.position() + match.length());
-                    return MakeParseError(ErrorCode::UnexpectedMetaEnd, MakeToken(Token::MetaEnd, { matchStart, matchStart + match.length() }));
+                    FinishCurrentLine(match.position + match.length);
+                    return MakeParseError(ErrorCode::UnexpectedMetaEnd, MakeToken(Token::MetaEnd, { matchStart, matchStart + match.length }));
                 }
-                m_currentBlockInfo.range.startOffset = FinishCurrentBlock(matchStart + match.length() - 2, TextBlockType::MetaBlock, matchStart);
+                m_currentBlockInfo.range.startOffset = FinishCurrentBlock(matchStart + match.length - 2, TextBlockType::MetaBlock, matchStart);
                 m_hasMetaBlock = true;
                 break;
         }
@@ -517,6 +656,16 @@ private:
         return nonstd::expected<void, ParseError>();
     }
 
+    void ExtractMetadata(const TextBlockInfo& block)
+    {
+        auto range = block.range;
+        if (range.size() == 0)
+            return;
+        auto metadata = nonstd::basic_string_view<CharT>(m_template->data() + range.startOffset, range.size());
+        if (!boost::algorithm::all(metadata, boost::algorithm::is_space()))
+            m_metadata = metadata;
+    }
+
     void StartControlBlock(TextBlockType blockType, size_t matchStart, size_t startOffset = 0)
     {
         if (!startOffset)
@@ -618,6 +767,8 @@ private:
         std::vector<ParseError> errors;
         StatementInfoList statementsStack;
         StatementInfo root = StatementInfo::Create(StatementInfo::TemplateRoot, Token(), renderers);
+        root.autoescape = m_settings.autoescape;
+        root.templateName = m_templateName;
         statementsStack.push_back(root);
         for (auto& origBlock : m_textBlocks)
         {
@@ -638,20 +789,17 @@ private:
                     break;
                 }
                 case TextBlockType::MetaBlock:
-                {
-                    auto range = block.range;
-                    if (range.size() == 0)
-                        break;
-                    auto metadata = nonstd::basic_string_view<CharT>(m_template->data() + range.startOffset, range.size());
-                    if (!boost::algorithm::all(metadata, boost::algorithm::is_space()))
-                        m_metadata = metadata;
+                    ExtractMetadata(block);
                     break;
-                }
                 case TextBlockType::Expression:
                 {
                     auto parseResult = InvokeParser<RendererPtr, ExpressionParser>(block);
                     if (parseResult)
+                    {
+                        static_cast<ExpressionRenderer*>(parseResult->get())->SetAutoescape(IsAutoescapeEnabled(statementsStack));
                         statementsStack.back().currentComposition->AddRenderer(*parseResult);
+                        AddProfiledBlock(parseResult->get(), block);
+                    }
                     else
                         errors.push_back(parseResult.error());
                     break;
@@ -661,7 +809,18 @@ private:
                 {
                     auto parseResult = InvokeParser<void, StatementsParser>(block, statementsStack);
                     if (!parseResult)
+                    {
                         errors.push_back(parseResult.error());
+                        break;
+                    }
+
+                    // Statement has either opened the new block or added the renderer to the current one. Closing statements add
+                    // the renderers which are already known
+                    auto& current = statementsStack.back();
+                    AddProfiledBlock(current.renderer.get(), block);
+                    auto& renderers = current.currentComposition->GetRenderers();
+                    if (!renderers.empty())
+                        AddProfiledBlock(renderers.back().get(), block);
                     break;
                 }
                 default:
@@ -674,10 +833,35 @@ private:
 
         return nonstd::expected<void, std::vector<ParseError>>();
     }
+    void AddProfiledBlock(const RendererBase* renderer, const TextBlockInfo& block)
+    {
+        if (m_settings.profileRender && renderer)
+            m_profiledBlocks.emplace(renderer, block);
+    }
+
+    ProfiledNodeInfo MakeProfiledNodeInfo(const TextBlockInfo& block)
+    {
+        auto text = boost::algorithm::trim_copy(GetSourceString(block.range));
+        // Trailing whitespace control char of the block
+        if (!text.empty() && (text.back() == '-' || text.back() == '+'))
+            text = boost::algorithm::trim_copy(text.substr(0, text.size() - 1));
+        std::replace_if(text.begin(), text.end(), [](CharT ch) { return ch == '\n' || ch == '\r' || ch == '\t'; }, ' ');
+
+        auto description = ConvertString<std::string>(text);
+        if (description.size() > MaxProfiledNodeDescriptionSize)
+            description = description.substr(0, MaxProfiledNodeDescriptionSize) + "...";
+
+        ProfiledNodeInfo result;
+        result.description = block.type == TextBlockType::Expression ? "{{ " + description + " }}" : "{% " + description + " %}";
+        result.location.fileName = m_templateName;
+        OffsetToLinePos(block.range.startOffset, result.location.line, result.location.col);
+        return result;
+    }
+
     template<typename R, typename P, typename... Args>
     nonstd::expected<R, ParseError> InvokeParser(const TextBlockInfo& block, Args&&... args)
     {
-        lexertk::generator<CharT> tokenizer;
+        auto& tokenizer = m_tokenizer;
         auto range = block.range;
         auto start = m_template->data();
         if (!tokenizer.process(start + range.startOffset, start + range.endOffset))
@@ -690,12 +874,13 @@ private:
               tok.position += adjust;
               return tok;
           },
-          this);
+          this,
+          m_tokens);
 
         if (!lexer.Preprocess())
             return MakeParseError(ErrorCode::Unspecified, MakeToken(Token::Unknown, { range.startOffset, range.startOffset + 1 }));
 
-        P praser(m_settings, m_env);
+        P praser(m_settings, m_env, &m_slotsResolver);
         LexScanner scanner(lexer);
         auto result = praser.Parse(scanner, std::forward<Args>(args)...);
         if (!result)
@@ -751,7 +936,7 @@ private:
             return p->second.template GetValue<CharT>();
 
         if (tok.range.size() != 0)
-            return m_template->substr(tok.range.startOffset, tok.range.size());
+            return GetSourceString(tok.range);
         else if (tok.type == Token::Identifier)
         {
             if (!tok.value.IsEmpty())
@@ -840,7 +1025,7 @@ private:
 
         auto& lineInfo = m_lines[line];
         std::basic_ostringstream<CharT> os;
-        auto origLine = m_template->substr(lineInfo.range.startOffset, lineInfo.range.size());
+        auto origLine = GetSourceString(lineInfo.range);
         os << origLine << std::endl;
 
         string_t spacePrefix;
@@ -890,7 +1075,7 @@ private:
     {
         if (type == Token::String)
         {
-            auto rawValue = CompileEscapes(m_template->substr(range.startOffset, range.size()));
+            auto rawValue = CompileEscapes(GetSourceString(range));
             return InternalValue(TargetString(std::move(rawValue)));
         }
         if (type == Token::IntegerNum || type == Token::FloatNum)
@@ -899,34 +1084,22 @@ private:
     }
     Keyword GetKeyword(const CharRange& range) override
     {
-        auto matchBegin = sregex_iterator(m_template->begin() + range.startOffset, m_template->begin() + range.endOffset, m_keywords);
-        auto matchEnd = sregex_iterator();
-
-        auto matches = std::distance(matchBegin, matchEnd);
-        // One line, no customization
-        if (matches == 0)
-            return Keyword::Unknown;
-
-        auto& match = *matchBegin;
-        for (size_t idx = 1; idx != match.size(); ++idx)
-        {
-            if (match.length(idx) != 0)
-            {
-                return traits_t::s_keywordsInfo[idx - 1].type;
-            }
-        }
-
-        return Keyword::Unknown;
+        return FindKeyword(string_view_t(m_template->data() + range.startOffset, range.size()));
     }
     char GetCharAt(size_t /*pos*/) override { return '\0'; }
 
 private:
-    const string_t* m_template;
+    string_t GetSourceString(const CharRange& range) const { return string_t(m_template->data() + range.startOffset, range.size()); }
+
+    const string_view_t* m_template;
     std::string m_templateName;
     const Settings& m_settings;
     TemplateEnv* m_env = nullptr;
-    std::basic_regex<CharT> m_roughTokenizer;
-    std::basic_regex<CharT> m_keywords;
+    LocalSlotsResolver m_slotsResolver;
+    const InternalValueMap* m_frozenGlobals = nullptr;
+    // Tokens of the currently parsed block. Reused by all the blocks of the template
+    lexertk::generator<CharT> m_tokenizer;
+    Lexer::TokensList m_tokens;
     std::vector<LineInfo> m_lines;
     std::vector<TextBlockInfo> m_textBlocks;
     LineInfo m_currentLineInfo = {};
@@ -935,51 +1108,10 @@ private:
     nonstd::basic_string_view<CharT> m_metadata;
     std::string m_metadataType;
     SourceLocation m_metadataLocation;
-};
+    // Blocks of the statements and the expressions for the render profiler (see Settings::profileRender)
+    std::unordered_map<const RendererBase*, TextBlockInfo> m_profiledBlocks;
 
-template<typename T>
-KeywordsInfo ParserTraitsBase<T>::s_keywordsInfo[41] = {
-    { UNIVERSAL_STR("for"), Keyword::For },
-    { UNIVERSAL_STR("endfor"), Keyword::Endfor },
-    { UNIVERSAL_STR("in"), Keyword::In },
-    { UNIVERSAL_STR("if"), Keyword::If },
-    { UNIVERSAL_STR("else"), Keyword::Else },
-    { UNIVERSAL_STR("elif"), Keyword::ElIf },
-    { UNIVERSAL_STR("endif"), Keyword::EndIf },
-    { UNIVERSAL_STR("or"), Keyword::LogicalOr },
-    { UNIVERSAL_STR("and"), Keyword::LogicalAnd },
-    { UNIVERSAL_STR("not"), Keyword::LogicalNot },
-    { UNIVERSAL_STR("is"), Keyword::Is },
-    { UNIVERSAL_STR("block"), Keyword::Block },
-    { UNIVERSAL_STR("endblock"), Keyword::EndBlock },
-    { UNIVERSAL_STR("extends"), Keyword::Extends },
-    { UNIVERSAL_STR("macro"), Keyword::Macro },
-    { UNIVERSAL_STR("endmacro"), Keyword::EndMacro },
-    { UNIVERSAL_STR("call"), Keyword::Call },
-    { UNIVERSAL_STR("endcall"), Keyword::EndCall },
-    { UNIVERSAL_STR("filter"), Keyword::Filter },
-    { UNIVERSAL_STR("endfilter"), Keyword::EndFilter },
-    { UNIVERSAL_STR("set"), Keyword::Set },
-    { UNIVERSAL_STR("endset"), Keyword::EndSet },
-    { UNIVERSAL_STR("include"), Keyword::Include },
-    { UNIVERSAL_STR("import"), Keyword::Import },
-    { UNIVERSAL_STR("true"), Keyword::True },
-    { UNIVERSAL_STR("false"), Keyword::False },
-    { UNIVERSAL_STR("True"), Keyword::True },
-    { UNIVERSAL_STR("False"), Keyword::False },
-    { UNIVERSAL_STR("none"), Keyword::None },
-    { UNIVERSAL_STR("None"), Keyword::None },
-    { UNIVERSAL_STR("recursive"), Keyword::Recursive },
-    { UNIVERSAL_STR("scoped"), Keyword::Scoped },
-    { UNIVERSAL_STR("with"), Keyword::With },
-    { UNIVERSAL_STR("endwith"), Keyword::EndWith },
-    { UNIVERSAL_STR("without"), Keyword::Without },
-    { UNIVERSAL_STR("ignore"), Keyword::Ignore },
-    { UNIVERSAL_STR("missing"), Keyword::Missing },
-    { UNIVERSAL_STR("context"), Keyword::Context },
-    { UNIVERSAL_STR("from"), Keyword::From },
-    { UNIVERSAL_STR("as"), Keyword::As },
-    { UNIVERSAL_STR("do"), Keyword::Do },
+    static constexpr size_t MaxProfiledNodeDescriptionSize = 80;
 };
 
 template<typename T>
@@ -1047,6 +1179,11 @@ std::unordered_map<int, MultiStringLiteral> ParserTraitsBase<T>::s_tokens = {
     { Token::From, UNIVERSAL_STR("form") },
     { Token::As, UNIVERSAL_STR("as") },
     { Token::Do, UNIVERSAL_STR("do") },
+    { Token::Autoescape, UNIVERSAL_STR("autoescape") },
+    { Token::EndAutoescape, UNIVERSAL_STR("endautoescape") },
+    { Token::Cache, UNIVERSAL_STR("cache") },
+    { Token::EndCache, UNIVERSAL_STR("endcache") },
+    { Token::Cached, UNIVERSAL_STR("cached") },
     { Token::RawBegin, UNIVERSAL_STR("{% raw %}") },
     { Token::RawEnd, UNIVERSAL_STR("{% endraw %}") },
     { Token::MetaBegin, UNIVERSAL_STR("{% meta %}") },
@@ -59,6 +59,12 @@ TesterPtr CreateTester(std::string testerName, CallParamsInfo params)
     return p->second(std::move(params));
 }
 
+bool IsConstantTester(const std::string& testerName)
+{
+    // User-defined testers are looked up in the render context
+    return s_testers.count(testerName) != 0;
+}
+
 namespace testers
 {
 
@@ -108,8 +114,15 @@ ValueTester::ValueTester(TesterParams params, ValueTester::Mode mode)
     case IsEvenMode:
         break;
     case IsInMode:
+    {
         ParseParams({{"seq", true}}, params);
+        // Args are parsed as the full expressions, so the literal tuples are taken through the wrapper
+        auto literal = m_args["seq"] ? m_args["seq"]->GetLiteralValue() : nullptr;
+        auto list = literal ? GetIf<ListAdapter>(literal) : nullptr;
+        if (list)
+            m_literalsIndex = MembershipIndex::Create(*list);
         break;
+    }
     case IsIterableMode:
         break;
     case IsLowerMode:
@@ -198,6 +211,40 @@ struct ValueKindGetter : visitors::BaseVisitor<ValueKind>
     }
 };
 
+bool ValueTester::TestIsIn(const InternalValue& baseVal, RenderContext& context)
+{
+    bool found = false;
+    if (m_literalsIndex && m_literalsIndex->Find(baseVal, found))
+        return found;
+
+    auto seq = GetArgumentValue("seq", context);
+    // Keys of the map are looked up directly instead of the scan over their list
+    if (auto map = GetIf<MapAdapter>(&seq))
+        return Apply<ValueKindGetter>(baseVal) == ValueKind::String && map->HasValue(AsString(baseVal));
+
+    bool isConverted = false;
+    ListAdapter values = ConvertToList(seq, InternalValue(), isConverted);
+
+    if (!isConverted)
+        return false;
+
+    auto indexes = context.GetMembershipIndexes();
+    auto index = indexes ? indexes->GetIndex(values) : nullptr;
+    if (index && index->Find(baseVal, found))
+        return found;
+
+    auto equalComparator = [&baseVal](auto& val) {
+        InternalValue cmpRes;
+
+        cmpRes = Apply2<visitors::BinaryMathOperation>(val, baseVal, BinaryExpression::LogicalEq);
+
+        return ConvertToBool(cmpRes);
+    };
+
+    auto p = std::find_if(values.begin(), values.end(), equalComparator);
+    return p != values.end();
+}
+
 bool ValueTester::Test(const InternalValue& baseVal, RenderContext& context)
 {
     bool result = false;
@@ -251,27 +298,8 @@ bool ValueTester::Test(const InternalValue& baseVal, RenderContext& context)
         result = valKind == ValueKind::Empty;
         break;
     case IsInMode:
-    {
-        bool isConverted = false;
-        auto seq = GetArgumentValue("seq", context);
-        ListAdapter values = ConvertToList(seq, InternalValue(), isConverted);
-
-        if (!isConverted)
-            return false;
-
-        auto equalComparator = [&baseVal](auto& val) {
-            InternalValue cmpRes;
-
-            cmpRes = Apply2<visitors::BinaryMathOperation>(val, baseVal, BinaryExpression::LogicalEq);
-
-            return ConvertToBool(cmpRes);
-        };
-
-        auto p = std::find_if(values.begin(), values.end(), equalComparator);
-        result = p != values.end();
-
+        result = TestIsIn(baseVal, context);
         break;
-    }
     case IsEvenMode:
     {
         testMode = EvenTest;
@@ -4,6 +4,7 @@
 #include "expression_evaluator.h"
 #include "function_base.h"
 #include "jinja2cpp/value.h"
+#include "membership_index.h"
 #include "render_context.h"
 
 #include <memory>
@@ -15,6 +16,8 @@ using TesterPtr = std::shared_ptr<IsExpression::ITester>;
 using TesterParams = CallParamsInfo;
 
 extern TesterPtr CreateTester(std::string testerName, CallParamsInfo params);
+// Returns true if the tester result depends on the tested value and parameters only
+extern bool IsConstantTester(const std::string& testerName);
 
 namespace testers
 {
@@ -66,8 +69,13 @@ public:
     ValueTester(TesterParams params, Mode mode);
 
     bool Test(const InternalValue& baseVal, RenderContext& context) override;
+private:
+    bool TestIsIn(const InternalValue& baseVal, RenderContext& context);
+
 private:
     Mode m_mode;
+    // Index of the 'in' sequence made of the literals (e.g. `x in ['a', 'b']`). Built at load time
+    std::unique_ptr<MembershipIndex> m_literalsIndex;
 };
 
 class UserDefinedTester : public TesterBase
@@ -143,6 +143,29 @@ struct BaseVisitor
 };
 
 
+// Numbers are appended to the output without the format string parsing. Doubles keep the '{:.8g}' representation, so
+// the integral ones which fit into it (the common case for the results of arithmetics on integers) are written as integers
+template<typename CharT>
+void AppendInteger(std::basic_string<CharT>& os, int64_t val)
+{
+    fmt::format_int str(val);
+    os.append(str.data(), str.data() + str.size());
+}
+
+template<typename CharT>
+void AppendDouble(std::basic_string<CharT>& os, double val)
+{
+    if (std::trunc(val) == val && std::fabs(val) < 1e8 && !(val == 0 && std::signbit(val)))
+    {
+        AppendInteger(os, static_cast<int64_t>(val));
+        return;
+    }
+
+    char buff[32];
+    auto result = fmt::format_to_n(buff, sizeof(buff), "{:.8g}", val);
+    os.append(buff, buff + std::min(result.size, sizeof(buff)));
+}
+
 template<typename CharT>
 struct ValueRendererBase
 {
@@ -153,7 +176,8 @@ struct ValueRendererBase
 
     template<typename T>
     void operator()(const T& val) const;
-    void operator()(double val) const;
+    void operator()(int64_t val) const { AppendInteger(*m_os, val); }
+    void operator()(double val) const { AppendDouble(*m_os, val); }
     void operator()(const nonstd::basic_string_view<CharT>& val) const
     {
         m_os->append(val.begin(), val.end());
@@ -201,18 +225,6 @@ void ValueRendererBase<wchar_t>::operator()(const T& val) const
     fmt::format_to(GetOs(), L"{}", val);
 }
 
-template<>
-inline void ValueRendererBase<char>::operator()(double val) const
-{
-    fmt::format_to(GetOs(), "{:.8g}", val);
-}
-
-template<>
-inline void ValueRendererBase<wchar_t>::operator()(double val) const
-{
-    fmt::format_to(GetOs(), L"{:.8g}", val);
-}
-
 struct InputValueConvertor
 {
     using result_t = boost::optional<InternalValue>;
@@ -300,6 +312,8 @@ struct InputValueConvertor
 
     result_t operator()(UserCallable& val) const { return ConvertUserCallable(std::move(val)); }
 
+    result_t operator()(const LazyValue& val) const { return ConvertLazyValue(val); }
+
     template<typename T>
     result_t operator()(const RecWrapper<T>& val) const
     {
@@ -319,6 +333,8 @@ struct InputValueConvertor
     }
 
     static result_t ConvertUserCallable(const UserCallable& val);
+    // Produced value is temporary, so it's always converted by value
+    static result_t ConvertLazyValue(const LazyValue& val);
 
     bool m_byValue;
     bool m_allowStringRef;
@@ -339,11 +355,11 @@ struct ValueRenderer<char> : ValueRendererBase<char>
     using ValueRendererBase<char>::operator ();
     void operator()(const std::wstring& str) const
     {
-        (*m_os) += ConvertString<std::string>(str);
+        AppendConvertedString(*m_os, nonstd::wstring_view(str));
     }
     void operator()(const nonstd::wstring_view& str) const
     {
-        (*m_os) += ConvertString<std::string>(str);
+        AppendConvertedString(*m_os, str);
     }
     void operator() (bool val) const
     {
@@ -362,11 +378,11 @@ struct ValueRenderer<wchar_t> : ValueRendererBase<wchar_t>
     using ValueRendererBase<wchar_t>::operator ();
     void operator()(const std::string& str) const
     {
-        (*m_os) += ConvertString<std::wstring>(str);
+        AppendConvertedString(*m_os, nonstd::string_view(str));
     }
     void operator()(const nonstd::string_view& str) const
     {
-        (*m_os) += ConvertString<std::wstring>(str);
+        AppendConvertedString(*m_os, str);
     }
     void operator() (bool val) const
     {
@@ -912,6 +928,76 @@ struct BinaryMathOperation : BaseVisitor<>
     BinaryExpression::CompareType m_compType;
 };
 
+// Hash of the value which is consistent with the 'LogicalEq' operation of BinaryMathOperation: values equal with this
+// operation have the same hash. Empty for the values which can't be hashed this way: doubles (they are compared with the
+// tolerance), lists, maps and the strings with non-ASCII chars compared case-insensitively (they are compared with the locale)
+struct ValueHasher : BaseVisitor<nonstd::optional<size_t>>
+{
+    using BaseVisitor::operator ();
+
+    explicit ValueHasher(BinaryExpression::CompareType compType)
+        : m_compType(compType)
+    {
+    }
+
+    nonstd::optional<size_t> operator() (EmptyValue) const
+    {
+        return static_cast<size_t>(0x9e3779b9);
+    }
+
+    nonstd::optional<size_t> operator() (bool val) const
+    {
+        return static_cast<size_t>(val ? 0x7f4a7c15 : 0x85ebca6b);
+    }
+
+    nonstd::optional<size_t> operator() (int64_t val) const
+    {
+        return std::hash<int64_t>()(val);
+    }
+
+    nonstd::optional<size_t> operator() (const std::string& str) const
+    {
+        return HashString(str);
+    }
+
+    nonstd::optional<size_t> operator() (const nonstd::string_view& str) const
+    {
+        return HashString(str);
+    }
+
+    // Wide strings are compared with the narrow ones after the conversion, so they are hashed in the narrow form
+    nonstd::optional<size_t> operator() (const std::wstring& str) const
+    {
+        return HashString(ConvertString<std::string>(str));
+    }
+
+    nonstd::optional<size_t> operator() (const nonstd::wstring_view& str) const
+    {
+        return HashString(ConvertString<std::string>(str));
+    }
+
+    nonstd::optional<size_t> HashString(const nonstd::string_view& str) const
+    {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char ch : str)
+        {
+            if (m_compType == BinaryExpression::CaseInsensitive)
+            {
+                if (ch >= 0x80)
+                    return nonstd::optional<size_t>();
+                if (ch >= 'A' && ch <= 'Z')
+                    ch = static_cast<unsigned char>(ch - 'A' + 'a');
+            }
+            hash = (hash ^ ch) * 1099511628211ULL;
+        }
+
+        return static_cast<size_t>(hash);
+    }
+
+    BinaryExpression::CompareType m_compType;
+};
+
 struct BooleanEvaluator : BaseVisitor<bool>
 {
     using BaseVisitor::operator ();
@@ -950,7 +1036,12 @@ struct BooleanEvaluator : BaseVisitor<bool>
 
     bool operator() (const ListAdapter& val) const
     {
-        return val.GetSize() != 0ULL;
+        auto size = val.GetSize();
+        if (size)
+            return size.value() != 0;
+
+        // Lazy lists are checked for the first item only
+        return val.begin() != val.end();
     }
 
     bool operator() (const EmptyValue&) const
@@ -989,51 +1080,6 @@ struct NumberEvaluator
 using IntegerEvaluator = NumberEvaluator<int64_t>;
 using DoubleEvaluator = NumberEvaluator<double>;
 
-
-struct StringJoiner : BaseVisitor<TargetString>
-{
-    using BaseVisitor::operator ();
-
-    template<typename CharT>
-    TargetString operator() (EmptyValue, const std::basic_string<CharT>& str) const
-    {
-        return str;
-    }
-
-    template<typename CharT>
-    TargetString operator() (EmptyValue, const nonstd::basic_string_view<CharT>& str) const
-    {
-        return std::basic_string<CharT>(str.begin(), str.end());
-    }
-
-    template<typename CharT>
-    TargetString operator() (const std::basic_string<CharT>& left, const std::basic_string<CharT>& right) const
-    {
-        return left + right;
-    }
-
-    template<typename CharT1, typename CharT2>
-    std::enable_if_t<!std::is_same<CharT1, CharT2>::value, TargetString> operator() (const std::basic_string<CharT1>& left, const std::basic_string<CharT2>& right) const
-    {
-        return left + ConvertString<std::basic_string<CharT1>>(right);
-    }
-
-    template<typename CharT>
-    TargetString operator() (std::basic_string<CharT> left, const nonstd::basic_string_view<CharT>& right) const
-    {
-        left.append(right.begin(), right.end());
-        return std::move(left);
-    }
-
-    template<typename CharT1, typename CharT2>
-    std::enable_if_t<!std::is_same<CharT1, CharT2>::value, TargetString> operator() (std::basic_string<CharT1> left, const nonstd::basic_string_view<CharT2>& right) const
-    {
-        auto r = ConvertString<std::basic_string<CharT1>>(right);
-        left.append(r.begin(), r.end());
-        return std::move(left);
-    }
-};
-
 template<typename Fn>
 struct StringConverterImpl : public BaseVisitor<decltype(std::declval<Fn>()(std::declval<nonstd::string_view>()))>
 {
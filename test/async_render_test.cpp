@@ -0,0 +1,200 @@
+#include <chrono>
+#include <future>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "jinja2cpp/async_render.h"
+#include "jinja2cpp/template.h"
+#include "jinja2cpp/user_callable.h"
+
+using namespace jinja2;
+
+namespace
+{
+// Callable which returns the value of the promise created on the first request with the specified key
+UserCallable MakeFetchCallable(std::map<std::string, ValuePromise>& requests, int& startsCount)
+{
+    UserCallable uc;
+    uc.callable = [&requests, &startsCount](const UserCallableParams& params) {
+        auto key = AsString(params["key"]);
+        return AwaitValue(key, [&requests, &startsCount, key]() {
+            ++ startsCount;
+            return requests[key].GetPendingValue();
+        });
+    };
+    uc.argsInfo = {ArgInfo{"key"}};
+    return uc;
+}
+
+UserCallable MakeCounterCallable(int& callsCount)
+{
+    UserCallable uc;
+    uc.callable = [&callsCount](const UserCallableParams&) -> Value { return ++ callsCount; };
+    return uc;
+}
+} // namespace
+
+TEST(AsyncRenderTest, SuspendAndResume)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{{ fetch('a') }} and {{ fetch('b') }}{% set n = attempt() %}").has_value());
+
+    std::map<std::string, ValuePromise> requests;
+    int startsCount = 0;
+    int attemptsCount = 0;
+    AsyncRenderer renderer;
+    auto result = renderer.RenderAsync(tpl, {{"fetch", MakeFetchCallable(requests, startsCount)}, {"attempt", MakeCounterCallable(attemptsCount)}});
+
+    // Both requests are started by the first attempt
+    EXPECT_EQ(1u, renderer.Poll());
+    EXPECT_EQ(2, startsCount);
+    requests["a"].SetValue("first");
+    EXPECT_EQ(1u, renderer.Poll());
+    EXPECT_EQ(1, attemptsCount);
+    requests["b"].SetValue("second");
+    EXPECT_EQ(0u, renderer.Poll());
+    EXPECT_EQ(2, startsCount);
+    EXPECT_EQ(2, attemptsCount);
+
+    auto text = result.get();
+    ASSERT_TRUE(text.has_value()) << text.error().ToString();
+    EXPECT_EQ("first and second", text.value());
+}
+
+TEST(AsyncRenderTest, DependentRequests)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{% set ref = fetch('ref') %}{% if ref %}{{ fetch(ref) }}{% endif %}").has_value());
+
+    std::map<std::string, ValuePromise> requests;
+    int startsCount = 0;
+    AsyncRenderer renderer;
+    auto result = renderer.RenderAsync(tpl, {{"fetch", MakeFetchCallable(requests, startsCount)}});
+
+    EXPECT_EQ(1u, renderer.Poll());
+    requests["ref"].SetValue("item");
+    EXPECT_EQ(1u, renderer.Poll());
+    EXPECT_EQ(2, startsCount);
+    requests["item"].SetValue("value");
+    renderer.Run();
+    EXPECT_EQ(2, startsCount);
+
+    auto text = result.get();
+    ASSERT_TRUE(text.has_value()) << text.error().ToString();
+    EXPECT_EQ("value", text.value());
+}
+
+TEST(AsyncRenderTest, MultiplexedRenders)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{% for k in keys %}{{ fetch(k) }};{% endfor %}").has_value());
+
+    std::map<std::string, ValuePromise> requests;
+    int startsCount = 0;
+    AsyncRenderer renderer;
+    std::vector<std::future<Result<std::string>>> results;
+    for (int n = 0; n < 100; ++ n)
+    {
+        auto key = std::to_string(n);
+        results.push_back(renderer.RenderAsync(tpl, {{"keys", ValuesList{key, key + "_2"}}, {"fetch", MakeFetchCallable(requests, startsCount)}}));
+    }
+
+    EXPECT_EQ(100u, renderer.Poll());
+    EXPECT_EQ(200, startsCount);
+    for (int n = 0; n < 100; ++ n)
+    {
+        auto key = std::to_string(n);
+        requests[key].SetValue(key);
+        requests[key + "_2"].SetValue(n * 2);
+    }
+    renderer.Run();
+    EXPECT_EQ(200, startsCount);
+
+    for (int n = 0; n < 100; ++ n)
+    {
+        auto text = results[n].get();
+        ASSERT_TRUE(text.has_value()) << text.error().ToString();
+        EXPECT_EQ(std::to_string(n) + ";" + std::to_string(n * 2) + ";", text.value());
+    }
+}
+
+TEST(AsyncRenderTest, RunWakesUpOnReadyValue)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{{ fetch('a') }}").has_value());
+
+    std::map<std::string, ValuePromise> requests;
+    int startsCount = 0;
+    AsyncRenderer renderer;
+    auto result = renderer.RenderAsync(tpl, {{"fetch", MakeFetchCallable(requests, startsCount)}});
+
+    EXPECT_EQ(1u, renderer.Poll());
+    auto& promise = requests["a"];
+    std::thread producer([&promise]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        promise.SetValue("ready");
+    });
+    renderer.Run();
+    producer.join();
+
+    auto text = result.get();
+    ASSERT_TRUE(text.has_value()) << text.error().ToString();
+    EXPECT_EQ("ready", text.value());
+}
+
+TEST(AsyncRenderTest, FailedValue)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{{ fetch('a') }}").has_value());
+
+    std::map<std::string, ValuePromise> requests;
+    int startsCount = 0;
+    AsyncRenderer renderer;
+    auto result = renderer.RenderAsync(tpl, {{"fetch", MakeFetchCallable(requests, startsCount)}});
+
+    EXPECT_EQ(1u, renderer.Poll());
+    requests["a"].SetException(std::make_exception_ptr(std::runtime_error("Connection lost")));
+    renderer.Run();
+
+    auto text = result.get();
+    ASSERT_FALSE(text.has_value());
+    EXPECT_EQ(ErrorCode::UnexpectedException, text.error().GetCode());
+}
+
+TEST(AsyncRenderTest, AbandonedPromise)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{{ fetch('a') }}").has_value());
+
+    std::map<std::string, ValuePromise> requests;
+    int startsCount = 0;
+    AsyncRenderer renderer;
+    auto result = renderer.RenderAsync(tpl, {{"fetch", MakeFetchCallable(requests, startsCount)}});
+
+    EXPECT_EQ(1u, renderer.Poll());
+    requests.erase("a");
+    renderer.Run();
+
+    auto text = result.get();
+    ASSERT_FALSE(text.has_value());
+    EXPECT_EQ(ErrorCode::UnexpectedException, text.error().GetCode());
+}
+
+TEST(AsyncRenderTest, SyncRenderWaitsForValue)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{{ fetch('a') }}").has_value());
+
+    std::map<std::string, ValuePromise> requests;
+    requests["a"].SetValue("ready");
+    int startsCount = 0;
+    auto text = tpl.RenderAsString({{"fetch", MakeFetchCallable(requests, startsCount)}});
+    ASSERT_TRUE(text.has_value()) << text.error().ToString();
+    EXPECT_EQ("ready", text.value());
+    EXPECT_EQ(1, startsCount);
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <string>
+
+#include "test_tools.h"
+#include "jinja2cpp/template.h"
+#include "jinja2cpp/template_env.h"
+
+using AutoescapeTest = TemplateEnvFixture;
+
+TEST_F(AutoescapeTest, DisabledByDefault)
+{
+    EXPECT_EQ("<b>&</b>", Render("{{ value }}", {{"value", "<b>&</b>"}}));
+}
+
+TEST_F(AutoescapeTest, EnabledBySettings)
+{
+    m_env.GetSettings().autoescape = true;
+    EXPECT_EQ("&lt;b&gt;&amp;&lt;/b&gt; <i>", Render("{{ value }} <i>", {{"value", "<b>&</b>"}}));
+    EXPECT_EQ("&#34;q&#34; &#39;a&#39;", Render("{{ value }}", {{"value", "\"q\" 'a'"}}));
+    EXPECT_EQ("&lt;1&gt;", Render("{{ '<' ~ 1 ~ '>' }}"));
+    EXPECT_EQ("10", Render("{{ 10 }}"));
+}
+
+TEST_F(AutoescapeTest, AutoescapeBlock)
+{
+    std::string source = R"({{ value }}|{% autoescape true %}{{ value }}{% autoescape false %}|{{ value }}|{% endautoescape %}{{ value }}{% endautoescape %}|{{ value }})";
+    EXPECT_EQ("<a>|&lt;a&gt;|<a>|&lt;a&gt;|<a>", Render(source, {{"value", "<a>"}}));
+}
+
+TEST_F(AutoescapeTest, SafeValuesNotEscaped)
+{
+    m_env.GetSettings().autoescape = true;
+    EXPECT_EQ("<a>", Render("{{ value | safe }}", {{"value", "<a>"}}));
+    EXPECT_EQ("&lt;a&gt;", Render("{{ value | escape }}", {{"value", "<a>"}}));
+    EXPECT_EQ("&lt;a&gt;", Render("{{ value | escape | escape }}", {{"value", "<a>"}}));
+    EXPECT_EQ("&lt;A&gt;", Render("{{ value | safe | upper }}", {{"value", "<a>"}}));
+}
+
+TEST_F(AutoescapeTest, MacroOutputNotDoubleEscaped)
+{
+    m_env.GetSettings().autoescape = true;
+    std::string source = R"({% macro wrap(text) %}<p>{{ text }}</p>{% endmacro %}{{ wrap(value) }}
+{% call wrap('<c>') %}{% endcall %}{% set block %}<i>{{ value }}</i>{% endset %}{{ block }})";
+    EXPECT_EQ("<p>&lt;a&gt;</p>\n<p>&lt;c&gt;</p><i>&lt;a&gt;</i>", Render(source, {{"value", "<a>"}}));
+}
+
+TEST_F(AutoescapeTest, FilterBlockAppliedToEscapedBody)
+{
+    m_env.GetSettings().autoescape = true;
+    EXPECT_EQ("<B>&LT;A&GT;</B>", Render("{% filter upper %}<b>{{ value }}</b>{% endfilter %}", {{"value", "<a>"}}));
+}
+
+TEST_F(AutoescapeTest, WideTemplate)
+{
+    m_env.GetSettings().autoescape = true;
+    jinja2::TemplateW tpl(&m_env);
+    ASSERT_TRUE(!!tpl.Load(L"{{ value }}{{ 'x&y' }}{{ value | safe }}"));
+    EXPECT_EQ(L"&lt;a&gt;x&amp;y<a>", tpl.RenderAsString({{"value", "<a>"}}).value());
+}
+
+TEST_F(AutoescapeTest, InvalidAutoescapeMode)
+{
+    jinja2::Template tpl(&m_env);
+    auto result = tpl.Load("{% autoescape value %}{% endautoescape %}");
+    ASSERT_FALSE(!!result);
+    EXPECT_EQ(jinja2::ErrorCode::ExpectedToken, result.error().GetCode());
+}
+
+TEST_F(AutoescapeTest, CompiledRoundTrip)
+{
+    std::string source = "{% autoescape true %}{{ value }}{{ '<&>' }}{% macro m() %}<b>{% endmacro %}{{ m() }}{% endautoescape %}{{ value }}";
+    jinja2::Template srcTpl(&m_env);
+    ASSERT_TRUE(!!srcTpl.Load(source));
+    std::string image;
+    ASSERT_TRUE(!!srcTpl.SaveCompiled(image));
+
+    jinja2::Template compiledTpl(&m_env);
+    ASSERT_TRUE(!!compiledTpl.LoadCompiled(image, source));
+    EXPECT_EQ("&lt;a&gt;&lt;&amp;&gt;<b><a>", compiledTpl.RenderAsString({{"value", "<a>"}}).value());
+
+    m_env.GetSettings().autoescape = true;
+    jinja2::Template otherTpl(&m_env);
+    EXPECT_FALSE(!!otherTpl.LoadCompiled(image, source));
+}
@@ -1,9 +1,14 @@
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
 
 #include "gtest/gtest.h"
 
 #include "jinja2cpp/template.h"
+#include "jinja2cpp/template_env.h"
 #include "test_tools.h"
 
 using namespace jinja2;
@@ -647,4 +652,376 @@ from Parser!)";
 
 MULTISTR_TEST(BasicMultiStrTest, LiteralWithEscapeCharacters, R"({{ 'Hello\t\nWorld\n\twith\nescape\tcharacters!' }})", "Hello\t\nWorld\n\twith\nescape\tcharacters!")
 {
-}
\ No newline at end of file
+}
+
+TEST(BasicTests, RenderToStream)
+{
+    std::string source = R"({% for i in range(3) %}{{ i }}{{ text }}{% endfor %})";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source).has_value());
+
+    std::ostringstream os;
+    auto renderRes = tpl.Render(os, ValuesMap{ { "text", "-text-" } });
+    EXPECT_TRUE(renderRes.has_value());
+    EXPECT_EQ("0-text-1-text-2-text-", os.str());
+}
+
+TEST(BasicTests, RenderToSink)
+{
+    std::string source = R"({{ header }}
+{% for i in range(3000) %}{{ i }},{% endfor %}
+Footer)";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source).has_value());
+
+    std::string result;
+    size_t chunks = 0;
+    auto renderRes = tpl.Render([&result, &chunks](const char* data, size_t size) {
+        result.append(data, size);
+        ++chunks;
+    }, ValuesMap{ { "header", "Header" } });
+    EXPECT_TRUE(renderRes.has_value());
+
+    std::string expectedResult = "Header\n";
+    for (int i = 0; i < 3000; ++i)
+        expectedResult += std::to_string(i) + ",";
+    expectedResult += "\nFooter";
+    EXPECT_EQ(expectedResult, result);
+    EXPECT_GT(chunks, 1u);
+}
+
+TEST(BasicTests, RenderToSinkChunkSize)
+{
+    std::string source = R"({% for i in range(3000) %}{{ i }},{% endfor %})";
+
+    auto renderChunks = [&source](size_t chunkSize, size_t& maxChunkSize) {
+        TemplateEnv env;
+        env.GetSettings().outputChunkSize = chunkSize;
+        Template tpl(&env);
+        EXPECT_TRUE(tpl.Load(source).has_value());
+
+        size_t chunks = 0;
+        maxChunkSize = 0;
+        EXPECT_TRUE(tpl.Render([&chunks, &maxChunkSize](const char*, size_t size) {
+            maxChunkSize = std::max(maxChunkSize, size);
+            ++chunks;
+        }, ValuesMap{}).has_value());
+        return chunks;
+    };
+
+    size_t maxChunkSize = 0;
+    EXPECT_EQ(1u, renderChunks(65536, maxChunkSize));
+    EXPECT_GT(renderChunks(256, maxChunkSize), 40u);
+    // Chunk is flushed once the value crossing its boundary is written
+    EXPECT_LT(maxChunkSize, 256u + 8u);
+}
+
+TEST(BasicTests, RenderToWideSink)
+{
+    std::wstring source = L"{{ 'Hello' }} {{ name }}!";
+
+    TemplateW tpl;
+    ASSERT_TRUE(tpl.Load(source).has_value());
+
+    std::wstring result;
+    auto renderRes = tpl.Render([&result](const wchar_t* data, size_t size) { result.append(data, size); }, ValuesMap{ { "name", "World" } });
+    EXPECT_TRUE(renderRes.has_value());
+    EXPECT_EQ(L"Hello World!", result);
+}
+
+TEST(BasicTests, RenderToReusedBuffer)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{% for i in range(count) %}{{ name }}{% endfor %}").has_value());
+
+    std::string buffer = "previous content";
+    ASSERT_TRUE(tpl.RenderTo(buffer, {{"count", 100}, {"name", "abc"}}).has_value());
+    EXPECT_EQ(300u, buffer.size());
+    auto capacity = buffer.capacity();
+
+    ASSERT_TRUE(tpl.RenderTo(buffer, {{"count", 2}, {"name", "xyz"}}).has_value());
+    EXPECT_EQ("xyzxyz", buffer);
+    EXPECT_EQ(capacity, buffer.capacity());
+
+    // Output size estimation doesn't affect the result
+    for (int n = 0; n < 3; ++ n)
+        EXPECT_EQ(std::string(60, 'a'), tpl.RenderAsString({{"count", 60}, {"name", "a"}}).value());
+
+    TemplateW wideTpl;
+    ASSERT_TRUE(wideTpl.Load(L"Hello {{ name }}!").has_value());
+    std::wstring wideBuffer = L"previous content";
+    ASSERT_TRUE(wideTpl.RenderTo(wideBuffer, {{"name", "World"}}).has_value());
+    EXPECT_EQ(L"Hello World!", wideBuffer);
+}
+
+TEST(BasicTests, LoadFromSharedSource)
+{
+    auto source = std::make_shared<std::string>("Hello {{ name }}!");
+    std::weak_ptr<std::string> weakSource = source;
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(*source, source, "shared.j2tpl").has_value());
+    source.reset();
+    // Template refers to the source instead of the copy of it
+    EXPECT_FALSE(weakSource.expired());
+    EXPECT_EQ("Hello World!", tpl.RenderAsString({{"name", "World"}}).value());
+
+    ASSERT_TRUE(tpl.Load("Bye!").has_value());
+    EXPECT_TRUE(weakSource.expired());
+    EXPECT_EQ("Bye!", tpl.RenderAsString({}).value());
+}
+
+TEST(BasicTests, RenderSlices)
+{
+    std::string header(100, 'h');
+    std::string footer(80, 'f');
+    auto source = std::make_shared<std::string>(header + "{{ name }}, {% for i in range(3) %}{{ i }}{% endfor %}{% include 'footer.j2tpl' %}");
+    std::string expectedResult = header + "World, 012" + footer;
+
+    Result<RenderedSlices<char>> slices;
+    {
+        auto fs = std::make_shared<MemoryFileSystem>();
+        fs->AddFile("footer.j2tpl", footer);
+        TemplateEnv env;
+        env.AddFilesystemHandler(std::string(), fs);
+
+        Template tpl(&env);
+        ASSERT_TRUE(tpl.Load(*source, source, "slices.j2tpl").has_value());
+        EXPECT_EQ(expectedResult, tpl.RenderAsString({{"name", "World"}}).value());
+
+        slices = tpl.RenderSlices({{"name", "World"}});
+        ASSERT_TRUE(slices.has_value());
+    }
+
+    // Static text is referenced in place, and the slices keep the templates alive once the environment is gone
+    auto& items = slices.value().GetSlices();
+    EXPECT_EQ(3u, items.size());
+    EXPECT_EQ(source->data(), items.front().data);
+    EXPECT_EQ(expectedResult.size(), slices.value().GetSize());
+    EXPECT_EQ(expectedResult, slices.value().ToString());
+
+    TemplateW wideTpl;
+    ASSERT_TRUE(wideTpl.Load(L"Hello {{ name }}!").has_value());
+    auto wideSlices = wideTpl.RenderSlices({{"name", "World"}});
+    ASSERT_TRUE(wideSlices.has_value());
+    // Short static fragments are copied together with the values
+    EXPECT_EQ(1u, wideSlices.value().GetSlices().size());
+    EXPECT_EQ(L"Hello World!", wideSlices.value().ToString());
+}
+
+TEST(BasicTests, EnvGlobalsChangesBetweenRenders)
+{
+    TemplateEnv env;
+    env.AddGlobal("greeting", "Hello");
+    env.AddGlobal("name", "World");
+
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load("{{ greeting }} {{ name }}{{ suffix }}!").has_value());
+
+    EXPECT_EQ("Hello World!", tpl.RenderAsString({}).value());
+    EXPECT_EQ("Hello Params!!!", tpl.RenderAsString({{"name", "Params"}, {"suffix", "!!"}}).value());
+
+    auto version = env.GetGlobalsVersion();
+    env.AddGlobal("greeting", "Bye");
+    env.RemoveGlobal("name");
+    EXPECT_NE(version, env.GetGlobalsVersion());
+    EXPECT_EQ("Bye !", tpl.RenderAsString({}).value());
+    EXPECT_EQ("Bye Params!", tpl.RenderAsString({{"name", "Params"}, {"unused", ValuesList{1, 2, 3}}}).value());
+}
+
+TEST(BasicTests, SpecializedTemplateFrozenGlobals)
+{
+    TemplateEnv env;
+    env.AddGlobal("site", ValuesMap{{"name", "Site"}});
+    env.AddGlobal("feature", true);
+    env.AddGlobal("name", "Global");
+    env.FreezeGlobals({"site", "feature", "name", "item"});
+
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load("{{ site.name | upper }}{% if feature %} on{% else %} off{% endif %}:{% for name in ['a'] %} {{ name }}{% endfor %} {{ item }}"
+                         "{% macro m(item) %}{{ item }}{% endmacro %} {{ m('arg') }}").has_value());
+    auto specialized = tpl.Specialize();
+    ASSERT_TRUE(specialized.has_value());
+
+    // Frozen globals take precedence over the params, the local variables are kept
+    EXPECT_EQ("SITE off: a 1 arg", tpl.RenderAsString({{"feature", false}, {"item", 1}}).value());
+    EXPECT_EQ("SITE on: a 1 arg", specialized->RenderAsString({{"feature", false}, {"item", 1}}).value());
+    EXPECT_LT(specialized->GetParsedSize(), tpl.GetParsedSize());
+
+    // Stale specialization renders the generic template until it's requested again
+    env.AddGlobal("feature", false);
+    EXPECT_EQ("SITE off: a 1 arg", specialized->RenderAsString({{"item", 1}}).value());
+    auto respecialized = tpl.Specialize();
+    ASSERT_TRUE(respecialized.has_value());
+    EXPECT_EQ("SITE off: a 1 arg", respecialized->RenderAsString({{"feature", true}, {"item", 1}}).value());
+
+    // Changes of the other globals don't invalidate the specialization
+    auto version = env.GetFrozenGlobalsVersion();
+    env.AddGlobal("other", 1);
+    EXPECT_EQ(version, env.GetFrozenGlobalsVersion());
+
+    Template noEnvTpl;
+    ASSERT_TRUE(noEnvTpl.Load("{{ feature }}").has_value());
+    EXPECT_EQ("1", noEnvTpl.Specialize()->RenderAsString({{"feature", 1}}).value());
+}
+
+TEST(BasicTests, RenderSessionParamsUpdate)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{{ greeting }}, {{ name }}{% for i in items %} {{ i }}{% endfor %}!").has_value());
+
+    auto session = tpl.CreateRenderSession({{"greeting", "Hello"}, {"name", "World"}});
+    EXPECT_EQ("Hello, World!", session.RenderAsString().value());
+    EXPECT_EQ("Hello, World!", session.RenderAsString().value());
+
+    session.SetParam("name", "Session");
+    session.SetParam("items", ValuesList{"a", "b"});
+    EXPECT_EQ("Hello, Session a b!", session.RenderAsString().value());
+
+    session.RemoveParam("items");
+    session.SetParam("greeting", std::string("Bye"));
+    EXPECT_EQ("Bye, Session!", session.RenderAsString().value());
+    EXPECT_EQ(2u, session.GetParams().size());
+
+    session.SetParams({{"name", "All"}});
+    EXPECT_EQ(", All!", session.RenderAsString().value());
+
+    TemplateW wideTpl;
+    ASSERT_TRUE(wideTpl.Load(L"{{ greeting }}, {{ name }}!").has_value());
+    auto wideSession = wideTpl.CreateRenderSession({{"greeting", "Hello"}});
+    wideSession.SetParam("name", "World");
+    EXPECT_EQ(L"Hello, World!", wideSession.RenderAsString().value());
+}
+
+TEST(BasicTests, RenderSessionIncremental)
+{
+    std::map<std::string, int> renders;
+    auto track = MakeCallable([&renders](const std::string& name) -> Value { ++ renders[name]; return std::string(); }, ArgInfo{"name"});
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{{ track('a') ~ a }}|{% if b %}{{ track('b') ~ b }}{% endif %}|{{ track('c') ~ c }}").has_value());
+    auto session = tpl.CreateRenderSession({{"track", track}, {"a", 1}, {"b", 2}});
+    session.SetIncrementalRender(true);
+    EXPECT_EQ("1|2|", session.RenderAsString().value());
+    EXPECT_EQ(1, renders["a"]);
+
+    // Segments are rendered again once the params they read (including the absent ones) are changed
+    session.SetParam("b", 5);
+    EXPECT_EQ("1|5|", session.RenderAsString().value());
+    session.SetParam("c", 3);
+    EXPECT_EQ("1|5|3", session.RenderAsString().value());
+    EXPECT_EQ("1|5|3", session.RenderAsString().value());
+    EXPECT_EQ(1, renders["a"]);
+    EXPECT_EQ(2, renders["b"]);
+    EXPECT_EQ(2, renders["c"]);
+
+    session.SetParams({{"track", track}, {"a", 10}});
+    EXPECT_EQ("10||", session.RenderAsString().value());
+    EXPECT_EQ(2, renders["a"]);
+
+    // Variables set at the top level may depend on the changed params, so the following segments are rendered again
+    renders.clear();
+    Template stateTpl;
+    ASSERT_TRUE(stateTpl.Load("{% set title = a | upper %}{{ track('title') ~ title }}|{{ track('b') ~ b }}").has_value());
+    auto stateSession = stateTpl.CreateRenderSession({{"track", track}, {"a", "x"}, {"b", "y"}});
+    stateSession.SetIncrementalRender(true);
+    EXPECT_EQ("X|y", stateSession.RenderAsString().value());
+    stateSession.SetParam("b", "z");
+    EXPECT_EQ("X|z", stateSession.RenderAsString().value());
+    EXPECT_EQ(1, renders["title"]);
+    stateSession.SetParam("a", "w");
+    EXPECT_EQ("W|z", stateSession.RenderAsString().value());
+    EXPECT_EQ(2, renders["title"]);
+    EXPECT_EQ(3, renders["b"]);
+}
+
+TEST(BasicTests, LazyParams)
+{
+    int computed = 0;
+    ValuesMap params{{"show", false}, {"items", LazyValue{[&computed] {
+                                                     ++ computed;
+                                                     return Value(ValuesList{1, 2, 3});
+                                                 }}}};
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{% if show %}{{ items | length }}:{% for i in items %}{{ i }}{% endfor %}{% endif %}").has_value());
+    EXPECT_EQ("", tpl.RenderAsString(params).value());
+    EXPECT_EQ(0, computed);
+
+    // Value is computed once per render, however many times it's looked up
+    params["show"] = true;
+    EXPECT_EQ("3:123", tpl.RenderAsString(params).value());
+    EXPECT_EQ(1, computed);
+    EXPECT_EQ("3:123", tpl.RenderAsString(params).value());
+    EXPECT_EQ(2, computed);
+}
+
+TEST(BasicTests, RenderBatch)
+{
+    TemplateEnv env;
+    env.AddGlobal("greeting", "Hello");
+
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load("{{ greeting }}, {{ name }}{% for i in range(count) %}!{% endfor %}{% if fail %}{% include 'missing' %}{% endif %}").has_value());
+
+    std::vector<ValuesMap> paramsList;
+    for (int n = 0; n < 100; ++ n)
+        paramsList.push_back({{"name", "User" + std::to_string(n)}, {"count", n % 3}});
+    paramsList[42]["fail"] = true;
+
+    auto results = tpl.RenderBatch(paramsList, 4);
+    ASSERT_EQ(paramsList.size(), results.size());
+    for (int n = 0; n < 100; ++ n)
+    {
+        if (n == 42)
+            EXPECT_FALSE(results[n].has_value());
+        else
+            EXPECT_EQ("Hello, User" + std::to_string(n) + std::string(n % 3, '!'), results[n].value());
+    }
+
+    std::mutex guard;
+    std::vector<std::string> sinkResults(paramsList.size());
+    tpl.RenderBatch(paramsList, [&guard, &sinkResults](size_t idx, const Result<nonstd::string_view>& result) {
+        std::lock_guard<std::mutex> lock(guard);
+        sinkResults[idx] = result ? std::string(result->data(), result->size()) : std::string("error");
+    });
+    for (size_t n = 0; n < results.size(); ++ n)
+        EXPECT_EQ(results[n] ? results[n].value() : std::string("error"), sinkResults[n]);
+
+    EXPECT_TRUE(tpl.RenderBatch({}).empty());
+
+    TemplateW wideTpl;
+    ASSERT_TRUE(wideTpl.Load(L"Hello {{ name }}!").has_value());
+    auto wideResults = wideTpl.RenderBatch({{{"name", "World"}}, {{"name", "Batch"}}}, 1);
+    ASSERT_EQ(2u, wideResults.size());
+    EXPECT_EQ(L"Hello World!", wideResults[0].value());
+    EXPECT_EQ(L"Hello Batch!", wideResults[1].value());
+}
+
+MULTISTR_TEST(BasicMultiStrTest, DelimitersScanning,
+R"({{ '{' }}{{ '}}' }}{% raw %}{{ x }}{% endraw %}{{ '%}' }}
+{%- raw
+-%} {% if %}{%- endraw %}|{# {{ #}|{ } % # %{ #{ }{)",
+R"({}}{{ x }}%}{% if %}||{ } % # %{ #{ }{)")
+{
+}
+
+TEST(BasicTests, ParsedSize)
+{
+    Template tpl;
+    EXPECT_EQ(0u, tpl.GetParsedSize());
+
+    std::string source = "{{ title }}";
+    ASSERT_TRUE(!!tpl.Load(source));
+    auto smallSize = tpl.GetParsedSize();
+    EXPECT_GT(smallSize, source.size());
+
+    std::string largeSource;
+    for (int n = 0; n != 100; ++ n)
+        largeSource += "{% for i in items %}{{ i | default('a long enough default value') }}{% endfor %}";
+    TemplateW largeTpl;
+    ASSERT_TRUE(!!largeTpl.Load(ConvertString<std::wstring>(largeSource)));
+    EXPECT_GT(largeTpl.GetParsedSize(), 50 * smallSize);
+}
@@ -0,0 +1,130 @@
+#include <iostream>
+#include <string>
+
+#include "test_tools.h"
+#include "jinja2cpp/template.h"
+#include "jinja2cpp/filesystem_handler.h"
+#include "jinja2cpp/template_env.h"
+
+using CompiledTemplateTest = TemplateEnvFixture;
+
+namespace
+{
+const std::string CompiledTestTemplate = R"(
+{#- comment -#}
+{% macro item(name, value='-') -%}
+[{{ name | upper }}={{ value }}]
+{%- endmacro %}
+{% set sep = ', ' %}
+{% for i in range(3) if i != 1 -%}
+{{ loop.index }}:{{ i * 2 + 1 }}{% if not loop.last %}{{ sep }}{% endif %}
+{%- else -%}
+empty
+{%- endfor %}
+{% for k, v in {'a'=1, 'b'=[1, 2]} | dictsort -%}
+{{ item(k, v | string) }}
+{%- endfor %}
+{% with x = 'abc', y = 10 -%}
+{{ x if y is odd else x | reverse }} {{ [y, 2.5, true] | join('|') }}
+{%- endwith %}
+{% set block -%}
+text {{ 'value' | replace('a', 'A') }}
+{%- endset %}{{ block }}
+{% filter upper %}filtered{% endfilter %}
+{% call(arg) item('called') %}{{ arg }}{% endcall %}
+{{ {'key'=[1, 2, 3]}['key'][1] }} {{ -5 + 10 // 3 }} {{ 'a' ~ 'b' in 'xaby' }}
+)";
+
+template<typename CharT>
+std::basic_string<CharT> ToCharT(const std::string& str)
+{
+    return std::basic_string<CharT>(str.begin(), str.end());
+}
+
+template<typename TemplateT, typename CharT>
+void CheckCompiledRoundTrip(const std::string& tplBody)
+{
+    auto source = ToCharT<CharT>(tplBody);
+    TemplateT srcTpl;
+    ASSERT_TRUE(!!srcTpl.Load(source, "test.j2tpl"));
+
+    std::string image;
+    ASSERT_TRUE(!!srcTpl.SaveCompiled(image));
+    EXPECT_FALSE(image.empty());
+
+    TemplateT compiledTpl;
+    auto loadResult = compiledTpl.LoadCompiled(image, source, "test.j2tpl");
+    ASSERT_TRUE(!!loadResult);
+
+    auto expected = srcTpl.RenderAsString({}).value();
+    auto result = compiledTpl.RenderAsString({}).value();
+    EXPECT_EQ(expected, result);
+
+    std::string image2;
+    ASSERT_TRUE(!!compiledTpl.SaveCompiled(image2));
+    EXPECT_EQ(image, image2);
+}
+} // namespace
+
+TEST_F(CompiledTemplateTest, RoundTrip_Narrow)
+{
+    CheckCompiledRoundTrip<jinja2::Template, char>(CompiledTestTemplate);
+}
+
+TEST_F(CompiledTemplateTest, RoundTrip_Wide)
+{
+    CheckCompiledRoundTrip<jinja2::TemplateW, wchar_t>(CompiledTestTemplate);
+}
+
+TEST_F(CompiledTemplateTest, RejectsMismatchedSource)
+{
+    jinja2::Template srcTpl;
+    ASSERT_TRUE(!!srcTpl.Load("Hello {{ name }}!"));
+    std::string image;
+    ASSERT_TRUE(!!srcTpl.SaveCompiled(image));
+
+    jinja2::Template tpl;
+    auto result = tpl.LoadCompiled(image, "Hello {{ user }}!");
+    ASSERT_FALSE(!!result);
+    EXPECT_EQ(jinja2::ErrorCode::InvalidCompiledTemplate, result.error().GetCode());
+
+    jinja2::TemplateW wideTpl;
+    auto wideResult = wideTpl.LoadCompiled(image, L"Hello {{ name }}!");
+    ASSERT_FALSE(!!wideResult);
+    EXPECT_EQ(jinja2::ErrorCode::InvalidCompiledTemplate, wideResult.error().GetCode());
+
+    auto truncated = image.substr(0, image.size() / 2);
+    result = tpl.LoadCompiled(truncated, "Hello {{ name }}!");
+    ASSERT_FALSE(!!result);
+    EXPECT_EQ(jinja2::ErrorCode::InvalidCompiledTemplate, result.error().GetCode());
+
+    result = tpl.LoadCompiled(image, "Hello {{ name }}!");
+    ASSERT_TRUE(!!result);
+    EXPECT_EQ("Hello World!", tpl.RenderAsString({{"name", "World"}}).value());
+}
+
+TEST_F(CompiledTemplateTest, EnvLoadsPrecompiledTemplates)
+{
+    const std::string baseSource = "Base: {% block b1 %}default{% endblock %}";
+    const std::string derivedSource = R"({% extends "base.j2tpl" %}{% block b1 %}{{ super() }}+{{ 6 * 7 }}{% endblock %})";
+
+    std::string baseImage;
+    std::string derivedImage;
+    {
+        jinja2::Template tpl(&m_env);
+        ASSERT_TRUE(!!tpl.Load(baseSource, "base.j2tpl"));
+        ASSERT_TRUE(!!tpl.SaveCompiled(baseImage));
+        ASSERT_TRUE(!!tpl.Load(derivedSource, "derived.j2tpl"));
+        ASSERT_TRUE(!!tpl.SaveCompiled(derivedImage));
+    }
+
+    m_env.GetSettings().usePrecompiledTemplates = true;
+    AddFile("base.j2tpl", baseSource);
+    AddFile("base.j2tpl.j2c", baseImage);
+    AddFile("derived.j2tpl", derivedSource);
+    // Stale image must be ignored and the template must be parsed from the source
+    AddFile("derived.j2tpl.j2c", derivedImage.substr(0, derivedImage.size() - 1));
+
+    auto tpl = m_env.LoadTemplate("derived.j2tpl").value();
+    EXPECT_EQ("Base: default+42", tpl.RenderAsString({}).value());
+}
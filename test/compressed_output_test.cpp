@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include <jinja2cpp/compressed_output.h>
+#include <jinja2cpp/template.h>
+#include <jinja2cpp/template_env.h>
+
+#ifdef JINJA2CPP_WITH_ZLIB
+
+#include <zlib.h>
+
+#include <string>
+
+using namespace jinja2;
+
+namespace
+{
+std::string Gunzip(const std::string& compressed)
+{
+    z_stream stream{};
+    inflateInit2(&stream, 15 + 16);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    stream.avail_in = static_cast<uInt>(compressed.size());
+
+    std::string result;
+    char buffer[4096];
+    int status = Z_OK;
+    while (status == Z_OK)
+    {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        status = inflate(&stream, Z_NO_FLUSH);
+        result.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    EXPECT_EQ(Z_STREAM_END, status);
+    return result;
+}
+} // namespace
+
+TEST(CompressedOutputTest, GzipRender)
+{
+    TemplateEnv env;
+    env.GetSettings().outputChunkSize = 16384;
+    Template tpl(&env);
+    ASSERT_TRUE(!!tpl.Load("{% for i in range(count) %}<li>{{ i }}: {{ text }}</li>\n{% endfor %}"));
+
+    ValuesMap params{{"count", 20000}, {"text", "Hello World!"}};
+    std::string compressed;
+    size_t compressedChunks = 0;
+    GzipOutputSink gzip([&compressed, &compressedChunks](const char* data, size_t size) {
+        compressed.append(data, size);
+        ++ compressedChunks;
+    });
+    ASSERT_TRUE(!!tpl.Render(gzip.GetSink(), params));
+    gzip.Finish();
+    // Data written after the end of the stream is ignored
+    gzip.Write("tail", 4);
+
+    auto expected = tpl.RenderAsString(params).value();
+    EXPECT_GT(compressedChunks, 1u);
+    EXPECT_LT(compressed.size(), expected.size() / 4);
+    EXPECT_EQ(expected, Gunzip(compressed));
+}
+
+TEST(CompressedOutputTest, GzipEmptyOutput)
+{
+    Template tpl;
+    ASSERT_TRUE(!!tpl.Load("{% if false %}text{% endif %}"));
+
+    std::string compressed;
+    GzipOutputSink gzip([&compressed](const char* data, size_t size) { compressed.append(data, size); });
+    ASSERT_TRUE(!!tpl.Render(gzip.GetSink(), {}));
+    gzip.Finish();
+
+    EXPECT_FALSE(compressed.empty());
+    EXPECT_EQ("", Gunzip(compressed));
+}
+
+#endif // JINJA2CPP_WITH_ZLIB
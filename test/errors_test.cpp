@@ -183,6 +183,39 @@ TEST_F(TemplateEnvFixture, ErrorPropagationTest_Wide)
     EXPECT_EQ(L"module:1:8: error: Identifier expected\n{% for %}\n    ---^-------", ErrorToString(renderResult.error()));
 }
 
+TEST_F(TemplateEnvFixture, RenderLimitsTest)
+{
+    auto render = [this](const Settings::RenderLimits& limits, std::string tplBody) {
+        m_env.GetSettings().renderLimits = limits;
+        Template tpl(&m_env);
+        auto parseResult = tpl.Load(std::move(tplBody));
+        EXPECT_TRUE(parseResult.has_value());
+        auto renderResult = tpl.RenderAsString({});
+        return renderResult ? renderResult.value() : ErrorToString(renderResult.error());
+    };
+
+    Settings::RenderLimits limits;
+    limits.maxSteps = 100;
+    EXPECT_EQ("", render(limits, "{% for i in range(50) %}{% endfor %}"));
+    EXPECT_EQ("noname.j2tpl:1:1: error: Render limit exceeded: maxSteps\n", render(limits, "{% for i in range(1000) %}{% endfor %}"));
+
+    limits = Settings::RenderLimits();
+    limits.maxOutputSize = 10;
+    EXPECT_EQ("0123456789", render(limits, "{% for i in range(10) %}{{ i }}{% endfor %}"));
+    EXPECT_EQ("noname.j2tpl:1:1: error: Render limit exceeded: maxOutputSize\n", render(limits, "{% for i in range(11) %}{{ i }}{% endfor %}"));
+
+    limits = Settings::RenderLimits();
+    limits.maxRecursionDepth = 5;
+    EXPECT_EQ("noname.j2tpl:1:1: error: Render limit exceeded: maxRecursionDepth\n",
+              render(limits, "{% macro m(n) %}{{ m(n + 1) }}{% endmacro %}{{ m(0) }}"));
+    AddFile("self", "{% include 'self' %}");
+    EXPECT_EQ("noname.j2tpl:1:1: error: Render limit exceeded: maxRecursionDepth\n", render(limits, "{% include 'self' %}"));
+
+    limits = Settings::RenderLimits();
+    limits.timeout = std::chrono::milliseconds(1);
+    EXPECT_EQ("noname.j2tpl:1:1: error: Render limit exceeded: timeout\n", render(limits, "{% for i in range(1000000000) %}{% endfor %}"));
+}
+
 TEST_P(ErrorsGenericTest, Test)
 {
     auto& testParam = GetParam();
@@ -137,6 +137,157 @@ Inner Value
     EXPECT_STREQ(expectedResult.c_str(), result.c_str());
 }
 
+TEST(ExpressionTest, ReflectedStringFields)
+{
+    std::string source = R"(
+{{ data.strValue }}|{{ data.strValue | upper }}|{{ data.wstrValue }}|{{ data.strValue == 'Referenced Value' }}
+{% set s = owned.strValue %}{{ s }}|{{ owned.strValue ~ '!' }}|{{ owned.wstrValue | upper }}
+)";
+
+    TestStruct referenced;
+    referenced.strValue = "Referenced Value";
+    referenced.wstrValue = L"Referenced Wide Value";
+    TestStruct owned;
+    owned.strValue = "Owned Value";
+    owned.wstrValue = L"Owned Wide Value";
+
+    ValuesMap params = {
+        {"data", Reflect(&referenced)},
+        {"owned", Reflect(std::move(owned))},
+    };
+
+    Template tpl;
+
+    ASSERT_TRUE(tpl.Load(source));
+    std::string result = tpl.RenderAsString(params).value();
+    std::cout << result << std::endl;
+    std::string expectedResult = R"(
+Referenced Value|REFERENCED VALUE|Referenced Wide Value|true
+Owned Value|Owned Value!|OWNED WIDE VALUE
+)";
+
+    EXPECT_STREQ(expectedResult.c_str(), result.c_str());
+}
+
+struct TestFieldsStruct
+{
+    int64_t intValue = 0;
+    std::string strValue;
+    TestInnerStruct innerValue;
+    std::vector<int> listValue;
+};
+
+namespace jinja2
+{
+template<>
+struct TypeReflection<TestFieldsStruct> : TypeReflectedFields<TestFieldsStruct>
+{
+    static auto& GetFields()
+    {
+        static const auto fields = MakeReflectedFields<TestFieldsStruct>(
+            ReflectField("intValue", &TestFieldsStruct::intValue),
+            ReflectField("strValue", &TestFieldsStruct::strValue),
+            ReflectField("innerValue", &TestFieldsStruct::innerValue),
+            ReflectField("listValue", &TestFieldsStruct::listValue),
+            ReflectField("intEvenValue", [](const TestFieldsStruct& obj) -> Value {
+                if (obj.intValue % 2)
+                    return {};
+                return {obj.intValue};
+            }));
+
+        return fields;
+    }
+};
+} // namespace jinja2
+
+TEST(ExpressionTest, ReflectedFieldsTable)
+{
+    std::string source = R"(
+{{ data.intValue }}|{{ data.strValue | upper }}|{{ data.innerValue.strValue }}|{{ data.listValue | pprint }}|{{ data.intEvenValue }}
+{{ data.unknownField is defined }}|{{ data | list | sort | pprint }}
+{% set s = owned.strValue %}{{ s }}|{{ owned.intEvenValue is defined }}|{{ owned.innerValue.strValue }}
+)";
+
+    TestFieldsStruct referenced;
+    referenced.intValue = 10;
+    referenced.strValue = "Referenced Value";
+    referenced.innerValue.strValue = "Inner Value";
+    referenced.listValue = {1, 2, 3};
+    TestFieldsStruct owned;
+    owned.intValue = 5;
+    owned.strValue = "Owned Value";
+
+    ValuesMap params = {
+        {"data", Reflect(&referenced)},
+        {"owned", Reflect(std::move(owned))},
+    };
+
+    Template tpl;
+
+    ASSERT_TRUE(tpl.Load(source));
+    std::string result = tpl.RenderAsString(params).value();
+    std::cout << result << std::endl;
+    std::string expectedResult = R"(
+10|REFERENCED VALUE|Inner Value|[1, 2, 3]|10
+false|['innerValue', 'intEvenValue', 'intValue', 'listValue', 'strValue']
+Owned Value|false|Hello World!
+)";
+
+    EXPECT_STREQ(expectedResult.c_str(), result.c_str());
+}
+
+TEST(ExpressionTest, ReflectedFieldsInlineCache)
+{
+    std::string source = R"({% for item in items %}{{ item.intValue }}:{{ item.strValue }}:{{ item.intEvenValue is defined }};{% endfor %})";
+
+    std::vector<TestFieldsStruct> objects(3);
+    for (size_t n = 0; n < objects.size(); ++ n)
+    {
+        objects[n].intValue = static_cast<int64_t>(n);
+        objects[n].strValue = "Object " + std::to_string(n);
+    }
+
+    ValuesList items;
+    items.push_back(Reflect(&objects[0]));
+    // Maps of the other layout are met by the same access site between the reflected objects
+    items.push_back(ValuesMap{{"intValue", 100}, {"strValue", "Map"}});
+    items.push_back(Reflect(&objects[1]));
+    items.push_back(Reflect(std::move(objects[2])));
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    std::string expectedResult = "0:Object 0:true;100:Map:false;1:Object 1:false;2:Object 2:true;";
+    for (int n = 0; n < 2; ++ n)
+    {
+        std::string result = tpl.RenderAsString({{"items", items}}).value();
+        std::cout << result << std::endl;
+        EXPECT_STREQ(expectedResult.c_str(), result.c_str());
+    }
+}
+
+TEST(ExpressionTest, SharedLiteralCollections)
+{
+    std::string source = R"({% macro show(opts, items) %}{{ opts.name }}={{ opts.nested.value }}/{{ items | join(',') }}/{{ items[1] }}{% endmacro %}
+{% for i in range(3) %}{{ show({'name'='item', 'nested'={'value'=10} }, [1, 'two', 3]) }}|{{ 'prefix' ~ i }}|{{ i in [0, 2] }}|{{ {'a'=i}.a }}
+{% endfor %})";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    std::string expectedResult = R"(
+item=10/1,two,3/two|prefix0|true|0
+item=10/1,two,3/two|prefix1|false|1
+item=10/1,two,3/two|prefix2|true|2
+)";
+    for (int n = 0; n < 2; ++ n)
+    {
+        std::string result = tpl.RenderAsString({}).value();
+        std::cout << result << std::endl;
+        EXPECT_STREQ(expectedResult.c_str(), result.c_str());
+    }
+}
+
 TEST(ExpressionsTest, PipeOperatorPrecedenceTest)
 {
     const std::string source = R"(>> {{ 2 < '6' | int }} <<
@@ -201,6 +352,11 @@ INSTANTIATE_TEST_CASE_P(LogicalExpressionTest, ExpressionSubstitutionTest, ::tes
                             InputOutputPair{"1 < 1",            "false"},
                             InputOutputPair{"1 <= 2",             "true"},
                             InputOutputPair{"1 <= 1",            "true"},
+                            InputOutputPair{"1 < 1.5",           "true"},
+                            InputOutputPair{"2.5 >= 2",          "true"},
+                            InputOutputPair{"'abc' < 'abd'",     "true"},
+                            InputOutputPair{"'abc' == 'abc'",    "true"},
+                            InputOutputPair{"'abc' != stringValue", "true"},
                             InputOutputPair{"1 == 2 or 2 == 2",  "true"},
                             InputOutputPair{"2 == 2 or 1 == 2",  "true"},
                             InputOutputPair{"1 == 2 or 3 == 2",  "false"},
@@ -272,6 +428,9 @@ INSTANTIATE_TEST_CASE_P(ComplexSubscriptionTest, ExpressionSubstitutionTest, ::t
                             InputOutputPair{"mapValue.reflectedList[1].intValue",    "1"},
                             InputOutputPair{"{'fieldName'='field', 'fieldValue'=10}.fieldName",    "field"},
                             InputOutputPair{"{'fieldName'='field', 'fieldValue'=10}['fieldValue']",    "10"},
+                            InputOutputPair{"{'outer'={'inner'='field'}}.outer.inner",    "field"},
+                            InputOutputPair{"{'outer'={'inner'='field'}}.outer.Inner",    ""},
+                            InputOutputPair{"(mapValue | dictsort | first).key",    "boolValue"},
                             InputOutputPair{R"( ([
                                                     {'fieldName'='field1', 'fieldValue'=10},
                                                     {'fieldName'='field2', 'fieldValue'=11},
@@ -288,3 +447,19 @@ INSTANTIATE_TEST_CASE_P(ComplexSubscriptionTest, ExpressionSubstitutionTest, ::t
                             InputOutputPair{"reflectedVal.innerStructList[5].strValue", "Hello World!"},
                             InputOutputPair{"reflectedVal.tmpStructList[5].strValue", "Hello World!"}
                             ));
+
+MULTISTR_TEST(ExpressionsMultiStrTest, ConstantExpressionsFolding,
+R"(
+{{ 'Hello' }}{# comment #} {{ 'World' | upper }}{{ 1 + 2 * 3 }}{{ ['c', 'a', 'b'] | sort | join(',') }}
+{{ ('abc' if 1 > 2 else 'def') ~ '!' }} {{ {'key'=[1, 2, 3]}['key'][2] }} {{ 10 in [1, 10] }}
+{{ intValue + 1 }} {{ 'str' | default(stringValue) }} {% raw %}{{ raw }}{% endraw %}
+)",
+//-----------
+R"(
+Hello WORLD7a,b,c
+def! 3 true
+4 str {{ raw }}
+)")
+{
+    params = PrepareTestData();
+}
@@ -270,3 +270,53 @@ R"({% extends "base.j2tpl" %}{% block body %}->{{ testMacro('RegularMacroText')
     expectedResult = R"(->#REGULARMACROTEXT#<-)";
     EXPECT_STREQ(expectedResult.c_str(), result.c_str());
 }
+
+TEST_F(ExtendsTest, LinkedMultiLevelExtends)
+{
+    m_env.GetSettings().autoReload = false;
+    m_templateFs->AddFile("base.j2tpl", "<{% block b1 %}base b1{% endblock %}|{% block b2 %}base b2{% endblock %}>");
+    m_templateFs->AddFile("level1.j2tpl", R"({% extends "base.j2tpl" %}{% block b1 %}l1 b1[{% block inner %}l1 inner{% endblock %}]{% endblock %})");
+    m_templateFs->AddFile("level2.j2tpl", R"({% extends "level1.j2tpl" %}{% block b2 %}l2 b2 {{ super() }}{% endblock %})");
+    m_templateFs->AddFile("level3.j2tpl", R"({% extends "level2.j2tpl" %}{% block inner %}l3 inner{% endblock %})");
+
+    auto tpl = m_env.LoadTemplate("level3.j2tpl").value();
+    EXPECT_EQ("<l1 b1[l3 inner]|l2 b2 base b2>", tpl.RenderAsString({}).value());
+
+    // Parent templates are resolved by the first render only
+    auto statsBefore = m_env.GetCacheStats();
+    EXPECT_EQ("<l1 b1[l3 inner]|l2 b2 base b2>", tpl.RenderAsString({}).value());
+    auto statsAfter = m_env.GetCacheStats();
+    EXPECT_EQ(statsBefore.hits + statsBefore.misses, statsAfter.hits + statsAfter.misses);
+
+    auto level2 = m_env.LoadTemplate("level2.j2tpl").value();
+    EXPECT_EQ("<l1 b1[l1 inner]|l2 b2 base b2>", level2.RenderAsString({}).value());
+}
+
+TEST_F(ExtendsTest, LinkedParentsReloaded)
+{
+    class TimestampedFileSystem : public jinja2::MemoryFileSystem
+    {
+    public:
+        nonstd::optional<std::chrono::system_clock::time_point> GetLastModificationDate(const std::string&) const override
+        {
+            return std::chrono::system_clock::time_point(std::chrono::seconds(modificationTime));
+        }
+
+        int modificationTime = 1;
+    };
+
+    auto fs = std::make_shared<TimestampedFileSystem>();
+    fs->AddFile("base.j2tpl", "<{% block b1 %}{% endblock %}>");
+    fs->AddFile("level1.j2tpl", R"({% extends "base.j2tpl" %}{% block b1 %}l1 b1{% endblock %})");
+    fs->AddFile("level2.j2tpl", R"({% extends "level1.j2tpl" %})");
+
+    jinja2::TemplateEnv env;
+    env.AddFilesystemHandler(std::string(), fs);
+
+    auto tpl = env.LoadTemplate("level2.j2tpl").value();
+    EXPECT_EQ("<l1 b1>", tpl.RenderAsString({}).value());
+
+    fs->AddFile("base.j2tpl", "[{% block b1 %}{% endblock %}]");
+    fs->modificationTime = 2;
+    EXPECT_EQ("[l1 b1]", tpl.RenderAsString({}).value());
+}
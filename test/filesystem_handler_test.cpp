@@ -2,9 +2,16 @@
 
 #include <jinja2cpp/filesystem_handler.h>
 #include <jinja2cpp/template_env.h>
+#include <jinja2cpp/user_callable.h>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
 class FilesystemHandlerTest : public testing::Test
 {
@@ -117,6 +124,29 @@ R"(Hello World!
     EXPECT_EQ(test1Content, ReadFile(test3Stream));
 }
 
+TEST_F(FilesystemHandlerTest, RealFS_MemoryMapping)
+{
+    jinja2::RealFileSystem fs("./test_data");
+    EXPECT_FALSE((bool)fs.OpenBuffer("simple_template1.j2tpl"));
+
+    fs.SetMemoryMapping(true);
+    auto buffer = fs.OpenBuffer("simple_template1.j2tpl");
+#if defined(_WIN32)
+    EXPECT_FALSE((bool)buffer);
+#else
+    ASSERT_TRUE((bool)buffer);
+    EXPECT_EQ("Hello World!\n", std::string(buffer->data(), buffer->size()));
+    EXPECT_FALSE((bool)fs.OpenBuffer("===incorrect====.j2tpl"));
+#endif
+    buffer.reset();
+
+    jinja2::TemplateEnv env;
+    env.AddFilesystemHandler("", fs);
+    auto tpl = env.LoadTemplate("simple_template1.j2tpl");
+    ASSERT_TRUE(tpl.has_value());
+    EXPECT_EQ("Hello World!\n", tpl.value().RenderAsString({}).value());
+}
+
 TEST_F(FilesystemHandlerTest, RealFS_WideReading)
 {
     const std::wstring test1Content =
@@ -183,6 +213,252 @@ Line8
     EXPECT_EQ(test2Content, tpl2.RenderAsString({}).value());
 }
 
+TEST_F(FilesystemHandlerTest, TestCacheEviction)
+{
+    jinja2::MemoryFileSystem fs;
+    fs.AddFile("test1.j2tpl", "Test1");
+    fs.AddFile("test2.j2tpl", "Test2");
+    fs.AddFile("test3.j2tpl", "Test3");
+
+    jinja2::TemplateEnv env;
+    env.GetSettings().cacheSize = 2;
+
+    env.AddFilesystemHandler("", fs);
+    EXPECT_EQ("Test1", env.LoadTemplate("test1.j2tpl").value().RenderAsString({}).value());
+    EXPECT_EQ("Test2", env.LoadTemplate("test2.j2tpl").value().RenderAsString({}).value());
+    // Make 'test2.j2tpl' the least recently used one
+    EXPECT_EQ("Test1", env.LoadTemplate("test1.j2tpl").value().RenderAsString({}).value());
+    EXPECT_EQ("Test3", env.LoadTemplate("test3.j2tpl").value().RenderAsString({}).value());
+
+    auto stats = env.GetCacheStats();
+    EXPECT_EQ(2u, stats.size);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(3u, stats.misses);
+    EXPECT_EQ(1u, stats.evictions);
+
+    fs.AddFile("test1.j2tpl", "Test1 changed");
+    fs.AddFile("test2.j2tpl", "Test2 changed");
+    EXPECT_EQ("Test1", env.LoadTemplate("test1.j2tpl").value().RenderAsString({}).value());
+    EXPECT_EQ("Test2 changed", env.LoadTemplate("test2.j2tpl").value().RenderAsString({}).value());
+
+    stats = env.GetCacheStats();
+    EXPECT_EQ(2u, stats.size);
+    EXPECT_EQ(2u, stats.hits);
+    EXPECT_EQ(4u, stats.misses);
+    EXPECT_EQ(2u, stats.evictions);
+}
+
+TEST_F(FilesystemHandlerTest, TestTemplatesDeduplication)
+{
+    jinja2::MemoryFileSystem fs;
+    fs.AddFile("tenant1/page.j2tpl", "Hello, {{ name }}!");
+    fs.AddFile("tenant2/page.j2tpl", "Hello, {{ name }}!");
+    fs.AddFile("tenant3/page.j2tpl", "Bye, {{ name }}!");
+
+    jinja2::TemplateEnv env;
+    env.GetSettings().deduplicateTemplates = true;
+    env.AddFilesystemHandler("", fs);
+
+    jinja2::ValuesMap params{{"name", "World"}};
+    EXPECT_EQ("Hello, World!", env.LoadTemplate("tenant1/page.j2tpl").value().RenderAsString(params).value());
+    EXPECT_EQ("Hello, World!", env.LoadTemplate("tenant2/page.j2tpl").value().RenderAsString(params).value());
+    EXPECT_EQ("Bye, World!", env.LoadTemplate("tenant3/page.j2tpl").value().RenderAsString(params).value());
+
+    auto stats = env.GetCacheStats();
+    EXPECT_EQ(3u, stats.size);
+    EXPECT_EQ(3u, stats.misses);
+    EXPECT_EQ(1u, stats.duplicates);
+
+    env.GetSettings().deduplicateTemplates = false;
+    fs.AddFile("tenant4/page.j2tpl", "Hello, {{ name }}!");
+    EXPECT_EQ("Hello, World!", env.LoadTemplate("tenant4/page.j2tpl").value().RenderAsString(params).value());
+    EXPECT_EQ(1u, env.GetCacheStats().duplicates);
+}
+
+TEST_F(FilesystemHandlerTest, TestMetrics)
+{
+    jinja2::MemoryFileSystem fs;
+    fs.AddFile("page.j2tpl", "Hello, {{ name }}!");
+    fs.AddFile("broken.j2tpl", "{% include 'missing.j2tpl' %}");
+
+    jinja2::TemplateEnv env;
+    env.AddFilesystemHandler("", fs);
+
+    std::map<jinja2::MetricsEvent, int> events;
+    env.SetMetricsListener([&events](jinja2::MetricsEvent event, const std::string&, std::chrono::nanoseconds, uint64_t) { ++ events[event]; });
+
+    jinja2::ValuesMap params{{"name", "World"}};
+    EXPECT_EQ("Hello, World!", env.LoadTemplate("page.j2tpl").value().RenderAsString(params).value());
+    EXPECT_TRUE(events.empty());
+    EXPECT_TRUE(env.GetMetrics().loadTime.empty());
+
+    env.GetSettings().collectMetrics = true;
+    env.LoadTemplate("page.j2tpl").value().RenderAsString(params);
+    env.LoadTemplate("page.j2tpl").value().RenderAsString(params);
+    EXPECT_FALSE(env.LoadTemplate("broken.j2tpl").value().RenderAsString(params).has_value());
+
+    auto metrics = env.GetMetrics();
+    EXPECT_EQ(1u, metrics.loadTime.count("broken.j2tpl"));
+    EXPECT_EQ(1u, metrics.loadTime["broken.j2tpl"].count);
+    EXPECT_EQ(3u, metrics.renderTime.count);
+    EXPECT_EQ(1u, metrics.failedRenders);
+    EXPECT_EQ(26u, metrics.renderedBytes);
+    EXPECT_LT(0u, metrics.filesystemOpenTime.count);
+    EXPECT_LT(0u, metrics.filesystemCheckTime.count);
+
+    uint64_t bucketsTotal = 0;
+    for (auto count : metrics.renderTime.buckets)
+        bucketsTotal += count;
+    EXPECT_EQ(metrics.renderTime.count, bucketsTotal);
+    EXPECT_EQ(1, events[jinja2::MetricsEvent::TemplateLoaded]);
+    EXPECT_EQ(2, events[jinja2::MetricsEvent::TemplateRendered]);
+    EXPECT_EQ(1, events[jinja2::MetricsEvent::RenderFailed]);
+
+    env.SetMetricsListener(nullptr);
+    env.LoadTemplate("page.j2tpl").value().RenderAsString(params);
+    EXPECT_EQ(2, events[jinja2::MetricsEvent::TemplateRendered]);
+    EXPECT_EQ(4u, env.GetMetrics().renderTime.count);
+}
+
+TEST_F(FilesystemHandlerTest, TestEvictedLoadTimeMetrics)
+{
+    jinja2::MemoryFileSystem fs;
+    fs.AddFile("test1.j2tpl", "Test1");
+    fs.AddFile("test2.j2tpl", "Test2");
+    fs.AddFile("test3.j2tpl", "Test3");
+
+    jinja2::TemplateEnv env;
+    env.GetSettings().cacheSize = 2;
+    env.GetSettings().collectMetrics = true;
+    env.AddFilesystemHandler("", fs);
+
+    EXPECT_TRUE(env.LoadTemplate("test1.j2tpl").has_value());
+    EXPECT_TRUE(env.LoadTemplate("test2.j2tpl").has_value());
+    EXPECT_TRUE(env.LoadTemplate("test3.j2tpl").has_value());
+
+    auto metrics = env.GetMetrics();
+    EXPECT_EQ(1u, metrics.cache.evictions);
+    EXPECT_EQ(2u, metrics.loadTime.size());
+    EXPECT_EQ(1u, metrics.loadTime.count("test3.j2tpl"));
+}
+
+TEST_F(FilesystemHandlerTest, TestAllocationTracking)
+{
+    jinja2::MemoryFileSystem fs;
+    fs.AddFile("page.j2tpl", "{{ alloc(100) }}{{ alloc(50) }}{{ free(100) }}{{ alloc(10) }}done");
+
+    jinja2::TemplateEnv env;
+    env.AddFilesystemHandler("", fs);
+
+    std::vector<std::pair<std::string, jinja2::RenderAllocationStats>> reports;
+    env.SetAllocationListener([&reports](const std::string& name, const jinja2::RenderAllocationStats& stats) { reports.emplace_back(name, stats); });
+
+    // Hooks are fed by the callables instead of the replaced operator new, so the counts are exact
+    jinja2::ValuesMap params;
+    params["alloc"] = jinja2::MakeCallable([](int64_t size) { jinja2::TrackAllocation(static_cast<size_t>(size)); return std::string(); }, jinja2::ArgInfo{"size"});
+    params["free"] = jinja2::MakeCallable([](int64_t size) { jinja2::TrackDeallocation(static_cast<size_t>(size)); return std::string(); }, jinja2::ArgInfo{"size"});
+
+    auto tpl = env.LoadTemplate("page.j2tpl").value();
+    EXPECT_EQ("done", tpl.RenderAsString(params).value());
+    EXPECT_TRUE(reports.empty());
+
+    env.GetSettings().trackAllocations = true;
+    env.InvalidateTemplate("page.j2tpl");
+    tpl = env.LoadTemplate("page.j2tpl").value();
+    EXPECT_EQ("done", tpl.RenderAsString(params).value());
+    ASSERT_EQ(1u, reports.size());
+    EXPECT_EQ("page.j2tpl", reports[0].first);
+    EXPECT_EQ(3u, reports[0].second.allocations);
+    EXPECT_EQ(1u, reports[0].second.deallocations);
+    EXPECT_EQ(160u, reports[0].second.allocatedBytes);
+    EXPECT_EQ(150u, reports[0].second.peakBytes);
+
+    // Outside of the tracked renders the hooks are no-op
+    jinja2::TrackAllocation(10);
+    EXPECT_EQ(1u, reports.size());
+}
+
+TEST_F(FilesystemHandlerTest, TestBackgroundReloadCheck)
+{
+    class TimestampedFileSystem : public jinja2::MemoryFileSystem
+    {
+    public:
+        nonstd::optional<std::chrono::system_clock::time_point> GetLastModificationDate(const std::string&) const override
+        {
+            ++ checksCount;
+            return std::chrono::system_clock::time_point(std::chrono::seconds(modificationTime.load()));
+        }
+
+        std::atomic<int> modificationTime{1};
+        mutable std::atomic<int> checksCount{0};
+    };
+
+    TimestampedFileSystem fs;
+    fs.AddFile("test1.j2tpl", "Test1");
+
+    jinja2::TemplateEnv env;
+    env.GetSettings().autoReloadInterval = std::chrono::milliseconds(10);
+    env.AddFilesystemHandler("", fs);
+
+    EXPECT_EQ("Test1", env.LoadTemplate("test1.j2tpl").value().RenderAsString({}).value());
+    auto checksCount = fs.checksCount.load();
+    for (int n = 0; n < 10; ++ n)
+        EXPECT_EQ("Test1", env.LoadTemplate("test1.j2tpl").value().RenderAsString({}).value());
+    // Cached template requests don't access the filesystem
+    EXPECT_LT(fs.checksCount.load() - checksCount, 10);
+
+    fs.AddFile("test1.j2tpl", "Test1 changed");
+    fs.modificationTime = 2;
+    std::string result;
+    for (int n = 0; n < 200 && result != "Test1 changed"; ++ n)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        result = env.LoadTemplate("test1.j2tpl").value().RenderAsString({}).value();
+    }
+    EXPECT_EQ("Test1 changed", result);
+}
+
+TEST_F(FilesystemHandlerTest, TestConcurrentLoadsOfUncachedTemplate)
+{
+    class SlowFileSystem : public jinja2::MemoryFileSystem
+    {
+    public:
+        jinja2::CharFileStreamPtr OpenStream(const std::string& name) const override
+        {
+            ++ opensCount;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return jinja2::MemoryFileSystem::OpenStream(name);
+        }
+
+        mutable std::atomic<int> opensCount{0};
+    };
+
+    SlowFileSystem fs;
+    fs.AddFile("test1.j2tpl", "Test1");
+
+    jinja2::TemplateEnv env;
+    env.AddFilesystemHandler("", fs);
+
+    std::vector<std::thread> threads;
+    std::atomic<int> loadedCount{0};
+    for (int n = 0; n < 8; ++ n)
+    {
+        threads.emplace_back([&env, &loadedCount]() {
+            auto tpl = env.LoadTemplate("test1.j2tpl");
+            if (tpl && tpl.value().RenderAsString({}).value() == "Test1")
+                ++ loadedCount;
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(8, loadedCount.load());
+    EXPECT_EQ(1, fs.opensCount.load());
+    auto stats = env.GetCacheStats();
+    EXPECT_EQ(1u, stats.misses);
+    EXPECT_EQ(7u, stats.hits);
+}
+
 TEST_F(FilesystemHandlerTest, TestDefaultRFSCaching)
 {
     const std::string test1Content = R"(
@@ -292,3 +568,184 @@ Line8
     EXPECT_EQ(test2Content, tpl2.RenderAsString({}).value());
 }
 
+
+TEST_F(FilesystemHandlerTest, RealFS_ListFiles)
+{
+    jinja2::RealFileSystem fs("./test_data/");
+
+    auto files = fs.ListFiles();
+    EXPECT_NE(files.end(), std::find(files.begin(), files.end(), "simple_template1.j2tpl"));
+    EXPECT_EQ(files.end(), std::find(files.begin(), files.end(), "===incorrect====.j2tpl"));
+}
+
+TEST_F(FilesystemHandlerTest, TestPreload)
+{
+    jinja2::MemoryFileSystem fs;
+    fs.AddFile("base.j2tpl", "[{% block body %}{% endblock %}]");
+    fs.AddFile("lib/macros.j2tpl", "{% macro hi(who) %}Hi, {{ who }}!{% endmacro %}");
+    fs.AddFile("lib/footer.j2tpl", "Bye");
+    fs.AddFile("pages/hello.j2tpl", R"({% extends "base.j2tpl" %}{% block body %}{% import "lib/macros.j2tpl" as m %}{{ m.hi('World') }} {% include ["lib/missing.j2tpl", "lib/footer.j2tpl"] %}{% endblock %})");
+    fs.AddFile("pages/broken.j2tpl", "{% if %}");
+    fs.AddFile("unused.j2tpl", "Unused");
+
+    jinja2::TemplateEnv env;
+    env.AddFilesystemHandler("", fs);
+
+    auto errors = env.PreloadByPattern("pages/*", 4);
+    ASSERT_EQ(1u, errors.size());
+    EXPECT_EQ("pages/broken.j2tpl", errors[0].GetErrorLocation().fileName);
+
+    // Requested templates, their dependencies and the missing dependency are loaded
+    auto stats = env.GetCacheStats();
+    EXPECT_EQ(4u, stats.size);
+    EXPECT_EQ(6u, stats.misses);
+
+    auto tpl = env.LoadTemplate("pages/hello.j2tpl").value();
+    EXPECT_EQ((std::vector<std::string>{"base.j2tpl", "lib/macros.j2tpl", "lib/missing.j2tpl", "lib/footer.j2tpl"}), tpl.GetDependencies());
+    EXPECT_EQ("[Hi, World! Bye]", tpl.RenderAsString({}).value());
+    // Only the missing template is requested again
+    EXPECT_EQ(7u, env.GetCacheStats().misses);
+
+    errors = env.Preload({"unused.j2tpl", "absent.j2tpl"});
+    ASSERT_EQ(1u, errors.size());
+    EXPECT_EQ(jinja2::ErrorCode::FileNotFound, errors[0].GetCode());
+    EXPECT_EQ(5u, env.GetCacheStats().size);
+}
+
+TEST_F(FilesystemHandlerTest, TestDependenciesPrefetch)
+{
+    class RemoteFileSystem : public jinja2::MemoryFileSystem
+    {
+    public:
+        void Prefetch(const std::vector<std::string>& names) const override
+        {
+            std::lock_guard<std::mutex> l(guard);
+            prefetched.insert(prefetched.end(), names.begin(), names.end());
+        }
+        std::vector<nonstd::optional<std::chrono::system_clock::time_point>> GetLastModificationDates(const std::vector<std::string>& names) const override
+        {
+            ++ batchedChecksCount;
+            return jinja2::MemoryFileSystem::GetLastModificationDates(names);
+        }
+
+        mutable std::mutex guard;
+        mutable std::vector<std::string> prefetched;
+        mutable std::atomic<int> batchedChecksCount{0};
+    };
+
+    RemoteFileSystem fs;
+    fs.AddFile("base.j2tpl", "[{% block body %}{% endblock %}]");
+    fs.AddFile("page.j2tpl", R"({% extends "base.j2tpl" %}{% block body %}{% include "footer.j2tpl" %}{% endblock %})");
+    fs.AddFile("footer.j2tpl", "{% include 'copyright.j2tpl' %}");
+    fs.AddFile("copyright.j2tpl", "(c)");
+
+    jinja2::TemplateEnv env;
+    env.GetSettings().prefetchDependencies = true;
+    env.GetSettings().autoReloadInterval = std::chrono::milliseconds(10);
+    env.AddFilesystemHandler("", fs);
+
+    auto tpl = env.LoadTemplate("page.j2tpl").value();
+    // Dependencies of the prefetched templates are prefetched as well
+    for (int n = 0; n < 200 && env.GetCacheStats().size != 4; ++ n)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(4u, env.GetCacheStats().size);
+    {
+        std::lock_guard<std::mutex> l(fs.guard);
+        std::sort(fs.prefetched.begin(), fs.prefetched.end());
+        EXPECT_EQ((std::vector<std::string>{"base.j2tpl", "copyright.j2tpl", "footer.j2tpl"}), fs.prefetched);
+    }
+
+    EXPECT_EQ("[(c)]", tpl.RenderAsString({}).value());
+    EXPECT_EQ(4u, env.GetCacheStats().misses);
+
+    // Cached templates are checked by the single call per reload check
+    for (int n = 0; n < 200 && fs.batchedChecksCount.load() == 0; ++ n)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_LT(0, fs.batchedChecksCount.load());
+}
+
+TEST_F(FilesystemHandlerTest, TestFailedBatchedModificationCheck)
+{
+    class FlakyFileSystem : public jinja2::MemoryFileSystem
+    {
+    public:
+        nonstd::optional<std::chrono::system_clock::time_point> GetLastModificationDate(const std::string& name) const override
+        {
+            ++ checksCount;
+            return jinja2::MemoryFileSystem::GetLastModificationDate(name);
+        }
+        std::vector<nonstd::optional<std::chrono::system_clock::time_point>> GetLastModificationDates(const std::vector<std::string>&) const override
+        {
+            throw std::runtime_error("Store is unavailable");
+        }
+
+        mutable std::atomic<int> checksCount{0};
+    };
+
+    FlakyFileSystem fs;
+    fs.AddFile("test1.j2tpl", "Test1");
+    fs.AddFile("test2.j2tpl", "Test2");
+
+    jinja2::TemplateEnv env;
+    env.GetSettings().autoReloadInterval = std::chrono::milliseconds(10);
+    env.AddFilesystemHandler("", fs);
+
+    EXPECT_EQ("Test1", env.LoadTemplate("test1.j2tpl").value().RenderAsString({}).value());
+    EXPECT_EQ("Test2", env.LoadTemplate("test2.j2tpl").value().RenderAsString({}).value());
+    auto loadChecksCount = fs.checksCount.load();
+
+    // Entries are checked one by one and kept in the cache
+    for (int n = 0; n < 200 && fs.checksCount.load() < loadChecksCount + 2; ++ n)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_LE(loadChecksCount + 2, fs.checksCount.load());
+
+    auto stats = env.GetCacheStats();
+    EXPECT_EQ(2u, stats.size);
+    EXPECT_EQ(0u, stats.reloads);
+}
+
+TEST_F(FilesystemHandlerTest, TestDependentTemplatesInvalidation)
+{
+    class TimestampedFileSystem : public jinja2::MemoryFileSystem
+    {
+    public:
+        nonstd::optional<std::chrono::system_clock::time_point> GetLastModificationDate(const std::string& name) const override
+        {
+            auto p = modificationTimes.find(name);
+            return std::chrono::system_clock::time_point(std::chrono::seconds(p == modificationTimes.end() ? 1 : p->second));
+        }
+
+        std::map<std::string, int> modificationTimes;
+    };
+
+    TimestampedFileSystem fs;
+    fs.AddFile("base.j2tpl", "[{% block body %}{% endblock %}]");
+    fs.AddFile("page.j2tpl", R"({% extends "base.j2tpl" %}{% block body %}{% include "footer.j2tpl" %}{% endblock %})");
+    fs.AddFile("footer.j2tpl", "Footer");
+    fs.AddFile("other.j2tpl", "Other");
+
+    jinja2::TemplateEnv env;
+    env.AddFilesystemHandler("", fs);
+    EXPECT_EQ("[Footer]", env.LoadTemplate("page.j2tpl").value().RenderAsString({}).value());
+    EXPECT_EQ("Other", env.LoadTemplate("other.j2tpl").value().RenderAsString({}).value());
+    EXPECT_EQ(4u, env.GetCacheStats().size);
+
+    auto graph = env.GetDependencyGraph();
+    EXPECT_EQ((std::vector<std::string>{"base.j2tpl", "footer.j2tpl"}), graph["page.j2tpl"]);
+    EXPECT_TRUE(graph["other.j2tpl"].empty());
+    EXPECT_EQ(std::vector<std::string>{"page.j2tpl"}, env.GetDependentTemplates("footer.j2tpl"));
+
+    // Reload of the changed template drops the dependent one only
+    fs.AddFile("footer.j2tpl", "New footer");
+    fs.modificationTimes["footer.j2tpl"] = 2;
+    EXPECT_EQ("New footer", env.LoadTemplate("footer.j2tpl").value().RenderAsString({}).value());
+    EXPECT_EQ(3u, env.GetCacheStats().size);
+    EXPECT_TRUE(env.GetDependentTemplates("footer.j2tpl").empty());
+    EXPECT_EQ("[New footer]", env.LoadTemplate("page.j2tpl").value().RenderAsString({}).value());
+
+    env.InvalidateTemplate("base.j2tpl");
+    graph = env.GetDependencyGraph();
+    EXPECT_EQ(2u, graph.size());
+    EXPECT_EQ(1u, graph.count("footer.j2tpl"));
+    EXPECT_EQ(1u, graph.count("other.j2tpl"));
+}
@@ -99,6 +99,111 @@ STR1->STR2->STR3
 {
 }
 
+MULTISTR_TEST(FilterGenericTestSingle, LazyListIndexedTest,
+ R"(
+{% set odd = [1, 2, 3, 4, 5, 6, 7] | select('odd') %}
+{% for i in range(4) %}{{ odd[3 - i] }}{{ odd[i] }};{% endfor %}
+{{ odd[4] | pprint }} {{ odd | join(',') }}
+)",
+//--------
+R"(
+
+71;53;35;17;
+none 1,3,5,7
+)"
+)
+{
+}
+
+MULTISTR_TEST(FilterGenericTestSingle, LazyListReusedTest,
+ R"(
+{% set lower = ['a', 'B', 'c', 'D', 'e'] | select('lower') | map('upper') %}
+{{ lower | join(',') }} {{ lower | join('-') }} {{ lower | length }}
+{% for i in lower %}{{ i }}/{{ loop.length }}{{ ' ' if not loop.last }}{% endfor %}
+)",
+//--------
+R"(
+
+A,C,E A-C-E 3
+A/3 C/3 E/3
+)"
+)
+{
+}
+
+TEST(CaseConversionFilters, KeepUtf8Sequences)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{{ text | upper }}|{{ text | lower }}|{{ text | capitalize }}|{{ text | title }}|{{ text | wordcount }}"));
+
+    auto result = tpl.RenderAsString({{"text", "na\xc3\xafve CAF\xc3\x89 \xc3\xa9t\xc3\xa9"}}).value();
+    EXPECT_EQ("NA\xc3\xafVE CAF\xc3\x89 \xc3\xa9T\xc3\xa9|na\xc3\xafve caf\xc3\x89 \xc3\xa9t\xc3\xa9|"
+              "Na\xc3\xafve caf\xc3\x89 \xc3\xa9t\xc3\xa9|Na\xc3\xafve CAF\xc3\x89 \xc3\xa9t\xc3\xa9|3", result);
+}
+
+TEST(ParallelFilters, SameResultsAsSequential)
+{
+    jinja2::ValuesList items;
+    for (int n = 0; n != 103; ++ n)
+        items.push_back(jinja2::ValuesMap{{"id", int64_t(n)}, {"group", int64_t(n % 7)}, {"name", "item" + std::to_string(n % 11)}});
+    jinja2::ValuesList numbers;
+    for (int n = 0; n != 103; ++ n)
+        numbers.push_back(int64_t((n * 37) % 101));
+
+    const char* source = "{{ items | map(attribute='name') | map('upper') | join(',') }}|{{ numbers | select('odd') | join(',') }}|"
+                         "{{ numbers | reject('in', [5, 7, 11]) | list | length }}|{{ items | selectattr('group', 'equalto', 3) | map(attribute='id') | join(',') }}|"
+                         "{{ items | sort(attribute='group') | map(attribute='id') | join(',') }}|{{ numbers | sort(reverse=true) | join(',') }}|"
+                         "{{ items | sum(attribute='id') }}|{{ numbers | max }}|{{ numbers | min }}|{{ items | max(attribute='group') }}|"
+                         "{{ items | unique(attribute='name') | map(attribute='id') | join(',') }}";
+
+    auto render = [&](size_t threshold) {
+        jinja2::TemplateEnv env;
+        env.GetSettings().parallelFilterThreshold = threshold;
+        env.GetSettings().parallelFilterThreads = 4;
+        jinja2::Template tpl(&env);
+        EXPECT_TRUE(!!tpl.Load(source));
+        auto result = tpl.RenderAsString({{"items", items}, {"numbers", numbers}});
+        EXPECT_TRUE(!!result) << result.error().ToString();
+        return result.value_or("");
+    };
+
+    auto sequential = render(0);
+    EXPECT_FALSE(sequential.empty());
+    EXPECT_EQ(sequential, render(4));
+    EXPECT_EQ(sequential, render(1000));
+}
+
+TEST(NumericArrayFilters, SameResultsAsBoxedItems)
+{
+    std::vector<int64_t> integers{5, -3, 12, 7, 12, 0, -8};
+    std::vector<double> doubles{2.5, -1.25, 10.5, 3.75, -0.25};
+    jinja2::ValuesList boxedIntegers(integers.begin(), integers.end());
+    jinja2::ValuesList boxedDoubles(doubles.begin(), doubles.end());
+
+    Template tpl;
+    ASSERT_TRUE(!!tpl.Load("{{ ints | sum }} {{ ints | min }} {{ ints | max }} {{ ints | sort | join(',') }} {{ ints | sort(reverse=true) | sum }} "
+                           "{{ ints | sum(start=10) }}|{{ dbls | sum }} {{ dbls | min }} {{ dbls | max }} {{ dbls | sort(reverse=true) | join(',') }} "
+                           "{{ dbls | sort | first }} {{ dbls | sort | length }}"));
+
+    auto typed = tpl.RenderAsString({{"ints", jinja2::Reflect(integers)}, {"dbls", jinja2::Reflect(doubles)}});
+    auto boxed = tpl.RenderAsString({{"ints", boxedIntegers}, {"dbls", boxedDoubles}});
+    ASSERT_TRUE(!!typed) << typed.error().ToString();
+    ASSERT_TRUE(!!boxed) << boxed.error().ToString();
+    EXPECT_EQ("25 -8 12 -8,-3,0,5,7,12,12 25 35|15.25 -1.25 10.5 10.5,3.75,2.5,-0.25,-1.25 -1.25 5", typed.value());
+    EXPECT_EQ(boxed.value(), typed.value());
+}
+
+TEST(StringFilters, KeepPartsOfSourceViews)
+{
+    Template tpl;
+    ASSERT_TRUE(tpl.Load("{% filter trim %}  a  b {% endfilter %}|{% filter truncate(5, leeway=0, end='') %}hello world{% endfilter %}|"
+                         "{% filter replace('x', 'y') %}abc{% endfilter %}|{% for s in items %}[{{ s | trim }}{{ s | replace('p', 'P') }}]{% endfor %}"));
+
+    auto result = tpl.RenderAsString({{"items", jinja2::ValuesList{"  p  ", "q"}}});
+    ASSERT_TRUE(!!result) << result.error().ToString();
+    EXPECT_EQ("a b|hello|abc|[p  P  ][qq]", result.value());
+}
+
 TEST_P(ListSliceTest, Test)
 {
     auto& testParam = GetParam();
@@ -111,6 +216,9 @@ INSTANTIATE_TEST_CASE_P(StringJoin, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"['str1', 'str2', 'str3'] | join",                   "str1str2str3"},
                             InputOutputPair{"['str1', 'str2', 'str3'] | join(' ')",              "str1 str2 str3"},
                             InputOutputPair{"['str1', 'str2', 'str3'] | join(d='-')",            "str1-str2-str3"},
+                            InputOutputPair{"[1, 'str2', 3.5] | join(', ')",                     "1, str2, 3.5"},
+                            InputOutputPair{"[] | join(', ') | pprint",                          "''"},
+                            InputOutputPair{"range(5) | join(1)",                                "011121314"},
                             InputOutputPair{"reflectedList | join(d='-', 'strValue')",           "test string 0-test string 1-test string 2-test string 3-test string 4-test string 5-test string 6-test string 7-test string 8-test string 9"},
                             InputOutputPair{"reflectedList | join(attribute='strValue', '-')",   "test string 0-test string 1-test string 2-test string 3-test string 4-test string 5-test string 6-test string 7-test string 8-test string 9"},
                             InputOutputPair{"reflectedList | join(attribute='strValue', d='-')", "test string 0-test string 1-test string 2-test string 3-test string 4-test string 5-test string 6-test string 7-test string 8-test string 9"}
@@ -124,6 +232,12 @@ INSTANTIATE_TEST_CASE_P(Sort, ListIteratorTest, ::testing::Values(
                             InputOutputPair{"['Str2', 'str1', 'str3'] | sort(case_sensitive=true)",               "Str2, str1, str3"},
                             InputOutputPair{"['Str2', 'str1', 'str3'] | sort(case_sensitive=true, reverse=true)", "str3, str1, Str2"},
                             InputOutputPair{"[3, 1, 2] | sort",                                                   "1, 2, 3"},
+                            InputOutputPair{"[3, 1.5, 2, 0.5, 10] | sort",                                        "0.5, 1.5, 2, 3, 10"},
+                            InputOutputPair{"[3, 1.5, 2, 0.5, 10] | sort(reverse=true)",                          "10, 3, 2, 1.5, 0.5"},
+                            InputOutputPair{"['b', 'A', 'a', 'B'] | sort",                                        "A, a, b, B"},
+                            InputOutputPair{"['b', 'A', 'a', 'B'] | sort(reverse=true)",                          "b, B, A, a"},
+                            InputOutputPair{"[{'k'=2, 'v'='a'}, {'k'=1, 'v'='b'}, {'k'=2, 'v'='c'}, {'k'=1, 'v'='d'}] | sort(attribute='k') | map(attribute='v')",
+                                                                                                                  "b, d, a, c"},
                             InputOutputPair{"reflectedIntVector | sort",                                          "0, 1, 2, 3, 4, 5, 6, 7, 8, 9"}
                             ));
 
@@ -215,6 +329,9 @@ INSTANTIATE_TEST_CASE_P(Unique, ListIteratorTest, ::testing::Values(
                             InputOutputPair{"[3, 1, 2] | unique",                                     "3, 1, 2"},
                             InputOutputPair{"[3, 1, 2, 1, -2, 1, 10, 1, 6, 1, 5] | unique",           "3, 1, 2, -2, 10, 6, 5"},
                             InputOutputPair{"[3.0, 3, 1] | unique",                                   "3, 1"},
+                            InputOutputPair{"['Str2', 'str2', 'str3'] | unique(case_sensitive=true)", "Str2, str2, str3"},
+                            InputOutputPair{"[1, 'a', 2.5, 1.0, 'A', 2, 'b', 1, 2.5] | unique",       "1, a, 2.5, 2, b"},
+                            InputOutputPair{"[1, 'a', 1.0, 'A', 2] | unique(case_sensitive=true)",    "1, a, A, 2"},
                             InputOutputPair{"reflectedList | unique(attribute='strValue') | map(attribute='strValue')",
                                                                                                       "test string 0, test string 1, test string 2, test string 3, test string 4, test string 5, test string 6, test string 7, test string 8, test string 9"},
                             InputOutputPair{"reflectedList | unique(attribute='boolValue') | map(attribute='strValue')",
@@ -282,6 +399,24 @@ INSTANTIATE_TEST_CASE_P(SelectAttr, ListIteratorTest, ::testing::Values(
                             ));
 
 
+INSTANTIATE_TEST_CASE_P(LazyChains, FilterGenericTest, ::testing::Values(
+                            InputOutputPair{"reflectedList | selectattr('boolValue') | map(attribute='strValue') | map('upper') | join('|')",
+                                                                                        "TEST STRING 1|TEST STRING 3|TEST STRING 5|TEST STRING 7|TEST STRING 9"},
+                            InputOutputPair{"reflectedList | selectattr('boolValue') | map(attribute='intValue') | slice(2, 0) | pprint",
+                                                                                        "[[1, 3], [5, 7], [9, 0]]"},
+                            InputOutputPair{"[1, 2, 3, 4, 5, 6, 7] | select('odd') | batch(2) | pprint", "[[1, 3], [5, 7]]"},
+                            InputOutputPair{"[1, 2, 3, 4, 5] | select('odd') | length", "3"},
+                            InputOutputPair{"[1, 2, 3, 4, 5] | reject('odd') | first", "2"},
+                            InputOutputPair{"[1, 2, 3, 4, 5] | select('odd') | last", "5"},
+                            InputOutputPair{"([1, 2, 3, 4, 5] | select('even'))[1]", "4"},
+                            InputOutputPair{"([1, 2, 3, 4, 5] | select('even'))[2] | pprint", "none"},
+                            InputOutputPair{"(['a', 'b', 'c'] | map('upper'))[2]", "C"},
+                            InputOutputPair{"[1, 1, 2, 3, 3] | select('odd') | unique | pprint", "[1, 3]"},
+                            InputOutputPair{"[1, 2, 3] | select('even') | sort(reverse=true) | pprint", "[2]"},
+                            InputOutputPair{"'yes' if [1, 3] | select('even') else 'no'", "no"},
+                            InputOutputPair{"'yes' if [1, 2] | select('even') else 'no'", "yes"}
+                            ));
+
 INSTANTIATE_TEST_CASE_P(PPrint, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"10 | pprint", "10"},
                             InputOutputPair{"10.5 | pprint", "10.5"},
@@ -365,9 +500,18 @@ grouper: true
                                 }
                             ));
 
+INSTANTIATE_TEST_CASE_P(GroupByMixedKeys, FilterGenericTest, ::testing::Values(
+                            InputOutputPair{"[{'k'=1, 'v'='a'}, {'k'='1', 'v'='b'}, {'k'=1.0, 'v'='c'}, {'k'=2, 'v'='d'}, {'k'=1, 'v'='e'}] | groupby('k') | map(attribute='grouper') | pprint",
+                                            "[1, '1', 2]"},
+                            InputOutputPair{"[{'k'=1.5, 'v'='a'}, {'k'='A', 'v'='b'}, {'k'='a', 'v'='c'}, {'k'=1.5, 'v'='d'}, {'k'='A', 'v'='e'}] | groupby('k') | map(attribute='list') | map('length') | pprint",
+                                            "[2, 2, 1]"}
+                            ));
+
 INSTANTIATE_TEST_CASE_P(DictSort, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"{'key'='itemName', 'Value'='ItemValue'} | dictsort | pprint", "['key': 'itemName', 'Value': 'ItemValue']"},
                             InputOutputPair{"{'key'='itemName', 'Value'='ItemValue'} | dictsort(by='value') | pprint", "['key': 'itemName', 'Value': 'ItemValue']"},
+                            InputOutputPair{"{'a'=3, 'b'=1.5, 'c'=2} | dictsort(by='value') | pprint", "['b': 1.5, 'c': 2, 'a': 3]"},
+                            InputOutputPair{"{'a'=3, 'b'=1.5, 'c'=2} | dictsort(by='value', reverse=true) | pprint", "['a': 3, 'c': 2, 'b': 1.5]"},
                             InputOutputPair{"{'key'='itemName', 'Value'='ItemValue'} | dictsort(reverse=true) | pprint", "['Value': 'ItemValue', 'key': 'itemName']"},
                             InputOutputPair{"{'key'='itemName', 'Value'='ItemValue'} | dictsort(reverse=true, by='value') | pprint", "['Value': 'ItemValue', 'key': 'itemName']"},
                             InputOutputPair{"{'key'='itemName', 'Value'='ItemValue'} | dictsort(case_sensitive=true) | pprint", "['Value': 'ItemValue', 'key': 'itemName']"},
@@ -428,6 +572,11 @@ INSTANTIATE_TEST_CASE_P(Convert, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"'100' | int(10, base=2) | pprint", "4"},
                             InputOutputPair{"'100' | int(10, base=8) | pprint", "64"},
                             InputOutputPair{"'100' | int(10, base=16) | pprint", "256"},
+                            InputOutputPair{"'12345678.9' | float", "12345679"},
+                            InputOutputPair{"'100000000' | float", "1e+08"},
+                            InputOutputPair{"'2.5' | float * 4", "10"},
+                            InputOutputPair{"'-1.25' | float | pprint", "-1.25"},
+                            InputOutputPair{"'-9223372036854775807' | int", "-9223372036854775807"},
                             InputOutputPair{"'100' | list | pprint", "['1', '0', '0']"},
                             InputOutputPair{"{'name'='itemName', 'val'='itemValue'} | list | sort | pprint", "['name', 'val']"}
                             ));
@@ -436,7 +585,9 @@ INSTANTIATE_TEST_CASE_P(Trim, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"'string' | trim | pprint", "'string'"},
                             InputOutputPair{"'    string' | trim | pprint", "'string'"},
                             InputOutputPair{"'string    ' | trim | pprint", "'string'"},
-                            InputOutputPair{"'    string     ' | trim | pprint", "'string'"}/*,
+                            InputOutputPair{"'    string     ' | trim | pprint", "'string'"},
+                            InputOutputPair{"'  inner   spaces   here ' | trim | pprint", "'inner spaces here'"},
+                            InputOutputPair{"'   ' | trim | pprint", "''"}/*,
                             InputOutputPair{"wstringValue | trim", "'hello world'"}*/
                             ));
 
@@ -452,7 +603,9 @@ INSTANTIATE_TEST_CASE_P(Upper, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"'string' | upper | pprint", "'STRING'"},
                             InputOutputPair{"'1234string' | upper | pprint", "'1234STRING'"},
                             InputOutputPair{"'hello world' | upper | pprint", "'HELLO WORLD'"},
-                            InputOutputPair{"'hello123ooo, world!' | upper | pprint", "'HELLO123OOO, WORLD!'"}/*,
+                            InputOutputPair{"'hello123ooo, world!' | upper | pprint", "'HELLO123OOO, WORLD!'"},
+                            InputOutputPair{"'hello world, long enough for the vectorized loop' | upper | pprint",
+                                            "'HELLO WORLD, LONG ENOUGH FOR THE VECTORIZED LOOP'"}/*,
                             InputOutputPair{"wstringValue | trim", "'hello world'"}*/
                             ));
 
@@ -461,7 +614,9 @@ INSTANTIATE_TEST_CASE_P(Lower, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"'String' | lower | pprint", "'string'"},
                             InputOutputPair{"'1234String' | lower | pprint", "'1234string'"},
                             InputOutputPair{"'Hello World' | lower | pprint", "'hello world'"},
-                            InputOutputPair{"'Hello123OOO, World!' | lower | pprint", "'hello123ooo, world!'"}/*,
+                            InputOutputPair{"'Hello123OOO, World!' | lower | pprint", "'hello123ooo, world!'"},
+                            InputOutputPair{"'HELLO WORLD, LONG ENOUGH FOR THE VECTORIZED LOOP' | lower | pprint",
+                                            "'hello world, long enough for the vectorized loop'"}/*,
                             InputOutputPair{"wstringValue | trim", "'hello world'"}*/
                             ));
 
@@ -478,7 +633,11 @@ INSTANTIATE_TEST_CASE_P(Replace, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"'Hello World' | replace('Hello', 'Goodbye') | pprint", "'Goodbye World'"},
                             InputOutputPair{"'Hello World' | replace(old='l', new='L') | pprint", "'HeLLo WorLd'"},
                             InputOutputPair{"'Hello World' | replace(old='l', new='L', 2) | pprint", "'HeLLo World'"},
-                            InputOutputPair{"'Hello World' | replace('l', 'L', count=1) | pprint", "'HeLlo World'"}
+                            InputOutputPair{"'Hello World' | replace('l', 'L', count=1) | pprint", "'HeLlo World'"},
+                            InputOutputPair{"'Hello World' | replace('xyz', 'L') | pprint", "'Hello World'"},
+                            InputOutputPair{"'Hello World' | replace('', 'L') | pprint", "'Hello World'"},
+                            InputOutputPair{"'aaa' | replace('a', 'ba', 2) | pprint", "'babaa'"},
+                            InputOutputPair{"'abababa' | replace('aba', 'X') | pprint", "'XbX'"}
                             ));
 
 INSTANTIATE_TEST_CASE_P(Truncate, FilterGenericTest, ::testing::Values(
@@ -505,7 +664,19 @@ INSTANTIATE_TEST_CASE_P(Capitalize, FilterGenericTest, ::testing::Values(
 INSTANTIATE_TEST_CASE_P(Escape, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"'' | escape | pprint", "''"},
                             InputOutputPair{"'abcd&><efgh' | escape | pprint", "'abcd&amp;&gt;&lt;efgh'"},
-                            InputOutputPair{"'\\\"\\'' | escape | pprint", "'&#34;&#39;'"}
+                            InputOutputPair{"'\\\"\\'' | escape | pprint", "'&#34;&#39;'"},
+                            InputOutputPair{"'The quick brown fox jumps over the lazy dog without any special chars' | escape",
+                                            "The quick brown fox jumps over the lazy dog without any special chars"},
+                            InputOutputPair{"'The quick <b>brown</b> fox & the \\\"lazy\\\" dog, it\\'s a very long string' | escape",
+                                            "The quick &lt;b&gt;brown&lt;/b&gt; fox &amp; the &#34;lazy&#34; dog, it&#39;s a very long string"}
+                            ));
+
+INSTANTIATE_TEST_CASE_P(EscapeCpp, FilterGenericTest, ::testing::Values(
+                            InputOutputPair{"'' | escapecpp", ""},
+                            InputOutputPair{"'plain text without any chars which should be escaped' | escapecpp",
+                                            "plain text without any chars which should be escaped"},
+                            InputOutputPair{"'say \\\"hi\\\"\\n\\tand it\\'s long enough for the vector kernels' | escapecpp",
+                                            "say \\\"hi\\\"\\n\\tand it\\'s long enough for the vector kernels"}
                             ));
 
 INSTANTIATE_TEST_CASE_P(Batch, FilterGenericTest, ::testing::Values(
@@ -544,7 +715,13 @@ INSTANTIATE_TEST_CASE_P(Format, FilterGenericTest, ::testing::Values(
                             InputOutputPair{"'Hello {name}!' | format(name='World')", "Hello World!"},
                             InputOutputPair{"'Hello {array}!' | format(array=[1, 2, 3])", "Hello [1, 2, 3]!"},
                             InputOutputPair{"'Hello {boolean}!' | format(boolean=True)", "Hello true!"},
-                            InputOutputPair{"'Hello {empty}!' | format(empty=nonexistent)", "Hello none!"}
+                            InputOutputPair{"'Hello {empty}!' | format(empty=nonexistent)", "Hello none!"},
+                            InputOutputPair{"'{{{}}} }}{{' | format(1)", "{1} }{"},
+                            InputOutputPair{"'[{:>5}|{:<3}|{}]' | format('ab', 7, 'cd')", "[   ab|7  |cd]"},
+                            InputOutputPair{"'{:{}}' | format(5, 3)", "  5"},
+                            InputOutputPair{"'{0}{1}{0}' | format('a', 'b')", "aba"},
+                            InputOutputPair{"('{}-' ~ '{}') | format('x', 'y')", "x-y"},
+                            InputOutputPair{"(stringValue ~ ' {}') | format(2)", "rain 2"}
                         ));
 
 INSTANTIATE_TEST_CASE_P(ListSlice, ListSliceTest, ::testing::Values(
@@ -6,8 +6,11 @@
 
 #include <array>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <forward_list>
+#include <vector>
 
 using namespace jinja2;
 
@@ -188,7 +191,11 @@ INSTANTIATE_TEST_CASE_P(RangeParamResolving, RangeForLoopTest, ::testing::Values
         InputOutputPair{"range(start=0, 8, 2)", "0,2,4,6,"},
         InputOutputPair{"range(start=0, 8, step=2)", "0,2,4,6,"},
         InputOutputPair{"range(0, stop=8, step=2)", "0,2,4,6,"},
-        InputOutputPair{"range(start=0, 8, step=2)", "0,2,4,6,"}
+        InputOutputPair{"range(start=0, 8, step=2)", "0,2,4,6,"},
+        InputOutputPair{"range(0, 10, 3)", "0,3,6,9,"},
+        InputOutputPair{"range(5, -2, -3)", "5,2,-1,"},
+        InputOutputPair{"range(3, 1)", ""},
+        InputOutputPair{"range(5) | reverse", "4,3,2,1,0,"}
         ));
 
 INSTANTIATE_TEST_CASE_P(SequencesLoopTest, RangeForLoopTest, ::testing::Values(
@@ -200,6 +207,30 @@ INSTANTIATE_TEST_CASE_P(SequencesLoopTest, RangeForLoopTest, ::testing::Values(
         InputOutputPair{"{'0'='1'}", "0,"}
         ));
 
+MULTISTR_TEST(ForLoopTest, RangeLoopVariable,
+R"(
+{% for i in range(1, 8, 3) %}
+{{ loop.index }}/{{ loop.length }}:{{ loop.previtem | default('-') }}<{{ i }}>{{ loop.nextitem | default('-') }}{% if loop.last %}!{% endif %}
+{% else %}
+empty
+{% endfor %}
+{% for i in range(0) %}{{ i }}{% else %}empty{% endfor %}|{{ (range(100))[42] }}|{{ range(10, 0, -2) | length }}
+)",
+//-----------
+R"(
+
+1/3:-<1>4
+
+2/3:1<4>7
+
+3/3:4<7>-!
+
+empty|42|5
+)"
+)
+{
+}
+
 MULTISTR_TEST(ForLoopTest, LoopCycleLoop,
 R"(
 {% for i in range(5) %}
@@ -401,6 +432,58 @@ R"(
 {
 }
 
+MULTISTR_TEST(ForLoopTest, ShadowedLoopVariables,
+R"(
+{% for i in outers %}{% for i in inners %}{{i}}{% endfor %}-{{i}};{% endfor %}
+{% for i in outers %}{% set i = i * 10 %}{{i}};{% endfor %}
+{% for i in outers %}{% with i = 'w' %}{{i}}{% endwith %}{{i}};{% endfor %}
+{% for i in outers if i > 0 %}{% for j in inners if j < i %}{{i}}{{j}}{{loop.index}};{% endfor %}{% endfor %}
+{% for i in outers %}{% macro m(i) %}<{{i}}>{% endmacro %}{{m(i + 5)}}{{i}};{% endfor %}
+{% for i in [] %}{{i}}{% else %}{{i}}empty{% endfor %}
+)",
+//---------
+R"(
+01-0;01-1;01-2;
+0;10;20;
+w0;w1;w2;
+101;201;212;
+<5>0;<6>1;<7>2;
+empty
+)"
+)
+{
+    params = {
+        {"outers", ValuesList{0, 1, 2} },
+        {"inners", ValuesList{0, 1}}
+    };
+}
+
+MULTISTR_TEST(ForLoopTest, LoopVariableUsage,
+R"(
+{% macro m() %}{{ loop.index }}{% endmacro %}
+{% for i in outers %}{{ m() }}{% endfor %}
+{% for i in outers %}{% for j in inners %}{{ loop.index }}{% endfor %};{% endfor %}
+{% for i in outers %}{% for j in inners %}{{ j }}{% endfor %}{{ loop.index }};{% endfor %}
+{% for i in outers %}{{ loop.previtem }}{% endfor %}
+{% for i in outers %}{% set outer = loop %}{% for j in inners %}{{ outer.index }}{{ j }}{% endfor %};{% endfor %}
+)",
+//---------
+R"(
+
+123
+12;12;12;
+011;012;013;
+01
+1011;2021;3031;
+)"
+)
+{
+    params = {
+        {"outers", ValuesList{0, 1, 2} },
+        {"inners", ValuesList{0, 1}}
+    };
+}
+
 MULTISTR_TEST(ForLoopTest, GenericListTest_Generator,
 R"(
 {{ input[0] | pprint }}
@@ -427,6 +510,82 @@ none
     };
 }
 
+MULTISTR_TEST(ForLoopTest, LoopRevIndex,
+R"(
+{% for i in items %}{{ loop.revindex }}{{ loop.revindex0 }};{% endfor %}
+{% for i in range(3) %}{{ loop.revindex }}{% endfor %}
+{% for i in items if i > 1 %}{{ loop.revindex }}{% endfor %}
+{% for i in input %}{{ loop.revindex }}/{{ loop.length }};{% endfor %}
+)",
+//---------
+R"(
+32;21;10;
+321
+21
+3/3;2/3;1/3;
+)"
+)
+{
+    params = {
+        {"items", ValuesList{1, 2, 3}},
+        {"input", jinja2::MakeGenericList([cur = 0]() mutable -> nonstd::optional<Value> {
+            if (cur == 3)
+                return nonstd::optional<Value>();
+            return Value(++ cur);
+        }) }
+    };
+}
+
+MULTISTR_TEST(ForLoopTest, DictSortItemsUnpacking,
+R"(
+{% for k, v in values | dictsort %}{{ k }}={{ v }};{% endfor %}
+{% for k, v in {'b'=2, 'a'=1, 'c'=3} | dictsort(by='value', reverse=true) %}{{ loop.index }}:{{ k }}={{ v }};{% endfor %}
+{% for item in values | dictsort %}{{ item.key }};{% endfor %}
+)",
+//---------
+R"(
+a=1;b=2.5;c=text;
+1:c=3;2:b=2;3:a=1;
+a;b;c;
+)"
+)
+{
+    params = {
+        {"values", ValuesMap{{"c", "text"}, {"a", 1}, {"b", 2.5}}}
+    };
+}
+
+// Streamed list is read one item ahead of the loop unless the body needs the size of it
+MULTISTR_TEST(ForLoopTest, GenericListTest_Streaming,
+R"(
+{% for i in input %}{{ i }}:{{ produced() }}{% if loop.last %}!{% endif %};{% endfor %}
+{% for i in sized_input %}{{ loop.length }}:{{ produced() }};{% endfor %}
+)",
+//---------
+R"(
+1:2;2:3;3:4;4:5;5:5!;
+5:10;5:10;5:10;5:10;5:10;
+)"
+)
+{
+    auto producedCount = std::make_shared<int>(0);
+    auto makeInput = [producedCount]() {
+        return jinja2::MakeGenericList([producedCount, cur = 0]() mutable -> nonstd::optional<Value> {
+            if (cur == 5)
+                return nonstd::optional<Value>();
+            ++ *producedCount;
+            return Value(++ cur);
+        });
+    };
+    jinja2::UserCallable produced;
+    produced.callable = [producedCount](auto&) -> jinja2::Value { return *producedCount; };
+    params = {
+        {"input", makeInput()},
+        {"sized_input", makeInput()},
+        {"produced", std::move(produced)}
+    };
+}
+
 using ForLoopTestSingle = SubstitutionTestBase;
 
 TEST_F(ForLoopTestSingle, GenericListTest_InputIterator)
@@ -436,11 +595,13 @@ TEST_F(ForLoopTestSingle, GenericListTest_InputIterator)
 {% for i in input %}>{{ i }}<{% endfor %}
 {% for i in input %}>{{ i }}<{% else %}<empty>{% endfor %}
 )";
-    std::string sampleStr("10 20 30 40 50 60 70 80 90");
-    std::istringstream is(sampleStr);
-
-    ValuesMap params = {
-        {"input", jinja2::MakeGenericList(std::istream_iterator<int>(is), std::istream_iterator<int>()) }
+    // Input is read once, so each render gets its own stream
+    std::vector<std::unique_ptr<std::istringstream>> streams;
+    auto getParams = [&streams]() {
+        streams.push_back(std::make_unique<std::istringstream>("10 20 30 40 50 60 70 80 90"));
+        return ValuesMap{
+            {"input", jinja2::MakeGenericList(std::istream_iterator<int>(*streams.back()), std::istream_iterator<int>()) }
+        };
     };
 
     std::string expectedResult = R"(
@@ -449,7 +610,7 @@ none
 <empty>
 )";
 
-    BasicTemplateRenderer::ExecuteTest<jinja2::Template>(source, expectedResult, params, "Narrow version");
+    BasicTemplateRenderer::ExecuteTest<jinja2::Template>(source, expectedResult, getParams, "Narrow version");
 }
 
 TEST_F(ForLoopTestSingle, GenericListTest_ForwardIterator)
@@ -20,3 +20,19 @@ TEST(Helpers, CompileEscapes)
 }
 
 
+
+TEST(Helpers, AppendConvertedString)
+{
+    std::string narrow = "a";
+    AppendConvertedString(narrow, nonstd::wstring_view(L"bc"));
+    AppendConvertedString(narrow, nonstd::string_view("de"));
+    EXPECT_EQ("abcde", narrow);
+
+    std::wstring wide = L"a";
+    AppendConvertedString(wide, nonstd::string_view("bc"));
+    AppendConvertedString(wide, nonstd::wstring_view(L"de"));
+    EXPECT_EQ(L"abcde", wide);
+
+    EXPECT_EQ(L"name", ConvertString<std::wstring>(std::string("name")));
+    EXPECT_EQ("name", ConvertString<std::string>(std::wstring(L"name")));
+}
@@ -89,6 +89,58 @@ ElseIf branch triggered!
 
 ElseIf 2 branch triggered!
 
+)";
+    EXPECT_EQ(expectedResult, result);
+}
+
+TEST(IfTest, ConstantConditionsTest)
+{
+    std::string source = R"(
+{% if 1 + 1 == 2 %}
+True branch {{ 2 * 3 }}
+{% else %}
+Never rendered
+{% endif %}
+{% if 'abc' | upper == 'XYZ' %}
+Never rendered
+{% elif false %}
+Never rendered
+{% elif Val %}
+Val branch
+{% elif 1 is odd %}
+Constant elif branch
+{% else %}
+Never rendered
+{% endif %}
+{% if false %}Never rendered{% endif %}
+)";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    std::string result = tpl.RenderAsString({{"Val", true}}).value();
+    std::cout << result << std::endl;
+    std::string expectedResult = R"(
+
+True branch 6
+
+
+Val branch
+
+
+)";
+    EXPECT_EQ(expectedResult, result);
+
+    result = tpl.RenderAsString({{"Val", false}}).value();
+    std::cout << result << std::endl;
+    expectedResult = R"(
+
+True branch 6
+
+
+Constant elif branch
+
+
 )";
     EXPECT_EQ(expectedResult, result);
 }
@@ -1,3 +1,4 @@
+#include <future>
 #include <iostream>
 #include <string>
 
@@ -67,3 +68,29 @@ TEST_F(ImportTest, TestImportSyntax)
     Load(R"({% from "foo" import bar, with with context %})");
 }
 
+
+TEST_F(ImportTest, TestMacroModuleReused)
+{
+    AddFile("macros", R"(
+{% macro wrap(text, open='[', close=']') %}{{ open }}{{ text }}{{ close }}{% endmacro %}
+{% macro twice(text) %}{{ wrap(text) }}{{ wrap(text, '<', '>') }}{% endmacro %}
+)");
+    AddFile("globals_module", R"({% set value = gval %}{% macro show() %}{{ value }}{% endmacro %})");
+
+    auto tpl = Load(R"({% import "macros" as m %}{% from "macros" import twice %}{{ m.wrap(foo) }}{{ twice(foo) }})");
+    EXPECT_EQ("[42][42]<42>", tpl.RenderAsString({{"foo", 42}}).value());
+    EXPECT_EQ("[a][a]<a>", tpl.RenderAsString({{"foo", "a"}}).value());
+
+    std::vector<std::future<std::string>> renders;
+    for (int n = 0; n != 4; ++ n)
+        renders.push_back(std::async(std::launch::async, [&tpl, n]() { return tpl.RenderAsString({{"foo", n}}).value(); }));
+    for (int n = 0; n != 4; ++ n)
+        EXPECT_EQ("[" + std::to_string(n) + "][" + std::to_string(n) + "]<" + std::to_string(n) + ">", renders[n].get());
+
+    // Module which depends on the globals is evaluated by every import
+    m_env.AddGlobal("gval", 1);
+    auto globalsTpl = Load(R"({% import "globals_module" as g %}{{ g.show() }})");
+    EXPECT_EQ("1", globalsTpl.RenderAsString({}).value());
+    m_env.AddGlobal("gval", 2);
+    EXPECT_EQ("2", globalsTpl.RenderAsString({}).value());
+}
@@ -126,6 +126,23 @@ TEST_F(IncludeTest, TestMissingIncludesError2)
     EXPECT_EQ("missing2", (*params_iter++).asString());
 }
 
+TEST_F(IncludeTest, TestMissingIncludeInLoopError)
+{
+    jinja2::Template tpl(&m_env);
+    ASSERT_TRUE(!!tpl.Load(R"({% for o in [1, 2, 3] %}{% include "o_printer" %}{% include ["missing", "missing_inner_header"] %}{% endfor %})"));
+
+    auto renderResult = tpl.RenderAsString({});
+    ASSERT_TRUE(!renderResult);
+    auto error = renderResult.error();
+    EXPECT_EQ(jinja2::ErrorCode::TemplateNotFound, error.GetCode());
+    auto& extraParams = error.GetExtraParams();
+    ASSERT_EQ(1ull, extraParams.size());
+    auto filesList = nonstd::get_if<jinja2::GenericList>(&extraParams[0].data());
+    ASSERT_NE(nullptr, filesList);
+    EXPECT_EQ(1ull, filesList->GetSize().value());
+    EXPECT_EQ("missing", (*filesList->begin()).asString());
+}
+
 TEST_F(IncludeTest, TestContextIncludeWithOverrides)
 {
     AddFile("item", "{{ item }}");
@@ -145,3 +162,50 @@ R"({% macro outer(o) %}
 
     EXPECT_EQ("\n\n\n\n(FOO)\n", result);
 }
+
+TEST_F(IncludeTest, TestParallelRender)
+{
+    m_env.GetSettings().parallelRender = true;
+    AddFile("items_printer", "{% for i in items %}{{ i }}{% endfor %}");
+
+    jinja2::ValuesMap params{{"foo", 42}, {"items", jinja2::ValuesList{1, 2, 3}}};
+    auto result = Render(
+R"(<{% include "header" %}|{% block b1 %}{{ foo }}{% for i in items %}{{ i }}{% endfor %}{% endblock %}|{% include "header1" %}|{% include "items_printer" %}>
+{{ inner_foo }}{% block b2 %}{% set x = inner_foo + 1 %}{{ x }}{% endblock %}{% include "header" without context %})", params);
+    EXPECT_EQ("<[42|23]|42123|[42|23]10|123>\n1011[|23]", result);
+
+    jinja2::Template tpl(&m_env);
+    ASSERT_TRUE(!!tpl.Load(R"({% include "header" %}{% include "missing_inner_header" %}{% include "header" %})"));
+    auto renderResult = tpl.RenderAsString(params);
+    ASSERT_TRUE(!renderResult);
+    EXPECT_EQ(jinja2::ErrorCode::TemplateNotFound, renderResult.error().GetCode());
+}
+
+TEST_F(IncludeTest, TestRepeatedIncludeLoadedOnce)
+{
+    auto tpl = Load(R"({% for o in [1, 2, 3] %}{% include "o_printer" %}{% endfor %})");
+
+    for (int n = 0; n != 2; ++ n)
+    {
+        auto statsBefore = m_env.GetCacheStats();
+        EXPECT_EQ("(1)(2)(3)", tpl.RenderAsString({}).value());
+        auto statsAfter = m_env.GetCacheStats();
+        EXPECT_EQ(1u, (statsAfter.hits + statsAfter.misses) - (statsBefore.hits + statsBefore.misses));
+    }
+}
+
+TEST_F(IncludeTest, UsedVariables)
+{
+    AddFile("user_card", "{{ user.name }}{% for p in user.phones %}{{ p.number }}{% endfor %}");
+
+    auto tpl = Load(
+R"({% set title = page.title | upper %}{% include "user_card" %}{% include "header" %}{% include "missing_inner_header" %}
+{% for item in items if item.visible %}{{ loop.index }}{{ item.label }}{{ title }}{% endfor %}
+{% macro show(x) %}{{ x.value }}{{ varargs }}{{ prefix }}{% endmacro %}{{ show(config['mode']) }}
+{% with z = 1 %}{{ z }}{% endwith %}{{ z }}{% for i in range(3) %}{{ i }}{% endfor %}{% set total = total + 1 %})");
+
+    auto usage = tpl.GetUsedVariables();
+    EXPECT_EQ((std::set<std::string>{"bar", "config", "foo", "items", "page", "prefix", "total", "user", "z"}), usage.variables);
+    EXPECT_EQ((std::set<std::string>{"config.mode", "page.title", "user.name", "user.phones"}), usage.attributePaths);
+    EXPECT_EQ((std::vector<std::string>{"missing"}), usage.unresolvedTemplates);
+}
@@ -233,3 +233,62 @@ kwargs: {'extraValue': 5}
 {
     params = PrepareTestData();
 }
+
+MULTISTR_TEST(MacroTest, MacroArgsBinding,
+R"(
+{% macro pos(a, b=2) %}{{ a }}-{{ b }}-{{ varargs | pprint }}{% endmacro %}
+{% macro kw(a, b=2) %}{{ a }}-{{ b }}-{{ kwargs | pprint }}{% endmacro %}
+{% macro opt(a=1, b) %}{{ a }}-{{ b }}{% endmacro %}
+{% macro filtered(a) %}{% filter upper %}{{ a }}{{ varargs | pprint }}{% endfilter %}{% endmacro %}
+{{ pos(1) }}|{{ pos(1, 3, 4) }}|{{ pos(b=5, a=6) }}
+{{ kw(b=5, a=1, c=7) }}|{{ kw(1, c='d') }}
+{{ opt(5) }}|{{ opt(5, 6) }}
+{{ filtered('a', 'x') }}
+)",
+//--------------
+R"(
+
+
+
+
+1-2-[]|1-3-[4]|6-5-[]
+1-5-{'c': 7}|1-2-{'c': 'd'}
+1-5|5-6
+A['X']
+)"
+)
+{
+    params = PrepareTestData();
+}
+
+MULTISTR_TEST(MacroTest, CachedMacro,
+R"(
+{% macro price(value, currency='$') cached %}{{ currency }}{{ value | pprint }}{% if caller is defined %}{{ caller() }}{% endif %}{% endmacro %}
+{% for v in [1, 2, 1, '1', 2.5] %}{{ price(v) }};{% endfor %}
+{{ price(3, currency='EUR') }}|{{ price(currency='EUR', value=3) }}|{{ price([1, 2]) }}
+{% call price(4) %}!{% endcall %}|{% call price(4) %}?{% endcall %}
+)",
+//--------------
+R"(
+
+$1;$2;$1;$'1';$2.5;
+EUR3|EUR3|$[1, 2]
+$4!|$4?
+)"
+)
+{
+    params = PrepareTestData();
+}
+
+TEST(MacroCacheTest, CachedMacroRenderedOnce)
+{
+    const std::string source = R"({% macro icon(kind) cached %}<i>{{ kind }}{{ count() }}</i>{% endmacro %}{{ icon('a') }}{{ icon('b') }}{{ icon('a') }}{{ icon('b') }})";
+
+    int callsCount = 0;
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    const auto result = tpl.RenderAsString({{"count", MakeCallable([&callsCount]() -> Value { return ++ callsCount; })}}).value();
+    EXPECT_EQ("<i>a1</i><i>b2</i><i>a1</i><i>b2</i>", result);
+    EXPECT_EQ(2, callsCount);
+}
@@ -1,8 +1,14 @@
+#include "jinja2cpp/filesystem_handler.h"
 #include "jinja2cpp/template.h"
+#include "jinja2cpp/template_env.h"
 #include "test_tools.h"
 
 #include <nlohmann/json.hpp>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 using namespace jinja2;
 
 TEST(MetadataTest, NoMetadata_EmtpyData)
@@ -144,3 +150,117 @@ TEST(MetadataTest, DISABLED_Metadata_JsonData_Wide)
     EXPECT_FALSE(!renderResult);
     EXPECT_EQ(L"Hello World!", renderResult.value());
 }
+
+TEST(MetadataTest, Metadata_ConcurrentRequests)
+{
+    constexpr auto source = R"({% meta %}{"route": "/index"}{% endmeta %}Hello World!)";
+
+    Template tpl;
+    ASSERT_FALSE(!tpl.Load(source));
+
+    std::vector<std::thread> threads;
+    std::atomic<int> matchedCount{0};
+    for (int n = 0; n < 8; ++ n)
+    {
+        threads.emplace_back([&tpl, &matchedCount]() {
+            auto metadata = tpl.GetMetadata();
+            if (metadata && AsString(metadata.value()["route"]) == "/index")
+                ++ matchedCount;
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(8, matchedCount.load());
+}
+
+TEST(MetadataTest, Metadata_OutlivesTemplate)
+{
+    GenericMap metadata;
+    {
+        Template tpl;
+        ASSERT_FALSE(!tpl.Load(R"({% meta %}{"route": "/index"}{% endmeta %}Hello World!)"));
+        metadata = tpl.GetMetadata().value();
+    }
+
+    EXPECT_EQ("/index", AsString(metadata["route"]));
+}
+
+TEST(MetadataTest, LoadMetadata_BodyIsNotParsed)
+{
+    auto fs = std::make_shared<MemoryFileSystem>();
+    fs->AddFile("index.j2tpl", R"({% meta %}{"route": "/index", "weight": 10}{% endmeta %}{% if %}Invalid body{{ )");
+    fs->AddFile("plain.j2tpl", "Hello World!");
+
+    TemplateEnv env;
+    env.AddFilesystemHandler(std::string(), fs);
+
+    auto metadata = env.LoadMetadata("index.j2tpl");
+    ASSERT_FALSE(!metadata);
+    EXPECT_EQ(2, metadata.value().GetSize());
+    EXPECT_EQ("/index", AsString(metadata.value()["route"]));
+    EXPECT_EQ(10, metadata.value()["weight"].get<int64_t>());
+    EXPECT_TRUE(!env.LoadTemplate("index.j2tpl"));
+
+    auto plainMetadata = env.LoadMetadata("plain.j2tpl");
+    ASSERT_FALSE(!plainMetadata);
+    EXPECT_EQ(0, plainMetadata.value().GetSize());
+
+    auto missing = env.LoadMetadata("missing.j2tpl");
+    ASSERT_TRUE(!missing);
+    EXPECT_EQ(ErrorCode::FileNotFound, missing.error().GetCode());
+}
+
+TEST(MetadataTest, LoadMetadata_Errors)
+{
+    auto fs = std::make_shared<MemoryFileSystem>();
+    fs->AddFile("invalid_json.j2tpl", "\n{% meta %}INVALID JSON{% endmeta %}Hello World!");
+    fs->AddFile("unclosed.j2tpl", "{% meta %}{}Hello World!");
+
+    TemplateEnv env;
+    env.AddFilesystemHandler(std::string(), fs);
+
+    auto metadata = env.LoadMetadata("invalid_json.j2tpl");
+    ASSERT_TRUE(!metadata);
+    EXPECT_EQ("invalid_json.j2tpl:2:1: error: Error occurred during template metadata parsing. Error: Invalid value.\n", metadata.error().ToString());
+
+    metadata = env.LoadMetadata("unclosed.j2tpl");
+    ASSERT_TRUE(!metadata);
+    EXPECT_EQ(ErrorCode::ExpectedMetaEnd, metadata.error().GetCode());
+}
+
+TEST(MetadataTest, LoadMetadata_Caching)
+{
+    auto fs = std::make_shared<MemoryFileSystem>();
+    fs->AddFile("index.j2tpl", R"({% meta %}{"route": "/index"}{% endmeta %}Hello World!)");
+
+    TemplateEnv env;
+    env.AddFilesystemHandler(std::string(), fs);
+
+    auto metadata = env.LoadMetadata("index.j2tpl");
+    ASSERT_FALSE(!metadata);
+    EXPECT_EQ("/index", AsString(metadata.value()["route"]));
+
+    fs->AddFile("index.j2tpl", R"({% meta %}{"route": "/home"}{% endmeta %}Hello World!)");
+    EXPECT_EQ("/index", AsString(env.LoadMetadata("index.j2tpl").value()["route"]));
+
+    env.InvalidateTemplate("index.j2tpl");
+    EXPECT_EQ("/home", AsString(env.LoadMetadata("index.j2tpl").value()["route"]));
+    // Map returned before the invalidation keeps the dropped entry alive
+    EXPECT_EQ("/index", AsString(metadata.value()["route"]));
+
+    std::vector<std::thread> threads;
+    std::atomic<int> matchedCount{0};
+    for (int n = 0; n < 8; ++ n)
+    {
+        threads.emplace_back([&env, &matchedCount]() {
+            auto metadata = env.LoadMetadata("index.j2tpl");
+            if (metadata && AsString(metadata.value()["route"]) == "/home")
+                ++ matchedCount;
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(8, matchedCount.load());
+}
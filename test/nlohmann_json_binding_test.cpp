@@ -175,3 +175,45 @@ true
     params["json"] = jinja2::Reflect(std::move(values));
 }
 
+
+MULTISTR_TEST(NlohmannJsonTest, ReferencedDocumentReflection,
+R"(
+{% for item in json.items %}{{ item.name | upper }}={{ item.value }}{% if item.tags %} [{{ item.tags | join(', ') }}]{% endif %};{% endfor %}
+{{ json.items[1].name }}
+{{ json.title | pprint }}
+)",
+R"(
+FIRST=1 [a, b];SECOND=2;THIRD=3 [c];
+second
+'Items'
+)")
+{
+    static const nlohmann::json values = nlohmann::json::parse(R"(
+{
+    "title": "Items",
+    "items": [
+        {"name": "first", "value": 1, "tags": ["a", "b"]},
+        {"value": 2, "name": "second"},
+        {"tags": ["c"], "name": "third", "value": 3}
+    ]
+}
+)");
+
+    params["json"] = jinja2::Reflect(&values);
+}
+
+TEST(NlohmannJsonReflectionTest, OwnedDocumentOutlivesSource)
+{
+    jinja2::Value item;
+    {
+        nlohmann::json values = {
+            {"items", {{{"name", "first"}}, {{"name", "second"}}}}
+        };
+        auto json = jinja2::Reflect(std::move(values));
+        item = json.get<jinja2::GenericMap>().GetValueByName("items").get<jinja2::GenericList>().GetAccessor()->GetIndexer()->GetItemByIndex(1);
+    }
+
+    auto name = item.get<jinja2::GenericMap>().GetValueByName("name");
+    ASSERT_TRUE(name.isString());
+    EXPECT_EQ("second", name.asString());
+}
@@ -1,9 +1,16 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
+#include "jinja2cpp/filesystem_handler.h"
 #include "jinja2cpp/template.h"
+#include "jinja2cpp/template_env.h"
 
 using namespace jinja2;
 
@@ -55,6 +62,23 @@ TEST(PerfTests, SimpleSubstituteText)
     std::cout << result << std::endl;
 }
 
+TEST(PerfTests, SimpleSubstituteTextSession)
+{
+    std::string source = "{{ message }} from Parser!";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    auto session = tpl.CreateRenderSession({{"message", "Hello World!"}});
+
+    std::cout << session.RenderAsString().value() << std::endl;
+    std::string result;
+    for (int n = 0; n < Iterations * 100; ++ n)
+        result = std::string(session.RenderAsString().value());
+
+    std::cout << result << std::endl;
+}
+
 TEST(PerfTests, ValueSubstituteText)
 {
     std::string source = "{{ message }} from Parser!";
@@ -181,6 +205,185 @@ TEST(PerfTests, ForLoopIfText)
     std::cout << result << std::endl;
 }
 
+TEST(PerfTests, ForLoopScopedSetText)
+{
+    std::string source = "{% for i in range(20)%}{% set sq = i * i %}{% with half = sq / 2 %} {{half}} {% endwith %}{%endfor%}";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    jinja2::ValuesMap params = {};
+
+    std::cout << tpl.RenderAsString(params).value() << std::endl;
+    for (int n = 0; n < Iterations * 20; ++ n)
+        tpl.RenderAsString(params);
+}
+
+TEST(PerfTests, ForLoopConstantsText)
+{
+    std::string source = "{% for i in range(20)%}{{ '<' }}{# item #}{{ i }}{% if true %}: {{ 2 * 10 }}{% endif %}{{ ' | ' | trim }}{{ '>' }}{%endfor%}";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    jinja2::ValuesMap params = {};
+
+    std::cout << tpl.RenderAsString(params).value() << std::endl;
+    for (int n = 0; n < Iterations * 20; ++ n)
+        tpl.RenderAsString(params);
+}
+
+TEST(PerfTests, ArithmeticLoopText)
+{
+    std::string source = "{% for i in range(50) %}{% set price = i * 1.25 + 3 %}{% set total = price * (i + 1) - i / 4 %}"
+                         "{{ total if total > 100 and i != 7 else i - 1 }}{{ '+' if i * 2 >= 40 else '-' }}{% endfor %}";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    jinja2::ValuesMap params = {};
+
+    std::cout << tpl.RenderAsString(params).value() << std::endl;
+    for (int n = 0; n < Iterations * 5; ++ n)
+        tpl.RenderAsString(params);
+}
+
+TEST(PerfTests, StringCompareLoopText)
+{
+    std::string source = "{% for item in items %}{{ item if item == 'item7' or item < 'item2' else '' }}{{ '|' if item != prev }}{% endfor %}";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    jinja2::ValuesList items;
+    for (int n = 0; n < 50; ++ n)
+        items.push_back("item" + std::to_string(n));
+    jinja2::ValuesMap params = {{"items", items}, {"prev", "item0"}};
+
+    std::cout << tpl.RenderAsString(params).value() << std::endl;
+    for (int n = 0; n < Iterations * 5; ++ n)
+        tpl.RenderAsString(params);
+}
+
+TEST(PerfTests, ListValuesText)
+{
+    std::string source = "{% for i in range(20)%}{% set items = [i, i * 2, 'item' ~ i, (i, i)] %} {{items | reverse | first}} {%endfor%}"
+                         "{{range(100) | list | sort(reverse=true) | first}}";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    jinja2::ValuesMap params = {};
+
+    std::cout << tpl.RenderAsString(params).value() << std::endl;
+    for (int n = 0; n < Iterations * 5; ++ n)
+        tpl.RenderAsString(params);
+}
+
+TEST(PerfTests, LargeTemplateLoad)
+{
+    std::string chunk = R"(<tr class="{{ rowClass }}">
+  {% for cell in row %}<td>{{ cell | upper }}</td>{% endfor %}{# cell row #}
+  {% if row | length > 10 %}<td>...</td>{% endif %}
+</tr>
+)";
+    std::string source;
+    for (int n = 0; n < 1000; ++ n)
+        source += chunk;
+
+    for (int n = 0; n < Iterations / 100; ++ n)
+    {
+        Template tpl;
+        ASSERT_TRUE(tpl.Load(source));
+    }
+}
+
+namespace
+{
+const char* ConcurrentTemplateSource = R"(
+{% import 'macros.j2tpl' as m %}{% set title = header | upper %}{{ title }}
+{% for row in rows %}{% for cell in row %}{{ m.cell(cell, loop.index) }}{% endfor %}{{ loop.index }}{% if loop.last %}!{% endif %}
+{% endfor %}{{ meta | join(',') }})";
+
+std::shared_ptr<MemoryFileSystem> MakeConcurrentTestFs()
+{
+    auto fs = std::make_shared<MemoryFileSystem>();
+    fs->AddFile("macros.j2tpl", "{% macro cell(val, idx) %}[{{ idx }}:{{ val | string | replace('1', 'one') }}]{% endmacro %}");
+    return fs;
+}
+
+ValuesMap MakeConcurrentTestParams(int rowsCount)
+{
+    ValuesList rows;
+    for (int n = 0; n < rowsCount; ++ n)
+        rows.push_back(ValuesList{n, n * 10, "str" + std::to_string(n)});
+
+    return {{"header", "concurrent"}, {"rows", std::move(rows)}, {"meta", ValuesList{1, 2, 3}}};
+}
+
+template<typename Fn>
+double RunInThreads(unsigned threadsCount, Fn&& fn)
+{
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned n = 0; n < threadsCount; ++ n)
+        threads.emplace_back(fn);
+    for (auto& t : threads)
+        t.join();
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+TEST(MultithreadingTests, ConcurrentRenderOfSharedTemplate)
+{
+    TemplateEnv env;
+    env.AddFilesystemHandler(std::string(), MakeConcurrentTestFs());
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load(ConcurrentTemplateSource));
+
+    auto params = MakeConcurrentTestParams(10);
+    auto expected = tpl.RenderAsString(params);
+    ASSERT_TRUE(expected.has_value()) << expected.error();
+
+    std::atomic<int> mismatches{0};
+    RunInThreads(16, [&] {
+        for (int n = 0; n < 200; ++ n)
+        {
+            auto result = tpl.RenderAsString(params);
+            if (!result || result.value() != expected.value())
+                ++ mismatches;
+        }
+    });
+
+    EXPECT_EQ(0, mismatches.load());
+}
+
+TEST(PerfTests, ConcurrentRenderThroughput)
+{
+    TemplateEnv env;
+    env.AddFilesystemHandler(std::string(), MakeConcurrentTestFs());
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load(ConcurrentTemplateSource));
+
+    auto params = MakeConcurrentTestParams(20);
+    constexpr int rendersPerThread = Iterations / 10;
+    auto renderFn = [&] {
+        for (int n = 0; n < rendersPerThread; ++ n)
+            tpl.RenderAsString(params);
+    };
+
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double singleThreadTime = RunInThreads(1, renderFn);
+    for (unsigned threadsCount = 1; threadsCount <= maxThreads; threadsCount *= 2)
+    {
+        double time = threadsCount == 1 ? singleThreadTime : RunInThreads(threadsCount, renderFn);
+        double throughput = threadsCount * rendersPerThread / time;
+        std::cout << threadsCount << " thread(s): " << static_cast<long long>(throughput) << " renders/s, scaling "
+                  << threadsCount * singleThreadTime / time << "x" << std::endl;
+    }
+}
+
 TEST(PerfTests, DISABLED_TestMatsuhiko)
 {
     std::string source = R"(
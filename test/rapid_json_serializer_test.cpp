@@ -66,4 +66,23 @@ TEST(RapidJsonSerializerTest, SerializeComplexTypesWithIndention)
 
     EXPECT_EQ(indentedDocument, jsonValue.AsString(4));
 }
+
+TEST(RapidJsonSerializerTest, WriteJson)
+{
+    jinja2::InternalValueList array{ MakeInternalValue<int64_t>(1), MakeInternalValue<std::string>("<a href='#'>&</a>"), jinja2::InternalValue() };
+    jinja2::InternalValueMap map{ { "array", jinja2::ListAdapter::CreateAdapter(std::move(array)) } };
+    const auto value = CreateMapAdapter(std::move(map));
+
+    std::string result;
+    jinja2::rapidjson_serializer::WriteJson(value, result);
+    EXPECT_EQ(R"({"array":[1,"<a href='#'>&</a>",null]})", result);
+
+    result.clear();
+    jinja2::rapidjson_serializer::WriteJson(value, result, 0, true);
+    EXPECT_EQ(R"({"array":[1,"\u003ca href=\u0027#\u0027\u003e\u0026\u003c/a\u003e",null]})", result);
+
+    result.clear();
+    jinja2::rapidjson_serializer::WriteJson(value, result, 2);
+    EXPECT_EQ("{\n  \"array\": [1, \"<a href='#'>&</a>\", null]\n}", result);
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "jinja2cpp/filesystem_handler.h"
+#include "jinja2cpp/template.h"
+#include "jinja2cpp/template_env.h"
+
+using namespace jinja2;
+
+namespace
+{
+const RenderProfileNode* FindNode(const RenderProfile& profile, const std::string& description)
+{
+    for (auto& node : profile.nodes)
+    {
+        if (node.description == description)
+            return &node;
+    }
+    return nullptr;
+}
+} // namespace
+
+TEST(RenderProfileTest, CallTree)
+{
+    MemoryFileSystem fs;
+    fs.AddFile("page.j2tpl", "{% for i in items %}{% include 'item.j2tpl' %}{% endfor %}\n{{ title | upper }}");
+    fs.AddFile("item.j2tpl", "[{{ i }}]");
+
+    TemplateEnv env;
+    env.GetSettings().profileRender = true;
+    env.AddFilesystemHandler(std::string(), fs);
+
+    auto tpl = env.LoadTemplate("page.j2tpl").value();
+    auto result = tpl.RenderAsString({{"items", ValuesList{1, 2, 3}}, {"title", "done"}});
+    ASSERT_TRUE(result.has_value()) << result.error().ToString();
+    EXPECT_EQ("[1][2][3]\nDONE", result.value());
+
+    auto profile = tpl.GetRenderProfile();
+    ASSERT_EQ(4u, profile.nodes.size());
+    auto forNode = FindNode(profile, "{% for i in items %}");
+    auto includeNode = FindNode(profile, "{% include 'item.j2tpl' %}");
+    auto itemNode = FindNode(profile, "{{ i }}");
+    auto titleNode = FindNode(profile, "{{ title | upper }}");
+    ASSERT_TRUE(forNode && includeNode && itemNode && titleNode);
+
+    EXPECT_EQ(RenderProfile::NoParent, forNode->parent);
+    EXPECT_EQ(1u, forNode->callsCount);
+    EXPECT_EQ("page.j2tpl", forNode->location.fileName);
+    EXPECT_EQ(1u, forNode->location.line);
+    EXPECT_EQ(forNode, &profile.nodes[includeNode->parent]);
+    EXPECT_EQ(3u, includeNode->callsCount);
+    EXPECT_EQ(includeNode, &profile.nodes[itemNode->parent]);
+    EXPECT_EQ(3u, itemNode->callsCount);
+    EXPECT_EQ("item.j2tpl", itemNode->location.fileName);
+    EXPECT_EQ(RenderProfile::NoParent, titleNode->parent);
+    EXPECT_EQ(2u, titleNode->location.line);
+    EXPECT_GE(forNode->inclusiveTime, includeNode->inclusiveTime);
+    EXPECT_EQ(forNode->inclusiveTime - includeNode->inclusiveTime, forNode->exclusiveTime);
+
+    tpl.RenderAsString({{"items", ValuesList{1}}, {"title", "done"}});
+    profile = tpl.GetRenderProfile();
+    EXPECT_EQ(4u, profile.nodes.size());
+    EXPECT_EQ(2u, FindNode(profile, "{% for i in items %}")->callsCount);
+    EXPECT_EQ(4u, FindNode(profile, "{{ i }}")->callsCount);
+
+    auto trace = profile.ToChromeTrace();
+    EXPECT_NE(std::string::npos, trace.find("\"traceEvents\""));
+    EXPECT_NE(std::string::npos, trace.find("{% include 'item.j2tpl' %}"));
+
+    tpl.ResetRenderProfile();
+    EXPECT_TRUE(tpl.GetRenderProfile().nodes.empty());
+}
+
+TEST(RenderProfileTest, FoldedStacks)
+{
+    RenderProfile profile;
+    RenderProfileNode root;
+    root.description = "{% for a; b in items %}";
+    root.location.fileName = "page.j2tpl";
+    root.location.line = 1;
+    root.parent = RenderProfile::NoParent;
+    root.exclusiveTime = std::chrono::nanoseconds(100);
+    profile.nodes.push_back(root);
+
+    RenderProfileNode child;
+    child.description = "{{ a }}";
+    child.location.fileName = "page.j2tpl";
+    child.location.line = 2;
+    child.parent = 0;
+    child.exclusiveTime = std::chrono::nanoseconds(50);
+    profile.nodes.push_back(child);
+
+    EXPECT_EQ("page.j2tpl:1 {% for a, b in items %} 100\n"
+              "page.j2tpl:1 {% for a, b in items %};page.j2tpl:2 {{ a }} 50\n", profile.ToFoldedStacks());
+}
+
+TEST(RenderProfileTest, DisabledByDefault)
+{
+    MemoryFileSystem fs;
+    fs.AddFile("page.j2tpl", "{% for i in items %}{{ i }}{% endfor %}");
+
+    TemplateEnv env;
+    env.AddFilesystemHandler(std::string(), fs);
+
+    auto tpl = env.LoadTemplate("page.j2tpl").value();
+    EXPECT_EQ("123", tpl.RenderAsString({{"items", ValuesList{1, 2, 3}}}).value());
+    EXPECT_TRUE(tpl.GetRenderProfile().nodes.empty());
+}
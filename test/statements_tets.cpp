@@ -4,6 +4,7 @@
 #include "gtest/gtest.h"
 
 #include "jinja2cpp/template.h"
+#include "jinja2cpp/template_env.h"
 
 #include "test_tools.h"
 
@@ -225,6 +226,80 @@ TEST(FilterStatement, ChainAndParams)
     EXPECT_STREQ("\n9+8+7+6+5+4+3+2+1+0\n", result.c_str());
 }
 
+TEST(FilterStatement, NestedInLoop)
+{
+    const std::string source = R"({% for s in ['long item text', 'a', 'bc'] %}{% filter upper %}{{ s }}{% filter replace('-', '+') %}-{{ loop.index }}-{% endfilter %}|{% endfilter %}{% endfor %})";
+
+    Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    for (int n = 0; n != 2; ++ n)
+    {
+        const auto result = tpl.RenderAsString({}).value();
+        EXPECT_STREQ("LONG ITEM TEXT+1+|A+2+|BC+3+|", result.c_str());
+    }
+}
+
+TEST(CacheStatement, General)
+{
+    const std::string source = R"({% cache 'header', 60 %}Hello {{ name }}!{% endcache %}|{{ name }})";
+
+    TemplateEnv env;
+    env.GetSettings().extensions.Cache = true;
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load(source));
+
+    EXPECT_EQ("Hello World!|World", tpl.RenderAsString({{"name", "World"}}).value());
+    EXPECT_EQ("Hello World!|Jinja2", tpl.RenderAsString({{"name", "Jinja2"}}).value());
+}
+
+TEST(CacheStatement, KeyVariation)
+{
+    const std::string source = R"({% for lang in langs %}{% cache lang %}{{ lang }}-{{ suffix }}|{% endcache %}{% endfor %})";
+
+    TemplateEnv env;
+    env.GetSettings().extensions.Cache = true;
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load(source));
+
+    EXPECT_EQ("en-1|de-1|", tpl.RenderAsString({{"langs", ValuesList{"en", "de"}}, {"suffix", 1}}).value());
+    EXPECT_EQ("de-1|fr-2|en-1|", tpl.RenderAsString({{"langs", ValuesList{"de", "fr", "en"}}, {"suffix", 2}}).value());
+}
+
+TEST(CacheStatement, EscapedFragment)
+{
+    const std::string source = R"({% cache 'k' %}{{ value }}{% endcache %})";
+
+    TemplateEnv env;
+    env.GetSettings().extensions.Cache = true;
+    env.GetSettings().autoescape = true;
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load(source));
+
+    for (int n = 0; n != 2; ++ n)
+        EXPECT_EQ("&lt;b&gt;", tpl.RenderAsString({{"value", "<b>"}}).value());
+}
+
+TEST(CacheStatement, WithoutStorage)
+{
+    const std::string source = R"({% cache 'k' %}{{ value }}{% endcache %})";
+
+    TemplateEnv env;
+    env.GetSettings().extensions.Cache = true;
+    env.SetFragmentCache(FragmentCachePtr());
+    Template tpl(&env);
+    ASSERT_TRUE(tpl.Load(source));
+
+    EXPECT_EQ("1", tpl.RenderAsString({{"value", 1}}).value());
+    EXPECT_EQ("2", tpl.RenderAsString({{"value", 2}}).value());
+}
+
+TEST(CacheStatement, ExtensionDisabled)
+{
+    Template tpl;
+    EXPECT_FALSE(tpl.Load("{% cache 'k' %}{% endcache %}"));
+}
+
 TEST(SetBlockStatement, OneVar)
 {
     const std::string source = R"(
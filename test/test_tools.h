@@ -121,13 +121,41 @@ inline void StringToConsole(const std::wstring& str)
 class BasicTemplateRenderer : public ::testing::Test
 {
 public:
+    // Produces the separate set of params for each render (e.g. params with the single-pass lists)
+    using ParamsGetter = std::function<jinja2::ValuesMap ()>;
+
     template<typename TemplateT, typename CharT>
     static void ExecuteTest(const std::basic_string<CharT>& source,
                             const std::basic_string<CharT>& expectedResult,
                             const jinja2::ValuesMap& params,
                             const char* version = "")
+    {
+        ExecuteTest<TemplateT>(source, expectedResult, ParamsGetter([&params]() { return params; }), version);
+    }
+
+    // Renders the template with both engines. The AST one is the reference, the bytecode one should produce the same output
+    template<typename TemplateT, typename CharT>
+    static void ExecuteTest(const std::basic_string<CharT>& source,
+                            const std::basic_string<CharT>& expectedResult,
+                            const ParamsGetter& getParams,
+                            const char* version = "")
     {
         TemplateT tpl;
+        ExecuteTest(tpl, source, expectedResult, getParams(), version);
+
+        jinja2::TemplateEnv env;
+        env.GetSettings().renderEngine = jinja2::RenderEngine::Bytecode;
+        TemplateT bytecodeTpl(&env);
+        ExecuteTest(bytecodeTpl, source, expectedResult, getParams(), (std::string(version) + " (bytecode engine)").c_str());
+    }
+
+    template<typename TemplateT, typename CharT>
+    static void ExecuteTest(TemplateT& tpl,
+                            const std::basic_string<CharT>& source,
+                            const std::basic_string<CharT>& expectedResult,
+                            const jinja2::ValuesMap& params,
+                            const char* version)
+    {
         auto parseRes = tpl.Load(source);
         EXPECT_TRUE(parseRes.has_value()) << version;
         if (!parseRes)
@@ -149,9 +177,9 @@ public:
     }
 
     template<typename TemplateT, typename CharT>
-    void PerformTest(const std::basic_string<CharT>& source, const std::basic_string<CharT>& expectedResult, const jinja2::ValuesMap& params)
+    void PerformTest(const std::basic_string<CharT>& source, const std::basic_string<CharT>& expectedResult, const ParamsGetter& getParams)
     {
-        ExecuteTest<TemplateT>(source, expectedResult, params);
+        ExecuteTest<TemplateT>(source, expectedResult, getParams);
     }
 };
 
@@ -232,10 +260,13 @@ protected:
 #define MULTISTR_TEST_IMPL(Fixture, TestName, StringT, TemplateT, Tpl, Result, ParamsGetter)                                                                   \
     TEST_F(Fixture, TestName)                                                                                                                                  \
     {                                                                                                                                                          \
-        jinja2::ValuesMap params;                                                                                                                              \
-        ParamsGetter(params, *this);                                                                                                                           \
+        auto getParams = [this]() {                                                                                                                            \
+            jinja2::ValuesMap params;                                                                                                                          \
+            ParamsGetter(params, *this);                                                                                                                       \
+            return params;                                                                                                                                     \
+        };                                                                                                                                                     \
                                                                                                                                                                \
-        PerformTest<TemplateT>(StringT(Tpl), StringT(Result), params);                                                                                         \
+        PerformTest<TemplateT>(StringT(Tpl), StringT(Result), getParams);                                                                                      \
     }
 
 #define MULTISTR_TEST(Fixture, TestName, Tpl, Result)                                                                                                          \
@@ -247,9 +247,35 @@ INSTANTIATE_TEST_CASE_P(InTest, TestersGenericTest, ::testing::Values(
                             InputOutputPair{"0 in intList",             "true"},
                             InputOutputPair{"1000 in intList",          "false"},
                             InputOutputPair{"'string9' in stringList",  "true"},
-                            InputOutputPair{"'string90' in stringList", "false"}
+                            InputOutputPair{"'string90' in stringList", "false"},
+                            InputOutputPair{"'b' in ['a', 'b']",        "true"},
+                            InputOutputPair{"'c' in ['a', 'b']",        "false"},
+                            InputOutputPair{"1.0 in (2, 1, 0)",         "true"},
+                            InputOutputPair{"1 in ['1', 2.5]",          "false"},
+                            InputOutputPair{"'intVal' in mapValue",     "true"},
+                            InputOutputPair{"'intval' in mapValue",     "false"},
+                            InputOutputPair{"10 in mapValue",           "false"}
                             ));
 
+TEST(TestersTest, IndexedMembershipTests)
+{
+    jinja2::ValuesList blocked;
+    for (int n = 0; n != 100; n += 2)
+        blocked.push_back("sku" + std::to_string(n));
+
+    jinja2::TemplateEnv env;
+    env.GetSettings().indexMembershipTests = true;
+    jinja2::Template tpl(&env);
+    ASSERT_TRUE(!!tpl.Load("{% for n in range(10) %}{{ 'x' if ('sku' ~ n) in blocked else '-' }}{% endfor %}|{{ 1.0 in doubles }}"));
+
+    jinja2::ValuesList doubles;
+    for (int n = 0; n != 20; ++ n)
+        doubles.push_back(n * 0.5);
+    auto result = tpl.RenderAsString({{"blocked", blocked}, {"doubles", doubles}});
+    ASSERT_TRUE(!!result) << result.error().ToString();
+    EXPECT_EQ("x-x-x-x-x-|true", result.value());
+}
+
 INSTANTIATE_TEST_CASE_P(EvenTest, TestersGenericTest, ::testing::Values(
                             InputOutputPair{"0 is even",              "true"},
                             InputOutputPair{"11 is even",             "false"},
@@ -164,6 +164,35 @@ https://google.com?label1label1label1#someTarget
                                    jinja2::ArgInfo{ "targetStr", false, "" });
 }
 
+MULTISTR_TEST(UserCallableTest, PositionalArgsBinding,
+R"(
+{{ fmt('Hello', 3) }}|{{ fmt('Hello') }}|{{ fmt(count=2, str='Hi') }}|{{ fmt('Hi', count=1) }}
+{% set s = echo(text) %}{{ s }}|{{ echo('World') ~ '!' }}
+{{ opt_first(2) }}|{{ opt_first(1, 2) }}|{{ opt_first(val2=5) }}
+)",
+//-------------
+R"(
+HelloHelloHello|Hello|HiHi|Hi
+Text Value|World!
+0-2|1-2|0-5
+)"
+)
+{
+    params["fmt"] = MakeCallable(
+        [](nonstd::string_view str, int64_t count) {
+            std::string result;
+            for (int64_t n = 0; n < count; ++ n)
+                result.append(str.begin(), str.end());
+            return result;
+        },
+        ArgInfoT<nonstd::string_view>{"str", true}, ArgInfoT<int64_t>{"count", false, 1});
+    params["echo"] = MakeCallable([](const std::string& val) { return val; }, ArgInfo{"val", true});
+    params["opt_first"] = MakeCallable(
+        [](int64_t val1, int64_t val2) { return std::to_string(val1) + "-" + std::to_string(val2); },
+        ArgInfoT<int64_t>{"val1", false, 0}, ArgInfoT<int64_t>{"val2", true});
+    params["text"] = "Text Value";
+}
+
 TEST(UserCallableTestSingle, ReflectedCallable)
 {
     std::string source = R"(
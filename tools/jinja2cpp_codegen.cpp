@@ -0,0 +1,691 @@
+// Generates the render code of the fixed templates. The template is parsed at build time and the generated source renders it without
+// the tree walk: static text is written from the string literals, 'if', 'for' and 'set' statements become the C++ control flow and the
+// expressions become the direct calls of the values, filters and testers runtime. The rest of the statements and expressions (e.g.
+// macros, blocks or dictionaries) are rendered by the nodes of the tree loaded from the compiled image (see Template::SaveCompiled),
+// which is embedded into the source along with the template text, so nothing is parsed at startup.
+// Generated code uses the internal headers of the library. See Jinja2CppGenerateTemplate CMake function (cmake/jinja2cpp_codegen.cmake)
+// for the build integration
+#include "../src/generated_template.h"
+
+#include <jinja2cpp/template.h>
+#include <jinja2cpp/template_env.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+using namespace jinja2;
+
+struct Options
+{
+    std::string templatePath;
+    std::string headerPath;
+    std::string sourcePath;
+    std::string functionName;
+    std::string namespaceName;
+    Settings settings;
+};
+
+void PrintUsage()
+{
+    std::cerr << "Usage: jinja2cpp_codegen --name <function> [--namespace <namespace>] [--trim-blocks] [--lstrip-blocks] [--autoescape]\n"
+                 "                         <template file> <output header> <output source>" << std::endl;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    std::vector<std::string> files;
+    for (int n = 1; n < argc; ++ n)
+    {
+        std::string arg = argv[n];
+        if (arg == "--name" && n + 1 < argc)
+            options.functionName = argv[++ n];
+        else if (arg == "--namespace" && n + 1 < argc)
+            options.namespaceName = argv[++ n];
+        else if (arg == "--trim-blocks")
+            options.settings.trimBlocks = true;
+        else if (arg == "--lstrip-blocks")
+            options.settings.lstripBlocks = true;
+        else if (arg == "--autoescape")
+            options.settings.autoescape = true;
+        else if (!arg.empty() && arg[0] != '-')
+            files.push_back(std::move(arg));
+        else
+            return false;
+    }
+
+    if (files.size() != 3 || options.functionName.empty())
+        return false;
+
+    options.templatePath = files[0];
+    options.headerPath = files[1];
+    options.sourcePath = files[2];
+    return true;
+}
+
+std::string GetFileName(const std::string& path)
+{
+    auto pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// Every line of the text becomes the separate literal. Non-printable and non-ASCII chars are written as octal escapes
+void WriteStringLiteral(std::ostream& os, const std::string& text)
+{
+    os << "\"";
+    for (size_t n = 0; n != text.size(); ++ n)
+    {
+        auto ch = static_cast<unsigned char>(text[n]);
+        switch (ch)
+        {
+        case '\\': os << "\\\\"; break;
+        case '"': os << "\\\""; break;
+        case '\t': os << "\\t"; break;
+        case '\r': os << "\\r"; break;
+        case '\n':
+            os << "\\n\"";
+            if (n + 1 != text.size())
+                os << "\n    \"";
+            else
+                return;
+            break;
+        case '?': os << "\\?"; break; // Trigraphs
+        default:
+            if (ch < 0x20 || ch >= 0x7f)
+            {
+                char buff[8];
+                std::snprintf(buff, sizeof(buff), "\\%03o", ch);
+                os << buff;
+            }
+            else
+                os << static_cast<char>(ch);
+        }
+    }
+    os << "\"";
+}
+
+void WriteByteArray(std::ostream& os, const std::string& data)
+{
+    for (size_t n = 0; n != data.size(); ++ n)
+    {
+        os << (n % 16 == 0 ? "\n    " : " ") << static_cast<unsigned>(static_cast<unsigned char>(data[n])) << ",";
+    }
+    os << "\n";
+}
+
+// Local variable of the generated code. Literals of the template are borrowed from the tree (as the const references), not copied
+struct Var
+{
+    std::string name;
+    bool isOwned;
+};
+
+// Generates the render functions of the tree. Loop bodies (and else bodies of the loops) are the separate functions, so the render
+// stopped by the error returns from the body without skipping the exit from the loop scope. The rest of the statements are inlined
+// into the function of the enclosing body. Each function has the same signature as GeneratedRenderFn
+class CodeGenerator
+{
+public:
+    explicit CodeGenerator(const GeneratedTemplateNodes& nodes)
+        : m_nodes(nodes)
+    {
+    }
+
+    // Returns the name of the root render function
+    std::string Generate(const RendererPtr& root) { return GenerateBody(root); }
+
+    std::string GetConstants() const { return m_constants.str(); }
+    std::string GetFunctions() const { return m_functions.str(); }
+
+private:
+    struct Function
+    {
+        std::ostringstream code;
+        int indent = 1;
+        bool usesOs = false;
+        bool usesValues = false;
+        bool usesNodes = false;
+        // Indent of the check of the error after the last statement. It's written once the next statement of the same body follows
+        int checkIndent = -1;
+    };
+
+    std::string GenerateBody(const RendererPtr& body);
+    void WriteStatement(const RendererPtr& renderer);
+    void WriteBlock(const RendererPtr& body);
+    void WriteOutput(const ExpressionRenderer& renderer);
+    void WriteIf(IfStatement& stmt);
+    void WriteElseBranches(IfStatement& stmt, size_t idx);
+    void WriteFor(ForStatement& stmt);
+    Var WriteExpression(const ExpressionEvaluatorPtr<>& expr);
+    Var WriteFilter(const ExpressionFilter& filter, const Var& value);
+    Var Declare(const std::string& init);
+    Var Owned(const Var& value);
+    static std::string Move(const Var& value) { return value.isOwned ? "std::move(" + value.name + ")" : value.name; }
+
+    std::ostream& Line();
+    Function& Current() { return *m_stack.back(); }
+    std::string Os() { Current().usesOs = true; return "os"; }
+    std::string Values() { Current().usesValues = true; return "values"; }
+    std::string Node(const std::string& getter, const void* node);
+    std::string RendererNode(const std::string& getter, const RendererBase* renderer) { return Node(getter, renderer); }
+    std::string ExpressionNode(const std::string& getter, const ExpressionEvaluatorBase* expr) { return Node(getter, expr); }
+    std::string AddText(const RawTextRenderer& text);
+    std::string AddName(const std::string& name);
+
+private:
+    const GeneratedTemplateNodes& m_nodes;
+    std::ostringstream m_constants;
+    std::ostringstream m_functions;
+    std::vector<std::unique_ptr<Function>> m_stack;
+    // Loops rendered by the generated code. Their variables are taken from the slots directly
+    std::unordered_map<const void*, std::string> m_loops;
+    std::unordered_map<std::string, std::string> m_names;
+    size_t m_functionsCount = 0;
+    size_t m_textsCount = 0;
+    size_t m_varsCount = 0;
+};
+
+std::string CodeGenerator::GenerateBody(const RendererPtr& body)
+{
+    auto name = "Render" + std::to_string(m_functionsCount ++);
+    m_stack.push_back(std::make_unique<Function>());
+    WriteStatement(body);
+    auto fn = std::move(m_stack.back());
+    m_stack.pop_back();
+
+    m_functions << "void " << name << "(OutStream& " << (fn->usesOs ? "os" : "/*os*/")
+                << ", RenderContext& " << (fn->usesValues ? "values" : "/*values*/")
+                << ", const GeneratedTemplateNodes& " << (fn->usesNodes ? "nodes" : "/*nodes*/") << ")\n{\n"
+                << fn->code.str() << "}\n\n";
+    return name;
+}
+
+// Same as the tree render, the body stops after the statement which reported the error
+void CodeGenerator::WriteStatement(const RendererPtr& renderer)
+{
+    auto r = renderer.get();
+    if (!r)
+        return;
+
+    auto composed = dynamic_cast<ComposedRenderer*>(r);
+    if (composed && !composed->IsParallel())
+    {
+        for (auto& child : composed->GetRenderers())
+            WriteStatement(child);
+        return;
+    }
+
+    auto setStmt = dynamic_cast<SetLineStatement*>(r);
+    if (setStmt && !setStmt->GetExpression())
+        return;
+
+    if (auto text = dynamic_cast<RawTextRenderer*>(r))
+    {
+        if (text->GetLength() == 0)
+            return;
+        auto textName = AddText(*text);
+        Line() << Os() << ".WriteStaticBuffer(" << textName << ", " << text->GetLength() << ");\n";
+    }
+    else if (dynamic_cast<ExpressionRenderer*>(r) || dynamic_cast<IfStatement*>(r) || dynamic_cast<ForStatement*>(r) || setStmt)
+    {
+        Line() << "{\n";
+        ++ Current().indent;
+        if (auto expr = dynamic_cast<ExpressionRenderer*>(r))
+            WriteOutput(*expr);
+        else if (auto ifStmt = dynamic_cast<IfStatement*>(r))
+            WriteIf(*ifStmt);
+        else if (auto forStmt = dynamic_cast<ForStatement*>(r))
+            WriteFor(*forStmt);
+        else
+        {
+            auto value = WriteExpression(setStmt->GetExpression());
+            auto node = RendererNode("GetRenderer<SetLineStatement>", setStmt);
+            Line() << node << "->AssignBody(" << Move(value) << ", " << Values() << ");\n";
+        }
+        -- Current().indent;
+        Line() << "}\n";
+    }
+    else
+    {
+        auto node = RendererNode("GetRenderer", r);
+        Line() << node << "->Render(" << Os() << ", " << Values() << ");\n";
+    }
+
+    Current().checkIndent = Current().indent;
+}
+
+void CodeGenerator::WriteBlock(const RendererPtr& body)
+{
+    Line() << "{\n";
+    ++ Current().indent;
+    WriteStatement(body);
+    -- Current().indent;
+    Line() << "}\n";
+}
+
+// Calls are rendered directly to the output (see CallExpression::Render), the rest of the expressions are evaluated and written
+void CodeGenerator::WriteOutput(const ExpressionRenderer& renderer)
+{
+    auto expr = renderer.GetExpression();
+    auto full = dynamic_cast<FullExpressionEvaluator*>(expr.get());
+    while (full && !full->GetTester() && full->GetExpression())
+    {
+        expr = full->GetExpression();
+        full = dynamic_cast<FullExpressionEvaluator*>(expr.get());
+    }
+
+    auto autoescape = renderer.IsAutoescape() ? "true" : "false";
+    if (auto call = dynamic_cast<CallExpression*>(expr.get()))
+    {
+        auto fn = WriteExpression(call->GetValueRef());
+        auto node = ExpressionNode("GetExpression<CallExpression>", call);
+        Line() << "bool prevAutoescape = " << Os() << ".SetAutoescape(" << autoescape << ");\n";
+        Line() << node << "->RenderCall(" << Move(fn) << ", os, " << Values() << ");\n";
+        Line() << "os.SetAutoescape(prevAutoescape);\n";
+        return;
+    }
+
+    auto value = WriteExpression(expr);
+    Line() << "bool prevAutoescape = " << Os() << ".SetAutoescape(" << autoescape << ");\n";
+    Line() << "os.WriteValue(" << value.name << ");\n";
+    Line() << "os.SetAutoescape(prevAutoescape);\n";
+}
+
+void CodeGenerator::WriteIf(IfStatement& stmt)
+{
+    auto cond = WriteExpression(stmt.GetCondition());
+    Line() << "if (ConvertToBool(" << cond.name << "))\n";
+    WriteBlock(stmt.GetMainBody());
+    WriteElseBranches(stmt, 0);
+}
+
+// Condition of the branch is evaluated only if the previous ones are false. Branches after the unconditional one are never rendered
+void CodeGenerator::WriteElseBranches(IfStatement& stmt, size_t idx)
+{
+    auto& branches = stmt.GetElseBranches();
+    if (idx == branches.size())
+        return;
+
+    auto& branch = branches[idx];
+    Line() << "else\n";
+    if (!branch->GetCondition())
+    {
+        WriteBlock(branch->GetMainBody());
+        return;
+    }
+
+    Line() << "{\n";
+    ++ Current().indent;
+    auto cond = WriteExpression(branch->GetCondition());
+    Line() << "if (ConvertToBool(" << cond.name << "))\n";
+    WriteBlock(branch->GetMainBody());
+    WriteElseBranches(stmt, idx + 1);
+    -- Current().indent;
+    Line() << "}\n";
+}
+
+// Items are iterated by ForStatement::LoopIterator, the same as by the tree render (see ForStatement::RenderLoop)
+void CodeGenerator::WriteFor(ForStatement& stmt)
+{
+    auto items = WriteExpression(stmt.GetLoopValue());
+    auto loop = RendererNode("GetRenderer<ForStatement>", &stmt);
+    m_loops[static_cast<const void*>(&stmt)] = loop;
+    auto& mainBody = stmt.GetMainBody();
+    auto body = mainBody ? GenerateBody(mainBody) : std::string();
+    auto& elseBody = stmt.GetElseBody();
+    auto elseFn = elseBody ? GenerateBody(elseBody) : std::string();
+
+    Line() << "ForStatement::LoopIterator it(" << loop << ", " << items.name << ", " << Values() << ", 0);\n";
+    Line() << "while (it.MoveNext())\n";
+    Line() << "{\n";
+    Line() << "    values.EnterScope();\n";
+    if (!body.empty())
+        Line() << "    " << body << "(" << Os() << ", values, nodes);\n";
+    Line() << "    values.ExitScope();\n";
+    Line() << "    if (values.HasError())\n";
+    Line() << "        break;\n";
+    Line() << "}\n";
+    if (!elseFn.empty())
+    {
+        Line() << "if (it.Finish())\n";
+        Line() << "    " << elseFn << "(" << Os() << ", values, nodes);\n";
+    }
+    else
+        Line() << "it.Finish();\n";
+    Line() << "values.ExitScope();\n";
+}
+
+// Expressions are written as the sequence of the local variables, one per node. The order of the evaluation is the same as the tree's one
+Var CodeGenerator::WriteExpression(const ExpressionEvaluatorPtr<>& expr)
+{
+    auto e = expr.get();
+    if (!e)
+        return Declare("InternalValue()");
+
+    if (auto literal = e->GetLiteralValue())
+    {
+        Var result{"v" + std::to_string(m_varsCount ++), false};
+        auto node = Node("GetLiteral", literal);
+        Line() << "const InternalValue& " << result.name << " = " << node << ";\n";
+        return result;
+    }
+
+    if (auto full = dynamic_cast<FullExpressionEvaluator*>(e))
+    {
+        if (!full->GetExpression())
+            return Declare("InternalValue()");
+
+        auto value = WriteExpression(full->GetExpression());
+        auto& tester = full->GetTester();
+        if (!tester)
+            return value;
+
+        // 'value if condition else alt': the value is replaced with the alternative one if the condition is false
+        auto result = Owned(value);
+        auto cond = WriteExpression(tester->GetTestExpression());
+        Line() << "if (!ConvertToBool(" << cond.name << "))\n";
+        Line() << "{\n";
+        ++ Current().indent;
+        auto alt = WriteExpression(tester->GetAltValue());
+        Line() << result.name << " = " << Move(alt) << ";\n";
+        -- Current().indent;
+        Line() << "}\n";
+        return result;
+    }
+
+    if (auto ref = dynamic_cast<ValueRefExpression*>(e))
+    {
+        auto name = AddName(ref->GetHashedName().GetName());
+        auto owner = ref->GetSlotOwner();
+        if (!owner)
+            return Declare("FindGeneratedVar(" + Values() + ", " + name + ")");
+
+        auto loop = m_loops.find(owner);
+        if (loop != m_loops.end())
+            return Declare("FindGeneratedVar(" + Values() + ", " + name + ", " + loop->second + ", " + std::to_string(ref->GetSlotIndex()) + ")");
+    }
+    else if (auto subscript = dynamic_cast<SubscriptExpression*>(e))
+    {
+        auto value = Owned(WriteExpression(subscript->GetValue()));
+        auto node = ExpressionNode("GetExpression<SubscriptExpression>", subscript);
+        for (size_t n = 0; n != subscript->GetIndicesCount(); ++ n)
+        {
+            std::string index = "nullptr";
+            if (!subscript->IsNamedIndex(n))
+                index = "&" + WriteExpression(subscript->GetIndex(n)).name;
+            Line() << node << "->ApplyIndex(" << n << ", " << value.name << ", " << index << ", " << Values() << ");\n";
+        }
+        return value;
+    }
+    else if (auto filtered = dynamic_cast<FilteredExpression*>(e))
+    {
+        auto value = WriteExpression(filtered->GetExpression());
+        return WriteFilter(*filtered->GetFilter(), value);
+    }
+    else if (auto unary = dynamic_cast<UnaryExpression*>(e))
+    {
+        auto value = WriteExpression(unary->GetExpression());
+        const char* operation = "LogicalNot";
+        if (unary->GetOperation() == UnaryExpression::UnaryPlus)
+            operation = "UnaryPlus";
+        else if (unary->GetOperation() == UnaryExpression::UnaryMinus)
+            operation = "UnaryMinus";
+        return Declare("Apply<visitors::UnaryOperation>(" + value.name + ", UnaryExpression::" + operation + ")");
+    }
+    else if (auto test = dynamic_cast<IsExpression*>(e))
+    {
+        auto value = WriteExpression(test->GetValue());
+        return Declare(Node("GetTester", test->GetTester().get()) + "->Test(" + value.name + ", " + Values() + ")");
+    }
+    else if (auto binary = dynamic_cast<BinaryExpression*>(e))
+    {
+        auto left = WriteExpression(binary->GetLeftExpression());
+        if (binary->GetOperation() == BinaryExpression::In)
+            return Declare(Node("GetTester", binary->GetInTester().get()) + "->Test(" + left.name + ", " + Values() + ")");
+
+        auto right = WriteExpression(binary->GetRightExpression());
+        auto leftTemp = left.isOwned ? "&" + left.name : std::string("nullptr");
+        return Declare(ExpressionNode("GetExpression<BinaryExpression>", binary) + "->Evaluate(" + left.name + ", " + right.name + ", " + leftTemp + ", " + Values() + ")");
+    }
+    else if (auto tuple = dynamic_cast<TupleCreator*>(e))
+    {
+        std::vector<Var> items;
+        for (auto& item : tuple->GetExprs())
+            items.push_back(WriteExpression(item));
+        auto list = "list" + std::to_string(m_varsCount ++);
+        Line() << "InternalValueList " << list << ";\n";
+        for (auto& item : items)
+            Line() << list << ".push_back(" << Move(item) << ");\n";
+        return Declare("ListAdapter::CreateAdapter(std::move(" + list + "))");
+    }
+    else if (auto call = dynamic_cast<CallExpression*>(e))
+    {
+        auto fn = WriteExpression(call->GetValueRef());
+        Line() << Values() << ".CountStep();\n";
+        return Declare("values.HasError() ? InternalValue() : " + ExpressionNode("GetExpression<CallExpression>", call) + "->Call(" + fn.name + ", values)");
+    }
+
+    return Declare(ExpressionNode("GetExpression", e) + "->Evaluate(" + Values() + ")");
+}
+
+// Parent filters of the chain are applied first
+Var CodeGenerator::WriteFilter(const ExpressionFilter& filter, const Var& value)
+{
+    auto base = value;
+    if (auto& parent = filter.GetParentFilter())
+        base = WriteFilter(*parent, value);
+
+    return Declare(Node("GetFilter", filter.GetFilter().get()) + "->Filter(" + base.name + ", " + Values() + ")");
+}
+
+Var CodeGenerator::Declare(const std::string& init)
+{
+    Var result{"v" + std::to_string(m_varsCount ++), true};
+    Line() << "InternalValue " << result.name << " = " << init << ";\n";
+    return result;
+}
+
+Var CodeGenerator::Owned(const Var& value)
+{
+    return value.isOwned ? value : Declare(value.name);
+}
+
+std::ostream& CodeGenerator::Line()
+{
+    auto& fn = Current();
+    auto indent = std::string(static_cast<size_t>(fn.indent) * 4, ' ');
+    if (fn.checkIndent == fn.indent)
+    {
+        fn.usesValues = true;
+        fn.code << indent << "if (values.HasError())\n" << indent << "    return;\n";
+    }
+    fn.checkIndent = -1;
+
+    fn.code << indent;
+    return fn.code;
+}
+
+std::string CodeGenerator::Node(const std::string& getter, const void* node)
+{
+    auto idx = m_nodes.IndexOf(node);
+    if (idx == GeneratedTemplateNodes::npos)
+        throw std::runtime_error("Node of the template tree isn't collected for the generated code");
+
+    Current().usesNodes = true;
+    return "nodes." + getter + "(" + std::to_string(idx) + ")";
+}
+
+std::string CodeGenerator::AddText(const RawTextRenderer& text)
+{
+    auto name = "Text" + std::to_string(m_textsCount ++);
+    m_constants << "const char " << name << "[] =\n    ";
+    WriteStringLiteral(m_constants, std::string(static_cast<const char*>(text.GetPtr()), text.GetLength()));
+    m_constants << ";\n";
+    return name;
+}
+
+std::string CodeGenerator::AddName(const std::string& name)
+{
+    auto p = m_names.find(name);
+    if (p != m_names.end())
+        return p->second;
+
+    auto constName = "Name" + std::to_string(m_names.size());
+    m_constants << "const HashedName " << constName << "(";
+    WriteStringLiteral(m_constants, name);
+    m_constants << ");\n";
+    m_names[name] = constName;
+    return constName;
+}
+
+void WriteHeader(std::ostream& os, const Options& options, const std::string& templateName)
+{
+    os << "// Generated by jinja2cpp_codegen from '" << templateName << "'. Don't edit\n"
+       << "#pragma once\n\n"
+       << "#include <jinja2cpp/template.h>\n\n";
+    if (!options.namespaceName.empty())
+        os << "namespace " << options.namespaceName << "\n{\n";
+    os << "// Renders '" << templateName << "' with the specified params. Function is thread-safe\n"
+       << "jinja2::Result<std::string> " << options.functionName << "(const jinja2::ValuesMap& params);\n"
+       << "// Loaded template object (e.g. for the batch renders)\n"
+       << "jinja2::Template& " << options.functionName << "_template();\n";
+    if (!options.namespaceName.empty())
+        os << "} // " << options.namespaceName << "\n";
+}
+
+void WriteSource(std::ostream& os, const Options& options, const std::string& templateName, const std::string& source, const std::string& image,
+                 const CodeGenerator& generator, const std::string& renderFn)
+{
+    auto boolStr = [](bool val) { return val ? "true" : "false"; };
+
+    os << "// Generated by jinja2cpp_codegen from '" << templateName << "'. Don't edit\n"
+       << "#include \"" << GetFileName(options.headerPath) << "\"\n\n"
+       << "#include <generated_template.h>\n"
+       << "#include <jinja2cpp/template_env.h>\n\n"
+       << "namespace\n{\n"
+       << "using namespace jinja2;\n\n"
+       << "const char TemplateName[] = ";
+    WriteStringLiteral(os, templateName);
+    os << ";\n\nconst char TemplateSource[] =\n";
+    os << "    ";
+    WriteStringLiteral(os, source);
+    os << ";\n\nconst unsigned char TemplateImage[] = {";
+    WriteByteArray(os, image);
+    os << "};\n\n"
+       << generator.GetConstants() << "\n"
+       << generator.GetFunctions()
+       << "struct TemplateHolder\n{\n"
+       << "    TemplateHolder()\n    {\n"
+       << "        auto& settings = env.GetSettings();\n"
+       << "        settings.trimBlocks = " << boolStr(options.settings.trimBlocks) << ";\n"
+       << "        settings.lstripBlocks = " << boolStr(options.settings.lstripBlocks) << ";\n"
+       << "        settings.autoescape = " << boolStr(options.settings.autoescape) << ";\n"
+       << "        std::string source(TemplateSource, sizeof(TemplateSource) - 1);\n"
+       << "        std::string image(reinterpret_cast<const char*>(TemplateImage), sizeof(TemplateImage));\n"
+       << "        LoadGeneratedTemplate(tpl, image, source, TemplateName, &" << renderFn << ");\n"
+       << "    }\n\n"
+       << "    TemplateEnv env;\n"
+       << "    Template tpl{&env};\n"
+       << "};\n"
+       << "} // namespace\n\n";
+    if (!options.namespaceName.empty())
+        os << "namespace " << options.namespaceName << "\n{\n";
+    os << "jinja2::Template& " << options.functionName << "_template()\n{\n"
+       << "    static TemplateHolder holder;\n"
+       << "    return holder.tpl;\n"
+       << "}\n\n"
+       << "jinja2::Result<std::string> " << options.functionName << "(const jinja2::ValuesMap& params)\n{\n"
+       << "    return " << options.functionName << "_template().RenderAsString(params);\n"
+       << "}\n";
+    if (!options.namespaceName.empty())
+        os << "} // " << options.namespaceName << "\n";
+}
+
+bool WriteFile(const std::string& path, const std::string& content)
+{
+    std::ofstream os(path, std::ios::binary);
+    os << content;
+    return !!os;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::ifstream is(options.templatePath, std::ios::binary);
+    if (!is)
+    {
+        std::cerr << "Can't open template file '" << options.templatePath << "'" << std::endl;
+        return 1;
+    }
+    std::string source{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+    auto templateName = GetFileName(options.templatePath);
+
+    TemplateEnv env;
+    env.SetSettings(options.settings);
+    Template tpl(&env);
+    auto loadResult = tpl.Load(source, templateName);
+    if (!loadResult)
+    {
+        std::cerr << loadResult.error().ToString() << std::endl;
+        return 1;
+    }
+
+    std::string image;
+    auto saveResult = tpl.SaveCompiled(image);
+    if (!saveResult)
+    {
+        std::cerr << saveResult.error().ToString() << std::endl;
+        return 1;
+    }
+
+    // Code is generated for the tree loaded from the image, so the nodes it refers to are the same as the ones of the loaded template
+    Template compiled(&env);
+    auto compiledResult = compiled.LoadCompiled(image, source, templateName);
+    if (!compiledResult)
+    {
+        std::cerr << compiledResult.error().ToString() << std::endl;
+        return 1;
+    }
+
+    auto root = GetTemplateRenderer(compiled);
+    GeneratedTemplateNodes nodes(root);
+    CodeGenerator generator(nodes);
+    std::string renderFn;
+    try
+    {
+        renderFn = generator.Generate(root);
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    std::ostringstream header;
+    WriteHeader(header, options, templateName);
+    std::ostringstream sourceFile;
+    WriteSource(sourceFile, options, templateName, source, image, generator, renderFn);
+    if (!WriteFile(options.headerPath, header.str()) || !WriteFile(options.sourcePath, sourceFile.str()))
+    {
+        std::cerr << "Can't write the generated files" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
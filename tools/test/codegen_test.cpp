@@ -0,0 +1,58 @@
+#include "RenderCodegenTestTemplate.h"
+
+#include "gtest/gtest.h"
+
+#include "../../src/generated_template.h"
+
+#include <jinja2cpp/template.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace
+{
+std::string ReadTemplateSource()
+{
+    std::ifstream is(CODEGEN_TEST_TEMPLATE, std::ios::binary);
+    return std::string{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+}
+
+void CompareWithParsedTemplate(const jinja2::ValuesMap& params)
+{
+    auto source = ReadTemplateSource();
+    ASSERT_FALSE(source.empty());
+    jinja2::Template tpl;
+    ASSERT_TRUE(tpl.Load(source));
+
+    auto result = codegen_test::RenderCodegenTestTemplate(params);
+    ASSERT_TRUE(result.has_value()) << result.error().ToString();
+    EXPECT_EQ(tpl.RenderAsString(params).value(), result.value());
+}
+} // namespace
+
+TEST(CodegenTest, SameAsParsedTemplate)
+{
+    CompareWithParsedTemplate({{"title", "Items"},
+                               {"items", jinja2::ValuesList{"first", jinja2::Value(), "third", "fourth"}},
+                               {"offset", 5},
+                               {"info", jinja2::ValuesMap{{"name", "list"}, {"id", 10}}}});
+}
+
+TEST(CodegenTest, SameAsParsedTemplateWithEmptyLoop)
+{
+    CompareWithParsedTemplate({{"title", "Nothing"}, {"items", jinja2::ValuesList{}}, {"offset", 0}});
+}
+
+TEST(CodegenTest, TemplateIsLoadedOnce)
+{
+    EXPECT_EQ(&codegen_test::RenderCodegenTestTemplate_template(), &codegen_test::RenderCodegenTestTemplate_template());
+}
+
+// Generated function renders the template instead of the tree
+TEST(CodegenTest, TemplateIsRenderedByGeneratedCode)
+{
+    auto root = jinja2::GetTemplateRenderer(codegen_test::RenderCodegenTestTemplate_template());
+    ASSERT_NE(nullptr, root);
+    EXPECT_EQ(nullptr, dynamic_cast<jinja2::ComposedRenderer*>(root.get()));
+}